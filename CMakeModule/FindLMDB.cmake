@@ -0,0 +1,15 @@
+find_path(LMDB_INCLUDE_DIR NAMES lmdb.h)
+mark_as_advanced(LMDB_INCLUDE_DIR)
+
+find_library(LMDB_LIBRARY NAMES lmdb)
+mark_as_advanced(LMDB_LIBRARY)
+
+include(FindPackageHandleStandardArgs)
+FIND_PACKAGE_HANDLE_STANDARD_ARGS(
+        LMDB
+        REQUIRED_VARS LMDB_LIBRARY LMDB_INCLUDE_DIR)
+
+if (LMDB_FOUND)
+    set(LMDB_LIBRARIES ${LMDB_LIBRARY})
+    set(LMDB_INCLUDE_DIRS ${LMDB_INCLUDE_DIR})
+endif ()
@@ -321,6 +321,97 @@ AccountManager::QosMapMutexSharedPtr AccountManager::GetAllQosInfo() {
   return QosMapMutexSharedPtr{&m_qos_map_, &m_rw_qos_mutex_};
 }
 
+std::vector<std::string> AccountManager::GetAncestorAccounts(
+    const std::string& account) {
+  auto snapshot = m_account_snapshot_.load(std::memory_order_acquire);
+
+  std::vector<std::string> ancestors;
+  auto it = snapshot->accounts.find(account);
+  while (it != snapshot->accounts.end() &&
+         !it->second.parent_account.empty()) {
+    ancestors.emplace_back(it->second.parent_account);
+    it = snapshot->accounts.find(it->second.parent_account);
+  }
+
+  return ancestors;
+}
+
+void AccountManager::AddUsageOfEndedTasks(
+    const std::vector<TaskInCtld*>& tasks) {
+  if (g_config.PriorityConfig.DecayHalfLife == 0 || tasks.empty()) return;
+
+  absl::Time now = absl::Now();
+
+  util::read_lock_guard account_guard(m_rw_account_mutex_);
+  absl::MutexLock usage_lock(&m_usage_mtx_);
+
+  for (const TaskInCtld* task : tasks) {
+    // A task cancelled while pending has never started or got resources, and
+    // its start time may be unset or only an estimate.
+    if (task->StartTime() == absl::UnixEpoch() ||
+        task->allocated_res_view.IsZero() ||
+        task->EndTime() <= task->StartTime())
+      continue;
+
+    double usage =
+        static_cast<double>(task->allocated_res_view.CpuCount()) *
+        absl::ToDoubleSeconds(task->EndTime() - task->StartTime());
+    if (usage <= 0) continue;
+
+    ChargeUsageNoLock_("", usage, now);
+
+    // The usage of a deleted account still counts for its ancestors.
+    const Account* account = GetAccountInfoNoLock_(task->account);
+    while (account != nullptr) {
+      ChargeUsageNoLock_(account->name, usage, now);
+      if (account->parent_account.empty()) break;
+      account = GetAccountInfoNoLock_(account->parent_account);
+    }
+  }
+}
+
+double AccountManager::GetFairShareFactor(const std::string& account,
+                                          absl::Time now) {
+  // The accounts from the given one up to the top level, each with the number
+  // of accounts sharing its parent.
+  std::vector<std::pair<const std::string*, uint32_t>> path;
+
+  util::read_lock_guard account_guard(m_rw_account_mutex_);
+
+  const Account* acct = GetExistedAccountInfoNoLock_(account);
+  while (acct != nullptr) {
+    const Account* parent = nullptr;
+    uint32_t sibling_num = m_top_level_account_num_;
+    if (!acct->parent_account.empty()) {
+      parent = GetExistedAccountInfoNoLock_(acct->parent_account);
+      if (parent != nullptr) sibling_num = parent->child_accounts.size();
+    }
+
+    path.emplace_back(&acct->name, std::max(sibling_num, 1U));
+    acct = parent;
+  }
+
+  absl::MutexLock usage_lock(&m_usage_mtx_);
+
+  double total_usage = DecayedUsageNoLock_("", now);
+  if (path.empty() || total_usage <= 0) return 1.0;
+
+  // Walk down from the top level. The effective usage of an account is its
+  // own usage plus its share of the usage of its parent beyond the parent's
+  // own consumption, so that an account can't escape the over-consumption of
+  // its ancestors. The factor halves each time the effective usage exceeds
+  // the share of the account by the share itself.
+  double share = 1.0;
+  double effective_usage = 1.0;
+  for (const auto& [name, sibling_num] : path | std::views::reverse) {
+    double usage = DecayedUsageNoLock_(*name, now) / total_usage;
+    share /= sibling_num;
+    effective_usage = usage + (effective_usage - usage) / sibling_num;
+  }
+
+  return std::exp2(-effective_usage / share);
+}
+
 CraneExpected<std::vector<User>> AccountManager::QueryAllUserInfo(
     uint32_t uid) {
   std::vector<User> res_user_list;
@@ -796,6 +887,195 @@ CraneExpected<void> AccountManager::DeleteUserAllowedQos(
                                actual_account, partition, force);
 }
 
+std::expected<void, std::vector<CraneRichError>>
+AccountManager::BatchModifyUsers(uint32_t uid,
+                                 const std::vector<UserBatchOp>& ops) {
+  util::write_lock_guard user_guard(m_rw_user_mutex_);
+  util::write_lock_guard account_guard(m_rw_account_mutex_);
+  util::read_lock_guard qos_guard(m_rw_qos_mutex_);
+
+  auto user_result = GetUserInfoByUidNoLock_(uid);
+  if (!user_result)
+    return std::unexpected(
+        std::vector{FormatRichErr(user_result.error(), "")});
+  const User* op_user = user_result.value();
+  const std::string& actor_name = op_user->name;
+
+  // Later operations are validated against the records staged by the former
+  // ones. A staged user paired with true is added or re-added.
+  absl::flat_hash_map<std::string, std::pair<User, bool>> staged_users;
+  absl::flat_hash_map<std::string, Account> staged_accounts;
+  std::vector<Txn> txns;
+  std::vector<CraneRichError> errors;
+
+  auto get_user = [&](const std::string& name) -> const User* {
+    auto iter = staged_users.find(name);
+    if (iter != staged_users.end()) return &iter->second.first;
+    return GetUserInfoNoLock_(name);
+  };
+  auto add_txn = [&](const std::string& target, TxnAction action,
+                     std::string info) {
+    Txn& txn = txns.emplace_back();
+    txn.creation_time = ToUnixSeconds(absl::Now());
+    txn.actor = actor_name;
+    txn.target = target;
+    txn.action = action;
+    txn.info = std::move(info);
+  };
+
+  auto add_user = [&](const User& user) -> CraneExpected<void> {
+    auto result = CheckIfUserHasHigherPrivThan_(*op_user, user.admin_level);
+    if (!result) return result;
+
+    if (user.default_account.empty())
+      return std::unexpected(CraneErrCode::ERR_NO_ACCOUNT_SPECIFIED);
+
+    const std::string& object_account = user.default_account;
+    const User* stale_user = get_user(user.name);
+    if (stale_user && !stale_user->deleted &&
+        stale_user->account_to_attrs_map.contains(object_account))
+      return std::unexpected(CraneErrCode::ERR_USER_ALREADY_EXISTS);
+
+    const Account* account = GetExistedAccountInfoNoLock_(object_account);
+    if (!account) return std::unexpected(CraneErrCode::ERR_INVALID_ACCOUNT);
+
+    for (const auto& [partition, qos] :
+         user.account_to_attrs_map.at(object_account)
+             .allowed_partition_qos_map) {
+      result = CheckPartitionIsAllowedNoLock_(account, partition, false, true);
+      if (!result) return result;
+    }
+
+    User res_user = MergeNewUser_(user, *account, stale_user);
+    add_txn(user.name, TxnAction::AddUser, res_user.UserToString());
+    staged_users.insert_or_assign(user.name,
+                                  std::pair{std::move(res_user), true});
+
+    Account& staged_account =
+        staged_accounts.try_emplace(object_account, *account).first->second;
+    if (!ranges::contains(staged_account.users, user.name))
+      staged_account.users.emplace_back(user.name);
+    if (!user.coordinator_accounts.empty() &&
+        !ranges::contains(staged_account.coordinators, user.name))
+      staged_account.coordinators.emplace_back(user.name);
+
+    return {};
+  };
+
+  // Returns the staged copy of an existing user on which op_user may modify
+  // the account, which is replaced by the default account if empty.
+  auto stage_user = [&](const std::string& name, std::string* account,
+                        const Account** account_ptr) -> CraneExpected<User*> {
+    const User* user = get_user(name);
+    if (!user || user->deleted)
+      return std::unexpected(CraneErrCode::ERR_INVALID_USER);
+
+    auto result = CheckIfUserHasPermOnUserOfAccountNoLock_(*op_user, user,
+                                                           account, false);
+    if (!result) return std::unexpected(result.error());
+
+    *account_ptr = GetExistedAccountInfoNoLock_(*account);
+    if (!*account_ptr)
+      return std::unexpected(CraneErrCode::ERR_INVALID_ACCOUNT);
+
+    auto iter = staged_users.find(name);
+    if (iter == staged_users.end())
+      iter = staged_users.emplace(name, std::pair{*user, false}).first;
+    return &iter->second.first;
+  };
+
+  auto add_partition =
+      [&](const AddUserAllowedPartitionOp& op) -> CraneExpected<void> {
+    std::string account = op.account;
+    const Account* account_ptr = nullptr;
+    auto user = stage_user(op.username, &account, &account_ptr);
+    if (!user) return std::unexpected(user.error());
+
+    auto result = CheckAddUserAllowedPartitionNoLock_(
+        user.value(), account_ptr, op.partition);
+    if (!result) return result;
+
+    AddAllowedPartitionToUser_(user.value(), *account_ptr, op.partition);
+    add_txn(op.username, TxnAction::ModifyUser,
+            fmt::format("Add: account: {}, partition: {}", account,
+                        op.partition));
+    return {};
+  };
+
+  auto add_qos = [&](const AddUserAllowedQosOp& op) -> CraneExpected<void> {
+    std::string account = op.account;
+    const Account* account_ptr = nullptr;
+    auto user = stage_user(op.username, &account, &account_ptr);
+    if (!user) return std::unexpected(user.error());
+
+    auto result = CheckAddUserAllowedQosNoLock_(user.value(), account_ptr,
+                                                op.partition, op.qos);
+    if (!result) return result;
+
+    AddAllowedQosToUser_(user.value(), account, op.partition, op.qos);
+    add_txn(op.username, TxnAction::ModifyUser,
+            fmt::format("Add: account: {}, partition: {}, qos: {}", account,
+                        op.partition, op.qos));
+    return {};
+  };
+
+  for (size_t i = 0; i < ops.size(); i++) {
+    CraneExpected<void> result;
+    std::string target;
+    if (const auto* user = std::get_if<User>(&ops[i])) {
+      target = user->name;
+      result = add_user(*user);
+    } else if (const auto* partition_op =
+                   std::get_if<AddUserAllowedPartitionOp>(&ops[i])) {
+      target = partition_op->username;
+      result = add_partition(*partition_op);
+    } else {
+      const auto& qos_op = std::get<AddUserAllowedQosOp>(ops[i]);
+      target = qos_op.username;
+      result = add_qos(qos_op);
+    }
+
+    if (!result)
+      errors.emplace_back(FormatRichErr(result.error(), "{}: {}", i, target));
+  }
+
+  if (!errors.empty()) return std::unexpected(std::move(errors));
+  if (staged_users.empty()) return {};
+
+  std::vector<std::pair<const User*, bool>> users;
+  users.reserve(staged_users.size());
+  for (const auto& [name, staged] : staged_users)
+    users.emplace_back(&staged.first, staged.second);
+
+  bool ok = false;
+  mongocxx::client_session::with_transaction_cb callback =
+      [&](mongocxx::client_session* session) {
+        ok = g_db_client->UpsertUsers(users);
+        for (const auto& [name, account] : staged_accounts)
+          ok = ok && g_db_client->UpdateAccount(account);
+        ok = ok && g_db_client->InsertTxns(txns);
+
+        // Ending the transaction here keeps with_transaction from committing
+        // a part of the batch.
+        if (!ok) session->abort_transaction();
+      };
+
+  if (!g_db_client->CommitTransaction(callback) || !ok)
+    return std::unexpected(
+        std::vector{FormatRichErr(CraneErrCode::ERR_UPDATE_DATABASE, "")});
+
+  for (auto& [name, staged] : staged_users)
+    m_user_map_[name] = std::make_unique<User>(std::move(staged.first));
+  for (auto& [name, account] : staged_accounts) {
+    m_account_map_[name]->users = std::move(account.users);
+    m_account_map_[name]->coordinators = std::move(account.coordinators);
+  }
+
+  PublishUserSnapshotNoLock_();
+
+  return {};
+}
+
 CraneExpected<void> AccountManager::ModifyAccount(
     crane::grpc::OperationType operation_type, uint32_t uid,
     const std::string& name, crane::grpc::ModifyField modify_field,
@@ -1006,6 +1286,9 @@ CraneExpected<void> AccountManager::ModifyQos(
   case crane::grpc::ModifyField::MaxTimeLimitPerTask:
     item = "max_time_limit_per_task";
     break;
+  case crane::grpc::ModifyField::MaxCpusPerAccount:
+    item = "max_cpus_per_account";
+    break;
   default:
     std::unreachable();
   }
@@ -1109,12 +1392,18 @@ CraneExpected<void> AccountManager::BlockUser(uint32_t uid,
 CraneExpected<std::list<Txn>> AccountManager::QueryTxnList(
     uint32_t uid,
     const std::unordered_map<std::string, std::string>& conditions,
-    int64_t start_time, int64_t end_time) {
+    int64_t start_time, int64_t end_time, uint32_t limit,
+    const std::string& page_cursor, std::string* next_page_cursor) {
   auto result = CheckUidIsAdmin(uid);
   if (!result) return std::unexpected(result.error());
 
   std::list<Txn> txn_list;
-  g_db_client->SelectTxns(conditions, start_time, end_time, &txn_list);
+  if (!g_db_client->SelectTxns(conditions, start_time, end_time, limit,
+                               page_cursor, &txn_list, next_page_cursor)) {
+    if (!page_cursor.empty())
+      return std::unexpected(CraneErrCode::ERR_INVALID_PARAM);
+    return std::unexpected(CraneErrCode::ERR_GENERIC_FAILURE);
+  }
 
   return std::move(txn_list);
 }
@@ -1122,36 +1411,44 @@ CraneExpected<std::list<Txn>> AccountManager::QueryTxnList(
 bool AccountManager::CheckUserPermissionToPartition(
     const std::string& name, const std::string& account,
     const std::string& partition) {
-  UserMutexSharedPtr user_share_ptr = GetExistedUserInfo(name);
-  if (!user_share_ptr) return false;
+  auto snapshot = m_user_snapshot_.load(std::memory_order_acquire);
 
-  if (user_share_ptr->uid == 0 ||
-      user_share_ptr->account_to_attrs_map.at(account)
-          .allowed_partition_qos_map.contains(partition)) {
-    return true;
-  }
+  auto user_it = snapshot->users.find(name);
+  if (user_it == snapshot->users.end()) return false;
+  if (user_it->second.uid == 0) return true;
 
-  return false;
+  auto attrs_it = user_it->second.account_to_attrs_map.find(account);
+  if (attrs_it == user_it->second.account_to_attrs_map.end()) return false;
+
+  return attrs_it->second.allowed_partition_qos_map.contains(partition);
 }
 
 CraneExpected<void> AccountManager::CheckIfUserOfAccountIsEnabled(
     const std::string& user, const std::string& account) {
-  util::read_lock_guard user_guard(m_rw_user_mutex_);
-  util::read_lock_guard account_guard(m_rw_account_mutex_);
+  auto account_snapshot = m_account_snapshot_.load(std::memory_order_acquire);
+  auto user_snapshot = m_user_snapshot_.load(std::memory_order_acquire);
   std::string account_name = account;
 
   do {
-    const Account* account_ptr = GetExistedAccountInfoNoLock_(account_name);
-    if (account_ptr->blocked) {
-      CRANE_DEBUG("Ancestor account '{}' is blocked", account_ptr->name);
+    auto account_it = account_snapshot->accounts.find(account_name);
+    if (account_it == account_snapshot->accounts.end())
+      return std::unexpected(CraneErrCode::ERR_INVALID_ACCOUNT);
+    if (account_it->second.blocked) {
+      CRANE_DEBUG("Ancestor account '{}' is blocked", account_name);
       return std::unexpected(CraneErrCode::ERR_BLOCKED_ACCOUNT);
     }
-    account_name = account_ptr->parent_account;
+    account_name = account_it->second.parent_account;
   } while (!account_name.empty());
 
-  const User* user_ptr = GetExistedUserInfoNoLock_(user);
-  if (user_ptr->account_to_attrs_map.at(account).blocked) {
-    CRANE_DEBUG("User '{}' is blocked", user_ptr->name);
+  auto user_it = user_snapshot->users.find(user);
+  if (user_it == user_snapshot->users.end())
+    return std::unexpected(CraneErrCode::ERR_INVALID_USER);
+
+  auto attrs_it = user_it->second.account_to_attrs_map.find(account);
+  if (attrs_it == user_it->second.account_to_attrs_map.end())
+    return std::unexpected(CraneErrCode::ERR_USER_ACCOUNT_MISMATCH);
+  if (attrs_it->second.blocked) {
+    CRANE_DEBUG("User '{}' is blocked", user);
     return std::unexpected(CraneErrCode::ERR_BLOCKED_USER);
   }
   return {};
@@ -1159,10 +1456,10 @@ CraneExpected<void> AccountManager::CheckIfUserOfAccountIsEnabled(
 
 CraneExpected<void> AccountManager::CheckQosLimitOnTask(
     const std::string& user, const std::string& account, TaskInCtld* task) {
-  util::read_lock_guard user_guard(m_rw_user_mutex_);
+  auto snapshot = m_user_snapshot_.load(std::memory_order_acquire);
 
-  const User* user_share_ptr = GetExistedUserInfoNoLock_(user);
-  if (!user_share_ptr) {
+  auto user_it = snapshot->users.find(user);
+  if (user_it == snapshot->users.end()) {
     CRANE_ERROR(
         "The current user {} is not in the user list when submitting the task",
         user);
@@ -1170,10 +1467,13 @@ CraneExpected<void> AccountManager::CheckQosLimitOnTask(
   }
 
   if (task->uid != 0) {
-    auto partition_it = user_share_ptr->account_to_attrs_map.at(account)
-                            .allowed_partition_qos_map.find(task->partition_id);
-    if (partition_it == user_share_ptr->account_to_attrs_map.at(account)
-                            .allowed_partition_qos_map.end()) {
+    auto attrs_it = user_it->second.account_to_attrs_map.find(account);
+    if (attrs_it == user_it->second.account_to_attrs_map.end())
+      return std::unexpected(CraneErrCode::ERR_USER_ACCOUNT_MISMATCH);
+
+    const auto& partition_qos_map = attrs_it->second.allowed_partition_qos_map;
+    auto partition_it = partition_qos_map.find(task->partition_id);
+    if (partition_it == partition_qos_map.end()) {
       CRANE_ERROR(
           "This user {} does not have partition {} permission when submitting "
           "the task",
@@ -1209,31 +1509,42 @@ CraneExpected<void> AccountManager::CheckQosLimitOnTask(
 }
 
 CraneExpected<std::string> AccountManager::CheckUidIsAdmin(uint32_t uid) {
-  util::read_lock_guard user_guard(m_rw_user_mutex_);
-  auto user_result = GetUserInfoByUidNoLock_(uid);
-  if (!user_result) {
-    return std::unexpected(CraneErrCode::ERR_INVALID_USER);
-  }
-  const User* user_ptr = user_result.value();
+  auto resolved = ResolveUid_(uid);
+  if (!resolved) return std::unexpected(CraneErrCode::ERR_INVALID_USER);
 
-  if (user_ptr->admin_level >= User::Operator) return {};
+  if (resolved->admin_level >= User::Operator) return {};
 
   return std::unexpected(CraneErrCode::ERR_USER_NO_PRIVILEGE);
 }
 
 CraneExpected<void> AccountManager::CheckIfUidHasPermOnUser(
     uint32_t uid, const std::string& username, bool read_only_priv) {
-  util::read_lock_guard user_guard(m_rw_user_mutex_);
-  util::read_lock_guard account_guard(m_rw_account_mutex_);
+  auto resolved = ResolveUid_(uid);
+  if (!resolved) return std::unexpected(resolved.error());
 
-  auto user_result = GetUserInfoByUidNoLock_(uid);
-  if (!user_result) return std::unexpected(user_result.error());
+  auto user_snapshot = m_user_snapshot_.load(std::memory_order_acquire);
+  auto account_snapshot = m_account_snapshot_.load(std::memory_order_acquire);
 
-  const User* user = GetExistedUserInfoNoLock_(username);
-  if (!user) return std::unexpected(CraneErrCode::ERR_INVALID_USER);
+  auto op_user_it = user_snapshot->users.find(resolved->username);
+  if (op_user_it == user_snapshot->users.end())
+    return std::unexpected(CraneErrCode::ERR_INVALID_OP_USER);
+  const UserSnapshot::Item& op_user = op_user_it->second;
+
+  auto user_it = user_snapshot->users.find(username);
+  if (user_it == user_snapshot->users.end())
+    return std::unexpected(CraneErrCode::ERR_INVALID_USER);
+  const UserSnapshot::Item& user = user_it->second;
+
+  if (op_user.admin_level > user.admin_level || resolved->username == username)
+    return {};
 
-  return CheckIfUserHasPermOnUserNoLock_(*user_result.value(), user,
-                                         read_only_priv);
+  for (const auto& [acct, item] : user.account_to_attrs_map) {
+    if (HasPermOnAccountInSnapshot_(op_user, acct, *account_snapshot,
+                                    read_only_priv))
+      return {};
+  }
+
+  return std::unexpected(CraneErrCode::ERR_PERMISSION_USER);
 }
 
 CraneExpected<std::string> AccountManager::SignUserCertificate(
@@ -1766,6 +2077,8 @@ void AccountManager::InitDataMap_() {
   std::list<Account> account_list;
   g_db_client->SelectAllAccount(&account_list);
   for (auto& account : account_list) {
+    if (!account.deleted && account.parent_account.empty())
+      m_top_level_account_num_++;
     m_account_map_[account.name] = std::make_unique<Account>(account);
   }
 
@@ -1774,21 +2087,129 @@ void AccountManager::InitDataMap_() {
   for (auto& qos : qos_list) {
     m_qos_map_[qos.name] = std::make_unique<Qos>(qos);
   }
+
+  PublishUserSnapshotNoLock_();
+  PublishAccountSnapshotNoLock_();
 }
 
-CraneExpected<const User*> AccountManager::GetUserInfoByUidNoLock_(
+void AccountManager::PublishUserSnapshotNoLock_() {
+  auto snapshot = std::make_shared<UserSnapshot>();
+
+  auto last = m_user_snapshot_.load(std::memory_order_relaxed);
+  snapshot->version = last ? last->version + 1 : 0;
+
+  snapshot->users.reserve(m_user_map_.size());
+  for (const auto& [name, user] : m_user_map_) {
+    if (user->deleted) continue;
+    snapshot->users.emplace(
+        name,
+        UserSnapshot::Item{
+            .uid = user->uid,
+            .admin_level = user->admin_level,
+            .account_to_attrs_map = user->account_to_attrs_map,
+            .coordinator_accounts = user->coordinator_accounts});
+  }
+
+  m_user_snapshot_.store(std::move(snapshot), std::memory_order_release);
+  m_uid_cache_epoch_.fetch_add(1, std::memory_order_acq_rel);
+}
+
+void AccountManager::PublishAccountSnapshotNoLock_() {
+  auto snapshot = std::make_shared<AccountSnapshot>();
+
+  auto last = m_account_snapshot_.load(std::memory_order_relaxed);
+  snapshot->version = last ? last->version + 1 : 0;
+
+  snapshot->accounts.reserve(m_account_map_.size());
+  for (const auto& [name, account] : m_account_map_) {
+    if (account->deleted) continue;
+    snapshot->accounts.emplace(
+        name, AccountSnapshot::Item{.blocked = account->blocked,
+                                    .parent_account = account->parent_account});
+  }
+
+  m_account_snapshot_.store(std::move(snapshot), std::memory_order_release);
+  m_uid_cache_epoch_.fetch_add(1, std::memory_order_acq_rel);
+}
+
+CraneExpected<AccountManager::UidCacheEntry> AccountManager::ResolveUid_(
     uint32_t uid) {
-  PasswordEntry entry(uid);
+  // Read before the snapshot, so that an entry resolved from a snapshot
+  // published concurrently is never taken as valid for the newer epoch.
+  uint64_t epoch = m_uid_cache_epoch_.load(std::memory_order_acquire);
+  absl::Time now = absl::Now();
+  {
+    absl::ReaderMutexLock lock(&m_uid_cache_mtx_);
+    auto it = m_uid_cache_.find(uid);
+    if (it != m_uid_cache_.end() && it->second.epoch == epoch &&
+        now - it->second.resolve_time < absl::Seconds(kUidCacheExpireSec))
+      return it->second;
+  }
 
+  PasswordEntry entry(uid);
   if (!entry.Valid()) {
     CRANE_ERROR("Uid {} not existed", uid);
     return std::unexpected(CraneErrCode::ERR_INVALID_UID);
   }
 
-  const User* user = GetExistedUserInfoNoLock_(entry.Username());
+  auto snapshot = m_user_snapshot_.load(std::memory_order_acquire);
+  auto user_it = snapshot->users.find(entry.Username());
+  if (user_it == snapshot->users.end()) {
+    CRANE_ERROR("User '{}' is not a user of Crane", entry.Username());
+    return std::unexpected(CraneErrCode::ERR_INVALID_OP_USER);
+  }
+
+  UidCacheEntry resolved{.epoch = epoch,
+                         .resolve_time = now,
+                         .username = entry.Username(),
+                         .admin_level = user_it->second.admin_level};
+  {
+    absl::MutexLock lock(&m_uid_cache_mtx_);
+    m_uid_cache_.insert_or_assign(uid, resolved);
+  }
+
+  return resolved;
+}
+
+bool AccountManager::HasPermOnAccountInSnapshot_(
+    const UserSnapshot::Item& op_user, const std::string& account,
+    const AccountSnapshot& accounts, bool read_only_priv) {
+  if (!accounts.accounts.contains(account)) return false;
+  if (op_user.admin_level != User::None) return true;
+
+  // Whether acc is the account or one of its ancestors.
+  auto covers = [&](const std::string& acc) {
+    if (!accounts.accounts.contains(acc)) return false;
+    std::string name = account;
+    while (!name.empty()) {
+      if (name == acc) return true;
+      auto it = accounts.accounts.find(name);
+      if (it == accounts.accounts.end()) return false;
+      name = it->second.parent_account;
+    }
+    return false;
+  };
+
+  if (read_only_priv) {
+    for (const auto& [acc, item] : op_user.account_to_attrs_map)
+      if (covers(acc)) return true;
+  } else {
+    for (const auto& acc : op_user.coordinator_accounts)
+      if (covers(acc)) return true;
+  }
+
+  return false;
+}
+
+CraneExpected<const User*> AccountManager::GetUserInfoByUidNoLock_(
+    uint32_t uid) {
+  auto resolved = ResolveUid_(uid);
+  if (!resolved) return std::unexpected(resolved.error());
+
+  const User* user = GetExistedUserInfoNoLock_(resolved->username);
 
   if (!user) {
-    CRANE_ERROR("User '{}' is not a user of Crane", entry.Username());
+    CRANE_ERROR("User '{}' is not a user of Crane", resolved->username);
     return std::unexpected(CraneErrCode::ERR_INVALID_OP_USER);
   }
 
@@ -1846,47 +2267,90 @@ bool AccountManager::IncQosReferenceCountInDb_(const std::string& name,
                                       name, "reference_count", num);
 }
 
-CraneExpected<void> AccountManager::AddUser_(const std::string& actor_name,
-                                             const User& user,
-                                             const Account* account,
-                                             const User* stale_user) {
+User AccountManager::MergeNewUser_(const User& user, const Account& account,
+                                   const User* stale_user) {
   const std::string& object_account = user.default_account;
-  const std::string& name = user.name;
-
-  bool add_coordinator = false;
-  if (!user.coordinator_accounts.empty()) add_coordinator = true;
 
   User res_user;
   if (stale_user && !stale_user->deleted) {
     res_user = *stale_user;
     res_user.account_to_attrs_map[object_account] =
         user.account_to_attrs_map.at(object_account);
-    if (add_coordinator)
+    if (!user.coordinator_accounts.empty())
       res_user.coordinator_accounts.push_back(object_account);
   } else {
     res_user = user;
   }
 
-  const std::list<std::string>& parent_allowed_partition =
-      account->allowed_partition;
-  if (!res_user.account_to_attrs_map[object_account]
-           .allowed_partition_qos_map.empty()) {
-    for (auto&& [partition, qos] : res_user.account_to_attrs_map[object_account]
-                                       .allowed_partition_qos_map) {
-      qos.first = account->default_qos;
-      qos.second = account->allowed_qos_list;
+  auto& attrs = res_user.account_to_attrs_map[object_account];
+  if (!attrs.allowed_partition_qos_map.empty()) {
+    for (auto&& [partition, qos] : attrs.allowed_partition_qos_map) {
+      qos.first = account.default_qos;
+      qos.second = account.allowed_qos_list;
     }
   } else {
     // Inherit
-    for (const auto& partition : parent_allowed_partition) {
-      res_user.account_to_attrs_map[object_account]
-          .allowed_partition_qos_map[partition] =
+    for (const auto& partition : account.allowed_partition) {
+      attrs.allowed_partition_qos_map[partition] =
           std::pair<std::string, std::list<std::string>>{
-              account->default_qos,
-              std::list<std::string>{account->allowed_qos_list}};
+              account.default_qos,
+              std::list<std::string>{account.allowed_qos_list}};
     }
   }
-  res_user.account_to_attrs_map[object_account].blocked = false;
+  attrs.blocked = false;
+
+  return res_user;
+}
+
+void AccountManager::AddAllowedPartitionToUser_(User* user,
+                                                const Account& account,
+                                                const std::string& partition) {
+  user->account_to_attrs_map[account.name]
+      .allowed_partition_qos_map[partition] =
+      std::pair<std::string, std::list<std::string>>{
+          account.default_qos,
+          std::list<std::string>{account.allowed_qos_list}};
+}
+
+void AccountManager::AddAllowedQosToUser_(User* user,
+                                          const std::string& account,
+                                          const std::string& partition,
+                                          const std::string& qos) {
+  auto& partition_qos_map =
+      user->account_to_attrs_map[account].allowed_partition_qos_map;
+  if (partition.empty()) {
+    // add to all partition
+    for (auto& [par, pair] : partition_qos_map) {
+      std::list<std::string>& list = pair.second;
+      if (!ranges::contains(list, qos)) {
+        if (pair.first.empty()) {
+          pair.first = qos;
+        }
+        list.emplace_back(qos);
+      }
+    }
+  } else {
+    // add to exacted partition
+    auto iter = partition_qos_map.find(partition);
+    std::list<std::string>& list = iter->second.second;
+    if (iter->second.first.empty()) {
+      iter->second.first = qos;
+    }
+    list.push_back(qos);
+  }
+}
+
+CraneExpected<void> AccountManager::AddUser_(const std::string& actor_name,
+                                             const User& user,
+                                             const Account* account,
+                                             const User* stale_user) {
+  const std::string& object_account = user.default_account;
+  const std::string& name = user.name;
+
+  bool add_coordinator = false;
+  if (!user.coordinator_accounts.empty()) add_coordinator = true;
+
+  User res_user = MergeNewUser_(user, *account, stale_user);
 
   mongocxx::client_session::with_transaction_cb callback =
       [&](mongocxx::client_session* session) {
@@ -1925,6 +2389,8 @@ CraneExpected<void> AccountManager::AddUser_(const std::string& actor_name,
   }
   m_user_map_[name] = std::make_unique<User>(std::move(res_user));
 
+  PublishUserSnapshotNoLock_();
+
   return {};
 }
 
@@ -1987,12 +2453,16 @@ CraneExpected<void> AccountManager::AddAccount_(const std::string& actor_name,
   if (!res_account.parent_account.empty()) {
     m_account_map_[res_account.parent_account]->child_accounts.emplace_back(
         name);
+  } else {
+    m_top_level_account_num_++;
   }
   for (const auto& qos : res_account.allowed_qos_list) {
     m_qos_map_[qos]->reference_count++;
   }
   m_account_map_[name] = std::make_unique<Account>(std::move(res_account));
 
+  PublishAccountSnapshotNoLock_();
+
   return {};
 }
 
@@ -2101,6 +2571,8 @@ CraneExpected<void> AccountManager::DeleteUser_(const std::string& actor_name,
 
   m_user_map_[name] = std::make_unique<User>(std::move(res_user));
 
+  PublishUserSnapshotNoLock_();
+
   return {};
 }
 
@@ -2131,13 +2603,22 @@ CraneExpected<void> AccountManager::DeleteAccount_(
 
   if (!account.parent_account.empty()) {
     m_account_map_[account.parent_account]->child_accounts.remove(name);
+  } else {
+    m_top_level_account_num_--;
   }
   m_account_map_[name]->deleted = true;
 
+  {
+    absl::MutexLock usage_lock(&m_usage_mtx_);
+    m_account_usage_map_.erase(name);
+  }
+
   for (const auto& qos : account.allowed_qos_list) {
     m_qos_map_[qos]->reference_count--;
   }
 
+  PublishAccountSnapshotNoLock_();
+
   return {};
 }
 
@@ -2165,13 +2646,7 @@ CraneExpected<void> AccountManager::AddUserAllowedPartition_(
   const std::string& account_name = account.name;
 
   User res_user(user);
-
-  // Update the map
-  res_user.account_to_attrs_map[account_name]
-      .allowed_partition_qos_map[partition] =
-      std::pair<std::string, std::list<std::string>>{
-          account.default_qos,
-          std::list<std::string>{account.allowed_qos_list}};
+  AddAllowedPartitionToUser_(&res_user, account, partition);
 
   // Update to database
   mongocxx::client_session::with_transaction_cb callback =
@@ -2190,6 +2665,8 @@ CraneExpected<void> AccountManager::AddUserAllowedPartition_(
       .allowed_partition_qos_map =
       res_user.account_to_attrs_map[account_name].allowed_partition_qos_map;
 
+  PublishUserSnapshotNoLock_();
+
   return {};
 }
 
@@ -2200,29 +2677,7 @@ CraneExpected<void> AccountManager::AddUserAllowedQos_(
   const std::string& account_name = account.name;
 
   User res_user(user);
-
-  if (partition.empty()) {
-    // add to all partition
-    for (auto& [par, pair] : res_user.account_to_attrs_map[account_name]
-                                 .allowed_partition_qos_map) {
-      std::list<std::string>& list = pair.second;
-      if (!ranges::contains(list, qos)) {
-        if (pair.first.empty()) {
-          pair.first = qos;
-        }
-        list.emplace_back(qos);
-      }
-    }
-  } else {
-    // add to exacted partition
-    auto iter = res_user.account_to_attrs_map[account_name]
-                    .allowed_partition_qos_map.find(partition);
-    std::list<std::string>& list = iter->second.second;
-    if (iter->second.first.empty()) {
-      iter->second.first = qos;
-    }
-    list.push_back(qos);
-  }
+  AddAllowedQosToUser_(&res_user, account_name, partition, qos);
 
   // Update to database
   mongocxx::client_session::with_transaction_cb callback =
@@ -2242,6 +2697,8 @@ CraneExpected<void> AccountManager::AddUserAllowedQos_(
       .allowed_partition_qos_map =
       res_user.account_to_attrs_map[account_name].allowed_partition_qos_map;
 
+  PublishUserSnapshotNoLock_();
+
   return {};
 }
 
@@ -2265,6 +2722,8 @@ CraneExpected<void> AccountManager::SetUserAdminLevel_(
 
   m_user_map_[name]->admin_level = new_level;
 
+  PublishUserSnapshotNoLock_();
+
   return {};
 }
 
@@ -2327,6 +2786,8 @@ CraneExpected<void> AccountManager::SetUserDefaultQos_(
   m_user_map_[name]->account_to_attrs_map[account].allowed_partition_qos_map =
       res_user.account_to_attrs_map[account].allowed_partition_qos_map;
 
+  PublishUserSnapshotNoLock_();
+
   return {};
 }
 
@@ -2366,6 +2827,8 @@ CraneExpectedRich<void> AccountManager::SetUserAllowedPartition_(
       .allowed_partition_qos_map =
       res_user.account_to_attrs_map[account_name].allowed_partition_qos_map;
 
+  PublishUserSnapshotNoLock_();
+
   return {};
 }
 
@@ -2417,6 +2880,8 @@ CraneExpectedRich<void> AccountManager::SetUserAllowedQos_(
       .allowed_partition_qos_map =
       res_user.account_to_attrs_map[account_name].allowed_partition_qos_map;
 
+  PublishUserSnapshotNoLock_();
+
   return {};
 }
 
@@ -2446,6 +2911,8 @@ CraneExpected<void> AccountManager::DeleteUserAllowedPartition_(
       ->account_to_attrs_map[account]
       .allowed_partition_qos_map.erase(partition);
 
+  PublishUserSnapshotNoLock_();
+
   return {};
 }
 
@@ -2497,6 +2964,8 @@ CraneExpected<void> AccountManager::DeleteUserAllowedQos_(
   m_user_map_[name]->account_to_attrs_map[account].allowed_partition_qos_map =
       res_user.account_to_attrs_map[account].allowed_partition_qos_map;
 
+  PublishUserSnapshotNoLock_();
+
   return {};
 }
 
@@ -2640,6 +3109,8 @@ CraneExpectedRich<void> AccountManager::SetAccountAllowedPartition_(
       std::make_move_iterator(partition_list.begin()),
       std::make_move_iterator(partition_list.end()));
 
+  PublishUserSnapshotNoLock_();
+
   return {};
 }
 
@@ -2712,6 +3183,8 @@ CraneExpectedRich<void> AccountManager::SetAccountAllowedQos_(
     }
   }
 
+  PublishUserSnapshotNoLock_();
+
   return {};
 }
 
@@ -2731,6 +3204,8 @@ CraneExpected<void> AccountManager::DeleteAccountAllowedPartition_(
 
   DeleteAccountAllowedPartitionFromMapNoLock_(account.name, partition);
 
+  PublishUserSnapshotNoLock_();
+
   return {};
 }
 
@@ -2753,6 +3228,8 @@ CraneExpected<void> AccountManager::DeleteAccountAllowedQos_(
   DeleteAccountAllowedQosFromMapNoLock_(account.name, qos);
   m_qos_map_[qos]->reference_count -= change_num;
 
+  PublishUserSnapshotNoLock_();
+
   return {};
 }
 
@@ -2775,6 +3252,8 @@ CraneExpected<void> AccountManager::BlockUserNoLock_(
 
   m_user_map_[name]->account_to_attrs_map[account].blocked = block;
 
+  PublishUserSnapshotNoLock_();
+
   return {};
 }
 
@@ -2794,6 +3273,8 @@ CraneExpected<void> AccountManager::BlockAccountNoLock_(
 
   m_account_map_[name]->blocked = block;
 
+  PublishAccountSnapshotNoLock_();
+
   return {};
 }
 
@@ -3102,4 +3583,29 @@ bool AccountManager::PaternityTestNoLockDFS_(const std::string& parent,
   return false;
 }
 
+void AccountManager::ChargeUsageNoLock_(const std::string& account,
+                                        double usage, absl::Time now) {
+  DecayedUsageNoLock_(account, now);
+
+  AccountUsage& node = m_account_usage_map_[account];
+  node.usage += usage;
+  node.last_decay_time = now;
+}
+
+double AccountManager::DecayedUsageNoLock_(const std::string& account,
+                                           absl::Time now) {
+  auto it = m_account_usage_map_.find(account);
+  if (it == m_account_usage_map_.end()) return 0;
+
+  AccountUsage& node = it->second;
+  if (now > node.last_decay_time) {
+    double half_lives = absl::ToDoubleSeconds(now - node.last_decay_time) /
+                        g_config.PriorityConfig.DecayHalfLife;
+    node.usage *= std::exp2(-half_lives);
+    node.last_decay_time = now;
+  }
+
+  return node.usage;
+}
+
 }  // namespace Ctld
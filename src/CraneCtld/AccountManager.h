@@ -82,6 +82,23 @@ class AccountManager {
   QosMutexSharedPtr GetExistedQosInfo(const std::string& name);
   QosMapMutexSharedPtr GetAllQosInfo();
 
+  // The ancestors of an account from its parent to the root, read from the
+  // account snapshot without any lock.
+  std::vector<std::string> GetAncestorAccounts(const std::string& account);
+
+  /* ---------------------------------------------------------------------------
+   * Fair-share usage
+   * ---------------------------------------------------------------------------
+   */
+  // Charges the cpu-seconds consumed by ended tasks to their accounts and all
+  // the ancestors of the accounts. No-op if usage decay is not configured.
+  void AddUsageOfEndedTasks(const std::vector<TaskInCtld*>& tasks);
+
+  // Returns the fair-share factor in [0, 1] of an account computed from the
+  // decayed usage along its path in the account hierarchy, where siblings
+  // share their parent equally. The cost is linear in the depth of account.
+  double GetFairShareFactor(const std::string& account, absl::Time now);
+
   /* ---------------------------------------------------------------------------
    * ModifyUser-related functions
    * ---------------------------------------------------------------------------
@@ -125,6 +142,30 @@ class AccountManager {
       uint32_t uid, const std::string& name, const std::string& partition,
       const std::string& account, const std::string& value, bool force);
 
+  struct AddUserAllowedPartitionOp {
+    std::string username;
+    std::string account;
+    std::string partition;
+  };
+
+  struct AddUserAllowedQosOp {
+    std::string username;
+    std::string account;
+    std::string partition;
+    std::string qos;
+  };
+
+  // Adding a user, or an allowed partition or qos of a user.
+  using UserBatchOp =
+      std::variant<User, AddUserAllowedPartitionOp, AddUserAllowedQosOp>;
+
+  // Validates the operations in order, each one on top of the ones before it,
+  // and commits all of them in one transaction under a single acquisition of
+  // the locks. Nothing is applied if any operation is invalid, and the error
+  // of each invalid one is described with its index.
+  std::expected<void, std::vector<CraneRichError>> BatchModifyUsers(
+      uint32_t uid, const std::vector<UserBatchOp>& ops);
+
   CraneExpected<void> ModifyAccount(crane::grpc::OperationType operation_type,
                                     uint32_t uid, const std::string& name,
                                     crane::grpc::ModifyField modify_field,
@@ -149,10 +190,13 @@ class AccountManager {
   CraneExpected<void> BlockUser(uint32_t uid, const std::string& name,
                                 const std::string& account, bool block);
 
+  // Returns a page of at most limit txns after page_cursor, newest first.
+  // next_page_cursor is left empty on the last page.
   CraneExpected<std::list<Txn>> QueryTxnList(
       uint32_t uid,
       const std::unordered_map<std::string, std::string>& conditions,
-      int64_t start_time, int64_t end_time);
+      int64_t start_time, int64_t end_time, uint32_t limit,
+      const std::string& page_cursor, std::string* next_page_cursor);
 
   bool CheckUserPermissionToPartition(const std::string& name,
                                       const std::string& account,
@@ -183,8 +227,66 @@ class AccountManager {
                                            const std::string& username);
 
  private:
+  // Usage is decayed lazily when it is charged or read.
+  struct AccountUsage {
+    double usage{0};
+    absl::Time last_decay_time;
+  };
+
+  // Immutable copies of the fields read by the submit-time checks, so that
+  // CheckUserPermissionToPartition, CheckIfUserOfAccountIsEnabled and
+  // CheckQosLimitOnTask take no lock of the maps, nor do CheckUidIsAdmin and
+  // CheckIfUidHasPermOnUser on the hot RPCs. A new snapshot is published
+  // after each committed modification while the write lock of the modified
+  // map is still held, so the versions of a snapshot only grow.
+  struct UserSnapshot {
+    struct Item {
+      uid_t uid;
+      User::AdminLevel admin_level;
+      User::AccountToAttrsMap account_to_attrs_map;
+      std::list<std::string> coordinator_accounts;
+    };
+
+    uint64_t version{0};
+    // Only the undeleted users.
+    absl::flat_hash_map<std::string /*user name*/, Item> users;
+  };
+
+  struct AccountSnapshot {
+    struct Item {
+      bool blocked;
+      std::string parent_account;
+    };
+
+    uint64_t version{0};
+    // Only the undeleted accounts.
+    absl::flat_hash_map<std::string /*account name*/, Item> accounts;
+  };
+
+  // A uid resolved through the passwd database and the user snapshot. It's
+  // valid until m_uid_cache_epoch_ changes or kUidCacheExpireSec passes.
+  struct UidCacheEntry {
+    uint64_t epoch;
+    absl::Time resolve_time;
+    std::string username;
+    User::AdminLevel admin_level;
+  };
+
   void InitDataMap_();
 
+  CraneExpected<UidCacheEntry> ResolveUid_(uint32_t uid);
+
+  // The snapshot counterpart of CheckIfUserHasPermOnAccountNoLock_().
+  static bool HasPermOnAccountInSnapshot_(const UserSnapshot::Item& op_user,
+                                          const std::string& account,
+                                          const AccountSnapshot& accounts,
+                                          bool read_only_priv);
+
+  // Require the write lock of m_rw_user_mutex_.
+  void PublishUserSnapshotNoLock_();
+  // Require the write lock of m_rw_account_mutex_.
+  void PublishAccountSnapshotNoLock_();
+
   CraneExpected<const User*> GetUserInfoByUidNoLock_(uint32_t uid);
 
   const User* GetUserInfoNoLock_(const std::string& name);
@@ -283,6 +385,16 @@ class AccountManager {
 
   bool IncQosReferenceCountInDb_(const std::string& name, int num);
 
+  // The records resulting from adding a user or an allowed partition or qos
+  // of a user, shared by the single and the batched modifications.
+  static User MergeNewUser_(const User& user, const Account& account,
+                            const User* stale_user);
+  static void AddAllowedPartitionToUser_(User* user, const Account& account,
+                                         const std::string& partition);
+  static void AddAllowedQosToUser_(User* user, const std::string& account,
+                                   const std::string& partition,
+                                   const std::string& qos);
+
   CraneExpected<void> AddUser_(const std::string& actor_name, const User& user,
                                const Account* account, const User* stale_user);
 
@@ -409,14 +521,35 @@ class AccountManager {
   bool PaternityTestNoLockDFS_(const std::string& parent,
                                const std::string& child);
 
+  void ChargeUsageNoLock_(const std::string& account, double usage,
+                          absl::Time now);
+  double DecayedUsageNoLock_(const std::string& account, absl::Time now);
+
   std::unordered_map<std::string /*account name*/, std::unique_ptr<Account>>
       m_account_map_;
-  util::rw_mutex m_rw_account_mutex_;
+  // Number of the undeleted accounts without a parent.
+  uint32_t m_top_level_account_num_{0};
+  util::rw_mutex m_rw_account_mutex_{"account_map"};
   std::unordered_map<std::string /*user name*/, std::unique_ptr<User>>
       m_user_map_;
-  util::rw_mutex m_rw_user_mutex_;
+  util::rw_mutex m_rw_user_mutex_{"user_map"};
   std::unordered_map<std::string /*Qos name*/, std::unique_ptr<Qos>> m_qos_map_;
-  util::rw_mutex m_rw_qos_mutex_;
+  util::rw_mutex m_rw_qos_mutex_{"qos_map"};
+
+  std::atomic<std::shared_ptr<const UserSnapshot>> m_user_snapshot_;
+  std::atomic<std::shared_ptr<const AccountSnapshot>> m_account_snapshot_;
+
+  // Bumped after each published snapshot of the users or the accounts.
+  std::atomic<uint64_t> m_uid_cache_epoch_{0};
+  absl::flat_hash_map<uid_t, UidCacheEntry> m_uid_cache_
+      ABSL_GUARDED_BY(m_uid_cache_mtx_);
+  absl::Mutex m_uid_cache_mtx_;
+
+  // The usage of all the accounts is kept under the empty name.
+  // Locked after m_rw_account_mutex_.
+  absl::flat_hash_map<std::string /*account name*/, AccountUsage>
+      m_account_usage_map_ ABSL_GUARDED_BY(m_usage_mtx_);
+  absl::Mutex m_usage_mtx_;
 };
 
 }  // namespace Ctld
@@ -23,57 +23,46 @@
 namespace Ctld {
 
 CraneErrCode AccountMetaContainer::TryMallocQosResource(TaskInCtld& task) {
-  auto qos = g_account_manager->GetExistedQosInfo(task.qos);
-  if (!qos) {
-    CRANE_ERROR("Unknown QOS '{}'", task.qos);
-    return CraneErrCode::ERR_INVALID_QOS;
+  QosLimits limits;
+  {
+    auto qos = g_account_manager->GetExistedQosInfo(task.qos);
+    if (!qos) {
+      CRANE_ERROR("Unknown QOS '{}'", task.qos);
+      return CraneErrCode::ERR_INVALID_QOS;
+    }
+
+    if (static_cast<double>(task.cpus_per_task) * task.node_num >
+        qos->max_cpus_per_user)
+      return CraneErrCode::ERR_CPUS_PER_TASK_BEYOND;
+
+    if (qos->max_jobs_per_user == 0)
+      return CraneErrCode::ERR_MAX_JOB_COUNT_PER_USER;
+
+    task.qos_priority = qos->priority;
+
+    if (task.time_limit >= absl::Seconds(kTaskMaxTimeLimitSec)) {
+      task.time_limit = qos->max_time_limit_per_task;
+    } else if (task.time_limit > qos->max_time_limit_per_task) {
+      CRANE_WARN("time-limit beyond the user's limit");
+      return CraneErrCode::ERR_TIME_TIMIT_BEYOND;
+    }
+
+    limits = QosLimits{.max_jobs_per_user = qos->max_jobs_per_user,
+                       .max_cpus_per_user = double(qos->max_cpus_per_user),
+                       .max_cpus_per_account =
+                           double(qos->max_cpus_per_account)};
   }
 
-  if (static_cast<double>(task.cpus_per_task) * task.node_num >
-      qos->max_cpus_per_user)
-    return CraneErrCode::ERR_CPUS_PER_TASK_BEYOND;
+  auto handle = m_counter_tree_.Find(task.Username(), task.account, task.qos);
+  if (!handle)
+    handle = m_counter_tree_.Resolve(
+        task.Username(), task.account, task.qos,
+        g_account_manager->GetAncestorAccounts(task.account));
 
-  if (qos->max_jobs_per_user == 0)
-    return CraneErrCode::ERR_MAX_JOB_COUNT_PER_USER;
-
-  task.qos_priority = qos->priority;
-
-  if (task.time_limit >= absl::Seconds(kTaskMaxTimeLimitSec)) {
-    task.time_limit = qos->max_time_limit_per_task;
-  } else if (task.time_limit > qos->max_time_limit_per_task) {
-    CRANE_WARN("time-limit beyond the user's limit");
-    return CraneErrCode::ERR_TIME_TIMIT_BEYOND;
-  }
-
-  CraneErrCode result = CraneErrCode::SUCCESS;
-
-  ResourceView resource_view{task.requested_node_res_view * task.node_num};
-
-  user_meta_map_.try_emplace_l(
-      task.Username(),
-      [&](std::pair<const std::string, QosToResourceMap>& pair) {
-        auto& qos_to_resource_map = pair.second;
-        auto iter = qos_to_resource_map.find(task.qos);
-        if (iter == qos_to_resource_map.end()) {
-          qos_to_resource_map.emplace(task.qos,
-                                      QosResource{std::move(resource_view), 1});
-          return;
-        }
-
-        auto& val = iter->second;
-        if (val.resource.CpuCount() + resource_view.CpuCount() >
-            qos->max_cpus_per_user) {
-          result = CraneErrCode::ERR_CPUS_PER_TASK_BEYOND;
-          return;
-        }
-        if (val.jobs_per_user + 1 > qos->max_jobs_per_user) {
-          result = CraneErrCode::ERR_MAX_JOB_COUNT_PER_USER;
-          return;
-        }
-        val.resource.GetAllocatableRes() += resource_view.GetAllocatableRes();
-        val.jobs_per_user++;
-      },
-      QosToResourceMap{{task.qos, QosResource{std::move(resource_view), 1}}});
+  double cpus = (task.requested_node_res_view * task.node_num).CpuCount();
+  CraneErrCode result = QosCounterTree::TryReserve(*handle, limits, cpus);
+  if (result == CraneErrCode::SUCCESS)
+    task.qos_counter_handle = std::move(handle);
 
   CRANE_DEBUG("Malloc QOS resource for task {} of user {}. Ok: {}",
               task.TaskId(), task.Username(), result == CraneErrCode::SUCCESS);
@@ -85,22 +74,14 @@ void AccountMetaContainer::FreeQosResource(const TaskInCtld& task) {
   CRANE_DEBUG("Free QOS resource for task {} of user {}", task.TaskId(),
               task.Username());
 
-  ResourceView resource_view{task.requested_node_res_view * task.node_num};
-
-  user_meta_map_.modify_if(
-      task.Username(),
-      [&](std::pair<const std::string, QosToResourceMap>& pair) {
-        auto& val = pair.second[task.qos];
-        CRANE_ASSERT(val.jobs_per_user > 0);
-        CRANE_ASSERT((resource_view).GetAllocatableRes() <=
-                     val.resource.GetAllocatableRes());
-        val.resource.GetAllocatableRes() -= (resource_view).GetAllocatableRes();
-        val.jobs_per_user--;
-      });
+  if (!task.qos_counter_handle) return;
+
+  double cpus = (task.requested_node_res_view * task.node_num).CpuCount();
+  QosCounterTree::Release(*task.qos_counter_handle, cpus);
 }
 
 void AccountMetaContainer::DeleteUserResource(const std::string& username) {
-  user_meta_map_.erase(username);
+  m_counter_tree_.EraseUser(username);
 }
 
 }  // namespace Ctld
\ No newline at end of file
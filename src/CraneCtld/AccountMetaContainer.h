@@ -21,23 +21,19 @@
 #include "CtldPublicDefs.h"
 // Precompiled header comes first!
 
+#include "QosCounter.h"
+
 namespace Ctld {
 
+// Enforces the per-user limits of the QoS and the per-account limit at every
+// level of the account hierarchy. See QosCounterTree.
 class AccountMetaContainer final {
  public:
-  using QosToResourceMap = std::unordered_map<std::string,  // qos_name
-                                              QosResource>;
-
-  using UserResourceMetaMap = phmap::parallel_flat_hash_map<
-      std::string,  // username
-      QosToResourceMap, phmap::priv::hash_default_hash<std::string>,
-      phmap::priv::hash_default_eq<std::string>,
-      std::allocator<std::pair<const std::string, QosToResourceMap>>, 4,
-      std::shared_mutex>;
-
   AccountMetaContainer() = default;
   ~AccountMetaContainer() = default;
 
+  // On success, the counters charged by task are kept in
+  // task.qos_counter_handle.
   CraneErrCode TryMallocQosResource(TaskInCtld& task);
 
   void FreeQosResource(const TaskInCtld& task);
@@ -45,7 +41,7 @@ class AccountMetaContainer final {
   void DeleteUserResource(const std::string& username);
 
  private:
-  UserResourceMetaMap user_meta_map_;
+  QosCounterTree m_counter_tree_;
 };
 
 inline std::unique_ptr<Ctld::AccountMetaContainer> g_account_meta_container;
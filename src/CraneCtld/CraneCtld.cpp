@@ -32,9 +32,15 @@
 #include "CtldPublicDefs.h"
 #include "DbClient.h"
 #include "EmbeddedDbClient.h"
+#include "JobArchive.h"
+#include "MongodbJobWriter.h"
+#include "QueryReplication.h"
 #include "RpcService/CranedKeeper.h"
 #include "RpcService/CtldGrpcServer.h"
+#include "SchedulerStats.h"
 #include "Security/VaultClient.h"
+#include "StepPayloadDedup.h"
+#include "TaskEventHub.h"
 #include "TaskScheduler.h"
 #include "crane/Network.h"
 #include "crane/PluginClient.h"
@@ -43,10 +49,24 @@ void ParseCtldConfig(const YAML::Node& config) {
   using util::YamlValueOr;
   Ctld::Config::CraneCtldConf ctld_config{};
   ctld_config.CranedTimeout = kCranedTimeoutSec;
+  ctld_config.CranedConnectWindow = kConcurrentStreamQuota;
+  ctld_config.CranedConnectMinBackoffMs = kDefaultCranedConnectMinBackoffMs;
+  ctld_config.CranedConnectMaxBackoffMs = kDefaultCranedConnectMaxBackoffMs;
   if (config["CraneCtld"]) {
     auto ctld_cfg = config["CraneCtld"];
     if (ctld_cfg["CranedTimeout"])
       ctld_config.CranedTimeout = ctld_cfg["CranedTimeout"].as<uint32_t>();
+    ctld_config.CranedConnectWindow = std::max(
+        YamlValueOr<uint32_t>(ctld_cfg["CranedConnectWindow"],
+                              kConcurrentStreamQuota),
+        1u);
+    ctld_config.CranedConnectMinBackoffMs =
+        YamlValueOr<uint32_t>(ctld_cfg["CranedConnectMinBackoffMs"],
+                              kDefaultCranedConnectMinBackoffMs);
+    ctld_config.CranedConnectMaxBackoffMs = std::max(
+        YamlValueOr<uint32_t>(ctld_cfg["CranedConnectMaxBackoffMs"],
+                              kDefaultCranedConnectMaxBackoffMs),
+        ctld_config.CranedConnectMinBackoffMs);
   }
   g_config.CtldConf = std::move(ctld_config);
 }
@@ -65,6 +85,9 @@ void ParseConfig(int argc, char** argv) {
       cxxopts::value<std::string>()->default_value("0.0.0.0"))
       ("p,port", "Listening port, format: <IP>:<port>",
       cxxopts::value<std::string>()->default_value(kCtldDefaultPort))
+      ("replica-of", "Serve queries as a read replica of the CraneCtld on "
+                     "the host",
+      cxxopts::value<std::string>())
       ("v,version", "Display version information")
       ("h,help", "Display help for CraneCtld")
       ;
@@ -109,10 +132,18 @@ void ParseConfig(int argc, char** argv) {
       g_config.CraneCtldDebugLevel =
           YamlValueOr(config["CraneCtldDebugLevel"], "info");
 
+      LogQueueOptions log_queue_options{
+          .size = YamlValueOr<uint32_t>(config["LogQueueSize"],
+                                        kDefaultLogQueueSize),
+          .drop_on_full = YamlValueOr<std::string>(
+                              config["LogQueueFullPolicy"], "Block") == "Drop",
+      };
+
       // spdlog should be initialized as soon as possible
       std::optional log_level = StrToLogLevel(g_config.CraneCtldDebugLevel);
       if (log_level.has_value()) {
-        InitLogger(log_level.value(), g_config.CraneCtldLogFile, true);
+        InitLogger(log_level.value(), g_config.CraneCtldLogFile, true,
+                   log_queue_options);
       } else {
         fmt::print(stderr, "Illegal debug-level format.");
         std::exit(1);
@@ -234,10 +265,9 @@ void ParseConfig(int argc, char** argv) {
       g_config.CranedListenConf.CranedListenPort =
           YamlValueOr(config["CranedListenPort"], kCranedDefaultPort);
 
-      g_config.PriorityConfig.MaxAge = kPriorityDefaultMaxAge;
-      if (config["PriorityMaxAge"]) {
-        std::string max_age = config["PriorityMaxAge"].as<std::string>();
-
+      // Accepts [days-]hours:minutes:seconds, days-hours and minutes.
+      auto parse_priority_duration = [](const std::string& duration,
+                                        uint64_t* seconds) {
         std::regex pattern_hour_min_sec(R"((\d+):(\d+):(\d+))");
         std::regex pattern_day_hour(R"((\d+)-(\d+))");
         std::regex pattern_min(R"((\d+))");
@@ -245,35 +275,45 @@ void ParseConfig(int argc, char** argv) {
         std::smatch matches;
 
         uint64_t day, hour, minute, second;
-        if (std::regex_match(max_age, matches, pattern_hour_min_sec)) {
+        if (std::regex_match(duration, matches, pattern_hour_min_sec)) {
           hour = std::stoi(matches[1]);
           minute = std::stoi(matches[2]);
           second = std::stoi(matches[3]);
 
-          g_config.PriorityConfig.MaxAge = hour * 3600 + minute * 60 + second;
-        } else if (std::regex_match(max_age, matches, pattern_day_hour)) {
+          *seconds = hour * 3600 + minute * 60 + second;
+        } else if (std::regex_match(duration, matches, pattern_day_hour)) {
           day = std::stoi(matches[1]);
           hour = std::stoi(matches[2]);
 
-          g_config.PriorityConfig.MaxAge = day * 24 * 3600 + hour * 3600;
-        } else if (std::regex_match(max_age, pattern_min)) {
-          minute = std::stoi(max_age);
+          *seconds = day * 24 * 3600 + hour * 3600;
+        } else if (std::regex_match(duration, pattern_min)) {
+          minute = std::stoi(duration);
 
-          g_config.PriorityConfig.MaxAge = minute * 60;
-        } else if (std::regex_match(max_age, pattern_day_hour_min_sec)) {
+          *seconds = minute * 60;
+        } else if (std::regex_match(duration, matches,
+                                    pattern_day_hour_min_sec)) {
           day = std::stoi(matches[1]);
           hour = std::stoi(matches[2]);
           minute = std::stoi(matches[3]);
           second = std::stoi(matches[4]);
 
-          g_config.PriorityConfig.MaxAge =
-              day * 24 * 3600 + hour * 3600 + minute * 60 + second;
+          *seconds = day * 24 * 3600 + hour * 3600 + minute * 60 + second;
         }
+      };
 
+      g_config.PriorityConfig.MaxAge = kPriorityDefaultMaxAge;
+      if (config["PriorityMaxAge"]) {
+        parse_priority_duration(config["PriorityMaxAge"].as<std::string>(),
+                                &g_config.PriorityConfig.MaxAge);
         g_config.PriorityConfig.MaxAge =
             std::min(g_config.PriorityConfig.MaxAge, kPriorityDefaultMaxAge);
       }
 
+      if (config["PriorityDecayHalfLife"])
+        parse_priority_duration(
+            config["PriorityDecayHalfLife"].as<std::string>(),
+            &g_config.PriorityConfig.DecayHalfLife);
+
       if (config["PriorityType"]) {
         std::string priority_type = config["PriorityType"].as<std::string>();
         if (priority_type == "priority/multifactor")
@@ -348,6 +388,84 @@ void ParseConfig(int argc, char** argv) {
         g_config.JobFileOpenModeAppend = Ctld::kDefaultJobFileOpenModeAppend;
       }
 
+      g_config.ParallelNodeSelection =
+          YamlValueOr<bool>(config["ParallelNodeSelection"],
+                            Ctld::kDefaultParallelNodeSelection);
+
+      g_config.InteractiveFastLane =
+          YamlValueOr<bool>(config["InteractiveFastLane"],
+                            Ctld::kDefaultInteractiveFastLane);
+
+      g_config.ScheduleCycleBudgetMs = YamlValueOr<uint32_t>(
+          config["ScheduleCycleBudgetMs"], Ctld::kDefaultScheduleCycleBudgetMs);
+
+      g_config.MaxConcurrentExecuteStepsRpc = std::max(
+          YamlValueOr<uint32_t>(config["MaxConcurrentExecuteStepsRpc"],
+                                Ctld::kDefaultMaxConcurrentExecuteStepsRpc),
+          1u);
+
+      g_config.LaunchTreeFanOut = YamlValueOr<uint32_t>(
+          config["LaunchTreeFanOut"], Ctld::kDefaultLaunchTreeFanOut);
+
+      g_config.StepPayloadCacheBytes =
+          YamlValueOr<uint64_t>(config["StepPayloadCacheMB"],
+                                kDefaultStepPayloadCacheMB) *
+          1024 * 1024;
+
+      g_config.MaxConcurrentQueryRpcs = std::max(
+          YamlValueOr<uint32_t>(config["MaxConcurrentQueryRpcs"],
+                                Ctld::kDefaultMaxConcurrentQueryRpcs),
+          1u);
+      g_config.MaxConcurrentMutatingRpcs = std::max(
+          YamlValueOr<uint32_t>(config["MaxConcurrentMutatingRpcs"],
+                                Ctld::kDefaultMaxConcurrentMutatingRpcs),
+          1u);
+
+      if (config["RpcRateLimit"]) {
+        const auto& rate_limit_config = config["RpcRateLimit"];
+        auto parse_rate_limit = [](const YAML::Node& node,
+                                   Ctld::Config::RpcRateLimitConfig* limit) {
+          if (!node) return;
+          limit->Rate = YamlValueOr<uint32_t>(node["Rate"], limit->Rate);
+          // A burst below one request would reject everything.
+          limit->Burst = std::max(
+              YamlValueOr<uint32_t>(node["Burst"], limit->Rate), 1u);
+        };
+        parse_rate_limit(rate_limit_config["Query"],
+                         &g_config.QueryRpcRateLimit);
+        parse_rate_limit(rate_limit_config["Mutating"],
+                         &g_config.MutatingRpcRateLimit);
+      }
+
+      g_config.TaskQuerySnapshotIntervalMs = YamlValueOr<uint32_t>(
+          config["TaskQuerySnapshotIntervalMs"],
+          Ctld::kDefaultTaskQuerySnapshotIntervalMs);
+
+      if (config["QueryReplication"]) {
+        const auto& replication_config = config["QueryReplication"];
+        g_config.QueryReplication.Enabled =
+            YamlValueOr<bool>(replication_config["Enabled"], false);
+        g_config.QueryReplication.SyncIntervalMs =
+            std::max(YamlValueOr<uint32_t>(
+                         replication_config["SyncIntervalMs"],
+                         Ctld::kDefaultQueryReplicationSyncIntervalMs),
+                     1u);
+        g_config.QueryReplication.PrimaryHostname =
+            YamlValueOr<std::string>(replication_config["PrimaryHostname"], "");
+      }
+
+      if (config["Metrics"]) {
+        const auto& metrics_config = config["Metrics"];
+        g_config.Metrics.Enabled =
+            YamlValueOr<bool>(metrics_config["Enabled"], false);
+        g_config.Metrics.ListenAddr =
+            YamlValueOr(metrics_config["ListenAddr"], kDefaultHost);
+        g_config.Metrics.ListenPort = YamlValueOr(
+            metrics_config["CraneCtldListenPort"], kCtldMetricsDefaultPort);
+        g_config.Metrics.LockProfiling =
+            YamlValueOr<bool>(metrics_config["LockProfiling"], false);
+      }
+
       if (config["Nodes"]) {
         for (auto it = config["Nodes"].begin(); it != config["Nodes"].end();
              ++it) {
@@ -614,6 +732,55 @@ void ParseConfig(int argc, char** argv) {
         }
       }
 
+      if (config["Topology"]) {
+        for (const auto& switch_node : config["Topology"]) {
+          Ctld::Config::TopologySwitch topo_switch;
+
+          if (!switch_node["SwitchName"] ||
+              switch_node["SwitchName"].IsNull()) {
+            CRANE_ERROR("SwitchName not found in Topology.");
+            std::exit(1);
+          }
+          topo_switch.name = switch_node["SwitchName"].as<std::string>();
+
+          std::list<std::string> name_list;
+          if (switch_node["Nodes"] && !switch_node["Nodes"].IsNull()) {
+            if (!util::ParseHostList(switch_node["Nodes"].as<std::string>(),
+                                     &name_list)) {
+              CRANE_ERROR("Illegal node list of switch {}.", topo_switch.name);
+              std::exit(1);
+            }
+            for (auto&& node : name_list) {
+              if (!g_config.Nodes.contains(node)) {
+                CRANE_ERROR("Unknown node '{}' found in switch '{}'.", node,
+                            topo_switch.name);
+                std::exit(1);
+              }
+              topo_switch.nodes.emplace_back(std::move(node));
+            }
+          } else if (switch_node["Switches"] &&
+                     !switch_node["Switches"].IsNull()) {
+            if (!util::ParseHostList(switch_node["Switches"].as<std::string>(),
+                                     &name_list)) {
+              CRANE_ERROR("Illegal switch list of switch {}.",
+                          topo_switch.name);
+              std::exit(1);
+            }
+            topo_switch.switches.assign(name_list.begin(), name_list.end());
+          } else {
+            CRANE_ERROR("Switch {} has neither Nodes nor Switches.",
+                        topo_switch.name);
+            std::exit(1);
+          }
+
+          g_config.Topology.emplace_back(std::move(topo_switch));
+        }
+      }
+
+      g_config.TopologyAwareSelection =
+          YamlValueOr<bool>(config["TopologyAwareSelection"],
+                            Ctld::kDefaultTopologyAwareSelection);
+
       if (config["IgnoreConfigInconsistency"] &&
           !config["IgnoreConfigInconsistency"].IsNull())
         g_config.IgnoreConfigInconsistency =
@@ -629,6 +796,12 @@ void ParseConfig(int argc, char** argv) {
             fmt::format("unix://{}{}", g_config.CraneBaseDir,
                         YamlValueOr(plugin_config["PlugindSockPath"],
                                     kDefaultPlugindUnixSockPath));
+        g_config.Plugin.MaxQueuedEvents =
+            YamlValueOr<uint32_t>(plugin_config["MaxQueuedEvents"],
+                                  kDefaultPluginMaxQueuedEvents);
+        g_config.Plugin.BlockOnQueueFull =
+            YamlValueOr<std::string>(plugin_config["QueueFullPolicy"],
+                                     "Drop") == "Block";
       }
     } catch (YAML::BadFile& e) {
       CRANE_CRITICAL("Can't open config file {}: {}", config_path, e.what());
@@ -660,6 +833,9 @@ void ParseConfig(int argc, char** argv) {
         g_config.CraneCtldDbPath =
             g_config.CraneBaseDir / kDefaultCraneCtldDbPath;
 
+      g_config.CraneEmbeddedDbCheckpointInterval = YamlValueOr<uint64_t>(
+          config["CraneEmbeddedDbCheckpointInterval"], 0);
+
       if (config["DbUser"] && !config["DbUser"].IsNull()) {
         g_config.DbUser = config["DbUser"].as<std::string>();
         if (config["DbPassword"] && !config["DbPassword"].IsNull())
@@ -688,6 +864,34 @@ void ParseConfig(int argc, char** argv) {
       else
         g_config.DbName = "crane_db";
 
+      g_config.DbMaxPoolSize = YamlValueOr<uint32_t>(config["DbMaxPoolSize"],
+                                                     kDefaultDbMaxPoolSize);
+      if (g_config.DbMaxPoolSize == 0) {
+        CRANE_ERROR("DbMaxPoolSize must be positive.");
+        std::exit(1);
+      }
+
+      if (config["JobArchive"]) {
+        const auto& archive_config = config["JobArchive"];
+
+        g_config.JobArchiveConf.Enabled =
+            YamlValueOr<bool>(archive_config["Enabled"], false);
+
+        std::filesystem::path path(
+            YamlValueOr(archive_config["Dir"], kDefaultJobArchiveDir));
+        if (path.is_absolute())
+          g_config.JobArchiveConf.Dir = path;
+        else
+          g_config.JobArchiveConf.Dir = g_config.CraneBaseDir / path;
+
+        g_config.JobArchiveConf.AgeDays = YamlValueOr<uint32_t>(
+            archive_config["AgeDays"], kDefaultJobArchiveAgeDays);
+        if (g_config.JobArchiveConf.AgeDays == 0) {
+          CRANE_ERROR("JobArchive.AgeDays must be positive.");
+          std::exit(1);
+        }
+      }
+
       if (config["Vault"]) {
         const auto& vault_config = config["Vault"];
 
@@ -742,6 +946,10 @@ void ParseConfig(int argc, char** argv) {
     g_config.ListenConf.CraneCtldListenPort =
         parsed_args["port"].as<std::string>();
   }
+  if (parsed_args.count("replica-of")) {
+    g_config.QueryReplication.PrimaryHostname =
+        parsed_args["replica-of"].as<std::string>();
+  }
 
   if (crane::GetIpAddrVer(g_config.ListenConf.CraneCtldListenAddr) == -1) {
     CRANE_ERROR("Listening address is invalid.");
@@ -756,10 +964,35 @@ void ParseConfig(int argc, char** argv) {
   }
 }
 
+void StartMetricsServer() {
+  using namespace Ctld;
+
+  if (!g_config.Metrics.Enabled) return;
+
+  util::metrics::AddLoggerMetrics(&util::metrics::DefaultRegistry());
+  if (g_config.Metrics.LockProfiling) util::lock_profiler::Enable();
+  g_metrics_server = std::make_unique<util::metrics::MetricsServer>();
+  if (!g_metrics_server->Start(g_config.Metrics.ListenAddr,
+                               g_config.Metrics.ListenPort))
+    g_metrics_server.reset();
+}
+
 void DestroyCtldGlobalVariables() {
   using namespace Ctld;
 
+  // The endpoint reads the queues of the objects destroyed below.
+  g_metrics_server.reset();
+
+  // The feed reads the scheduler and the craned metas.
+  g_query_state_feed.reset();
+  g_query_replica.reset();
+
   g_task_scheduler.reset();
+  g_step_payload_dedup.reset();
+  g_task_event_hub.reset();
+  g_mongodb_job_writer.reset();
+  g_job_archive.reset();
+  g_scheduler_stats.reset();
   g_craned_keeper.reset();
 
   // In case that spdlog is destructed before g_embedded_db_client->Close()
@@ -777,6 +1010,8 @@ void InitializeCtldGlobalVariables() {
   PasswordEntry::InitializeEntrySize();
 
   crane::InitializeNetworkFunctions();
+  crane::SeedResolveCache(g_config.Nodes | std::views::keys |
+                          std::ranges::to<std::vector<std::string>>());
 
   char hostname[HOST_NAME_MAX + 1];
   int err = gethostname(hostname, HOST_NAME_MAX + 1);
@@ -798,10 +1033,22 @@ void InitializeCtldGlobalVariables() {
     std::exit(1);
   }
 
+  if (g_config.JobArchiveConf.Enabled) {
+    g_job_archive = std::make_unique<JobArchive>(g_config.JobArchiveConf.Dir);
+    if (!g_job_archive->Init()) {
+      CRANE_ERROR("Failed to initialize the job archive.");
+      std::exit(1);
+    }
+  }
+
   if (g_config.Plugin.Enabled) {
     CRANE_INFO("[Plugin] Plugin module is enabled.");
     g_plugin_client = std::make_unique<plugin::PluginClient>();
-    g_plugin_client->InitChannelAndStub(g_config.Plugin.PlugindSockPath);
+    g_plugin_client->InitChannelAndStub(
+        g_config.Plugin.PlugindSockPath, g_config.Plugin.MaxQueuedEvents,
+        g_config.Plugin.BlockOnQueueFull
+            ? plugin::PluginClient::QueueFullPolicy::BLOCK
+            : plugin::PluginClient::QueueFullPolicy::DROP);
   }
 
   if (g_config.VaultConf.Enabled) {
@@ -812,6 +1059,17 @@ void InitializeCtldGlobalVariables() {
     std::exit(1);
   }
 
+  if (!g_config.QueryReplication.PrimaryHostname.empty()) {
+    // A read replica neither schedules nor owns the embedded db. It follows
+    // the primary and only reads MongoDB for the completed tasks. The server
+    // is ready once the replica has applied the state of the primary.
+    g_query_replica = std::make_unique<QueryReplica>(
+        g_config.QueryReplication.PrimaryHostname);
+    g_ctld_server = std::make_unique<Ctld::CtldServer>(g_config.ListenConf);
+    StartMetricsServer();
+    return;
+  }
+
   // Account manager must be initialized before Task Scheduler
   // since the recovery stage of the task scheduler will acquire
   // information from account manager.
@@ -853,6 +1111,12 @@ void InitializeCtldGlobalVariables() {
 
   using namespace std::chrono_literals;
 
+  g_scheduler_stats = std::make_unique<SchedulerStats>();
+  if (g_config.StepPayloadCacheBytes > 0)
+    g_step_payload_dedup =
+        std::make_unique<StepPayloadDedup>(g_config.StepPayloadCacheBytes);
+  g_mongodb_job_writer = std::make_unique<MongodbJobWriter>();
+  g_task_event_hub = std::make_unique<TaskEventHub>();
   g_task_scheduler = std::make_unique<TaskScheduler>();
 
   g_ctld_server = std::make_unique<Ctld::CtldServer>(g_config.ListenConf);
@@ -864,6 +1128,11 @@ void InitializeCtldGlobalVariables() {
     std::exit(1);
   }
 
+  if (g_config.QueryReplication.Enabled)
+    g_query_state_feed = std::make_unique<QueryStateFeed>();
+
+  StartMetricsServer();
+
   g_runtime_status.srv_ready.store(true, std::memory_order_release);
 }
 
@@ -0,0 +1,47 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "CranedBitmap.h"
+
+namespace Ctld {
+
+CranedBitmap::CranedBitmap(size_t size)
+    : m_size_(size), m_words_((size + 63) / 64, 0) {}
+
+size_t CranedBitmap::Count() const {
+  size_t count = 0;
+  for (uint64_t word : m_words_) count += std::popcount(word);
+  return count;
+}
+
+CranedBitmap& CranedBitmap::operator&=(const CranedBitmap& rhs) {
+  for (size_t i = 0; i < m_words_.size(); i++) m_words_[i] &= rhs.m_words_[i];
+  return *this;
+}
+
+CranedBitmap& CranedBitmap::operator|=(const CranedBitmap& rhs) {
+  for (size_t i = 0; i < m_words_.size(); i++) m_words_[i] |= rhs.m_words_[i];
+  return *this;
+}
+
+CranedBitmap& CranedBitmap::AndNot(const CranedBitmap& rhs) {
+  for (size_t i = 0; i < m_words_.size(); i++) m_words_[i] &= ~rhs.m_words_[i];
+  return *this;
+}
+
+}  // namespace Ctld
@@ -0,0 +1,74 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "CtldPublicDefs.h"
+// Precompiled header comes first!
+
+namespace Ctld {
+
+// A set of craneds as bits over their dense indexes. All the bitmaps
+// combined together must be of the same size.
+class CranedBitmap {
+ public:
+  CranedBitmap() = default;
+  explicit CranedBitmap(size_t size);
+
+  size_t Size() const { return m_size_; }
+
+  void Set(size_t index) { m_words_[index / 64] |= Bit_(index); }
+  void Reset(size_t index) { m_words_[index / 64] &= ~Bit_(index); }
+  void Assign(size_t index, bool value) {
+    if (value)
+      Set(index);
+    else
+      Reset(index);
+  }
+  bool Test(size_t index) const {
+    return (m_words_[index / 64] & Bit_(index)) != 0;
+  }
+
+  // The number of set bits.
+  size_t Count() const;
+
+  CranedBitmap& operator&=(const CranedBitmap& rhs);
+  CranedBitmap& operator|=(const CranedBitmap& rhs);
+  // Clear the bits set in rhs.
+  CranedBitmap& AndNot(const CranedBitmap& rhs);
+
+  // Call func with the index of every set bit in increasing order.
+  template <typename Func>
+  void ForEach(Func&& func) const {
+    for (size_t i = 0; i < m_words_.size(); i++) {
+      uint64_t word = m_words_[i];
+      while (word != 0) {
+        func(i * 64 + std::countr_zero(word));
+        word &= word - 1;
+      }
+    }
+  }
+
+ private:
+  static uint64_t Bit_(size_t index) { return uint64_t{1} << (index % 64); }
+
+  size_t m_size_{0};
+  std::vector<uint64_t> m_words_;
+};
+
+}  // namespace Ctld
@@ -0,0 +1,74 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "CranedConnectScheduler.h"
+
+namespace Ctld {
+
+CranedConnectScheduler::CranedConnectScheduler(uint32_t window,
+                                               int64_t min_backoff_ms,
+                                               int64_t max_backoff_ms,
+                                               uint64_t seed)
+    : m_window_(std::max(window, 1u)),
+      m_min_backoff_ms_(std::max<int64_t>(min_backoff_ms, 1)),
+      m_max_backoff_ms_(std::max(max_backoff_ms, m_min_backoff_ms_)),
+      m_rng_(seed) {}
+
+void CranedConnectScheduler::Add(const CranedId& craned_id) {
+  m_craned_states_.try_emplace(craned_id);
+}
+
+void CranedConnectScheduler::Remove(const CranedId& craned_id) {
+  auto iter = m_craned_states_.find(craned_id);
+  if (iter == m_craned_states_.end()) return;
+
+  if (iter->second.connecting) m_connecting_num_--;
+  m_craned_states_.erase(iter);
+}
+
+void CranedConnectScheduler::OnConnectFailed(const CranedId& craned_id,
+                                             int64_t now_ms) {
+  auto iter = m_craned_states_.find(craned_id);
+  if (iter == m_craned_states_.end() || !iter->second.connecting) return;
+
+  CranedState& state = iter->second;
+  state.connecting = false;
+  m_connecting_num_--;
+
+  // Equal jitter: wait at least half of the backoff, so the retries of
+  // craneds failing together spread over the other half.
+  int64_t backoff_ms = BackoffMsOf(++state.failure_num);
+  std::uniform_int_distribution<int64_t> jitter(0, backoff_ms / 2);
+  state.next_attempt_ms = now_ms + backoff_ms - backoff_ms / 2 + jitter(m_rng_);
+}
+
+bool CranedConnectScheduler::IsConnecting(const CranedId& craned_id) const {
+  auto iter = m_craned_states_.find(craned_id);
+  return iter != m_craned_states_.end() && iter->second.connecting;
+}
+
+int64_t CranedConnectScheduler::BackoffMsOf(uint32_t failure_num) const {
+  if (failure_num == 0) return 0;
+
+  int64_t backoff_ms = m_min_backoff_ms_;
+  for (uint32_t i = 1; i < failure_num && backoff_ms < m_max_backoff_ms_; i++)
+    backoff_ms *= 2;
+  return std::min(backoff_ms, m_max_backoff_ms_);
+}
+
+}  // namespace Ctld
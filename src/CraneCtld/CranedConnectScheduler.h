@@ -0,0 +1,88 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "CtldPublicDefs.h"
+// Precompiled header comes first!
+
+namespace Ctld {
+
+// Decides when CranedKeeper connects to each unavailable craned. At most
+// `window` craneds are connecting at a time, and a craned failing to connect
+// is retried after an exponential backoff with jitter. So craneds becoming
+// unavailable together, e.g. all of them when ctld restarts, are connected in
+// waves and their retries spread out instead of all coming at once.
+// Not thread-safe. Times are in milliseconds of a monotonic clock.
+class CranedConnectScheduler {
+ public:
+  CranedConnectScheduler(uint32_t window, int64_t min_backoff_ms,
+                         int64_t max_backoff_ms, uint64_t seed);
+
+  // A craned already unavailable keeps its backoff.
+  void Add(const CranedId& craned_id);
+
+  // Forget the craned, e.g. once it is connected.
+  void Remove(const CranedId& craned_id);
+
+  // Mark the craned as not connecting and retry it after a backoff. Ignored
+  // if the craned is not connecting.
+  void OnConnectFailed(const CranedId& craned_id, int64_t now_ms);
+
+  // Append the craneds to connect to now and mark them as connecting.
+  // Craneds for which skip returns true are left alone.
+  template <typename SkipFunc>
+  void Pick(int64_t now_ms, SkipFunc&& skip, std::vector<CranedId>* picked) {
+    for (auto& [craned_id, state] : m_craned_states_) {
+      if (m_connecting_num_ >= m_window_) break;
+      if (state.connecting || state.next_attempt_ms > now_ms) continue;
+      if (skip(craned_id)) continue;
+
+      state.connecting = true;
+      m_connecting_num_++;
+      picked->emplace_back(craned_id);
+    }
+  }
+
+  bool IsConnecting(const CranedId& craned_id) const;
+
+  size_t Size() const { return m_craned_states_.size(); }
+  uint32_t ConnectingNum() const { return m_connecting_num_; }
+
+  // The time to wait before the attempt after `failure_num` failures, before
+  // jitter is applied.
+  int64_t BackoffMsOf(uint32_t failure_num) const;
+
+ private:
+  struct CranedState {
+    bool connecting{false};
+    uint32_t failure_num{0};
+    int64_t next_attempt_ms{0};
+  };
+
+  const uint32_t m_window_;
+  const int64_t m_min_backoff_ms_;
+  const int64_t m_max_backoff_ms_;
+
+  std::mt19937_64 m_rng_;
+
+  absl::flat_hash_map<CranedId, CranedState> m_craned_states_;
+  uint32_t m_connecting_num_{0};
+};
+
+}  // namespace Ctld
@@ -59,6 +59,8 @@ void CranedMetaContainer::CranedUp(
   }
 
   node_meta->alive = true;
+  BumpCranedSchedVersion(node_meta.get());
+  BumpGeneration_();
 
   node_meta->remote_meta = CranedRemoteMeta(remote_meta);
   for (auto& partition_meta : part_meta_ptrs) {
@@ -93,6 +95,8 @@ void CranedMetaContainer::CranedDown(const CranedId& craned_id) {
     return;
   }
   node_meta->alive = false;
+  BumpCranedSchedVersion(node_meta.get());
+  BumpGeneration_();
 
   for (auto& partition_meta : part_meta_ptrs) {
     PartitionGlobalMeta& part_global_meta =
@@ -120,13 +124,16 @@ int CranedMetaContainer::GetOnlineCranedCount() {
 }
 
 CranedMetaContainer::PartitionMetaPtr CranedMetaContainer::GetPartitionMetasPtr(
-    const PartitionId& partition_id) {
-  return partition_meta_map_.GetValueExclusivePtr(partition_id);
+    const PartitionId& partition_id, std::source_location loc) {
+  return partition_meta_map_.GetValueExclusivePtr(partition_id, loc);
 }
 
 CranedMetaContainer::CranedMetaPtr CranedMetaContainer::GetCranedMetaPtr(
-    const CranedId& craned_id) {
-  return craned_meta_map_.GetValueExclusivePtr(craned_id);
+    const CranedId& craned_id, std::source_location loc) {
+  auto craned_meta = craned_meta_map_.GetValueExclusivePtr(craned_id, loc);
+  // The craned lock is held by the caller until its change is done.
+  if (craned_meta) BumpGeneration_();
+  return craned_meta;
 }
 
 CranedMetaContainer::ResvMetaPtr CranedMetaContainer::GetResvMetaPtr(
@@ -135,13 +142,14 @@ CranedMetaContainer::ResvMetaPtr CranedMetaContainer::GetResvMetaPtr(
 }
 
 CranedMetaContainer::AllPartitionsMetaMapConstPtr
-CranedMetaContainer::GetAllPartitionsMetaMapConstPtr() {
-  return partition_meta_map_.GetMapConstSharedPtr();
+CranedMetaContainer::GetAllPartitionsMetaMapConstPtr(
+    std::source_location loc) {
+  return partition_meta_map_.GetMapConstSharedPtr(loc);
 }
 
 CranedMetaContainer::CranedMetaMapConstPtr
-CranedMetaContainer::GetCranedMetaMapConstPtr() {
-  return craned_meta_map_.GetMapConstSharedPtr();
+CranedMetaContainer::GetCranedMetaMapConstPtr(std::source_location loc) {
+  return craned_meta_map_.GetMapConstSharedPtr(loc);
 }
 
 CranedMetaContainer::ResvMetaMapConstPtr
@@ -153,87 +161,258 @@ CranedMetaContainer::ResvMetaMapPtr CranedMetaContainer::GetResvMetaMapPtr() {
   return resv_meta_map_.GetMapSharedPtr();
 }
 
-void CranedMetaContainer::MallocResourceFromNode(CranedId node_id,
-                                                 task_id_t task_id,
-                                                 const ResourceV2& resources) {
-  if (!craned_meta_map_.Contains(node_id)) {
-    CRANE_ERROR("Try to malloc resource from an unknown craned {}", node_id);
-    return;
+void CranedMetaContainer::MallocResourceFromNodes(
+    task_id_t task_id, const ResourceV2& resources) {
+  // The resources taken from each partition, summed over its craneds. Sorted
+  // by partition id, which is the order of locking the partitions.
+  TreeMap<PartitionId, ResourceInNode> part_res_map;
+  for (const auto& craned_id : resources.EachNodeResMap() | std::views::keys) {
+    auto iter = craned_id_part_ids_map_.find(craned_id);
+    if (iter == craned_id_part_ids_map_.end()) {
+      CRANE_ERROR("Try to malloc resource from an unknown craned {}",
+                  craned_id);
+      return;
+    }
+    for (PartitionId const& part_id : iter->second) part_res_map[part_id];
   }
 
-  auto& part_ids = craned_id_part_ids_map_.at(node_id);
-
   std::vector<util::Synchronized<PartitionMeta>::ExclusivePtr> part_meta_ptrs;
-  part_meta_ptrs.reserve(part_ids.size());
+  part_meta_ptrs.reserve(part_res_map.size());
 
-  auto raw_part_metas_map_ = partition_meta_map_.GetMapSharedPtr();
+  auto raw_part_metas_map = partition_meta_map_.GetMapSharedPtr();
 
   // Acquire all partition locks first.
-  for (PartitionId const& part_id : part_ids)
+  for (PartitionId const& part_id : part_res_map | std::views::keys)
     part_meta_ptrs.emplace_back(
-        raw_part_metas_map_->at(part_id).GetExclusivePtr());
+        raw_part_metas_map->at(part_id).GetExclusivePtr());
 
-  const ResourceInNode& task_node_res = resources.at(node_id);
+  // Then acquire the lock of each craned in turn.
+  auto raw_craned_metas_map = craned_meta_map_.GetMapSharedPtr();
+  for (const auto& [craned_id, task_node_res] : resources.EachNodeResMap()) {
+    auto node_meta = raw_craned_metas_map->at(craned_id).GetExclusivePtr();
 
-  // Then acquire craned meta lock.
-  auto node_meta = craned_meta_map_[node_id];
-
-  node_meta->rn_task_res_map.emplace(task_id, task_node_res);
+    node_meta->rn_task_res_map.emplace(task_id, task_node_res);
+    node_meta->res_avail -= task_node_res;
+    node_meta->res_in_use += task_node_res;
+    BumpCranedSchedVersion(node_meta.get());
+    BumpGeneration_();
 
-  node_meta->res_avail -= task_node_res;
-  node_meta->res_in_use += task_node_res;
+    for (PartitionId const& part_id : craned_id_part_ids_map_.at(craned_id))
+      part_res_map[part_id] += task_node_res;
+  }
 
+  auto part_res_iter = part_res_map.begin();
   for (auto& partition_meta : part_meta_ptrs) {
     PartitionGlobalMeta& part_global_meta =
         partition_meta->partition_global_meta;
 
-    part_global_meta.res_avail -= task_node_res;
-    part_global_meta.res_in_use += task_node_res;
+    part_global_meta.res_avail -= part_res_iter->second;
+    part_global_meta.res_in_use += part_res_iter->second;
+    ++part_res_iter;
   }
 }
 
-void CranedMetaContainer::FreeResourceFromNode(CranedId node_id,
-                                               uint32_t task_id) {
-  if (!craned_meta_map_.Contains(node_id)) {
-    CRANE_ERROR("Try to free resource from an unknown craned {}", node_id);
-    return;
+void CranedMetaContainer::FreeResourceFromNodes(
+    const HashMap<CranedId, std::vector<task_id_t>>& craned_task_ids_map) {
+  // The resources freed in each partition, summed over its craneds. Sorted
+  // by partition id, which is the order of locking the partitions.
+  TreeMap<PartitionId, ResourceInNode> part_res_map;
+  for (const auto& craned_id : craned_task_ids_map | std::views::keys) {
+    auto iter = craned_id_part_ids_map_.find(craned_id);
+    if (iter == craned_id_part_ids_map_.end()) {
+      CRANE_ERROR("Try to free resource from an unknown craned {}", craned_id);
+      return;
+    }
+    for (PartitionId const& part_id : iter->second) part_res_map[part_id];
   }
 
-  auto& part_ids = craned_id_part_ids_map_.at(node_id);
-
   std::vector<util::Synchronized<PartitionMeta>::ExclusivePtr> part_meta_ptrs;
-  part_meta_ptrs.reserve(part_ids.size());
+  part_meta_ptrs.reserve(part_res_map.size());
 
-  auto raw_part_metas_map_ = partition_meta_map_.GetMapSharedPtr();
+  auto raw_part_metas_map = partition_meta_map_.GetMapSharedPtr();
 
   // Acquire all partition locks first.
-  for (PartitionId const& part_id : part_ids)
+  for (PartitionId const& part_id : part_res_map | std::views::keys)
     part_meta_ptrs.emplace_back(
-        raw_part_metas_map_->at(part_id).GetExclusivePtr());
+        raw_part_metas_map->at(part_id).GetExclusivePtr());
+
+  // Then acquire the lock of each craned in turn.
+  auto raw_craned_metas_map = craned_meta_map_.GetMapSharedPtr();
+  for (const auto& [craned_id, task_ids] : craned_task_ids_map) {
+    auto node_meta = raw_craned_metas_map->at(craned_id).GetExclusivePtr();
+
+    ResourceInNode freed_res;
+    bool any_freed = false;
+    for (task_id_t task_id : task_ids) {
+      auto resource_iter = node_meta->rn_task_res_map.find(task_id);
+      if (resource_iter == node_meta->rn_task_res_map.end()) {
+        CRANE_ERROR(
+            "Try to free resource from an unknown task {} on craned {}",
+            task_id, craned_id);
+        continue;
+      }
 
-  // Then acquire craned meta lock.
-  auto node_meta = craned_meta_map_[node_id];
+      freed_res += resource_iter->second;
+      node_meta->rn_task_res_map.erase(resource_iter);
+      any_freed = true;
+    }
+    if (!any_freed) continue;
 
-  auto resource_iter = node_meta->rn_task_res_map.find(task_id);
-  if (resource_iter == node_meta->rn_task_res_map.end()) {
-    CRANE_ERROR("Try to free resource from an unknown task {} on craned {}",
-                task_id, node_id);
-    return;
-  }
+    node_meta->res_avail += freed_res;
+    node_meta->res_in_use -= freed_res;
+    BumpCranedSchedVersion(node_meta.get());
+    BumpGeneration_();
 
-  ResourceInNode const& resources = resource_iter->second;
+    for (PartitionId const& part_id : craned_id_part_ids_map_.at(craned_id))
+      part_res_map[part_id] += freed_res;
+  }
 
-  node_meta->res_avail += resources;
-  node_meta->res_in_use -= resources;
+  auto part_res_iter = part_res_map.begin();
   for (auto& partition_meta : part_meta_ptrs) {
     PartitionGlobalMeta& part_global_meta =
         partition_meta->partition_global_meta;
 
-    part_global_meta.res_avail += resources;
-    part_global_meta.res_in_use -= resources;
+    part_global_meta.res_avail += part_res_iter->second;
+    part_global_meta.res_in_use -= part_res_iter->second;
+    ++part_res_iter;
+  }
+}
+
+void CranedMetaContainer::MarkCranedSchedStateChanged(
+    const CranedId& craned_id) {
+  auto node_meta = craned_meta_map_.GetValueExclusivePtr(craned_id);
+  if (!node_meta) {
+    CRANE_ERROR("Try to mark state changed of an unknown craned {}",
+                craned_id);
+    return;
+  }
+
+  BumpCranedSchedVersion(node_meta.get());
+}
+
+void CranedMetaContainer::BumpCranedSchedVersion(CranedMeta* craned_meta) {
+  craned_meta->sched_version++;
+
+  {
+    absl::MutexLock lock(&craned_index_mtx_);
+    IndexCraned_(*craned_meta);
+  }
+
+  absl::MutexLock lock(&craned_change_mtx_);
+  craned_changes_.emplace_back(craned_meta->static_meta.hostname);
+  craned_change_last_seq_++;
+  if (craned_changes_.size() > kCranedChangeStreamMaxNum)
+    craned_changes_.pop_front();
+}
+
+std::expected<uint64_t, uint64_t> CranedMetaContainer::ReadCranedChanges(
+    uint64_t after_seq, HashSet<CranedId>* craned_ids) {
+  absl::MutexLock lock(&craned_change_mtx_);
+  uint64_t first_seq = craned_change_last_seq_ - craned_changes_.size() + 1;
+  if (after_seq + 1 < first_seq)
+    return std::unexpected(craned_change_last_seq_);
+
+  for (size_t i = after_seq + 1 - first_seq; i < craned_changes_.size(); i++)
+    craned_ids->emplace(craned_changes_[i]);
+  return craned_change_last_seq_;
+}
+
+uint64_t CranedMetaContainer::LastCranedChangeSeq() {
+  absl::MutexLock lock(&craned_change_mtx_);
+  return craned_change_last_seq_;
+}
+
+std::vector<CranedId> CranedMetaContainer::SearchCraneds(
+    const PartitionId& partition_id, const CranedFilter& filter) {
+  std::vector<CranedId> craned_ids;
+  CranedBitmap craneds;
+  if (!FilterCraneds_(partition_id, filter, &craneds)) return craned_ids;
+
+  craned_ids.reserve(craneds.Count());
+  craneds.ForEach([&](size_t index) {
+    craned_ids.emplace_back(craned_ids_by_index_[index]);
+  });
+  return craned_ids;
+}
+
+size_t CranedMetaContainer::CountCraneds(const PartitionId& partition_id,
+                                         const CranedFilter& filter) {
+  CranedBitmap craneds;
+  if (!FilterCraneds_(partition_id, filter, &craneds)) return 0;
+  return craneds.Count();
+}
+
+bool CranedMetaContainer::FilterCraneds_(const PartitionId& partition_id,
+                                         const CranedFilter& filter,
+                                         CranedBitmap* craneds) {
+  auto part_iter = partition_craned_bitmaps_.find(partition_id);
+  if (part_iter == partition_craned_bitmaps_.end()) return false;
+  *craneds = part_iter->second;
+
+  absl::MutexLock lock(&craned_index_mtx_);
+  if (!filter.resource_states.empty()) {
+    CranedBitmap in_states(craneds->Size());
+    for (auto state : filter.resource_states)
+      in_states |= resource_state_craned_bitmaps_[static_cast<int>(state)];
+    *craneds &= in_states;
+  }
+
+  if (filter.drained.has_value()) {
+    if (filter.drained.value())
+      *craneds &= drained_craned_bitmap_;
+    else
+      craneds->AndNot(drained_craned_bitmap_);
+  }
+
+  for (const auto& device : filter.devices) {
+    auto iter = device_craned_bitmaps_.find(device);
+    if (iter == device_craned_bitmaps_.end()) {
+      *craneds = CranedBitmap(craneds->Size());
+      break;
+    }
+    *craneds &= iter->second;
   }
 
-  node_meta->rn_task_res_map.erase(resource_iter);
+  return true;
+}
+
+void CranedMetaContainer::IndexCraned_(const CranedMeta& craned_meta) {
+  auto index_iter = craned_indexes_.find(craned_meta.static_meta.hostname);
+  if (index_iter == craned_indexes_.end()) return;
+  uint32_t index = index_iter->second;
+
+  size_t resource_state = static_cast<size_t>(ResourceStateOf_(craned_meta));
+  for (size_t i = 0; i < resource_state_craned_bitmaps_.size(); i++)
+    resource_state_craned_bitmaps_[i].Assign(index, i == resource_state);
+
+  drained_craned_bitmap_.Assign(index, craned_meta.drain);
+
+  // The devices of a craned are only added once it reports them, so a
+  // device may be seen for the first time here.
+  for (auto& [device, craneds] : device_craned_bitmaps_) craneds.Reset(index);
+  auto set_device = [&](std::string&& device) {
+    auto [iter, _] = device_craned_bitmaps_.try_emplace(
+        std::move(device), craned_ids_by_index_.size());
+    iter->second.Set(index);
+  };
+  for (const auto& [name, type_slots] :
+       craned_meta.res_total.dedicated_res.name_type_slots_map) {
+    for (const auto& [type, slots] : type_slots.type_slots_map) {
+      if (slots.empty()) continue;
+      set_device(std::string(name));
+      set_device(absl::StrCat(name, ":", type));
+    }
+  }
+}
+
+crane::grpc::CranedResourceState CranedMetaContainer::ResourceStateOf_(
+    const CranedMeta& craned_meta) {
+  if (!craned_meta.alive) return crane::grpc::CranedResourceState::CRANE_DOWN;
+  if (craned_meta.res_in_use.IsZero())
+    return crane::grpc::CranedResourceState::CRANE_IDLE;
+  if (craned_meta.res_avail.allocatable_res.IsAnyZero())
+    return crane::grpc::CranedResourceState::CRANE_ALLOC;
+  return crane::grpc::CranedResourceState::CRANE_MIX;
 }
 
 void CranedMetaContainer::MallocResourceFromResv(
@@ -358,11 +537,125 @@ void CranedMetaContainer::InitFromConfig(const Config& config) {
         part_meta.partition_global_meta.node_cnt);
   }
 
+  // The partitions of a craned are locked in this order, so that those of
+  // any craneds together can be locked the same way without deadlock.
+  for (auto& part_ids : craned_id_part_ids_map_ | std::views::values)
+    part_ids.sort();
+
+  InitCranedIndexes_(craned_map, partition_map);
+
   craned_meta_map_.InitFromMap(std::move(craned_map));
   partition_meta_map_.InitFromMap(std::move(partition_map));
+
+  InitTopologyFromConfig_(config);
+}
+
+void CranedMetaContainer::InitCranedIndexes_(
+    const HashMap<CranedId, CranedMeta>& craned_map,
+    const HashMap<PartitionId, PartitionMeta>& part_map) {
+  craned_ids_by_index_.reserve(craned_map.size());
+  for (const auto& craned_id : craned_map | std::views::keys)
+    craned_ids_by_index_.emplace_back(craned_id);
+  // Searched craneds come out in the order of their names.
+  std::ranges::sort(craned_ids_by_index_);
+
+  size_t craned_num = craned_ids_by_index_.size();
+  for (uint32_t i = 0; i < craned_num; i++)
+    craned_indexes_.emplace(craned_ids_by_index_[i], i);
+
+  for (const auto& [part_id, part_meta] : part_map) {
+    auto& craneds =
+        partition_craned_bitmaps_.try_emplace(part_id, craned_num)
+            .first->second;
+    for (const auto& craned_id : part_meta.craned_ids)
+      craneds.Set(craned_indexes_.at(craned_id));
+  }
+
+  absl::MutexLock lock(&craned_index_mtx_);
+  for (auto& craneds : resource_state_craned_bitmaps_)
+    craneds = CranedBitmap(craned_num);
+  drained_craned_bitmap_ = CranedBitmap(craned_num);
+  for (const auto& craned_meta : craned_map | std::views::values)
+    IndexCraned_(craned_meta);
+}
+
+void CranedMetaContainer::InitTopologyFromConfig_(const Config& config) {
+  if (config.Topology.empty()) return;
+
+  // The switches defined in the config, in the order of their indexes.
+  std::vector<const Config::TopologySwitch*> topo_switches;
+  HashMap<std::string, uint32_t> switch_index_map;
+  auto& switches = topology_.switches;
+  for (const auto& topo_switch : config.Topology) {
+    if (!switch_index_map.emplace(topo_switch.name, switches.size()).second) {
+      CRANE_ERROR("Switch {} is defined more than once. Ignored.",
+                  topo_switch.name);
+      continue;
+    }
+    topo_switches.emplace_back(&topo_switch);
+    switches.emplace_back(NetworkTopology::Switch{.name = topo_switch.name});
+  }
+
+  for (uint32_t index = 0; index < topo_switches.size(); index++) {
+    const auto& topo_switch = *topo_switches[index];
+    for (const auto& child_name : topo_switch.switches) {
+      auto it = switch_index_map.find(child_name);
+      if (it == switch_index_map.end()) {
+        CRANE_ERROR("Unknown switch {} under switch {}. Ignored.", child_name,
+                    topo_switch.name);
+        continue;
+      }
+      if (switches[it->second].parent != -1) {
+        CRANE_ERROR("Switch {} has more than one parent. Ignored under {}.",
+                    child_name, topo_switch.name);
+        continue;
+      }
+      switches[it->second].parent = static_cast<int32_t>(index);
+    }
+  }
+
+  // Walk up from every switch to compute the levels. A path longer than the
+  // number of switches means a cycle.
+  for (uint32_t i = 0; i < switches.size(); i++) {
+    uint32_t level = 0;
+    for (int32_t j = switches[i].parent; j != -1; j = switches[j].parent) {
+      if (++level > switches.size()) {
+        CRANE_ERROR("Cycle found in the topology at switch {}. Topology is "
+                    "ignored.",
+                    switches[i].name);
+        topology_ = {};
+        return;
+      }
+      switches[j].level = std::max(switches[j].level, level);
+    }
+  }
+
+  for (uint32_t index = 0; index < topo_switches.size(); index++) {
+    std::vector<uint32_t> path;
+    for (auto j = static_cast<int32_t>(index); j != -1;
+         j = switches[j].parent)
+      path.emplace_back(j);
+
+    for (const auto& craned_id : topo_switches[index]->nodes) {
+      if (!topology_.craned_switch_path_map.emplace(craned_id, path).second)
+        CRANE_ERROR("Craned {} is under more than one leaf switch. Only the "
+                    "first one is used.",
+                    craned_id);
+    }
+  }
+
+  CRANE_INFO("Topology loaded with {} switches and {} craneds.",
+             switches.size(), topology_.craned_switch_path_map.size());
 }
 
 crane::grpc::QueryCranedInfoReply CranedMetaContainer::QueryAllCranedInfo() {
+  uint64_t generation = generation_.load(std::memory_order_acquire);
+  return craned_info_reply_cache_.GetOrBuild(
+      generation, "", [this] { return BuildAllCranedInfoReply_(); });
+}
+
+crane::grpc::QueryCranedInfoReply
+CranedMetaContainer::BuildAllCranedInfoReply_() {
   crane::grpc::QueryCranedInfoReply reply;
   auto* list = reply.mutable_craned_info_list();
 
@@ -395,6 +688,13 @@ crane::grpc::QueryCranedInfoReply CranedMetaContainer::QueryCranedInfo(
 
 crane::grpc::QueryPartitionInfoReply
 CranedMetaContainer::QueryAllPartitionInfo() {
+  uint64_t generation = generation_.load(std::memory_order_acquire);
+  return partition_info_reply_cache_.GetOrBuild(
+      generation, "", [this] { return BuildAllPartitionInfoReply_(); });
+}
+
+crane::grpc::QueryPartitionInfoReply
+CranedMetaContainer::BuildAllPartitionInfoReply_() {
   crane::grpc::QueryPartitionInfoReply reply;
   auto* list = reply.mutable_partition_info_list();
 
@@ -605,6 +905,18 @@ crane::grpc::QueryReservationInfoReply CranedMetaContainer::QueryResvInfo(
 
 crane::grpc::QueryClusterInfoReply CranedMetaContainer::QueryClusterInfo(
     const crane::grpc::QueryClusterInfoRequest& request) {
+  uint64_t generation = generation_.load(std::memory_order_acquire);
+  // Equal filters serialize to equal keys, e.g. every cinfo without options.
+  // The uid of the caller doesn't change the reply.
+  crane::grpc::QueryClusterInfoRequest filters = request;
+  filters.clear_uid();
+  return cluster_info_reply_cache_.GetOrBuild(
+      generation, filters.SerializeAsString(),
+      [this, &request] { return BuildClusterInfoReply_(request); });
+}
+
+crane::grpc::QueryClusterInfoReply CranedMetaContainer::BuildClusterInfoReply_(
+    const crane::grpc::QueryClusterInfoRequest& request) {
   crane::grpc::QueryClusterInfoReply reply;
   auto* partition_list = reply.mutable_partitions();
 
@@ -620,16 +932,14 @@ crane::grpc::QueryClusterInfoReply CranedMetaContainer::QueryClusterInfo(
   };
 
   std::string hosts = absl::StrJoin(request.filter_nodes(), ",");
-  std::list<std::string> hosts_list;
-  util::ParseHostList(hosts, &hosts_list);
-  std::unordered_set<std::string> req_nodes;
-  for (auto& host : hosts_list) req_nodes.insert(std::move(host));
+  util::HostList req_nodes;
+  util::HostList::Parse(hosts, &req_nodes);
 
   bool no_craned_hostname_constraint = request.filter_nodes().empty();
   auto craned_rng_filter_hostname = [&](CranedMetaRawMap::const_iterator it) {
     auto craned_meta = it->second.GetExclusivePtr();
     return no_craned_hostname_constraint ||
-           req_nodes.contains(craned_meta->static_meta.hostname);
+           req_nodes.Contains(craned_meta->static_meta.hostname);
   };
 
   if (request.filter_craned_control_states().empty() ||
@@ -654,6 +964,18 @@ crane::grpc::QueryClusterInfoReply CranedMetaContainer::QueryClusterInfo(
   for (const auto& it : request.filter_craned_power_states())
     power_filters[static_cast<int>(it)] = true;
 
+  // Only the craneds in the requested control and resource states by the
+  // indexes are locked and checked below.
+  CranedFilter craned_filter;
+  for (int i = 0; i < resource_state_num; i++)
+    if (resource_filters[i])
+      craned_filter.resource_states.emplace_back(
+          crane::grpc::CranedResourceState(i));
+  if (control_filters[crane::grpc::CranedControlState::CRANE_DRAIN] !=
+      control_filters[crane::grpc::CranedControlState::CRANE_NONE])
+    craned_filter.drained =
+        control_filters[crane::grpc::CranedControlState::CRANE_DRAIN];
+
   // Ensure that the map global read lock is held during the following filtering
   // operations and partition_meta_map_ must be locked before craned_meta_map_
   auto partition_map = partition_meta_map_.GetMapConstSharedPtr();
@@ -666,16 +988,6 @@ crane::grpc::QueryClusterInfoReply CranedMetaContainer::QueryClusterInfo(
 
     auto* part_info = partition_list->Add();
 
-    // we make a copy of these craned ids to lower overall latency.
-    // The amortized cost is 1 copy for each craned node.
-    // Although an extra copying cost is introduced,
-    // the time of accessing partition_meta_map_ is minimized and
-    // the copying cost is taken only by this grpc thread handling
-    // cinfo request.
-    // Since we assume the number of cpu cores is sufficient on the
-    // machine running CraneCtld, it's ok to pay 1 core cpu time
-    // for overall low latency.
-    std::unordered_set<CranedId> craned_ids;
     {
       auto part_meta = it.second.GetExclusivePtr();
       std::string partition_name = part_meta->partition_global_meta.name;
@@ -687,9 +999,12 @@ crane::grpc::QueryClusterInfoReply CranedMetaContainer::QueryClusterInfo(
       part_info->set_state(part_meta->partition_global_meta.alive_craned_cnt > 0
                                ? crane::grpc::PartitionState::PARTITION_UP
                                : crane::grpc::PartitionState::PARTITION_DOWN);
-      craned_ids = part_meta->craned_ids;
     }
 
+    // The craneds are searched without holding the partition lock, so the
+    // time of accessing partition_meta_map_ is minimized.
+    std::vector<CranedId> craned_ids = SearchCraneds(part_id, craned_filter);
+
     std::list<std::string> craned_name_lists[control_state_num]
                                             [resource_state_num]
                                             [power_state_num];
@@ -705,28 +1020,14 @@ crane::grpc::QueryClusterInfoReply CranedMetaContainer::QueryClusterInfo(
     ranges::for_each(craned_rng, [&](CranedMetaRawMap::const_iterator it) {
       auto craned_meta = it->second.GetExclusivePtr();
 
-      auto& res_total = craned_meta->res_total;
-      auto& res_in_use = craned_meta->res_in_use;
-      auto& res_avail = craned_meta->res_avail;
-
       crane::grpc::CranedControlState control_state;
       if (craned_meta->drain) {
         control_state = crane::grpc::CranedControlState::CRANE_DRAIN;
       } else {
         control_state = crane::grpc::CranedControlState::CRANE_NONE;
       }
-      crane::grpc::CranedResourceState resource_state;
-      if (craned_meta->alive) {
-        if (res_in_use.IsZero()) {
-          resource_state = crane::grpc::CranedResourceState::CRANE_IDLE;
-        } else if (res_avail.allocatable_res.IsAnyZero()) {
-          resource_state = crane::grpc::CranedResourceState::CRANE_ALLOC;
-        } else {
-          resource_state = crane::grpc::CranedResourceState::CRANE_MIX;
-        }
-      } else {
-        resource_state = crane::grpc::CranedResourceState::CRANE_DOWN;
-      }
+      crane::grpc::CranedResourceState resource_state =
+          ResourceStateOf_(*craned_meta);
       if (control_filters[static_cast<int>(control_state)] &&
           resource_filters[static_cast<int>(resource_state)] &&
           power_filters[static_cast<int>(craned_meta->power_state)]) {
@@ -800,6 +1101,8 @@ crane::grpc::ModifyCranedStateReply CranedMetaContainer::ChangeNodeState(
         }
 
         craned_meta->drain = true;
+        BumpCranedSchedVersion(craned_meta.get());
+        BumpGeneration_();
         craned_meta->state_reason = request.reason();
         reply.add_modified_nodes(craned_id);
       } else if (request.new_state() ==
@@ -812,6 +1115,8 @@ crane::grpc::ModifyCranedStateReply CranedMetaContainer::ChangeNodeState(
         }
 
         craned_meta->drain = false;
+        BumpCranedSchedVersion(craned_meta.get());
+        BumpGeneration_();
         craned_meta->state_reason.clear();
         reply.add_modified_nodes(craned_id);
       } else {
@@ -851,6 +1156,7 @@ CraneExpected<void> CranedMetaContainer::ModifyPartitionAcl(
   } else {
     denied_accounts = std::move(accounts);
   }
+  BumpGeneration_();
 
   return result;
 }
@@ -928,6 +1234,8 @@ void CranedMetaContainer::AddDedicatedResource(
 
   node_meta->res_total.dedicated_res += intersection;
   node_meta->res_avail.dedicated_res += intersection;
+  BumpCranedSchedVersion(node_meta.get());
+  BumpGeneration_();
 
   for (auto& partition_meta : part_meta_ptrs) {
     PartitionGlobalMeta& part_global_meta =
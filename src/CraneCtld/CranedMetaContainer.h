@@ -21,12 +21,31 @@
 #include "CtldPublicDefs.h"
 // Precompiled header comes first!
 
+#include "CranedBitmap.h"
 #include "crane/AtomicHashMap.h"
 #include "crane/Lock.h"
 #include "crane/Pointer.h"
 
 namespace Ctld {
 
+// The tree of network switches loaded from the configuration.
+struct NetworkTopology {
+  struct Switch {
+    std::string name;
+    int32_t parent{-1};
+    // 0 for leaf switches. An upper switch is one level above the highest of
+    // its children.
+    uint32_t level{0};
+  };
+
+  std::vector<Switch> switches;
+  // Indexes of the switches from the leaf one up to the root above each
+  // craned. Craneds not in the tree are absent.
+  absl::flat_hash_map<CranedId, std::vector<uint32_t>> craned_switch_path_map;
+
+  bool Empty() const { return craned_switch_path_map.empty(); }
+};
+
 class CranedMetaContainer final {
  public:
   template <typename K, typename V,
@@ -105,22 +124,80 @@ class CranedMetaContainer final {
 
   int GetOnlineCranedCount();
 
-  PartitionMetaPtr GetPartitionMetasPtr(const PartitionId& partition_id);
+  // The returned partition meta must only be read. Changes made through it
+  // are not seen by the cached query replies.
+  PartitionMetaPtr GetPartitionMetasPtr(
+      const PartitionId& partition_id,
+      std::source_location loc = std::source_location::current());
+
+  // The caller may modify the craned meta through the returned pointer, so
+  // acquiring it invalidates the cached query replies.
+  // The callers of the getters of the metas are the call sites of the map
+  // locks when lock profiling is enabled.
+  CranedMetaPtr GetCranedMetaPtr(
+      const CranedId& craned_id,
+      std::source_location loc = std::source_location::current());
 
-  CranedMetaPtr GetCranedMetaPtr(const CranedId& craned_id);
+  AllPartitionsMetaMapConstPtr GetAllPartitionsMetaMapConstPtr(
+      std::source_location loc = std::source_location::current());
 
-  AllPartitionsMetaMapConstPtr GetAllPartitionsMetaMapConstPtr();
+  CranedMetaMapConstPtr GetCranedMetaMapConstPtr(
+      std::source_location loc = std::source_location::current());
 
-  CranedMetaMapConstPtr GetCranedMetaMapConstPtr();
+  // READ-ONLY after initialization, so it can be read without any lock.
+  const NetworkTopology& GetTopology() const { return topology_; }
 
   bool CheckCranedAllowed(const std::string& hostname) {
     return craned_meta_map_.Contains(hostname);
   };
 
-  void MallocResourceFromNode(CranedId node_id, task_id_t task_id,
-                              const ResourceV2& resources);
+  // Allocate the resources of a task on every craned in `resources`. Each
+  // partition involved is locked once for the whole batch and each craned in
+  // turn, and the partition aggregates are updated in a single pass.
+  void MallocResourceFromNodes(task_id_t task_id, const ResourceV2& resources);
+
+  // Free the resources of the tasks on each craned, locking in the same way
+  // as MallocResourceFromNodes.
+  void FreeResourceFromNodes(
+      const HashMap<CranedId, std::vector<task_id_t>>& craned_task_ids_map);
+
+  // Invalidate the scheduling timeline cached for this craned. Must be called
+  // when a running task on it changes in a way not visible through the
+  // methods above, e.g. its time limit is modified.
+  void MarkCranedSchedStateChanged(const CranedId& craned_id);
+
+  // Bump the sched_version of the craned, reindex its states and publish the
+  // change to the craned change stream. Must be called after the craned meta
+  // is changed, with the craned meta still locked by the caller.
+  void BumpCranedSchedVersion(CranedMeta* craned_meta);
+
+  // Constraints on the craneds searched in a partition. An empty field
+  // doesn't constrain.
+  struct CranedFilter {
+    std::vector<crane::grpc::CranedResourceState> resource_states;
+    std::optional<bool> drained;
+    // "name" or "name:type" of each device the craned must have.
+    std::vector<std::string> devices;
+  };
 
-  void FreeResourceFromNode(CranedId craned_id, uint32_t task_id);
+  // Search the craneds of a partition by the state indexes without locking
+  // any craned meta. The result may lag behind concurrent changes of the
+  // craned metas, so callers must recheck the craneds they lock.
+  std::vector<CranedId> SearchCraneds(const PartitionId& partition_id,
+                                      const CranedFilter& filter);
+
+  size_t CountCraneds(const PartitionId& partition_id,
+                      const CranedFilter& filter);
+
+  // Add the ids of the craneds changed after change `after_seq` to
+  // `craned_ids` and return the sequence number of the last change. If some
+  // of these changes are no longer kept, return the sequence number as
+  // unexpected instead, and the reader must recheck every craned.
+  std::expected<uint64_t, uint64_t> ReadCranedChanges(
+      uint64_t after_seq, HashSet<CranedId>* craned_ids);
+
+  // The sequence number of the last change of the craned change stream.
+  uint64_t LastCranedChangeSeq();
 
   // TODO: Move to Reservation Mini-Scheduler. Craned only use LogicalPartition.
   using ResvMetaAtomicMap = util::AtomicHashMap<HashMap, std::string, ResvMeta>;
@@ -156,18 +233,120 @@ class CranedMetaContainer final {
   // 2. lock elements in craned_meta_map_
   // 3. unlock elements in craned_meta_map_
   // 4. unlock elements in partition_meta_map_
-  CranedMetaAtomicMap craned_meta_map_;
-  AllPartitionsMetaAtomicMap partition_meta_map_;
+  CranedMetaAtomicMap craned_meta_map_{"craned_meta_map"};
+  AllPartitionsMetaAtomicMap partition_meta_map_{"partition_meta_map"};
 
   // TODO: Move to Reservation Logical Partition.
-  ResvMetaAtomicMap resv_meta_map_;
+  ResvMetaAtomicMap resv_meta_map_{"resv_meta_map"};
+
+  // Replies of QueryAllCranedInfo, QueryAllPartitionInfo and QueryClusterInfo
+  // built at one generation of the metadata, keyed by the query. An entry is
+  // served until the generation is bumped.
+  template <typename Reply>
+  class GenerationalReplyCache {
+   public:
+    template <typename BuildFunc>
+    Reply GetOrBuild(uint64_t generation, const std::string& key,
+                     BuildFunc&& build) {
+      {
+        absl::MutexLock lock(&mtx_);
+        if (generation == generation_) {
+          auto iter = replies_.find(key);
+          if (iter != replies_.end()) return *iter->second;
+        }
+      }
+
+      // Build without holding the cache mutex, since the build takes the
+      // meta locks. The reply reflects at least `generation`.
+      auto reply = std::make_shared<const Reply>(build());
+
+      absl::MutexLock lock(&mtx_);
+      // Never replace the entries of a newer generation with an older reply.
+      if (generation < generation_) return *reply;
+      if (generation > generation_) {
+        replies_.clear();
+        generation_ = generation;
+      }
+      if (replies_.size() < kMaxCachedQueryReplyNum)
+        replies_.emplace(key, reply);
+      return *reply;
+    }
+
+   private:
+    absl::Mutex mtx_;
+    uint64_t generation_ ABSL_GUARDED_BY(mtx_){0};
+    HashMap<std::string, std::shared_ptr<const Reply>> replies_
+        ABSL_GUARDED_BY(mtx_);
+  };
+
+  // Bumped on every change of a craned or partition meta visible through the
+  // queries above, while the locks of the changed metas are still held. A
+  // query reading generation G before taking those locks therefore sees every
+  // change counted in G.
+  std::atomic<uint64_t> generation_{1};
+
+  GenerationalReplyCache<crane::grpc::QueryCranedInfoReply>
+      craned_info_reply_cache_;
+  GenerationalReplyCache<crane::grpc::QueryPartitionInfoReply>
+      partition_info_reply_cache_;
+  GenerationalReplyCache<crane::grpc::QueryClusterInfoReply>
+      cluster_info_reply_cache_;
+
+  // Ids of the craneds whose sched_version was bumped, oldest first. The
+  // last one is change craned_change_last_seq_.
+  absl::Mutex craned_change_mtx_;
+  std::deque<CranedId> craned_changes_ ABSL_GUARDED_BY(craned_change_mtx_);
+  uint64_t craned_change_last_seq_ ABSL_GUARDED_BY(craned_change_mtx_){0};
 
   // A craned node may belong to multiple partitions.
   // Use this map as a READ-ONLY index, so multi-thread reading is ok.
   HashMap<CranedId /*craned hostname*/, std::list<PartitionId>>
       craned_id_part_ids_map_;
 
+  // Dense indexes of the craneds for the bitmaps below and the craneds of
+  // each partition. READ-ONLY after initialization.
+  HashMap<CranedId, uint32_t> craned_indexes_;
+  std::vector<CranedId> craned_ids_by_index_;
+  HashMap<PartitionId, CranedBitmap> partition_craned_bitmaps_;
+
+  // Craneds by their states, reindexed along with their sched_version.
+  absl::Mutex craned_index_mtx_;
+  std::array<CranedBitmap, crane::grpc::CranedResourceState_ARRAYSIZE>
+      resource_state_craned_bitmaps_ ABSL_GUARDED_BY(craned_index_mtx_);
+  CranedBitmap drained_craned_bitmap_ ABSL_GUARDED_BY(craned_index_mtx_);
+  // Keyed by "name" and "name:type" of the devices.
+  HashMap<std::string, CranedBitmap> device_craned_bitmaps_
+      ABSL_GUARDED_BY(craned_index_mtx_);
+
+  NetworkTopology topology_;
+
  private:  // Helper functions
+  void InitTopologyFromConfig_(const Config& config);
+
+  void InitCranedIndexes_(const HashMap<CranedId, CranedMeta>& craned_map,
+                          const HashMap<PartitionId, PartitionMeta>& part_map);
+
+  void IndexCraned_(const CranedMeta& craned_meta)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(craned_index_mtx_);
+
+  // Return false if the partition doesn't exist.
+  bool FilterCraneds_(const PartitionId& partition_id,
+                      const CranedFilter& filter, CranedBitmap* craneds);
+
+  static crane::grpc::CranedResourceState ResourceStateOf_(
+      const CranedMeta& craned_meta);
+
+  void BumpGeneration_() {
+    generation_.fetch_add(1, std::memory_order_release);
+  }
+
+  crane::grpc::QueryCranedInfoReply BuildAllCranedInfoReply_();
+
+  crane::grpc::QueryPartitionInfoReply BuildAllPartitionInfoReply_();
+
+  crane::grpc::QueryClusterInfoReply BuildClusterInfoReply_(
+      const crane::grpc::QueryClusterInfoRequest& request);
+
   void SetGrpcCranedInfoByCranedMeta_(const CranedMeta& craned_meta,
                                       crane::grpc::CranedInfo* craned_info);
 };
@@ -20,14 +20,18 @@
 
 // Standard Libraries
 #include <algorithm>
+#include <array>
 #include <atomic>
+#include <bit>
 #include <cerrno>
 #include <charconv>
 #include <chrono>
+#include <cmath>
 #include <concepts>
 #include <condition_variable>
 #include <csignal>
 #include <cstdint>
+#include <deque>
 #include <expected>
 #include <filesystem>
 #include <fstream>
@@ -41,8 +45,11 @@
 #include <mutex>
 #include <optional>
 #include <queue>
+#include <random>
 #include <ranges>
+#include <set>
 #include <source_location>
+#include <span>
 #include <string>
 #include <thread>
 #include <tuple>
@@ -102,7 +109,9 @@
 // Logger.h must be the first
 
 #include "crane/GrpcHelper.h"
+#include "crane/Metrics.h"
 #include "crane/OS.h"
 #include "crane/PasswordEntry.h"
+#include "crane/ProtoArena.h"
 #include "crane/PublicHeader.h"
 #include "crane/String.h"
\ No newline at end of file
@@ -37,15 +37,29 @@ CranedRemoteMeta::CranedRemoteMeta(
   }
 }
 
+std::shared_ptr<const PasswordEntry> PasswordEntryInternTable::Intern(
+    PasswordEntry&& entry) {
+  LockGuard lock_guard(&m_mtx_);
+
+  auto& weak_entry = m_entries_[entry.Uid()];
+  if (auto shared_entry = weak_entry.lock();
+      shared_entry && *shared_entry == entry)
+    return shared_entry;
+
+  auto shared_entry = std::make_shared<const PasswordEntry>(std::move(entry));
+  weak_entry = shared_entry;
+  return shared_entry;
+}
+
 bool TaskInCtld::IsX11() const {
   if (!IsInteractive()) return false;
-  auto const& ia_meta = this->task_to_ctld.interactive_meta();
+  auto const& ia_meta = TaskToCtld().interactive_meta();
   return ia_meta.x11();
 }
 
 bool TaskInCtld::IsX11WithPty() const {
   if (!IsX11()) return false;
-  auto const& ia_meta = this->task_to_ctld.interactive_meta();
+  auto const& ia_meta = TaskToCtld().interactive_meta();
   return ia_meta.pty();
 }
 
@@ -141,6 +155,22 @@ void TaskInCtld::SetHeld(bool val) {
   runtime_attr.set_held(val);
 }
 
+void TaskInCtld::ResolveDependency(task_id_t upstream_id, bool satisfied) {
+  runtime_attr.add_resolved_dependency_ids(upstream_id);
+  if (dependency_wait_num > 0) dependency_wait_num--;
+  if (!satisfied) {
+    dependency_failed = true;
+    runtime_attr.set_dependency_failed(true);
+  }
+}
+
+const char* TaskInCtld::BlockedReason() const {
+  if (held) return "Held";
+  if (dependency_failed) return "DependencyNeverSatisfied";
+  if (dependency_wait_num > 0) return "Dependency";
+  return "";
+}
+
 void TaskInCtld::SetCachedPriority(const double val) {
   cached_priority = val;
   runtime_attr.set_cached_priority(val);
@@ -152,8 +182,47 @@ void TaskInCtld::SetAllocatedRes(ResourceV2&& val) {
   allocated_res = std::move(val);
 }
 
+void TaskInCtld::AddUsageSample(crane::grpc::JobUsageSample const& sample) {
+  auto* usage = runtime_attr.mutable_usage();
+  uint64_t sampled_ms = usage->sampled_ms() + sample.interval_ms();
+  if (sampled_ms == 0) return;
+
+  usage->set_memory_avg_bytes(
+      (usage->memory_avg_bytes() * usage->sampled_ms() +
+       static_cast<double>(sample.memory_avg_bytes()) * sample.interval_ms()) /
+      sampled_ms);
+  usage->set_sampled_ms(sampled_ms);
+  usage->set_memory_peak_bytes(
+      std::max(usage->memory_peak_bytes(), sample.memory_peak_bytes()));
+  usage->set_cpu_usage_usec(usage->cpu_usage_usec() + sample.cpu_usage_usec());
+  usage->set_io_read_bytes(usage->io_read_bytes() + sample.io_read_bytes());
+  usage->set_io_write_bytes(usage->io_write_bytes() + sample.io_write_bytes());
+  usage->set_cpu_pressure_usec(usage->cpu_pressure_usec() +
+                               sample.cpu_pressure_usec());
+  usage->set_memory_pressure_usec(usage->memory_pressure_usec() +
+                                  sample.memory_pressure_usec());
+  usage->set_io_pressure_usec(usage->io_pressure_usec() +
+                              sample.io_pressure_usec());
+}
+
+void TaskInCtld::PublishSchedAttr() {
+  sched_attr_snapshot.start_time = start_time;
+  sched_attr_snapshot.end_time = end_time;
+  sched_attr_snapshot.cached_priority = cached_priority;
+  sched_attr_snapshot.pending_reason = pending_reason;
+  sched_attr_snapshot.allocated_res_view = allocated_res_view;
+  sched_attr_snapshot.planned_craneds_regex = planned_craneds_regex;
+  sched_attr_snapshot.start_estimate_time = start_estimate_time;
+}
+
 void TaskInCtld::SetFieldsByTaskToCtld(crane::grpc::TaskToCtld const& val) {
-  task_to_ctld = val;
+  SetFieldsByTaskToCtld(std::make_shared<crane::grpc::TaskToCtld>(val));
+}
+
+void TaskInCtld::SetFieldsByTaskToCtld(
+    std::shared_ptr<crane::grpc::TaskToCtld> shared_val) {
+  task_to_ctld = std::move(shared_val);
+  const crane::grpc::TaskToCtld& val = *task_to_ctld;
 
   partition_id = (val.partition_name().empty()) ? g_config.DefaultPartition
                                                 : val.partition_name();
@@ -164,12 +233,7 @@ void TaskInCtld::SetFieldsByTaskToCtld(crane::grpc::TaskToCtld const& val) {
   type = val.type();
 
   if (type == crane::grpc::Batch) {
-    meta.emplace<BatchMetaInTask>(BatchMetaInTask{
-        .sh_script = val.batch_meta().sh_script(),
-        .interpreter = val.batch_meta().interpreter(),
-        .output_file_pattern = val.batch_meta().output_file_pattern(),
-        .error_file_pattern = val.batch_meta().error_file_pattern(),
-    });
+    meta.emplace<BatchMetaInTask>();
   } else {
     auto& ia_meta = std::get<InteractiveMetaInTask>(meta);
     ia_meta.interactive_type = val.interactive_meta().interactive_type();
@@ -180,7 +244,7 @@ void TaskInCtld::SetFieldsByTaskToCtld(crane::grpc::TaskToCtld const& val) {
   cpus_per_task = cpu_t(val.cpus_per_task());
 
   uid = val.uid();
-  password_entry = std::make_unique<PasswordEntry>(uid);
+  password_entry = g_password_entry_intern_table.Intern(PasswordEntry(uid));
 
   // Note: gid is egid, which may be different from the
   // primary group of the user in `password_entry`.
@@ -190,16 +254,8 @@ void TaskInCtld::SetFieldsByTaskToCtld(crane::grpc::TaskToCtld const& val) {
   name = val.name();
   qos = val.qos();
 
-  cmd_line = val.cmd_line();
-  cwd = val.cwd();
-  container = val.container();
-
-  for (const auto& [k, v] : val.env()) env[k] = v;
-
   get_user_env = val.get_user_env();
 
-  extra_attr = val.extra_attr();
-
   reservation = val.reservation();
 
   SetHeld(val.hold());
@@ -217,6 +273,7 @@ void TaskInCtld::SetFieldsByRuntimeAttr(
 
   status = runtime_attr.status();
   held = runtime_attr.held();
+  dependency_failed = runtime_attr.dependency_failed();
   cached_priority = runtime_attr.cached_priority();
 
   if (status != crane::grpc::TaskStatus::Pending) {
@@ -260,112 +317,218 @@ void TaskInCtld::SetFieldsOfTaskInfo(crane::grpc::TaskInfo* task_info) {
 
   task_info->mutable_time_limit()->set_seconds(ToInt64Seconds(time_limit));
   task_info->mutable_submit_time()->CopyFrom(runtime_attr.submit_time());
-  task_info->mutable_start_time()->CopyFrom(runtime_attr.start_time());
-  task_info->mutable_end_time()->CopyFrom(runtime_attr.end_time());
+  if (status == crane::grpc::Pending) {
+    // The scheduler may be updating the live fields. See SchedAttrSnapshot.
+    task_info->mutable_start_time()->set_seconds(
+        ToUnixSeconds(sched_attr_snapshot.start_time));
+    task_info->mutable_end_time()->set_seconds(
+        ToUnixSeconds(sched_attr_snapshot.end_time));
+  } else {
+    task_info->mutable_start_time()->CopyFrom(runtime_attr.start_time());
+    task_info->mutable_end_time()->CopyFrom(runtime_attr.end_time());
+  }
 
   task_info->set_uid(uid);
   task_info->set_gid(gid);
   task_info->set_username(username);
   task_info->set_node_num(node_num);
-  task_info->set_cmd_line(cmd_line);
-  task_info->set_cwd(cwd);
+  task_info->set_cmd_line(TaskToCtld().cmd_line());
+  task_info->set_cwd(TaskToCtld().cwd());
   task_info->mutable_req_nodes()->Assign(included_nodes.begin(),
                                          included_nodes.end());
   task_info->mutable_exclude_nodes()->Assign(excluded_nodes.begin(),
                                              excluded_nodes.end());
 
-  task_info->set_container(container);
-  task_info->set_extra_attr(extra_attr);
+  task_info->set_container(TaskToCtld().container());
+  task_info->set_extra_attr(TaskToCtld().extra_attr());
   task_info->set_reservation(reservation);
 
   task_info->set_held(held);
   task_info->mutable_execution_node()->Assign(executing_craned_ids.begin(),
                                               executing_craned_ids.end());
 
-  *task_info->mutable_req_res_view() =
-      static_cast<crane::grpc::ResourceView>(requested_node_res_view);
+  requested_node_res_view.ToGrpc(task_info->mutable_req_res_view());
 
   task_info->set_exit_code(runtime_attr.exit_code());
-  task_info->set_priority(cached_priority);
+  if (runtime_attr.has_usage()) *task_info->mutable_usage() = Usage();
 
   task_info->set_status(status);
   if (Status() == crane::grpc::Pending) {
-    task_info->set_pending_reason(pending_reason);
+    task_info->set_priority(sched_attr_snapshot.cached_priority);
+    task_info->set_pending_reason(sched_attr_snapshot.pending_reason);
+    sched_attr_snapshot.allocated_res_view.ToGrpc(
+        task_info->mutable_allocated_res_view());
+    if (sched_attr_snapshot.start_estimate_time != absl::InfinitePast()) {
+      task_info->set_planned_craned_list(
+          sched_attr_snapshot.planned_craneds_regex);
+      task_info->mutable_start_estimate_time()->set_seconds(
+          ToUnixSeconds(sched_attr_snapshot.start_estimate_time));
+    }
   } else {
+    task_info->set_priority(cached_priority);
     task_info->set_craned_list(allocated_craneds_regex);
+    allocated_res_view.ToGrpc(task_info->mutable_allocated_res_view());
   }
-  task_info->set_exclusive(task_to_ctld.exclusive());
-
-  *task_info->mutable_allocated_res_view() =
-      static_cast<crane::grpc::ResourceView>(allocated_res_view);
+  task_info->set_exclusive(TaskToCtld().exclusive());
 }
 
 crane::grpc::TaskToD TaskInCtld::GetTaskToD(const CranedId& craned_id) const {
   crane::grpc::TaskToD task_to_d;
+  SetFieldsOfTaskToD(craned_id, &task_to_d);
+  return task_to_d;
+}
+
+void TaskInCtld::SetFieldsOfTaskToD(const CranedId& craned_id,
+                                    crane::grpc::TaskToD* task_to_d,
+                                    const std::string& payload_hash) const {
   // Set time_limit
-  task_to_d.mutable_time_limit()->CopyFrom(
+  task_to_d->mutable_time_limit()->CopyFrom(
       google::protobuf::util::TimeUtil::MillisecondsToDuration(
           ToInt64Milliseconds(this->time_limit)));
 
   // TODO: remove this field
   //  Set resources
-  auto* mutable_res_in_node = task_to_d.mutable_resources();
-  *mutable_res_in_node = static_cast<crane::grpc::ResourceInNode>(
-      this->AllocatedRes().at(craned_id));
+  this->AllocatedRes().at(craned_id).ToGrpc(task_to_d->mutable_resources());
 
   // Set type
-  task_to_d.set_type(this->type);
+  task_to_d->set_type(this->type);
 
-  task_to_d.set_task_id(this->TaskId());
-  task_to_d.set_name(this->name);
-  task_to_d.set_account(this->account);
-  task_to_d.set_qos(this->qos);
-  task_to_d.set_partition(this->partition_id);
+  task_to_d->set_task_id(this->TaskId());
+  task_to_d->set_name(this->name);
+  task_to_d->set_account(this->account);
+  task_to_d->set_qos(this->qos);
+  task_to_d->set_partition(this->partition_id);
 
   for (auto&& node : this->included_nodes) {
-    task_to_d.mutable_nodelist()->Add()->assign(node);
+    task_to_d->mutable_nodelist()->Add()->assign(node);
   }
 
   for (auto&& node : this->excluded_nodes) {
-    task_to_d.mutable_excludes()->Add()->assign(node);
+    task_to_d->mutable_excludes()->Add()->assign(node);
   }
 
-  task_to_d.set_node_num(this->node_num);
-  task_to_d.set_ntasks_per_node(this->ntasks_per_node);
-  task_to_d.set_cpus_per_task(static_cast<double>(this->cpus_per_task));
+  task_to_d->set_node_num(this->node_num);
+  task_to_d->set_ntasks_per_node(this->ntasks_per_node);
+  task_to_d->set_cpus_per_task(static_cast<double>(this->cpus_per_task));
 
-  task_to_d.set_uid(this->uid);
-  task_to_d.set_gid(this->gid);
-  task_to_d.mutable_env()->insert(this->env.begin(), this->env.end());
+  task_to_d->set_uid(this->uid);
+  task_to_d->set_gid(this->gid);
+  if (payload_hash.empty())
+    *task_to_d->mutable_env() = TaskToCtld().env();
+  else
+    task_to_d->set_payload_hash(payload_hash);
 
-  task_to_d.set_cwd(this->cwd);
-  task_to_d.set_container(this->container);
-  task_to_d.set_get_user_env(this->get_user_env);
+  task_to_d->set_cwd(TaskToCtld().cwd());
+  task_to_d->set_container(TaskToCtld().container());
+  task_to_d->set_get_user_env(this->get_user_env);
 
   for (const auto& hostname : this->CranedIds())
-    task_to_d.mutable_allocated_nodes()->Add()->assign(hostname);
+    task_to_d->mutable_allocated_nodes()->Add()->assign(hostname);
 
-  task_to_d.mutable_start_time()->set_seconds(this->StartTimeInUnixSecond());
-  task_to_d.mutable_time_limit()->set_seconds(ToInt64Seconds(this->time_limit));
+  task_to_d->mutable_start_time()->set_seconds(this->StartTimeInUnixSecond());
+  task_to_d->mutable_time_limit()->set_seconds(
+      ToInt64Seconds(this->time_limit));
 
   if (this->type == crane::grpc::Batch) {
-    auto* mutable_meta = task_to_d.mutable_batch_meta();
-    mutable_meta->CopyFrom(this->task_to_ctld.batch_meta());
+    const auto& proto_batch_meta = TaskToCtld().batch_meta();
+    auto* mutable_meta = task_to_d->mutable_batch_meta();
+    if (payload_hash.empty()) {
+      mutable_meta->CopyFrom(proto_batch_meta);
+    } else {
+      // All but sh_script, which may be large.
+      if (proto_batch_meta.has_open_mode_append())
+        mutable_meta->set_open_mode_append(
+            proto_batch_meta.open_mode_append());
+      mutable_meta->set_output_file_pattern(
+          proto_batch_meta.output_file_pattern());
+      mutable_meta->set_error_file_pattern(
+          proto_batch_meta.error_file_pattern());
+      mutable_meta->set_interpreter(proto_batch_meta.interpreter());
+    }
   } else {
-    const auto& proto_ia_meta = this->task_to_ctld.interactive_meta();
-    auto* mutable_meta = task_to_d.mutable_interactive_meta();
+    const auto& proto_ia_meta = TaskToCtld().interactive_meta();
+    auto* mutable_meta = task_to_d->mutable_interactive_meta();
     mutable_meta->CopyFrom(proto_ia_meta);
   }
-  return task_to_d;
 }
 
 crane::grpc::JobToD TaskInCtld::GetJobToD(const CranedId& craned_id) const {
   crane::grpc::JobToD spec;
-  spec.set_job_id(task_id);
-  spec.set_uid(uid);
-  *spec.mutable_res() =
-      crane::grpc::ResourceInNode(allocated_res.at(craned_id));
+  SetFieldsOfJobToD(craned_id, &spec);
   return spec;
 }
 
+void TaskInCtld::SetFieldsOfJobToD(const CranedId& craned_id,
+                                   crane::grpc::JobToD* spec) const {
+  spec->set_job_id(task_id);
+  spec->set_uid(uid);
+  allocated_res.at(craned_id).ToGrpc(spec->mutable_res());
+}
+
+size_t TaskInCtld::ApproxMemoryUsage() const {
+  // Short strings are stored inline and take no extra space.
+  auto string_heap_bytes = [](const std::string& s) -> size_t {
+    return s.capacity() > std::string().capacity() ? s.capacity() + 1 : 0;
+  };
+  // Bookkeeping of a node in std::list and std::unordered_set.
+  constexpr size_t kNodeOverhead = 2 * sizeof(void*);
+
+  size_t bytes = sizeof(TaskInCtld);
+  for (const std::string* s :
+       {&partition_id, &account, &name, &qos, &reservation, &username,
+        &allocated_craneds_regex, &pending_reason,
+        &sched_attr_snapshot.pending_reason})
+    bytes += string_heap_bytes(*s);
+
+  for (const auto* nodes : {&included_nodes, &excluded_nodes}) {
+    bytes += nodes->bucket_count() * sizeof(void*);
+    for (const auto& node : *nodes)
+      bytes += sizeof(node) + kNodeOverhead + string_heap_bytes(node);
+  }
+  for (const auto& craned_id : craned_ids)
+    bytes += sizeof(craned_id) + kNodeOverhead + string_heap_bytes(craned_id);
+  bytes += executing_craned_ids.capacity() * sizeof(CranedId);
+  for (const auto& craned_id : executing_craned_ids)
+    bytes += string_heap_bytes(craned_id);
+
+  bytes += runtime_attr.SpaceUsedLong() - sizeof(runtime_attr);
+  bytes += task_to_ctld->SpaceUsedLong() / task_to_ctld.use_count();
+  if (password_entry) {
+    size_t entry_bytes = sizeof(PasswordEntry) +
+                         string_heap_bytes(password_entry->Username()) +
+                         string_heap_bytes(password_entry->HomeDir()) +
+                         string_heap_bytes(password_entry->Shell());
+    bytes += entry_bytes / password_entry.use_count();
+  }
+
+  return bytes;
+}
+
+void ParallelForChunks(size_t n, size_t min_chunk,
+                       std::function<void(size_t, size_t)> const& func) {
+  if (n == 0) return;
+
+  size_t chunk_num = 1;
+  if (g_thread_pool)
+    chunk_num = std::clamp<size_t>(n / std::max<size_t>(min_chunk, 1), 1,
+                                   g_thread_pool->get_thread_count());
+  if (chunk_num == 1) {
+    func(0, n);
+    return;
+  }
+
+  size_t chunk_size = (n + chunk_num - 1) / chunk_num;
+  chunk_num = (n + chunk_size - 1) / chunk_size;
+
+  absl::BlockingCounter bl(chunk_num);
+  for (size_t begin = 0; begin < n; begin += chunk_size) {
+    size_t end = std::min(begin + chunk_size, n);
+    g_thread_pool->detach_task([&, begin, end] {
+      func(begin, end);
+      bl.DecrementCount();
+    });
+  }
+  bl.Wait();
+}
+
 }  // namespace Ctld
\ No newline at end of file
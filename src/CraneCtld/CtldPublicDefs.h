@@ -31,7 +31,14 @@ using task_db_id_t = int64_t;
 // *****************************************************
 // TaskScheduler Constants
 
-constexpr uint32_t kTaskScheduleIntervalMs = 1000;
+// A scheduling cycle is triggered by the events which may change its result,
+// such as submission, task completion, node up and reservation changes.
+// Cycles are at least kTaskScheduleMinIntervalMs apart so that bursts of
+// events are coalesced into one cycle. Without any event, a cycle is still
+// considered every kTaskScheduleMaxIntervalMs and runs if a craned changed
+// or a reservation started since the last one.
+constexpr uint32_t kTaskScheduleMinIntervalMs = 100;
+constexpr uint32_t kTaskScheduleMaxIntervalMs = 10000;
 
 // Clean TaskHoldTimerQueue when timeout or exceeding batch num
 constexpr uint32_t kTaskHoldTimerTimeoutMs = 500;
@@ -48,14 +55,76 @@ constexpr uint32_t kSubmitTaskBatchNum = 1000;
 // Clean TaskStatusChangeQueue when timeout or exceeding batch num
 constexpr uint32_t kTaskStatusChangeTimeoutMS = 500;
 constexpr uint32_t kTaskStatusChangeBatchNum = 1000;
+constexpr uint32_t kTaskStatusChangeMaxDrainNum = 20000;
+// Max number of status changes applied under one hold of the running map lock.
+// test/CraneCtld/RunningMapLockBench.cpp compares this with sharding the map.
+constexpr uint32_t kTaskStatusChangeLockChunkNum = 1000;
+
+// Writes to the embedded db are committed in groups. A group is flushed once
+// it has waited kEmbeddedDbGroupCommitWindowUs or holds
+// kEmbeddedDbGroupCommitMaxMutations mutations.
+constexpr uint32_t kEmbeddedDbGroupCommitWindowUs = 1000;
+constexpr uint32_t kEmbeddedDbGroupCommitMaxMutations = 20000;
+// A task keeps at most kEmbeddedDbMaxRuntimeAttrDeltaNum delta records of
+// its runtime attributes before they are compacted into the full record.
+constexpr uint32_t kEmbeddedDbMaxRuntimeAttrDeltaNum = 8;
+// A checkpoint file with another magic or version is ignored.
+constexpr uint64_t kEmbeddedDbCheckpointMagic = 0x54504B4342444D45;  // EMDBCKPT
+constexpr uint32_t kEmbeddedDbCheckpointVersion = 1;
+
+// Tasks recovered from the embedded db are parsed and rebuilt in parallel in
+// chunks of at least kRecoveryParallelChunkNum tasks.
+constexpr uint32_t kRecoveryParallelChunkNum = 1000;
+
+// The tasks of a batch submission are validated in parallel in chunks of at
+// least kSubmitValidationChunkNum tasks.
+constexpr uint32_t kSubmitValidationChunkNum = 64;
+
+// Per-task trace messages on paths walking every task (recovery, job
+// completion) are sampled one in kPerTaskLogSampleNum.
+constexpr uint32_t kPerTaskLogSampleNum = 100;
+
+// The final status of the last kDependencyEndedTaskCacheNum ended tasks is
+// kept for the dependencies submitted on them. Older ones are looked up in
+// MongoDB.
+constexpr uint32_t kDependencyEndedTaskCacheNum = 65536;
+
+// Finished jobs are written into MongoDB in bulk writes of at most
+// kMongoJobWriteBatchNum jobs, flushed after kMongoJobWriteWindowMs.
+// Beyond kMongoJobWriterQueueMaxSize queued jobs, a job is only kept in the
+// embedded db until the writer catches up. A failed write is retried after
+// a backoff doubling from kMongoJobWriteMinBackoffMs to
+// kMongoJobWriteMaxBackoffMs.
+constexpr uint32_t kMongoJobWriteBatchNum = 1000;
+constexpr uint32_t kMongoJobWriteWindowMs = 100;
+constexpr uint32_t kMongoJobWriterQueueMaxSize = 50000;
+constexpr uint32_t kMongoJobWriteMinBackoffMs = 100;
+constexpr uint32_t kMongoJobWriteMaxBackoffMs = 30000;
+
+// Periods of the usage rollups in MongoDB, aligned to UTC.
+constexpr int64_t kUsageRollupHourSeconds = 3600;
+constexpr int64_t kUsageRollupDaySeconds = 86400;
+
+// Jobs ended longer than JobArchive.AgeDays ago are moved every
+// kJobArchiveIntervalSec from the task table into segments of at most
+// kJobArchiveSegmentMaxJobNum jobs in the archive directory.
+constexpr uint32_t kJobArchiveIntervalSec = 3600;
+constexpr uint32_t kJobArchiveSegmentMaxJobNum = 10000;
+// A segment file with another magic or version is skipped.
+constexpr uint64_t kJobArchiveSegmentMagic = 0x4745535241424F4A;  // JOBARSEG
+constexpr uint32_t kJobArchiveSegmentVersion = 1;
 
 //*********************************************************
 
 // CranedKeeper Constants
 constexpr uint32_t kConcurrentStreamQuota = 3000;
+constexpr uint32_t kDefaultCranedConnectMinBackoffMs = 1000;
+constexpr uint32_t kDefaultCranedConnectMaxBackoffMs = 60000;
 constexpr uint32_t kCompletionQueueCapacity = 5000;
 constexpr uint16_t kCompletionQueueConnectingTimeoutSeconds = 3;
 constexpr uint16_t kCompletionQueueEstablishedTimeoutSeconds = 45;
+constexpr uint32_t kCranedBroadcastMaxInFlight = 64;
+constexpr int64_t kCranedBroadcastTimeoutSeconds = 30;
 
 // Since Unqlite has a limitation of about 900000 tasks per transaction,
 // we use this value to set the batch size of one dequeue action on
@@ -65,12 +134,75 @@ constexpr uint32_t kMaxScheduledBatchSize = 200000;
 constexpr uint32_t kDefaultScheduledBatchSize = 100000;
 
 constexpr int64_t kCtldRpcTimeoutSeconds = 5;
+// Launch trees are only used for at least this many craneds.
+constexpr uint32_t kLaunchTreeMinCraneds = 64;
+// The extra time given to a launch tree for each level below its root. It
+// must not be less than the forward margin of craned.
+constexpr int64_t kLaunchTreeLevelTimeoutMs = 500;
+// The uid of an RPC is resolved to its user again after this even if no user
+// or account has changed, so that changes of the passwd database are seen.
+constexpr uint32_t kUidCacheExpireSec = 300;
+constexpr uint32_t kMaxQueryTaskPageSize = 10000;
+// Distinct node/partition query replies kept per metadata generation.
+constexpr uint32_t kMaxCachedQueryReplyNum = 256;
+// Craned changes kept for the scheduler. A scheduler falling further behind
+// rechecks all the craneds.
+constexpr uint32_t kCranedChangeStreamMaxNum = 65536;
+
+// Token buckets of the per-user RPC rate limits are sharded by caller. A
+// shard drops the buckets idle long enough to be full again once it tracks
+// this many callers.
+constexpr uint32_t kRpcRateLimitShardNum = 16;
+constexpr uint32_t kRpcRateLimitShardMaxCallerNum = 1024;
+
+// Task events kept for watchers to catch up or resume. A watcher falling
+// further behind is dropped.
+constexpr uint32_t kTaskEventHistoryNum = 100000;
+constexpr uint32_t kTaskWatchBatchNum = 1000;
+constexpr uint32_t kTaskWatchHeartbeatIntervalSec = 10;
+constexpr uint32_t kMaxTaskWatchStreamNum = 256;
+
+// Query state updates kept for the read replicas to resume. A replica
+// falling further behind is sent the full state again.
+constexpr uint32_t kQueryStateHistoryNum = 600;
+constexpr uint32_t kDefaultQueryReplicationSyncIntervalMs = 1000;
+// Delay before a read replica reconnects to the primary, doubled on every
+// failure in a row.
+constexpr int64_t kQueryReplicaMinRetryMs = 500;
+constexpr int64_t kQueryReplicaMaxRetryMs = 30000;
+
+// Replies coalesced into one BATCH message on a CforedStream at most.
+constexpr uint32_t kCforedStreamMaxBatchReplyNum = 256;
+// The page size of QueryTxnLog if none is given, which is also the limit of
+// the unpaginated queries.
+constexpr uint32_t kDefaultTxnLogPageSize = 1000;
+constexpr uint32_t kMaxTxnLogPageSize = 10000;
 constexpr bool kDefaultRejectTasksBeyondCapacity = false;
 constexpr bool kDefaultJobFileOpenModeAppend = false;
+constexpr bool kDefaultParallelNodeSelection = false;
+constexpr bool kDefaultTopologyAwareSelection = false;
+constexpr bool kDefaultInteractiveFastLane = false;
+// 0 means node selection is not bounded by time.
+constexpr uint32_t kDefaultScheduleCycleBudgetMs = 0;
+constexpr uint32_t kDefaultMaxConcurrentExecuteStepsRpc = 64;
+constexpr uint32_t kDefaultLaunchTreeFanOut = 0;
+constexpr uint32_t kDefaultMaxConcurrentQueryRpcs = 64;
+constexpr uint32_t kDefaultMaxConcurrentMutatingRpcs = 128;
+constexpr uint32_t kDefaultQueryRpcRate = 50;
+constexpr uint32_t kDefaultQueryRpcBurst = 200;
+// 0 means queries read the task maps instead of a snapshot.
+constexpr uint32_t kDefaultTaskQuerySnapshotIntervalMs = 0;
+constexpr uint32_t kDefaultDbMaxPoolSize = 1000;
+constexpr uint32_t kDefaultJobArchiveAgeDays = 180;
+inline const char* const kDefaultJobArchiveDir = "cranectld/job_archive";
 
 struct Config {
   struct CraneCtldConf {
     uint32_t CranedTimeout;
+    // At most CranedConnectWindow craneds are connected to at a time.
+    uint32_t CranedConnectWindow;
+    uint32_t CranedConnectMinBackoffMs;
+    uint32_t CranedConnectMaxBackoffMs;
   };
 
   CraneCtldConf CtldConf;
@@ -91,6 +223,14 @@ struct Config {
     std::unordered_set<std::string> denied_accounts;
   };
 
+  struct TopologySwitch {
+    std::string name;
+    // Only one of the lists is set. A leaf switch lists its nodes and an
+    // upper switch lists its child switches.
+    std::vector<std::string> nodes;
+    std::vector<std::string> switches;
+  };
+
   struct CraneCtldListenConf {
     std::string CraneCtldListenAddr;
     std::string CraneCtldListenPort;
@@ -130,6 +270,9 @@ struct Config {
     // Config of multifactorial job priority sorting.
     bool FavorSmall{true};
     uint64_t MaxAge;
+    // Half-life in seconds of the historical usage in fair-share.
+    // 0 means fair-share only considers the running tasks.
+    uint64_t DecayHalfLife{0};
     uint32_t WeightAge;
     uint32_t WeightFairShare;
     uint32_t WeightJobSize;
@@ -140,6 +283,9 @@ struct Config {
   struct PluginConfig {
     bool Enabled{false};
     std::string PlugindSockPath;
+    uint32_t MaxQueuedEvents{kDefaultPluginMaxQueuedEvents};
+    // Hook calls wait for the queue instead of dropping the events if set.
+    bool BlockOnQueueFull{false};
   };
 
   bool CompressedRpc{};
@@ -151,6 +297,8 @@ struct Config {
 
   std::string CraneEmbeddedDbBackend;
   std::filesystem::path CraneCtldDbPath;
+  // In seconds. 0 disables the checkpoint of the embedded db.
+  uint64_t CraneEmbeddedDbCheckpointInterval{0};
 
   std::filesystem::path CraneBaseDir;
   std::filesystem::path CraneCtldMutexFilePath;
@@ -161,6 +309,7 @@ struct Config {
   std::unordered_map<std::string, std::shared_ptr<Node>> Nodes;
   std::unordered_map<std::string, Partition> Partitions;
   std::string DefaultPartition;
+  std::vector<TopologySwitch> Topology;
 
   Priority PriorityConfig;
 
@@ -171,6 +320,15 @@ struct Config {
   std::string DbPort;
   std::string DbRSName;
   std::string DbName;
+  // Each thread accessing MongoDB holds one client of the pool.
+  uint32_t DbMaxPoolSize{kDefaultDbMaxPoolSize};
+
+  struct JobArchiveConfig {
+    bool Enabled{false};
+    std::filesystem::path Dir;
+    uint32_t AgeDays{kDefaultJobArchiveAgeDays};
+  };
+  JobArchiveConfig JobArchiveConf;
 
   // Plugin config
   PluginConfig Plugin;
@@ -179,7 +337,53 @@ struct Config {
   uint32_t ScheduledBatchSize;
   bool RejectTasksBeyondCapacity{false};
   bool JobFileOpenModeAppend{false};
+  bool ParallelNodeSelection{false};
+  bool TopologyAwareSelection{false};
+  // Start interactive tasks fitting in the idle resources between scheduling
+  // cycles.
+  bool InteractiveFastLane{kDefaultInteractiveFastLane};
+  // Node selection stops after this long and the next cycle goes on with
+  // the rest of the tasks in the priority order.
+  uint32_t ScheduleCycleBudgetMs{kDefaultScheduleCycleBudgetMs};
+  uint32_t MaxConcurrentExecuteStepsRpc{kDefaultMaxConcurrentExecuteStepsRpc};
+  // 0 if the craneds are launched directly.
+  uint32_t LaunchTreeFanOut{kDefaultLaunchTreeFanOut};
+  // Size of the StepPayload cache of each craned, 0 if the scripts and the
+  // environments are sent in full.
+  uint64_t StepPayloadCacheBytes{0};
+  uint32_t MaxConcurrentQueryRpcs{kDefaultMaxConcurrentQueryRpcs};
+  uint32_t MaxConcurrentMutatingRpcs{kDefaultMaxConcurrentMutatingRpcs};
+
+  // Token bucket of each caller for a class of RPCs. It holds Burst tokens
+  // and gains Rate tokens per second. A zero Rate disables the limit.
+  struct RpcRateLimitConfig {
+    uint32_t Rate{0};
+    uint32_t Burst{0};
+  };
+  RpcRateLimitConfig QueryRpcRateLimit{kDefaultQueryRpcRate,
+                                       kDefaultQueryRpcBurst};
+  RpcRateLimitConfig MutatingRpcRateLimit;
+  uint32_t TaskQuerySnapshotIntervalMs{kDefaultTaskQuerySnapshotIntervalMs};
   bool IgnoreConfigInconsistency{false};
+
+  struct MetricsConfig {
+    bool Enabled{false};
+    std::string ListenAddr;
+    std::string ListenPort;
+    // Export the wait and hold time of the scheduler and metadata locks.
+    bool LockProfiling{false};
+  };
+  MetricsConfig Metrics;
+
+  struct QueryReplicationConfig {
+    // Publish the query state to the read replicas.
+    bool Enabled{false};
+    uint32_t SyncIntervalMs{kDefaultQueryReplicationSyncIntervalMs};
+    // If set, this ctld is a read replica of the ctld on the host. It only
+    // serves the task, node and partition queries.
+    std::string PrimaryHostname;
+  };
+  QueryReplicationConfig QueryReplication;
 };
 
 struct RunTimeStatus {
@@ -262,6 +466,12 @@ struct CranedMeta {
   // Store total resource of each reservation.
   absl::flat_hash_map<ResvId, ResvInNode> resv_in_node_map;
   // **********************************************************
+
+  // Bumped whenever anything the scheduler derives the availability timeline
+  // of this node from is changed, i.e. alive/drain, task allocations,
+  // reservations and time limits of running tasks.
+  // The scheduler reuses its cached timeline while this stays unchanged.
+  uint64_t sched_version{0};
 };
 
 struct LogicalPartition {
@@ -355,13 +565,29 @@ struct InteractiveMetaInTask {
   std::atomic<bool> has_been_terminated_on_craned{false};
 };
 
-struct BatchMetaInTask {
-  std::string sh_script;
-  std::string interpreter;
-  std::string output_file_pattern;
-  std::string error_file_pattern;
+// The script, the interpreter and the output patterns are not copied here.
+// They are kept in TaskToCtld only.
+struct BatchMetaInTask {};
+
+// Interns the passwd entries of the tasks, so that all the tasks of one user
+// share a single entry instead of holding a copy each. An entry is dropped
+// once no task refers to it, and it is replaced if the passwd database
+// returns a different one for the same uid.
+class PasswordEntryInternTable {
+ public:
+  std::shared_ptr<const PasswordEntry> Intern(PasswordEntry&& entry);
+
+ private:
+  using Mutex = absl::Mutex;
+  using LockGuard = absl::MutexLock;
+
+  Mutex m_mtx_;
+  absl::flat_hash_map<uid_t, std::weak_ptr<const PasswordEntry>> m_entries_
+      ABSL_GUARDED_BY(m_mtx_);
 };
 
+struct QosCounterHandle;
+
 struct TaskInCtld {
   /* -------- [1] Fields that are set at the submission time. ------- */
   absl::Duration time_limit;
@@ -389,13 +615,8 @@ struct TaskInCtld {
   bool requeue_if_failed{false};
   bool get_user_env{false};
 
-  std::string cmd_line;
-  std::unordered_map<std::string, std::string> env;
-  std::string cwd;
-  std::string container;
-
-  std::string extra_attr;
-
+  // cmd_line, env, cwd, container and extra_attr are read from TaskToCtld()
+  // to avoid keeping two copies.
   std::variant<InteractiveMetaInTask, BatchMetaInTask> meta;
 
   std::string reservation;
@@ -418,6 +639,7 @@ struct TaskInCtld {
   crane::grpc::TaskStatus status{};
   uint32_t exit_code{};
   bool held{false};
+  bool dependency_failed{false};
 
   // If this task is PENDING, start_time is either not set (default constructed)
   // or an estimated start time.
@@ -432,8 +654,17 @@ struct TaskInCtld {
   // Might change at each scheduling cycle.
   ResourceV2 allocated_res;
 
+  // Number of the upstream tasks of the dependencies which haven't ended.
+  // Not persisted, but rebuilt by TaskDependencyGraph on recovery.
+  uint32_t dependency_wait_num{0};
+
   /* ------ duplicate of the fields [1] above just for convenience ----- */
-  crane::grpc::TaskToCtld task_to_ctld;
+  // Shared by all the tasks submitted by one SubmitBatchTasks request, which
+  // only differ in the fields stored outside of it. It's copied on write by
+  // MutableTaskToCtld(). Pointers are only shared at submission, so a task
+  // holding the only reference never needs to copy it.
+  std::shared_ptr<crane::grpc::TaskToCtld> task_to_ctld =
+      std::make_shared<crane::grpc::TaskToCtld>();
 
   /* ------ duplicate of the fields [2][3] above just for convenience ----- */
   crane::grpc::RuntimeAttrOfTask runtime_attr;
@@ -444,13 +675,18 @@ struct TaskInCtld {
    * However, these fields are NOT persisted on the disk.
    * These fields are cached for performance purpose.
    * ----------- */
-  // set in SetFieldsByTaskToCtld from uid
-  std::unique_ptr<PasswordEntry> password_entry;
+  // set in SetFieldsByTaskToCtld from uid and shared by the tasks of the
+  // same user. See PasswordEntryInternTable.
+  std::shared_ptr<const PasswordEntry> password_entry;
 
   // Set in TaskScheduler->AcquireAttributes()
   uint32_t partition_priority{0};
   uint32_t qos_priority{0};
 
+  // Set in AccountMetaContainer::TryMallocQosResource() if the QoS resource
+  // is allocated, and released through it by FreeQosResource().
+  std::shared_ptr<const QosCounterHandle> qos_counter_handle;
+
   /* -----------
    * Fields that may change at run time.
    * However, these fields are NOT persisted on the disk.
@@ -465,8 +701,28 @@ struct TaskInCtld {
   std::string allocated_craneds_regex;
   std::string pending_reason;
 
+  // Nodes planned for a pending task by the cycle that estimated its start
+  // time at start_estimate_time. Empty if no estimate is available.
+  std::string planned_craneds_regex;
+  absl::Time start_estimate_time{absl::InfinitePast()};
+
   double mandated_priority{0.0};
 
+  // Copies of the fields changed by the scheduler during a scheduling cycle.
+  // Node selection only holds the reader lock of the pending map, so queries
+  // of pending tasks read these copies instead, which are refreshed under the
+  // writer lock when the cycle is committed.
+  struct SchedAttrSnapshot {
+    absl::Time start_time;
+    absl::Time end_time;
+    double cached_priority{0.0};
+    std::string pending_reason;
+    ResourceView allocated_res_view;
+    std::string planned_craneds_regex;
+    absl::Time start_estimate_time{absl::InfinitePast()};
+  };
+  SchedAttrSnapshot sched_attr_snapshot;
+
   // Helper function
  public:
   // =================== Get Attr ==================
@@ -476,8 +732,12 @@ struct TaskInCtld {
   bool IsX11WithPty() const;
   bool ShouldLaunchOnAllNodes() const;
 
-  crane::grpc::TaskToCtld const& TaskToCtld() const { return task_to_ctld; }
-  crane::grpc::TaskToCtld* MutableTaskToCtld() { return &task_to_ctld; }
+  crane::grpc::TaskToCtld const& TaskToCtld() const { return *task_to_ctld; }
+  crane::grpc::TaskToCtld* MutableTaskToCtld() {
+    if (task_to_ctld.use_count() > 1)
+      task_to_ctld = std::make_shared<crane::grpc::TaskToCtld>(*task_to_ctld);
+    return task_to_ctld.get();
+  }
 
   crane::grpc::RuntimeAttrOfTask const& RuntimeAttr() { return runtime_attr; }
 
@@ -521,13 +781,34 @@ struct TaskInCtld {
   void SetHeld(bool val);
   bool const& Held() const { return held; }
 
+  void SetDependencyWaitNum(uint32_t val) { dependency_wait_num = val; }
+  // Record that an upstream task has ended. If the dependency on it is not
+  // satisfied, the task will never start.
+  void ResolveDependency(task_id_t upstream_id, bool satisfied);
+  bool DependencyFailed() const { return dependency_failed; }
+  bool WaitingForDependency() const {
+    return dependency_wait_num > 0 || dependency_failed;
+  }
+
+  // Held tasks and tasks waiting for dependencies are not scheduled.
+  bool Blocked() const { return held || WaitingForDependency(); }
+  const char* BlockedReason() const;
+
   void SetCachedPriority(const double val);
   double CachedPriority() const { return cached_priority; }
 
   void SetAllocatedRes(ResourceV2&& val);
   ResourceV2 const& AllocatedRes() const { return allocated_res; }
 
+  // Accumulate a usage sample of the job cgroup on one of its nodes.
+  void AddUsageSample(crane::grpc::JobUsageSample const& sample);
+  crane::grpc::JobUsage const& Usage() const { return runtime_attr.usage(); }
+
+  void PublishSchedAttr();
+
   void SetFieldsByTaskToCtld(crane::grpc::TaskToCtld const& val);
+  // `val` is shared instead of copied.
+  void SetFieldsByTaskToCtld(std::shared_ptr<crane::grpc::TaskToCtld> val);
 
   void SetFieldsByRuntimeAttr(crane::grpc::RuntimeAttrOfTask const& val);
 
@@ -537,8 +818,20 @@ struct TaskInCtld {
   void SetFieldsOfTaskInfo(crane::grpc::TaskInfo* task_info);
 
   crane::grpc::TaskToD GetTaskToD(const CranedId& craned_id) const;
+  // Fill the messages in place, so that they may be built on an arena.
+  // If payload_hash is set, it replaces the script and the environment,
+  // see StepPayloadDedup.
+  void SetFieldsOfTaskToD(const CranedId& craned_id,
+                          crane::grpc::TaskToD* task_to_d,
+                          const std::string& payload_hash = {}) const;
 
   crane::grpc::JobToD GetJobToD(const CranedId& craned_id) const;
+  void SetFieldsOfJobToD(const CranedId& craned_id,
+                         crane::grpc::JobToD* spec) const;
+
+  // Approximate number of bytes held by this task. The shared TaskToCtld and
+  // passwd entry are counted in proportion to the number of their owners.
+  size_t ApproxMemoryUsage() const;
 };
 
 struct Qos {
@@ -707,11 +1000,6 @@ inline bool CheckIfTimeLimitIsValid(absl::Duration d) {
   return CheckIfTimeLimitSecIsValid(sec);
 }
 
-struct QosResource {
-  ResourceView resource;
-  uint32_t jobs_per_user;
-};
-
 // Transaction
 struct Txn {
   uint64_t creation_time;
@@ -721,6 +1009,16 @@ struct Txn {
   std::string info;
 };
 
+// Calls func(begin, end) on g_thread_pool for the chunks of [0, n) of at
+// least min_chunk items and waits for all of them. Runs inline if there is
+// only one chunk.
+void ParallelForChunks(size_t n, size_t min_chunk,
+                       std::function<void(size_t, size_t)> const& func);
+
 }  // namespace Ctld
 
-inline std::unique_ptr<BS::thread_pool> g_thread_pool;
\ No newline at end of file
+inline std::unique_ptr<BS::thread_pool> g_thread_pool;
+
+inline std::unique_ptr<util::metrics::MetricsServer> g_metrics_server;
+
+inline Ctld::PasswordEntryInternTable g_password_entry_intern_table;
\ No newline at end of file
@@ -18,8 +18,15 @@
 
 #include "DbClient.h"
 
+#include "JobArchive.h"
+
+#include <absl/strings/numbers.h>
 #include <bsoncxx/exception/exception.hpp>
+#include <bsoncxx/oid.hpp>
+#include <mongocxx/bulk_write.hpp>
 #include <mongocxx/exception/exception.hpp>
+#include <mongocxx/model/replace_one.hpp>
+#include <mongocxx/model/update_one.hpp>
 
 namespace Ctld {
 
@@ -45,9 +52,90 @@ bool MongodbClient::Connect() {
     return false;
   }
 
+  // Queries still work without the indexes, only slower.
+  if (!CheckIndexes_()) CRANE_ERROR("Failed to create the indexes of MongoDB.");
+
   return CheckDefaultRootAccountUserAndInit_();
 }
 
+bool MongodbClient::CheckIndexes_() {
+  using IndexKeys = std::vector<std::pair<std::string, int32_t>>;
+  struct Index {
+    const std::string& collection_name;
+    IndexKeys keys;
+    bool unique;
+  };
+
+  // For the task table: the sort orders and the selective filters of
+  // FetchJobRecords. Filters on user and account are mostly combined with a
+  // submit time interval. task_db_id also serves the upserts of jobs.
+  // For the rollup tables: the key of an upserted rollup.
+  // For the txn table: the order of QueryTxnLog, alone or after the filters
+  // on actor and target.
+  const IndexKeys rollup_keys{{"period_start", 1},
+                              {"account", 1},
+                              {"username", 1},
+                              {"partition_name", 1}};
+  const std::vector<Index> indexes{
+      {m_task_collection_name_, {{"task_db_id", 1}}, false},
+      {m_task_collection_name_, {{"task_id", 1}}, false},
+      {m_task_collection_name_, {{"time_submit", 1}}, false},
+      {m_task_collection_name_, {{"time_end", 1}}, false},
+      {m_task_collection_name_, {{"username", 1}, {"time_submit", 1}}, false},
+      {m_task_collection_name_, {{"account", 1}, {"time_submit", 1}}, false},
+      {m_task_collection_name_, {{"state", 1}, {"time_end", 1}}, false},
+      {m_usage_hourly_collection_name_, rollup_keys, true},
+      {m_usage_daily_collection_name_, rollup_keys, true},
+      {m_txn_collection_name_, {{"creation_time", 1}, {"_id", 1}}, false},
+      {m_txn_collection_name_,
+       {{"actor", 1}, {"creation_time", 1}, {"_id", 1}},
+       false},
+      {m_txn_collection_name_,
+       {{"target", 1}, {"creation_time", 1}, {"_id", 1}},
+       false},
+  };
+
+  try {
+    std::unordered_map<std::string, std::unordered_set<std::string>>
+        existing_names;
+
+    for (const Index& index : indexes) {
+      mongocxx::collection collection =
+          (*GetClient_())[m_db_name_][index.collection_name];
+
+      if (!existing_names.contains(index.collection_name)) {
+        auto& names = existing_names[index.collection_name];
+        for (auto existing : collection.list_indexes())
+          names.emplace(existing["name"].get_string().value);
+      }
+
+      document keys_doc;
+      std::vector<std::string> name_parts;
+      for (const auto& [field, order] : index.keys) {
+        keys_doc.append(kvp(field, order));
+        name_parts.emplace_back(fmt::format("{}_{}", field, order));
+      }
+
+      // Same as the default name given by MongoDB, so an index created by
+      // hand with the same keys is recognized.
+      std::string name = absl::StrJoin(name_parts, "_");
+      if (existing_names[index.collection_name].contains(name)) continue;
+
+      CRANE_INFO("Creating index {} of {}. It may take a while.", name,
+                 index.collection_name);
+      document options;
+      options.append(kvp("name", name));
+      if (index.unique) options.append(kvp("unique", true));
+      collection.create_index(keys_doc.view(), options.view());
+    }
+  } catch (const std::exception& e) {
+    CRANE_LOGGER_ERROR(m_logger_, e.what());
+    return false;
+  }
+
+  return true;
+}
+
 bool MongodbClient::CheckDefaultRootAccountUserAndInit_() {
   Qos qos;
   if (!SelectQos("name", kUnlimitedQosName, &qos)) {
@@ -112,62 +200,271 @@ bool MongodbClient::CheckDefaultRootAccountUserAndInit_() {
 
 bool MongodbClient::InsertRecoveredJob(
     const crane::grpc::TaskInEmbeddedDb& task_in_embedded_db) {
-  document doc = TaskInEmbeddedDbToDocument_(task_in_embedded_db);
+  std::vector<bsoncxx::document::value> documents;
+  documents.emplace_back(JobDocumentOf(task_in_embedded_db));
+  return UpsertJobs(documents);
+}
 
-  try {
-    bsoncxx::stdx::optional<mongocxx::result::insert_one> ret =
-        (*GetClient_())[m_db_name_][m_task_collection_name_].insert_one(
-            *GetSession_(), doc.view());
+bool MongodbClient::InsertJob(TaskInCtld* task) {
+  std::vector<bsoncxx::document::value> documents;
+  documents.emplace_back(JobDocumentOf(task));
+  return UpsertJobs(documents);
+}
 
-    if (ret != bsoncxx::stdx::nullopt) return true;
-  } catch (const std::exception& e) {
-    CRANE_LOGGER_ERROR(m_logger_, e.what());
-  }
-  CRANE_LOGGER_ERROR(m_logger_, "Failed to insert in-memory TaskInCtld.");
-  return false;
+bool MongodbClient::InsertJobs(const std::vector<TaskInCtld*>& tasks) {
+  if (tasks.empty()) return false;
+
+  std::vector<bsoncxx::document::value> documents;
+  documents.reserve(tasks.size());
+  for (TaskInCtld* task : tasks) documents.emplace_back(JobDocumentOf(task));
+  return UpsertJobs(documents);
 }
 
-bool MongodbClient::InsertJob(TaskInCtld* task) {
-  document doc = TaskInCtldToDocument_(task);
+bsoncxx::document::value MongodbClient::JobDocumentOf(TaskInCtld* task) {
+  return TaskInCtldToDocument_(task).extract();
+}
 
-  try {
-    bsoncxx::stdx::optional<mongocxx::result::insert_one> ret =
-        (*GetClient_())[m_db_name_][m_task_collection_name_].insert_one(
-            *GetSession_(), doc.view());
+bsoncxx::document::value MongodbClient::JobDocumentOf(
+    const crane::grpc::TaskInEmbeddedDb& task_in_embedded_db) {
+  return TaskInEmbeddedDbToDocument_(task_in_embedded_db).extract();
+}
 
-    if (ret != bsoncxx::stdx::nullopt) return true;
+bool MongodbClient::UpsertJobs(
+    const std::vector<bsoncxx::document::value>& documents) {
+  if (documents.empty()) return true;
+
+  // The jobs and their usage are written in one transaction, and only the
+  // jobs new to the task table are added to the rollups, so a retried batch
+  // doesn't count a job twice.
+  bool ok = false;
+  auto callback = [&](mongocxx::client_session* session) {
+    ok = false;
+
+    mongocxx::options::bulk_write bulk_options;
+    bulk_options.ordered(false);  // unordered to speed up the operation
+
+    mongocxx::bulk_write bulk =
+        (*GetClient_())[m_db_name_][m_task_collection_name_].create_bulk_write(
+            *session, bulk_options);
+    for (const auto& doc : documents) {
+      document filter;
+      filter.append(kvp("task_db_id", doc.view()["task_db_id"].get_value()));
+
+      mongocxx::model::replace_one replace{filter.extract(), doc.view()};
+      replace.upsert(true);
+      bulk.append(replace);
+    }
+
+    bsoncxx::stdx::optional<mongocxx::result::bulk_write> ret =
+        bulk.execute();
+    if (ret == bsoncxx::stdx::nullopt ||
+        size_t(ret->upserted_count() + ret->matched_count()) !=
+            documents.size())
+      return;
+
+    std::vector<bsoncxx::document::view> new_jobs;
+    for (const auto& [index, id] : ret->upserted_ids())
+      new_jobs.emplace_back(documents[index].view());
+    AddJobsToUsageRollups_(session, new_jobs);
+
+    ok = true;
+  };
+
+  try {
+    mongocxx::options::transaction opts;
+    opts.write_concern(m_wc_majority_);
+    opts.read_concern(m_rc_local_);
+    opts.read_preference(m_rp_primary_);
+    GetSession_()->with_transaction(callback, opts);
   } catch (const std::exception& e) {
     CRANE_LOGGER_ERROR(m_logger_, e.what());
+    ok = false;
   }
 
-  CRANE_LOGGER_ERROR(m_logger_, "Failed to insert in-memory TaskInCtld.");
-  return false;
+  if (!ok)
+    CRANE_LOGGER_ERROR(m_logger_, "Failed to upsert {} jobs.",
+                       documents.size());
+  return ok;
 }
 
-bool MongodbClient::InsertJobs(const std::vector<TaskInCtld*>& tasks) {
-  if (tasks.empty()) return false;
-  std::vector<bsoncxx::document::value> documents;
+void MongodbClient::AddJobsToUsageRollups_(
+    mongocxx::client_session* session,
+    const std::vector<bsoncxx::document::view>& jobs) {
+  if (jobs.empty()) return;
+
+  // period_start, account, username, partition_name
+  using RollupKey = std::tuple<int64_t, std::string, std::string, std::string>;
+  struct RollupDelta {
+    double cpu_seconds{0};
+    std::map<std::string, double> device_seconds;
+    int64_t job_count{0};
+  };
+
+  auto add_to_rollups = [&](const std::string& collection_name,
+                            int64_t period) {
+    absl::flat_hash_map<RollupKey, RollupDelta> deltas;
+
+    for (const auto& job : jobs) {
+      int64_t start = job["time_start"].get_int64().value;
+      int64_t end = job["time_end"].get_int64().value;
+      if (end <= 0) continue;
+
+      std::string account{job["account"].get_string().value};
+      std::string username{job["username"].get_string().value};
+      std::string partition{job["partition_name"].get_string().value};
+      auto delta_of = [&](int64_t time) -> RollupDelta& {
+        return deltas[RollupKey{time - time % period, account, username,
+                                partition}];
+      };
+
+      delta_of(end).job_count++;
+      if (start <= 0 || start >= end) continue;
+
+      double cpus = job["cpus_alloc"].get_double().value;
+      std::vector<std::pair<std::string, int64_t>> devices;
+      auto device_map = job["device_map"];
+      if (device_map && device_map.type() == bsoncxx::type::k_document)
+        for (const auto& device : device_map.get_document().view())
+          devices.emplace_back(device.key(),
+                               device["total"].get_int64().value);
+
+      // The usage is split over the periods the run overlaps.
+      for (int64_t begin = start - start % period; begin < end;
+           begin += period) {
+        int64_t overlap =
+            std::min(end, begin + period) - std::max(start, begin);
+        RollupDelta& delta = delta_of(begin);
+        delta.cpu_seconds += cpus * overlap;
+        for (const auto& [name, total] : devices)
+          delta.device_seconds[name] += double(total * overlap);
+      }
+    }
+
+    if (deltas.empty()) return;
+
+    mongocxx::options::bulk_write bulk_options;
+    bulk_options.ordered(false);
+    mongocxx::bulk_write bulk =
+        (*GetClient_())[m_db_name_][collection_name].create_bulk_write(
+            *session, bulk_options);
+
+    for (const auto& [key, delta] : deltas) {
+      const auto& [period_start, account, username, partition] = key;
+
+      document filter;
+      filter.append(kvp("period_start", period_start), kvp("account", account),
+                    kvp("username", username),
+                    kvp("partition_name", partition));
+
+      document inc;
+      inc.append(kvp("cpu_seconds", delta.cpu_seconds),
+                 kvp("job_count", delta.job_count));
+      for (const auto& [name, seconds] : delta.device_seconds)
+        inc.append(kvp(fmt::format("device_seconds.{}", name), seconds));
 
-  for (const auto& task : tasks) {
-    document doc = TaskInCtldToDocument_(task);
-    documents.push_back(doc.extract());
+      document update;
+      update.append(kvp("$inc", inc.extract()));
+
+      mongocxx::model::update_one update_model{filter.extract(),
+                                               update.extract()};
+      update_model.upsert(true);
+      bulk.append(update_model);
+    }
+
+    bulk.execute();
+  };
+
+  add_to_rollups(m_usage_hourly_collection_name_, kUsageRollupHourSeconds);
+  add_to_rollups(m_usage_daily_collection_name_, kUsageRollupDaySeconds);
+}
+
+bool MongodbClient::FetchUsageSummary(
+    const crane::grpc::QueryUsageSummaryRequest* request,
+    crane::grpc::QueryUsageSummaryReply* response) {
+  bool daily =
+      request->granularity() == crane::grpc::QueryUsageSummaryRequest::DAY;
+  const std::string& collection_name = daily
+                                           ? m_usage_daily_collection_name_
+                                           : m_usage_hourly_collection_name_;
+  int64_t period = daily ? kUsageRollupDaySeconds : kUsageRollupHourSeconds;
+
+  document filter;
+
+  if (request->has_filter_period_interval()) {
+    const auto& interval = request->filter_period_interval();
+    filter.append(kvp("period_start", [&](sub_document period_doc) {
+      if (interval.has_lower_bound()) {
+        int64_t lower = interval.lower_bound().seconds();
+        period_doc.append(kvp("$gte", lower - lower % period));
+      }
+      if (interval.has_upper_bound())
+        period_doc.append(kvp("$lte", interval.upper_bound().seconds()));
+    }));
   }
 
-  mongocxx::options::insert insert_options;
-  insert_options.ordered(false);  // unordered to speed up the operation
+  auto append_in_filter = [&filter](const std::string& field,
+                                    const auto& values) {
+    if (values.empty()) return;
+    filter.append(kvp(field, [&values](sub_document in_doc) {
+      array value_array;
+      for (const auto& value : values) value_array.append(value);
+      in_doc.append(kvp("$in", value_array));
+    }));
+  };
+  append_in_filter("account", request->filter_accounts());
+  append_in_filter("username", request->filter_users());
+  append_in_filter("partition_name", request->filter_partitions());
+
+  // Rollups of the dimensions not grouped by are summed into one summary.
+  using SummaryKey = std::tuple<int64_t, std::string, std::string, std::string>;
+  std::map<SummaryKey, crane::grpc::QueryUsageSummaryReply::UsageSummary>
+      summaries;
 
   try {
-    bsoncxx::stdx::optional<mongocxx::result::insert_many> ret =
-        (*GetClient_())[m_db_name_][m_task_collection_name_].insert_many(
-            *GetSession_(), documents, insert_options);
-    if (ret != bsoncxx::stdx::nullopt && ret->inserted_count() == tasks.size())
-      return true;
+    mongocxx::cursor cursor =
+        (*GetClient_())[m_db_name_][collection_name].find(filter.view());
+
+    for (auto view : cursor) {
+      SummaryKey key{
+          request->group_by_period() ? view["period_start"].get_int64().value
+                                     : 0,
+          request->group_by_account()
+              ? std::string(view["account"].get_string().value)
+              : std::string{},
+          request->group_by_user()
+              ? std::string(view["username"].get_string().value)
+              : std::string{},
+          request->group_by_partition()
+              ? std::string(view["partition_name"].get_string().value)
+              : std::string{}};
+
+      auto& summary = summaries[key];
+      summary.set_cpu_seconds(summary.cpu_seconds() +
+                              view["cpu_seconds"].get_double().value);
+      summary.set_job_count(summary.job_count() +
+                            view["job_count"].get_int64().value);
+
+      auto device_seconds = view["device_seconds"];
+      if (device_seconds && device_seconds.type() == bsoncxx::type::k_document)
+        for (const auto& device : device_seconds.get_document().view())
+          (*summary.mutable_device_seconds())[std::string(device.key())] +=
+              device.get_double().value;
+    }
   } catch (const std::exception& e) {
     CRANE_LOGGER_ERROR(m_logger_, e.what());
+    return false;
   }
 
-  CRANE_LOGGER_ERROR(m_logger_, "Failed to insert in-memory TaskInCtld.");
-  return false;
+  for (auto& [key, summary] : summaries) {
+    const auto& [period_start, account, username, partition] = key;
+    summary.set_period_start(period_start);
+    summary.set_account(account);
+    summary.set_username(username);
+    summary.set_partition(partition);
+    *response->add_summaries() = std::move(summary);
+  }
+
+  return true;
 }
 
 bool MongodbClient::FetchJobRecords(
@@ -272,13 +569,19 @@ bool MongodbClient::FetchJobRecords(
   }
 
   bool has_task_ids_constraint = !request->filter_task_ids().empty();
-  if (has_task_ids_constraint) {
-    filter.append(kvp("task_id", [&request](sub_document task_id_doc) {
-      array task_id_array;
-      for (const auto& task_id : request->filter_task_ids()) {
-        task_id_array.append(static_cast<std::int32_t>(task_id));
+  bool paginated = request->page_size() > 0;
+  if (has_task_ids_constraint || paginated) {
+    filter.append(kvp("task_id", [&](sub_document task_id_doc) {
+      if (has_task_ids_constraint) {
+        array task_id_array;
+        for (const auto& task_id : request->filter_task_ids()) {
+          task_id_array.append(static_cast<std::int32_t>(task_id));
+        }
+        task_id_doc.append(kvp("$in", task_id_array));
       }
-      task_id_doc.append(kvp("$in", task_id_array));
+      if (paginated)
+        task_id_doc.append(kvp(
+            "$gt", static_cast<std::int32_t>(request->page_after_task_id())));
     }));
   }
 
@@ -296,10 +599,30 @@ bool MongodbClient::FetchJobRecords(
   mongocxx::options::find option;
   option = option.limit(limit);
 
+  // Pages are in ascending order of task id to be resumable from a cursor.
   document sort_doc;
-  sort_doc.append(kvp("task_db_id", -1));
+  if (paginated)
+    sort_doc.append(kvp("task_id", 1));
+  else
+    sort_doc.append(kvp("task_db_id", -1));
   option = option.sort(sort_doc.view());
 
+  // Only the fields converted into TaskInfo are returned. The script and the
+  // environment are usually the bulk of a job document.
+  document projection;
+  for (const char* field :
+       {"task_id",     "nodes_alloc", "account",        "username",
+        "cpus_req",    "mem_req",     "cpus_alloc",     "mem_alloc",
+        "device_map",  "task_name",   "qos",            "id_user",
+        "id_group",    "nodelist",    "partition_name", "time_start",
+        "time_end",    "state",       "timelimit",      "time_submit",
+        "work_dir",    "submit_line", "exit_code",      "type",
+        "extra_attr",  "priority",    "reservation",    "exclusive",
+        "container",   "mem_peak",    "mem_avg",        "cpu_usage_usec",
+        "io_read_bytes", "io_write_bytes"})
+    projection.append(kvp(field, 1));
+  option = option.projection(projection.view());
+
   mongocxx::cursor cursor =
       (*GetClient_())[m_db_name_][m_task_collection_name_].find(filter.view(),
                                                                 option);
@@ -311,82 +634,185 @@ bool MongodbClient::FetchJobRecords(
   // 20 script        state          timelimit     time_submit work_dir
   // 25 submit_line   exit_code      username       qos        get_user_env
   // 30 type          extra_attr     reservation    exclusive  cpus_alloc
-  // 35 mem_alloc     device_map     container
+  // 35 mem_alloc     device_map     container     cpu_usage_usec mem_peak
+  // 40 mem_avg       io_read_bytes  io_write_bytes
 
+  size_t fetched_num = 0;
   try {
     for (auto view : cursor) {
-      auto* task = task_list->Add();
-
-      task->set_task_id(view["task_id"].get_int32().value);
-
-      task->set_node_num(view["nodes_alloc"].get_int32().value);
-
-      task->set_account(view["account"].get_string().value.data());
-      task->set_username(view["username"].get_string().value.data());
-
-      auto* mutable_req_res_view = task->mutable_req_res_view();
-      auto* mutable_req_alloc_res =
-          mutable_req_res_view->mutable_allocatable_res();
-      mutable_req_alloc_res->set_cpu_core_limit(
-          view["cpus_req"].get_double().value);
-      mutable_req_alloc_res->set_memory_limit_bytes(
-          view["mem_req"].get_int64().value);
-      mutable_req_alloc_res->set_memory_sw_limit_bytes(
-          view["mem_req"].get_int64().value);
-
-      auto* mutable_allocated_res_view = task->mutable_allocated_res_view();
-      auto* mutable_allocated_alloc_res =
-          mutable_allocated_res_view->mutable_allocatable_res();
-      mutable_allocated_alloc_res->set_cpu_core_limit(
-          view["cpus_alloc"].get_double().value);
-      mutable_allocated_alloc_res->set_memory_limit_bytes(
-          view["mem_alloc"].get_int64().value);
-      mutable_allocated_alloc_res->set_memory_sw_limit_bytes(
-          view["mem_alloc"].get_int64().value);
-      auto* device_map_ptr = mutable_allocated_res_view->mutable_device_map();
-      *device_map_ptr = ToGrpcDeviceMap(BsonToDeviceMap(view));
-      task->set_name(std::string(view["task_name"].get_string().value));
-      task->set_qos(std::string(view["qos"].get_string().value));
-      task->set_uid(view["id_user"].get_int32().value);
-      task->set_gid(view["id_group"].get_int32().value);
-      task->set_craned_list(view["nodelist"].get_string().value.data());
-      task->set_partition(
-          std::string(view["partition_name"].get_string().value));
-
-      task->mutable_start_time()->set_seconds(
-          view["time_start"].get_int64().value);
-      task->mutable_end_time()->set_seconds(view["time_end"].get_int64().value);
-
-      task->set_status(static_cast<crane::grpc::TaskStatus>(
-          view["state"].get_int32().value));
-      task->mutable_time_limit()->set_seconds(
-          view["timelimit"].get_int64().value);
-      task->mutable_submit_time()->set_seconds(
-          view["time_submit"].get_int64().value);
-      task->set_cwd(std::string(view["work_dir"].get_string().value));
-      if (view["submit_line"])
-        task->set_cmd_line(std::string(view["submit_line"].get_string().value));
-      task->set_exit_code(view["exit_code"].get_int32().value);
-
-      task->set_type((crane::grpc::TaskType)view["type"].get_int32().value);
-
-      task->set_extra_attr(view["extra_attr"].get_string().value.data());
-
-      task->set_priority(view["priority"].get_int64().value);
-
-      if (view.find("reservation") != view.end()) {
-        task->set_reservation(view["reservation"].get_string().value.data());
-      }
-      task->set_exclusive(view["exclusive"].get_bool().value);
-      task->set_container(view["container"].get_string().value);
+      ViewToTaskInfo_(view, task_list->Add());
+      fetched_num++;
     }
   } catch (const std::exception& e) {
     CRANE_LOGGER_ERROR(m_logger_, e.what());
   }
 
+  if (g_job_archive && g_job_archive->MayContain(*request))
+    FetchArchivedJobRecords_(request, response, limit, fetched_num);
+
   return true;
 }
 
+void MongodbClient::FetchArchivedJobRecords_(
+    const crane::grpc::QueryTasksInfoRequest* request,
+    crane::grpc::QueryTasksInfoReply* response, size_t limit,
+    size_t fetched_num) {
+  auto* task_list = response->mutable_task_info_list();
+
+  try {
+    if (request->page_size() == 0) {
+      // Archived jobs are older than those in the task table, so they only
+      // fill up the rest of the limit.
+      if (fetched_num >= limit) return;
+      size_t archived_num = limit - fetched_num;
+      g_job_archive->Scan(*request, [&](const bsoncxx::document::view& job) {
+        ViewToTaskInfo_(job, task_list->Add());
+        return --archived_num > 0;
+      });
+      return;
+    }
+
+    // A page is the smallest task ids after the cursor, which may be
+    // anywhere in the archive.
+    std::map<uint32_t, bsoncxx::document::value> page;
+    g_job_archive->Scan(*request, [&](const bsoncxx::document::view& job) {
+      page.emplace(job["task_id"].get_int32().value, job);
+      if (page.size() > limit) page.erase(std::prev(page.end()));
+      return true;
+    });
+    for (const auto& job : page | std::views::values)
+      ViewToTaskInfo_(job.view(), task_list->Add());
+  } catch (const std::exception& e) {
+    CRANE_LOGGER_ERROR(m_logger_, e.what());
+  }
+}
+
+bool MongodbClient::ArchiveJobsEndedBefore(int64_t cutoff,
+                                           JobArchive* archive) {
+  document filter;
+  filter.append(kvp("time_end", [cutoff](sub_document time_end_doc) {
+    time_end_doc.append(kvp("$gt", int64_t{0}), kvp("$lt", cutoff));
+  }));
+
+  document sort_doc;
+  sort_doc.append(kvp("time_end", 1));
+  document projection;
+  projection.append(kvp("_id", 0));
+
+  mongocxx::options::find option;
+  option.limit(kJobArchiveSegmentMaxJobNum);
+  option.sort(sort_doc.view());
+  option.projection(projection.view());
+
+  uint64_t archived_num = 0;
+  try {
+    mongocxx::collection collection =
+        (*GetClient_())[m_db_name_][m_task_collection_name_];
+
+    while (true) {
+      std::vector<bsoncxx::document::value> jobs;
+      for (auto view : collection.find(filter.view(), option))
+        jobs.emplace_back(view);
+      if (jobs.empty()) break;
+
+      // The jobs are only deleted once their segments are durable.
+      if (!archive->WriteSegments(jobs)) return false;
+
+      array db_ids;
+      for (const auto& job : jobs)
+        db_ids.append(job.view()["task_db_id"].get_value());
+      document delete_filter;
+      delete_filter.append(kvp("task_db_id", [&db_ids](sub_document in_doc) {
+        in_doc.append(kvp("$in", db_ids.view()));
+      }));
+      collection.delete_many(delete_filter.view());
+
+      archived_num += jobs.size();
+      if (jobs.size() < kJobArchiveSegmentMaxJobNum) break;
+    }
+  } catch (const std::exception& e) {
+    CRANE_LOGGER_ERROR(m_logger_, e.what());
+    return false;
+  }
+
+  if (archived_num > 0)
+    CRANE_INFO("Archived {} jobs ended before {}.", archived_num,
+               absl::FormatTime(absl::FromUnixSeconds(cutoff)));
+  return true;
+}
+
+void MongodbClient::ViewToTaskInfo_(const bsoncxx::document::view& view,
+                                    crane::grpc::TaskInfo* task) {
+  task->set_task_id(view["task_id"].get_int32().value);
+
+  task->set_node_num(view["nodes_alloc"].get_int32().value);
+
+  task->set_account(view["account"].get_string().value.data());
+  task->set_username(view["username"].get_string().value.data());
+
+  auto* mutable_req_res_view = task->mutable_req_res_view();
+  auto* mutable_req_alloc_res = mutable_req_res_view->mutable_allocatable_res();
+  mutable_req_alloc_res->set_cpu_core_limit(
+      view["cpus_req"].get_double().value);
+  mutable_req_alloc_res->set_memory_limit_bytes(
+      view["mem_req"].get_int64().value);
+  mutable_req_alloc_res->set_memory_sw_limit_bytes(
+      view["mem_req"].get_int64().value);
+
+  auto* mutable_allocated_res_view = task->mutable_allocated_res_view();
+  auto* mutable_allocated_alloc_res =
+      mutable_allocated_res_view->mutable_allocatable_res();
+  mutable_allocated_alloc_res->set_cpu_core_limit(
+      view["cpus_alloc"].get_double().value);
+  mutable_allocated_alloc_res->set_memory_limit_bytes(
+      view["mem_alloc"].get_int64().value);
+  mutable_allocated_alloc_res->set_memory_sw_limit_bytes(
+      view["mem_alloc"].get_int64().value);
+  auto* device_map_ptr = mutable_allocated_res_view->mutable_device_map();
+  *device_map_ptr = ToGrpcDeviceMap(BsonToDeviceMap(view));
+  task->set_name(std::string(view["task_name"].get_string().value));
+  task->set_qos(std::string(view["qos"].get_string().value));
+  task->set_uid(view["id_user"].get_int32().value);
+  task->set_gid(view["id_group"].get_int32().value);
+  task->set_craned_list(view["nodelist"].get_string().value.data());
+  task->set_partition(std::string(view["partition_name"].get_string().value));
+
+  task->mutable_start_time()->set_seconds(view["time_start"].get_int64().value);
+  task->mutable_end_time()->set_seconds(view["time_end"].get_int64().value);
+
+  task->set_status(
+      static_cast<crane::grpc::TaskStatus>(view["state"].get_int32().value));
+  task->mutable_time_limit()->set_seconds(view["timelimit"].get_int64().value);
+  task->mutable_submit_time()->set_seconds(
+      view["time_submit"].get_int64().value);
+  task->set_cwd(std::string(view["work_dir"].get_string().value));
+  if (view["submit_line"])
+    task->set_cmd_line(std::string(view["submit_line"].get_string().value));
+  task->set_exit_code(view["exit_code"].get_int32().value);
+
+  task->set_type((crane::grpc::TaskType)view["type"].get_int32().value);
+
+  task->set_extra_attr(view["extra_attr"].get_string().value.data());
+
+  task->set_priority(view["priority"].get_int64().value);
+
+  if (view.find("reservation") != view.end()) {
+    task->set_reservation(view["reservation"].get_string().value.data());
+  }
+  task->set_exclusive(view["exclusive"].get_bool().value);
+  task->set_container(view["container"].get_string().value);
+
+  // Jobs recorded before usage sampling have no usage fields.
+  if (view.find("cpu_usage_usec") != view.end()) {
+    auto* usage = task->mutable_usage();
+    usage->set_cpu_usage_usec(view["cpu_usage_usec"].get_int64().value);
+    usage->set_memory_peak_bytes(view["mem_peak"].get_int64().value);
+    usage->set_memory_avg_bytes(view["mem_avg"].get_int64().value);
+    usage->set_io_read_bytes(view["io_read_bytes"].get_int64().value);
+    usage->set_io_write_bytes(view["io_write_bytes"].get_int64().value);
+  }
+}
+
 bool MongodbClient::CheckTaskDbIdExisted(int64_t task_db_id) {
   document doc;
   doc.append(kvp("job_db_inx", task_db_id));
@@ -565,6 +991,44 @@ bool MongodbClient::UpdateUser(const Ctld::User& user) {
   return true;
 }
 
+bool MongodbClient::UpsertUsers(
+    const std::vector<std::pair<const User*, bool>>& users) {
+  if (users.empty()) return true;
+
+  try {
+    mongocxx::options::bulk_write bulk_options;
+    bulk_options.ordered(false);
+
+    mongocxx::bulk_write bulk =
+        (*GetClient_())[m_db_name_][m_user_collection_name_].create_bulk_write(
+            *GetSession_(), bulk_options);
+
+    int64_t now = ToUnixSeconds(absl::Now());
+    for (const auto& [user, created] : users) {
+      document doc = UserToDocument_(*user), set_document, filter;
+      doc.append(kvp("mod_time", now));
+      if (created) doc.append(kvp("creation_time", now));
+      set_document.append(kvp("$set", doc));
+
+      filter.append(kvp("name", user->name));
+
+      mongocxx::model::update_one update{filter.extract(),
+                                         set_document.extract()};
+      update.upsert(true);
+      bulk.append(update);
+    }
+
+    bsoncxx::stdx::optional<mongocxx::result::bulk_write> ret =
+        bulk.execute();
+    return ret != bsoncxx::stdx::nullopt &&
+           size_t(ret->upserted_count() + ret->matched_count()) ==
+               users.size();
+  } catch (const std::exception& e) {
+    CRANE_LOGGER_ERROR(m_logger_, e.what());
+  }
+  return false;
+}
+
 bool MongodbClient::UpdateAccount(const Ctld::Account& account) {
   document doc = AccountToDocument_(account), setDocument, filter;
   doc.append(kvp("mod_time", ToUnixSeconds(absl::Now())));
@@ -617,11 +1081,64 @@ bool MongodbClient::InsertTxn(const Txn& txn) {
   return ret != bsoncxx::stdx::nullopt;
 }
 
-void MongodbClient::SelectTxns(
+bool MongodbClient::InsertTxns(const std::vector<Txn>& txns) {
+  if (txns.empty()) return true;
+
+  std::vector<bsoncxx::document::value> documents;
+  documents.reserve(txns.size());
+  for (const auto& txn : txns)
+    documents.emplace_back(TxnToDocument_(txn).extract());
+
+  try {
+    bsoncxx::stdx::optional<mongocxx::result::insert_many> ret =
+        (*GetClient_())[m_db_name_][m_txn_collection_name_].insert_many(
+            *GetSession_(), documents);
+
+    return ret != bsoncxx::stdx::nullopt &&
+           size_t(ret->inserted_count()) == txns.size();
+  } catch (const std::exception& e) {
+    CRANE_LOGGER_ERROR(m_logger_, e.what());
+  }
+  return false;
+}
+
+bool MongodbClient::SelectTxns(
     const std::unordered_map<std::string, std::string>& conditions,
-    int64_t start_time, int64_t end_time, std::list<Txn>* res_txn) {
+    int64_t start_time, int64_t end_time, uint32_t limit,
+    const std::string& page_cursor, std::list<Txn>* res_txn,
+    std::string* next_page_cursor) {
   bsoncxx::builder::basic::document doc_builder;
 
+  // A cursor is the creation time and the id of a txn, which is the key of
+  // the order of the txns.
+  if (!page_cursor.empty()) {
+    std::vector<std::string> parts = absl::StrSplit(page_cursor, '_');
+    int64_t cursor_time;
+    if (parts.size() != 2 || !absl::SimpleAtoi(parts[0], &cursor_time)) {
+      CRANE_LOGGER_ERROR(m_logger_, "Invalid txn page cursor '{}'.",
+                         page_cursor);
+      return false;
+    }
+
+    try {
+      bsoncxx::oid cursor_id{parts[1]};
+      doc_builder.append(kvp("$or", [&](sub_array array) {
+        array.append(bsoncxx::builder::basic::make_document(
+            kvp("creation_time",
+                bsoncxx::builder::basic::make_document(
+                    kvp("$lt", cursor_time)))));
+        array.append(bsoncxx::builder::basic::make_document(
+            kvp("creation_time", cursor_time),
+            kvp("_id", bsoncxx::builder::basic::make_document(
+                           kvp("$lt", cursor_id)))));
+      }));
+    } catch (const bsoncxx::exception& e) {
+      CRANE_LOGGER_ERROR(m_logger_, "Invalid txn page cursor '{}': {}",
+                         page_cursor, e.what());
+      return false;
+    }
+  }
+
   if (start_time != 0 || end_time != 0) {
     bsoncxx::builder::basic::document range_doc;
     if (start_time != 0) range_doc.append(kvp("$gte", start_time));
@@ -647,23 +1164,44 @@ void MongodbClient::SelectTxns(
       doc_builder.append(kvp(key, value));
   }
 
+  // One more txn is fetched to tell whether there are more.
   mongocxx::options::find find_options;
-  // TODO: page query?
-  find_options.limit(1000);
+  find_options.limit(int64_t{limit} + 1);
 
-  // Return newest-first deterministically.
+  // Return newest-first deterministically. The id breaks the ties of txns
+  // created in the same second.
   bsoncxx::builder::basic::document sort_doc;
   sort_doc.append(kvp("creation_time", -1));
+  sort_doc.append(kvp("_id", -1));
   find_options.sort(sort_doc.view());
-  mongocxx::cursor cursor =
-      (*GetClient_())[m_db_name_][m_txn_collection_name_].find(
-          doc_builder.view(), find_options);
 
-  for (auto view : cursor) {
-    Txn txn;
-    ViewToTxn_(view, &txn);
-    res_txn->emplace_back(txn);
+  next_page_cursor->clear();
+  try {
+    mongocxx::cursor cursor =
+        (*GetClient_())[m_db_name_][m_txn_collection_name_].find(
+            doc_builder.view(), find_options);
+
+    uint32_t count = 0;
+    std::string last_cursor;
+    for (auto view : cursor) {
+      if (count == limit) {
+        *next_page_cursor = std::move(last_cursor);
+        break;
+      }
+
+      Txn txn;
+      ViewToTxn_(view, &txn);
+      last_cursor = fmt::format("{}_{}", txn.creation_time,
+                                view["_id"].get_oid().value.to_string());
+      res_txn->emplace_back(std::move(txn));
+      count++;
+    }
+  } catch (const std::exception& e) {
+    CRANE_LOGGER_ERROR(m_logger_, e.what());
+    return false;
   }
+
+  return true;
 }
 
 bool MongodbClient::CommitTransaction(
@@ -794,12 +1332,41 @@ T MongodbClient::ViewValueOr_(const ViewValue& view_value,
 
 mongocxx::client* MongodbClient::GetClient_() {
   if (m_connect_pool_) {
-    thread_local mongocxx::pool::entry entry{m_connect_pool_->acquire()};
+    thread_local mongocxx::pool::entry entry{AcquireClient_()};
     return &(*entry);
   }
   return nullptr;
 }
 
+mongocxx::pool::entry MongodbClient::AcquireClient_() {
+  auto begin = std::chrono::steady_clock::now();
+
+  auto entry = m_connect_pool_->try_acquire();
+  if (!entry) {
+    CRANE_LOGGER_WARN(m_logger_,
+                      "All {} clients of the MongoDB pool are taken. Waiting "
+                      "for one. DbMaxPoolSize may be too small.",
+                      g_config.DbMaxPoolSize);
+    entry = m_connect_pool_->acquire();
+  }
+
+  m_pool_acquire_histogram_.Record(std::chrono::steady_clock::now() - begin);
+  m_acquired_client_num_.fetch_add(1, std::memory_order_relaxed);
+  return std::move(*entry);
+}
+
+void MongodbClient::QueryPoolStats(
+    crane::grpc::QuerySchedulerStatsReply* reply) const {
+  auto* pool_stats = reply->mutable_mongo_pool_stats();
+  pool_stats->set_max_pool_size(g_config.DbMaxPoolSize);
+  pool_stats->set_acquired_client_count(
+      m_acquired_client_num_.load(std::memory_order_relaxed));
+
+  auto* latency = reply->add_phase_latencies();
+  latency->set_phase("mongo_pool_acquire");
+  m_pool_acquire_histogram_.ToGrpc(latency);
+}
+
 mongocxx::client_session* MongodbClient::GetSession_() {
   if (m_connect_pool_) {
     thread_local mongocxx::client_session session =
@@ -947,6 +1514,13 @@ void MongodbClient::ViewToQos_(const bsoncxx::document::view& qos_view,
         qos_view[Qos::FieldStringOfMaxCpusPerUser()].get_int64().value;
     qos->max_time_limit_per_task = absl::Seconds(
         qos_view[Qos::FieldStringOfMaxTimeLimitPerTask()].get_int64().value);
+    // Absent in the QoS created before the limit was introduced.
+    auto max_cpus_per_account =
+        qos_view[Qos::FieldStringOfMaxCpusPerAccount()];
+    qos->max_cpus_per_account =
+        max_cpus_per_account
+            ? max_cpus_per_account.get_int64().value
+            : std::numeric_limits<decltype(qos->max_cpus_per_account)>::max();
   } catch (const bsoncxx::exception& e) {
     CRANE_LOGGER_ERROR(m_logger_, e.what());
   }
@@ -954,7 +1528,7 @@ void MongodbClient::ViewToQos_(const bsoncxx::document::view& qos_view,
 
 bsoncxx::builder::basic::document MongodbClient::QosToDocument_(
     const Ctld::Qos& qos) {
-  std::array<std::string, 8> fields{
+  std::array<std::string, 9> fields{
       Qos::FieldStringOfDeleted(),
       Qos::FieldStringOfName(),
       Qos::FieldStringOfDescription(),
@@ -963,9 +1537,10 @@ bsoncxx::builder::basic::document MongodbClient::QosToDocument_(
       Qos::FieldStringOfMaxJobsPerUser(),
       Qos::FieldStringOfMaxCpusPerUser(),
       Qos::FieldStringOfMaxTimeLimitPerTask(),
+      Qos::FieldStringOfMaxCpusPerAccount(),
   };
   std::tuple<bool, std::string, std::string, int, int64_t, int64_t, int64_t,
-             int64_t>
+             int64_t, int64_t>
       values{false,
              qos.name,
              qos.description,
@@ -973,7 +1548,8 @@ bsoncxx::builder::basic::document MongodbClient::QosToDocument_(
              qos.priority,
              qos.max_jobs_per_user,
              qos.max_cpus_per_user,
-             absl::ToInt64Seconds(qos.max_time_limit_per_task)};
+             absl::ToInt64Seconds(qos.max_time_limit_per_task),
+             qos.max_cpus_per_account};
 
   return DocumentConstructor_(fields, values);
 }
@@ -1032,7 +1608,7 @@ DeviceMap MongodbClient::BsonToDeviceMap(const bsoncxx::document::view& doc) {
           CRANE_LOGGER_ERROR(m_logger_, "total: BSON type is not a number.");
       }
 
-      std::unordered_map<std::string, uint64_t> type_count_map;
+      TypeCountMap type_count_map;
       if (auto type_map_elem = type_count_doc["type_count_map"];
           type_map_elem && type_map_elem.type() == bsoncxx::type::k_document) {
         auto type_map_doc = type_map_elem.get_document().view();
@@ -1053,7 +1629,7 @@ DeviceMap MongodbClient::BsonToDeviceMap(const bsoncxx::document::view& doc) {
                            "type_count_map: BSON type is not a document.");
       }
 
-      device_map[device_name] = {total, type_count_map};
+      device_map[device_name] = {total, std::move(type_count_map)};
     }
   } catch (const std::exception& e) {
     CRANE_LOGGER_ERROR(m_logger_, e.what());
@@ -1086,10 +1662,11 @@ MongodbClient::document MongodbClient::TaskInEmbeddedDbToDocument_(
   // 20 script        state          timelimit     time_submit work_dir
   // 25 submit_line   exit_code      username       qos        get_user_env
   // 30 type          extra_attr     reservation   exclusive   cpus_alloc
-  // 35 mem_alloc     device_map     container
+  // 35 mem_alloc     device_map     container     cpu_usage_usec mem_peak
+  // 40 mem_avg       io_read_bytes  io_write_bytes
 
   // clang-format off
-  std::array<std::string, 38> fields{
+  std::array<std::string, 43> fields{
     // 0 - 4
     "task_id",  "task_db_id", "mod_time",    "deleted",  "account",
     // 5 - 9
@@ -1105,7 +1682,9 @@ MongodbClient::document MongodbClient::TaskInEmbeddedDbToDocument_(
     // 30 - 34
     "type", "extra_attr", "reservation", "exclusive", "cpus_alloc",
     // 35 - 39
-    "mem_alloc", "device_map", "container",
+    "mem_alloc", "device_map", "container", "cpu_usage_usec", "mem_peak",
+    // 40 - 42
+    "mem_avg", "io_read_bytes", "io_write_bytes",
   };
   // clang-format on
 
@@ -1116,7 +1695,8 @@ MongodbClient::document MongodbClient::TaskInEmbeddedDbToDocument_(
              std::string, int32_t, int64_t, int64_t, std::string,  /*20-24*/
              std::string, int32_t, std::string, std::string, bool, /*25-29*/
              int32_t, std::string, std::string, bool, double,      /*30-34*/
-             int64_t, DeviceMap, std::string>                      /*35-39*/
+             int64_t, DeviceMap, std::string, int64_t, int64_t,    /*35-39*/
+             int64_t, int64_t, int64_t>                            /*40-42*/
       values{                                                      // 0-4
              static_cast<int32_t>(runtime_attr.task_id()),
              runtime_attr.task_db_id(), absl::ToUnixSeconds(absl::Now()), false,
@@ -1150,7 +1730,13 @@ MongodbClient::document MongodbClient::TaskInEmbeddedDbToDocument_(
              allocated_res_view.CpuCount(),
              // 35-39
              static_cast<int64_t>(allocated_res_view.MemoryBytes()),
-             allocated_res_view.GetDeviceMap(), task_to_ctld.container()};
+             allocated_res_view.GetDeviceMap(), task_to_ctld.container(),
+             static_cast<int64_t>(runtime_attr.usage().cpu_usage_usec()),
+             static_cast<int64_t>(runtime_attr.usage().memory_peak_bytes()),
+             // 40-42
+             static_cast<int64_t>(runtime_attr.usage().memory_avg_bytes()),
+             static_cast<int64_t>(runtime_attr.usage().io_read_bytes()),
+             static_cast<int64_t>(runtime_attr.usage().io_write_bytes())};
 
   return DocumentConstructor_(fields, values);
 }
@@ -1158,10 +1744,10 @@ MongodbClient::document MongodbClient::TaskInEmbeddedDbToDocument_(
 MongodbClient::document MongodbClient::TaskInCtldToDocument_(TaskInCtld* task) {
   std::string script;
   if (task->type == crane::grpc::Batch)
-    script = std::get<BatchMetaInTask>(task->meta).sh_script;
+    script = task->TaskToCtld().batch_meta().sh_script();
 
   bsoncxx::builder::stream::document env_doc;
-  for (const auto& entry : task->env) {
+  for (const auto& entry : task->TaskToCtld().env()) {
     env_doc << entry.first << entry.second;
   }
 
@@ -1174,10 +1760,11 @@ MongodbClient::document MongodbClient::TaskInCtldToDocument_(TaskInCtld* task) {
   // 20 script        state          timelimit     time_submit work_dir
   // 25 submit_line   exit_code      username       qos        get_user_env
   // 30 type          extra_attr     reservation    exclusive  cpus_alloc
-  // 35 mem_alloc     device_map     container
+  // 35 mem_alloc     device_map     container     cpu_usage_usec mem_peak
+  // 40 mem_avg       io_read_bytes  io_write_bytes
 
   // clang-format off
-  std::array<std::string, 38> fields{
+  std::array<std::string, 43> fields{
       // 0 - 4
       "task_id",  "task_db_id", "mod_time",    "deleted",  "account",
       // 5 - 9
@@ -1193,7 +1780,9 @@ MongodbClient::document MongodbClient::TaskInCtldToDocument_(TaskInCtld* task) {
       // 30 - 34
       "type", "extra_attr", "reservation", "exclusive", "cpus_alloc",
       // 35 - 39
-      "mem_alloc", "device_map", "container",
+      "mem_alloc", "device_map", "container", "cpu_usage_usec", "mem_peak",
+      // 40 - 42
+      "mem_avg", "io_read_bytes", "io_write_bytes",
   };
   // clang-format on
 
@@ -1204,7 +1793,8 @@ MongodbClient::document MongodbClient::TaskInCtldToDocument_(TaskInCtld* task) {
              std::string, int32_t, int64_t, int64_t, std::string,  /*20-24*/
              std::string, int32_t, std::string, std::string, bool, /*25-29*/
              int32_t, std::string, std::string, bool, double,      /*30-34*/
-             int64_t, DeviceMap, std::string>                      /*35-39*/
+             int64_t, DeviceMap, std::string, int64_t, int64_t,    /*35-39*/
+             int64_t, int64_t, int64_t>                            /*40-42*/
       values{                                                      // 0-4
              static_cast<int32_t>(task->TaskId()), task->TaskDbId(),
              absl::ToUnixSeconds(absl::Now()), false, task->account,
@@ -1220,17 +1810,25 @@ MongodbClient::document MongodbClient::TaskInCtldToDocument_(TaskInCtld* task) {
              task->StartTimeInUnixSecond(), task->EndTimeInUnixSecond(), 0,
              // 20-24
              script, task->Status(), absl::ToInt64Seconds(task->time_limit),
-             task->SubmitTimeInUnixSecond(), task->cwd,
+             task->SubmitTimeInUnixSecond(), task->TaskToCtld().cwd(),
              // 25-29
-             task->cmd_line, task->ExitCode(), task->Username(), task->qos,
+             task->TaskToCtld().cmd_line(), task->ExitCode(), task->Username(),
+             task->qos,
              task->get_user_env,
              // 30-34
-             task->type, task->extra_attr, task->reservation,
+             task->type, task->TaskToCtld().extra_attr(), task->reservation,
              task->TaskToCtld().exclusive(),
              task->allocated_res_view.CpuCount(),
              // 35-39
              static_cast<int64_t>(task->allocated_res_view.MemoryBytes()),
-             task->allocated_res_view.GetDeviceMap(), task->container};
+             task->allocated_res_view.GetDeviceMap(),
+             task->TaskToCtld().container(),
+             static_cast<int64_t>(task->Usage().cpu_usage_usec()),
+             static_cast<int64_t>(task->Usage().memory_peak_bytes()),
+             // 40-42
+             static_cast<int64_t>(task->Usage().memory_avg_bytes()),
+             static_cast<int64_t>(task->Usage().io_read_bytes()),
+             static_cast<int64_t>(task->Usage().io_write_bytes())};
   return DocumentConstructor_(fields, values);
 }
 
@@ -1248,13 +1846,15 @@ MongodbClient::MongodbClient() {
       "mongodb", StrToLogLevel(g_config.CraneCtldDebugLevel).value(), true);
   m_logger_ = g_runtime_status.db_logger;
   m_connect_uri_ = fmt::format(
-      "mongodb://{}{}:{}/?replicaSet={}&maxPoolSize=1000", authentication,
-      g_config.DbHost, g_config.DbPort, g_config.DbRSName);
+      "mongodb://{}{}:{}/?replicaSet={}&maxPoolSize={}", authentication,
+      g_config.DbHost, g_config.DbPort, g_config.DbRSName,
+      g_config.DbMaxPoolSize);
   CRANE_LOGGER_TRACE(
       m_logger_,
       "Mongodb connect uri: "
-      "mongodb://{}:[passwd]@{}:{}/?replicaSet={}&maxPoolSize=1000",
-      g_config.DbUser, g_config.DbHost, g_config.DbPort, g_config.DbRSName);
+      "mongodb://{}:[passwd]@{}:{}/?replicaSet={}&maxPoolSize={}",
+      g_config.DbUser, g_config.DbHost, g_config.DbPort, g_config.DbRSName,
+      g_config.DbMaxPoolSize);
   m_wc_majority_.acknowledge_level(mongocxx::write_concern::level::k_majority);
   m_rc_local_.acknowledge_level(mongocxx::read_concern::level::k_local);
   m_rp_primary_.mode(mongocxx::read_preference::read_mode::k_primary);
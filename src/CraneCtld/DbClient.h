@@ -30,8 +30,12 @@
 #include <mongocxx/instance.hpp>
 #include <mongocxx/pool.hpp>
 
+#include "SchedulerStats.h"
+
 namespace Ctld {
 
+class JobArchive;
+
 template <typename T>
 struct BsonFieldTrait {
   static T get(const bsoncxx::document::element&) {
@@ -119,6 +123,27 @@ class MongodbClient {
 
   bool CheckTaskDbIdExisted(int64_t task_db_id);
 
+  // Move the jobs ended before the cutoff from the task table into the
+  // archive.
+  bool ArchiveJobsEndedBefore(int64_t cutoff, JobArchive* archive);
+
+  // Report the size of the client pool and how long the threads waited to
+  // acquire a client.
+  void QueryPoolStats(crane::grpc::QuerySchedulerStatsReply* reply) const;
+
+  bsoncxx::document::value JobDocumentOf(TaskInCtld* task);
+  bsoncxx::document::value JobDocumentOf(
+      crane::grpc::TaskInEmbeddedDb const& task_in_embedded_db);
+
+  // Write the jobs in one unordered bulk write. A job already in the table
+  // is replaced, so a failed batch can be retried as a whole. The usage of
+  // the jobs new to the table is added to the rollups.
+  bool UpsertJobs(const std::vector<bsoncxx::document::value>& documents);
+
+  /* ----- Method of operating the usage rollup tables ----------- */
+  bool FetchUsageSummary(const crane::grpc::QueryUsageSummaryRequest* request,
+                         crane::grpc::QueryUsageSummaryReply* response);
+
   /* ----- Method of operating the account table ----------- */
   bool InsertUser(const User& new_user);
   bool InsertAccount(const Account& new_account);
@@ -231,10 +256,23 @@ class MongodbClient {
   bool UpdateAccount(const Account& account);
   bool UpdateQos(const Qos& qos);
 
+  // Write the users in one bulk write within the transaction of the session.
+  // A user paired with true is inserted, or overwrites its stale record with
+  // a new creation time.
+  bool UpsertUsers(const std::vector<std::pair<const User*, bool>>& users);
+
   bool InsertTxn(const Txn& txn);
-  void SelectTxns(
+  bool InsertTxns(const std::vector<Txn>& txns);
+  // Select at most limit txns matching the conditions, newest first. Only the
+  // txns after page_cursor are selected if it is not empty. next_page_cursor
+  // is set to the cursor of the last selected txn if more txns remain, or
+  // cleared otherwise. Returns false if page_cursor is malformed or the query
+  // failed.
+  bool SelectTxns(
       const std::unordered_map<std::string, std::string>& conditions,
-      int64_t start_time, int64_t end_time, std::list<Txn>* res_txn);
+      int64_t start_time, int64_t end_time, uint32_t limit,
+      const std::string& page_cursor, std::list<Txn>* res_txn,
+      std::string* next_page_cursor);
 
   bool CommitTransaction(
       const mongocxx::client_session::with_transaction_cb& callback);
@@ -242,6 +280,9 @@ class MongodbClient {
  private:
   bool CheckDefaultRootAccountUserAndInit_();
 
+  // Create the missing indexes of the task and rollup tables.
+  bool CheckIndexes_();
+
   template <typename V>
   void DocumentAppendItem_(document& doc, const std::string& key,
                            const V& value);
@@ -258,8 +299,11 @@ class MongodbClient {
   template <typename ViewValue, typename T>
   T ViewValueOr_(const ViewValue& view_value, const T& default_value);
 
+  // A thread acquires a client the first time it accesses MongoDB and keeps
+  // it, so that the session used in a transaction stays on the same client.
   mongocxx::client* GetClient_();
   mongocxx::client_session* GetSession_();
+  mongocxx::pool::entry AcquireClient_();
 
   void ViewToUser_(const bsoncxx::document::view& user_view, User* user);
 
@@ -277,6 +321,20 @@ class MongodbClient {
   void ViewToTxn_(const bsoncxx::document::view& txn_view, Txn* txn);
   document TxnToDocument_(const Txn& txn);
 
+  // Add the usage of the jobs into the hourly and daily rollup tables.
+  void AddJobsToUsageRollups_(mongocxx::client_session* session,
+                              const std::vector<bsoncxx::document::view>& jobs);
+
+  // Add the jobs of the archive matching the request after fetched_num
+  // jobs are fetched from the task table.
+  void FetchArchivedJobRecords_(
+      const crane::grpc::QueryTasksInfoRequest* request,
+      crane::grpc::QueryTasksInfoReply* response, size_t limit,
+      size_t fetched_num);
+
+  void ViewToTaskInfo_(const bsoncxx::document::view& view,
+                       crane::grpc::TaskInfo* task);
+
   document TaskInCtldToDocument_(TaskInCtld* task);
   document TaskInEmbeddedDbToDocument_(
       crane::grpc::TaskInEmbeddedDb const& task);
@@ -289,10 +347,14 @@ class MongodbClient {
   const std::string m_user_collection_name_{"user_table"};
   const std::string m_qos_collection_name_{"qos_table"};
   const std::string m_txn_collection_name_{"txn_table"};
+  const std::string m_usage_hourly_collection_name_{"usage_hourly_table"};
+  const std::string m_usage_daily_collection_name_{"usage_daily_table"};
   std::shared_ptr<spdlog::logger> m_logger_;
 
   std::unique_ptr<mongocxx::instance> m_instance_;
   std::unique_ptr<mongocxx::pool> m_connect_pool_;
+  LatencyHistogram m_pool_acquire_histogram_;
+  std::atomic_uint64_t m_acquired_client_num_{0};
 
   mongocxx::write_concern m_wc_majority_{};
   mongocxx::read_concern m_rc_local_{};
@@ -18,6 +18,11 @@
 
 #include "EmbeddedDbClient.h"
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 namespace Ctld {
 
 #ifdef CRANE_HAVE_UNQLITE
@@ -478,7 +483,272 @@ DbTxn* BerkeleyDb::GetDbTxnFromId_(txn_id_t txn_id) {
 
 #endif
 
+#ifdef CRANE_HAVE_LMDB
+
+std::expected<void, DbErrorCode> LmdbDb::Init(const std::string& path) {
+  m_db_path_ = path;
+
+  // With MDB_NOTLS, the read-only transaction of a fetch outside any
+  // transaction doesn't conflict with a write transaction of the same thread.
+  int rc = mdb_env_create(&m_env_);
+  if (rc == 0) rc = mdb_env_set_mapsize(m_env_, s_map_size_);
+  if (rc == 0)
+    rc = mdb_env_open(m_env_, path.c_str(), MDB_NOSUBDIR | MDB_NOTLS, 0600);
+
+  MDB_txn* txn;
+  if (rc == 0) rc = mdb_txn_begin(m_env_, nullptr, 0, &txn);
+  if (rc == 0) {
+    rc = mdb_dbi_open(txn, nullptr, 0, &m_dbi_);
+    if (rc == 0)
+      rc = mdb_txn_commit(txn);
+    else
+      mdb_txn_abort(txn);
+  }
+
+  if (rc != 0) {
+    CRANE_ERROR("Failed to open lmdb file {}: {}", m_db_path_,
+                mdb_strerror(rc));
+    if (m_env_ != nullptr) mdb_env_close(m_env_);
+    m_env_ = nullptr;
+    return std::unexpected(DbErrorCode::kOther);
+  }
+
+  return {};
+}
+
+std::expected<void, DbErrorCode> LmdbDb::Close() {
+  if (m_env_ != nullptr) {
+    CRANE_TRACE("Closing lmdb...");
+    {
+      absl::MutexLock lock(&m_txn_map_mtx_);
+      for (MDB_txn* txn : m_txn_map_ | std::views::values) mdb_txn_abort(txn);
+      m_txn_map_.clear();
+    }
+
+    mdb_dbi_close(m_env_, m_dbi_);
+    mdb_env_close(m_env_);
+    m_env_ = nullptr;
+  }
+
+  return {};
+}
+
+std::expected<void, DbErrorCode> LmdbDb::Store(txn_id_t txn_id,
+                                               const std::string& key,
+                                               const void* data, size_t len) {
+  MDB_val key_val{.mv_size = key.size(), .mv_data = (void*)key.data()};
+  MDB_val data_val{.mv_size = len, .mv_data = (void*)data};
+
+  return RunInWriteTxn_(txn_id, [&](MDB_txn* txn) {
+    int rc = mdb_put(txn, m_dbi_, &key_val, &data_val, 0);
+    if (rc != 0)
+      CRANE_ERROR("Failed to store key {} into db: {}", key, mdb_strerror(rc));
+    return rc;
+  });
+}
+
+std::expected<size_t, DbErrorCode> LmdbDb::Fetch(txn_id_t txn_id,
+                                                 const std::string& key,
+                                                 void* buf, size_t* len) {
+  MDB_txn* txn;
+  if (txn_id == 0) {
+    int rc = mdb_txn_begin(m_env_, nullptr, MDB_RDONLY, &txn);
+    if (rc != 0) {
+      CRANE_ERROR("Failed to begin a read transaction: {}", mdb_strerror(rc));
+      return std::unexpected(DbErrorCode::kOther);
+    }
+  } else {
+    txn = GetMdbTxnFromId_(txn_id);
+    if (txn == nullptr) return std::unexpected(DbErrorCode::kOther);
+  }
+
+  MDB_val key_val{.mv_size = key.size(), .mv_data = (void*)key.data()};
+  MDB_val data_val;
+  int rc = mdb_get(txn, m_dbi_, &key_val, &data_val);
+
+  // The value is only valid in the transaction, so it's copied before the
+  // read transaction ends.
+  std::expected<size_t, DbErrorCode> result;
+  if (rc == MDB_NOTFOUND) {
+    result = std::unexpected(DbErrorCode::kNotFound);
+  } else if (rc != 0) {
+    CRANE_ERROR("Failed to get value size for key {}: {}", key,
+                mdb_strerror(rc));
+    result = std::unexpected(DbErrorCode::kOther);
+  } else if (*len == 0) {
+    *len = data_val.mv_size;
+    result = 0;
+  } else if (*len < data_val.mv_size) {
+    *len = data_val.mv_size;
+    result = std::unexpected(DbErrorCode::kBufferSmall);
+  } else {
+    std::memcpy(buf, data_val.mv_data, data_val.mv_size);
+    result = data_val.mv_size;
+  }
+
+  if (txn_id == 0) mdb_txn_abort(txn);
+  return result;
+}
+
+std::expected<void, DbErrorCode> LmdbDb::Delete(txn_id_t txn_id,
+                                                const std::string& key) {
+  MDB_val key_val{.mv_size = key.size(), .mv_data = (void*)key.data()};
+
+  return RunInWriteTxn_(txn_id, [&](MDB_txn* txn) {
+    int rc = mdb_del(txn, m_dbi_, &key_val, nullptr);
+    if (rc != 0 && rc != MDB_NOTFOUND)
+      CRANE_ERROR("Failed to delete key {} from db: {}", key,
+                  mdb_strerror(rc));
+    return rc;
+  });
+}
+
+std::expected<txn_id_t, DbErrorCode> LmdbDb::Begin() {
+  // Blocks while another thread holds the write transaction.
+  MDB_txn* txn;
+  int rc = mdb_txn_begin(m_env_, nullptr, 0, &txn);
+  if (rc != 0) {
+    CRANE_ERROR("Failed to begin a transaction: {}", mdb_strerror(rc));
+    return std::unexpected(DbErrorCode::kOther);
+  }
+
+  absl::MutexLock lock(&m_txn_map_mtx_);
+  txn_id_t txn_id = m_next_txn_id_++;
+  if (m_next_txn_id_ == 0) m_next_txn_id_ = 1;
+  m_txn_map_.emplace(txn_id, txn);
+  return {txn_id};
+}
+
+std::expected<void, DbErrorCode> LmdbDb::Commit(txn_id_t txn_id) {
+  // The transaction is gone if one of its writes failed.
+  MDB_txn* txn = TakeMdbTxnFromId_(txn_id);
+  if (txn == nullptr) return std::unexpected(DbErrorCode::kOther);
+
+  int rc = mdb_txn_commit(txn);
+  if (rc != 0) {
+    CRANE_ERROR("Failed to commit a transaction: {}", mdb_strerror(rc));
+    return std::unexpected(DbErrorCode::kOther);
+  }
+
+  return {};
+}
+
+std::expected<void, DbErrorCode> LmdbDb::Abort(txn_id_t txn_id) {
+  MDB_txn* txn = TakeMdbTxnFromId_(txn_id);
+  if (txn != nullptr) mdb_txn_abort(txn);
+  return {};
+}
+
+std::expected<void, DbErrorCode> LmdbDb::IterateAllKv(KvIterFunc func) {
+  MDB_txn* txn;
+  MDB_cursor* cursor;
+
+  int rc = mdb_txn_begin(m_env_, nullptr, 0, &txn);
+  if (rc != 0) return std::unexpected(DbErrorCode::kOther);
+
+  rc = mdb_cursor_open(txn, m_dbi_, &cursor);
+  if (rc != 0) {
+    mdb_txn_abort(txn);
+    return std::unexpected(DbErrorCode::kOther);
+  }
+
+  MDB_val key, value;
+  for (rc = mdb_cursor_get(cursor, &key, &value, MDB_FIRST); rc == 0;
+       rc = mdb_cursor_get(cursor, &key, &value, MDB_NEXT)) {
+    std::string key_buf(static_cast<const char*>(key.mv_data), key.mv_size);
+
+    const auto* value_ptr = static_cast<const uint8_t*>(value.mv_data);
+    std::vector<uint8_t> value_buf(value_ptr, value_ptr + value.mv_size);
+
+    // After a deletion, MDB_NEXT moves to the entry following the deleted one.
+    if (!func(std::move(key_buf), std::move(value_buf))) {
+      rc = mdb_cursor_del(cursor, 0);
+      if (rc != 0) break;
+    }
+  }
+
+  mdb_cursor_close(cursor);
+  if (rc != MDB_NOTFOUND) {
+    CRANE_ERROR("Failed to iterate lmdb {}: {}", m_db_path_, mdb_strerror(rc));
+    mdb_txn_abort(txn);
+    return std::unexpected(DbErrorCode::kOther);
+  }
+
+  if (mdb_txn_commit(txn) != 0) return std::unexpected(DbErrorCode::kOther);
+  return {};
+}
+
+MDB_txn* LmdbDb::GetMdbTxnFromId_(txn_id_t txn_id) {
+  absl::MutexLock lock(&m_txn_map_mtx_);
+  auto it = m_txn_map_.find(txn_id);
+  if (it == m_txn_map_.end()) {
+    CRANE_ERROR("Try to obtain a non-existent MDB_txn, txn_id : {}", txn_id);
+    return nullptr;
+  }
+  return it->second;
+}
+
+MDB_txn* LmdbDb::TakeMdbTxnFromId_(txn_id_t txn_id) {
+  absl::MutexLock lock(&m_txn_map_mtx_);
+  auto it = m_txn_map_.find(txn_id);
+  if (it == m_txn_map_.end()) return nullptr;
+
+  MDB_txn* txn = it->second;
+  m_txn_map_.erase(it);
+  return txn;
+}
+
+std::expected<void, DbErrorCode> LmdbDb::RunInWriteTxn_(
+    txn_id_t txn_id, std::function<int(MDB_txn*)> const& func) {
+  auto error_of = [](int rc) {
+    return rc == MDB_NOTFOUND ? DbErrorCode::kNotFound : DbErrorCode::kOther;
+  };
+
+  if (txn_id != 0) {
+    MDB_txn* txn = GetMdbTxnFromId_(txn_id);
+    if (txn == nullptr) return std::unexpected(DbErrorCode::kOther);
+
+    int rc = func(txn);
+    if (rc == 0) return {};
+
+    // A transaction can't be used anymore after a failed write.
+    if (rc != MDB_NOTFOUND) std::ignore = Abort(txn_id);
+    return std::unexpected(error_of(rc));
+  }
+
+  MDB_txn* txn;
+  int rc = mdb_txn_begin(m_env_, nullptr, 0, &txn);
+  if (rc != 0) {
+    CRANE_ERROR("Failed to begin a transaction: {}", mdb_strerror(rc));
+    return std::unexpected(DbErrorCode::kOther);
+  }
+
+  rc = func(txn);
+  if (rc != 0) {
+    mdb_txn_abort(txn);
+    return std::unexpected(error_of(rc));
+  }
+
+  rc = mdb_txn_commit(txn);
+  if (rc != 0) {
+    CRANE_ERROR("Failed to commit a transaction: {}", mdb_strerror(rc));
+    return std::unexpected(DbErrorCode::kOther);
+  }
+
+  return {};
+}
+
+#endif
+
 EmbeddedDbClient::~EmbeddedDbClient() {
+  if (m_commit_thread_.joinable()) {
+    {
+      absl::MutexLock lock(&m_commit_queue_mtx_);
+      m_commit_thread_stop_ = true;
+    }
+    m_commit_thread_.join();
+  }
+
   if (m_variable_db_) {
     auto result = m_variable_db_->Close();
     if (!result)
@@ -523,6 +793,16 @@ bool EmbeddedDbClient::Init(const std::string& db_path) {
     return false;
 #endif
 
+  } else if (g_config.CraneEmbeddedDbBackend == "LMDB") {
+#ifdef CRANE_HAVE_LMDB
+    m_variable_db_ = std::make_unique<LmdbDb>();
+    m_fixed_db_ = std::make_unique<LmdbDb>();
+    m_resv_db_ = std::make_unique<LmdbDb>();
+#else
+    CRANE_ERROR("Select LMDB as the embedded db but it's not been compiled.");
+    return false;
+#endif
+
   } else {
     CRANE_ERROR("Invalid embedded database backend: {}",
                 g_config.CraneEmbeddedDbBackend);
@@ -536,6 +816,8 @@ bool EmbeddedDbClient::Init(const std::string& db_path) {
   result = m_resv_db_->Init(db_path + "resv");
   if (!result) return false;
 
+  m_checkpoint_path_ = db_path + "ckpt";
+
   bool ok;
 
   // There is no race during Init stage.
@@ -548,6 +830,8 @@ bool EmbeddedDbClient::Init(const std::string& db_path) {
                                                       &s_next_task_db_id_, 1L);
   if (!ok) return false;
 
+  m_commit_thread_ = std::thread([this] { GroupCommitThread_(); });
+
   return true;
 }
 
@@ -555,66 +839,164 @@ bool EmbeddedDbClient::RetrieveLastSnapshot(DbSnapshot* snapshot) {
   using TaskStatus = crane::grpc::TaskStatus;
   using RuntimeAttr = crane::grpc::RuntimeAttrOfTask;
 
-  std::expected<void, DbErrorCode> result;
-  std::unordered_map<db_id_t, RuntimeAttr> db_id_runtime_attr_map;
+  using RuntimeAttrDelta = crane::grpc::RuntimeAttrDeltaOfTask;
+  using SeqAndDelta = std::pair<uint32_t, RuntimeAttrDelta>;
+
+  using Clock = std::chrono::steady_clock;
+  auto ms_since = [](Clock::time_point begin) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() -
+                                                                 begin)
+        .count();
+  };
+
+  // The kv pairs are only collected from the checkpoint or the dbs. Parsing
+  // them is split over g_thread_pool.
+  auto phase_begin = Clock::now();
+  RawTaskKvs kvs;
+  bool from_checkpoint = g_config.CraneEmbeddedDbCheckpointInterval != 0 &&
+                         LoadCheckpoint_(&kvs);
+  if (!from_checkpoint && !CollectTaskKvsFromDbs_(&kvs)) return false;
+  auto collect_ms = ms_since(phase_begin);
+
+  std::vector<std::pair<db_id_t, std::string_view>> runtime_attr_values;
+  std::unordered_map<db_id_t, std::vector<SeqAndDelta>> db_id_deltas_map;
+  std::vector<std::string> delta_keys;
+
+  phase_begin = Clock::now();
+  for (const auto& [key, value] : kvs.variable) {
+    if (IsRuntimeAttrDeltaEntry_(key)) {
+      uint32_t seq = std::stoul(key.substr(key.find('D') + 1));
+
+      RuntimeAttrDelta delta;
+      delta.ParseFromArray(value.data(), value.size());
+
+      db_id_deltas_map[std::stol(key)].emplace_back(seq, std::move(delta));
+      delta_keys.emplace_back(key);
+      continue;
+    }
 
-  result = m_variable_db_->IterateAllKv(
-      [&](std::string&& key, std::vector<uint8_t>&& value) {
-        // Skip if not RuntimeAttr
-        if (!IsVariableDbTaskDataEntry_(key)) return true;
+    // Skip if not RuntimeAttr
+    if (!IsVariableDbTaskDataEntry_(key)) continue;
 
-        task_db_id_t id = ExtractDbIdFromEntry_(key);
+    runtime_attr_values.emplace_back(ExtractDbIdFromEntry_(key), value);
+  }
 
-        RuntimeAttr runtime_attr;
-        runtime_attr.ParseFromArray(value.data(), value.size());
+  std::vector<RuntimeAttr> runtime_attrs(runtime_attr_values.size());
+  ParallelForChunks(runtime_attr_values.size(), kRecoveryParallelChunkNum,
+                    [&](size_t begin, size_t end) {
+                      for (size_t i = begin; i < end; i++) {
+                        const auto& value = runtime_attr_values[i].second;
+                        runtime_attrs[i].ParseFromArray(value.data(),
+                                                        value.size());
+                      }
+                    });
+
+  std::unordered_map<db_id_t, size_t> db_id_runtime_attr_idx_map;
+  db_id_runtime_attr_idx_map.reserve(runtime_attr_values.size());
+  for (size_t i = 0; i < runtime_attr_values.size(); i++)
+    db_id_runtime_attr_idx_map.emplace(runtime_attr_values[i].first, i);
+  runtime_attr_values = {};
+  auto var_parse_ms = ms_since(phase_begin);
+
+  // Compact the deltas into the full records before anything else is written,
+  // so the committer thread starts without any delta.
+  if (!delta_keys.empty()) {
+    txn_id_t txn_id;
+    if (!BeginDbTransaction_(m_variable_db_.get(), &txn_id)) return false;
+
+    for (auto& [id, deltas] : db_id_deltas_map) {
+      auto idx_it = db_id_runtime_attr_idx_map.find(id);
+      if (idx_it == db_id_runtime_attr_idx_map.end()) continue;
+      RuntimeAttr& runtime_attr = runtime_attrs[idx_it->second];
+
+      std::ranges::sort(deltas, {}, &SeqAndDelta::first);
+      for (const auto& delta : deltas | std::views::values)
+        ApplyRuntimeAttrDelta_(delta, &runtime_attr);
+
+      if (!StoreTypeIntoDb_(m_variable_db_.get(), txn_id,
+                            GetVariableDbEntryName_(id), &runtime_attr)) {
+        CRANE_ERROR("Failed to store compacted runtime attr of task db id {}.",
+                    id);
+        return false;
+      }
+    }
 
-        db_id_runtime_attr_map.emplace(id, std::move(runtime_attr));
+    for (const auto& key : delta_keys)
+      std::ignore = m_variable_db_->Delete(txn_id, key);
 
-        // Record all task_id here and don't delete any key,
-        // so true is returned.
-        return true;
-      });
+    if (!CommitDbTransaction_(m_variable_db_.get(), txn_id)) return false;
+    CRANE_INFO("Compacted {} runtime attr deltas of {} tasks.",
+               delta_keys.size(), db_id_deltas_map.size());
+  }
 
-  if (!result) {
-    CRANE_ERROR("Failed to restore the variable data into queues");
-    return false;
+  // The db id, the index into runtime_attrs and the fixed data of each task.
+  std::vector<std::tuple<db_id_t, size_t, std::string_view>>
+      task_to_ctld_values;
+  task_to_ctld_values.reserve(runtime_attrs.size());
+
+  // Incomplete task fixed data, where fixed data are stored but variable data
+  // are missing.
+  std::vector<std::string> orphan_keys;
+
+  phase_begin = Clock::now();
+  for (const auto& [key, value] : kvs.fixed) {
+    task_db_id_t id = ExtractDbIdFromEntry_(key);
+
+    auto idx_it = db_id_runtime_attr_idx_map.find(id);
+    if (idx_it == db_id_runtime_attr_idx_map.end()) {
+      orphan_keys.emplace_back(key);
+      continue;
+    }
+
+    task_to_ctld_values.emplace_back(id, idx_it->second, value);
   }
 
-  result = m_fixed_db_->IterateAllKv(
-      [&](std::string&& key, std::vector<uint8_t>&& value) {
-        task_db_id_t id = ExtractDbIdFromEntry_(key);
-
-        // Delete incomplete task fixed data,
-        // where fixed data are stored but variable data are missing.
-        auto runtime_attr_it = db_id_runtime_attr_map.find(id);
-        if (runtime_attr_it == db_id_runtime_attr_map.end()) return false;
-
-        TaskStatus status = runtime_attr_it->second.status();
-
-        // Assemble TaskInEmbeddedDb here.
-        TaskInEmbeddedDb task;
-        *task.mutable_runtime_attr() = std::move(runtime_attr_it->second);
-        task.mutable_task_to_ctld()->ParseFromArray(value.data(), value.size());
-
-        // Dispatch to different queues by status.
-        switch (status) {
-        case crane::grpc::Pending:
-          snapshot->pending_queue.emplace(id, std::move(task));
-          break;
-        case crane::grpc::Running:
-          snapshot->running_queue.emplace(id, std::move(task));
-          break;
-        default:
-          snapshot->final_queue.emplace(id, std::move(task));
-          break;
+  if (!orphan_keys.empty()) {
+    txn_id_t txn_id;
+    if (!BeginDbTransaction_(m_fixed_db_.get(), &txn_id)) return false;
+    for (const auto& key : orphan_keys)
+      std::ignore = m_fixed_db_->Delete(txn_id, key);
+    if (!CommitDbTransaction_(m_fixed_db_.get(), txn_id)) return false;
+  }
+
+  // Assemble TaskInEmbeddedDb here.
+  std::vector<TaskInEmbeddedDb> tasks(task_to_ctld_values.size());
+  ParallelForChunks(
+      task_to_ctld_values.size(), kRecoveryParallelChunkNum,
+      [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+          const auto& [id, idx, value] = task_to_ctld_values[i];
+          *tasks[i].mutable_runtime_attr() = std::move(runtime_attrs[idx]);
+          tasks[i].mutable_task_to_ctld()->ParseFromArray(value.data(),
+                                                          value.size());
         }
-        return true;
       });
 
-  if (!result) {
-    CRANE_ERROR("Failed to restore fixed data into queues!");
-    return false;
+  // Dispatch to different queues by status.
+  for (size_t i = 0; i < tasks.size(); i++) {
+    db_id_t id = std::get<0>(task_to_ctld_values[i]);
+    TaskInEmbeddedDb& task = tasks[i];
+    TaskStatus status = task.runtime_attr().status();
+    switch (status) {
+    case crane::grpc::Pending:
+      snapshot->pending_queue.emplace(id, std::move(task));
+      break;
+    case crane::grpc::Running:
+      snapshot->running_queue.emplace(id, std::move(task));
+      break;
+    default:
+      snapshot->final_queue.emplace(id, std::move(task));
+      break;
+    }
   }
+  task_to_ctld_values = {};
+  auto fixed_parse_ms = ms_since(phase_begin);
+
+  CRANE_INFO(
+      "Retrieved {} tasks from embedded {}. Collect {} ms, parse variable "
+      "data {} ms, parse fixed data {} ms.",
+      tasks.size(), from_checkpoint ? "db checkpoint" : "db", collect_ms,
+      var_parse_ms, fixed_parse_ms);
 
   return true;
 }
@@ -644,9 +1026,6 @@ bool EmbeddedDbClient::RetrieveReservationInfo(
 
 bool EmbeddedDbClient::AppendTasksToPendingAndAdvanceTaskIds(
     const std::vector<TaskInCtld*>& tasks) {
-  txn_id_t txn_id;
-  std::expected<void, DbErrorCode> result;
-
   // Note: In current implementation, this function is called by only
   // one single thread and the lock here is actually useless.
   // However, it costs little and prevents race condition,
@@ -656,96 +1035,776 @@ bool EmbeddedDbClient::AppendTasksToPendingAndAdvanceTaskIds(
   uint32_t task_id{s_next_task_id_};
   db_id_t task_db_id{s_next_task_db_id_};
 
-  if (!BeginDbTransaction_(m_fixed_db_.get(), &txn_id)) return false;
-
+  WriteBatch batch;
   for (const auto& task : tasks) {
     task->SetTaskId(task_id++);
     task->SetTaskDbId(task_db_id++);
 
-    result = StoreTypeIntoDb_(m_fixed_db_.get(), txn_id,
-                              GetFixedDbEntryName_(task->TaskDbId()),
-                              &task->TaskToCtld());
-    if (!result) {
-      CRANE_ERROR(
-          "Failed to store the fixed data of task id: {} / task db id: {}.",
-          task->TaskId(), task->TaskDbId());
+    batch.PutTaskToCtld(task->TaskDbId(), task->TaskToCtld());
+    batch.PutRuntimeAttr(task->TaskDbId(), task->RuntimeAttr());
+  }
 
-      // Just drop this batch if any of them failed.
-      return false;
+  // The ids are advanced in the same transaction as the variable data.
+  using VariableOp = WriteBatch::VariableOp;
+  batch.m_variable_ops_.emplace_back(
+      VariableOp::kPut, 0, s_next_task_id_str_,
+      std::string(reinterpret_cast<const char*>(&task_id), sizeof(task_id)),
+      false);
+  batch.m_variable_ops_.emplace_back(
+      VariableOp::kPut, 0, s_next_task_db_id_str_,
+      std::string(reinterpret_cast<const char*>(&task_db_id),
+                  sizeof(task_db_id)),
+      false);
+
+  if (!CommitAsync(std::move(batch)).get()) {
+    // Just drop this batch if any of them failed.
+    CRANE_ERROR("Failed to store the data of a batch of {} tasks.",
+                tasks.size());
+    return false;
+  }
+
+  s_next_task_id_ = task_id;
+  s_next_task_db_id_ = task_db_id;
+
+  return true;
+}
+
+bool EmbeddedDbClient::FetchTaskDataInDb(txn_id_t txn_id, db_id_t db_id,
+                                         TaskInEmbeddedDb* task_in_db) {
+  // Deltas are read before the full record. If they are compacted in
+  // between, the full record already contains them and applying them again
+  // changes nothing.
+  std::vector<crane::grpc::RuntimeAttrDeltaOfTask> deltas;
+  for (uint32_t seq = 0;; seq++) {
+    crane::grpc::RuntimeAttrDeltaOfTask delta;
+    if (!FetchTypeFromDb_(m_variable_db_.get(), txn_id,
+                          GetRuntimeAttrDeltaEntryName_(db_id, seq), &delta))
+      break;
+    deltas.emplace_back(std::move(delta));
+  }
+
+  if (!FetchTaskDataInDbAtomic_(txn_id, db_id, task_in_db)) return false;
+
+  for (const auto& delta : deltas)
+    ApplyRuntimeAttrDelta_(delta, task_in_db->mutable_runtime_attr());
+  return true;
+}
+
+bool EmbeddedDbClient::PurgeEndedTasks(const std::vector<db_id_t>& db_ids) {
+  WriteBatch batch;
+  for (const auto& id : db_ids) batch.DeleteTask(id);
+
+  return CommitAsync(std::move(batch)).get();
+}
+
+std::future<bool> EmbeddedDbClient::CommitAsync(WriteBatch&& batch) {
+  std::promise<bool> durable_promise;
+  std::future<bool> durable_future = durable_promise.get_future();
+
+  if (batch.Empty()) {
+    durable_promise.set_value(true);
+    return durable_future;
+  }
+
+  absl::MutexLock lock(&m_commit_queue_mtx_);
+  m_queued_mutation_num_ += batch.Size();
+  m_commit_queue_.emplace_back(std::move(batch), std::move(durable_promise));
+
+  return durable_future;
+}
+
+void EmbeddedDbClient::GroupCommitThread_() {
+  util::SetCurrentThreadName("EmbDbCommitThr");
+
+  auto has_batch = [this] {
+    return !m_commit_queue_.empty() || m_commit_thread_stop_;
+  };
+  auto group_full = [this] {
+    return m_queued_mutation_num_ >= kEmbeddedDbGroupCommitMaxMutations ||
+           m_commit_thread_stop_;
+  };
+
+  std::vector<QueuedBatch> group;
+  std::vector<bool> ok;
+
+  while (true) {
+    {
+      absl::MutexLock lock(&m_commit_queue_mtx_);
+      m_commit_queue_mtx_.Await(absl::Condition(&has_batch));
+
+      // Give the concurrent writers a window to join the group.
+      m_commit_queue_mtx_.AwaitWithTimeout(
+          absl::Condition(&group_full),
+          absl::Microseconds(kEmbeddedDbGroupCommitWindowUs));
+
+      if (m_commit_queue_.empty() && m_commit_thread_stop_) break;
+
+      group.swap(m_commit_queue_);
+      m_queued_mutation_num_ = 0;
+    }
+
+    ok.assign(group.size(), true);
+    if (!ApplyBatchGroup_(group, &ok)) ok.assign(group.size(), false);
+
+    for (size_t i = 0; i < group.size(); i++)
+      group[i].durable_promise.set_value(ok[i]);
+    group.clear();
+
+    uint64_t checkpoint_interval = g_config.CraneEmbeddedDbCheckpointInterval;
+    if (checkpoint_interval != 0 && m_journal_seq_ > m_first_journal_seq_ &&
+        absl::Now() - m_last_checkpoint_time_ >=
+            absl::Seconds(checkpoint_interval)) {
+      if (!WriteCheckpoint_())
+        CRANE_ERROR("Failed to write the embedded db checkpoint.");
+      m_last_checkpoint_time_ = absl::Now();
     }
   }
+}
 
-  if (!CommitDbTransaction_(m_fixed_db_.get(), txn_id)) return false;
+bool EmbeddedDbClient::ApplyBatchGroup_(std::vector<QueuedBatch> const& group,
+                                        std::vector<bool>* ok) {
+  // To ensure consistency of both fixed data db and variable data db under
+  // failure, we must ensure that:
+  // 1. when inserting task data, fixed data db is written before variable db;
+  // 2. when erasing task data, fixed data db is erased after variable db;
+  // Each db is only touched if some batch of the group needs it.
+  bool has_fixed_put = false, has_variable = false, has_fixed_delete = false;
+  for (const QueuedBatch& queued : group) {
+    const WriteBatch& batch = queued.batch;
+    has_fixed_put |= !batch.m_fixed_puts_.empty();
+    has_variable |= !batch.m_variable_ops_.empty();
+    has_fixed_delete |= !batch.m_fixed_deletes_.empty();
+  }
 
-  if (!BeginDbTransaction_(m_variable_db_.get(), &txn_id)) return false;
+  // The journal entry goes into the first transaction, so the tasks are
+  // re-read on recovery once any of their mutations may be durable.
+  // Deleted tasks are covered by their ops on the variable db.
+  std::string journal;
+  if (g_config.CraneEmbeddedDbCheckpointInterval != 0) {
+    auto append_db_id = [&journal](db_id_t db_id) {
+      journal.append(reinterpret_cast<const char*>(&db_id), sizeof(db_id));
+    };
+    for (const QueuedBatch& queued : group) {
+      for (const auto& put : queued.batch.m_fixed_puts_)
+        append_db_id(put.db_id);
+      for (const auto& op : queued.batch.m_variable_ops_)
+        if (op.db_id != 0) append_db_id(op.db_id);
+    }
+  }
 
-  for (const auto& task : tasks) {
-    result = StoreTypeIntoDb_(m_variable_db_.get(), txn_id,
-                              GetVariableDbEntryName_(task->TaskDbId()),
-                              &task->RuntimeAttr());
-    if (!result) {
-      CRANE_ERROR(
-          "Failed to store the variable data of "
-          "task id: {} / task db id: {}.",
-          task->TaskId(), task->TaskDbId());
+  auto store_journal = [&](IEmbeddedDb* db, txn_id_t txn_id) {
+    if (journal.empty()) return true;
+    auto res = db->Store(txn_id, GetJournalEntryName_(m_journal_seq_),
+                         journal.data(), journal.size());
+    if (!res) CRANE_ERROR("Failed to store embedded db journal entry.");
+    return res.has_value();
+  };
+
+  // The seq is only consumed once the entry is durable, so that the entries
+  // stay contiguous.
+  auto journal_committed = [&] {
+    if (journal.empty()) return;
+    m_journal_seq_++;
+    journal.clear();
+  };
+
+  // Applies one step to the batches which have not failed so far. The group
+  // is tried in one transaction first. If a batch fails, that transaction is
+  // aborted and the batches are retried one by one, so that a batch is never
+  // half applied and only the failing ones report false.
+  auto run_step = [&](IEmbeddedDb* db, bool with_journal, auto apply) {
+    txn_id_t txn_id;
+    if (!BeginDbTransaction_(db, &txn_id)) return false;
+    if (with_journal && !store_journal(db, txn_id)) {
+      std::ignore = db->Abort(txn_id);
       return false;
     }
-  }
 
-  result = StoreTypeIntoDb_(m_variable_db_.get(), txn_id, s_next_task_id_str_,
-                            &task_id);
-  if (!result) {
-    CRANE_ERROR("Failed to store next_task_id.");
+    bool all_ok = true;
+    for (size_t i = 0; i < group.size() && all_ok; i++)
+      if ((*ok)[i]) all_ok = apply(txn_id, group[i].batch);
+    if (all_ok) {
+      if (!CommitDbTransaction_(db, txn_id)) {
+        RuntimeAttrDeltaNumsAborted_();
+        return false;
+      }
+      RuntimeAttrDeltaNumsCommitted_();
+      if (with_journal) journal_committed();
+      return true;
+    }
+    std::ignore = db->Abort(txn_id);
+    RuntimeAttrDeltaNumsAborted_();
+
+    // The journal entry is stored again with each batch. It covers the whole
+    // group, which is only more than needed.
+    bool committed = false;
+    for (size_t i = 0; i < group.size(); i++) {
+      if (!(*ok)[i]) continue;
+      if (!BeginDbTransaction_(db, &txn_id)) return false;
+      if (with_journal && !store_journal(db, txn_id)) {
+        std::ignore = db->Abort(txn_id);
+        return false;
+      }
+      if (!apply(txn_id, group[i].batch)) {
+        std::ignore = db->Abort(txn_id);
+        RuntimeAttrDeltaNumsAborted_();
+        (*ok)[i] = false;
+        continue;
+      }
+      if (!CommitDbTransaction_(db, txn_id)) {
+        RuntimeAttrDeltaNumsAborted_();
+        return false;
+      }
+      RuntimeAttrDeltaNumsCommitted_();
+      committed = true;
+    }
+    if (with_journal && committed) journal_committed();
+    return true;
+  };
+
+  auto apply_fixed_puts = [this](txn_id_t txn_id, WriteBatch const& batch) {
+    for (const auto& put : batch.m_fixed_puts_)
+      if (!ApplyPut_(m_fixed_db_.get(), txn_id, put.key, put.value,
+                     put.if_exists))
+        return false;
+    return true;
+  };
+
+  auto apply_variable_ops = [this](txn_id_t txn_id, WriteBatch const& batch) {
+    for (const auto& op : batch.m_variable_ops_)
+      if (!ApplyVariableOp_(txn_id, op)) return false;
+    return true;
+  };
+
+  auto apply_fixed_deletes = [this](txn_id_t txn_id, WriteBatch const& batch) {
+    for (const auto& key : batch.m_fixed_deletes_) {
+      auto res = m_fixed_db_->Delete(txn_id, key);
+      if (!res) {
+        CRANE_ERROR(
+            "Failed to delete embedded fixed data entry. Error code: {}",
+            int(res.error()));
+        return false;
+      }
+    }
+    return true;
+  };
+
+  if (has_fixed_put && !run_step(m_fixed_db_.get(), true, apply_fixed_puts))
+    return false;
+  if (has_variable &&
+      !run_step(m_variable_db_.get(), true, apply_variable_ops))
     return false;
+  if (has_fixed_delete &&
+      !run_step(m_fixed_db_.get(), false, apply_fixed_deletes))
+    return false;
+
+  return true;
+}
+
+bool EmbeddedDbClient::ApplyPut_(IEmbeddedDb* db, txn_id_t txn_id,
+                                 std::string const& key,
+                                 std::string const& value, bool if_exists) {
+  if (if_exists) {
+    size_t len = 0;
+    auto fetch_result = db->Fetch(txn_id, key, nullptr, &len);
+    if (!fetch_result) {
+      if (fetch_result.error() == DbErrorCode::kNotFound) return true;
+      if (fetch_result.error() != DbErrorCode::kBufferSmall) {
+        CRANE_ERROR("Failed to check the existence of key '{}'.", key);
+        return false;
+      }
+    }
   }
 
-  result = StoreTypeIntoDb_(m_variable_db_.get(), txn_id,
-                            s_next_task_db_id_str_, &task_db_id);
-  if (!result) {
-    CRANE_ERROR("Failed to store next_task_db_id.");
+  if (!db->Store(txn_id, key, value.data(), value.size())) {
+    CRANE_ERROR("Failed to store key '{}'.", key);
     return false;
   }
-  if (!CommitDbTransaction_(m_variable_db_.get(), txn_id)) return false;
-
-  s_next_task_id_ = task_id;
-  s_next_task_db_id_ = task_db_id;
 
   return true;
 }
 
-bool EmbeddedDbClient::PurgeEndedTasks(const std::vector<db_id_t>& db_ids) {
-  // To ensure consistency of both fixed data db and variable data db under
-  // failure, we must ensure that:
-  // 1. when inserting task data, fixed data db is written before variable db;
-  // 2. when erasing task data, fixed data db is erased after variable db;
+bool EmbeddedDbClient::ApplyVariableOp_(txn_id_t txn_id,
+                                        WriteBatch::VariableOp const& op) {
+  using VariableOp = WriteBatch::VariableOp;
 
-  txn_id_t txn_id;
-  std::expected<void, DbErrorCode> res;
+  switch (op.type) {
+  case VariableOp::kPut:
+    if (!ApplyPut_(m_variable_db_.get(), txn_id, op.key, op.value,
+                   op.if_exists))
+      return false;
+    if (op.db_id != 0) DeleteRuntimeAttrDeltas_(txn_id, op.db_id);
+    return true;
+
+  case VariableOp::kDelta: {
+    size_t len = 0;
+    auto fetch_result = m_variable_db_->Fetch(
+        txn_id, GetVariableDbEntryName_(op.db_id), nullptr, &len);
+    if (!fetch_result && fetch_result.error() == DbErrorCode::kNotFound)
+      return true;
+
+    uint32_t delta_num = GetRuntimeAttrDeltaNum_(op.db_id);
+    if (delta_num + 1 < kEmbeddedDbMaxRuntimeAttrDeltaNum) {
+      auto res = m_variable_db_->Store(
+          txn_id, GetRuntimeAttrDeltaEntryName_(op.db_id, delta_num),
+          op.value.data(), op.value.size());
+      if (!res) {
+        CRANE_ERROR("Failed to store runtime attr delta of task db id {}.",
+                    op.db_id);
+        return false;
+      }
+      m_staged_delta_num_map_[op.db_id] = delta_num + 1;
+      return true;
+    }
+
+    crane::grpc::RuntimeAttrDeltaOfTask delta;
+    delta.ParseFromString(op.value);
+    return CompactRuntimeAttr_(txn_id, op.db_id, delta);
+  }
 
-  if (!BeginDbTransaction_(m_variable_db_.get(), &txn_id)) return false;
-  for (const auto& id : db_ids) {
-    res = m_variable_db_->Delete(txn_id, GetVariableDbEntryName_(id));
+  case VariableOp::kDelete: {
+    DeleteRuntimeAttrDeltas_(txn_id, op.db_id);
+    auto res =
+        m_variable_db_->Delete(txn_id, GetVariableDbEntryName_(op.db_id));
     if (!res) {
       CRANE_ERROR(
           "Failed to delete embedded variable data entry. Error code: {}",
           int(res.error()));
       return false;
     }
+    return true;
+  }
   }
-  if (!CommitDbTransaction_(m_variable_db_.get(), txn_id)) return false;
 
-  if (!BeginDbTransaction_(m_fixed_db_.get(), &txn_id)) return false;
-  for (const auto& id : db_ids) {
-    res = m_fixed_db_->Delete(txn_id, GetFixedDbEntryName_(id));
-    if (!res) {
-      CRANE_ERROR("Failed to delete embedded fixed data entry. Error code: {}",
-                  int(res.error()));
+  return false;
+}
+
+bool EmbeddedDbClient::CompactRuntimeAttr_(
+    txn_id_t txn_id, db_id_t db_id,
+    crane::grpc::RuntimeAttrDeltaOfTask const& delta) {
+  std::string key = GetVariableDbEntryName_(db_id);
+
+  crane::grpc::RuntimeAttrOfTask runtime_attr;
+  if (!FetchTypeFromDb_(m_variable_db_.get(), txn_id, key, &runtime_attr))
+    return false;
+
+  uint32_t delta_num = GetRuntimeAttrDeltaNum_(db_id);
+  for (uint32_t seq = 0; seq < delta_num; seq++) {
+    crane::grpc::RuntimeAttrDeltaOfTask stored_delta;
+    if (FetchTypeFromDb_(m_variable_db_.get(), txn_id,
+                         GetRuntimeAttrDeltaEntryName_(db_id, seq),
+                         &stored_delta))
+      ApplyRuntimeAttrDelta_(stored_delta, &runtime_attr);
+  }
+  ApplyRuntimeAttrDelta_(delta, &runtime_attr);
+
+  if (!StoreTypeIntoDb_(m_variable_db_.get(), txn_id, key, &runtime_attr)) {
+    CRANE_ERROR("Failed to store compacted runtime attr of task db id {}.",
+                db_id);
+    return false;
+  }
+
+  DeleteRuntimeAttrDeltas_(txn_id, db_id);
+  return true;
+}
+
+void EmbeddedDbClient::DeleteRuntimeAttrDeltas_(txn_id_t txn_id,
+                                                db_id_t db_id) {
+  uint32_t delta_num = GetRuntimeAttrDeltaNum_(db_id);
+  if (delta_num == 0) return;
+
+  for (uint32_t seq = 0; seq < delta_num; seq++)
+    std::ignore = m_variable_db_->Delete(
+        txn_id, GetRuntimeAttrDeltaEntryName_(db_id, seq));
+
+  m_staged_delta_num_map_[db_id] = 0;
+}
+
+uint32_t EmbeddedDbClient::GetRuntimeAttrDeltaNum_(db_id_t db_id) const {
+  if (auto it = m_staged_delta_num_map_.find(db_id);
+      it != m_staged_delta_num_map_.end())
+    return it->second;
+  auto it = m_runtime_attr_delta_num_map_.find(db_id);
+  return it == m_runtime_attr_delta_num_map_.end() ? 0 : it->second;
+}
+
+void EmbeddedDbClient::RuntimeAttrDeltaNumsCommitted_() {
+  for (auto [db_id, delta_num] : m_staged_delta_num_map_) {
+    if (delta_num == 0)
+      m_runtime_attr_delta_num_map_.erase(db_id);
+    else
+      m_runtime_attr_delta_num_map_[db_id] = delta_num;
+  }
+  m_staged_delta_num_map_.clear();
+}
+
+void EmbeddedDbClient::ApplyRuntimeAttrDelta_(
+    crane::grpc::RuntimeAttrDeltaOfTask const& delta,
+    crane::grpc::RuntimeAttrOfTask* runtime_attr) {
+  if (delta.has_status()) runtime_attr->set_status(delta.status());
+  if (delta.has_exit_code()) runtime_attr->set_exit_code(delta.exit_code());
+  if (delta.has_held()) runtime_attr->set_held(delta.held());
+  if (delta.has_start_time())
+    *runtime_attr->mutable_start_time() = delta.start_time();
+  if (delta.has_end_time())
+    *runtime_attr->mutable_end_time() = delta.end_time();
+  for (uint32_t id : delta.resolved_dependency_ids())
+    runtime_attr->add_resolved_dependency_ids(id);
+  if (delta.has_dependency_failed())
+    runtime_attr->set_dependency_failed(delta.dependency_failed());
+}
+
+EmbeddedDbClient::RawTaskKvs::~RawTaskKvs() {
+  if (mapping != nullptr) munmap(mapping, mapping_len);
+}
+
+namespace {
+
+// Layout of the checkpoint file: the header is followed by fixed_num and then
+// variable_num entries of [key_len: u32][value_len: u32][key][value].
+struct CheckpointHeader {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t reserved;
+  uint64_t journal_seq;  // The last journal entry covered by the checkpoint.
+  uint64_t fixed_num;
+  uint64_t variable_num;
+  uint64_t payload_len;
+  uint64_t checksum;  // FNV-1a of the payload.
+};
+
+constexpr uint64_t kFnvOffsetBasis = 0xcbf29ce484222325;
+constexpr size_t kCheckpointWriteBufferSize = 4 * 1024 * 1024;
+
+uint64_t Fnv1a(const char* data, size_t len, uint64_t hash) {
+  for (size_t i = 0; i < len; i++) {
+    hash ^= static_cast<uint8_t>(data[i]);
+    hash *= 0x100000001b3;
+  }
+  return hash;
+}
+
+// Makes a rename or an unlink in the directory of path durable.
+bool SyncParentDir(const std::string& path) {
+  std::string dir = std::filesystem::path(path).parent_path().string();
+  if (dir.empty()) dir = ".";
+  int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd == -1) return false;
+  bool ok = fsync(fd) == 0;
+  close(fd);
+  return ok;
+}
+
+// Keys of Berkeley DB are returned with the terminating null character.
+void StripKeyTerminator(std::string* key) {
+  if (!key->empty() && key->back() == '\0') key->pop_back();
+}
+
+std::string_view AsStringView(std::vector<uint8_t> const& value) {
+  return {reinterpret_cast<const char*>(value.data()), value.size()};
+}
+
+}  // namespace
+
+bool EmbeddedDbClient::CollectTaskKvsFromDbs_(RawTaskKvs* kvs) {
+  // A checkpoint left behind is stale, and the journal entries written from
+  // now on reuse its sequence numbers. Make sure it is gone for good before
+  // the journal keys are touched, or a crash would replay them on top of it.
+  std::error_code ec;
+  std::filesystem::remove(m_checkpoint_path_, ec);
+  if (ec || !SyncParentDir(m_checkpoint_path_)) {
+    CRANE_ERROR("Failed to remove the stale embedded db checkpoint {}: {}",
+                m_checkpoint_path_, ec ? ec.message() : std::strerror(errno));
+    return false;
+  }
+
+  auto collect = [kvs](IEmbeddedDb* db, auto* map) {
+    auto result = db->IterateAllKv(
+        [&](std::string&& key, std::vector<uint8_t>&& value) {
+          StripKeyTerminator(&key);
+          // Journal entries are useless without the checkpoint.
+          if (IsJournalEntry_(key)) return false;
+
+          const auto& stored = kvs->storage.emplace_back(std::move(value));
+          map->emplace(std::move(key), AsStringView(stored));
+          return true;
+        });
+    return result.has_value();
+  };
+
+  if (!collect(m_variable_db_.get(), &kvs->variable)) {
+    CRANE_ERROR("Failed to restore the variable data into queues");
+    return false;
+  }
+
+  if (!collect(m_fixed_db_.get(), &kvs->fixed)) {
+    CRANE_ERROR("Failed to restore fixed data into queues!");
+    return false;
+  }
+
+  return true;
+}
+
+bool EmbeddedDbClient::LoadCheckpoint_(RawTaskKvs* kvs) {
+  int fd = open(m_checkpoint_path_.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    CRANE_INFO("No embedded db checkpoint found at {}.", m_checkpoint_path_);
+    return false;
+  }
+
+  struct stat st{};
+  void* mapping = MAP_FAILED;
+  if (fstat(fd, &st) == 0 &&
+      static_cast<size_t>(st.st_size) >= sizeof(CheckpointHeader))
+    mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    CRANE_WARN("Failed to map the embedded db checkpoint {}.",
+               m_checkpoint_path_);
+    return false;
+  }
+  kvs->mapping = mapping;
+  kvs->mapping_len = st.st_size;
+
+  auto discard = [kvs](std::string_view reason) {
+    CRANE_WARN("Ignore the embedded db checkpoint: {}.", reason);
+    kvs->fixed.clear();
+    kvs->variable.clear();
+    kvs->storage.clear();
+    munmap(kvs->mapping, kvs->mapping_len);
+    kvs->mapping = nullptr;
+    kvs->mapping_len = 0;
+    return false;
+  };
+
+  const char* data = static_cast<const char*>(mapping);
+  CheckpointHeader header;
+  std::memcpy(&header, data, sizeof(header));
+  if (header.magic != kEmbeddedDbCheckpointMagic ||
+      header.version != kEmbeddedDbCheckpointVersion)
+    return discard("unknown format");
+
+  const char* payload = data + sizeof(header);
+  size_t payload_len = kvs->mapping_len - sizeof(header);
+  if (header.payload_len != payload_len ||
+      Fnv1a(payload, payload_len, kFnvOffsetBasis) != header.checksum)
+    return discard("corrupted");
+
+  size_t offset = 0;
+  auto read_entries = [&](uint64_t num, auto* map) {
+    map->reserve(num);
+    for (uint64_t i = 0; i < num; i++) {
+      uint32_t key_len, value_len;
+      if (payload_len - offset < sizeof(key_len) + sizeof(value_len))
+        return false;
+      std::memcpy(&key_len, payload + offset, sizeof(key_len));
+      offset += sizeof(key_len);
+      std::memcpy(&value_len, payload + offset, sizeof(value_len));
+      offset += sizeof(value_len);
+
+      if (payload_len - offset < uint64_t{key_len} + value_len) return false;
+      map->emplace(std::string(payload + offset, key_len),
+                   std::string_view(payload + offset + key_len, value_len));
+      offset += key_len + value_len;
+    }
+    return true;
+  };
+
+  if (!read_entries(header.fixed_num, &kvs->fixed) ||
+      !read_entries(header.variable_num, &kvs->variable) ||
+      offset != payload_len)
+    return discard("corrupted");
+
+  // Collect the tasks touched after the checkpoint.
+  std::unordered_set<db_id_t> dirty_db_ids;
+  uint64_t seq = header.journal_seq + 1;
+  for (;; seq++) {
+    std::string key = GetJournalEntryName_(seq);
+    auto entry = FetchRawFromDb_(m_variable_db_.get(), key);
+    if (!entry && entry.error() == DbErrorCode::kNotFound)
+      entry = FetchRawFromDb_(m_fixed_db_.get(), key);
+    if (!entry) {
+      if (entry.error() == DbErrorCode::kNotFound) break;
+      return discard("failed to read the journal");
+    }
+
+    for (size_t i = 0; i + sizeof(db_id_t) <= entry->size();
+         i += sizeof(db_id_t)) {
+      db_id_t db_id;
+      std::memcpy(&db_id, entry->data() + i, sizeof(db_id));
+      dirty_db_ids.emplace(db_id);
+    }
+  }
+
+  // Replace them with their data in the dbs. Returns whether the key is found.
+  auto reload = [this, kvs](IEmbeddedDb* db, std::string key,
+                            auto* map) -> std::expected<bool, DbErrorCode> {
+    map->erase(key);
+
+    auto value = FetchRawFromDb_(db, key);
+    if (!value) {
+      if (value.error() == DbErrorCode::kNotFound) return false;
+      return std::unexpected(value.error());
+    }
+
+    const auto& stored = kvs->storage.emplace_back(std::move(value.value()));
+    map->emplace(std::move(key), AsStringView(stored));
+    return true;
+  };
+
+  for (db_id_t db_id : dirty_db_ids) {
+    if (!reload(m_fixed_db_.get(), GetFixedDbEntryName_(db_id), &kvs->fixed) ||
+        !reload(m_variable_db_.get(), GetVariableDbEntryName_(db_id),
+                &kvs->variable))
+      return discard("failed to read the dbs");
+
+    for (uint32_t delta_seq = 0;; delta_seq++) {
+      auto found = reload(m_variable_db_.get(),
+                          GetRuntimeAttrDeltaEntryName_(db_id, delta_seq),
+                          &kvs->variable);
+      if (!found) return discard("failed to read the dbs");
+      if (!found.value()) break;
+    }
+  }
+
+  m_first_journal_seq_ = header.journal_seq + 1;
+  m_journal_seq_ = seq;
+
+  CRANE_INFO(
+      "Loaded embedded db checkpoint of {} entries and replayed {} journal "
+      "entries of {} tasks.",
+      header.fixed_num + header.variable_num, seq - m_first_journal_seq_,
+      dirty_db_ids.size());
+  return true;
+}
+
+bool EmbeddedDbClient::WriteCheckpoint_() {
+  absl::Time begin = absl::Now();
+
+  // The delta numbers are lost on restart, so the checkpoint should not
+  // contain any delta.
+  if (!m_runtime_attr_delta_num_map_.empty()) {
+    std::vector<db_id_t> db_ids;
+    db_ids.reserve(m_runtime_attr_delta_num_map_.size());
+    for (db_id_t db_id : m_runtime_attr_delta_num_map_ | std::views::keys)
+      db_ids.emplace_back(db_id);
+
+    txn_id_t txn_id;
+    if (!BeginDbTransaction_(m_variable_db_.get(), &txn_id)) return false;
+    for (db_id_t db_id : db_ids)
+      std::ignore = CompactRuntimeAttr_(txn_id, db_id, {});
+    if (!CommitDbTransaction_(m_variable_db_.get(), txn_id)) {
+      RuntimeAttrDeltaNumsAborted_();
       return false;
     }
+    RuntimeAttrDeltaNumsCommitted_();
+  }
+
+  CheckpointHeader header{.magic = kEmbeddedDbCheckpointMagic,
+                          .version = kEmbeddedDbCheckpointVersion,
+                          .reserved = 0,
+                          .journal_seq = m_journal_seq_ - 1,
+                          .fixed_num = 0,
+                          .variable_num = 0,
+                          .payload_len = 0,
+                          .checksum = kFnvOffsetBasis};
+
+  std::string tmp_path = m_checkpoint_path_ + ".tmp";
+  int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                0600);
+  if (fd == -1) {
+    CRANE_ERROR("Failed to open {}: {}", tmp_path, std::strerror(errno));
+    return false;
   }
-  if (!CommitDbTransaction_(m_fixed_db_.get(), txn_id)) return false;
 
+  // The header is written last, when the numbers are known.
+  std::string buf(sizeof(header), '\0');
+  bool write_ok = true;
+  auto flush = [&] {
+    if (write_ok) write_ok = util::os::WriteAll(fd, buf.data(), buf.size());
+    buf.clear();
+  };
+
+  auto dump = [&](IEmbeddedDb* db, uint64_t* num) {
+    auto result = db->IterateAllKv(
+        [&](std::string&& key, std::vector<uint8_t>&& value) {
+          StripKeyTerminator(&key);
+          if (IsJournalEntry_(key)) return true;
+
+          uint32_t key_len = key.size();
+          uint32_t value_len = value.size();
+          size_t entry_begin = buf.size();
+          buf.append(reinterpret_cast<const char*>(&key_len), sizeof(key_len));
+          buf.append(reinterpret_cast<const char*>(&value_len),
+                     sizeof(value_len));
+          buf.append(key);
+          buf.append(AsStringView(value));
+
+          size_t entry_len = buf.size() - entry_begin;
+          header.checksum =
+              Fnv1a(buf.data() + entry_begin, entry_len, header.checksum);
+          header.payload_len += entry_len;
+          (*num)++;
+
+          if (buf.size() >= kCheckpointWriteBufferSize) flush();
+          return true;
+        });
+    return result.has_value();
+  };
+
+  bool dump_ok = dump(m_fixed_db_.get(), &header.fixed_num) &&
+                 dump(m_variable_db_.get(), &header.variable_num);
+  flush();
+
+  if (write_ok)
+    write_ok = pwrite(fd, &header, sizeof(header), 0) == sizeof(header);
+  if (write_ok) write_ok = fsync(fd) == 0;
+  close(fd);
+
+  if (!dump_ok || !write_ok ||
+      rename(tmp_path.c_str(), m_checkpoint_path_.c_str()) != 0 ||
+      !SyncParentDir(m_checkpoint_path_)) {
+    CRANE_ERROR("Failed to write the embedded db checkpoint {}.", tmp_path);
+    unlink(tmp_path.c_str());
+    return false;
+  }
+
+  // Journal entries left by a failure here are covered by the next
+  // checkpoint.
+  bool deleted = true;
+  for (IEmbeddedDb* db : {m_fixed_db_.get(), m_variable_db_.get()}) {
+    txn_id_t txn_id;
+    if (!BeginDbTransaction_(db, &txn_id)) {
+      deleted = false;
+      continue;
+    }
+    for (uint64_t seq = m_first_journal_seq_; seq <= header.journal_seq; seq++)
+      std::ignore = db->Delete(txn_id, GetJournalEntryName_(seq));
+    if (!CommitDbTransaction_(db, txn_id)) deleted = false;
+  }
+  if (deleted) m_first_journal_seq_ = header.journal_seq + 1;
+
+  CRANE_INFO("Wrote embedded db checkpoint of {} entries in {} ms.",
+             header.fixed_num + header.variable_num,
+             absl::ToInt64Milliseconds(absl::Now() - begin));
   return true;
 }
 
+std::expected<std::vector<uint8_t>, DbErrorCode>
+EmbeddedDbClient::FetchRawFromDb_(IEmbeddedDb* db, std::string const& key) {
+  size_t n_bytes{0};
+
+  auto result = db->Fetch(0, key, nullptr, &n_bytes);
+  if (!result && result.error() != DbErrorCode::kBufferSmall)
+    return std::unexpected(result.error());
+
+  std::vector<uint8_t> buf(n_bytes);
+  if (n_bytes != 0) {
+    result = db->Fetch(0, key, buf.data(), &n_bytes);
+    if (!result) return std::unexpected(result.error());
+  }
+
+  return buf;
+}
+
 }  // namespace Ctld
@@ -29,6 +29,10 @@
 #  include <unqlite.h>
 #endif
 
+#ifdef CRANE_HAVE_LMDB
+#  include <lmdb.h>
+#endif
+
 #include "protos/Crane.pb.h"
 
 namespace Ctld {
@@ -161,6 +165,61 @@ class BerkeleyDb : public IEmbeddedDb {
 
 #endif
 
+#ifdef CRANE_HAVE_LMDB
+
+class LmdbDb : public IEmbeddedDb {
+ public:
+  std::expected<void, DbErrorCode> Init(const std::string& path) override;
+
+  std::expected<void, DbErrorCode> Close() override;
+
+  std::expected<void, DbErrorCode> Store(txn_id_t txn_id,
+                                         const std::string& key,
+                                         const void* data, size_t len) override;
+
+  std::expected<size_t, DbErrorCode> Fetch(txn_id_t txn_id,
+                                           const std::string& key, void* buf,
+                                           size_t* len) override;
+
+  std::expected<void, DbErrorCode> Delete(txn_id_t txn_id,
+                                          const std::string& key) override;
+
+  std::expected<txn_id_t, DbErrorCode> Begin() override;
+
+  std::expected<void, DbErrorCode> Commit(txn_id_t txn_id) override;
+
+  std::expected<void, DbErrorCode> Abort(txn_id_t txn_id) override;
+
+  std::expected<void, DbErrorCode> IterateAllKv(KvIterFunc func) override;
+
+  const std::string& DbPath() override { return m_db_path_; };
+
+ private:
+  MDB_txn* GetMdbTxnFromId_(txn_id_t txn_id);
+  // Also forgets the transaction, which is about to be committed or aborted.
+  MDB_txn* TakeMdbTxnFromId_(txn_id_t txn_id);
+
+  // Runs func in the transaction of txn_id, or in a transaction of its own
+  // which is committed afterward if txn_id is 0.
+  std::expected<void, DbErrorCode> RunInWriteTxn_(
+      txn_id_t txn_id, std::function<int(MDB_txn*)> const& func);
+
+  // The file is sparse, so the map size only bounds the size of the db.
+  static constexpr size_t s_map_size_ = size_t{64} * 1024 * 1024 * 1024;
+
+  std::string m_db_path_;
+
+  MDB_env* m_env_{nullptr};
+  MDB_dbi m_dbi_{0};
+
+  txn_id_t m_next_txn_id_ ABSL_GUARDED_BY(m_txn_map_mtx_){1};
+  std::unordered_map<txn_id_t, MDB_txn*> m_txn_map_
+      ABSL_GUARDED_BY(m_txn_map_mtx_);
+  absl::Mutex m_txn_map_mtx_;
+};
+
+#endif
+
 class EmbeddedDbClient {
  private:
   using db_id_t = task_db_id_t;
@@ -173,6 +232,76 @@ class EmbeddedDbClient {
     std::unordered_map<db_id_t, TaskInEmbeddedDb> final_queue;
   };
 
+  // Mutations of task data which are committed together by CommitAsync().
+  // Values are serialized when they are added, so the batch doesn't refer to
+  // the tasks afterwards.
+  class WriteBatch {
+   public:
+    // With if_exists, the value is only written if the task is still in db.
+    void PutTaskToCtld(db_id_t db_id,
+                       crane::grpc::TaskToCtld const& task_to_ctld,
+                       bool if_exists = false) {
+      m_fixed_puts_.emplace_back(db_id, GetFixedDbEntryName_(db_id),
+                                 task_to_ctld.SerializeAsString(), if_exists);
+    }
+
+    // A full record supersedes the deltas stored before.
+    void PutRuntimeAttr(db_id_t db_id,
+                        crane::grpc::RuntimeAttrOfTask const& runtime_attr,
+                        bool if_exists = false) {
+      m_variable_ops_.emplace_back(VariableOp::kPut, db_id,
+                                   GetVariableDbEntryName_(db_id),
+                                   runtime_attr.SerializeAsString(), if_exists);
+    }
+
+    // Appends a delta record instead of rewriting the full record. The delta
+    // is dropped if the task is no longer in db.
+    void PutRuntimeAttrDelta(
+        db_id_t db_id, crane::grpc::RuntimeAttrDeltaOfTask const& delta) {
+      m_variable_ops_.emplace_back(VariableOp::kDelta, db_id, std::string{},
+                                   delta.SerializeAsString(), true);
+    }
+
+    void DeleteTask(db_id_t db_id) {
+      m_variable_ops_.emplace_back(VariableOp::kDelete, db_id, std::string{},
+                                   std::string{}, false);
+      m_fixed_deletes_.emplace_back(GetFixedDbEntryName_(db_id));
+    }
+
+    size_t Size() const {
+      return m_fixed_puts_.size() + m_variable_ops_.size() +
+             m_fixed_deletes_.size();
+    }
+
+    bool Empty() const { return Size() == 0; }
+
+   private:
+    friend class EmbeddedDbClient;
+
+    struct Put {
+      db_id_t db_id;
+      std::string key;
+      std::string value;
+      bool if_exists;
+    };
+
+    // Operations on the variable db are applied in order, since the deltas
+    // of a task depend on its full record.
+    struct VariableOp {
+      enum Type : uint8_t { kPut, kDelta, kDelete };
+
+      Type type;
+      db_id_t db_id;  // 0 if the entry is not the data of a task.
+      std::string key;  // Only for kPut.
+      std::string value;
+      bool if_exists;
+    };
+
+    std::vector<Put> m_fixed_puts_;
+    std::vector<VariableOp> m_variable_ops_;
+    std::vector<std::string> m_fixed_deletes_;
+  };
+
   EmbeddedDbClient() = default;
   ~EmbeddedDbClient();
 
@@ -208,6 +337,12 @@ class EmbeddedDbClient {
     return CommitDbTransaction_(m_resv_db_.get(), txn_id);
   }
 
+  // Enqueues the batch for the committer thread, which merges the batches of
+  // concurrent callers into one transaction per db. The future becomes true
+  // once the batch is durable and false if any of its mutations failed.
+  // Batches are applied in the order they are enqueued.
+  std::future<bool> CommitAsync(WriteBatch&& batch);
+
   // Note: All operations in transaction will abort or rollback automatically if
   // some operation fails, so we don't need anything like AbortTransaction here!
 
@@ -247,10 +382,9 @@ class EmbeddedDbClient {
         .has_value();
   }
 
+  // Fetch a task with the runtime attr deltas not compacted yet applied.
   bool FetchTaskDataInDb(txn_id_t txn_id, db_id_t db_id,
-                         TaskInEmbeddedDb* task_in_db) {  // Only used in test
-    return FetchTaskDataInDbAtomic_(txn_id, db_id, task_in_db).has_value();
-  }
+                         TaskInEmbeddedDb* task_in_db);
 
   bool UpdateReservationInfo(
       txn_id_t txn_id, const ResvId& name,
@@ -272,14 +406,35 @@ class EmbeddedDbClient {
     return fmt::format("{}S", db_id);
   }
 
+  inline static std::string GetRuntimeAttrDeltaEntryName_(db_id_t db_id,
+                                                          uint32_t seq) {
+    return fmt::format("{}D{}", db_id, seq);
+  }
+
   inline static bool IsVariableDbTaskDataEntry_(std::string const& key) {
     return key.back() == 'S';
   }
 
+  inline static bool IsRuntimeAttrDeltaEntry_(std::string const& key) {
+    return std::isdigit(key.front()) && key.find('D') != std::string::npos;
+  }
+
+  inline static std::string GetJournalEntryName_(uint64_t seq) {
+    return fmt::format("J{}", seq);
+  }
+
+  inline static bool IsJournalEntry_(std::string const& key) {
+    return key.front() == 'J';
+  }
+
   inline static task_db_id_t ExtractDbIdFromEntry_(std::string const& key) {
     return std::stol(key.substr(0, key.size() - 1));
   }
 
+  static void ApplyRuntimeAttrDelta_(
+      crane::grpc::RuntimeAttrDeltaOfTask const& delta,
+      crane::grpc::RuntimeAttrOfTask* runtime_attr);
+
   bool BeginDbTransaction_(IEmbeddedDb* db, txn_id_t* txn_id) {
     auto result = db->Begin();
     if (result.has_value()) {
@@ -508,6 +663,93 @@ class EmbeddedDbClient {
   std::unique_ptr<IEmbeddedDb> m_variable_db_;
   std::unique_ptr<IEmbeddedDb> m_fixed_db_;
   std::unique_ptr<IEmbeddedDb> m_resv_db_;
+
+  // ----------- Group commit
+
+  struct QueuedBatch {
+    WriteBatch batch;
+    std::promise<bool> durable_promise;
+  };
+
+  void GroupCommitThread_();
+
+  // Sets ok[i] to false if a mutation of the i-th batch fails, in which case
+  // none of the mutations of the later steps of that batch are applied.
+  // Returns false if the transactions themselves fail.
+  bool ApplyBatchGroup_(std::vector<QueuedBatch> const& group,
+                        std::vector<bool>* ok);
+
+  bool ApplyPut_(IEmbeddedDb* db, txn_id_t txn_id, std::string const& key,
+                 std::string const& value, bool if_exists);
+  bool ApplyVariableOp_(txn_id_t txn_id, WriteBatch::VariableOp const& op);
+
+  // Merges the deltas of a task into its full record.
+  bool CompactRuntimeAttr_(txn_id_t txn_id, db_id_t db_id,
+                           crane::grpc::RuntimeAttrDeltaOfTask const& delta);
+  void DeleteRuntimeAttrDeltas_(txn_id_t txn_id, db_id_t db_id);
+
+  uint32_t GetRuntimeAttrDeltaNum_(db_id_t db_id) const;
+  // Applies the delta numbers staged by a committed transaction. The staged
+  // ones of an aborted transaction are dropped instead.
+  void RuntimeAttrDeltaNumsCommitted_();
+  void RuntimeAttrDeltaNumsAborted_() { m_staged_delta_num_map_.clear(); }
+
+  // Mutations in m_commit_queue_.
+  size_t m_queued_mutation_num_ ABSL_GUARDED_BY(m_commit_queue_mtx_){0};
+  std::vector<QueuedBatch> m_commit_queue_ ABSL_GUARDED_BY(m_commit_queue_mtx_);
+  bool m_commit_thread_stop_ ABSL_GUARDED_BY(m_commit_queue_mtx_){false};
+  absl::Mutex m_commit_queue_mtx_;
+
+  // Number of the deltas stored for each task. Only used by the committer
+  // thread. Recovery compacts all the deltas, so it starts empty.
+  absl::flat_hash_map<db_id_t, uint32_t> m_runtime_attr_delta_num_map_;
+  // The numbers changed by the open transaction, 0 for the tasks whose
+  // deltas are deleted.
+  absl::flat_hash_map<db_id_t, uint32_t> m_staged_delta_num_map_;
+
+  std::thread m_commit_thread_;
+
+  // ----------- Checkpoint
+  // The checkpoint is a dump of both task data dbs. While it is enabled, the
+  // first transaction of each group also stores a journal entry "J<seq>"
+  // with the db ids the group touches, so recovery only has to re-read these
+  // tasks from the dbs on top of the checkpoint.
+
+  // The kv pairs of the task data in both dbs. The values point into the
+  // mapped checkpoint file or into storage.
+  struct RawTaskKvs {
+    std::unordered_map<std::string, std::string_view> fixed;
+    std::unordered_map<std::string, std::string_view> variable;
+    std::list<std::vector<uint8_t>> storage;
+
+    void* mapping{nullptr};
+    size_t mapping_len{0};
+
+    ~RawTaskKvs();
+  };
+
+  // Iterates both dbs. Stale journal entries are deleted.
+  bool CollectTaskKvsFromDbs_(RawTaskKvs* kvs);
+
+  // Maps the checkpoint file and replaces the tasks in the journal entries
+  // written after it with their data in the dbs.
+  // Returns false if there is no usable checkpoint.
+  bool LoadCheckpoint_(RawTaskKvs* kvs);
+
+  // Called by the committer thread, which stops committing meanwhile.
+  // Compacts all the deltas, writes the checkpoint file and deletes the
+  // journal entries it covers.
+  bool WriteCheckpoint_();
+
+  std::expected<std::vector<uint8_t>, DbErrorCode> FetchRawFromDb_(
+      IEmbeddedDb* db, std::string const& key);
+
+  std::string m_checkpoint_path_;
+
+  // Only used by the committer thread once the recovery is done.
+  uint64_t m_journal_seq_{1};        // Seq of the next journal entry.
+  uint64_t m_first_journal_seq_{1};  // Oldest journal entry in the dbs.
+  absl::Time m_last_checkpoint_time_{absl::InfinitePast()};
 };
 
 }  // namespace Ctld
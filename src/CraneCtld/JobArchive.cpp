@@ -0,0 +1,418 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "JobArchive.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "DbClient.h"
+
+namespace Ctld {
+
+namespace {
+
+// Layout of a segment file: the header is followed by payload_len bytes of
+// the zlib-compressed JobArchiveSegment, which is raw_len bytes serialized.
+struct SegmentHeader {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t job_num;
+  int64_t min_time_submit, max_time_submit;
+  int64_t min_time_start, max_time_start;
+  int64_t min_time_end, max_time_end;
+  int64_t min_task_db_id, max_task_db_id;
+  uint32_t min_task_id, max_task_id;
+  uint64_t raw_len;
+  uint64_t payload_len;
+  uint32_t checksum;  // crc32 of the payload
+  uint32_t reserved;
+};
+
+bool ReadHeader(const std::filesystem::path& path, std::ifstream* file,
+                SegmentHeader* header) {
+  file->open(path, std::ios::binary);
+  if (!file->read(reinterpret_cast<char*>(header), sizeof(*header))) {
+    CRANE_ERROR("Failed to read the header of job archive segment {}.",
+                path.string());
+    return false;
+  }
+  if (header->magic != kJobArchiveSegmentMagic ||
+      header->version != kJobArchiveSegmentVersion) {
+    CRANE_ERROR("Skip job archive segment {} of unknown format.",
+                path.string());
+    return false;
+  }
+  return true;
+}
+
+bool ReadSegment(const std::filesystem::path& path, std::ifstream* file,
+                 const SegmentHeader& header,
+                 crane::grpc::JobArchiveSegment* segment) {
+  std::string payload(header.payload_len, '\0');
+  if (!file->read(payload.data(), payload.size()) ||
+      crc32(0, reinterpret_cast<const Bytef*>(payload.data()),
+            payload.size()) != header.checksum) {
+    CRANE_ERROR("Job archive segment {} is truncated or corrupted.",
+                path.string());
+    return false;
+  }
+
+  std::string raw(header.raw_len, '\0');
+  uLongf raw_len = raw.size();
+  if (uncompress(reinterpret_cast<Bytef*>(raw.data()), &raw_len,
+                 reinterpret_cast<const Bytef*>(payload.data()),
+                 payload.size()) != Z_OK ||
+      raw_len != raw.size() || !segment->ParseFromString(raw)) {
+    CRANE_ERROR("Failed to decode job archive segment {}.", path.string());
+    return false;
+  }
+  return true;
+}
+
+bool IntervalMayOverlap(bool has_interval,
+                        const crane::grpc::TimeInterval& interval,
+                        int64_t min_time, int64_t max_time) {
+  if (!has_interval) return true;
+  if (interval.has_lower_bound() &&
+      max_time < interval.lower_bound().seconds())
+    return false;
+  if (interval.has_upper_bound() &&
+      min_time > interval.upper_bound().seconds())
+    return false;
+  return true;
+}
+
+bool HeaderMayMatch(const SegmentHeader& header,
+                    const crane::grpc::QueryTasksInfoRequest& request) {
+  if (!IntervalMayOverlap(request.has_filter_submit_time_interval(),
+                          request.filter_submit_time_interval(),
+                          header.min_time_submit, header.max_time_submit) ||
+      !IntervalMayOverlap(request.has_filter_start_time_interval(),
+                          request.filter_start_time_interval(),
+                          header.min_time_start, header.max_time_start) ||
+      !IntervalMayOverlap(request.has_filter_end_time_interval(),
+                          request.filter_end_time_interval(),
+                          header.min_time_end, header.max_time_end))
+    return false;
+
+  if (request.page_size() > 0 &&
+      header.max_task_id <= request.page_after_task_id())
+    return false;
+
+  if (!request.filter_task_ids().empty() &&
+      std::none_of(request.filter_task_ids().begin(),
+                   request.filter_task_ids().end(), [&](uint32_t task_id) {
+                     return task_id >= header.min_task_id &&
+                            task_id <= header.max_task_id;
+                   }))
+    return false;
+
+  return true;
+}
+
+bool RowMatches(const crane::grpc::JobArchiveSegment& segment, int row,
+                const crane::grpc::QueryTasksInfoRequest& request) {
+  auto in = [](const auto& values, const auto& value) {
+    return values.empty() ||
+           std::find(values.begin(), values.end(), value) != values.end();
+  };
+  auto in_interval = [](bool has_interval,
+                        const crane::grpc::TimeInterval& interval,
+                        int64_t time) {
+    return IntervalMayOverlap(has_interval, interval, time, time);
+  };
+
+  uint32_t task_id = segment.task_id(row);
+  if (request.page_size() > 0 && task_id <= request.page_after_task_id())
+    return false;
+
+  return in(request.filter_task_ids(), task_id) &&
+         in(request.filter_task_states(), segment.state(row)) &&
+         in(request.filter_partitions(), segment.partition_name(row)) &&
+         in(request.filter_task_names(), segment.task_name(row)) &&
+         in(request.filter_qos(), segment.qos(row)) &&
+         in(request.filter_users(), segment.username(row)) &&
+         in(request.filter_accounts(), segment.account(row)) &&
+         in_interval(request.has_filter_submit_time_interval(),
+                     request.filter_submit_time_interval(),
+                     segment.time_submit(row)) &&
+         in_interval(request.has_filter_start_time_interval(),
+                     request.filter_start_time_interval(),
+                     segment.time_start(row)) &&
+         in_interval(request.has_filter_end_time_interval(),
+                     request.filter_end_time_interval(),
+                     segment.time_end(row));
+}
+
+// Entries of the directory sorted by name, newest first.
+std::vector<std::filesystem::path> ListNewestFirst(
+    const std::filesystem::path& dir, bool directories) {
+  std::vector<std::filesystem::path> paths;
+  std::error_code ec;
+  for (const auto& entry : std::filesystem::directory_iterator(dir, ec)) {
+    if (directories ? entry.is_directory()
+                    : entry.path().extension() == ".seg")
+      paths.emplace_back(entry.path());
+  }
+  std::ranges::sort(paths, std::greater{});
+  return paths;
+}
+
+}  // namespace
+
+JobArchive::JobArchive(std::filesystem::path dir) : m_dir_(std::move(dir)) {}
+
+JobArchive::~JobArchive() {
+  if (m_aging_thread_.joinable()) {
+    {
+      LockGuard lock(&m_stop_mtx_);
+      m_stop_ = true;
+    }
+    m_aging_thread_.join();
+  }
+}
+
+bool JobArchive::Init() {
+  std::error_code ec;
+  std::filesystem::create_directories(m_dir_, ec);
+  if (ec) {
+    CRANE_ERROR("Failed to create job archive directory {}: {}",
+                m_dir_.string(), ec.message());
+    return false;
+  }
+
+  // Segments are named after their task db ids, so the latest end time
+  // can't be found without reading the headers.
+  uint64_t segment_num = 0;
+  int64_t max_time_end = 0;
+  for (const auto& month_dir : ListNewestFirst(m_dir_, true)) {
+    for (const auto& path : ListNewestFirst(month_dir, false)) {
+      std::ifstream file;
+      SegmentHeader header;
+      if (!ReadHeader(path, &file, &header)) continue;
+      max_time_end = std::max(max_time_end, header.max_time_end);
+      segment_num++;
+    }
+  }
+  m_max_time_end_ = max_time_end;
+
+  CRANE_INFO("Job archive {} has {} segments.", m_dir_.string(), segment_num);
+
+  m_aging_thread_ = std::thread([this] { AgingThread_(); });
+  return true;
+}
+
+bool JobArchive::MayContain(
+    const crane::grpc::QueryTasksInfoRequest& request) const {
+  int64_t max_time_end = m_max_time_end_.load(std::memory_order_acquire);
+  if (max_time_end == 0) return false;
+
+  // A job is submitted and started before it ends, so a lower bound of any
+  // of the times after the latest archived end time excludes the archive.
+  for (auto [has_interval, interval] :
+       {std::pair{request.has_filter_submit_time_interval(),
+                  &request.filter_submit_time_interval()},
+        std::pair{request.has_filter_start_time_interval(),
+                  &request.filter_start_time_interval()},
+        std::pair{request.has_filter_end_time_interval(),
+                  &request.filter_end_time_interval()}}) {
+    if (has_interval && interval->has_lower_bound() &&
+        interval->lower_bound().seconds() > max_time_end)
+      return false;
+  }
+
+  return true;
+}
+
+void JobArchive::Scan(const crane::grpc::QueryTasksInfoRequest& request,
+                      const Visitor& visitor) const {
+  absl::flat_hash_set<task_db_id_t> visited_db_ids;
+
+  for (const auto& month_dir : ListNewestFirst(m_dir_, true)) {
+    for (const auto& path : ListNewestFirst(month_dir, false)) {
+      std::ifstream file;
+      SegmentHeader header;
+      if (!ReadHeader(path, &file, &header) || !HeaderMayMatch(header, request))
+        continue;
+
+      crane::grpc::JobArchiveSegment segment;
+      if (!ReadSegment(path, &file, header, &segment)) continue;
+
+      // Rows are appended in ascending order of end time.
+      for (int row = segment.task_db_id_size() - 1; row >= 0; row--) {
+        if (!RowMatches(segment, row, request) ||
+            !visited_db_ids.emplace(segment.task_db_id(row)).second)
+          continue;
+
+        const std::string& doc = segment.document(row);
+        bsoncxx::document::view view{
+            reinterpret_cast<const uint8_t*>(doc.data()), doc.size()};
+        if (!visitor(view)) return;
+      }
+    }
+  }
+}
+
+bool JobArchive::WriteSegments(
+    const std::vector<bsoncxx::document::value>& jobs) {
+  absl::btree_map<std::string, std::vector<bsoncxx::document::view>> months;
+  for (const auto& job : jobs) {
+    absl::Time time_end =
+        absl::FromUnixSeconds(job.view()["time_end"].get_int64().value);
+    months[absl::FormatTime("%Y-%m", time_end, absl::UTCTimeZone())]
+        .emplace_back(job.view());
+  }
+
+  for (const auto& [month, month_jobs] : months) {
+    crane::grpc::JobArchiveSegment segment;
+    SegmentHeader header{
+        .magic = kJobArchiveSegmentMagic,
+        .version = kJobArchiveSegmentVersion,
+        .job_num = static_cast<uint32_t>(month_jobs.size()),
+        .min_time_submit = std::numeric_limits<int64_t>::max(),
+        .max_time_submit = std::numeric_limits<int64_t>::min(),
+        .min_time_start = std::numeric_limits<int64_t>::max(),
+        .max_time_start = std::numeric_limits<int64_t>::min(),
+        .min_time_end = std::numeric_limits<int64_t>::max(),
+        .max_time_end = std::numeric_limits<int64_t>::min(),
+        .min_task_db_id = std::numeric_limits<int64_t>::max(),
+        .max_task_db_id = std::numeric_limits<int64_t>::min(),
+        .min_task_id = std::numeric_limits<uint32_t>::max(),
+        .max_task_id = 0,
+        .raw_len = 0,
+        .payload_len = 0,
+        .checksum = 0,
+        .reserved = 0};
+
+    auto add_int64 = [](google::protobuf::RepeatedField<int64_t>* column,
+                        int64_t value, int64_t* min_value,
+                        int64_t* max_value) {
+      column->Add(value);
+      *min_value = std::min(*min_value, value);
+      *max_value = std::max(*max_value, value);
+    };
+
+    try {
+      for (const auto& job : month_jobs) {
+        add_int64(segment.mutable_task_db_id(),
+                  job["task_db_id"].get_int64().value, &header.min_task_db_id,
+                  &header.max_task_db_id);
+        add_int64(segment.mutable_time_submit(),
+                  job["time_submit"].get_int64().value,
+                  &header.min_time_submit, &header.max_time_submit);
+        add_int64(segment.mutable_time_start(),
+                  job["time_start"].get_int64().value, &header.min_time_start,
+                  &header.max_time_start);
+        add_int64(segment.mutable_time_end(),
+                  job["time_end"].get_int64().value, &header.min_time_end,
+                  &header.max_time_end);
+
+        uint32_t task_id = job["task_id"].get_int32().value;
+        segment.add_task_id(task_id);
+        header.min_task_id = std::min(header.min_task_id, task_id);
+        header.max_task_id = std::max(header.max_task_id, task_id);
+
+        auto string_of = [&job](const char* field) {
+          return std::string(job[field].get_string().value);
+        };
+        segment.add_state(job["state"].get_int32().value);
+        segment.add_account(string_of("account"));
+        segment.add_username(string_of("username"));
+        segment.add_task_name(string_of("task_name"));
+        segment.add_qos(string_of("qos"));
+        segment.add_partition_name(string_of("partition_name"));
+        segment.add_document(job.data(), job.length());
+      }
+    } catch (const std::exception& e) {
+      CRANE_ERROR("Failed to archive a job of {}: {}", month, e.what());
+      return false;
+    }
+
+    std::string raw = segment.SerializeAsString();
+    uLongf payload_len = compressBound(raw.size());
+    std::string buf(sizeof(header) + payload_len, '\0');
+    if (compress(reinterpret_cast<Bytef*>(buf.data() + sizeof(header)),
+                 &payload_len, reinterpret_cast<const Bytef*>(raw.data()),
+                 raw.size()) != Z_OK) {
+      CRANE_ERROR("Failed to compress job archive segment of {}.", month);
+      return false;
+    }
+    buf.resize(sizeof(header) + payload_len);
+
+    header.raw_len = raw.size();
+    header.payload_len = payload_len;
+    header.checksum = crc32(
+        0, reinterpret_cast<const Bytef*>(buf.data() + sizeof(header)),
+        payload_len);
+    std::memcpy(buf.data(), &header, sizeof(header));
+
+    std::filesystem::path month_dir = m_dir_ / month;
+    std::error_code ec;
+    std::filesystem::create_directories(month_dir, ec);
+
+    std::filesystem::path path =
+        month_dir / fmt::format("{:020}-{:020}.seg", header.min_task_db_id,
+                                header.max_task_db_id);
+    std::string tmp_path = path.string() + ".tmp";
+    int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                  0600);
+    if (fd == -1) {
+      CRANE_ERROR("Failed to open {}: {}", tmp_path, std::strerror(errno));
+      return false;
+    }
+
+    bool ok = util::os::WriteAll(fd, buf.data(), buf.size()) && fsync(fd) == 0;
+    close(fd);
+    if (!ok || rename(tmp_path.c_str(), path.c_str()) != 0) {
+      CRANE_ERROR("Failed to write job archive segment {}: {}", path.string(),
+                  std::strerror(errno));
+      unlink(tmp_path.c_str());
+      return false;
+    }
+
+    int64_t max_time_end = m_max_time_end_.load(std::memory_order_relaxed);
+    m_max_time_end_.store(std::max(max_time_end, header.max_time_end),
+                          std::memory_order_release);
+  }
+
+  return true;
+}
+
+void JobArchive::AgingThread_() {
+  util::SetCurrentThreadName("JobArchiveThr");
+
+  auto stopped = [this] { return m_stop_; };
+
+  while (true) {
+    absl::Time cutoff =
+        absl::Now() - absl::Hours(24) * g_config.JobArchiveConf.AgeDays;
+    if (!g_db_client->ArchiveJobsEndedBefore(absl::ToUnixSeconds(cutoff),
+                                             this))
+      CRANE_ERROR("Failed to archive the jobs ended before {}.",
+                  absl::FormatTime(cutoff));
+
+    LockGuard lock(&m_stop_mtx_);
+    if (m_stop_mtx_.AwaitWithTimeout(absl::Condition(&stopped),
+                                     absl::Seconds(kJobArchiveIntervalSec)))
+      break;
+  }
+}
+
+}  // namespace Ctld
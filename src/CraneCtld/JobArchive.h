@@ -0,0 +1,84 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "CtldPublicDefs.h"
+// Precompiled header comes first!
+
+#include <bsoncxx/document/value.hpp>
+#include <bsoncxx/document/view.hpp>
+
+#include "protos/Crane.pb.h"
+
+namespace Ctld {
+
+// Cold tier of the task table for the records only read by rare audits.
+//
+// Every kJobArchiveIntervalSec the aging thread moves the jobs ended more
+// than JobArchive.AgeDays ago out of MongoDB. The jobs of one pass ended in
+// the same month (UTC) form a segment, stored in
+// <Dir>/<YYYY-MM>/<min task_db_id>-<max task_db_id>.seg. The header of a
+// segment keeps the bounds of its time and task id columns, so that a scan
+// skips the segments out of the range of a query without reading the
+// payload, a zlib-compressed JobArchiveSegment.
+//
+// A segment is durable before its jobs are deleted from MongoDB. If ctld
+// stops in between, the jobs are archived again by the next pass and the
+// duplicated rows are skipped by Scan.
+class JobArchive {
+  using Mutex = absl::Mutex;
+  using LockGuard = absl::MutexLock;
+
+ public:
+  // Return false to stop the scan.
+  using Visitor = std::function<bool(const bsoncxx::document::view& job)>;
+
+  explicit JobArchive(std::filesystem::path dir);
+  ~JobArchive();
+
+  // Read the segment headers and start the aging thread.
+  bool Init();
+
+  // Whether the time range of the query reaches into the archive.
+  bool MayContain(const crane::grpc::QueryTasksInfoRequest& request) const;
+
+  // Visit the archived jobs matching the filters of the request, newest
+  // segments first.
+  void Scan(const crane::grpc::QueryTasksInfoRequest& request,
+            const Visitor& visitor) const;
+
+  // Write the jobs into new segments, one per month the jobs ended in.
+  bool WriteSegments(const std::vector<bsoncxx::document::value>& jobs);
+
+ private:
+  void AgingThread_();
+
+  std::filesystem::path m_dir_;
+
+  // Latest end time of the archived jobs. 0 if the archive is empty.
+  std::atomic_int64_t m_max_time_end_{0};
+
+  bool m_stop_ ABSL_GUARDED_BY(m_stop_mtx_){false};
+  Mutex m_stop_mtx_;
+  std::thread m_aging_thread_;
+};
+
+}  // namespace Ctld
+
+inline std::unique_ptr<Ctld::JobArchive> g_job_archive;
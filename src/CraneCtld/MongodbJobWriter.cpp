@@ -0,0 +1,169 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "MongodbJobWriter.h"
+
+#include "DbClient.h"
+#include "EmbeddedDbClient.h"
+#include "SchedulerStats.h"
+
+namespace Ctld {
+
+MongodbJobWriter::MongodbJobWriter() {
+  m_writer_thread_ = std::thread([this] { WriterThread_(); });
+}
+
+MongodbJobWriter::~MongodbJobWriter() {
+  {
+    LockGuard lock(&m_mtx_);
+    m_stop_ = true;
+  }
+  m_writer_thread_.join();
+}
+
+void MongodbJobWriter::InsertJobsAsync(const std::vector<TaskInCtld*>& tasks) {
+  if (tasks.empty()) return;
+
+  std::vector<QueuedJob> jobs;
+  jobs.reserve(tasks.size());
+  for (TaskInCtld* task : tasks)
+    jobs.emplace_back(task->TaskDbId(), g_db_client->JobDocumentOf(task));
+
+  LockGuard lock(&m_mtx_);
+  for (QueuedJob& job : jobs) {
+    if (m_queue_.size() < kMongoJobWriterQueueMaxSize)
+      m_queue_.emplace_back(std::move(job));
+    else
+      m_spilled_db_ids_.emplace_back(job.db_id);
+  }
+}
+
+void MongodbJobWriter::QueryStats(
+    crane::grpc::QuerySchedulerStatsReply::JobWriterStats* stats) const {
+  {
+    LockGuard lock(&m_mtx_);
+    stats->set_queued_job_count(m_queue_.size());
+    stats->set_spilled_job_count(m_spilled_db_ids_.size());
+  }
+  stats->set_written_job_count(
+      m_written_job_count_.load(std::memory_order_relaxed));
+  stats->set_failed_write_count(
+      m_failed_write_count_.load(std::memory_order_relaxed));
+}
+
+void MongodbJobWriter::WriterThread_() {
+  util::SetCurrentThreadName("MongoJobWriter");
+
+  auto has_job = [this] {
+    return !m_queue_.empty() || !m_spilled_db_ids_.empty() || m_stop_;
+  };
+  auto batch_full = [this] {
+    return m_queue_.size() + m_spilled_db_ids_.size() >=
+               kMongoJobWriteBatchNum ||
+           m_stop_;
+  };
+  auto stopped = [this] { return m_stop_; };
+
+  absl::Duration backoff = absl::Milliseconds(kMongoJobWriteMinBackoffMs);
+  std::vector<task_db_id_t> db_ids;
+  std::vector<task_db_id_t> spilled_db_ids;
+  std::vector<bsoncxx::document::value> documents;
+
+  while (true) {
+    {
+      LockGuard lock(&m_mtx_);
+      m_mtx_.Await(absl::Condition(&has_job));
+      m_mtx_.AwaitWithTimeout(absl::Condition(&batch_full),
+                              absl::Milliseconds(kMongoJobWriteWindowMs));
+
+      // The jobs not written yet are still in the embedded db.
+      if (m_stop_) break;
+
+      while (!m_queue_.empty() && db_ids.size() < kMongoJobWriteBatchNum) {
+        QueuedJob& job = m_queue_.front();
+        db_ids.emplace_back(job.db_id);
+        documents.emplace_back(std::move(job.document));
+        m_queue_.pop_front();
+      }
+
+      size_t spilled_num = std::min<size_t>(
+          m_spilled_db_ids_.size(), kMongoJobWriteBatchNum - db_ids.size());
+      spilled_db_ids.assign(m_spilled_db_ids_.end() - spilled_num,
+                            m_spilled_db_ids_.end());
+      m_spilled_db_ids_.resize(m_spilled_db_ids_.size() - spilled_num);
+    }
+
+    LoadSpilledJobs_(spilled_db_ids, &db_ids, &documents);
+    spilled_db_ids.clear();
+
+    bool ok;
+    {
+      SchedulerStats::ScopedTimer timer(g_scheduler_stats.get(),
+                                        SchedulerStats::Phase::MongoJobWrite);
+      ok = g_db_client->UpsertJobs(documents);
+    }
+    documents.clear();
+
+    if (ok) {
+      backoff = absl::Milliseconds(kMongoJobWriteMinBackoffMs);
+      m_written_job_count_.fetch_add(db_ids.size(), std::memory_order_relaxed);
+
+      if (!g_embedded_db_client->PurgeEndedTasks(db_ids))
+        CRANE_ERROR(
+            "Failed to purge {} written jobs from the embedded db. They will "
+            "be written again during the recovery of the next start.",
+            db_ids.size());
+      db_ids.clear();
+      continue;
+    }
+
+    m_failed_write_count_.fetch_add(1, std::memory_order_relaxed);
+    CRANE_ERROR("Failed to write {} jobs into MongoDB. Retry in {}.",
+                db_ids.size(), absl::FormatDuration(backoff));
+
+    LockGuard lock(&m_mtx_);
+    m_spilled_db_ids_.insert(m_spilled_db_ids_.end(), db_ids.begin(),
+                             db_ids.end());
+    db_ids.clear();
+
+    m_mtx_.AwaitWithTimeout(absl::Condition(&stopped), backoff);
+    backoff = std::min(backoff * 2,
+                       absl::Milliseconds(kMongoJobWriteMaxBackoffMs));
+  }
+}
+
+void MongodbJobWriter::LoadSpilledJobs_(
+    const std::vector<task_db_id_t>& spilled_db_ids,
+    std::vector<task_db_id_t>* db_ids,
+    std::vector<bsoncxx::document::value>* documents) {
+  for (task_db_id_t db_id : spilled_db_ids) {
+    crane::grpc::TaskInEmbeddedDb task_in_db;
+    if (!g_embedded_db_client->FetchTaskDataInDb(0, db_id, &task_in_db)) {
+      CRANE_ERROR(
+          "Failed to read spilled job of db id {} from the embedded db. It "
+          "will be written during the recovery of the next start.",
+          db_id);
+      continue;
+    }
+
+    db_ids->emplace_back(db_id);
+    documents->emplace_back(g_db_client->JobDocumentOf(task_in_db));
+  }
+}
+
+}  // namespace Ctld
@@ -0,0 +1,83 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "CtldPublicDefs.h"
+// Precompiled header comes first!
+
+#include <bsoncxx/document/value.hpp>
+
+#include "protos/Crane.pb.h"
+
+namespace Ctld {
+
+// Writes the finished jobs into MongoDB off the status change path.
+//
+// A job is handed over once its final state is durable in the embedded db.
+// The writer thread flushes the queued jobs in unordered bulk upserts every
+// kMongoJobWriteWindowMs or once kMongoJobWriteBatchNum jobs are queued,
+// and purges them from the embedded db after they are written.
+//
+// The queue holds the documents of at most kMongoJobWriterQueueMaxSize jobs.
+// Jobs beyond it and jobs of a failed write are spilled: only their db ids
+// are kept and their documents are rebuilt from the embedded db when they
+// are retried. A failed write is retried after an exponential backoff. Jobs
+// still queued on shutdown stay in the embedded db and are written during
+// the recovery of the next start.
+class MongodbJobWriter {
+  using Mutex = absl::Mutex;
+  using LockGuard = absl::MutexLock;
+
+ public:
+  MongodbJobWriter();
+  ~MongodbJobWriter();
+
+  void InsertJobsAsync(const std::vector<TaskInCtld*>& tasks);
+
+  void QueryStats(crane::grpc::QuerySchedulerStatsReply::JobWriterStats* stats)
+      const;
+
+ private:
+  struct QueuedJob {
+    task_db_id_t db_id;
+    bsoncxx::document::value document;
+  };
+
+  void WriterThread_();
+
+  // Rebuild the documents of the spilled jobs. A job that can't be read from
+  // the embedded db is left there for the recovery of the next start.
+  void LoadSpilledJobs_(const std::vector<task_db_id_t>& spilled_db_ids,
+                        std::vector<task_db_id_t>* db_ids,
+                        std::vector<bsoncxx::document::value>* documents);
+
+  std::deque<QueuedJob> m_queue_ ABSL_GUARDED_BY(m_mtx_);
+  std::vector<task_db_id_t> m_spilled_db_ids_ ABSL_GUARDED_BY(m_mtx_);
+  bool m_stop_ ABSL_GUARDED_BY(m_mtx_){false};
+  mutable Mutex m_mtx_;
+
+  std::atomic_uint64_t m_written_job_count_{0};
+  std::atomic_uint64_t m_failed_write_count_{0};
+
+  std::thread m_writer_thread_;
+};
+
+}  // namespace Ctld
+
+inline std::unique_ptr<Ctld::MongodbJobWriter> g_mongodb_job_writer;
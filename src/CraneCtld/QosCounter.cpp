@@ -0,0 +1,130 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "QosCounter.h"
+
+namespace Ctld {
+
+namespace {
+
+template <typename T>
+bool TryAddWithin(std::atomic<T>* counter, T delta, T limit) {
+  T value = counter->load(std::memory_order_relaxed);
+  do {
+    if (value + delta > limit) return false;
+  } while (!counter->compare_exchange_weak(value, value + delta,
+                                           std::memory_order_acq_rel,
+                                           std::memory_order_relaxed));
+  return true;
+}
+
+}  // namespace
+
+std::shared_ptr<const QosCounterHandle> QosCounterTree::Find(
+    const std::string& user, const std::string& account,
+    const std::string& qos) {
+  absl::ReaderMutexLock lock(&m_mtx_);
+  auto it = m_handles_.find(HandleKey{user, account, qos});
+  if (it == m_handles_.end()) return nullptr;
+  return it->second;
+}
+
+std::shared_ptr<const QosCounterHandle> QosCounterTree::Resolve(
+    const std::string& user, const std::string& account,
+    const std::string& qos, const std::vector<std::string>& ancestors) {
+  absl::MutexLock lock(&m_mtx_);
+
+  auto& handle = m_handles_[HandleKey{user, account, qos}];
+  if (handle) return handle;
+
+  auto new_handle = std::make_shared<QosCounterHandle>();
+
+  auto& user_counter = m_user_counters_[CounterKey{user, qos}];
+  if (!user_counter) user_counter = std::make_shared<QosCounter>();
+  new_handle->user_counter = user_counter;
+
+  new_handle->account_counters.reserve(ancestors.size() + 1);
+  auto add_account = [&](const std::string& name) {
+    auto& counter = m_account_counters_[CounterKey{name, qos}];
+    if (!counter) counter = std::make_shared<QosCounter>();
+    new_handle->account_counters.emplace_back(counter);
+  };
+  add_account(account);
+  for (const auto& ancestor : ancestors) add_account(ancestor);
+
+  handle = std::move(new_handle);
+  return handle;
+}
+
+void QosCounterTree::EraseUser(const std::string& user) {
+  absl::MutexLock lock(&m_mtx_);
+  absl::erase_if(m_handles_, [&](const auto& kv) {
+    return std::get<0>(kv.first) == user;
+  });
+  absl::erase_if(m_user_counters_,
+                 [&](const auto& kv) { return kv.first.first == user; });
+}
+
+CraneErrCode QosCounterTree::TryReserve(const QosCounterHandle& handle,
+                                        const QosLimits& limits, double cpus) {
+  QosCounter& user_counter = *handle.user_counter;
+  if (!TryAddWithin<uint32_t>(&user_counter.job_num, 1,
+                              limits.max_jobs_per_user))
+    return CraneErrCode::ERR_MAX_JOB_COUNT_PER_USER;
+
+  if (!TryAddWithin(&user_counter.cpu_count, cpus, limits.max_cpus_per_user)) {
+    user_counter.job_num.fetch_sub(1, std::memory_order_acq_rel);
+    return CraneErrCode::ERR_CPUS_PER_TASK_BEYOND;
+  }
+
+  for (size_t i = 0; i < handle.account_counters.size(); i++) {
+    if (TryAddWithin(&handle.account_counters[i]->cpu_count, cpus,
+                     limits.max_cpus_per_account)) {
+      handle.account_counters[i]->job_num.fetch_add(1,
+                                                    std::memory_order_acq_rel);
+      continue;
+    }
+
+    for (size_t j = 0; j < i; j++) {
+      handle.account_counters[j]->cpu_count.fetch_sub(
+          cpus, std::memory_order_acq_rel);
+      handle.account_counters[j]->job_num.fetch_sub(1,
+                                                    std::memory_order_acq_rel);
+    }
+    user_counter.cpu_count.fetch_sub(cpus, std::memory_order_acq_rel);
+    user_counter.job_num.fetch_sub(1, std::memory_order_acq_rel);
+    return CraneErrCode::ERR_CPUS_PER_ACCOUNT_BEYOND;
+  }
+
+  return CraneErrCode::SUCCESS;
+}
+
+void QosCounterTree::Release(const QosCounterHandle& handle, double cpus) {
+  for (const auto& counter : handle.account_counters) {
+    CRANE_ASSERT(counter->job_num.load(std::memory_order_relaxed) > 0);
+    counter->cpu_count.fetch_sub(cpus, std::memory_order_acq_rel);
+    counter->job_num.fetch_sub(1, std::memory_order_acq_rel);
+  }
+
+  CRANE_ASSERT(handle.user_counter->job_num.load(std::memory_order_relaxed) >
+               0);
+  handle.user_counter->cpu_count.fetch_sub(cpus, std::memory_order_acq_rel);
+  handle.user_counter->job_num.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+}  // namespace Ctld
@@ -0,0 +1,88 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "CtldPublicDefs.h"
+// Precompiled header comes first!
+
+namespace Ctld {
+
+// Jobs and cpus held under a QoS, either by a user or by all the users of an
+// account and its descendants.
+struct QosCounter {
+  std::atomic<uint32_t> job_num{0};
+  std::atomic<double> cpu_count{0};
+};
+
+struct QosLimits {
+  uint32_t max_jobs_per_user;
+  double max_cpus_per_user;
+  // Applied at every level of the account hierarchy.
+  double max_cpus_per_account;
+};
+
+// The counters charged by the tasks of a user in an account under a QoS. It's
+// immutable once resolved, so reserving and releasing take no lock.
+struct QosCounterHandle {
+  std::shared_ptr<QosCounter> user_counter;
+  // The counter of the account followed by the ones of its ancestors.
+  std::vector<std::shared_ptr<QosCounter>> account_counters;
+};
+
+// Resolves the handles of (user, account, qos) and keeps the counters shared
+// by them. Resolution hashes the names under a lock, so it is done once per
+// task and the handle is kept in the task. The check and reservation on a
+// handle are compare-and-add loops on the counters and roll back on failure.
+class QosCounterTree {
+ public:
+  // Return nullptr if the handle has not been resolved yet.
+  std::shared_ptr<const QosCounterHandle> Find(const std::string& user,
+                                               const std::string& account,
+                                               const std::string& qos);
+
+  // ancestors are the accounts above account, from the parent to the root.
+  std::shared_ptr<const QosCounterHandle> Resolve(
+      const std::string& user, const std::string& account,
+      const std::string& qos, const std::vector<std::string>& ancestors);
+
+  // Drop the handles and the counters of a user. Holders of the handles keep
+  // the counters alive until they release them.
+  void EraseUser(const std::string& user);
+
+  static CraneErrCode TryReserve(const QosCounterHandle& handle,
+                                 const QosLimits& limits, double cpus);
+
+  static void Release(const QosCounterHandle& handle, double cpus);
+
+ private:
+  using HandleKey = std::tuple<std::string /*user*/, std::string /*account*/,
+                               std::string /*qos*/>;
+  using CounterKey = std::pair<std::string /*user or account*/,
+                               std::string /*qos*/>;
+
+  absl::Mutex m_mtx_;
+  absl::flat_hash_map<HandleKey, std::shared_ptr<const QosCounterHandle>>
+      m_handles_ ABSL_GUARDED_BY(m_mtx_);
+  absl::flat_hash_map<CounterKey, std::shared_ptr<QosCounter>> m_user_counters_
+      ABSL_GUARDED_BY(m_mtx_);
+  absl::flat_hash_map<CounterKey, std::shared_ptr<QosCounter>>
+      m_account_counters_ ABSL_GUARDED_BY(m_mtx_);
+};
+
+}  // namespace Ctld
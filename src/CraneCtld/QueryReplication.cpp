@@ -0,0 +1,457 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "QueryReplication.h"
+
+#include <google/protobuf/util/message_differencer.h>
+
+#include "CranedMetaContainer.h"
+#include "TaskScheduler.h"
+#include "crane/GrpcHelper.h"
+
+namespace Ctld {
+
+using google::protobuf::util::MessageDifferencer;
+using google::protobuf::util::TimeUtil;
+
+QueryStateFeed::QueryStateFeed()
+    : m_epoch_(absl::ToUnixMicros(absl::Now())),
+      m_ring_(kQueryStateHistoryNum) {
+  // A replica connecting at once gets the state instead of an empty one.
+  Sync_();
+  m_sync_thread_ = std::thread([this] { SyncThread_(); });
+}
+
+QueryStateFeed::~QueryStateFeed() {
+  m_thread_stop_ = true;
+  if (m_sync_thread_.joinable()) m_sync_thread_.join();
+}
+
+void QueryStateFeed::SyncThread_() {
+  util::SetCurrentThreadName("QueryFeedThr");
+
+  while (!m_thread_stop_) {
+    std::this_thread::sleep_for(
+        std::chrono::milliseconds(g_config.QueryReplication.SyncIntervalMs));
+    Sync_();
+  }
+}
+
+void QueryStateFeed::Sync_() {
+  auto snapshot = g_task_scheduler->GetTaskInfoSnapshot();
+  crane::grpc::QueryCranedInfoReply craned_reply =
+      g_meta_container->QueryAllCranedInfo();
+  crane::grpc::QueryPartitionInfoReply partition_reply =
+      g_meta_container->QueryAllPartitionInfo();
+
+  auto update = std::make_shared<crane::grpc::QueryStateUpdate>();
+  update->set_epoch(m_epoch_);
+  *update->mutable_build_time() = TimeUtil::MillisecondsToTimestamp(
+      absl::ToUnixMillis(snapshot->build_time));
+
+  LockGuard lock_guard(&m_mtx_);
+
+  // A task may move from the pending list to the running one between two
+  // reads, so the removed tasks are found after both lists are visited.
+  absl::flat_hash_set<task_id_t> task_ids;
+  task_ids.reserve(snapshot->pending_tasks.size() +
+                   snapshot->running_tasks.size());
+  for (const auto* tasks : {&snapshot->pending_tasks, &snapshot->running_tasks})
+    for (const crane::grpc::TaskInfo* task : *tasks) {
+      task_ids.insert(task->task_id());
+      auto [it, inserted] = m_tasks_.try_emplace(task->task_id());
+      if (!inserted && MessageDifferencer::Equals(it->second, *task)) continue;
+      it->second = *task;
+      *update->add_upserted_tasks() = *task;
+    }
+  for (auto it = m_tasks_.begin(); it != m_tasks_.end();) {
+    if (task_ids.contains(it->first)) {
+      ++it;
+      continue;
+    }
+    update->add_removed_task_ids(it->first);
+    it = m_tasks_.erase(it);
+  }
+
+  absl::flat_hash_set<CranedId> craned_ids;
+  craned_ids.reserve(craned_reply.craned_info_list_size());
+  for (auto& craned : *craned_reply.mutable_craned_info_list()) {
+    craned_ids.insert(craned.hostname());
+    auto [it, inserted] = m_craneds_.try_emplace(craned.hostname());
+    if (!inserted && MessageDifferencer::Equals(it->second, craned)) continue;
+    it->second = craned;
+    *update->add_upserted_craneds() = std::move(craned);
+  }
+  for (auto it = m_craneds_.begin(); it != m_craneds_.end();) {
+    if (craned_ids.contains(it->first)) {
+      ++it;
+      continue;
+    }
+    update->add_removed_craned_ids(it->first);
+    it = m_craneds_.erase(it);
+  }
+
+  m_partitions_ = partition_reply.partition_info_list();
+  *update->mutable_partitions() = m_partitions_;
+  m_build_time_ = update->build_time();
+
+  uint64_t seq = ++m_last_seq_;
+  update->set_seq(seq);
+  m_ring_[(seq - 1) % kQueryStateHistoryNum] = std::move(update);
+  m_cv_.SignalAll();
+}
+
+QueryStateFeed::UpdatePtr QueryStateFeed::FullUpdate() {
+  auto update = std::make_shared<crane::grpc::QueryStateUpdate>();
+
+  absl::ReaderMutexLock lock_guard(&m_mtx_);
+  update->set_epoch(m_epoch_);
+  update->set_seq(m_last_seq_);
+  update->set_full(true);
+  *update->mutable_build_time() = m_build_time_;
+
+  update->mutable_upserted_tasks()->Reserve(m_tasks_.size());
+  for (const auto& task : m_tasks_ | std::views::values)
+    *update->add_upserted_tasks() = task;
+  update->mutable_upserted_craneds()->Reserve(m_craneds_.size());
+  for (const auto& craned : m_craneds_ | std::views::values)
+    *update->add_upserted_craneds() = craned;
+  *update->mutable_partitions() = m_partitions_;
+
+  return update;
+}
+
+std::expected<uint64_t, uint64_t> QueryStateFeed::WaitAndRead(
+    uint64_t after_seq, absl::Duration timeout,
+    std::vector<UpdatePtr>* updates) {
+  absl::Time deadline = absl::Now() + timeout;
+
+  LockGuard lock_guard(&m_mtx_);
+  while (m_last_seq_ <= after_seq) {
+    if (m_cv_.WaitWithDeadline(&m_mtx_, deadline)) return after_seq;
+  }
+
+  uint64_t oldest_seq = OldestSeqNoLock_();
+  if (after_seq + 1 < oldest_seq) return std::unexpected(oldest_seq);
+
+  for (uint64_t seq = after_seq + 1; seq <= m_last_seq_; seq++)
+    updates->emplace_back(m_ring_[(seq - 1) % kQueryStateHistoryNum]);
+  return m_last_seq_;
+}
+
+uint64_t QueryStateFeed::OldestSeqNoLock_() const {
+  if (m_last_seq_ < kQueryStateHistoryNum) return 1;
+  return m_last_seq_ - kQueryStateHistoryNum + 1;
+}
+
+QueryReplica::QueryReplica(const std::string& primary_hostname)
+    : m_primary_hostname_(primary_hostname) {
+  grpc::ChannelArguments channel_args;
+  SetGrpcClientKeepAliveChannelArgs(&channel_args);
+  // A full state holds every task in RAM.
+  channel_args.SetMaxReceiveMessageSize(-1);
+
+  if (g_config.CompressedRpc)
+    channel_args.SetCompressionAlgorithm(GRPC_COMPRESS_GZIP);
+
+  if (g_config.ListenConf.TlsConfig.Enabled)
+    m_channel_ = CreateTcpTlsCustomChannelByHostname(
+        primary_hostname, g_config.ListenConf.CraneCtldForInternalListenPort,
+        g_config.ListenConf.TlsConfig.InternalCerts,
+        g_config.ListenConf.TlsConfig.DomainSuffix, channel_args);
+  else
+    m_channel_ = CreateTcpInsecureCustomChannel(
+        primary_hostname, g_config.ListenConf.CraneCtldForInternalListenPort,
+        channel_args);
+
+  m_stub_ = crane::grpc::CraneCtldForInternal::NewStub(m_channel_);
+
+  m_metric_callback_ids_.emplace_back(
+      util::metrics::DefaultRegistry().AddGaugeCallback(
+          "crane_ctld_replica_lag_seconds",
+          "Time since the primary read the query state served by the "
+          "replica.",
+          {}, [this] { return absl::ToDoubleSeconds(Lag()); }));
+
+  m_replicate_thread_ = std::thread([this] { ReplicateThread_(); });
+}
+
+QueryReplica::~QueryReplica() {
+  for (auto id : m_metric_callback_ids_)
+    util::metrics::DefaultRegistry().RemoveCallback(id);
+
+  {
+    LockGuard lock_guard(&m_mtx_);
+    m_stop_ = true;
+    if (m_context_) m_context_->TryCancel();
+    m_cv_.Signal();
+  }
+  if (m_replicate_thread_.joinable()) m_replicate_thread_.join();
+}
+
+void QueryReplica::ReplicateThread_() {
+  util::SetCurrentThreadName("QueryReplicaThr");
+
+  int64_t retry_ms = kQueryReplicaMinRetryMs;
+  bool resync = true;
+  while (true) {
+    grpc::ClientContext context;
+    {
+      LockGuard lock_guard(&m_mtx_);
+      if (m_stop_) return;
+      m_context_ = &context;
+    }
+
+    crane::grpc::ReplicateQueryStateRequest request;
+    if (auto state = m_state_.load(std::memory_order_acquire);
+        state && !resync) {
+      request.set_epoch(state->epoch);
+      request.set_after_seq(state->seq);
+    }
+
+    auto reader = m_stub_->ReplicateQueryState(&context, request);
+    crane::grpc::QueryStateUpdate update;
+    resync = false;
+    while (reader->Read(&update)) {
+      if (!Apply_(update)) {
+        resync = true;
+        context.TryCancel();
+        break;
+      }
+      retry_ms = kQueryReplicaMinRetryMs;
+    }
+    grpc::Status status = reader->Finish();
+
+    LockGuard lock_guard(&m_mtx_);
+    m_context_ = nullptr;
+    if (m_stop_) return;
+    if (!resync)
+      CRANE_WARN(
+          "Replication from the primary ctld {} broke: {}. Reconnecting in "
+          "{} ms.",
+          m_primary_hostname_, status.error_message(), retry_ms);
+    m_cv_.WaitWithTimeout(&m_mtx_, absl::Milliseconds(retry_ms));
+    retry_ms = std::min(retry_ms * 2, kQueryReplicaMaxRetryMs);
+  }
+}
+
+bool QueryReplica::Apply_(const crane::grpc::QueryStateUpdate& update) {
+  auto last_state = m_state_.load(std::memory_order_acquire);
+  if (!update.full() &&
+      (!last_state || update.epoch() != last_state->epoch ||
+       update.seq() != last_state->seq + 1)) {
+    CRANE_WARN("Query state update #{} doesn't follow the state applied. "
+               "Fetching the full state again.",
+               update.seq());
+    return false;
+  }
+
+  if (update.full()) {
+    m_tasks_.clear();
+    m_craneds_.clear();
+  }
+
+  auto state = std::make_shared<State>();
+  state->epoch = update.epoch();
+  state->seq = update.seq();
+  state->build_time = absl::FromUnixMillis(
+      TimeUtil::TimestampToMilliseconds(update.build_time()));
+
+  if (update.full() || !update.upserted_tasks().empty() ||
+      !update.removed_task_ids().empty()) {
+    for (const auto& task : update.upserted_tasks())
+      m_tasks_[task.task_id()] =
+          std::make_shared<const crane::grpc::TaskInfo>(task);
+    for (task_id_t task_id : update.removed_task_ids()) m_tasks_.erase(task_id);
+
+    auto task_view = std::make_shared<TaskView>();
+    task_view->tasks.reserve(m_tasks_.size());
+    for (const auto& task : m_tasks_ | std::views::values) {
+      task_view->tasks.emplace_back(task);
+      if (task->status() == crane::grpc::Pending)
+        task_view->pending_tasks.emplace_back(task.get());
+      else
+        task_view->running_tasks.emplace_back(task.get());
+    }
+    state->task_view = std::move(task_view);
+  } else {
+    state->task_view = last_state->task_view;
+  }
+
+  for (const auto& craned : update.upserted_craneds())
+    m_craneds_[craned.hostname()] =
+        std::make_shared<const crane::grpc::CranedInfo>(craned);
+  for (const auto& craned_id : update.removed_craned_ids())
+    m_craneds_.erase(craned_id);
+
+  auto node_view = std::make_shared<NodeView>();
+  node_view->craneds.reserve(m_craneds_.size());
+  for (const auto& craned : m_craneds_ | std::views::values)
+    node_view->craneds.emplace_back(craned);
+  node_view->partitions.assign(update.partitions().begin(),
+                               update.partitions().end());
+  state->node_view = std::move(node_view);
+
+  m_state_.store(std::move(state), std::memory_order_release);
+
+  if (update.full()) {
+    CRANE_INFO(
+        "Applied the full query state #{} of the primary ctld {}: {} tasks "
+        "and {} craneds.",
+        update.seq(), m_primary_hostname_, m_tasks_.size(), m_craneds_.size());
+    // Queries are served once there is a state to answer them from.
+    g_runtime_status.srv_ready.store(true, std::memory_order_release);
+  }
+  return true;
+}
+
+absl::Duration QueryReplica::Lag() {
+  auto state = m_state_.load(std::memory_order_acquire);
+  if (!state) return absl::ZeroDuration();
+  return std::max(absl::Now() - state->build_time, absl::ZeroDuration());
+}
+
+void QueryReplica::QueryTasks(const crane::grpc::QueryTasksInfoRequest* request,
+                              crane::grpc::QueryTasksInfoReply* response) {
+  auto state = m_state_.load(std::memory_order_acquire);
+  if (!state) return;
+
+  TaskScheduler::QueryTaskInfoLists(state->task_view->pending_tasks,
+                                    state->task_view->running_tasks,
+                                    state->build_time, request, response);
+}
+
+crane::grpc::QueryCranedInfoReply QueryReplica::QueryCranedInfo(
+    const CranedId& craned_id) {
+  crane::grpc::QueryCranedInfoReply reply;
+  auto state = m_state_.load(std::memory_order_acquire);
+  if (!state) return reply;
+
+  const auto& craneds = state->node_view->craneds;
+  if (craned_id.empty()) {
+    reply.mutable_craned_info_list()->Reserve(craneds.size());
+    for (const auto& craned : craneds) *reply.add_craned_info_list() = *craned;
+    return reply;
+  }
+
+  auto it = std::ranges::lower_bound(
+      craneds, craned_id, {},
+      [](const auto& craned) -> const std::string& {
+        return craned->hostname();
+      });
+  if (it != craneds.end() && (*it)->hostname() == craned_id)
+    *reply.add_craned_info_list() = **it;
+  return reply;
+}
+
+crane::grpc::QueryPartitionInfoReply QueryReplica::QueryPartitionInfo(
+    const PartitionId& partition_id) {
+  crane::grpc::QueryPartitionInfoReply reply;
+  auto state = m_state_.load(std::memory_order_acquire);
+  if (!state) return reply;
+
+  for (const auto& partition : state->node_view->partitions)
+    if (partition_id.empty() || partition.name() == partition_id)
+      *reply.add_partition_info_list() = partition;
+  return reply;
+}
+
+crane::grpc::QueryClusterInfoReply QueryReplica::QueryClusterInfo(
+    const crane::grpc::QueryClusterInfoRequest& request) {
+  crane::grpc::QueryClusterInfoReply reply;
+  reply.set_ok(true);
+
+  auto state = m_state_.load(std::memory_order_acquire);
+  if (!state) return reply;
+
+  // Same filters as CranedMetaContainer::QueryClusterInfo.
+  if (request.filter_craned_control_states().empty() ||
+      request.filter_craned_resource_states().empty() ||
+      request.filter_craned_power_states().empty())
+    return reply;
+
+  std::unordered_set<std::string> req_partitions(
+      request.filter_partitions().begin(), request.filter_partitions().end());
+
+  util::HostList req_nodes;
+  util::HostList::Parse(absl::StrJoin(request.filter_nodes(), ","), &req_nodes);
+
+  constexpr int control_state_num = crane::grpc::CranedControlState_ARRAYSIZE;
+  constexpr int resource_state_num =
+      crane::grpc::CranedResourceState_ARRAYSIZE;
+  constexpr int power_state_num = crane::grpc::CranedPowerState_ARRAYSIZE;
+
+  std::array<bool, control_state_num> control_filters{};
+  for (const auto& it : request.filter_craned_control_states())
+    control_filters[it] = true;
+  std::array<bool, resource_state_num> resource_filters{};
+  for (const auto& it : request.filter_craned_resource_states())
+    resource_filters[it] = true;
+  std::array<bool, power_state_num> power_filters{};
+  for (const auto& it : request.filter_craned_power_states())
+    power_filters[it] = true;
+
+  for (const auto& partition : state->node_view->partitions) {
+    if (!req_partitions.empty() && !req_partitions.contains(partition.name()))
+      continue;
+
+    auto* part_info = reply.add_partitions();
+    part_info->set_name(partition.name() == g_config.DefaultPartition
+                            ? partition.name() + "*"
+                            : partition.name());
+    part_info->set_state(partition.alive_nodes() > 0
+                             ? crane::grpc::PartitionState::PARTITION_UP
+                             : crane::grpc::PartitionState::PARTITION_DOWN);
+
+    std::list<std::string> craned_name_lists[control_state_num]
+                                            [resource_state_num]
+                                            [power_state_num];
+    for (const auto& craned : state->node_view->craneds) {
+      if (std::ranges::find(craned->partition_names(), partition.name()) ==
+          craned->partition_names().end())
+        continue;
+      if (!request.filter_nodes().empty() &&
+          !req_nodes.Contains(craned->hostname()))
+        continue;
+      if (control_filters[craned->control_state()] &&
+          resource_filters[craned->resource_state()] &&
+          power_filters[craned->power_state()])
+        craned_name_lists[craned->control_state()][craned->resource_state()]
+                         [craned->power_state()]
+                             .emplace_back(craned->hostname());
+    }
+
+    for (int i = 0; i < control_state_num; i++)
+      for (int j = 0; j < resource_state_num; j++)
+        for (int k = 0; k < power_state_num; k++) {
+          const auto& craned_names = craned_name_lists[i][j][k];
+          if (craned_names.empty()) continue;
+          auto* craned_list = part_info->add_craned_lists();
+          craned_list->set_control_state(crane::grpc::CranedControlState(i));
+          craned_list->set_resource_state(crane::grpc::CranedResourceState(j));
+          craned_list->set_power_state(crane::grpc::CranedPowerState(k));
+          craned_list->set_count(craned_names.size());
+          craned_list->set_craned_list_regex(
+              util::HostNameListToStr(craned_names));
+        }
+  }
+
+  return reply;
+}
+
+}  // namespace Ctld
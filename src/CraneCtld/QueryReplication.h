@@ -0,0 +1,179 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "CtldPublicDefs.h"
+// Precompiled header comes first!
+
+#include "protos/Crane.grpc.pb.h"
+#include "protos/Crane.pb.h"
+
+namespace Ctld {
+
+// Publishes the query state of the primary ctld to the read replicas. Every
+// SyncIntervalMs the tasks in RAM, the craneds and the partitions are read
+// and compared with the last read, and the changes become the update of the
+// next seq. The latest updates are kept in a ring, so a replica resumes from
+// the seq it has applied, or is sent the full state if it fell behind.
+class QueryStateFeed {
+  using Mutex = absl::Mutex;
+  using LockGuard = absl::MutexLock;
+
+ public:
+  using UpdatePtr = std::shared_ptr<const crane::grpc::QueryStateUpdate>;
+
+  // Must be created after the task scheduler has recovered the tasks.
+  QueryStateFeed();
+
+  ~QueryStateFeed();
+
+  // Identifies this run of ctld. The seqs of another run are meaningless.
+  uint64_t Epoch() const { return m_epoch_; }
+
+  // The whole state as of the last seq.
+  UpdatePtr FullUpdate();
+
+  // Appends the updates after after_seq to updates, waiting up to timeout for
+  // one if there is none yet. Returns the seq of the last update appended,
+  // or after_seq if there is none. Fails with the seq of the oldest update
+  // kept if some updates after after_seq are no longer kept.
+  std::expected<uint64_t, uint64_t> WaitAndRead(
+      uint64_t after_seq, absl::Duration timeout,
+      std::vector<UpdatePtr>* updates);
+
+ private:
+  void SyncThread_();
+
+  // Reads the state and publishes the changes since the last read.
+  void Sync_();
+
+  uint64_t OldestSeqNoLock_() const ABSL_SHARED_LOCKS_REQUIRED(m_mtx_);
+
+  const uint64_t m_epoch_;
+
+  Mutex m_mtx_;
+  absl::CondVar m_cv_;
+  // The update of seq s is at (s - 1) % kQueryStateHistoryNum.
+  std::vector<UpdatePtr> m_ring_ ABSL_GUARDED_BY(m_mtx_);
+  uint64_t m_last_seq_ ABSL_GUARDED_BY(m_mtx_){0};
+
+  // The state the last update leads to.
+  google::protobuf::Timestamp m_build_time_ ABSL_GUARDED_BY(m_mtx_);
+  absl::btree_map<task_id_t, crane::grpc::TaskInfo> m_tasks_
+      ABSL_GUARDED_BY(m_mtx_);
+  absl::btree_map<CranedId, crane::grpc::CranedInfo> m_craneds_
+      ABSL_GUARDED_BY(m_mtx_);
+  google::protobuf::RepeatedPtrField<crane::grpc::PartitionInfo> m_partitions_
+      ABSL_GUARDED_BY(m_mtx_);
+
+  std::atomic_bool m_thread_stop_{false};
+  std::thread m_sync_thread_;
+};
+
+// Follows the query state of the primary ctld and answers the task, node and
+// partition queries from it, so that they don't contend with scheduling on
+// the primary. The state lags the primary by about its sync interval, which
+// the task queries report as the snapshot age.
+class QueryReplica {
+  using Mutex = absl::Mutex;
+  using LockGuard = absl::MutexLock;
+
+ public:
+  explicit QueryReplica(const std::string& primary_hostname);
+
+  ~QueryReplica();
+
+  // Whether a full state of the primary has been applied.
+  bool Ready() const {
+    return m_state_.load(std::memory_order_acquire) != nullptr;
+  }
+
+  void QueryTasks(const crane::grpc::QueryTasksInfoRequest* request,
+                  crane::grpc::QueryTasksInfoReply* response);
+
+  // All the craneds if craned_id is empty.
+  crane::grpc::QueryCranedInfoReply QueryCranedInfo(const CranedId& craned_id);
+
+  // All the partitions if partition_id is empty.
+  crane::grpc::QueryPartitionInfoReply QueryPartitionInfo(
+      const PartitionId& partition_id);
+
+  crane::grpc::QueryClusterInfoReply QueryClusterInfo(
+      const crane::grpc::QueryClusterInfoRequest& request);
+
+  // Time since the primary read the state applied last.
+  absl::Duration Lag();
+
+ private:
+  struct TaskView {
+    // Keeps the tasks below alive.
+    std::vector<std::shared_ptr<const crane::grpc::TaskInfo>> tasks;
+    // Each in ascending order of task id.
+    std::vector<const crane::grpc::TaskInfo*> pending_tasks;
+    std::vector<const crane::grpc::TaskInfo*> running_tasks;
+  };
+
+  struct NodeView {
+    // In ascending order of hostname.
+    std::vector<std::shared_ptr<const crane::grpc::CranedInfo>> craneds;
+    std::vector<crane::grpc::PartitionInfo> partitions;
+  };
+
+  // Published for the queries after each update is applied. Views without
+  // changes are shared with the previous state.
+  struct State {
+    uint64_t epoch;
+    uint64_t seq;
+    absl::Time build_time;
+    std::shared_ptr<const TaskView> task_view;
+    std::shared_ptr<const NodeView> node_view;
+  };
+
+  void ReplicateThread_();
+
+  // Returns false if the update doesn't follow the state applied, in which
+  // case the full state must be fetched again.
+  bool Apply_(const crane::grpc::QueryStateUpdate& update);
+
+  const std::string m_primary_hostname_;
+  std::shared_ptr<grpc::Channel> m_channel_;
+  std::unique_ptr<crane::grpc::CraneCtldForInternal::Stub> m_stub_;
+
+  // Only used by the replicate thread.
+  absl::btree_map<task_id_t, std::shared_ptr<const crane::grpc::TaskInfo>>
+      m_tasks_;
+  absl::btree_map<CranedId, std::shared_ptr<const crane::grpc::CranedInfo>>
+      m_craneds_;
+
+  std::atomic<std::shared_ptr<const State>> m_state_;
+
+  Mutex m_mtx_;
+  absl::CondVar m_cv_;
+  bool m_stop_ ABSL_GUARDED_BY(m_mtx_){false};
+  // The context of the stream in progress, cancelled on stop.
+  grpc::ClientContext* m_context_ ABSL_GUARDED_BY(m_mtx_){nullptr};
+  std::thread m_replicate_thread_;
+
+  std::vector<util::metrics::Registry::CallbackId> m_metric_callback_ids_;
+};
+
+}  // namespace Ctld
+
+inline std::unique_ptr<Ctld::QueryStateFeed> g_query_state_feed;
+inline std::unique_ptr<Ctld::QueryReplica> g_query_replica;
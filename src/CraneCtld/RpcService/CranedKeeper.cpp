@@ -68,7 +68,8 @@ void CranedStub::ConfigureCraned(const CranedId &craned_id,
 }
 
 CraneExpected<std::vector<task_id_t>> CranedStub::ExecuteSteps(
-    const crane::grpc::ExecuteStepsRequest &request) {
+    const crane::grpc::ExecuteStepsRequest &request,
+    std::vector<task_id_t> *missed_task_ids) {
   using crane::grpc::ExecuteStepsReply;
   using crane::grpc::ExecuteStepsRequest;
 
@@ -92,6 +93,12 @@ CraneExpected<std::vector<task_id_t>> CranedStub::ExecuteSteps(
 
   failed_task_ids.assign(reply.failed_task_id_list().begin(),
                          reply.failed_task_id_list().end());
+  const auto &missed = reply.payload_missed_task_id_list();
+  if (missed_task_ids != nullptr)
+    missed_task_ids->assign(missed.begin(), missed.end());
+  else
+    failed_task_ids.insert(failed_task_ids.end(), missed.begin(),
+                           missed.end());
   return failed_task_ids;
 }
 
@@ -182,6 +189,28 @@ CraneErrCode CranedStub::CreateCgroupForJobs(
   return CraneErrCode::SUCCESS;
 }
 
+CraneExpected<crane::grpc::LaunchTreeReply> CranedStub::LaunchTree(
+    const crane::grpc::LaunchTreeRequest &request, uint32_t depth) {
+  crane::grpc::LaunchTreeReply reply;
+
+  ClientContext context;
+  context.set_deadline(
+      std::chrono::system_clock::now() +
+      std::chrono::seconds(kCtldRpcTimeoutSeconds) +
+      std::chrono::milliseconds(kLaunchTreeLevelTimeoutMs * depth));
+
+  Status status = m_stub_->LaunchTree(&context, request, &reply);
+  if (!status.ok()) {
+    CRANE_DEBUG("LaunchTree RPC for Node {} returned with status not ok: {}",
+                m_craned_id_, status.error_message());
+    HandleGrpcErrorCode_(status.error_code());
+    return std::unexpected{CraneErrCode::ERR_RPC_FAILURE};
+  }
+  UpdateLastActiveTime();
+
+  return reply;
+}
+
 CraneErrCode CranedStub::FreeSteps(const std::vector<task_id_t> &jobs) {
   using crane::grpc::FreeStepsReply;
   using crane::grpc::FreeStepsRequest;
@@ -275,71 +304,22 @@ void CranedStub::HandleGrpcErrorCode_(grpc::StatusCode code) {
   }
 }
 
-crane::grpc::ExecuteStepsRequest CranedStub::NewExecuteTasksRequests(
-    const CranedId &craned_id, const std::vector<TaskInCtld *> &tasks) {
-  crane::grpc::ExecuteStepsRequest request;
-
-  for (TaskInCtld *task : tasks) {
-    auto *mutable_task = request.add_tasks();
-
-    // Set time_limit
-    mutable_task->mutable_time_limit()->CopyFrom(
-        google::protobuf::util::TimeUtil::MillisecondsToDuration(
-            ToInt64Milliseconds(task->time_limit)));
-
-    // Set resources
-    auto *mutable_res_in_node = mutable_task->mutable_resources();
-    *mutable_res_in_node = static_cast<crane::grpc::ResourceInNode>(
-        task->AllocatedRes().at(craned_id));
-
-    // Set type
-    mutable_task->set_type(task->type);
-    mutable_task->set_task_id(task->TaskId());
-    mutable_task->set_name(task->name);
-    mutable_task->set_account(task->account);
-    mutable_task->set_qos(task->qos);
-    mutable_task->set_partition(task->partition_id);
-
-    for (auto &&node : task->included_nodes) {
-      mutable_task->mutable_nodelist()->Add()->assign(node);
-    }
-
-    for (auto &&node : task->excluded_nodes) {
-      mutable_task->mutable_excludes()->Add()->assign(node);
-    }
-
-    mutable_task->set_node_num(task->node_num);
-    mutable_task->set_ntasks_per_node(task->ntasks_per_node);
-    mutable_task->set_cpus_per_task(static_cast<double>(task->cpus_per_task));
-
-    mutable_task->set_uid(task->uid);
-    mutable_task->set_gid(task->gid);
-    mutable_task->mutable_env()->insert(task->env.begin(), task->env.end());
-
-    mutable_task->set_cwd(task->cwd);
-    mutable_task->set_get_user_env(task->get_user_env);
-
-    for (const auto &hostname : task->CranedIds())
-      mutable_task->mutable_allocated_nodes()->Add()->assign(hostname);
-
-    mutable_task->mutable_start_time()->set_seconds(
-        task->StartTimeInUnixSecond());
-    mutable_task->mutable_time_limit()->set_seconds(
-        ToInt64Seconds(task->time_limit));
-
-    if (task->type == crane::grpc::Batch) {
-      auto *mutable_meta = mutable_task->mutable_batch_meta();
-      mutable_meta->CopyFrom(task->TaskToCtld().batch_meta());
-    } else {
-      auto *mutable_meta = mutable_task->mutable_interactive_meta();
-      mutable_meta->CopyFrom(task->TaskToCtld().interactive_meta());
-    }
-  }
-
+crane::grpc::ExecuteStepsRequest *CranedStub::NewExecuteTasksRequests(
+    const CranedId &craned_id, const std::vector<TaskInCtld *> &tasks,
+    google::protobuf::Arena *arena) {
+  auto *request = util::ArenaCreate<crane::grpc::ExecuteStepsRequest>(arena);
+  request->mutable_tasks()->Reserve(tasks.size());
+  for (TaskInCtld *task : tasks)
+    task->SetFieldsOfTaskToD(craned_id, request->add_tasks());
   return request;
 }
 
-CranedKeeper::CranedKeeper(uint32_t node_num) : m_cq_closed_(false) {
+CranedKeeper::CranedKeeper(uint32_t node_num)
+    : m_connect_scheduler_(g_config.CtldConf.CranedConnectWindow,
+                           g_config.CtldConf.CranedConnectMinBackoffMs,
+                           g_config.CtldConf.CranedConnectMaxBackoffMs,
+                           std::random_device{}()),
+      m_cq_closed_(false) {
   m_pmr_pool_res_ = std::make_unique<std::pmr::synchronized_pool_resource>();
   m_tag_sync_allocator_ =
       std::make_unique<std::pmr::polymorphic_allocator<CqTag>>(
@@ -385,9 +365,34 @@ CranedKeeper::CranedKeeper(uint32_t node_num) : m_cq_closed_(false) {
   });
   g_runtime_status.connection_logger = AddLogger(
       "connection", StrToLogLevel(g_config.CraneCtldDebugLevel).value(), true);
+
+  auto &registry = util::metrics::DefaultRegistry();
+  m_connect_fail_counter_ = registry.GetCounter(
+      "crane_ctld_craned_connect_failures_total",
+      "Number of failed attempts to connect to craned nodes.");
+
+  constexpr const char *kConnHelp = "Number of craned nodes in a state.";
+  m_metric_callback_ids_.emplace_back(registry.AddGaugeCallback(
+      "crane_ctld_craned_connections", kConnHelp, {{"state", "connected"}},
+      [this] {
+        absl::ReaderMutexLock lk(&m_connected_craned_mtx_);
+        return m_connected_craned_id_stub_map_.size();
+      }));
+  m_metric_callback_ids_.emplace_back(registry.AddGaugeCallback(
+      "crane_ctld_craned_connections", kConnHelp, {{"state", "unavailable"}},
+      [this] {
+        util::lock_guard guard(m_unavail_craned_set_mtx_);
+        return m_unavail_craned_set_.size();
+      }));
+  m_metric_callback_ids_.emplace_back(registry.AddGaugeCallback(
+      "crane_ctld_craned_channels", "Number of open channels to craned nodes.",
+      {}, [this] { return m_channel_count_.load(); }));
 }
 
 CranedKeeper::~CranedKeeper() {
+  for (auto id : m_metric_callback_ids_)
+    util::metrics::DefaultRegistry().RemoveCallback(id);
+
   Shutdown();
 
   for (auto &cq_thread : m_cq_thread_vec_) cq_thread.join();
@@ -555,7 +560,7 @@ CranedKeeper::CqTag *CranedKeeper::InitCranedStateMachine_(
       util::lock_guard guard(m_unavail_craned_set_mtx_);
       token = m_unavail_craned_set_.at(craned->m_craned_id_);
       m_unavail_craned_set_.erase(craned->m_craned_id_);
-      m_connecting_craned_set_.erase(craned->m_craned_id_);
+      m_connect_scheduler_.Remove(craned->m_craned_id_);
     }
 
     if (m_craned_connected_cb_)
@@ -729,6 +734,68 @@ void CranedKeeper::PutNodeIntoUnavailSet(const std::string &crane_id,
 
   util::lock_guard guard(m_unavail_craned_set_mtx_);
   m_unavail_craned_set_.emplace(crane_id, token);
+  m_connect_scheduler_.Add(crane_id);
+}
+
+std::vector<CraneErrCode> CranedKeeper::Broadcast(
+    std::vector<CranedId> craned_ids, BroadcastFunc func,
+    uint32_t max_in_flight, absl::Duration timeout) {
+  // Shared with the helper threads, which may start after the broadcast has
+  // returned and then find no craned left.
+  struct BroadcastState {
+    std::vector<CranedId> craned_ids;
+    BroadcastFunc func;
+    absl::Time deadline;
+    std::atomic_size_t next_index{0};
+
+    std::vector<CraneErrCode> results;
+    Mutex mtx;
+    size_t done_num ABSL_GUARDED_BY(mtx){0};
+  };
+
+  size_t craned_num = craned_ids.size();
+  if (craned_num == 0) return {};
+
+  auto state = std::make_shared<BroadcastState>();
+  state->craned_ids = std::move(craned_ids);
+  state->func = std::move(func);
+  state->deadline = absl::Now() + timeout;
+  state->results.resize(craned_num, CraneErrCode::SUCCESS);
+
+  auto worker = [this](BroadcastState *state) {
+    size_t num = state->craned_ids.size();
+    for (size_t i = state->next_index.fetch_add(1); i < num;
+         i = state->next_index.fetch_add(1)) {
+      const CranedId &craned_id = state->craned_ids[i];
+
+      CraneErrCode err;
+      if (absl::Now() > state->deadline) {
+        err = CraneErrCode::ERR_CONNECTION_TIMEOUT;
+      } else {
+        auto stub = GetCranedStub(craned_id);
+        if (stub == nullptr || stub->Invalid())
+          err = CraneErrCode::ERR_INVALID_STUB;
+        else
+          err = state->func(craned_id, stub.get());
+      }
+
+      // Published to the waiting thread by the mutex.
+      state->results[i] = err;
+      LockGuard guard(&state->mtx);
+      state->done_num++;
+    }
+  };
+
+  size_t helper_num = std::min<size_t>(max_in_flight, craned_num) - 1;
+  for (size_t i = 0; i < helper_num; i++)
+    g_thread_pool->detach_task([state, worker] { worker(state.get()); });
+  worker(state.get());
+
+  auto all_done = [&] { return state->done_num == craned_num; };
+
+  LockGuard guard(&state->mtx);
+  state->mtx.Await(absl::Condition(&all_done));
+  return std::move(state->results);
 }
 
 void CranedKeeper::ConnectCranedNode_(CranedId const &craned_id) {
@@ -819,12 +886,21 @@ void CranedKeeper::ConnectCranedNode_(CranedId const &craned_id) {
       &m_cq_vec_[thread_id], tag);
 }
 
+int64_t CranedKeeper::SteadyNowMs_() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
 void CranedKeeper::CranedChannelConnectFail_(CranedStub *stub) {
   CranedKeeper *craned_keeper = stub->m_craned_keeper_;
 
+  craned_keeper->m_connect_fail_counter_->Inc();
+
   util::lock_guard guard(craned_keeper->m_unavail_craned_set_mtx_);
   craned_keeper->m_channel_count_.fetch_sub(1);
-  craned_keeper->m_connecting_craned_set_.erase(stub->m_craned_id_);
+  craned_keeper->m_connect_scheduler_.OnConnectFailed(stub->m_craned_id_,
+                                                      SteadyNowMs_());
 }
 
 void CranedKeeper::PeriodConnectCranedThreadFunc_() {
@@ -833,28 +909,26 @@ void CranedKeeper::PeriodConnectCranedThreadFunc_() {
   while (true) {
     if (m_cq_closed_) break;
 
-    // Use a window to limit the maximum number of connecting craned nodes.
+    // The scheduler limits the number of connecting craned nodes by a window
+    // and delays the retries of those failing to connect.
+    std::vector<CranedId> craned_ids;
     {
       absl::ReaderMutexLock connected_reader_lock(&m_connected_craned_mtx_);
       util::lock_guard guard(m_unavail_craned_set_mtx_);
 
-      uint32_t fetch_num =
-          kConcurrentStreamQuota - m_connecting_craned_set_.size();
-
-      auto it = m_unavail_craned_set_.begin();
-      while (it != m_unavail_craned_set_.end() && fetch_num > 0) {
-        if (!m_connecting_craned_set_.contains(it->first) &&
-            !m_connected_craned_id_stub_map_.contains(it->first)) {
-          m_connecting_craned_set_.emplace(*it);
-          g_thread_pool->detach_task([this, craned_id = it->first]() {
-            ConnectCranedNode_(craned_id);
-          });
-          fetch_num--;
-        }
-        ++it;
-      }
+      m_connect_scheduler_.Pick(
+          SteadyNowMs_(),
+          [this](const CranedId &craned_id) {
+            return m_connected_craned_id_stub_map_.contains(craned_id);
+          },
+          &craned_ids);
     }
 
+    for (auto &craned_id : craned_ids)
+      g_thread_pool->detach_task([this, craned_id = std::move(craned_id)]() {
+        ConnectCranedNode_(craned_id);
+      });
+
     std::this_thread::sleep_for(std::chrono::milliseconds(300));
   }
 }
@@ -21,6 +21,7 @@
 #include "CtldPublicDefs.h"
 // Precompiled header comes first!
 
+#include "CranedConnectScheduler.h"
 #include "crane/Lock.h"
 #include "crane/Network.h"
 #include "protos/Crane.grpc.pb.h"
@@ -72,15 +73,26 @@ class CranedStub {
     m_token_.reset();
   }
 
-  static crane::grpc::ExecuteStepsRequest NewExecuteTasksRequests(
-      const CranedId &craned_id, const std::vector<TaskInCtld *> &tasks);
+  // The request is built on the arena. Without one it is on the heap and
+  // owned by the caller.
+  static crane::grpc::ExecuteStepsRequest *NewExecuteTasksRequests(
+      const CranedId &craned_id, const std::vector<TaskInCtld *> &tasks,
+      google::protobuf::Arena *arena);
 
+  // Returns the failed task ids. The tasks not started since their
+  // StepPayload was missed are put in missed_task_ids, or are failed too if
+  // it is null.
   CraneExpected<std::vector<task_id_t>> ExecuteSteps(
-      const crane::grpc::ExecuteStepsRequest &request);
+      const crane::grpc::ExecuteStepsRequest &request,
+      std::vector<task_id_t> *missed_task_ids = nullptr);
 
   CraneErrCode CreateCgroupForJobs(
       std::vector<crane::grpc::JobToD> const &jobs);
 
+  // depth is the number of levels below the root of the tree.
+  CraneExpected<crane::grpc::LaunchTreeReply> LaunchTree(
+      const crane::grpc::LaunchTreeRequest &request, uint32_t depth);
+
   CraneErrCode FreeSteps(const std::vector<task_id_t> &jobs);
 
   CraneErrCode ReleaseCgroupForJobs(
@@ -182,6 +194,23 @@ class CranedKeeper {
   void PutNodeIntoUnavailSet(const std::string &crane_id,
                              const RegToken &token);
 
+  using BroadcastFunc =
+      std::function<CraneErrCode(const CranedId &, CranedStub *)>;
+
+  /**
+   * Call func with the stub of each craned concurrently, with at most
+   * max_in_flight calls at a time. The calling thread makes calls too, so a
+   * broadcast makes progress even when the thread pool is busy.
+   * @return the result of each craned in the order of craned_ids:
+   * ERR_INVALID_STUB if the craned is not connected, ERR_CONNECTION_TIMEOUT
+   * if its call was not started within the timeout, and the result of func
+   * otherwise. A started call is only bounded by the deadline of its RPC.
+   */
+  std::vector<CraneErrCode> Broadcast(
+      std::vector<CranedId> craned_ids, BroadcastFunc func,
+      uint32_t max_in_flight = kCranedBroadcastMaxInFlight,
+      absl::Duration timeout = absl::Seconds(kCranedBroadcastTimeoutSeconds));
+
  private:
   struct CqTag {
     enum Type : uint8_t { kInitializingCraned, kEstablishedCraned };
@@ -189,6 +218,8 @@ class CranedKeeper {
     CranedStub *craned;
   };
 
+  static int64_t SteadyNowMs_();
+
   static void CranedChannelConnectFail_(CranedStub *stub);
 
   void ConnectCranedNode_(CranedId const &craned_id);
@@ -225,7 +256,8 @@ class CranedKeeper {
   Mutex m_unavail_craned_set_mtx_;
   std::unordered_map<CranedId, RegToken> m_unavail_craned_set_
       ABSL_GUARDED_BY(m_unavail_craned_set_mtx_);
-  std::unordered_map<CranedId, RegToken> m_connecting_craned_set_
+  // Decides which craned in m_unavail_craned_set_ to connect to and when.
+  CranedConnectScheduler m_connect_scheduler_
       ABSL_GUARDED_BY(m_unavail_craned_set_mtx_);
 
   std::vector<grpc::CompletionQueue> m_cq_vec_;
@@ -241,6 +273,9 @@ class CranedKeeper {
   std::shared_ptr<uvw::timer_handle> m_check_timeout_handle_;
 
   std::atomic_uint64_t m_channel_count_{0};
+
+  util::metrics::Counter *m_connect_fail_counter_;
+  std::vector<util::metrics::Registry::CallbackId> m_metric_callback_ids_;
 };
 
 }  // namespace Ctld
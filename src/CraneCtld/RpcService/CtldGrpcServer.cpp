@@ -23,13 +23,104 @@
 #include "CranedKeeper.h"
 #include "CranedMetaContainer.h"
 #include "CtldPublicDefs.h"
+#include "MongodbJobWriter.h"
+#include "QueryReplication.h"
+#include "SchedulerStats.h"
 #include "Security/VaultClient.h"
+#include "TaskEventHub.h"
 #include "TaskScheduler.h"
 #include "crane/PluginClient.h"
 #include "protos/PublicDefs.pb.h"
 
 namespace Ctld {
 
+void CforedStreamWriter::Invalidate() {
+  auto flushed = [this] { return !m_flushing_; };
+
+  LockGuard guard(&m_queue_mtx_);
+  m_queue_mtx_.Await(absl::Condition(&flushed));
+  m_valid_ = false;
+}
+
+CforedStreamWriter::Stats CforedStreamWriter::GetStats() {
+  LockGuard guard(&m_queue_mtx_);
+  return {
+      .queued_reply_count = m_queued_replies_.size(),
+      .max_queued_reply_count = m_max_queued_reply_count_,
+      .written_message_count =
+          m_written_message_count_.load(std::memory_order_relaxed),
+      .written_reply_count =
+          m_written_reply_count_.load(std::memory_order_relaxed),
+  };
+}
+
+bool CforedStreamWriter::Enqueue_(StreamCtldReply &&reply) {
+  {
+    LockGuard guard(&m_queue_mtx_);
+    if (!m_valid_) return false;
+
+    m_queued_replies_.emplace_back(std::move(reply));
+    m_max_queued_reply_count_ =
+        std::max<uint64_t>(m_max_queued_reply_count_, m_queued_replies_.size());
+    if (m_flushing_) return true;
+    m_flushing_ = true;
+  }
+
+  return FlushQueue_();
+}
+
+bool CforedStreamWriter::FlushQueue_() {
+  std::vector<StreamCtldReply> replies;
+  bool ok = true;
+  while (true) {
+    {
+      LockGuard guard(&m_queue_mtx_);
+      if (!ok) {
+        m_valid_ = false;
+        m_queued_replies_.clear();
+      }
+      if (m_queued_replies_.empty()) {
+        m_flushing_ = false;
+        return ok;
+      }
+      replies.swap(m_queued_replies_);
+    }
+
+    ok = WriteReplies_(&replies);
+    replies.clear();
+  }
+}
+
+bool CforedStreamWriter::WriteReplies_(std::vector<StreamCtldReply> *replies) {
+  for (size_t begin = 0; begin < replies->size();) {
+    size_t num = 1;
+    if (m_batch_reply_supported_)
+      num = std::min<size_t>(replies->size() - begin,
+                             kCforedStreamMaxBatchReplyNum);
+
+    StreamCtldReply batch;
+    StreamCtldReply *message = &(*replies)[begin];
+    if (num > 1) {
+      batch.set_type(StreamCtldReply::BATCH);
+      auto *batch_replies = batch.mutable_payload_batch()->mutable_replies();
+      batch_replies->Reserve(num);
+      for (size_t i = begin; i < begin + num; i++)
+        *batch_replies->Add() = std::move((*replies)[i]);
+      message = &batch;
+    }
+
+    auto write_begin = std::chrono::steady_clock::now();
+    bool ok = m_stream_->Write(*message);
+    m_write_latency_.Record(std::chrono::steady_clock::now() - write_begin);
+    if (!ok) return false;
+
+    m_written_message_count_.fetch_add(1, std::memory_order_relaxed);
+    m_written_reply_count_.fetch_add(num, std::memory_order_relaxed);
+    begin += num;
+  }
+  return true;
+}
+
 grpc::Status CtldForInternalServiceImpl::StepStatusChange(
     grpc::ServerContext *context,
     const crane::grpc::StepStatusChangeRequest *request,
@@ -41,11 +132,40 @@ grpc::Status CtldForInternalServiceImpl::StepStatusChange(
   std::optional<std::string> reason;
   if (!request->reason().empty()) reason = request->reason();
 
+  // Accounted before the status change, which may end the job.
+  if (!request->job_usage().empty())
+    g_task_scheduler->AddJobUsageSamples(request->craned_id(),
+                                         request->job_usage());
+
   // TODO: Set reason here.
   g_task_scheduler->TaskStatusChangeAsync(
       request->task_id(), request->craned_id(), request->new_status(),
       request->exit_code());
   response->set_ok(true);
+  // Status changes are frequent on busy nodes, so they save the craned from
+  // sending separate pings.
+  response->set_craned_active(RefreshCranedActiveTime_(request->craned_id()));
+  return grpc::Status::OK;
+}
+
+grpc::Status CtldForInternalServiceImpl::StepStatusChangeBatch(
+    grpc::ServerContext *context,
+    const crane::grpc::StepStatusChangeBatchRequest *request,
+    crane::grpc::StepStatusChangeBatchReply *response) {
+  if (!g_runtime_status.srv_ready.load(std::memory_order_acquire))
+    return grpc::Status{grpc::StatusCode::UNAVAILABLE,
+                        "CraneCtld Server is not ready"};
+
+  const CranedId &craned_id = request->craned_id();
+  if (!request->job_usage().empty())
+    g_task_scheduler->AddJobUsageSamples(craned_id, request->job_usage());
+
+  for (const auto &change : request->changes())
+    g_task_scheduler->TaskStatusChangeAsync(change.task_id(), craned_id,
+                                            change.new_status(),
+                                            change.exit_code());
+  response->set_ok(true);
+  response->set_craned_active(RefreshCranedActiveTime_(craned_id));
   return grpc::Status::OK;
 }
 
@@ -142,6 +262,7 @@ grpc::Status CtldForInternalServiceImpl::CranedRegister(
 
   stub->SetReady();
   g_meta_container->CranedUp(request->craned_id(), request->remote_meta());
+  g_task_scheduler->TriggerSchedule();
   response->set_ok(true);
   return grpc::Status::OK;
 }
@@ -149,25 +270,32 @@ grpc::Status CtldForInternalServiceImpl::CranedRegister(
 grpc::Status CtldForInternalServiceImpl::CranedPing(
     grpc::ServerContext *context, const crane::grpc::CranedPingRequest *request,
     crane::grpc::CranedPingReply *response) {
-  if (!g_meta_container->CheckCranedOnline(request->craned_id())) {
-    CRANE_WARN("Reject ping from offline node {}", request->craned_id());
-    response->set_ok(false);
-    return grpc::Status::OK;
-  }
-
-  auto stub = g_craned_keeper->GetCranedStub(request->craned_id());
-  if (stub == nullptr) {
-    CRANE_WARN("Ping from Craned {}, which is not connected.",
+  if (!RefreshCranedActiveTime_(request->craned_id())) {
+    CRANE_WARN("Reject ping from node {}, which is offline or not connected.",
                request->craned_id());
     response->set_ok(false);
     return grpc::Status::OK;
   }
-  stub->UpdateLastActiveTime();
-  response->set_ok(true);
 
+  if (!request->job_usage().empty())
+    g_task_scheduler->AddJobUsageSamples(request->craned_id(),
+                                         request->job_usage());
+
+  response->set_ok(true);
   return grpc::Status::OK;
 }
 
+bool CtldForInternalServiceImpl::RefreshCranedActiveTime_(
+    const CranedId &craned_id) {
+  if (!g_meta_container->CheckCranedOnline(craned_id)) return false;
+
+  auto stub = g_craned_keeper->GetCranedStub(craned_id);
+  if (stub == nullptr) return false;
+
+  stub->UpdateLastActiveTime();
+  return true;
+}
+
 grpc::Status CtldForInternalServiceImpl::CforedStream(
     grpc::ServerContext *context,
     grpc::ServerReaderWriter<crane::grpc::StreamCtldReply,
@@ -212,6 +340,12 @@ grpc::Status CtldForInternalServiceImpl::CforedStream(
         cfored_name = cfored_request.payload_cfored_reg().cfored_name();
         CRANE_INFO("Cfored {} registered.", cfored_name);
 
+        stream_writer->SetBatchReplySupported(
+            cfored_request.payload_cfored_reg().batch_reply_supported());
+        m_ctld_server_->m_mtx_.Lock();
+        m_ctld_server_->m_cfored_stream_writers_[cfored_name] = stream_writer;
+        m_ctld_server_->m_mtx_.Unlock();
+
         ok = stream_writer->WriteCforedRegistrationAck({});
         if (ok) {
           state = StreamState::kWaitMsg;
@@ -353,6 +487,12 @@ grpc::Status CtldForInternalServiceImpl::CforedStream(
       std::vector<task_id_t> running_tasks(running_task_set.begin(),
                                            running_task_set.end());
       m_ctld_server_->m_cfored_running_tasks_.erase(cfored_name);
+      // A cfored reconnecting under the same name may have replaced it.
+      auto writer_iter =
+          m_ctld_server_->m_cfored_stream_writers_.find(cfored_name);
+      if (writer_iter != m_ctld_server_->m_cfored_stream_writers_.end() &&
+          writer_iter->second.lock() == stream_writer)
+        m_ctld_server_->m_cfored_stream_writers_.erase(writer_iter);
       m_ctld_server_->m_mtx_.Unlock();
 
       for (task_id_t task_id : running_tasks) {
@@ -365,6 +505,163 @@ grpc::Status CtldForInternalServiceImpl::CforedStream(
   }
 }
 
+grpc::Status CtldForInternalServiceImpl::ReplicateQueryState(
+    grpc::ServerContext *context,
+    const crane::grpc::ReplicateQueryStateRequest *request,
+    grpc::ServerWriter<crane::grpc::QueryStateUpdate> *writer) {
+  if (!g_runtime_status.srv_ready.load(std::memory_order_acquire))
+    return grpc::Status{grpc::StatusCode::UNAVAILABLE,
+                        "CraneCtld Server is not ready"};
+  if (!g_query_state_feed)
+    return {grpc::StatusCode::FAILED_PRECONDITION,
+            "Query replication is not enabled on this CraneCtld."};
+
+  // A replica resuming from another run of ctld or from an update no longer
+  // kept starts over from the full state.
+  bool send_full = request->epoch() != g_query_state_feed->Epoch();
+  uint64_t last_seq = request->after_seq();
+  std::vector<QueryStateFeed::UpdatePtr> updates;
+  while (!context->IsCancelled() &&
+         g_runtime_status.srv_ready.load(std::memory_order_acquire)) {
+    if (send_full) {
+      auto full_update = g_query_state_feed->FullUpdate();
+      if (!writer->Write(*full_update)) break;
+      last_seq = full_update->seq();
+      send_full = false;
+      continue;
+    }
+
+    updates.clear();
+    auto result =
+        g_query_state_feed->WaitAndRead(last_seq, absl::Seconds(1), &updates);
+    if (!result) {
+      CRANE_INFO("Replica {} fell behind seq {}. Sending the full state.",
+                 context->peer(), last_seq);
+      send_full = true;
+      continue;
+    }
+    last_seq = result.value();
+
+    for (const auto &update : updates)
+      if (!writer->Write(*update)) return grpc::Status::OK;
+  }
+
+  return grpc::Status::OK;
+}
+
+RpcUserRateLimiter::RpcUserRateLimiter(
+    std::string name, const Config::RpcRateLimitConfig &config)
+    : m_name_(std::move(name)),
+      m_rate_(config.Rate),
+      m_burst_(std::max(config.Burst, 1u)) {}
+
+grpc::Status RpcUserRateLimiter::Acquire(grpc::ServerContext *context,
+                                         std::optional<uint32_t> uid) {
+  if (m_rate_ == 0) return grpc::Status::OK;
+
+  std::string caller = CallerOf_(context, uid);
+  Shard &shard =
+      m_shards_[absl::Hash<std::string>{}(caller) % kRpcRateLimitShardNum];
+
+  Clock::time_point now = Clock::now();
+  int64_t now_sec = std::chrono::duration_cast<std::chrono::seconds>(
+                        now.time_since_epoch())
+                        .count();
+
+  double wait_sec;
+  {
+    absl::MutexLock lock(&shard.mtx);
+    if (shard.buckets.size() >= kRpcRateLimitShardMaxCallerNum)
+      PruneIdleBuckets_(&shard, now);
+
+    auto [iter, inserted] = shard.buckets.try_emplace(caller);
+    Bucket &bucket = iter->second;
+    if (inserted) {
+      bucket.tokens = m_burst_;
+      bucket.window_sec = now_sec;
+    } else {
+      double elapsed =
+          std::chrono::duration<double>(now - bucket.last_refill_time).count();
+      bucket.tokens = std::min(m_burst_, bucket.tokens + elapsed * m_rate_);
+    }
+    bucket.last_refill_time = now;
+
+    if (bucket.window_sec != now_sec) {
+      bucket.prev_window_count =
+          bucket.window_sec + 1 == now_sec ? bucket.window_count : 0;
+      bucket.window_sec = now_sec;
+      bucket.window_count = 0;
+    }
+    bucket.window_count++;
+
+    if (bucket.tokens >= 1) {
+      bucket.tokens -= 1;
+      bucket.admitted_count++;
+      return grpc::Status::OK;
+    }
+
+    bucket.limited_count++;
+    wait_sec = (1 - bucket.tokens) / m_rate_;
+  }
+
+  auto retry_after_ms = static_cast<int64_t>(std::ceil(wait_sec * 1000));
+  context->AddTrailingMetadata("retry-after-ms",
+                               std::to_string(retry_after_ms));
+  return {grpc::StatusCode::RESOURCE_EXHAUSTED,
+          fmt::format("Too many {} RPCs from {}. Please retry after {} ms.",
+                      m_name_, caller, retry_after_ms)};
+}
+
+std::vector<RpcUserRateLimiter::CallerStats>
+RpcUserRateLimiter::GetCallerStats() {
+  std::vector<CallerStats> stats;
+  if (m_rate_ == 0) return stats;
+
+  int64_t now_sec = std::chrono::duration_cast<std::chrono::seconds>(
+                        Clock::now().time_since_epoch())
+                        .count();
+  for (Shard &shard : m_shards_) {
+    absl::MutexLock lock(&shard.mtx);
+    for (const auto &[caller, bucket] : shard.buckets)
+      stats.emplace_back(CallerStats{
+          .caller = caller,
+          .request_rate = RequestRateOf_(bucket, now_sec),
+          .admitted_count = bucket.admitted_count,
+          .limited_count = bucket.limited_count,
+      });
+  }
+  return stats;
+}
+
+std::string RpcUserRateLimiter::CallerOf_(const grpc::ServerContext *context,
+                                          std::optional<uint32_t> uid) {
+  if (uid) return fmt::format("uid:{}", uid.value());
+
+  // Drop the port, which differs between the connections of one client.
+  std::string peer = context->peer();
+  if (peer.starts_with("ipv4:") || peer.starts_with("ipv6:"))
+    peer.resize(peer.rfind(':'));
+  return "peer:" + peer;
+}
+
+uint64_t RpcUserRateLimiter::RequestRateOf_(const Bucket &bucket,
+                                            int64_t now_sec) {
+  if (bucket.window_sec == now_sec) return bucket.prev_window_count;
+  if (bucket.window_sec + 1 == now_sec) return bucket.window_count;
+  return 0;
+}
+
+void RpcUserRateLimiter::PruneIdleBuckets_(Shard *shard,
+                                           Clock::time_point now) {
+  // A bucket full again behaves as a new one, so only its counters are lost.
+  absl::erase_if(shard->buckets, [&](const auto &kv) {
+    const Bucket &bucket = kv.second;
+    double elapsed =
+        std::chrono::duration<double>(now - bucket.last_refill_time).count();
+    return bucket.tokens + elapsed * m_rate_ >= m_burst_;
+  });
+}
+
 grpc::Status CraneCtldServiceImpl::SubmitBatchTask(
     grpc::ServerContext *context,
     const crane::grpc::SubmitBatchTaskRequest *request,
@@ -372,8 +669,14 @@ grpc::Status CraneCtldServiceImpl::SubmitBatchTask(
   if (!g_runtime_status.srv_ready.load(std::memory_order_acquire))
     return grpc::Status{grpc::StatusCode::UNAVAILABLE,
                         "CraneCtld Server is not ready"};
+  auto ticket = m_mutating_gate_.TryAdmit();
+  if (!ticket) return m_mutating_gate_.RejectedStatus();
   if (auto msg = CheckCertAndUIDAllowed_(context, request->task().uid()); msg)
     return {grpc::StatusCode::UNAUTHENTICATED, msg.value()};
+  if (auto status =
+          m_mutating_rate_limiter_.Acquire(context, request->task().uid());
+      !status.ok())
+    return status;
 
   auto task = std::make_unique<TaskInCtld>();
   task->SetFieldsByTaskToCtld(request->task());
@@ -403,22 +706,33 @@ grpc::Status CraneCtldServiceImpl::SubmitBatchTasks(
   if (!g_runtime_status.srv_ready.load(std::memory_order_acquire))
     return grpc::Status{grpc::StatusCode::UNAVAILABLE,
                         "CraneCtld Server is not ready"};
+  auto ticket = m_mutating_gate_.TryAdmit();
+  if (!ticket) return m_mutating_gate_.RejectedStatus();
   if (auto msg = CheckCertAndUIDAllowed_(context, request->task().uid()); msg)
     return {grpc::StatusCode::UNAUTHENTICATED, msg.value()};
-
-  std::vector<CraneExpected<std::future<task_id_t>>> results;
+  if (auto status =
+          m_mutating_rate_limiter_.Acquire(context, request->task().uid());
+      !status.ok())
+    return status;
 
   uint32_t task_count = request->count();
-  const auto &task_to_ctld = request->task();
-  results.reserve(task_count);
 
-  for (int i = 0; i < task_count; i++) {
-    auto task = std::make_unique<TaskInCtld>();
-    task->SetFieldsByTaskToCtld(task_to_ctld);
+  // All the tasks share one TaskToCtld, including the script and the env.
+  auto task_to_ctld =
+      std::make_shared<crane::grpc::TaskToCtld>(request->task());
+  TaskScheduler::FillDefaultsOfSharedTaskToCtld(task_to_ctld.get());
 
-    auto result = g_task_scheduler->SubmitTaskToScheduler(std::move(task));
-    results.emplace_back(std::move(result));
-  }
+  std::vector<std::unique_ptr<TaskInCtld>> tasks(task_count);
+  ParallelForChunks(task_count, kSubmitValidationChunkNum,
+                    [&](size_t begin, size_t end) {
+                      for (size_t i = begin; i < end; i++) {
+                        tasks[i] = std::make_unique<TaskInCtld>();
+                        tasks[i]->SetFieldsByTaskToCtld(task_to_ctld);
+                      }
+                    });
+
+  std::vector<CraneExpected<std::future<task_id_t>>> results =
+      g_task_scheduler->SubmitTasksToScheduler(std::move(tasks));
 
   for (auto &res : results) {
     if (res.has_value())
@@ -436,6 +750,12 @@ grpc::Status CraneCtldServiceImpl::CancelTask(
   if (!g_runtime_status.srv_ready.load(std::memory_order_acquire))
     return grpc::Status{grpc::StatusCode::UNAVAILABLE,
                         "CraneCtld Server is not ready"};
+  auto ticket = m_mutating_gate_.TryAdmit();
+  if (!ticket) return m_mutating_gate_.RejectedStatus();
+  if (auto status =
+          m_mutating_rate_limiter_.Acquire(context, request->operator_uid());
+      !status.ok())
+    return status;
 
   *response = g_task_scheduler->CancelPendingOrRunningTask(*request);
   return grpc::Status::OK;
@@ -448,8 +768,16 @@ grpc::Status CraneCtldServiceImpl::QueryCranedInfo(
   if (!g_runtime_status.srv_ready.load(std::memory_order_acquire))
     return grpc::Status{grpc::StatusCode::UNAVAILABLE,
                         "CraneCtld Server is not ready"};
-
-  if (request->craned_name().empty()) {
+  auto ticket = m_query_gate_.TryAdmit();
+  if (!ticket) return m_query_gate_.RejectedStatus();
+  if (auto status =
+          m_query_rate_limiter_.Acquire(context, UidOfRequest_(*request));
+      !status.ok())
+    return status;
+
+  if (g_query_replica) {
+    *response = g_query_replica->QueryCranedInfo(request->craned_name());
+  } else if (request->craned_name().empty()) {
     *response = g_meta_container->QueryAllCranedInfo();
   } else {
     *response = g_meta_container->QueryCranedInfo(request->craned_name());
@@ -465,8 +793,16 @@ grpc::Status CraneCtldServiceImpl::QueryPartitionInfo(
   if (!g_runtime_status.srv_ready.load(std::memory_order_acquire))
     return grpc::Status{grpc::StatusCode::UNAVAILABLE,
                         "CraneCtld Server is not ready"};
-
-  if (request->partition_name().empty()) {
+  auto ticket = m_query_gate_.TryAdmit();
+  if (!ticket) return m_query_gate_.RejectedStatus();
+  if (auto status =
+          m_query_rate_limiter_.Acquire(context, UidOfRequest_(*request));
+      !status.ok())
+    return status;
+
+  if (g_query_replica) {
+    *response = g_query_replica->QueryPartitionInfo(request->partition_name());
+  } else if (request->partition_name().empty()) {
     *response = g_meta_container->QueryAllPartitionInfo();
   } else {
     *response = g_meta_container->QueryPartitionInfo(request->partition_name());
@@ -482,8 +818,14 @@ grpc::Status CraneCtldServiceImpl::QueryReservationInfo(
   if (!g_runtime_status.srv_ready.load(std::memory_order_acquire))
     return grpc::Status{grpc::StatusCode::UNAVAILABLE,
                         "CraneCtld Server is not ready"};
+  auto ticket = m_query_gate_.TryAdmit();
+  if (!ticket) return m_query_gate_.RejectedStatus();
   if (auto msg = CheckCertAndUIDAllowed_(context, request->uid()); msg)
     return {grpc::StatusCode::UNAUTHENTICATED, msg.value()};
+  if (auto status =
+          m_query_rate_limiter_.Acquire(context, UidOfRequest_(*request));
+      !status.ok())
+    return status;
 
   auto res = g_account_manager->CheckUidIsAdmin(request->uid());
   if (!res) {
@@ -508,8 +850,14 @@ grpc::Status CraneCtldServiceImpl::ModifyTask(
   if (!g_runtime_status.srv_ready.load(std::memory_order_acquire))
     return grpc::Status{grpc::StatusCode::UNAVAILABLE,
                         "CraneCtld Server is not ready"};
+  auto ticket = m_mutating_gate_.TryAdmit();
+  if (!ticket) return m_mutating_gate_.RejectedStatus();
   if (auto msg = CheckCertAndUIDAllowed_(context, request->uid()); msg)
     return {grpc::StatusCode::UNAUTHENTICATED, msg.value()};
+  if (auto status =
+          m_mutating_rate_limiter_.Acquire(context, UidOfRequest_(*request));
+      !status.ok())
+    return status;
 
   using ModifyTaskRequest = crane::grpc::ModifyTaskRequest;
 
@@ -602,8 +950,14 @@ grpc::Status CraneCtldServiceImpl::ModifyTasksExtraAttrs(
   if (!g_runtime_status.srv_ready.load(std::memory_order_acquire))
     return grpc::Status{grpc::StatusCode::UNAVAILABLE,
                         "CraneCtld Server is not ready"};
+  auto ticket = m_mutating_gate_.TryAdmit();
+  if (!ticket) return m_mutating_gate_.RejectedStatus();
   if (auto msg = CheckCertAndUIDAllowed_(context, request->uid()); msg)
     return {grpc::StatusCode::UNAUTHENTICATED, msg.value()};
+  if (auto status =
+          m_mutating_rate_limiter_.Acquire(context, UidOfRequest_(*request));
+      !status.ok())
+    return status;
 
   auto res = g_account_manager->CheckUidIsAdmin(request->uid());
   if (!res) {
@@ -637,6 +991,57 @@ grpc::Status CraneCtldServiceImpl::ModifyTasksExtraAttrs(
   return grpc::Status::OK;
 }
 
+grpc::Status CraneCtldServiceImpl::QuerySchedulerStats(
+    grpc::ServerContext *context,
+    const crane::grpc::QuerySchedulerStatsRequest *request,
+    crane::grpc::QuerySchedulerStatsReply *response) {
+  if (!g_runtime_status.srv_ready.load(std::memory_order_acquire))
+    return grpc::Status{grpc::StatusCode::UNAVAILABLE,
+                        "CraneCtld Server is not ready"};
+  // Not subject to the admission control, so that an overload can always be
+  // inspected.
+  *response = g_scheduler_stats->QuerySchedulerStats();
+  g_task_scheduler->QueryTaskMemoryUsage(response);
+  g_mongodb_job_writer->QueryStats(response->mutable_job_writer_stats());
+  g_db_client->QueryPoolStats(response);
+
+  auto *admission_stats = response->mutable_rpc_admission_stats();
+  admission_stats->set_rejected_query_count(m_query_gate_.RejectedCount());
+  admission_stats->set_rejected_mutating_count(
+      m_mutating_gate_.RejectedCount());
+
+  {
+    absl::MutexLock lock(&m_ctld_server_->m_mtx_);
+    for (const auto &[cfored_name, writer_weak_ptr] :
+         m_ctld_server_->m_cfored_stream_writers_) {
+      auto writer = writer_weak_ptr.lock();
+      if (!writer) continue;
+
+      CforedStreamWriter::Stats stats = writer->GetStats();
+      auto *stream_stats = response->add_cfored_stream_stats();
+      stream_stats->set_cfored_name(cfored_name);
+      stream_stats->set_queued_reply_count(stats.queued_reply_count);
+      stream_stats->set_max_queued_reply_count(stats.max_queued_reply_count);
+      stream_stats->set_written_message_count(stats.written_message_count);
+      stream_stats->set_written_reply_count(stats.written_reply_count);
+      writer->WriteLatencyToGrpc(stream_stats->mutable_write_latency());
+    }
+  }
+
+  for (RpcUserRateLimiter *limiter :
+       {&m_query_rate_limiter_, &m_mutating_rate_limiter_}) {
+    for (auto &caller_stats : limiter->GetCallerStats()) {
+      auto *user_rate = response->add_user_rpc_rates();
+      user_rate->set_caller(std::move(caller_stats.caller));
+      user_rate->set_rpc_class(limiter->Name());
+      user_rate->set_request_rate(caller_stats.request_rate);
+      user_rate->set_admitted_count(caller_stats.admitted_count);
+      user_rate->set_limited_count(caller_stats.limited_count);
+    }
+  }
+  return grpc::Status::OK;
+}
+
 grpc::Status CraneCtldServiceImpl::ModifyNode(
     grpc::ServerContext *context,
     const crane::grpc::ModifyCranedStateRequest *request,
@@ -649,6 +1054,12 @@ grpc::Status CraneCtldServiceImpl::ModifyNode(
   if (!g_runtime_status.srv_ready.load(std::memory_order_acquire))
     return grpc::Status{grpc::StatusCode::UNAVAILABLE,
                         "CraneCtld Server is not ready"};
+  auto ticket = m_mutating_gate_.TryAdmit();
+  if (!ticket) return m_mutating_gate_.RejectedStatus();
+  if (auto status =
+          m_mutating_rate_limiter_.Acquire(context, UidOfRequest_(*request));
+      !status.ok())
+    return status;
 
   auto res = g_account_manager->CheckUidIsAdmin(request->uid());
   if (!res) {
@@ -727,6 +1138,7 @@ grpc::Status CraneCtldServiceImpl::ModifyNode(
   }
 
   *response = g_meta_container->ChangeNodeState(*request);
+  g_task_scheduler->TriggerSchedule();
 
   return grpc::Status::OK;
 }
@@ -738,8 +1150,14 @@ grpc::Status CraneCtldServiceImpl::ModifyPartitionAcl(
   if (!g_runtime_status.srv_ready.load(std::memory_order_acquire))
     return grpc::Status{grpc::StatusCode::UNAVAILABLE,
                         "CraneCtld Server is not ready"};
+  auto ticket = m_mutating_gate_.TryAdmit();
+  if (!ticket) return m_mutating_gate_.RejectedStatus();
   if (auto msg = CheckCertAndUIDAllowed_(context, request->uid()); msg)
     return {grpc::StatusCode::UNAUTHENTICATED, msg.value()};
+  if (auto status =
+          m_mutating_rate_limiter_.Acquire(context, UidOfRequest_(*request));
+      !status.ok())
+    return status;
 
   CraneExpected<void> result;
 
@@ -778,8 +1196,62 @@ grpc::Status CraneCtldServiceImpl::QueryTasksInfo(
   if (!g_runtime_status.srv_ready.load(std::memory_order_acquire))
     return grpc::Status{grpc::StatusCode::UNAVAILABLE,
                         "CraneCtld Server is not ready"};
+  auto ticket = m_query_gate_.TryAdmit();
+  if (!ticket) return m_query_gate_.RejectedStatus();
+  if (auto status =
+          m_query_rate_limiter_.Acquire(context, UidOfRequest_(*request));
+      !status.ok())
+    return status;
+
+  if (request->page_size() > 0) {
+    crane::grpc::QueryTasksInfoRequest clamped_request;
+    if (request->page_size() > kMaxQueryTaskPageSize) {
+      clamped_request = *request;
+      clamped_request.set_page_size(kMaxQueryTaskPageSize);
+      request = &clamped_request;
+    }
+    size_t page_size = request->page_size();
+
+    // Each source returns at most page_size + 1 tasks after the cursor in
+    // ascending order of task id, so the first page_size tasks of the merged
+    // list form the page and one more means there is a next page.
+    QueryTasksInRam_(request, response);
+    if (request->option_include_completed_tasks() &&
+        !g_db_client->FetchJobRecords(request, response, page_size + 1)) {
+      CRANE_ERROR("Failed to call g_db_client->FetchJobRecords");
+      return grpc::Status::OK;
+    }
+
+    auto *task_list = response->mutable_task_info_list();
+    std::sort(
+        task_list->begin(), task_list->end(),
+        [](const crane::grpc::TaskInfo &a, const crane::grpc::TaskInfo &b) {
+          return a.task_id() < b.task_id();
+        });
+
+    // A task ending during the query may come from both sources.
+    auto unique_end = std::unique(
+        task_list->begin(), task_list->end(),
+        [](const crane::grpc::TaskInfo &a, const crane::grpc::TaskInfo &b) {
+          return a.task_id() == b.task_id();
+        });
+    task_list->DeleteSubrange(unique_end - task_list->begin(),
+                              task_list->end() - unique_end);
+
+    if (task_list->size() > page_size) {
+      response->set_has_more(true);
+      task_list->DeleteSubrange(page_size, task_list->size() - page_size);
+    }
+    if (!task_list->empty())
+      response->set_next_page_after_task_id(
+          task_list->at(task_list->size() - 1).task_id());
+
+    response->set_ok(true);
+    return grpc::Status::OK;
+  }
+
   // Query tasks in RAM
-  g_task_scheduler->QueryTasksInRam(request, response);
+  QueryTasksInRam_(request, response);
 
   size_t num_limit = request->num_limit() == 0 ? kDefaultQueryTaskNumLimit
                                                : request->num_limit();
@@ -818,14 +1290,117 @@ grpc::Status CraneCtldServiceImpl::QueryTasksInfo(
   return grpc::Status::OK;
 }
 
+grpc::Status CraneCtldServiceImpl::WatchTasks(
+    grpc::ServerContext *context, const crane::grpc::WatchTasksRequest *request,
+    grpc::ServerWriter<crane::grpc::WatchTasksReply> *writer) {
+  if (!g_runtime_status.srv_ready.load(std::memory_order_acquire))
+    return grpc::Status{grpc::StatusCode::UNAVAILABLE,
+                        "CraneCtld Server is not ready"};
+  auto ticket = m_watch_gate_.TryAdmit();
+  if (!ticket) return m_watch_gate_.RejectedStatus();
+  if (auto msg = CheckCertAndUIDAllowed_(context, request->uid()); msg)
+    return {grpc::StatusCode::UNAUTHENTICATED, msg.value()};
+  if (auto status =
+          m_query_rate_limiter_.Acquire(context, UidOfRequest_(*request));
+      !status.ok())
+    return status;
+
+  uint64_t epoch = g_task_event_hub->Epoch();
+  uint64_t last_seq;
+  if (request->epoch() == 0) {
+    last_seq = g_task_event_hub->LastSeq();
+  } else if (request->epoch() == epoch) {
+    last_seq = request->after_seq();
+  } else {
+    return {grpc::StatusCode::FAILED_PRECONDITION,
+            "CraneCtld has restarted since the watch. Query the tasks and "
+            "watch again."};
+  }
+
+  std::unordered_set<uint32_t> req_task_ids(request->filter_task_ids().begin(),
+                                            request->filter_task_ids().end());
+  std::unordered_set<std::string> req_users(request->filter_users().begin(),
+                                            request->filter_users().end());
+  std::unordered_set<std::string> req_accounts(
+      request->filter_accounts().begin(), request->filter_accounts().end());
+  auto match = [&](const crane::grpc::TaskEvent &event) {
+    return (req_task_ids.empty() || req_task_ids.contains(event.task_id())) &&
+           (req_users.empty() || req_users.contains(event.username())) &&
+           (req_accounts.empty() || req_accounts.contains(event.account()));
+  };
+
+  crane::grpc::WatchTasksReply reply;
+  reply.set_epoch(epoch);
+  reply.set_last_seq(last_seq);
+  if (!writer->Write(reply)) return grpc::Status::OK;
+
+  // Events go out as they come, and heartbeats tell the watcher how far
+  // the watch is while nothing matches. Write blocks on a slow watcher, so
+  // it only falls behind in the ring of the hub until it is dropped.
+  std::vector<crane::grpc::TaskEvent> events;
+  absl::Time last_write_time = absl::Now();
+  while (!context->IsCancelled() &&
+         g_runtime_status.srv_ready.load(std::memory_order_acquire)) {
+    events.clear();
+    auto result = g_task_event_hub->WaitAndRead(
+        last_seq, kTaskWatchBatchNum, absl::Seconds(1), &events);
+    if (!result)
+      return {grpc::StatusCode::DATA_LOSS,
+              fmt::format("The watch fell behind and the events after seq {} "
+                          "were dropped. Query the tasks and watch again.",
+                          last_seq)};
+    last_seq = result.value();
+
+    reply.Clear();
+    reply.set_epoch(epoch);
+    reply.set_last_seq(last_seq);
+    for (auto &event : events)
+      if (match(event)) *reply.add_events() = std::move(event);
+
+    if (reply.events().empty() &&
+        absl::Now() - last_write_time <
+            absl::Seconds(kTaskWatchHeartbeatIntervalSec))
+      continue;
+
+    if (!writer->Write(reply)) break;
+    last_write_time = absl::Now();
+  }
+
+  return grpc::Status::OK;
+}
+
+grpc::Status CraneCtldServiceImpl::QueryUsageSummary(
+    grpc::ServerContext *context,
+    const crane::grpc::QueryUsageSummaryRequest *request,
+    crane::grpc::QueryUsageSummaryReply *response) {
+  if (!g_runtime_status.srv_ready.load(std::memory_order_acquire))
+    return grpc::Status{grpc::StatusCode::UNAVAILABLE,
+                        "CraneCtld Server is not ready"};
+  auto ticket = m_query_gate_.TryAdmit();
+  if (!ticket) return m_query_gate_.RejectedStatus();
+  if (auto status =
+          m_query_rate_limiter_.Acquire(context, UidOfRequest_(*request));
+      !status.ok())
+    return status;
+
+  response->set_ok(g_db_client->FetchUsageSummary(request, response));
+  return grpc::Status::OK;
+}
+
 grpc::Status CraneCtldServiceImpl::AddAccount(
     grpc::ServerContext *context, const crane::grpc::AddAccountRequest *request,
     crane::grpc::AddAccountReply *response) {
   if (!g_runtime_status.srv_ready.load(std::memory_order_acquire))
     return grpc::Status{grpc::StatusCode::UNAVAILABLE,
                         "CraneCtld Server is not ready"};
+  auto ticket = m_mutating_gate_.TryAdmit();
+  if (!ticket) return m_mutating_gate_.RejectedStatus();
   if (auto msg = CheckCertAndUIDAllowed_(context, request->uid()); msg)
     return {grpc::StatusCode::UNAUTHENTICATED, msg.value()};
+  if (auto status =
+          m_mutating_rate_limiter_.Acquire(context, UidOfRequest_(*request));
+      !status.ok())
+    return status;
 
   Account account;
   const crane::grpc::AccountInfo *account_info = &request->account();
@@ -858,34 +1433,16 @@ grpc::Status CraneCtldServiceImpl::AddUser(
   if (!g_runtime_status.srv_ready.load(std::memory_order_acquire))
     return grpc::Status{grpc::StatusCode::UNAVAILABLE,
                         "CraneCtld Server is not ready"};
+  auto ticket = m_mutating_gate_.TryAdmit();
+  if (!ticket) return m_mutating_gate_.RejectedStatus();
   if (auto msg = CheckCertAndUIDAllowed_(context, request->uid()); msg)
     return {grpc::StatusCode::UNAUTHENTICATED, msg.value()};
+  if (auto status =
+          m_mutating_rate_limiter_.Acquire(context, UidOfRequest_(*request));
+      !status.ok())
+    return status;
 
-  User user;
-  const crane::grpc::UserInfo *user_info = &request->user();
-
-  user.name = user_info->name();
-  user.uid = user_info->uid();
-  user.default_account = user_info->account();
-  user.admin_level = User::AdminLevel(user_info->admin_level());
-  for (const auto &acc : user_info->coordinator_accounts()) {
-    user.coordinator_accounts.emplace_back(acc);
-  }
-
-  // For user adding operation, the front end allows user only to set
-  // 'Allowed Partition'. 'Qos Lists' of the 'Allowed Partitions' can't be
-  // set by user. It's inherited from the parent account.
-  // However, we use UserInfo message defined in gRPC here. The `qos_list` field
-  // for any `allowed_partition_qos_list` is empty as just mentioned. Only
-  // `partition_name` field is set.
-  // Moreover, if `allowed_partition_qos_list` is empty, both allowed partitions
-  // and qos_list for allowed partitions are inherited from the parent.
-  if (!user.default_account.empty()) {
-    user.account_to_attrs_map[user.default_account];
-    for (const auto &apq : user_info->allowed_partition_qos_list())
-      user.account_to_attrs_map[user.default_account]
-          .allowed_partition_qos_map[apq.partition_name()];
-  }
+  User user = UserOfUserInfo_(request->user());
 
   CraneExpected<void> result = g_account_manager->AddUser(request->uid(), user);
   if (result) {
@@ -904,8 +1461,14 @@ grpc::Status CraneCtldServiceImpl::AddQos(
   if (!g_runtime_status.srv_ready.load(std::memory_order_acquire))
     return grpc::Status{grpc::StatusCode::UNAVAILABLE,
                         "CraneCtld Server is not ready"};
+  auto ticket = m_mutating_gate_.TryAdmit();
+  if (!ticket) return m_mutating_gate_.RejectedStatus();
   if (auto msg = CheckCertAndUIDAllowed_(context, request->uid()); msg)
     return {grpc::StatusCode::UNAUTHENTICATED, msg.value()};
+  if (auto status =
+          m_mutating_rate_limiter_.Acquire(context, UidOfRequest_(*request));
+      !status.ok())
+    return status;
   Qos qos;
   const crane::grpc::QosInfo *qos_info = &request->qos();
 
@@ -915,6 +1478,10 @@ grpc::Status CraneCtldServiceImpl::AddQos(
       qos_info->priority() == 0 ? kDefaultQosPriority : qos_info->priority();
   qos.max_jobs_per_user = qos_info->max_jobs_per_user();
   qos.max_cpus_per_user = qos_info->max_cpus_per_user();
+  qos.max_cpus_per_account =
+      qos_info->max_cpus_per_account() == 0
+          ? std::numeric_limits<decltype(qos.max_cpus_per_account)>::max()
+          : qos_info->max_cpus_per_account();
 
   int64_t sec = qos_info->max_time_limit_per_task();
   if (!CheckIfTimeLimitSecIsValid(sec)) {
@@ -942,8 +1509,14 @@ grpc::Status CraneCtldServiceImpl::ModifyAccount(
   if (!g_runtime_status.srv_ready.load(std::memory_order_acquire))
     return grpc::Status{grpc::StatusCode::UNAVAILABLE,
                         "CraneCtld Server is not ready"};
+  auto ticket = m_mutating_gate_.TryAdmit();
+  if (!ticket) return m_mutating_gate_.RejectedStatus();
   if (auto msg = CheckCertAndUIDAllowed_(context, request->uid()); msg)
     return {grpc::StatusCode::UNAUTHENTICATED, msg.value()};
+  if (auto status =
+          m_mutating_rate_limiter_.Acquire(context, UidOfRequest_(*request));
+      !status.ok())
+    return status;
 
   if (request->type() == crane::grpc::OperationType::Overwrite &&
       request->modify_field() ==
@@ -1007,8 +1580,14 @@ grpc::Status CraneCtldServiceImpl::ModifyUser(
   if (!g_runtime_status.srv_ready.load(std::memory_order_acquire))
     return grpc::Status{grpc::StatusCode::UNAVAILABLE,
                         "CraneCtld Server is not ready"};
+  auto ticket = m_mutating_gate_.TryAdmit();
+  if (!ticket) return m_mutating_gate_.RejectedStatus();
   if (auto msg = CheckCertAndUIDAllowed_(context, request->uid()); msg)
     return {grpc::StatusCode::UNAUTHENTICATED, msg.value()};
+  if (auto status =
+          m_mutating_rate_limiter_.Acquire(context, UidOfRequest_(*request));
+      !status.ok())
+    return status;
 
   CraneExpected<void> modify_res;
 
@@ -1149,8 +1728,14 @@ grpc::Status CraneCtldServiceImpl::ModifyQos(
   if (!g_runtime_status.srv_ready.load(std::memory_order_acquire))
     return grpc::Status{grpc::StatusCode::UNAVAILABLE,
                         "CraneCtld Server is not ready"};
+  auto ticket = m_mutating_gate_.TryAdmit();
+  if (!ticket) return m_mutating_gate_.RejectedStatus();
   if (auto msg = CheckCertAndUIDAllowed_(context, request->uid()); msg)
     return {grpc::StatusCode::UNAUTHENTICATED, msg.value()};
+  if (auto status =
+          m_mutating_rate_limiter_.Acquire(context, UidOfRequest_(*request));
+      !status.ok())
+    return status;
   auto modify_res =
       g_account_manager->ModifyQos(request->uid(), request->name(),
                                    request->modify_field(), request->value());
@@ -1165,6 +1750,68 @@ grpc::Status CraneCtldServiceImpl::ModifyQos(
   return grpc::Status::OK;
 }
 
+grpc::Status CraneCtldServiceImpl::BatchModifyUsers(
+    grpc::ServerContext *context,
+    const crane::grpc::BatchModifyUsersRequest *request,
+    crane::grpc::BatchModifyUsersReply *response) {
+  if (!g_runtime_status.srv_ready.load(std::memory_order_acquire))
+    return grpc::Status{grpc::StatusCode::UNAVAILABLE,
+                        "CraneCtld Server is not ready"};
+  auto ticket = m_mutating_gate_.TryAdmit();
+  if (!ticket) return m_mutating_gate_.RejectedStatus();
+  if (auto msg = CheckCertAndUIDAllowed_(context, request->uid()); msg)
+    return {grpc::StatusCode::UNAUTHENTICATED, msg.value()};
+  if (auto status =
+          m_mutating_rate_limiter_.Acquire(context, UidOfRequest_(*request));
+      !status.ok())
+    return status;
+
+  std::vector<AccountManager::UserBatchOp> ops;
+  ops.reserve(request->operation_list_size());
+  for (const auto &operation : request->operation_list()) {
+    switch (operation.operation_case()) {
+    case crane::grpc::UserBatchOperation::kAddUser:
+      ops.emplace_back(UserOfUserInfo_(operation.add_user()));
+      break;
+    case crane::grpc::UserBatchOperation::kAddAllowedPartition: {
+      const auto &op = operation.add_allowed_partition();
+      ops.emplace_back(AccountManager::AddUserAllowedPartitionOp{
+          .username = op.name(),
+          .account = op.account(),
+          .partition = op.partition()});
+      break;
+    }
+    case crane::grpc::UserBatchOperation::kAddAllowedQos: {
+      const auto &op = operation.add_allowed_qos();
+      ops.emplace_back(AccountManager::AddUserAllowedQosOp{
+          .username = op.name(),
+          .account = op.account(),
+          .partition = op.partition(),
+          .qos = op.qos()});
+      break;
+    }
+    default: {
+      auto *new_err_record = response->mutable_rich_error_list()->Add();
+      new_err_record->set_code(CraneErrCode::ERR_INVALID_PARAM);
+      new_err_record->set_description(std::to_string(ops.size()));
+      response->set_ok(false);
+      return grpc::Status::OK;
+    }
+    }
+  }
+
+  auto batch_res = g_account_manager->BatchModifyUsers(request->uid(), ops);
+  if (batch_res) {
+    response->set_ok(true);
+  } else {
+    response->set_ok(false);
+    for (const auto &rich_err : batch_res.error())
+      response->mutable_rich_error_list()->Add()->CopyFrom(rich_err);
+  }
+
+  return grpc::Status::OK;
+}
+
 grpc::Status CraneCtldServiceImpl::QueryAccountInfo(
     grpc::ServerContext *context,
     const crane::grpc::QueryAccountInfoRequest *request,
@@ -1172,8 +1819,14 @@ grpc::Status CraneCtldServiceImpl::QueryAccountInfo(
   if (!g_runtime_status.srv_ready.load(std::memory_order_acquire))
     return grpc::Status{grpc::StatusCode::UNAVAILABLE,
                         "CraneCtld Server is not ready"};
+  auto ticket = m_query_gate_.TryAdmit();
+  if (!ticket) return m_query_gate_.RejectedStatus();
   if (auto msg = CheckCertAndUIDAllowed_(context, request->uid()); msg)
     return {grpc::StatusCode::UNAUTHENTICATED, msg.value()};
+  if (auto status =
+          m_query_rate_limiter_.Acquire(context, UidOfRequest_(*request));
+      !status.ok())
+    return status;
   std::vector<Account> res_account_list;
   if (request->account_list().empty()) {
     auto res = g_account_manager->QueryAllAccountInfo(request->uid());
@@ -1250,8 +1903,14 @@ grpc::Status CraneCtldServiceImpl::QueryUserInfo(
   if (!g_runtime_status.srv_ready.load(std::memory_order_acquire))
     return grpc::Status{grpc::StatusCode::UNAVAILABLE,
                         "CraneCtld Server is not ready"};
+  auto ticket = m_query_gate_.TryAdmit();
+  if (!ticket) return m_query_gate_.RejectedStatus();
   if (auto msg = CheckCertAndUIDAllowed_(context, request->uid()); msg)
     return {grpc::StatusCode::UNAUTHENTICATED, msg.value()};
+  if (auto status =
+          m_query_rate_limiter_.Acquire(context, UidOfRequest_(*request));
+      !status.ok())
+    return status;
 
   std::unordered_set<std::string> user_list{request->user_list().begin(),
                                             request->user_list().end()};
@@ -1332,8 +1991,14 @@ grpc::Status CraneCtldServiceImpl::QueryQosInfo(
   if (!g_runtime_status.srv_ready.load(std::memory_order_acquire))
     return grpc::Status{grpc::StatusCode::UNAVAILABLE,
                         "CraneCtld Server is not ready"};
+  auto ticket = m_query_gate_.TryAdmit();
+  if (!ticket) return m_query_gate_.RejectedStatus();
   if (auto msg = CheckCertAndUIDAllowed_(context, request->uid()); msg)
     return {grpc::StatusCode::UNAUTHENTICATED, msg.value()};
+  if (auto status =
+          m_query_rate_limiter_.Acquire(context, UidOfRequest_(*request));
+      !status.ok())
+    return status;
 
   std::vector<Qos> res_qos_list;
 
@@ -1375,6 +2040,7 @@ grpc::Status CraneCtldServiceImpl::QueryQosInfo(
     qos_info->set_priority(qos.priority);
     qos_info->set_max_jobs_per_user(qos.max_jobs_per_user);
     qos_info->set_max_cpus_per_user(qos.max_cpus_per_user);
+    qos_info->set_max_cpus_per_account(qos.max_cpus_per_account);
     qos_info->set_max_time_limit_per_task(
         absl::ToInt64Seconds(qos.max_time_limit_per_task));
   }
@@ -1388,8 +2054,14 @@ grpc::Status CraneCtldServiceImpl::DeleteAccount(
   if (!g_runtime_status.srv_ready.load(std::memory_order_acquire))
     return grpc::Status{grpc::StatusCode::UNAVAILABLE,
                         "CraneCtld Server is not ready"};
+  auto ticket = m_mutating_gate_.TryAdmit();
+  if (!ticket) return m_mutating_gate_.RejectedStatus();
   if (auto msg = CheckCertAndUIDAllowed_(context, request->uid()); msg)
     return {grpc::StatusCode::UNAUTHENTICATED, msg.value()};
+  if (auto status =
+          m_mutating_rate_limiter_.Acquire(context, UidOfRequest_(*request));
+      !status.ok())
+    return status;
 
   for (const auto &account_name : request->account_list()) {
     auto res = g_account_manager->DeleteAccount(request->uid(), account_name);
@@ -1414,8 +2086,14 @@ grpc::Status CraneCtldServiceImpl::DeleteUser(
   if (!g_runtime_status.srv_ready.load(std::memory_order_acquire))
     return grpc::Status{grpc::StatusCode::UNAVAILABLE,
                         "CraneCtld Server is not ready"};
+  auto ticket = m_mutating_gate_.TryAdmit();
+  if (!ticket) return m_mutating_gate_.RejectedStatus();
   if (auto msg = CheckCertAndUIDAllowed_(context, request->uid()); msg)
     return {grpc::StatusCode::UNAUTHENTICATED, msg.value()};
+  if (auto status =
+          m_mutating_rate_limiter_.Acquire(context, UidOfRequest_(*request));
+      !status.ok())
+    return status;
   for (const auto &user_name : request->user_list()) {
     auto res = g_account_manager->DeleteUser(request->uid(), user_name,
                                              request->account());
@@ -1441,8 +2119,14 @@ grpc::Status CraneCtldServiceImpl::DeleteQos(
   if (!g_runtime_status.srv_ready.load(std::memory_order_acquire))
     return grpc::Status{grpc::StatusCode::UNAVAILABLE,
                         "CraneCtld Server is not ready"};
+  auto ticket = m_mutating_gate_.TryAdmit();
+  if (!ticket) return m_mutating_gate_.RejectedStatus();
   if (auto msg = CheckCertAndUIDAllowed_(context, request->uid()); msg)
     return {grpc::StatusCode::UNAUTHENTICATED, msg.value()};
+  if (auto status =
+          m_mutating_rate_limiter_.Acquire(context, UidOfRequest_(*request));
+      !status.ok())
+    return status;
 
   for (const auto &qos_name : request->qos_list()) {
     auto res = g_account_manager->DeleteQos(request->uid(), qos_name);
@@ -1469,8 +2153,14 @@ grpc::Status CraneCtldServiceImpl::BlockAccountOrUser(
   if (!g_runtime_status.srv_ready.load(std::memory_order_acquire))
     return grpc::Status(grpc::StatusCode::UNAVAILABLE,
                         "CraneCtld Server is not ready");
+  auto ticket = m_mutating_gate_.TryAdmit();
+  if (!ticket) return m_mutating_gate_.RejectedStatus();
   if (auto msg = CheckCertAndUIDAllowed_(context, request->uid()); msg)
     return {grpc::StatusCode::UNAUTHENTICATED, msg.value()};
+  if (auto status =
+          m_mutating_rate_limiter_.Acquire(context, UidOfRequest_(*request));
+      !status.ok())
+    return status;
   CraneExpected<void> res;
   std::unordered_set<std::string> entity_list{request->entity_list().begin(),
                                               request->entity_list().end()};
@@ -1556,8 +2246,14 @@ grpc::Status CraneCtldServiceImpl::ResetUserCredential(
   if (!g_runtime_status.srv_ready.load(std::memory_order_acquire))
     return grpc::Status{grpc::StatusCode::UNAVAILABLE,
                         "CraneCtld Server is not ready"};
+  auto ticket = m_mutating_gate_.TryAdmit();
+  if (!ticket) return m_mutating_gate_.RejectedStatus();
   if (auto msg = CheckCertAndUIDAllowed_(context, request->uid()); msg)
     return {grpc::StatusCode::UNAUTHENTICATED, msg.value()};
+  if (auto status =
+          m_mutating_rate_limiter_.Acquire(context, UidOfRequest_(*request));
+      !status.ok())
+    return status;
 
   std::unordered_set<std::string> user_list{request->user_list().begin(),
                                             request->user_list().end()};
@@ -1595,39 +2291,64 @@ grpc::Status CraneCtldServiceImpl::QueryTxnLog(
   if (!g_runtime_status.srv_ready.load(std::memory_order_acquire))
     return grpc::Status{grpc::StatusCode::UNAVAILABLE,
                         "CraneCtld Server is not ready"};
+  auto ticket = m_query_gate_.TryAdmit();
+  if (!ticket) return m_query_gate_.RejectedStatus();
   if (auto msg = CheckCertAndUIDAllowed_(context, request->uid()); msg)
     return {grpc::StatusCode::UNAUTHENTICATED, msg.value()};
-
-  std::unordered_map<std::string, std::string> conditions;
-  if (!request->actor().empty()) conditions.emplace("actor", request->actor());
-  if (!request->target().empty())
-    conditions.emplace("target", request->target());
-  if (!request->action().empty())
-    conditions.emplace("action", request->action());
-  if (!request->info().empty()) conditions.emplace("info", request->info());
-
-  auto result = g_account_manager->QueryTxnList(
-      request->uid(), conditions,
-      request->time_interval().lower_bound().seconds(),
-      request->time_interval().upper_bound().seconds());
-  if (!result) {
-    response->set_ok(false);
-    response->set_code(result.error());
+  if (auto status =
+          m_query_rate_limiter_.Acquire(context, UidOfRequest_(*request));
+      !status.ok())
+    return status;
+
+  if (request->page_size() == 0) {
+    QueryTxnLogPage_(*request, kDefaultTxnLogPageSize, "", response);
+    response->clear_next_page_cursor();
   } else {
-    response->set_ok(true);
-    for (auto &txn : result.value()) {
-      auto *new_txn = response->add_txn_log_list();
-      new_txn->set_actor(txn.actor);
-      new_txn->set_target(txn.target);
-      new_txn->set_action(txn.action);
-      new_txn->set_creation_time(txn.creation_time);
-      new_txn->set_info(txn.info);
-    }
+    QueryTxnLogPage_(*request,
+                     std::min(request->page_size(), kMaxTxnLogPageSize),
+                     request->page_cursor(), response);
   }
 
   return grpc::Status::OK;
 }
 
+grpc::Status CraneCtldServiceImpl::QueryTxnLogStream(
+    grpc::ServerContext *context,
+    const crane::grpc::QueryTxnLogRequest *request,
+    grpc::ServerWriter<crane::grpc::QueryTxnLogReply> *writer) {
+  if (!g_runtime_status.srv_ready.load(std::memory_order_acquire))
+    return grpc::Status{grpc::StatusCode::UNAVAILABLE,
+                        "CraneCtld Server is not ready"};
+  auto ticket = m_query_gate_.TryAdmit();
+  if (!ticket) return m_query_gate_.RejectedStatus();
+  if (auto msg = CheckCertAndUIDAllowed_(context, request->uid()); msg)
+    return {grpc::StatusCode::UNAUTHENTICATED, msg.value()};
+  if (auto status =
+          m_query_rate_limiter_.Acquire(context, UidOfRequest_(*request));
+      !status.ok())
+    return status;
+
+  uint32_t page_size = request->page_size() == 0
+                           ? kDefaultTxnLogPageSize
+                           : std::min(request->page_size(), kMaxTxnLogPageSize);
+
+  // Each page is queried after the former one is written, so only one page
+  // is held in memory however long the log is and however slow the reader.
+  std::string page_cursor = request->page_cursor();
+  do {
+    if (context->IsCancelled()) return grpc::Status::CANCELLED;
+
+    crane::grpc::QueryTxnLogReply reply;
+    QueryTxnLogPage_(*request, page_size, page_cursor, &reply);
+    if (!writer->Write(reply)) return grpc::Status::CANCELLED;
+    if (!reply.ok()) break;
+
+    page_cursor = reply.next_page_cursor();
+  } while (!page_cursor.empty());
+
+  return grpc::Status::OK;
+}
+
 grpc::Status CraneCtldServiceImpl::QueryClusterInfo(
     grpc::ServerContext *context,
     const crane::grpc::QueryClusterInfoRequest *request,
@@ -1635,8 +2356,17 @@ grpc::Status CraneCtldServiceImpl::QueryClusterInfo(
   if (!g_runtime_status.srv_ready.load(std::memory_order_acquire))
     return grpc::Status{grpc::StatusCode::UNAVAILABLE,
                         "CraneCtld Server is not ready"};
-
-  *response = g_meta_container->QueryClusterInfo(*request);
+  auto ticket = m_query_gate_.TryAdmit();
+  if (!ticket) return m_query_gate_.RejectedStatus();
+  if (auto status =
+          m_query_rate_limiter_.Acquire(context, UidOfRequest_(*request));
+      !status.ok())
+    return status;
+
+  if (g_query_replica)
+    *response = g_query_replica->QueryClusterInfo(*request);
+  else
+    *response = g_meta_container->QueryClusterInfo(*request);
   return grpc::Status::OK;
 }
 
@@ -1647,8 +2377,14 @@ grpc::Status CraneCtldServiceImpl::CreateReservation(
   if (!g_runtime_status.srv_ready.load(std::memory_order_acquire))
     return grpc::Status{grpc::StatusCode::UNAVAILABLE,
                         "CraneCtld Server is not ready"};
+  auto ticket = m_mutating_gate_.TryAdmit();
+  if (!ticket) return m_mutating_gate_.RejectedStatus();
   if (auto msg = CheckCertAndUIDAllowed_(context, request->uid()); msg)
     return {grpc::StatusCode::UNAUTHENTICATED, msg.value()};
+  if (auto status =
+          m_mutating_rate_limiter_.Acquire(context, UidOfRequest_(*request));
+      !status.ok())
+    return status;
 
   auto res = g_account_manager->CheckUidIsAdmin(request->uid());
   if (!res) {
@@ -1668,8 +2404,14 @@ grpc::Status CraneCtldServiceImpl::DeleteReservation(
   if (!g_runtime_status.srv_ready.load(std::memory_order_acquire))
     return grpc::Status{grpc::StatusCode::UNAVAILABLE,
                         "CraneCtld Server is not ready"};
+  auto ticket = m_mutating_gate_.TryAdmit();
+  if (!ticket) return m_mutating_gate_.RejectedStatus();
   if (auto msg = CheckCertAndUIDAllowed_(context, request->uid()); msg)
     return {grpc::StatusCode::UNAUTHENTICATED, msg.value()};
+  if (auto status =
+          m_mutating_rate_limiter_.Acquire(context, UidOfRequest_(*request));
+      !status.ok())
+    return status;
 
   auto res = g_account_manager->CheckUidIsAdmin(request->uid());
   if (!res) {
@@ -1689,6 +2431,12 @@ grpc::Status CraneCtldServiceImpl::PowerStateChange(
   if (!g_runtime_status.srv_ready.load(std::memory_order_acquire))
     return grpc::Status{grpc::StatusCode::UNAVAILABLE,
                         "CraneCtld Server is not ready"};
+  auto ticket = m_mutating_gate_.TryAdmit();
+  if (!ticket) return m_mutating_gate_.RejectedStatus();
+  if (auto status =
+          m_mutating_rate_limiter_.Acquire(context, std::nullopt);
+      !status.ok())
+    return status;
 
   CRANE_INFO("Received power state change request for node {}: {}",
              request->craned_id(),
@@ -1736,8 +2484,14 @@ grpc::Status CraneCtldServiceImpl::EnableAutoPowerControl(
   if (!g_runtime_status.srv_ready.load(std::memory_order_acquire))
     return grpc::Status{grpc::StatusCode::UNAVAILABLE,
                         "CraneCtld Server is not ready"};
+  auto ticket = m_mutating_gate_.TryAdmit();
+  if (!ticket) return m_mutating_gate_.RejectedStatus();
   if (auto msg = CheckCertAndUIDAllowed_(context, request->uid()); msg)
     return {grpc::StatusCode::UNAUTHENTICATED, msg.value()};
+  if (auto status =
+          m_mutating_rate_limiter_.Acquire(context, UidOfRequest_(*request));
+      !status.ok())
+    return status;
 
   CRANE_INFO(
       "Received enable auto power control request for {} nodes, enable: {}",
@@ -1802,6 +2556,12 @@ grpc::Status CraneCtldServiceImpl::SignUserCertificate(
   if (!g_runtime_status.srv_ready.load(std::memory_order_acquire))
     return grpc::Status{grpc::StatusCode::UNAVAILABLE,
                         "CraneCtld Server is not ready"};
+  auto ticket = m_mutating_gate_.TryAdmit();
+  if (!ticket) return m_mutating_gate_.RejectedStatus();
+  if (auto status =
+          m_mutating_rate_limiter_.Acquire(context, UidOfRequest_(*request));
+      !status.ok())
+    return status;
   if (!g_config.ListenConf.TlsConfig.AllowedNodes.empty()) {
     std::string client_address = context->peer();
     std::vector<std::string> str_list = absl::StrSplit(client_address, ":");
@@ -1864,6 +2624,77 @@ grpc::Status CraneCtldServiceImpl::SignUserCertificate(
   return grpc::Status::OK;
 }
 
+User CraneCtldServiceImpl::UserOfUserInfo_(
+    const crane::grpc::UserInfo &user_info) {
+  User user;
+
+  user.name = user_info.name();
+  user.uid = user_info.uid();
+  user.default_account = user_info.account();
+  user.admin_level = User::AdminLevel(user_info.admin_level());
+  for (const auto &acc : user_info.coordinator_accounts()) {
+    user.coordinator_accounts.emplace_back(acc);
+  }
+
+  // For user adding operation, the front end allows user only to set
+  // 'Allowed Partition'. 'Qos Lists' of the 'Allowed Partitions' can't be
+  // set by user. It's inherited from the parent account.
+  // However, we use UserInfo message defined in gRPC here. The `qos_list` field
+  // for any `allowed_partition_qos_list` is empty as just mentioned. Only
+  // `partition_name` field is set.
+  // Moreover, if `allowed_partition_qos_list` is empty, both allowed partitions
+  // and qos_list for allowed partitions are inherited from the parent.
+  if (!user.default_account.empty()) {
+    user.account_to_attrs_map[user.default_account];
+    for (const auto &apq : user_info.allowed_partition_qos_list())
+      user.account_to_attrs_map[user.default_account]
+          .allowed_partition_qos_map[apq.partition_name()];
+  }
+
+  return user;
+}
+
+void CraneCtldServiceImpl::QueryTxnLogPage_(
+    const crane::grpc::QueryTxnLogRequest &request, uint32_t page_size,
+    const std::string &page_cursor, crane::grpc::QueryTxnLogReply *response) {
+  std::unordered_map<std::string, std::string> conditions;
+  if (!request.actor().empty()) conditions.emplace("actor", request.actor());
+  if (!request.target().empty()) conditions.emplace("target", request.target());
+  if (!request.action().empty()) conditions.emplace("action", request.action());
+  if (!request.info().empty()) conditions.emplace("info", request.info());
+
+  std::string next_page_cursor;
+  auto result = g_account_manager->QueryTxnList(
+      request.uid(), conditions,
+      request.time_interval().lower_bound().seconds(),
+      request.time_interval().upper_bound().seconds(), page_size, page_cursor,
+      &next_page_cursor);
+  if (!result) {
+    response->set_ok(false);
+    response->set_code(result.error());
+  } else {
+    response->set_ok(true);
+    for (auto &txn : result.value()) {
+      auto *new_txn = response->add_txn_log_list();
+      new_txn->set_actor(txn.actor);
+      new_txn->set_target(txn.target);
+      new_txn->set_action(txn.action);
+      new_txn->set_creation_time(txn.creation_time);
+      new_txn->set_info(txn.info);
+    }
+    response->set_next_page_cursor(std::move(next_page_cursor));
+  }
+}
+
+void CraneCtldServiceImpl::QueryTasksInRam_(
+    const crane::grpc::QueryTasksInfoRequest *request,
+    crane::grpc::QueryTasksInfoReply *response) {
+  if (g_query_replica)
+    g_query_replica->QueryTasks(request, response);
+  else
+    g_task_scheduler->QueryTasksInRam(request, response);
+}
+
 std::optional<std::string> CraneCtldServiceImpl::CheckCertAndUIDAllowed_(
     const grpc::ServerContext *context, uint32_t uid) {
   if (!g_config.ListenConf.TlsConfig.Enabled) return std::nullopt;
@@ -1898,38 +2729,45 @@ std::optional<std::string> CraneCtldServiceImpl::CheckCertAndUIDAllowed_(
 
 CtldServer::CtldServer(const Config::CraneCtldListenConf &listen_conf) {
   std::string cranectld_listen_addr = listen_conf.CraneCtldListenAddr;
+  // Craneds and cfored never talk to a read replica.
+  bool is_replica = !g_config.QueryReplication.PrimaryHostname.empty();
 
   // internal
-  m_internal_service_impl_ = std::make_unique<CtldForInternalServiceImpl>(this);
-  grpc::ServerBuilder internal_builder;
-  ServerBuilderSetKeepAliveArgs(&internal_builder);
-
-  if (g_config.CompressedRpc) ServerBuilderSetCompression(&internal_builder);
-
-  if (listen_conf.TlsConfig.Enabled)
-    ServerBuilderAddTcpTlsListeningPort(
-        &internal_builder, cranectld_listen_addr,
-        listen_conf.CraneCtldForInternalListenPort,
-        listen_conf.TlsConfig.InternalCerts);
-  else
-    ServerBuilderAddTcpInsecureListeningPort(
-        &internal_builder, cranectld_listen_addr,
-        listen_conf.CraneCtldForInternalListenPort);
+  if (!is_replica) {
+    m_internal_service_impl_ =
+        std::make_unique<CtldForInternalServiceImpl>(this);
+    grpc::ServerBuilder internal_builder;
+    ServerBuilderSetKeepAliveArgs(&internal_builder);
+
+    if (g_config.CompressedRpc) ServerBuilderSetCompression(&internal_builder);
+    if (g_config.Metrics.Enabled)
+      ServerBuilderAddMetricsInterceptor(&internal_builder);
+
+    if (listen_conf.TlsConfig.Enabled)
+      ServerBuilderAddTcpTlsListeningPort(
+          &internal_builder, cranectld_listen_addr,
+          listen_conf.CraneCtldForInternalListenPort,
+          listen_conf.TlsConfig.InternalCerts);
+    else
+      ServerBuilderAddTcpInsecureListeningPort(
+          &internal_builder, cranectld_listen_addr,
+          listen_conf.CraneCtldForInternalListenPort);
 
-  internal_builder.RegisterService(m_internal_service_impl_.get());
+    internal_builder.RegisterService(m_internal_service_impl_.get());
 
-  m_internal_server_ = internal_builder.BuildAndStart();
-  if (!m_internal_server_) {
-    CRANE_ERROR("Cannot start internal gRPC server!");
-    std::exit(1);
+    m_internal_server_ = internal_builder.BuildAndStart();
+    if (!m_internal_server_) {
+      CRANE_ERROR("Cannot start internal gRPC server!");
+      std::exit(1);
+    }
   }
 
   // external
-  m_service_impl_ = std::make_unique<CraneCtldServiceImpl>(this);
   grpc::ServerBuilder builder;
   ServerBuilderSetKeepAliveArgs(&builder);
 
   if (g_config.CompressedRpc) ServerBuilderSetCompression(&builder);
+  if (g_config.Metrics.Enabled) ServerBuilderAddMetricsInterceptor(&builder);
 
   if (listen_conf.TlsConfig.Enabled) {
     ServerBuilderAddTcpTlsListeningPort(&builder, cranectld_listen_addr,
@@ -1940,7 +2778,14 @@ CtldServer::CtldServer(const Config::CraneCtldListenConf &listen_conf) {
                                              listen_conf.CraneCtldListenPort);
   }
 
-  builder.RegisterService(m_service_impl_.get());
+  if (is_replica) {
+    m_replica_service_impl_ =
+        std::make_unique<CraneCtldReplicaServiceImpl>(this);
+    builder.RegisterService(m_replica_service_impl_.get());
+  } else {
+    m_service_impl_ = std::make_unique<CraneCtldServiceImpl>(this);
+    builder.RegisterService(m_service_impl_.get());
+  }
 
   m_server_ = builder.BuildAndStart();
   if (!m_server_) {
@@ -1948,10 +2793,19 @@ CtldServer::CtldServer(const Config::CraneCtldListenConf &listen_conf) {
     std::exit(1);
   }
 
-  CRANE_INFO("CraneCtld is listening on {}:{} and {}:{} and Tls is {}",
-             cranectld_listen_addr, listen_conf.CraneCtldListenPort,
-             cranectld_listen_addr, listen_conf.CraneCtldForInternalListenPort,
-             listen_conf.TlsConfig.Enabled);
+  if (is_replica)
+    CRANE_INFO(
+        "CraneCtld is listening on {}:{} as a read replica of {} and Tls is "
+        "{}",
+        cranectld_listen_addr, listen_conf.CraneCtldListenPort,
+        g_config.QueryReplication.PrimaryHostname,
+        listen_conf.TlsConfig.Enabled);
+  else
+    CRANE_INFO("CraneCtld is listening on {}:{} and {}:{} and Tls is {}",
+               cranectld_listen_addr, listen_conf.CraneCtldListenPort,
+               cranectld_listen_addr,
+               listen_conf.CraneCtldForInternalListenPort,
+               listen_conf.TlsConfig.Enabled);
 
   // Avoid the potential deadlock error in underlying absl::mutex
   std::thread signal_waiting_thread(
@@ -1970,10 +2824,11 @@ CtldServer::CtldServer(const Config::CraneCtldListenConf &listen_conf) {
         // g_craned_keeper.reset() is called. The Shutdown here and reset() in
         // the main thread will access g_craned_keeper simultaneously and a race
         // condition will occur.
-        g_craned_keeper->Shutdown();
+        if (g_craned_keeper) g_craned_keeper->Shutdown();
 
         auto ddl = std::chrono::seconds(1);
-        p_internal_server->Shutdown(std::chrono::system_clock::now() + ddl);
+        if (p_internal_server)
+          p_internal_server->Shutdown(std::chrono::system_clock::now() + ddl);
         p_server->Shutdown(std::chrono::system_clock::now() + ddl);
       });
   signal_waiting_thread.detach();
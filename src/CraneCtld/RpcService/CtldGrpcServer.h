@@ -21,6 +21,7 @@
 #include "CtldPublicDefs.h"
 // Precompiled header comes first!
 
+#include "SchedulerStats.h"
 #include "crane/Lock.h"
 #include "protos/Crane.grpc.pb.h"
 #include "protos/Crane.pb.h"
@@ -39,16 +40,25 @@ class CforedStreamWriter {
   using StreamCtldReply = crane::grpc::StreamCtldReply;
 
  public:
+  struct Stats {
+    uint64_t queued_reply_count;
+    uint64_t max_queued_reply_count;
+    uint64_t written_message_count;
+    uint64_t written_reply_count;
+  };
+
   explicit CforedStreamWriter(
       grpc::ServerReaderWriter<crane::grpc::StreamCtldReply,
                                crane::grpc::StreamCforedRequest> *stream)
-      : m_stream_(stream), m_valid_(true) {}
+      : m_stream_(stream) {}
+
+  // Must be called before the registration ack is written.
+  void SetBatchReplySupported(bool supported) {
+    m_batch_reply_supported_ = supported;
+  }
 
   bool WriteTaskIdReply(pid_t calloc_pid,
                         std::expected<task_id_t, std::string> res) {
-    LockGuard guard(&m_stream_mtx_);
-    if (!m_valid_) return false;
-
     StreamCtldReply reply;
     reply.set_type(StreamCtldReply::TASK_ID_REPLY);
     auto *task_id_reply = reply.mutable_payload_task_id_reply();
@@ -62,16 +72,13 @@ class CforedStreamWriter {
       task_id_reply->set_failure_reason(std::move(res.error()));
     }
 
-    return m_stream_->Write(reply);
+    return Enqueue_(std::move(reply));
   }
 
   bool WriteTaskResAllocReply(
       task_id_t task_id,
       std::expected<std::pair<std::string, std::list<CranedId>>, std::string>
           res) {
-    LockGuard guard(&m_stream_mtx_);
-    if (!m_valid_) return false;
-
     StreamCtldReply reply;
     reply.set_type(StreamCtldReply::TASK_RES_ALLOC_REPLY);
     auto *task_res_alloc_reply = reply.mutable_payload_task_res_alloc_reply();
@@ -89,12 +96,10 @@ class CforedStreamWriter {
       task_res_alloc_reply->set_failure_reason(std::move(res.error()));
     }
 
-    return m_stream_->Write(reply);
+    return Enqueue_(std::move(reply));
   }
 
   bool WriteTaskCompletionAckReply(task_id_t task_id) {
-    LockGuard guard(&m_stream_mtx_);
-    if (!m_valid_) return false;
     CRANE_TRACE("Sending TaskCompletionAckReply to cfored of task id {}",
                 task_id);
     StreamCtldReply reply;
@@ -103,26 +108,20 @@ class CforedStreamWriter {
     auto *task_completion_ack = reply.mutable_payload_task_completion_ack();
     task_completion_ack->set_task_id(task_id);
 
-    return m_stream_->Write(reply);
+    return Enqueue_(std::move(reply));
   }
 
   bool WriteTaskCancelRequest(task_id_t task_id) {
-    LockGuard guard(&m_stream_mtx_);
-    if (!m_valid_) return false;
-
     StreamCtldReply reply;
     reply.set_type(StreamCtldReply::TASK_CANCEL_REQUEST);
 
     auto *task_cancel_req = reply.mutable_payload_task_cancel_request();
     task_cancel_req->set_task_id(task_id);
 
-    return m_stream_->Write(reply);
+    return Enqueue_(std::move(reply));
   }
 
   bool WriteCforedRegistrationAck(const std::expected<void, std::string> &res) {
-    LockGuard guard(&m_stream_mtx_);
-    if (!m_valid_) return false;
-
     StreamCtldReply reply;
     reply.set_type(StreamCtldReply::CFORED_REGISTRATION_ACK);
 
@@ -134,35 +133,59 @@ class CforedStreamWriter {
       cfored_reg_ack->set_failure_reason(res.error());
     }
 
-    return m_stream_->Write(reply);
+    return Enqueue_(std::move(reply));
   }
 
   bool WriteCforedGracefulExitAck() {
-    LockGuard guard(&m_stream_mtx_);
-    if (!m_valid_) return false;
-
     StreamCtldReply reply;
     reply.set_type(StreamCtldReply::CFORED_GRACEFUL_EXIT_ACK);
 
     auto *cfored_graceful_exit_ack = reply.mutable_payload_graceful_exit_ack();
     cfored_graceful_exit_ack->set_ok(true);
 
-    return m_stream_->Write(reply);
+    return Enqueue_(std::move(reply));
   }
 
-  void Invalidate() {
-    LockGuard guard(&m_stream_mtx_);
-    m_valid_ = false;
+  // Waits for the queued replies to be written, e.g. the graceful exit ack.
+  // No write is done on the stream once this returns.
+  void Invalidate();
+
+  Stats GetStats();
+
+  void WriteLatencyToGrpc(
+      crane::grpc::QuerySchedulerStatsReply::PhaseLatency *latency) const {
+    m_write_latency_.ToGrpc(latency);
   }
 
  private:
-  Mutex m_stream_mtx_;
+  // Replies written while another thread is writing are queued, and that
+  // thread writes them right after its own write. The replies queued during
+  // one write go out together in BATCH messages if cfored supports them, so
+  // a burst costs a few writes, and a reply waits for one write at most.
+  // Returns false once the stream is broken or invalidated.
+  bool Enqueue_(StreamCtldReply &&reply);
+
+  bool FlushQueue_();
+
+  bool WriteReplies_(std::vector<StreamCtldReply> *replies);
 
-  bool m_valid_;
+  Mutex m_queue_mtx_;
+  bool m_valid_ ABSL_GUARDED_BY(m_queue_mtx_){true};
+  std::vector<StreamCtldReply> m_queued_replies_ ABSL_GUARDED_BY(m_queue_mtx_);
+  // Whether a thread is writing the queued replies. The queue is only empty
+  // while no thread is.
+  bool m_flushing_ ABSL_GUARDED_BY(m_queue_mtx_){false};
+  uint64_t m_max_queued_reply_count_ ABSL_GUARDED_BY(m_queue_mtx_){0};
 
+  bool m_batch_reply_supported_{false};
+
+  // Only written by the thread flushing the queue.
   grpc::ServerReaderWriter<crane::grpc::StreamCtldReply,
-                           crane::grpc::StreamCforedRequest> *m_stream_
-      ABSL_GUARDED_BY(m_stream_mtx_);
+                           crane::grpc::StreamCforedRequest> *m_stream_;
+
+  std::atomic_uint64_t m_written_message_count_{0};
+  std::atomic_uint64_t m_written_reply_count_{0};
+  LatencyHistogram m_write_latency_;
 };
 
 class CtldServer;
@@ -178,6 +201,11 @@ class CtldForInternalServiceImpl final
       const crane::grpc::StepStatusChangeRequest *request,
       crane::grpc::StepStatusChangeReply *response) override;
 
+  grpc::Status StepStatusChangeBatch(
+      grpc::ServerContext *context,
+      const crane::grpc::StepStatusChangeBatchRequest *request,
+      crane::grpc::StepStatusChangeBatchReply *response) override;
+
   grpc::Status CranedTriggerReverseConn(
       grpc::ServerContext *context,
       const crane::grpc::CranedTriggerReverseConnRequest *request,
@@ -198,10 +226,137 @@ class CtldForInternalServiceImpl final
                                crane::grpc::StreamCforedRequest> *stream)
       override;
 
+  // Streams the query state to a read replica. See QueryStateFeed.
+  grpc::Status ReplicateQueryState(
+      grpc::ServerContext *context,
+      const crane::grpc::ReplicateQueryStateRequest *request,
+      grpc::ServerWriter<crane::grpc::QueryStateUpdate> *writer) override;
+
  private:
+  // Count a message from the craned as its heartbeat. Return false if the
+  // craned is not online or not connected, in which case it must register
+  // again.
+  static bool RefreshCranedActiveTime_(const CranedId &craned_id);
+
   CtldServer *m_ctld_server_;
 };
 
+// Bounds the number of RPCs of a class handled at the same time, so that a
+// storm of RPCs of one class can't occupy every handler thread and starve the
+// others. An RPC beyond the bound is rejected at once instead of waiting for
+// a thread until it times out.
+class RpcAdmissionGate {
+ public:
+  // Holds a slot of the gate until destroyed.
+  class Ticket {
+   public:
+    explicit Ticket(RpcAdmissionGate *gate) : m_gate_(gate) {}
+    Ticket(Ticket &&other) noexcept
+        : m_gate_(std::exchange(other.m_gate_, nullptr)) {}
+    Ticket &operator=(Ticket &&) = delete;
+    ~Ticket() {
+      if (m_gate_)
+        m_gate_->m_in_flight_.fetch_sub(1, std::memory_order_acq_rel);
+    }
+
+   private:
+    RpcAdmissionGate *m_gate_;
+  };
+
+  RpcAdmissionGate(std::string name, uint32_t limit)
+      : m_name_(std::move(name)), m_limit_(limit) {}
+
+  std::optional<Ticket> TryAdmit() {
+    uint32_t in_flight = m_in_flight_.load(std::memory_order_relaxed);
+    do {
+      if (in_flight >= m_limit_) {
+        m_rejected_.fetch_add(1, std::memory_order_relaxed);
+        return std::nullopt;
+      }
+    } while (!m_in_flight_.compare_exchange_weak(in_flight, in_flight + 1,
+                                                 std::memory_order_acq_rel,
+                                                 std::memory_order_relaxed));
+    return Ticket(this);
+  }
+
+  grpc::Status RejectedStatus() const {
+    return {grpc::StatusCode::RESOURCE_EXHAUSTED,
+            fmt::format("CraneCtld is handling {} {} RPCs at most. Please "
+                        "retry later.",
+                        m_limit_, m_name_)};
+  }
+
+  uint64_t RejectedCount() const {
+    return m_rejected_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  const std::string m_name_;
+  const uint32_t m_limit_;
+  std::atomic<uint32_t> m_in_flight_{0};
+  std::atomic<uint64_t> m_rejected_{0};
+};
+
+// Per-caller token buckets of a class of RPCs. A caller is the uid in the
+// request, or the client address if the request carries no uid.
+class RpcUserRateLimiter {
+ public:
+  struct CallerStats {
+    std::string caller;
+    uint64_t request_rate;
+    uint64_t admitted_count;
+    uint64_t limited_count;
+  };
+
+  RpcUserRateLimiter(std::string name,
+                     const Config::RpcRateLimitConfig &config);
+
+  // Returns OK if the caller has a token left. Otherwise returns
+  // RESOURCE_EXHAUSTED and sets the "retry-after-ms" trailing metadata.
+  grpc::Status Acquire(grpc::ServerContext *context,
+                       std::optional<uint32_t> uid);
+
+  std::vector<CallerStats> GetCallerStats();
+
+  const std::string &Name() const { return m_name_; }
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Bucket {
+    double tokens;
+    Clock::time_point last_refill_time;
+
+    // Requests counted in the current second and in the one before it.
+    int64_t window_sec;
+    uint64_t window_count{0};
+    uint64_t prev_window_count{0};
+
+    uint64_t admitted_count{0};
+    uint64_t limited_count{0};
+  };
+
+  struct Shard {
+    absl::Mutex mtx;
+    absl::flat_hash_map<std::string, Bucket> buckets ABSL_GUARDED_BY(mtx);
+  };
+
+  static std::string CallerOf_(const grpc::ServerContext *context,
+                               std::optional<uint32_t> uid);
+
+  // Number of requests in the last full second as of now_sec.
+  static uint64_t RequestRateOf_(const Bucket &bucket, int64_t now_sec);
+
+  void PruneIdleBuckets_(Shard *shard, Clock::time_point now)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(shard->mtx);
+
+  const std::string m_name_;
+  const double m_rate_;
+  const double m_burst_;
+
+  std::array<Shard, kRpcRateLimitShardNum> m_shards_;
+};
+
 class CraneCtldServiceImpl final : public crane::grpc::CraneCtld::Service {
  public:
   explicit CraneCtldServiceImpl(CtldServer *server) : m_ctld_server_(server) {}
@@ -226,6 +381,16 @@ class CraneCtldServiceImpl final : public crane::grpc::CraneCtld::Service {
       const crane::grpc::QueryTasksInfoRequest *request,
       crane::grpc::QueryTasksInfoReply *response) override;
 
+  grpc::Status WatchTasks(
+      grpc::ServerContext *context,
+      const crane::grpc::WatchTasksRequest *request,
+      grpc::ServerWriter<crane::grpc::WatchTasksReply> *writer) override;
+
+  grpc::Status QueryUsageSummary(
+      grpc::ServerContext *context,
+      const crane::grpc::QueryUsageSummaryRequest *request,
+      crane::grpc::QueryUsageSummaryReply *response) override;
+
   grpc::Status QueryCranedInfo(
       grpc::ServerContext *context,
       const crane::grpc::QueryCranedInfoRequest *request,
@@ -250,6 +415,11 @@ class CraneCtldServiceImpl final : public crane::grpc::CraneCtld::Service {
       const crane::grpc::ModifyTasksExtraAttrsRequest *request,
       crane::grpc::ModifyTasksExtraAttrsReply *response) override;
 
+  grpc::Status QuerySchedulerStats(
+      grpc::ServerContext *context,
+      const crane::grpc::QuerySchedulerStatsRequest *request,
+      crane::grpc::QuerySchedulerStatsReply *response) override;
+
   grpc::Status ModifyNode(
       grpc::ServerContext *context,
       const crane::grpc::ModifyCranedStateRequest *request,
@@ -285,6 +455,11 @@ class CraneCtldServiceImpl final : public crane::grpc::CraneCtld::Service {
                          const crane::grpc::ModifyQosRequest *request,
                          crane::grpc::ModifyQosReply *response) override;
 
+  grpc::Status BatchModifyUsers(
+      grpc::ServerContext *context,
+      const crane::grpc::BatchModifyUsersRequest *request,
+      crane::grpc::BatchModifyUsersReply *response) override;
+
   grpc::Status QueryAccountInfo(
       grpc::ServerContext *context,
       const crane::grpc::QueryAccountInfoRequest *request,
@@ -326,6 +501,11 @@ class CraneCtldServiceImpl final : public crane::grpc::CraneCtld::Service {
                            const crane::grpc::QueryTxnLogRequest *request,
                            crane::grpc::QueryTxnLogReply *response) override;
 
+  grpc::Status QueryTxnLogStream(
+      grpc::ServerContext *context,
+      const crane::grpc::QueryTxnLogRequest *request,
+      grpc::ServerWriter<crane::grpc::QueryTxnLogReply> *writer) override;
+
   grpc::Status QueryClusterInfo(
       grpc::ServerContext *context,
       const crane::grpc::QueryClusterInfoRequest *request,
@@ -360,7 +540,88 @@ class CraneCtldServiceImpl final : public crane::grpc::CraneCtld::Service {
   static std::optional<std::string> CheckCertAndUIDAllowed_(
       const grpc::ServerContext *context, uint32_t uid);
 
+  static User UserOfUserInfo_(const crane::grpc::UserInfo &user_info);
+
+  // The pending and running tasks, from the replicated state on a read
+  // replica.
+  static void QueryTasksInRam_(
+      const crane::grpc::QueryTasksInfoRequest *request,
+      crane::grpc::QueryTasksInfoReply *response);
+
+  // The uid a request identifies its caller with for the rate limits.
+  template <typename Request>
+  static std::optional<uint32_t> UidOfRequest_(const Request &request) {
+    if constexpr (requires { request.has_uid(); }) {
+      if (!request.has_uid()) return std::nullopt;
+    }
+    return request.uid();
+  }
+
+  // Fills response with the page of the txn log after page_cursor matching
+  // the filters of request.
+  static void QueryTxnLogPage_(const crane::grpc::QueryTxnLogRequest &request,
+                               uint32_t page_size,
+                               const std::string &page_cursor,
+                               crane::grpc::QueryTxnLogReply *response);
+
   CtldServer *m_ctld_server_;
+
+  // Queries and mutations are admitted separately, so a storm of queries
+  // can't starve job submission and cancellation, and vice versa.
+  RpcAdmissionGate m_query_gate_{"query", g_config.MaxConcurrentQueryRpcs};
+  RpcAdmissionGate m_mutating_gate_{"mutating",
+                                    g_config.MaxConcurrentMutatingRpcs};
+  // A watch holds its slot as long as it lasts.
+  RpcAdmissionGate m_watch_gate_{"watch", kMaxTaskWatchStreamNum};
+
+  // A single caller can't take up the admitted RPCs of everyone else.
+  RpcUserRateLimiter m_query_rate_limiter_{"query",
+                                           g_config.QueryRpcRateLimit};
+  RpcUserRateLimiter m_mutating_rate_limiter_{"mutating",
+                                              g_config.MutatingRpcRateLimit};
+};
+
+// The service of a read replica. Only the task, node and partition queries
+// are answered, the same way as on the primary but from the replicated
+// state. Every other RPC, including all those changing anything, is left to
+// the base class and fails with UNIMPLEMENTED, so they must go to the
+// primary.
+class CraneCtldReplicaServiceImpl final
+    : public crane::grpc::CraneCtld::Service {
+ public:
+  explicit CraneCtldReplicaServiceImpl(CtldServer *server) : m_impl_(server) {}
+
+  grpc::Status QueryCranedInfo(
+      grpc::ServerContext *context,
+      const crane::grpc::QueryCranedInfoRequest *request,
+      crane::grpc::QueryCranedInfoReply *response) override {
+    return m_impl_.QueryCranedInfo(context, request, response);
+  }
+
+  grpc::Status QueryPartitionInfo(
+      grpc::ServerContext *context,
+      const crane::grpc::QueryPartitionInfoRequest *request,
+      crane::grpc::QueryPartitionInfoReply *response) override {
+    return m_impl_.QueryPartitionInfo(context, request, response);
+  }
+
+  grpc::Status QueryTasksInfo(
+      grpc::ServerContext *context,
+      const crane::grpc::QueryTasksInfoRequest *request,
+      crane::grpc::QueryTasksInfoReply *response) override {
+    return m_impl_.QueryTasksInfo(context, request, response);
+  }
+
+  grpc::Status QueryClusterInfo(
+      grpc::ServerContext *context,
+      const crane::grpc::QueryClusterInfoRequest *request,
+      crane::grpc::QueryClusterInfoReply *response) override {
+    return m_impl_.QueryClusterInfo(context, request, response);
+  }
+
+ private:
+  // Never registered. It reads g_query_replica in replica mode.
+  CraneCtldServiceImpl m_impl_;
 };
 
 /***
@@ -391,6 +652,8 @@ class CtldServer {
   Mutex m_mtx_;
   HashMap<std::string /* cfored_name */, HashSet<task_id_t>>
       m_cfored_running_tasks_ ABSL_GUARDED_BY(m_mtx_);
+  HashMap<std::string /* cfored_name */, std::weak_ptr<CforedStreamWriter>>
+      m_cfored_stream_writers_ ABSL_GUARDED_BY(m_mtx_);
 
   std::unique_ptr<CtldForInternalServiceImpl> m_internal_service_impl_;
   std::unique_ptr<Server> m_internal_server_;
@@ -399,6 +662,9 @@ class CtldServer {
 
   // external
   std::unique_ptr<CraneCtldServiceImpl> m_service_impl_;
+  // Registered instead of m_service_impl_ on a read replica, which has no
+  // internal server.
+  std::unique_ptr<CraneCtldReplicaServiceImpl> m_replica_service_impl_;
   std::unique_ptr<Server> m_server_;
 
   inline static std::mutex s_signal_cv_mtx_;
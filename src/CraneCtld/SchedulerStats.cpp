@@ -0,0 +1,150 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "SchedulerStats.h"
+
+namespace Ctld {
+
+std::vector<double> LatencyHistogram::BucketBounds_() {
+  std::vector<double> bounds;
+  bounds.reserve(kBucketNum - 1);
+  for (size_t i = 0; i + 1 < kBucketNum; i++)
+    bounds.emplace_back(static_cast<double>(uint64_t{1} << i) * 1e-6);
+  return bounds;
+}
+
+void LatencyHistogram::Record(std::chrono::steady_clock::duration duration) {
+  uint64_t us = std::max<int64_t>(
+      std::chrono::duration_cast<std::chrono::microseconds>(duration).count(),
+      0);
+
+  // Observed in whole microseconds so that a sample on a bound is counted
+  // in the bucket of that bound.
+  m_histogram_.Observe(static_cast<double>(us) * 1e-6);
+
+  uint64_t max_us = m_max_us_.load(std::memory_order_relaxed);
+  while (us > max_us &&
+         !m_max_us_.compare_exchange_weak(max_us, us,
+                                          std::memory_order_relaxed));
+}
+
+void LatencyHistogram::ToGrpc(
+    crane::grpc::QuerySchedulerStatsReply::PhaseLatency* latency) const {
+  util::metrics::Histogram::Snapshot snapshot = m_histogram_.Collect();
+  latency->set_count(snapshot.count);
+  latency->set_sum_us(std::llround(snapshot.sum * 1e6));
+  latency->set_max_us(m_max_us_.load(std::memory_order_relaxed));
+
+  // Trailing empty buckets are omitted.
+  size_t bucket_num = snapshot.bucket_counts.size();
+  while (bucket_num > 0 && snapshot.bucket_counts[bucket_num - 1] == 0)
+    bucket_num--;
+  for (size_t i = 0; i < bucket_num; i++)
+    latency->add_bucket_counts(snapshot.bucket_counts[i]);
+}
+
+SchedulerStats::SchedulerStats() {
+  auto& registry = util::metrics::DefaultRegistry();
+  m_metric_callback_ids_.emplace_back(registry.AddCounterCallback(
+      "crane_ctld_sched_evaluated_tasks_total",
+      "Pending tasks evaluated by node selection.", {}, [this] {
+        return m_evaluated_task_count_.load(std::memory_order_relaxed);
+      }));
+  m_metric_callback_ids_.emplace_back(registry.AddGaugeCallback(
+      "crane_ctld_sched_last_cycle_evaluated_tasks",
+      "Pending tasks evaluated by the last node selection.", {}, [this] {
+        return m_last_evaluated_task_num_.load(std::memory_order_relaxed);
+      }));
+  m_metric_callback_ids_.emplace_back(registry.AddCounterCallback(
+      "crane_ctld_sched_budget_hits_total",
+      "Scheduling cycles stopped by ScheduleCycleBudgetMs.", {}, [this] {
+        return m_budget_hit_count_.load(std::memory_order_relaxed);
+      }));
+}
+
+SchedulerStats::~SchedulerStats() {
+  for (auto id : m_metric_callback_ids_)
+    util::metrics::DefaultRegistry().RemoveCallback(id);
+}
+
+void SchedulerStats::RecordCranedDispatch(
+    const CranedId& craned_id, std::chrono::steady_clock::duration duration) {
+  m_craned_dispatch_histogram_.Record(duration);
+
+  uint64_t us = std::max<int64_t>(
+      std::chrono::duration_cast<std::chrono::microseconds>(duration).count(),
+      0);
+  if (duration >= kSlowCranedDispatchThreshold)
+    CRANE_WARN("ExecuteSteps RPC to craned {} took {} ms.", craned_id,
+               us / 1000);
+
+  LockGuard guard(&m_craned_dispatch_mtx_);
+  CranedDispatchStat& stat = m_craned_dispatch_stat_map_[craned_id];
+  stat.count++;
+  stat.last_us = us;
+  stat.max_us = std::max(stat.max_us, us);
+}
+
+crane::grpc::QuerySchedulerStatsReply SchedulerStats::QuerySchedulerStats()
+    const {
+  crane::grpc::QuerySchedulerStatsReply reply;
+  reply.set_ok(true);
+  reply.set_cycle_count(m_cycle_count_.load(std::memory_order_relaxed));
+  reply.set_considered_task_count(
+      m_considered_task_count_.load(std::memory_order_relaxed));
+  reply.set_scheduled_task_count(
+      m_scheduled_task_count_.load(std::memory_order_relaxed));
+  reply.set_evaluated_task_count(
+      m_evaluated_task_count_.load(std::memory_order_relaxed));
+  reply.set_last_cycle_evaluated_task_count(
+      m_last_evaluated_task_num_.load(std::memory_order_relaxed));
+  reply.set_budget_hit_count(
+      m_budget_hit_count_.load(std::memory_order_relaxed));
+
+  for (size_t i = 0; i < m_histograms_.size(); i++) {
+    auto* latency = reply.add_phase_latencies();
+    latency->set_phase(std::string(PhaseName(Phase(i))));
+    m_histograms_[i].ToGrpc(latency);
+  }
+
+  auto* dispatch_latency = reply.add_phase_latencies();
+  dispatch_latency->set_phase("execute_steps_per_craned");
+  m_craned_dispatch_histogram_.ToGrpc(dispatch_latency);
+
+  {
+    LockGuard guard(&m_craned_dispatch_mtx_);
+    for (const auto& [craned_id, stat] : m_craned_dispatch_stat_map_) {
+      auto* craned_latency = reply.add_craned_dispatch_latencies();
+      craned_latency->set_craned_id(craned_id);
+      craned_latency->set_count(stat.count);
+      craned_latency->set_last_us(stat.last_us);
+      craned_latency->set_max_us(stat.max_us);
+    }
+  }
+
+  // Slowest craneds first.
+  auto* craned_latencies = reply.mutable_craned_dispatch_latencies();
+  std::sort(craned_latencies->begin(), craned_latencies->end(),
+            [](const auto& lhs, const auto& rhs) {
+              return lhs.last_us() > rhs.last_us();
+            });
+
+  return reply;
+}
+
+}  // namespace Ctld
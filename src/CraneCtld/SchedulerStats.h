@@ -0,0 +1,165 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "CtldPublicDefs.h"
+// Precompiled header comes first!
+
+#include "protos/Crane.pb.h"
+
+namespace Ctld {
+
+// Latency histogram with power-of-two buckets in microseconds, kept in a
+// util::metrics::Histogram. Bucket 0 counts samples up to 1us and bucket i
+// counts samples in (2^(i-1), 2^i] us. The last bucket also takes everything
+// above. Recording is lock-free and can be done from any thread.
+class LatencyHistogram {
+ public:
+  static constexpr size_t kBucketNum = 32;
+
+  void Record(std::chrono::steady_clock::duration duration);
+
+  void ToGrpc(crane::grpc::QuerySchedulerStatsReply::PhaseLatency* latency)
+      const;
+
+ private:
+  // The upper bounds in seconds of all the buckets but the last one.
+  static std::vector<double> BucketBounds_();
+
+  util::metrics::Histogram m_histogram_{BucketBounds_()};
+  std::atomic_uint64_t m_max_us_{0};
+};
+
+class SchedulerStats {
+  using Mutex = absl::Mutex;
+  using LockGuard = absl::MutexLock;
+
+ public:
+  SchedulerStats();
+  ~SchedulerStats();
+
+  SchedulerStats(const SchedulerStats&) = delete;
+  SchedulerStats& operator=(const SchedulerStats&) = delete;
+
+  enum class Phase : uint8_t {
+    PrioritySort = 0,
+    NodeSelect,
+    CommitSelection,
+    CreateCgroup,
+    EmbeddedDbCommit,
+    ExecuteSteps,
+    PendingMapLockWait,
+    RunningMapLockWait,
+    LaunchStageWait,
+    MongoJobWrite,
+    FastLane,
+    Cycle,
+    PhaseNum,
+  };
+
+  // Time the enclosing scope and record it into the phase on destruction.
+  class ScopedTimer {
+   public:
+    ScopedTimer(SchedulerStats* stats, Phase phase)
+        : m_stats_(stats),
+          m_phase_(phase),
+          m_begin_(std::chrono::steady_clock::now()) {}
+    ~ScopedTimer() {
+      m_stats_->Record(m_phase_, std::chrono::steady_clock::now() - m_begin_);
+    }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+   private:
+    SchedulerStats* m_stats_;
+    Phase m_phase_;
+    std::chrono::steady_clock::time_point m_begin_;
+  };
+
+  static constexpr std::string_view PhaseName(Phase phase) {
+    constexpr std::array<std::string_view, size_t(Phase::PhaseNum)> kNames{
+        "priority_sort",         "node_select",
+        "commit_selection",      "create_cgroup",
+        "embedded_db_commit",    "execute_steps",
+        "pending_map_lock_wait", "running_map_lock_wait",
+        "launch_stage_wait",     "mongo_job_write",
+        "fast_lane",             "cycle",
+    };
+    return kNames[size_t(phase)];
+  }
+
+  void Record(Phase phase, std::chrono::steady_clock::duration duration) {
+    m_histograms_[size_t(phase)].Record(duration);
+  }
+
+  void RecordCycle(size_t num_pending_tasks, size_t num_scheduled_tasks) {
+    m_cycle_count_.fetch_add(1, std::memory_order_relaxed);
+    m_considered_task_count_.fetch_add(num_pending_tasks,
+                                       std::memory_order_relaxed);
+    m_scheduled_task_count_.fetch_add(num_scheduled_tasks,
+                                      std::memory_order_relaxed);
+  }
+
+  // Called once per NodeSelect() pass with the number of tasks evaluated in
+  // it and whether it stopped at ScheduleCycleBudgetMs.
+  void RecordNodeSelection(size_t num_evaluated_tasks, bool budget_hit) {
+    m_evaluated_task_count_.fetch_add(num_evaluated_tasks,
+                                      std::memory_order_relaxed);
+    m_last_evaluated_task_num_.store(num_evaluated_tasks,
+                                     std::memory_order_relaxed);
+    if (budget_hit) m_budget_hit_count_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // Latency of a single ExecuteSteps RPC to a craned. Slow craneds are
+  // logged and listed in the reply of QuerySchedulerStats.
+  void RecordCranedDispatch(const CranedId& craned_id,
+                            std::chrono::steady_clock::duration duration);
+
+  crane::grpc::QuerySchedulerStatsReply QuerySchedulerStats() const;
+
+ private:
+  struct CranedDispatchStat {
+    uint64_t count{0};
+    uint64_t last_us{0};
+    uint64_t max_us{0};
+  };
+
+  static constexpr std::chrono::seconds kSlowCranedDispatchThreshold{1};
+
+  std::array<LatencyHistogram, size_t(Phase::PhaseNum)> m_histograms_;
+
+  LatencyHistogram m_craned_dispatch_histogram_;
+  mutable Mutex m_craned_dispatch_mtx_;
+  absl::flat_hash_map<CranedId, CranedDispatchStat> m_craned_dispatch_stat_map_
+      ABSL_GUARDED_BY(m_craned_dispatch_mtx_);
+
+  std::atomic_uint64_t m_cycle_count_{0};
+  std::atomic_uint64_t m_considered_task_count_{0};
+  std::atomic_uint64_t m_scheduled_task_count_{0};
+  std::atomic_uint64_t m_evaluated_task_count_{0};
+  std::atomic_uint64_t m_last_evaluated_task_num_{0};
+  std::atomic_uint64_t m_budget_hit_count_{0};
+
+  std::vector<util::metrics::Registry::CallbackId> m_metric_callback_ids_;
+};
+
+inline std::unique_ptr<Ctld::SchedulerStats> g_scheduler_stats;
+
+}  // namespace Ctld
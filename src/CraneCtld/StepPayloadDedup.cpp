@@ -0,0 +1,125 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "StepPayloadDedup.h"
+
+namespace Ctld {
+
+namespace {
+
+constexpr uint64_t kFnvOffsetBasis = 0xcbf29ce484222325;
+constexpr uint64_t kFnvPrime = 0x100000001b3;
+
+// FNV-1a of the length and the bytes of s, stable across runs of ctld.
+void FnvUpdate(std::string_view s, uint64_t* hash) {
+  uint64_t len = s.size();
+  for (int i = 0; i < 8; i++) {
+    *hash ^= (len >> (i * 8)) & 0xff;
+    *hash *= kFnvPrime;
+  }
+  for (unsigned char c : s) {
+    *hash ^= c;
+    *hash *= kFnvPrime;
+  }
+}
+
+}  // namespace
+
+StepPayloadDedup::StepPayloadDedup(uint64_t craned_cache_bytes)
+    : m_craned_cache_bytes_(craned_cache_bytes) {}
+
+std::string StepPayloadDedup::Add(const TaskInCtld& task,
+                                  PayloadMap* payloads) {
+  const auto& proto_env = task.TaskToCtld().env();
+  std::string_view script;
+  if (task.type == crane::grpc::Batch)
+    script = task.TaskToCtld().batch_meta().sh_script();
+
+  // Map order is unspecified, so the variables are hashed sorted.
+  std::vector<std::pair<std::string_view, std::string_view>> env(
+      proto_env.begin(), proto_env.end());
+  std::ranges::sort(env);
+
+  uint64_t hash = kFnvOffsetBasis;
+  uint64_t size = script.size();
+  FnvUpdate(script, &hash);
+  for (const auto& [name, value] : env) {
+    FnvUpdate(name, &hash);
+    FnvUpdate(value, &hash);
+    size += name.size() + value.size();
+  }
+  std::string key = fmt::format("{}-{}-{:016x}", task.uid, size, hash);
+
+  auto [it, inserted] = payloads->try_emplace(key);
+  if (inserted) {
+    *it->second.mutable_env() = proto_env;
+    it->second.set_sh_script(std::string(script));
+  }
+  return key;
+}
+
+void StepPayloadDedup::Attach(const CranedId& craned_id,
+                              const std::string& key,
+                              const PayloadMap& payloads,
+                              crane::grpc::ExecuteStepsRequest* request) {
+  const crane::grpc::StepPayload& payload = payloads.at(key);
+  uint64_t size = payload.ByteSizeLong();
+
+  bool cached;
+  {
+    LockGuard lock_guard(&m_mtx_);
+    CranedLru& lru = m_craned_lru_map_[craned_id];
+    auto index_it = lru.index.find(key);
+    cached = index_it != lru.index.end();
+    if (cached) {
+      lru.entries.splice(lru.entries.begin(), lru.entries, index_it->second);
+    } else if (size <= m_craned_cache_bytes_) {
+      lru.entries.emplace_front(key, size);
+      lru.index.emplace(key, lru.entries.begin());
+      lru.bytes += size;
+      while (lru.bytes > m_craned_cache_bytes_) {
+        const auto& [oldest_key, oldest_size] = lru.entries.back();
+        lru.bytes -= oldest_size;
+        lru.index.erase(oldest_key);
+        lru.entries.pop_back();
+      }
+    }
+  }
+
+  auto* attached = request->mutable_payloads();
+  if (!cached && attached->find(key) == attached->end())
+    (*attached)[key] = payload;
+}
+
+void StepPayloadDedup::Forget(const CranedId& craned_id) {
+  LockGuard lock_guard(&m_mtx_);
+  m_craned_lru_map_.erase(craned_id);
+}
+
+void StepPayloadDedup::AttachAll(const PayloadMap& payloads,
+                                 crane::grpc::ExecuteStepsRequest* request) {
+  auto* attached = request->mutable_payloads();
+  for (const auto& task_to_d : request->tasks()) {
+    const std::string& key = task_to_d.payload_hash();
+    if (key.empty() || attached->find(key) != attached->end()) continue;
+    if (auto it = payloads.find(key); it != payloads.end())
+      (*attached)[key] = it->second;
+  }
+}
+
+}  // namespace Ctld
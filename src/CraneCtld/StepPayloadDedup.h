@@ -0,0 +1,84 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "CtldPublicDefs.h"
+// Precompiled header comes first!
+
+#include "protos/Crane.pb.h"
+
+namespace Ctld {
+
+// Replaces the script and the environment of the tasks in the ExecuteSteps
+// requests by a hash of them, so that the identical payloads of array and
+// multi-node jobs are sent to a craned once.
+//
+// The craned keeps the payloads attached to the requests in an LRU of
+// StepPayloadCacheMB. The same LRU is mirrored here for each craned from
+// the requests built, and a payload is attached only if the mirror has not
+// got it. The mirror may be wrong, e.g. after the craned restarted, in
+// which case the craned reports the tasks as missed and they are sent again
+// with the payloads attached.
+//
+// The hash covers the uid, so a crafted collision can't make the task of a
+// user run the script of another.
+class StepPayloadDedup {
+  using Mutex = absl::Mutex;
+  using LockGuard = absl::MutexLock;
+
+ public:
+  using PayloadMap =
+      absl::flat_hash_map<std::string, crane::grpc::StepPayload>;
+
+  explicit StepPayloadDedup(uint64_t craned_cache_bytes);
+
+  // Adds the payload of the task to payloads and returns its hash, which is
+  // set in its TaskToD built without the payload.
+  static std::string Add(const TaskInCtld& task, PayloadMap* payloads);
+
+  // Attaches the payload of key to request unless the craned has it.
+  void Attach(const CranedId& craned_id, const std::string& key,
+              const PayloadMap& payloads,
+              crane::grpc::ExecuteStepsRequest* request);
+
+  // Drops the mirror of a craned which missed payloads.
+  void Forget(const CranedId& craned_id);
+
+  // Attaches the payload of each task of the request which has a hash.
+  static void AttachAll(const PayloadMap& payloads,
+                        crane::grpc::ExecuteStepsRequest* request);
+
+ private:
+  struct CranedLru {
+    // Most recently used first.
+    std::list<std::pair<std::string, uint64_t>> entries;
+    absl::flat_hash_map<std::string, decltype(entries)::iterator> index;
+    uint64_t bytes{0};
+  };
+
+  const uint64_t m_craned_cache_bytes_;
+
+  Mutex m_mtx_;
+  absl::flat_hash_map<CranedId, CranedLru> m_craned_lru_map_
+      ABSL_GUARDED_BY(m_mtx_);
+};
+
+inline std::unique_ptr<Ctld::StepPayloadDedup> g_step_payload_dedup;
+
+}  // namespace Ctld
@@ -0,0 +1,145 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "TaskDependencyGraph.h"
+
+namespace Ctld {
+
+bool TaskDependencyGraph::Satisfied(crane::grpc::DependencyType type,
+                                    crane::grpc::TaskStatus status) {
+  switch (type) {
+  case crane::grpc::AfterOk:
+    return status == crane::grpc::Completed;
+  case crane::grpc::AfterNotOk:
+    return status != crane::grpc::Completed;
+  default:
+    return true;
+  }
+}
+
+void TaskDependencyGraph::AddTasks(const std::vector<TaskInCtld*>& tasks,
+                                   std::vector<Resolution>* resolutions) {
+  LockGuard guard(&m_mtx_);
+
+  // Tasks recovered together may depend on each other.
+  for (const TaskInCtld* task : tasks) {
+    m_live_ids_.emplace(task->TaskId());
+    m_named_ids_[{task->uid, task->name}].emplace(task->TaskId());
+  }
+
+  for (TaskInCtld* task : tasks) {
+    if (task->Status() != crane::grpc::Pending) continue;
+
+    const crane::grpc::Dependencies& deps = task->TaskToCtld().dependencies();
+    if (deps.deps().empty() && !deps.singleton()) continue;
+
+    task_id_t task_id = task->TaskId();
+    const auto& resolved_ids = task->RuntimeAttr().resolved_dependency_ids();
+    HashSet<task_id_t> resolved(resolved_ids.begin(), resolved_ids.end());
+
+    uint32_t wait_num = 0;
+    auto add_dep = [&](crane::grpc::DependencyType type, task_id_t up_id) {
+      if (resolved.contains(up_id)) return;
+
+      if (m_live_ids_.contains(up_id)) {
+        m_edges_[up_id].emplace_back(task_id, type);
+        wait_num++;
+        return;
+      }
+
+      // Unknown upstream tasks are left behind by a restart right after the
+      // submission, and the dependencies on them can't be satisfied.
+      auto ended_it = m_ended_status_.find(up_id);
+      bool satisfied = ended_it != m_ended_status_.end() &&
+                       Satisfied(type, ended_it->second);
+      task->ResolveDependency(up_id, satisfied);
+      resolutions->emplace_back(task_id, up_id, satisfied);
+    };
+
+    for (const auto& dep : deps.deps()) add_dep(dep.type(), dep.task_id());
+
+    if (deps.singleton()) {
+      const auto& same_name_ids = m_named_ids_[{task->uid, task->name}];
+      for (task_id_t id : same_name_ids) {
+        if (id >= task_id) break;
+        add_dep(crane::grpc::AfterAny, id);
+      }
+    }
+
+    task->SetDependencyWaitNum(wait_num);
+  }
+}
+
+void TaskDependencyGraph::RemoveEndedTasks(
+    const std::vector<TaskInCtld*>& tasks,
+    std::vector<Resolution>* resolutions) {
+  LockGuard guard(&m_mtx_);
+
+  for (const TaskInCtld* task : tasks) {
+    task_id_t task_id = task->TaskId();
+    m_live_ids_.erase(task_id);
+
+    auto named_it = m_named_ids_.find({task->uid, task->name});
+    if (named_it != m_named_ids_.end()) {
+      named_it->second.erase(task_id);
+      if (named_it->second.empty()) m_named_ids_.erase(named_it);
+    }
+
+    RememberEndedNoLock_(task_id, task->Status());
+
+    auto edge_it = m_edges_.find(task_id);
+    if (edge_it == m_edges_.end()) continue;
+    for (const Edge& edge : edge_it->second)
+      resolutions->emplace_back(edge.dependent_id, task_id,
+                                Satisfied(edge.type, task->Status()));
+    m_edges_.erase(edge_it);
+  }
+}
+
+void TaskDependencyGraph::AddEndedTasks(
+    const std::vector<std::pair<task_id_t, crane::grpc::TaskStatus>>& tasks) {
+  LockGuard guard(&m_mtx_);
+  for (const auto& [task_id, status] : tasks)
+    RememberEndedNoLock_(task_id, status);
+}
+
+std::vector<task_id_t> TaskDependencyGraph::UnknownUpstreams(
+    const crane::grpc::Dependencies& deps) const {
+  std::vector<task_id_t> unknown_ids;
+
+  ReaderLockGuard guard(&m_mtx_);
+  for (const auto& dep : deps.deps()) {
+    task_id_t up_id = dep.task_id();
+    if (!m_live_ids_.contains(up_id) && !m_ended_status_.contains(up_id))
+      unknown_ids.emplace_back(up_id);
+  }
+  return unknown_ids;
+}
+
+void TaskDependencyGraph::RememberEndedNoLock_(task_id_t task_id,
+                                               crane::grpc::TaskStatus status) {
+  if (!m_ended_status_.insert_or_assign(task_id, status).second) return;
+
+  m_ended_order_.emplace_back(task_id);
+  if (m_ended_order_.size() > kDependencyEndedTaskCacheNum) {
+    m_ended_status_.erase(m_ended_order_.front());
+    m_ended_order_.pop_front();
+  }
+}
+
+}  // namespace Ctld
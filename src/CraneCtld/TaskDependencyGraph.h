@@ -0,0 +1,97 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "CtldPublicDefs.h"
+// Precompiled header comes first!
+
+namespace Ctld {
+
+// The dependencies between the tasks in RAM, kept by TaskScheduler. An edge
+// goes from an upstream task to a task waiting for it, so that the end of a
+// task only visits its own edges to release its dependents. The final status
+// of the tasks ended recently is remembered for the dependencies submitted on
+// them while they were ending.
+class TaskDependencyGraph {
+  using Mutex = absl::Mutex;
+  using LockGuard = absl::MutexLock;
+  using ReaderLockGuard = absl::ReaderMutexLock;
+
+  template <typename K, typename V>
+  using HashMap = absl::flat_hash_map<K, V>;
+
+  template <typename K>
+  using HashSet = absl::flat_hash_set<K>;
+
+ public:
+  // An upstream task of dependent_id has ended.
+  struct Resolution {
+    task_id_t dependent_id;
+    task_id_t upstream_id;
+    bool satisfied;
+  };
+
+  static bool Satisfied(crane::grpc::DependencyType type,
+                        crane::grpc::TaskStatus status);
+
+  // Track the tasks entering the pending or running queue. The unresolved
+  // dependencies of the pending ones become edges. Those on ended or unknown
+  // tasks are resolved on the tasks at once and appended to resolutions to be
+  // persisted. The caller holds the lock of the map containing the tasks.
+  void AddTasks(const std::vector<TaskInCtld*>& tasks,
+                std::vector<Resolution>* resolutions);
+
+  // Forget the ended tasks and append the dependencies on them to
+  // resolutions. Removing a task without edges is O(1).
+  void RemoveEndedTasks(const std::vector<TaskInCtld*>& tasks,
+                        std::vector<Resolution>* resolutions);
+
+  // Remember the final status of tasks which ended before, e.g. the tasks
+  // found in MongoDB.
+  void AddEndedTasks(
+      const std::vector<std::pair<task_id_t, crane::grpc::TaskStatus>>& tasks);
+
+  // The upstream tasks of deps which are neither in RAM nor ended recently.
+  std::vector<task_id_t> UnknownUpstreams(
+      const crane::grpc::Dependencies& deps) const;
+
+ private:
+  struct Edge {
+    task_id_t dependent_id;
+    crane::grpc::DependencyType type;
+  };
+
+  void RememberEndedNoLock_(task_id_t task_id, crane::grpc::TaskStatus status)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(m_mtx_);
+
+  mutable Mutex m_mtx_;
+
+  HashSet<task_id_t> m_live_ids_ ABSL_GUARDED_BY(m_mtx_);
+  // The live tasks of each uid with each name, for singleton dependencies.
+  HashMap<std::pair<uint32_t, std::string>, absl::btree_set<task_id_t>>
+      m_named_ids_ ABSL_GUARDED_BY(m_mtx_);
+  HashMap<task_id_t, std::vector<Edge>> m_edges_ ABSL_GUARDED_BY(m_mtx_);
+
+  // At most kDependencyEndedTaskCacheNum tasks, evicted in the order of end.
+  HashMap<task_id_t, crane::grpc::TaskStatus> m_ended_status_
+      ABSL_GUARDED_BY(m_mtx_);
+  std::deque<task_id_t> m_ended_order_ ABSL_GUARDED_BY(m_mtx_);
+};
+
+}  // namespace Ctld
@@ -0,0 +1,78 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "TaskEventHub.h"
+
+namespace Ctld {
+
+TaskEventHub::TaskEventHub()
+    : m_epoch_(absl::ToUnixMicros(absl::Now())),
+      m_ring_(kTaskEventHistoryNum) {}
+
+void TaskEventHub::Publish(const std::vector<TaskInCtld*>& tasks) {
+  if (tasks.empty()) return;
+
+  int64_t now_sec = absl::ToUnixSeconds(absl::Now());
+
+  LockGuard lock_guard(&m_mtx_);
+  for (TaskInCtld* task : tasks) {
+    uint64_t seq = ++m_last_seq_;
+    crane::grpc::TaskEvent& event = m_ring_[(seq - 1) % kTaskEventHistoryNum];
+    event.set_seq(seq);
+    event.set_task_id(task->TaskId());
+    event.set_uid(task->uid);
+    event.set_username(task->Username());
+    event.set_account(task->account);
+    event.set_partition(task->partition_id);
+    event.set_status(task->RuntimeAttr().status());
+    event.set_exit_code(task->RuntimeAttr().exit_code());
+    event.mutable_time()->set_seconds(now_sec);
+  }
+  m_cv_.SignalAll();
+}
+
+uint64_t TaskEventHub::LastSeq() {
+  absl::ReaderMutexLock lock_guard(&m_mtx_);
+  return m_last_seq_;
+}
+
+std::expected<uint64_t, uint64_t> TaskEventHub::WaitAndRead(
+    uint64_t after_seq, uint32_t max_num, absl::Duration timeout,
+    std::vector<crane::grpc::TaskEvent>* events) {
+  absl::Time deadline = absl::Now() + timeout;
+
+  LockGuard lock_guard(&m_mtx_);
+  while (m_last_seq_ <= after_seq) {
+    if (m_cv_.WaitWithDeadline(&m_mtx_, deadline)) return after_seq;
+  }
+
+  uint64_t oldest_seq = OldestSeqNoLock_();
+  if (after_seq + 1 < oldest_seq) return std::unexpected(oldest_seq);
+
+  uint64_t last_seq = std::min(m_last_seq_, after_seq + max_num);
+  for (uint64_t seq = after_seq + 1; seq <= last_seq; seq++)
+    events->emplace_back(m_ring_[(seq - 1) % kTaskEventHistoryNum]);
+  return last_seq;
+}
+
+uint64_t TaskEventHub::OldestSeqNoLock_() const {
+  if (m_last_seq_ < kTaskEventHistoryNum) return 1;
+  return m_last_seq_ - kTaskEventHistoryNum + 1;
+}
+
+}  // namespace Ctld
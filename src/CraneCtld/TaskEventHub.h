@@ -0,0 +1,69 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "CtldPublicDefs.h"
+// Precompiled header comes first!
+
+#include "protos/Crane.pb.h"
+
+namespace Ctld {
+
+// Keeps the latest task state transitions in a ring for the WatchTasks
+// streams. The scheduler publishes the tasks entering a status and each
+// stream reads the events after the last one it has seen, so a slow watcher
+// costs no memory beyond the ring.
+class TaskEventHub {
+  using Mutex = absl::Mutex;
+  using LockGuard = absl::MutexLock;
+
+ public:
+  TaskEventHub();
+
+  // Identifies this run of ctld. The seqs of another run are meaningless.
+  uint64_t Epoch() const { return m_epoch_; }
+
+  // Publishes the current status of each task.
+  void Publish(const std::vector<TaskInCtld*>& tasks);
+
+  uint64_t LastSeq();
+
+  // Appends at most max_num events after after_seq to events, waiting up to
+  // timeout for one if there is none yet. Returns the seq of the last event
+  // appended, or after_seq if there is none. Fails with the seq of the
+  // oldest event kept if some events after after_seq are no longer kept.
+  std::expected<uint64_t, uint64_t> WaitAndRead(
+      uint64_t after_seq, uint32_t max_num, absl::Duration timeout,
+      std::vector<crane::grpc::TaskEvent>* events);
+
+ private:
+  uint64_t OldestSeqNoLock_() const ABSL_SHARED_LOCKS_REQUIRED(m_mtx_);
+
+  const uint64_t m_epoch_;
+
+  Mutex m_mtx_;
+  absl::CondVar m_cv_;
+  // The event of seq s is at (s - 1) % kTaskEventHistoryNum.
+  std::vector<crane::grpc::TaskEvent> m_ring_ ABSL_GUARDED_BY(m_mtx_);
+  uint64_t m_last_seq_ ABSL_GUARDED_BY(m_mtx_){0};
+};
+
+inline std::unique_ptr<Ctld::TaskEventHub> g_task_event_hub;
+
+}  // namespace Ctld
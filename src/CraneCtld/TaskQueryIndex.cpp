@@ -0,0 +1,125 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "TaskQueryIndex.h"
+
+namespace Ctld {
+
+void TaskQueryIndex::Add(const TaskInCtld& task) {
+  LockGuard guard(&m_mtx_);
+  m_all_ids_.emplace(task.TaskId());
+  AddTo_(&m_user_index_, task.Username(), task.TaskId());
+  AddTo_(&m_account_index_, task.account, task.TaskId());
+  AddTo_(&m_partition_index_, task.partition_id, task.TaskId());
+  AddTo_(&m_qos_index_, task.qos, task.TaskId());
+}
+
+void TaskQueryIndex::Remove(const TaskInCtld& task) {
+  LockGuard guard(&m_mtx_);
+  m_all_ids_.erase(task.TaskId());
+  RemoveFrom_(&m_user_index_, task.Username(), task.TaskId());
+  RemoveFrom_(&m_account_index_, task.account, task.TaskId());
+  RemoveFrom_(&m_partition_index_, task.partition_id, task.TaskId());
+  RemoveFrom_(&m_qos_index_, task.qos, task.TaskId());
+}
+
+std::optional<std::vector<task_id_t>> TaskQueryIndex::Lookup(
+    const crane::grpc::QueryTasksInfoRequest& request) const {
+  std::vector<std::vector<task_id_t>> id_lists;
+
+  if (!request.filter_task_ids().empty()) {
+    std::vector<task_id_t> ids(request.filter_task_ids().begin(),
+                               request.filter_task_ids().end());
+    std::ranges::sort(ids);
+    auto [first, last] = std::ranges::unique(ids);
+    ids.erase(first, last);
+    id_lists.emplace_back(std::move(ids));
+  }
+
+  {
+    ReaderLockGuard guard(&m_mtx_);
+    if (!request.filter_users().empty())
+      id_lists.emplace_back(UnionOf_(m_user_index_, request.filter_users()));
+    if (!request.filter_accounts().empty())
+      id_lists.emplace_back(
+          UnionOf_(m_account_index_, request.filter_accounts()));
+    if (!request.filter_partitions().empty())
+      id_lists.emplace_back(
+          UnionOf_(m_partition_index_, request.filter_partitions()));
+    if (!request.filter_qos().empty())
+      id_lists.emplace_back(UnionOf_(m_qos_index_, request.filter_qos()));
+  }
+
+  if (id_lists.empty()) return std::nullopt;
+
+  // Intersect starting from the shortest list.
+  std::ranges::sort(id_lists, [](const auto& lhs, const auto& rhs) {
+    return lhs.size() < rhs.size();
+  });
+  std::vector<task_id_t> result = std::move(id_lists.front());
+  std::vector<task_id_t> intersection;
+  for (size_t i = 1; i < id_lists.size() && !result.empty(); i++) {
+    intersection.clear();
+    std::ranges::set_intersection(result, id_lists[i],
+                                  std::back_inserter(intersection));
+    result.swap(intersection);
+  }
+
+  return result;
+}
+
+void TaskQueryIndex::ForEachIdAfter(
+    task_id_t after_task_id, const std::function<bool(task_id_t)>& fn) const {
+  ReaderLockGuard guard(&m_mtx_);
+  for (auto it = m_all_ids_.upper_bound(after_task_id); it != m_all_ids_.end();
+       ++it)
+    if (!fn(*it)) break;
+}
+
+void TaskQueryIndex::AddTo_(IdIndex* index, const std::string& key,
+                            task_id_t id) {
+  (*index)[key].emplace(id);
+}
+
+void TaskQueryIndex::RemoveFrom_(IdIndex* index, const std::string& key,
+                                 task_id_t id) {
+  auto it = index->find(key);
+  if (it == index->end()) return;
+
+  it->second.erase(id);
+  if (it->second.empty()) index->erase(it);
+}
+
+template <typename Keys>
+std::vector<task_id_t> TaskQueryIndex::UnionOf_(const IdIndex& index,
+                                                const Keys& keys) {
+  std::vector<task_id_t> ids;
+  for (const auto& key : keys) {
+    auto it = index.find(key);
+    if (it != index.end())
+      ids.insert(ids.end(), it->second.begin(), it->second.end());
+  }
+
+  // The same key may be requested more than once.
+  std::ranges::sort(ids);
+  auto [first, last] = std::ranges::unique(ids);
+  ids.erase(first, last);
+  return ids;
+}
+
+}  // namespace Ctld
@@ -0,0 +1,77 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "CtldPublicDefs.h"
+// Precompiled header comes first!
+
+#include "protos/Crane.pb.h"
+
+namespace Ctld {
+
+// Secondary indexes of the tasks in RAM by user, account, partition and QoS.
+// They are kept by TaskScheduler in step with the submitted task buffer, the
+// pending map and the running map, so that a query with any of these filters
+// only visits the matching tasks instead of scanning all of them. The ids of
+// all the tasks are also kept in order for paginated queries.
+// A task stays indexed when it moves from pending to running.
+class TaskQueryIndex {
+  using Mutex = absl::Mutex;
+  using LockGuard = absl::MutexLock;
+  using ReaderLockGuard = absl::ReaderMutexLock;
+
+ public:
+  void Add(const TaskInCtld& task);
+  void Remove(const TaskInCtld& task);
+
+  // Return the ids of the tasks matching all the indexed filters of the
+  // request in ascending order, or std::nullopt if the request has none of
+  // them. Task ids requested explicitly are taken as one more such filter.
+  // The returned ids may belong to tasks in neither map, e.g. tasks being
+  // moved from pending to running, and the caller must apply the filters that
+  // are not indexed.
+  std::optional<std::vector<task_id_t>> Lookup(
+      const crane::grpc::QueryTasksInfoRequest& request) const;
+
+  // Call fn on the ids of all the indexed tasks greater than after_task_id
+  // in ascending order until fn returns false. Used by paginated queries to
+  // resume from the cursor without scanning the tasks before it.
+  void ForEachIdAfter(task_id_t after_task_id,
+                      const std::function<bool(task_id_t)>& fn) const;
+
+ private:
+  using IdIndex = absl::flat_hash_map<std::string, absl::btree_set<task_id_t>>;
+
+  static void AddTo_(IdIndex* index, const std::string& key, task_id_t id);
+  static void RemoveFrom_(IdIndex* index, const std::string& key,
+                          task_id_t id);
+
+  template <typename Keys>
+  static std::vector<task_id_t> UnionOf_(const IdIndex& index,
+                                         const Keys& keys);
+
+  mutable Mutex m_mtx_;
+  absl::btree_set<task_id_t> m_all_ids_ ABSL_GUARDED_BY(m_mtx_);
+  IdIndex m_user_index_ ABSL_GUARDED_BY(m_mtx_);
+  IdIndex m_account_index_ ABSL_GUARDED_BY(m_mtx_);
+  IdIndex m_partition_index_ ABSL_GUARDED_BY(m_mtx_);
+  IdIndex m_qos_index_ ABSL_GUARDED_BY(m_mtx_);
+};
+
+}  // namespace Ctld
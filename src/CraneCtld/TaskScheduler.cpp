@@ -23,7 +23,11 @@
 #include "CranedMetaContainer.h"
 #include "CtldPublicDefs.h"
 #include "EmbeddedDbClient.h"
+#include "MongodbJobWriter.h"
 #include "RpcService/CranedKeeper.h"
+#include "SchedulerStats.h"
+#include "StepPayloadDedup.h"
+#include "TaskEventHub.h"
 #include "crane/PluginClient.h"
 #include "protos/PublicDefs.pb.h"
 
@@ -40,17 +44,52 @@ TaskScheduler::TaskScheduler() {
 
   m_node_selection_algo_ =
       std::make_unique<MinLoadFirst>(m_priority_sorter_.get());
+
+  AddMetricCallbacks_();
 }
 
 TaskScheduler::~TaskScheduler() {
+  for (auto id : m_metric_callback_ids_)
+    util::metrics::DefaultRegistry().RemoveCallback(id);
+
   m_thread_stop_ = true;
+  TriggerSchedule();
   if (m_schedule_thread_.joinable()) m_schedule_thread_.join();
+  {
+    // The schedule thread has stopped, so no more batch will come.
+    LockGuard launch_guard(&m_launch_batch_mtx_);
+    m_launch_thread_stop_ = true;
+  }
+  if (m_launch_thread_.joinable()) m_launch_thread_.join();
   if (m_task_release_thread_.joinable()) m_task_release_thread_.join();
   if (m_task_cancel_thread_.joinable()) m_task_cancel_thread_.join();
   if (m_task_submit_thread_.joinable()) m_task_submit_thread_.join();
   if (m_task_status_change_thread_.joinable())
     m_task_status_change_thread_.join();
   if (m_resv_clean_thread_.joinable()) m_resv_clean_thread_.join();
+  if (m_task_info_snapshot_thread_.joinable())
+    m_task_info_snapshot_thread_.join();
+}
+
+void TaskScheduler::AddMetricCallbacks_() {
+  auto& registry = util::metrics::DefaultRegistry();
+  auto add_queue = [&](const char* queue, std::function<double()> cb) {
+    m_metric_callback_ids_.emplace_back(registry.AddGaugeCallback(
+        "crane_ctld_queue_depth",
+        "Approximate number of requests waiting in a queue of the scheduler.",
+        {{"queue", queue}}, std::move(cb)));
+  };
+  add_queue("submit", [this] { return m_submit_task_queue_.size_approx(); });
+  add_queue("task_status_change",
+            [this] { return m_task_status_change_queue_.size_approx(); });
+  add_queue("cancel", [this] { return m_cancel_task_queue_.size_approx(); });
+  add_queue("task_timer",
+            [this] { return m_task_timer_queue_.size_approx(); });
+
+  m_metric_callback_ids_.emplace_back(registry.AddGaugeCallback(
+      "crane_ctld_pending_tasks", "Number of pending tasks.", {}, [this] {
+        return m_pending_map_cached_size_.load(std::memory_order_acquire);
+      }));
 }
 
 bool TaskScheduler::Init() {
@@ -66,26 +105,83 @@ bool TaskScheduler::Init() {
     return false;
   }
 
+  using Clock = std::chrono::steady_clock;
+  auto ms_since = [](Clock::time_point begin) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() -
+                                                                 begin)
+        .count();
+  };
+
+  // Rebuilds the tasks of a recovered queue and checks them on g_thread_pool.
+  // AcquireTaskAttributes() and CheckTaskValidity() only read the containers
+  // under their own locks, as they do for concurrent submissions.
+  auto rebuild_tasks =
+      [](std::unordered_map<task_db_id_t, TaskInEmbeddedDb> const& queue,
+         auto const& check, std::vector<task_db_id_t>* db_ids,
+         std::vector<std::unique_ptr<TaskInCtld>>* tasks,
+         std::vector<CraneExpected<void>>* results) {
+        std::vector<const TaskInEmbeddedDb*> entries;
+        entries.reserve(queue.size());
+        for (const auto& [task_db_id, task_in_embedded_db] : queue) {
+          db_ids->emplace_back(task_db_id);
+          entries.emplace_back(&task_in_embedded_db);
+        }
+
+        tasks->resize(entries.size());
+        results->resize(entries.size());
+        ParallelForChunks(
+            entries.size(), kRecoveryParallelChunkNum,
+            [&](size_t begin, size_t end) {
+              for (size_t i = begin; i < end; i++) {
+                auto task = std::make_unique<TaskInCtld>();
+                task->SetFieldsByTaskToCtld(entries[i]->task_to_ctld());
+                // Must be called after SetFieldsByTaskToCtld!
+                task->SetFieldsByRuntimeAttr(entries[i]->runtime_attr());
+                (*results)[i] = check(task.get());
+                (*tasks)[i] = std::move(task);
+              }
+            });
+      };
+
+  // The tasks ended before the restart may still be upstream tasks of the
+  // recovered ones.
+  std::vector<std::pair<task_id_t, crane::grpc::TaskStatus>> final_tasks;
+  for (const auto& task : snapshot.final_queue | std::views::values)
+    final_tasks.emplace_back(task.runtime_attr().task_id(),
+                             task.runtime_attr().status());
+  m_dependency_graph_.AddEndedTasks(final_tasks);
+
   auto& running_queue = snapshot.running_queue;
 
   if (!running_queue.empty()) {
     CRANE_INFO("{} running task(s) recovered.", running_queue.size());
 
-    for (auto&& [task_db_id, task_in_embedded_db] : running_queue) {
-      auto task = std::make_unique<TaskInCtld>();
-      task->SetFieldsByTaskToCtld(task_in_embedded_db.task_to_ctld());
-      // Must be called after SetFieldsByTaskToCtld!
-      task->SetFieldsByRuntimeAttr(task_in_embedded_db.runtime_attr());
+    auto phase_begin = Clock::now();
+    std::vector<task_db_id_t> db_ids;
+    std::vector<std::unique_ptr<TaskInCtld>> tasks;
+    std::vector<CraneExpected<void>> results;
+    rebuild_tasks(running_queue, &AcquireTaskAttributes, &db_ids, &tasks,
+                  &results);
+    auto rebuild_ms = ms_since(phase_begin);
+
+    phase_begin = Clock::now();
+    std::vector<std::unique_ptr<TaskInCtld>> recovered_tasks;
+    recovered_tasks.reserve(tasks.size());
+    for (size_t i = 0; i < tasks.size(); i++) {
+      task_db_id_t task_db_id = db_ids[i];
+      auto& task = tasks[i];
+      auto& result = results[i];
       task_id_t task_id = task->TaskId();
 
-      CRANE_TRACE("Restore task #{} from embedded running queue.",
-                  task->TaskId());
+      CRANE_TRACE_EVERY_N(kPerTaskLogSampleNum,
+                          "Restore task #{} from embedded running queue.",
+                          task->TaskId());
 
-      auto result = AcquireTaskAttributes(task.get());
       if (!result || task->type == crane::grpc::Interactive) {
         task->SetStatus(crane::grpc::Failed);
-        ok = g_embedded_db_client->UpdateRuntimeAttrOfTask(0, task_db_id,
-                                                           task->RuntimeAttr());
+        EmbeddedDbClient::WriteBatch db_batch;
+        db_batch.PutRuntimeAttr(task_db_id, task->RuntimeAttr());
+        ok = g_embedded_db_client->CommitAsync(std::move(db_batch)).get();
         if (!ok) {
           CRANE_ERROR(
               "UpdateRuntimeAttrOfTask failed for task #{} when "
@@ -123,8 +219,12 @@ bool TaskScheduler::Init() {
         // process next task.
         continue;
       }
-      PutRecoveredTaskIntoRunningQueueLock_(std::move(task));
+      recovered_tasks.emplace_back(std::move(task));
     }
+    PutRecoveredTasksIntoRunningQueueLock_(std::move(recovered_tasks));
+
+    CRANE_INFO("Recovering running tasks: rebuild {} ms, insert {} ms.",
+               rebuild_ms, ms_since(phase_begin));
   }
 
   // Process the pending tasks in the embedded pending queue.
@@ -132,36 +232,46 @@ bool TaskScheduler::Init() {
   if (!pending_queue.empty()) {
     CRANE_INFO("{} pending task(s) recovered.", pending_queue.size());
 
-    for (auto&& [task_db_id, task_in_embedded_db] : pending_queue) {
-      auto task = std::make_unique<TaskInCtld>();
-      task->SetFieldsByTaskToCtld(task_in_embedded_db.task_to_ctld());
-      // Must be called after SetFieldsByTaskToCtld!
-      task->SetFieldsByRuntimeAttr(task_in_embedded_db.runtime_attr());
-
-      task_id_t task_id = task->TaskId();
-
-      CRANE_TRACE("Restore task #{} from embedded pending queue.",
-                  task->TaskId());
-
-      bool mark_task_as_failed = false;
-
+    auto check_pending = [](TaskInCtld* task) -> CraneExpected<void> {
       if (task->type != crane::grpc::Batch) {
-        CRANE_INFO("Mark interactive task #{} as FAILED", task_id);
-        mark_task_as_failed = true;
+        CRANE_INFO("Mark interactive task #{} as FAILED", task->TaskId());
+        return std::unexpected(CraneErrCode::ERR_INVALID_PARAM);
       }
 
-      if (!mark_task_as_failed && !(AcquireTaskAttributes(task.get()))) {
-        CRANE_ERROR("AcquireTaskAttributes failed for task #{}", task_id);
-        mark_task_as_failed = true;
+      auto result = AcquireTaskAttributes(task);
+      if (!result) {
+        CRANE_ERROR("AcquireTaskAttributes failed for task #{}",
+                    task->TaskId());
+        return result;
       }
 
-      if (!mark_task_as_failed && !CheckTaskValidity(task.get())) {
-        CRANE_ERROR("CheckTaskValidity failed for task #{}", task_id);
-        mark_task_as_failed = true;
-      }
+      result = CheckTaskValidity(task);
+      if (!result)
+        CRANE_ERROR("CheckTaskValidity failed for task #{}", task->TaskId());
+      return result;
+    };
+
+    auto phase_begin = Clock::now();
+    std::vector<task_db_id_t> db_ids;
+    std::vector<std::unique_ptr<TaskInCtld>> tasks;
+    std::vector<CraneExpected<void>> results;
+    rebuild_tasks(pending_queue, check_pending, &db_ids, &tasks, &results);
+    auto rebuild_ms = ms_since(phase_begin);
+
+    phase_begin = Clock::now();
+    std::vector<std::unique_ptr<TaskInCtld>> recovered_tasks;
+    recovered_tasks.reserve(tasks.size());
+    for (size_t i = 0; i < tasks.size(); i++) {
+      task_db_id_t task_db_id = db_ids[i];
+      auto& task = tasks[i];
+      task_id_t task_id = task->TaskId();
+
+      CRANE_TRACE_EVERY_N(kPerTaskLogSampleNum,
+                          "Restore task #{} from embedded pending queue.",
+                          task->TaskId());
 
-      if (!mark_task_as_failed) {
-        RequeueRecoveredTaskIntoPendingQueueLock_(std::move(task));
+      if (results[i]) {
+        recovered_tasks.emplace_back(std::move(task));
       } else {
         // If a batch task failed to requeue the task into pending queue due to
         // insufficient resource or other reasons or the task is an interactive
@@ -171,8 +281,9 @@ bool TaskScheduler::Init() {
             "move it to the ended queue.",
             task_id);
         task->SetStatus(crane::grpc::Failed);
-        ok = g_embedded_db_client->UpdateRuntimeAttrOfTask(0, task_db_id,
-                                                           task->RuntimeAttr());
+        EmbeddedDbClient::WriteBatch db_batch;
+        db_batch.PutRuntimeAttr(task_db_id, task->RuntimeAttr());
+        ok = g_embedded_db_client->CommitAsync(std::move(db_batch)).get();
         if (!ok) {
           CRANE_ERROR(
               "UpdateRuntimeAttrOfTask failed for task #{} when "
@@ -188,8 +299,8 @@ bool TaskScheduler::Init() {
               task->TaskId());
         }
 
-        std::vector<task_db_id_t> db_ids{task_db_id};
-        ok = g_embedded_db_client->PurgeEndedTasks(db_ids);
+        std::vector<task_db_id_t> purged_db_ids{task_db_id};
+        ok = g_embedded_db_client->PurgeEndedTasks(purged_db_ids);
         if (!ok) {
           CRANE_ERROR(
               "PurgeEndedTasks failed for task #{} when recovering "
@@ -198,6 +309,10 @@ bool TaskScheduler::Init() {
         }
       }
     }
+    RequeueRecoveredTasksIntoPendingQueueLock_(std::move(recovered_tasks));
+
+    CRANE_INFO("Recovering pending tasks: rebuild {} ms, insert {} ms.",
+               rebuild_ms, ms_since(phase_begin));
   }
 
   if (!snapshot.final_queue.empty()) {
@@ -236,6 +351,14 @@ bool TaskScheduler::Init() {
       std::chrono::milliseconds(kTaskHoldTimerTimeoutMs * 3),
       std::chrono::milliseconds(kTaskHoldTimerTimeoutMs));
 
+  m_hold_timer_wheel_handle_ = uvw_release_loop->resource<uvw::timer_handle>();
+  m_hold_timer_wheel_handle_->on<uvw::timer_event>(
+      [this](const uvw::timer_event&, uvw::timer_handle&) {
+        HoldTimerWheelCb_();
+      });
+  m_hold_timer_wheel_handle_->start(std::chrono::seconds(1),
+                                    std::chrono::seconds(1));
+
   m_task_timeout_async_handle_ =
       uvw_release_loop->resource<uvw::async_handle>();
   m_task_timeout_async_handle_->on<uvw::async_event>(
@@ -246,9 +369,8 @@ bool TaskScheduler::Init() {
   m_clean_task_timer_queue_handle_ =
       uvw_release_loop->resource<uvw::async_handle>();
   m_clean_task_timer_queue_handle_->on<uvw::async_event>(
-      [this, loop = uvw_release_loop](const uvw::async_event&,
-                                      uvw::async_handle&) {
-        CleanTaskTimerQueueCb_(loop);
+      [this](const uvw::async_event&, uvw::async_handle&) {
+        CleanTaskTimerQueueCb_();
       });
 
   m_task_release_thread_ = std::thread(
@@ -380,49 +502,113 @@ bool TaskScheduler::Init() {
   }
 
   // Start schedule thread first.
+  m_launch_thread_ = std::thread([this] { LaunchThread_(); });
   m_schedule_thread_ = std::thread([this] { ScheduleThread_(); });
 
+  if (g_config.TaskQuerySnapshotIntervalMs > 0)
+    m_task_info_snapshot_thread_ =
+        std::thread([this] { TaskInfoSnapshotThread_(); });
+
   return true;
 }
 
-void TaskScheduler::RequeueRecoveredTaskIntoPendingQueueLock_(
-    std::unique_ptr<TaskInCtld> task) {
-  CRANE_ASSERT_MSG(
-      g_account_meta_container->TryMallocQosResource(*task) ==
-          CraneErrCode::SUCCESS,
-      fmt::format(
-          "ApplyQosLimitOnTask failed when recovering pending task #{}.",
-          task->TaskId()));
-  // The order of LockGuards matters.
-  LockGuard pending_guard(&m_pending_task_map_mtx_);
-  m_pending_task_map_.emplace(task->TaskId(), std::move(task));
+void TaskScheduler::RequeueRecoveredTasksIntoPendingQueueLock_(
+    std::vector<std::unique_ptr<TaskInCtld>>&& tasks) {
+  for (const auto& task : tasks) {
+    CRANE_ASSERT_MSG(
+        g_account_meta_container->TryMallocQosResource(*task) ==
+            CraneErrCode::SUCCESS,
+        fmt::format(
+            "ApplyQosLimitOnTask failed when recovering pending task #{}.",
+            task->TaskId()));
+    task->PublishSchedAttr();
+  }
+
+  // Upstream tasks which are neither recovered nor ended recently are looked
+  // up in MongoDB. Those not found anywhere fail their dependents.
+  std::vector<TaskInCtld*> task_ptrs;
+  HashSet<task_id_t> recovered_ids;
+  for (const auto& task : tasks) {
+    task_ptrs.emplace_back(task.get());
+    recovered_ids.emplace(task->TaskId());
+  }
+
+  std::vector<task_id_t> unknown_ids;
+  for (const auto& task : tasks)
+    for (task_id_t id : m_dependency_graph_.UnknownUpstreams(
+             task->TaskToCtld().dependencies()))
+      if (!recovered_ids.contains(id)) unknown_ids.emplace_back(id);
+
+  std::vector<task_id_t> missing_ids;
+  if (!unknown_ids.empty() &&
+      LoadEndedUpstreamTasks_(unknown_ids, &missing_ids) &&
+      !missing_ids.empty())
+    CRANE_INFO("Upstream task(s) {} of recovered dependencies are not found.",
+               absl::StrJoin(missing_ids, ","));
+
+  std::vector<TaskDependencyGraph::Resolution> resolutions;
+  {
+    // The order of LockGuards matters.
+    LockGuard pending_guard(&m_pending_task_map_mtx_);
+    for (auto& task : tasks) {
+      m_priority_sorter_->OnPendingTaskAdded(*task);
+      m_task_query_index_.Add(*task);
+      m_pending_task_map_.emplace(task->TaskId(), std::move(task));
+    }
+    m_dependency_graph_.AddTasks(task_ptrs, &resolutions);
+  }
+
+  if (resolutions.empty()) return;
+
+  HashMap<task_id_t, const TaskInCtld*> task_map;
+  for (const TaskInCtld* task : task_ptrs)
+    task_map.emplace(task->TaskId(), task);
+
+  EmbeddedDbClient::WriteBatch db_batch;
+  for (const auto& resolution : resolutions)
+    PutDependencyDelta_(*task_map.at(resolution.dependent_id), resolution,
+                        &db_batch);
+  if (!g_embedded_db_client->CommitAsync(std::move(db_batch)).get())
+    CRANE_ERROR("Failed to persist the dependencies resolved on recovery.");
 }
 
-void TaskScheduler::PutRecoveredTaskIntoRunningQueueLock_(
-    std::unique_ptr<TaskInCtld> task) {
-  auto res = g_account_meta_container->TryMallocQosResource(*task);
-  CRANE_ASSERT_MSG(
-      res == CraneErrCode::SUCCESS,
-      fmt::format(
-          "ApplyQosLimitOnTask failed when recovering running task #{}.",
-          task->TaskId()));
-  for (const CranedId& craned_id : task->CranedIds())
-    g_meta_container->MallocResourceFromNode(craned_id, task->TaskId(),
-                                             task->AllocatedRes());
-  if (!task->reservation.empty()) {
-    g_meta_container->MallocResourceFromResv(
-        task->reservation, task->TaskId(),
-        {task->EndTime(), task->AllocatedRes()});
+void TaskScheduler::PutRecoveredTasksIntoRunningQueueLock_(
+    std::vector<std::unique_ptr<TaskInCtld>>&& tasks) {
+  for (const auto& task : tasks) {
+    auto res = g_account_meta_container->TryMallocQosResource(*task);
+    CRANE_ASSERT_MSG(
+        res == CraneErrCode::SUCCESS,
+        fmt::format(
+            "ApplyQosLimitOnTask failed when recovering running task #{}.",
+            task->TaskId()));
+    g_meta_container->MallocResourceFromNodes(task->TaskId(),
+                                              task->AllocatedRes());
+    if (!task->reservation.empty()) {
+      g_meta_container->MallocResourceFromResv(
+          task->reservation, task->TaskId(),
+          {task->EndTime(), task->AllocatedRes()});
+    }
   }
 
+  std::vector<TaskInCtld*> task_ptrs;
+  for (const auto& task : tasks) task_ptrs.emplace_back(task.get());
+
   // The order of LockGuards matters.
   LockGuard running_guard(&m_running_task_map_mtx_);
   LockGuard indexes_guard(&m_task_indexes_mtx_);
 
-  for (const CranedId& craned_id : task->CranedIds())
-    m_node_to_tasks_map_[craned_id].emplace(task->TaskId());
+  for (auto& task : tasks) {
+    for (const CranedId& craned_id : task->CranedIds())
+      m_node_to_tasks_map_[craned_id].emplace(task->TaskId());
+
+    m_priority_sorter_->OnRunningTaskAdded(*task);
+    m_task_query_index_.Add(*task);
+    m_running_task_map_.emplace(task->TaskId(), std::move(task));
+  }
 
-  m_running_task_map_.emplace(task->TaskId(), std::move(task));
+  // Only tracked as upstream tasks. Their own dependencies are resolved.
+  std::vector<TaskDependencyGraph::Resolution> resolutions;
+  m_dependency_graph_.AddTasks(task_ptrs, &resolutions);
 }
 
 void TaskScheduler::ReleaseTaskThread_(
@@ -549,423 +735,840 @@ void TaskScheduler::ScheduleThread_() {
   std::chrono::steady_clock::time_point begin;
   std::chrono::steady_clock::time_point end;
 
+  bool triggered = true;
   while (!m_thread_stop_) {
+    // Without an event, the cycle would only redo the last one unless a
+    // craned changed or a reservation started. The inputs are recorded for
+    // every cycle, so they are checked first.
+    if (!ScheduleInputsChanged_() && !triggered) {
+      CRANE_TRACE("Scheduling inputs unchanged. Skip the cycle.");
+      triggered = WaitForScheduleTrigger_();
+      continue;
+    }
+
     // Note: In other parts of code, we must avoid the happening of the
     // situation where m_running_task_map_mtx is acquired and then
     // m_pending_task_map_mtx_ needs to be acquired. Deadlock may happen under
     // such a situation.
-    m_pending_task_map_mtx_.Lock();
+    m_submitted_task_buffer_mtx_.Lock();
+    begin = std::chrono::steady_clock::now();
+    // Tasks may be parked while the pending map was held by someone else.
+    if (!m_submitted_task_buffer_.empty()) {
+      m_pending_task_map_mtx_.Lock();
+      MergeSubmittedTaskBufferNoLock_();
+      m_pending_task_map_mtx_.Unlock();
+    }
+    m_pending_task_map_mtx_.ReaderLock();
+    g_scheduler_stats->Record(SchedulerStats::Phase::PendingMapLockWait,
+                              std::chrono::steady_clock::now() - begin);
     if (!m_pending_task_map_.empty()) {  // all_part_metas is locked here.
+      // From now on, submitted tasks are parked in m_submitted_task_buffer_.
+      m_node_selecting_ = true;
+      m_submitted_task_buffer_mtx_.Unlock();
+
       // Running map must be locked before g_meta_container's lock.
       // Otherwise, DEADLOCK may happen because TaskStatusChange() locks running
       // map first and then locks g_meta_container.
-      m_running_task_map_mtx_.Lock();
+      begin = std::chrono::steady_clock::now();
+      m_running_task_map_mtx_.ReaderLock();
+      g_scheduler_stats->Record(SchedulerStats::Phase::RunningMapLockWait,
+                                std::chrono::steady_clock::now() - begin);
 
       schedule_begin = std::chrono::steady_clock::now();
       num_tasks_single_schedule = std::min((size_t)g_config.ScheduledBatchSize,
                                            m_pending_task_map_.size());
+      // Tasks beyond the batch size are not considered in this cycle.
+      if (m_pending_task_map_.size() > g_config.ScheduledBatchSize)
+        TriggerSchedule();
 
       begin = std::chrono::steady_clock::now();
 
-      std::list<INodeSelectionAlgo::NodeSelectionResult> selection_result_list;
-      m_node_selection_algo_->NodeSelect(
-          m_running_task_map_, &m_pending_task_map_, &selection_result_list);
-
-      // Update cached pending map size
-      m_pending_map_cached_size_.store(m_pending_task_map_.size(),
-                                       std::memory_order::release);
-
-      m_running_task_map_mtx_.Unlock();
-      m_pending_task_map_mtx_.Unlock();
+      // Both maps are only locked for reading, so queries are not blocked.
+      std::vector<INodeSelectionAlgo::SelectedTask> selected_tasks;
+      m_node_selection_algo_->NodeSelect(m_running_task_map_,
+                                         m_pending_task_map_, &selected_tasks);
+      // The rest of a pass stopped by the budget is evaluated in the next
+      // cycle.
+      if (m_node_selection_algo_->SelectionResumable()) TriggerSchedule();
 
-      num_tasks_single_execution = selection_result_list.size();
+      m_running_task_map_mtx_.ReaderUnlock();
+      m_pending_task_map_mtx_.ReaderUnlock();
 
       end = std::chrono::steady_clock::now();
+      g_scheduler_stats->Record(SchedulerStats::Phase::NodeSelect, end - begin);
       CRANE_TRACE(
           "NodeSelect costed {} ms",
           std::chrono::duration_cast<std::chrono::milliseconds>(end - begin)
               .count());
 
       begin = std::chrono::steady_clock::now();
-      for (auto& it : selection_result_list) {
-        auto& task = it.first;
-        PartitionId const& partition_id = task->partition_id;
-
-        task->SetStatus(crane::grpc::TaskStatus::Running);
-        task->SetCranedIds(std::move(it.second));
-        task->nodes_alloc = task->CranedIds().size();
 
-        // CRANE_DEBUG(
-        // "Task #{} is allocated to partition {} and craned nodes: {}",
-        // task->TaskId(), partition_id, fmt::join(task->CranedIds(), ", "));
-
-        task->allocated_craneds_regex =
-            util::HostNameListToStr(task->CranedIds());
+      std::list<INodeSelectionAlgo::NodeSelectionResult> selection_result_list;
+      CommitNodeSelection_(&selected_tasks, &selection_result_list, true);
 
-        if (task->ShouldLaunchOnAllNodes()) {
-          for (auto const& craned_id : task->CranedIds())
-            task->executing_craned_ids.emplace_back(craned_id);
-        } else
-          task->executing_craned_ids.emplace_back(task->CranedIds().front());
-      }
+      num_tasks_single_execution = selection_result_list.size();
 
       end = std::chrono::steady_clock::now();
+      g_scheduler_stats->Record(SchedulerStats::Phase::CommitSelection,
+                                end - begin);
       CRANE_TRACE(
-          "Set task fields costed {} ms",
+          "Commit node selection costed {} ms",
           std::chrono::duration_cast<std::chrono::milliseconds>(end - begin)
               .count());
 
-      begin = std::chrono::steady_clock::now();
+      StartSelectedTasks_(&selection_result_list);
 
-      // Add task ids to node maps immediately before CreateCgroupForTasks
-      // to ensure that
-      // if a CraneD crash, the callback of CranedKeeper can call
-      // TerminateTasksOnCraned in which m_node_to_tasks_map_ will be searched
-      // and send TerminateTasksOnCraned to appropriate CraneD
-      // to release the cgroups.
-      m_task_indexes_mtx_.Lock();
-      for (auto& it : selection_result_list) {
-        auto& task = it.first;
-        for (CranedId const& craned_id : task->CranedIds())
-          m_node_to_tasks_map_[craned_id].emplace(task->TaskId());
-      }
-      m_task_indexes_mtx_.Unlock();
-
-      // RPC is time-consuming. Clustering rpc to one craned for performance.
-      HashMap<CranedId, std::vector<crane::grpc::JobToD>> craned_cgroup_map;
-
-      for (auto& it : selection_result_list) {
-        auto& task = it.first;
-        for (CranedId const& craned_id : task->CranedIds())
-          craned_cgroup_map[craned_id].push_back(task->GetJobToD(craned_id));
-      }
-
-      Mutex thread_pool_mtx;
-      HashSet<CranedId> failed_craned_set;
-      HashSet<task_id_t> failed_task_id_set;
-
-      absl::BlockingCounter bl(craned_cgroup_map.size());
-      for (auto&& iter : craned_cgroup_map) {
-        CranedId const& craned_id = iter.first;
-        auto& job_to_d_vec = iter.second;
-
-        g_thread_pool->detach_task([&]() {
-          auto stub = g_craned_keeper->GetCranedStub(craned_id);
-          CRANE_TRACE("Send CreateCgroupForTasks for {} tasks to {}",
-                      job_to_d_vec.size(), craned_id);
-          if (stub == nullptr || stub->Invalid()) {
-            CRANE_TRACE(
-                "CreateCgroupForTasks for {} tasks to {} failed: craned down.",
-                job_to_d_vec.size(), craned_id);
-            failed_craned_set.emplace(craned_id);
-            for (const auto& job_to_d : job_to_d_vec)
-              failed_task_id_set.emplace(job_to_d.job_id());
-            bl.DecrementCount();
-            return;
-          }
+      schedule_end = std::chrono::steady_clock::now();
+      g_scheduler_stats->Record(SchedulerStats::Phase::Cycle,
+                                schedule_end - schedule_begin);
+      g_scheduler_stats->RecordCycle(num_tasks_single_schedule,
+                                     num_tasks_single_execution);
+      CRANE_TRACE(
+          "Scheduling {} pending tasks. {} get scheduled. Time elapsed: {}ms",
+          num_tasks_single_schedule, num_tasks_single_execution,
+          std::chrono::duration_cast<std::chrono::milliseconds>(schedule_end -
+                                                                schedule_begin)
+              .count());
+    } else {
+      m_pending_map_cached_size_.store(m_pending_task_map_.size(),
+                                       std::memory_order::release);
+      m_pending_task_map_mtx_.ReaderUnlock();
+      m_submitted_task_buffer_mtx_.Unlock();
+    }
 
-          auto err = stub->CreateCgroupForJobs(job_to_d_vec);
-          if (err == CraneErrCode::SUCCESS) {
-            bl.DecrementCount();
-            return;
-          }
+    triggered = WaitForScheduleTrigger_();
+  }
+}
 
-          CRANE_TRACE(
-              "CreateCgroupForTasks for {} tasks to {} failed: Rpc failure.",
-              job_to_d_vec.size(), craned_id);
-          thread_pool_mtx.Lock();
-
-          failed_craned_set.emplace(craned_id);
-          for (const auto& job_to_d : job_to_d_vec)
-            failed_task_id_set.emplace(job_to_d.job_id());
-
-          thread_pool_mtx.Unlock();
-
-          // If tasks in task_uid_pairs failed to start,
-          // they will be moved to the completed tasks and do the following
-          // steps:
-          // 1. call g_meta_container->FreeResources() for the failed tasks.
-          // 2. Release all cgroups related to these failed tasks.
-          // 3. Move these tasks to the completed queue.
-          CRANE_ERROR("Craned #{} failed when CreateCgroupForTasks.",
-                      craned_id);
+bool TaskScheduler::ScheduleInputsChanged_() {
+  absl::Time last_time = m_cycle_inputs_time_;
+  m_cycle_inputs_time_ = absl::Now();
+
+  uint64_t seq = g_meta_container->LastCranedChangeSeq();
+  bool changed = seq != m_cycle_craned_change_seq_;
+  m_cycle_craned_change_seq_ = seq;
+  if (changed) return true;
+
+  // Reservations created, deleted or expired trigger a cycle by themselves,
+  // but starting ones do not.
+  auto reservation_meta_map = g_meta_container->GetResvMetaMapPtr();
+  for (auto& reservation_meta : *reservation_meta_map | std::views::values) {
+    auto resv_meta = reservation_meta.GetExclusivePtr();
+    absl::Time start_time = resv_meta->logical_part.start_time;
+    if (last_time < start_time && start_time <= m_cycle_inputs_time_)
+      return true;
+  }
+  return false;
+}
 
-          bl.DecrementCount();
-        });
-      }
-      bl.Wait();
+void TaskScheduler::StartSelectedTasks_(
+    std::list<INodeSelectionAlgo::NodeSelectionResult>*
+        selection_result_list_ptr) {
+  auto& selection_result_list = *selection_result_list_ptr;
 
-      std::list<INodeSelectionAlgo::NodeSelectionResult> failed_result_list;
-      for (auto it = selection_result_list.begin();
-           it != selection_result_list.end();) {
-        auto& task = it->first;
-        if (failed_task_id_set.contains(task->TaskId())) {
-          failed_result_list.emplace_back(std::move(*it));
-          it = selection_result_list.erase(it);
-        } else
-          it = std::next(it);
-      }
+  std::chrono::steady_clock::time_point begin;
+  std::chrono::steady_clock::time_point end;
 
-      // Now we have the ownerships of succeeded tasks in
-      // `selection_result_list` and the ownerships of failed tasks in
-      // `failed_result_list`.
+  begin = std::chrono::steady_clock::now();
+  std::vector<TaskInCtld*> started_task_ptrs;
+  started_task_ptrs.reserve(selection_result_list.size());
+  for (auto& it : selection_result_list) {
+    auto& task = it.first;
+    PartitionId const& partition_id = task->partition_id;
+
+    task->SetStatus(crane::grpc::TaskStatus::Running);
+    started_task_ptrs.emplace_back(task.get());
+    task->SetCranedIds(std::move(it.second));
+    task->nodes_alloc = task->CranedIds().size();
+
+    // CRANE_DEBUG(
+    // "Task #{} is allocated to partition {} and craned nodes: {}",
+    // task->TaskId(), partition_id, fmt::join(task->CranedIds(), ", "));
+
+    task->allocated_craneds_regex = util::HostNameListToStr(task->CranedIds());
+
+    if (task->ShouldLaunchOnAllNodes()) {
+      for (auto const& craned_id : task->CranedIds())
+        task->executing_craned_ids.emplace_back(craned_id);
+    } else
+      task->executing_craned_ids.emplace_back(task->CranedIds().front());
+  }
+  g_task_event_hub->Publish(started_task_ptrs);
+
+  end = std::chrono::steady_clock::now();
+  CRANE_TRACE(
+      "Set task fields costed {} ms",
+      std::chrono::duration_cast<std::chrono::milliseconds>(end - begin)
+          .count());
+
+  begin = std::chrono::steady_clock::now();
+
+  // Add task ids to node maps immediately before CreateCgroupForTasks
+  // to ensure that
+  // if a CraneD crash, the callback of CranedKeeper can call
+  // TerminateTasksOnCraned in which m_node_to_tasks_map_ will be searched
+  // and send TerminateTasksOnCraned to appropriate CraneD
+  // to release the cgroups.
+  m_task_indexes_mtx_.Lock();
+  for (auto& it : selection_result_list) {
+    auto& task = it.first;
+    for (CranedId const& craned_id : task->CranedIds())
+      m_node_to_tasks_map_[craned_id].emplace(task->TaskId());
+  }
+  m_task_indexes_mtx_.Unlock();
+
+  // Prepare everything the launch stage needs.
+  // We do this since the ownership of tasks will be transferred to the
+  // running queue in the following step, after which a task may end and
+  // be destroyed at any time.
+  LaunchBatch batch;
+  m_launch_batch_mtx_.Lock();
+  batch.arena = std::move(m_spare_launch_arena_);
+  m_launch_batch_mtx_.Unlock();
+  if (!batch.arena) batch.arena = std::make_unique<util::ReusableArena>();
+
+  for (auto& it : selection_result_list) {
+    auto& task = it.first;
+
+    // RPC is time-consuming. Clustering rpc to one craned for performance.
+    for (CranedId const& craned_id : task->CranedIds())
+      task->SetFieldsOfJobToD(
+          craned_id, &batch.craned_cgroup_map[craned_id].emplace_back());
+
+    std::string payload_hash;
+    if (g_step_payload_dedup && !task->executing_craned_ids.empty())
+      payload_hash = StepPayloadDedup::Add(*task, &batch.payloads);
+
+    for (const auto& craned_id : task->executing_craned_ids) {
+      auto& req = batch.craned_exec_requests_map[craned_id];
+      if (req == nullptr)
+        req = batch.arena->Create<crane::grpc::ExecuteStepsRequest>();
+      task->SetFieldsOfTaskToD(craned_id, req->add_tasks(), payload_hash);
+      if (!payload_hash.empty())
+        g_step_payload_dedup->Attach(craned_id, payload_hash, batch.payloads,
+                                     req);
+    }
 
-      end = std::chrono::steady_clock::now();
-      CRANE_TRACE(
-          "CreateCgroupForTasks costed {} ms",
-          std::chrono::duration_cast<std::chrono::milliseconds>(end - begin)
-              .count());
+    if (g_config.Plugin.Enabled) {
+      crane::grpc::TaskInfo task_info;
+      task->SetFieldsOfTaskInfo(&task_info);
+      batch.tasks_post_start.emplace_back(std::move(task_info));
+    }
 
-      begin = std::chrono::steady_clock::now();
+    LaunchBatch::TaskLaunchInfo& info =
+        batch.task_launch_info_map[task->TaskId()];
+    info.uid = task->uid;
+    info.craned_ids.assign(task->CranedIds().begin(), task->CranedIds().end());
+    info.executing_craned_ids = task->executing_craned_ids;
+    if (task->type == crane::grpc::Interactive) {
+      info.cb_res_allocated =
+          [cb = std::get<InteractiveMetaInTask>(task->meta)
+                    .cb_task_res_allocated,
+           task_id = task->TaskId(),
+           craned_regex = task->allocated_craneds_regex,
+           craned_ids = task->CranedIds()] {
+            cb(task_id, craned_regex, craned_ids);
+          };
+    }
+  }
 
-      // For tasks whose cgroups are created successfully,
-      // add them to m_node_to_tasks_map_.
-      // For failed tasks,
-      // free all the resource and move them to the completed queue.
-
-      // First handle successful tasks in selection_result_list.
-
-      // Prepare ExecuteTasksRequest.
-      // We do this since the ownership of tasks will be transferred outside
-      // this thread in the following step to move these tasks to ram and DB
-      // running queue before we call stub->ExecuteTasks().
-      HashMap<CranedId, std::vector<TaskInCtld*>>
-          craned_task_to_exec_raw_ptrs_map;
-      std::vector<crane::grpc::TaskInfo> tasks_post_start;
-      for (auto& it : selection_result_list) {
-        auto& task = it.first;
-
-        // We need to copy TaskInCtld here since the ownership of task will be
-        // transferred before we call StartHook.
-        if (g_config.Plugin.Enabled) {
-          crane::grpc::TaskInfo task_info;
-          task->SetFieldsOfTaskInfo(&task_info);
-          tasks_post_start.emplace_back(std::move(task_info));
-        }
+  // Move tasks into running queue.
+  auto db_begin = std::chrono::steady_clock::now();
+  EmbeddedDbClient::WriteBatch db_batch;
+  for (auto& it : selection_result_list) {
+    auto& task = it.first;
 
-        for (const auto& craned_id : task->executing_craned_ids)
-          craned_task_to_exec_raw_ptrs_map[craned_id].emplace_back(task.get());
-      }
+    // IMPORTANT: task must be put into running_task_map before any
+    //  time-consuming operation, otherwise TaskStatusChange RPC will come
+    //  earlier before task is put into running_task_map.
+    db_batch.PutRuntimeAttr(task->TaskDbId(), task->RuntimeAttr());
+  }
 
-      HashMap<CranedId, crane::grpc::ExecuteStepsRequest>
-          craned_exec_requests_map;
-      for (auto& [craned_id, tasks_raw_ptrs] :
-           craned_task_to_exec_raw_ptrs_map) {
-        crane::grpc::ExecuteStepsRequest req;
-        for (TaskInCtld* task : tasks_raw_ptrs) {
-          req.mutable_tasks()->Add(task->GetTaskToD(craned_id));
-        }
-        craned_exec_requests_map.emplace(craned_id, std::move(req));
-      }
+  if (!g_embedded_db_client->CommitAsync(std::move(db_batch)).get()) {
+    CRANE_ERROR("Embedded database failed to commit started tasks.");
+  }
+  g_scheduler_stats->Record(SchedulerStats::Phase::EmbeddedDbCommit,
+                            std::chrono::steady_clock::now() - db_begin);
+
+  // The tasks are in the launch stage as soon as they can be found in the
+  // running queue.
+  m_launching_task_mtx_.Lock();
+  for (task_id_t task_id : batch.task_launch_info_map | std::views::keys)
+    m_launching_task_ids_.emplace(task_id);
+  m_launching_task_mtx_.Unlock();
+
+  // The ownership of TaskInCtld is transferred to the running queue.
+  // The lock is taken once for the whole cycle.
+  auto lock_begin = std::chrono::steady_clock::now();
+  m_running_task_map_mtx_.Lock();
+  g_scheduler_stats->Record(SchedulerStats::Phase::RunningMapLockWait,
+                            std::chrono::steady_clock::now() - lock_begin);
+  for (auto& it : selection_result_list) {
+    auto& task = it.first;
+    m_priority_sorter_->OnRunningTaskAdded(*task);
+    m_running_task_map_.emplace(task->TaskId(), std::move(task));
+  }
+  m_running_task_map_mtx_.Unlock();
+  selection_result_list.clear();
+
+  end = std::chrono::steady_clock::now();
+  CRANE_TRACE(
+      "Move tasks into running queue costed {} ms",
+      std::chrono::duration_cast<std::chrono::milliseconds>(end - begin)
+          .count());
+
+  // The resources of the tasks stay allocated in g_meta_container while
+  // the launch stage creates the cgroups and executes the tasks. The next
+  // cycle selects nodes in the meantime. Tasks failing to launch are
+  // ended through TaskStatusChange, which frees their resources.
+  if (!batch.task_launch_info_map.empty()) {
+    begin = std::chrono::steady_clock::now();
+    auto slot_free = [this] { return !m_launch_batch_.has_value(); };
+    m_launch_batch_mtx_.LockWhen(absl::Condition(&slot_free));
+    g_scheduler_stats->Record(SchedulerStats::Phase::LaunchStageWait,
+                              std::chrono::steady_clock::now() - begin);
+    m_launch_batch_ = std::move(batch);
+    m_launch_batch_mtx_.Unlock();
+  }
+}
 
-      // Move tasks into running queue.
-      txn_id_t txn_id{0};
-      bool ok = g_embedded_db_client->BeginVariableDbTransaction(&txn_id);
-      if (!ok) {
-        CRANE_ERROR(
-            "TaskScheduler failed to start transaction when scheduling.");
-      }
+void TaskScheduler::LaunchThread_() {
+  util::SetCurrentThreadName("LaunchThread");
 
-      for (auto& it : selection_result_list) {
-        auto& task = it.first;
+  auto batch_ready = [this] {
+    return m_launch_batch_.has_value() || m_launch_thread_stop_;
+  };
 
-        // IMPORTANT: task must be put into running_task_map before any
-        //  time-consuming operation, otherwise TaskStatusChange RPC will come
-        //  earlier before task is put into running_task_map.
-        g_embedded_db_client->UpdateRuntimeAttrOfTask(txn_id, task->TaskDbId(),
-                                                      task->RuntimeAttr());
-      }
+  while (true) {
+    m_launch_batch_mtx_.LockWhen(absl::Condition(&batch_ready));
+    if (!m_launch_batch_.has_value()) {
+      m_launch_batch_mtx_.Unlock();
+      break;
+    }
+    LaunchBatch batch = std::move(m_launch_batch_.value());
+    m_launch_batch_mtx_.Unlock();
+
+    LaunchTasks_(&batch);
+
+    // The requests die with the arena, which is reset here rather than on
+    // the schedule thread.
+    batch.craned_exec_requests_map.clear();
+    batch.arena->Reset();
+
+    // Free the slot only after the batch is launched so that at most one
+    // batch is in the launch stage while the next cycle is selecting nodes.
+    m_launch_batch_mtx_.Lock();
+    m_launch_batch_.reset();
+    m_spare_launch_arena_ = std::move(batch.arena);
+    m_launch_batch_mtx_.Unlock();
+  }
+}
 
-      ok = g_embedded_db_client->CommitVariableDbTransaction(txn_id);
-      if (!ok) {
-        CRANE_ERROR("Embedded database failed to commit manual transaction.");
-      }
-
-      // Set succeed tasks status and do callbacks.
-      for (auto& it : selection_result_list) {
-        auto& task = it.first;
-        if (task->type == crane::grpc::Interactive) {
-          const auto& meta = std::get<InteractiveMetaInTask>(task->meta);
-          std::get<InteractiveMetaInTask>(task->meta)
-              .cb_task_res_allocated(task->TaskId(),
-                                     task->allocated_craneds_regex,
-                                     task->CranedIds());
-        }
+void TaskScheduler::LaunchTasks_(LaunchBatch* batch) {
+  std::chrono::steady_clock::time_point begin;
+  std::chrono::steady_clock::time_point end;
 
-        // The ownership of TaskInCtld is transferred to the running queue.
-        m_running_task_map_mtx_.Lock();
-        m_running_task_map_.emplace(task->TaskId(), std::move(task));
-        m_running_task_map_mtx_.Unlock();
-      }
+  begin = std::chrono::steady_clock::now();
 
-      end = std::chrono::steady_clock::now();
-      CRANE_TRACE(
-          "Move tasks into running queue costed {} ms",
-          std::chrono::duration_cast<std::chrono::milliseconds>(end - begin)
-              .count());
+  HashSet<task_id_t> failed_task_id_set;
 
-      begin = std::chrono::steady_clock::now();
+  HashMap<CranedId, std::vector<task_id_t>> tree_results;
+  if (UseLaunchTree_(batch->craned_cgroup_map.size())) {
+    std::vector<crane::grpc::LaunchTreeNode> nodes;
+    nodes.reserve(batch->craned_cgroup_map.size());
+    for (const auto& [craned_id, job_to_d_vec] : batch->craned_cgroup_map) {
+      auto& node = nodes.emplace_back();
+      node.set_craned_id(craned_id);
+      auto* job_list = node.mutable_create_cgroup()->mutable_job_list();
+      job_list->Add(job_to_d_vec.begin(), job_to_d_vec.end());
+    }
+    tree_results = LaunchByTree_(std::move(nodes));
+  }
 
-      // TODO: Refactor here! Add filter chain for post-scheduling stage.
-      absl::Time post_sched_time_point = absl::Now();
-      for (auto const& craned_id :
-           craned_exec_requests_map | std::ranges::views::keys) {
-        g_meta_container->GetCranedMetaPtr(craned_id)->last_busy_time =
-            post_sched_time_point;
-      }
+  std::vector<CranedId> cgroup_craned_ids =
+      batch->craned_cgroup_map | std::views::keys |
+      std::views::filter([&](const CranedId& craned_id) {
+        return !tree_results.contains(craned_id);
+      }) |
+      std::ranges::to<std::vector<CranedId>>();
+  std::vector<CraneErrCode> cgroup_results = g_craned_keeper->Broadcast(
+      cgroup_craned_ids, [batch](const CranedId& craned_id, CranedStub* stub) {
+        const auto& job_to_d_vec = batch->craned_cgroup_map.at(craned_id);
+        CRANE_TRACE("Send CreateCgroupForTasks for {} tasks to {}",
+                    job_to_d_vec.size(), craned_id);
+        return stub->CreateCgroupForJobs(job_to_d_vec);
+      },
+      kCranedBroadcastMaxInFlight, absl::InfiniteDuration());
+
+  for (size_t i = 0; i < cgroup_craned_ids.size(); i++) {
+    if (cgroup_results[i] == CraneErrCode::SUCCESS) continue;
+
+    const CranedId& craned_id = cgroup_craned_ids[i];
+    if (cgroup_results[i] == CraneErrCode::ERR_INVALID_STUB)
+      CRANE_TRACE("CreateCgroupForTasks to {} failed: craned down.",
+                  craned_id);
+    else
+      CRANE_ERROR("Craned #{} failed when CreateCgroupForTasks.", craned_id);
 
-      std::unordered_map<
-          CranedId, std::pair<std::vector<job_id_t>, uint16_t /*exit_code*/>>
-          failed_to_exec_job_id_map;
-      for (auto const& [craned_id, tasks] : craned_exec_requests_map) {
-        auto stub = g_craned_keeper->GetCranedStub(craned_id);
-        CRANE_TRACE("Send ExecuteTasks for {} tasks to {}", tasks.tasks_size(),
-                    craned_id);
-        if (stub == nullptr || stub->Invalid()) {
-          for (auto& task : tasks.tasks()) {
-            failed_to_exec_job_id_map[craned_id].first.push_back(
-                task.task_id());
-            failed_to_exec_job_id_map[craned_id].second =
-                ExitCode::kExitCodeRpcError;
-          }
-          continue;
-        }
+    for (const auto& job_to_d : batch->craned_cgroup_map.at(craned_id))
+      failed_task_id_set.emplace(job_to_d.job_id());
+  }
 
-        CraneExpected failed_task_ids = stub->ExecuteSteps(tasks);
-        if (!failed_task_ids.has_value()) {
-          for (auto& task : tasks.tasks()) {
-            failed_to_exec_job_id_map[craned_id].first.push_back(
-                task.task_id());
-            failed_to_exec_job_id_map[craned_id].second =
-                ExitCode::kExitCodeRpcError;
-          }
-        } else if (!failed_task_ids.value().empty()) {
-          failed_to_exec_job_id_map[craned_id].first =
-              std::move(failed_task_ids.value());
-          failed_to_exec_job_id_map[craned_id].second =
-              ExitCode::kExitCodeExecutionError;
-        }
+  end = std::chrono::steady_clock::now();
+  g_scheduler_stats->Record(SchedulerStats::Phase::CreateCgroup, end - begin);
+  CRANE_TRACE(
+      "CreateCgroupForTasks costed {} ms",
+      std::chrono::duration_cast<std::chrono::milliseconds>(end - begin)
+          .count());
+
+  begin = std::chrono::steady_clock::now();
+
+  // The tasks may end or be terminated while their cgroups are being
+  // created. The ended ones have left the running queue and the cgroups
+  // created for them are released on all their nodes. The terminated ones
+  // have no steps on the craneds yet and are ended here.
+  HashSet<task_id_t> ended_task_id_set;
+  m_running_task_map_mtx_.ReaderLock();
+  for (task_id_t task_id : batch->task_launch_info_map | std::views::keys) {
+    if (!failed_task_id_set.contains(task_id) &&
+        !m_running_task_map_.contains(task_id))
+      ended_task_id_set.emplace(task_id);
+  }
+  m_running_task_map_mtx_.ReaderUnlock();
+
+  HashSet<task_id_t> terminated_task_id_set;
+  m_launching_task_mtx_.Lock();
+  for (task_id_t task_id : batch->task_launch_info_map | std::views::keys) {
+    if (m_launch_terminated_task_ids_.erase(task_id) &&
+        !failed_task_id_set.contains(task_id) &&
+        !ended_task_id_set.contains(task_id))
+      terminated_task_id_set.emplace(task_id);
+  }
+  m_launching_task_mtx_.Unlock();
+
+  HashSet<task_id_t> dropped_task_id_set;
+  dropped_task_id_set.insert(failed_task_id_set.begin(),
+                             failed_task_id_set.end());
+  dropped_task_id_set.insert(terminated_task_id_set.begin(),
+                             terminated_task_id_set.end());
+  dropped_task_id_set.insert(ended_task_id_set.begin(),
+                             ended_task_id_set.end());
+
+  if (!dropped_task_id_set.empty()) {
+    // The failed and the terminated tasks are still in the running queue.
+    // End them through TaskStatusChange, which frees their resources and
+    // releases the cgroups on their executing craned nodes. Cgroups on the
+    // other allocated nodes are released here.
+    HashMap<CranedId, std::vector<std::pair<task_id_t, uid_t>>>
+        craned_cgroup_map_to_release;
+    auto end_task = [&](task_id_t task_id, crane::grpc::TaskStatus status,
+                        uint32_t exit_code) {
+      const auto& info = batch->task_launch_info_map.at(task_id);
+      for (CranedId const& craned_id : info.craned_ids) {
+        if (!std::ranges::contains(info.executing_craned_ids, craned_id))
+          craned_cgroup_map_to_release[craned_id].emplace_back(task_id,
+                                                               info.uid);
       }
+      for (CranedId const& craned_id : info.executing_craned_ids)
+        TaskStatusChangeAsync(task_id, craned_id, status, exit_code);
+    };
+    for (task_id_t task_id : failed_task_id_set)
+      end_task(task_id, crane::grpc::TaskStatus::Failed,
+               ExitCode::kExitCodeRpcError);
+    for (task_id_t task_id : terminated_task_id_set)
+      end_task(task_id, crane::grpc::TaskStatus::Cancelled,
+               ExitCode::kExitCodeTerminated);
+    for (task_id_t task_id : ended_task_id_set) {
+      const auto& info = batch->task_launch_info_map.at(task_id);
+      for (CranedId const& craned_id : info.craned_ids)
+        craned_cgroup_map_to_release[craned_id].emplace_back(task_id,
+                                                             info.uid);
+    }
 
-      // After sending ExecuteTasks RPC, StartHook is called.
-      // This must before checking failed tasks as TaskStatusChangeAsync may
-      // trigger EndHook.
-      if (g_config.Plugin.Enabled && !tasks_post_start.empty()) {
-        g_plugin_client->StartHookAsync(std::move(tasks_post_start));
-      }
+    // Release the cgroups asynchronously. Craneds down are ignored.
+    if (!craned_cgroup_map_to_release.empty())
+      g_thread_pool->detach_task([cgroups_map = std::move(
+                                      craned_cgroup_map_to_release)] {
+        g_craned_keeper->Broadcast(
+            cgroups_map | std::views::keys |
+                std::ranges::to<std::vector<CranedId>>(),
+            [&](const CranedId& craned_id, CranedStub* stub) {
+              const auto& cgroups = cgroups_map.at(craned_id);
+              CraneErrCode err = stub->ReleaseCgroupForJobs(cgroups);
+              if (err != CraneErrCode::SUCCESS)
+                CRANE_ERROR(
+                    "Failed to Release cgroup RPC for {} tasks on Node {}",
+                    cgroups.size(), craned_id);
+              return err;
+            });
+      });
 
-      // If any task failed during this stage,
-      // call TaskStatusChangeAsync since the ownership of tasks
-      // has been transferred.
-      for (auto& [craned_id, task_status] : failed_to_exec_job_id_map) {
-        CRANE_ERROR("Task [{}] on {} failed to execute.",
-                    absl::StrJoin(task_status.first, ","), craned_id);
-        for (auto task_id : task_status.first)
-          TaskStatusChangeAsync(task_id, craned_id,
-                                crane::grpc::TaskStatus::Failed,
-                                task_status.second);
-        g_thread_pool->detach_task(
-            [craned_id, steps = std::move(task_status.first)]() {
-              auto stub = g_craned_keeper->GetCranedStub(craned_id);
+    // Dropped tasks are not executed.
+    for (auto& [craned_id, req] : batch->craned_exec_requests_map) {
+      auto* tasks = req->mutable_tasks();
+      tasks->erase(std::remove_if(tasks->begin(), tasks->end(),
+                                  [&](const crane::grpc::TaskToD& task) {
+                                    return dropped_task_id_set.contains(
+                                        task.task_id());
+                                  }),
+                   tasks->end());
+    }
+    absl::erase_if(batch->craned_exec_requests_map, [](const auto& kv) {
+      return kv.second->tasks().empty();
+    });
+    std::erase_if(batch->tasks_post_start,
+                  [&](const crane::grpc::TaskInfo& task_info) {
+                    return dropped_task_id_set.contains(task_info.task_id());
+                  });
+
+    if (!failed_task_id_set.empty())
+      CRANE_ERROR("{} tasks failed to create cgroups.",
+                  failed_task_id_set.size());
+    if (!terminated_task_id_set.empty() || !ended_task_id_set.empty())
+      CRANE_TRACE("{} tasks terminated and {} tasks ended before execution.",
+                  terminated_task_id_set.size(), ended_task_id_set.size());
+  }
 
-              // If the craned is down, just ignore it.
-              if (stub == nullptr || stub->Invalid()) return;
+  // Set succeed tasks status and do callbacks.
+  for (auto& [task_id, info] : batch->task_launch_info_map) {
+    if (info.cb_res_allocated && !dropped_task_id_set.contains(task_id))
+      info.cb_res_allocated();
+  }
 
-              CraneErrCode err = stub->FreeSteps(steps);
-              if (err != CraneErrCode::SUCCESS)
-                CRANE_ERROR("Failed to FreeSteps RPC for {} tasks on Node {}",
-                            steps.size(), craned_id);
-            });
-      }
+  // TODO: Refactor here! Add filter chain for post-scheduling stage.
+  absl::Time post_sched_time_point = absl::Now();
+  for (auto const& craned_id :
+       batch->craned_exec_requests_map | std::ranges::views::keys) {
+    g_meta_container->GetCranedMetaPtr(craned_id)->last_busy_time =
+        post_sched_time_point;
+  }
 
-      end = std::chrono::steady_clock::now();
-      CRANE_TRACE(
-          "ExecuteTasks costed {} ms",
-          std::chrono::duration_cast<std::chrono::milliseconds>(end - begin)
-              .count());
+  std::unordered_map<
+      CranedId, std::pair<std::vector<job_id_t>, uint16_t /*exit_code*/>>
+      failed_to_exec_job_id_map;
+  DispatchExecuteSteps_(batch->craned_exec_requests_map, batch->payloads,
+                        &failed_to_exec_job_id_map);
+
+  // After sending ExecuteTasks RPC, StartHook is called.
+  // This must before checking failed tasks as TaskStatusChangeAsync may
+  // trigger EndHook.
+  if (g_config.Plugin.Enabled && !batch->tasks_post_start.empty()) {
+    g_plugin_client->StartHookAsync(std::move(batch->tasks_post_start));
+  }
 
-      schedule_end = end;
-      CRANE_TRACE(
-          "Scheduling {} pending tasks. {} get scheduled. Time elapsed: {}ms",
-          num_tasks_single_schedule, num_tasks_single_execution,
-          std::chrono::duration_cast<std::chrono::milliseconds>(schedule_end -
-                                                                schedule_begin)
-              .count());
+  // If any task failed during this stage,
+  // call TaskStatusChangeAsync since the ownership of tasks
+  // has been transferred.
+  for (auto& [craned_id, task_status] : failed_to_exec_job_id_map) {
+    CRANE_ERROR("Task [{}] on {} failed to execute.",
+                absl::StrJoin(task_status.first, ","), craned_id);
+    for (auto task_id : task_status.first)
+      TaskStatusChangeAsync(task_id, craned_id, crane::grpc::TaskStatus::Failed,
+                            task_status.second);
+  }
+  if (!failed_to_exec_job_id_map.empty()) {
+    g_thread_pool->detach_task([failed_map =
+                                    std::move(failed_to_exec_job_id_map)] {
+      // Craneds down are ignored.
+      g_craned_keeper->Broadcast(
+          failed_map | std::views::keys |
+              std::ranges::to<std::vector<CranedId>>(),
+          [&](const CranedId& craned_id, CranedStub* stub) {
+            const auto& steps = failed_map.at(craned_id).first;
+            CraneErrCode err = stub->FreeSteps(steps);
+            if (err != CraneErrCode::SUCCESS)
+              CRANE_ERROR("Failed to FreeSteps RPC for {} tasks on Node {}",
+                          steps.size(), craned_id);
+            return err;
+          });
+    });
+  }
 
-      if (!failed_result_list.empty()) {
-        // Then handle failed tasks in failed_result_list if there's any.
-        begin = std::chrono::steady_clock::now();
-
-        for (auto& it : failed_result_list) {
-          auto& task = it.first;
-          for (CranedId const& craned_id : task->CranedIds())
-            g_meta_container->FreeResourceFromNode(craned_id, task->TaskId());
-          if (task->reservation != "")
-            g_meta_container->FreeResourceFromResv(task->reservation,
-                                                   task->TaskId());
-          g_account_meta_container->FreeQosResource(*task);
-        }
+  // The steps of the batch are on the craneds now, so the tasks terminated
+  // since the check above are terminated there.
+  bool cancel_enqueued = false;
+  m_launching_task_mtx_.Lock();
+  for (const auto& [task_id, info] : batch->task_launch_info_map) {
+    m_launching_task_ids_.erase(task_id);
+    if (!m_launch_terminated_task_ids_.erase(task_id) ||
+        dropped_task_id_set.contains(task_id))
+      continue;
+    for (CranedId const& craned_id : info.executing_craned_ids) {
+      m_cancel_task_queue_.enqueue(
+          CancelRunningTaskQueueElem{task_id, craned_id});
+      cancel_enqueued = true;
+    }
+  }
+  m_launching_task_mtx_.Unlock();
+  if (cancel_enqueued) m_cancel_task_async_handle_->send();
+
+  end = std::chrono::steady_clock::now();
+  g_scheduler_stats->Record(SchedulerStats::Phase::ExecuteSteps, end - begin);
+  CRANE_TRACE(
+      "ExecuteTasks costed {} ms",
+      std::chrono::duration_cast<std::chrono::milliseconds>(end - begin)
+          .count());
+}
 
-        // Construct the map for cgroups to be released of all failed tasks
-        HashMap<CranedId, std::vector<std::pair<task_id_t, uid_t>>>
-            craned_cgroup_map_to_release;
-        for (auto& it : failed_result_list) {
-          auto& task = it.first;
-          for (CranedId const& craned_id : task->CranedIds())
-            craned_cgroup_map_to_release[craned_id].emplace_back(task->TaskId(),
-                                                                 task->uid);
-        }
+bool TaskScheduler::WaitForScheduleTrigger_() {
+  // Events arriving during the gap are handled together by the next cycle.
+  // Only the tasks queued for the fast lane are handled as soon as they come.
+  absl::Time min_deadline =
+      absl::Now() + absl::Milliseconds(kTaskScheduleMinIntervalMs);
+  absl::Time max_deadline =
+      min_deadline + absl::Milliseconds(kTaskScheduleMaxIntervalMs);
+
+  auto fast_lane_ready = [this] { return !m_fast_lane_task_ids_.empty(); };
+  auto cycle_ready = [this] {
+    return m_schedule_triggered_ || !m_fast_lane_task_ids_.empty();
+  };
 
-        // Release the cgroups asynchronously.
-        for (auto const& iter : craned_cgroup_map_to_release) {
-          CranedId const& craned_id = iter.first;
-          auto& task_uid_pairs = iter.second;
+  LockGuard trigger_guard(&m_schedule_trigger_mtx_);
+  while (true) {
+    bool cycle_due = absl::Now() >= min_deadline;
+    if (cycle_due)
+      m_schedule_trigger_mtx_.AwaitWithDeadline(absl::Condition(&cycle_ready),
+                                                max_deadline);
+    else
+      m_schedule_trigger_mtx_.AwaitWithDeadline(
+          absl::Condition(&fast_lane_ready), min_deadline);
+
+    if (!m_fast_lane_task_ids_.empty()) {
+      std::vector<task_id_t> task_ids;
+      task_ids.swap(m_fast_lane_task_ids_);
+      m_schedule_trigger_mtx_.Unlock();
+      RunFastLane_(task_ids);
+      m_schedule_trigger_mtx_.Lock();
+      continue;
+    }
 
-          g_thread_pool->detach_task([=, cgroups_to_release =
-                                             std::move(task_uid_pairs)]() {
-            auto stub = g_craned_keeper->GetCranedStub(craned_id);
+    if (cycle_due) break;
+  }
+  bool triggered = m_schedule_triggered_;
+  m_schedule_triggered_ = false;
+  return triggered;
+}
 
-            // If the craned is down, just ignore it.
-            if (stub == nullptr || stub->Invalid()) return;
+void TaskScheduler::RunFastLane_(const std::vector<task_id_t>& task_ids) {
+  auto begin = std::chrono::steady_clock::now();
+
+  // Tasks submitted meanwhile are parked in the buffer as in a scheduling
+  // cycle. The running map is not needed, since only the resources left by
+  // the last cycle are looked at.
+  m_submitted_task_buffer_mtx_.Lock();
+  m_pending_task_map_mtx_.ReaderLock();
+  m_node_selecting_ = true;
+  m_submitted_task_buffer_mtx_.Unlock();
+
+  std::vector<INodeSelectionAlgo::SelectedTask> selected_tasks;
+  m_node_selection_algo_->FastLaneSelect(m_pending_task_map_, task_ids,
+                                         &selected_tasks);
+
+  m_pending_task_map_mtx_.ReaderUnlock();
+
+  // The scheduling fields of the other pending tasks are not changed, so
+  // they are not published again.
+  std::list<INodeSelectionAlgo::NodeSelectionResult> selection_result_list;
+  CommitNodeSelection_(&selected_tasks, &selection_result_list, false);
+
+  size_t started_task_num = selection_result_list.size();
+  if (!selection_result_list.empty())
+    StartSelectedTasks_(&selection_result_list);
+
+  auto end = std::chrono::steady_clock::now();
+  g_scheduler_stats->Record(SchedulerStats::Phase::FastLane, end - begin);
+  CRANE_TRACE(
+      "Fast lane started {} of {} interactive tasks in {} ms.",
+      started_task_num, task_ids.size(),
+      std::chrono::duration_cast<std::chrono::milliseconds>(end - begin)
+          .count());
+}
 
-            CraneErrCode err = stub->ReleaseCgroupForJobs(cgroups_to_release);
-            if (err != CraneErrCode::SUCCESS)
-              CRANE_ERROR(
-                  "Failed to Release cgroup RPC for {} tasks on Node {}",
-                  cgroups_to_release.size(), craned_id);
-          });
-        }
+void TaskScheduler::DispatchExecuteSteps_(
+    const HashMap<CranedId, crane::grpc::ExecuteStepsRequest*>&
+        craned_exec_requests_map,
+    const StepPayloadDedup::PayloadMap& payloads,
+    std::unordered_map<CranedId, std::pair<std::vector<job_id_t>, uint16_t>>*
+        failed_to_exec_job_id_map) {
+  // One slow craned must not delay the job starts on the others, so the RPCs
+  // are sent concurrently with at most MaxConcurrentExecuteStepsRpc in flight.
+  Mutex mtx;
+  auto record_failure = [&](const CranedId& craned_id,
+                            std::vector<job_id_t>&& job_ids,
+                            uint16_t exit_code) {
+    LockGuard guard(&mtx);
+    auto& [failed_ids, failed_exit_code] =
+        (*failed_to_exec_job_id_map)[craned_id];
+    failed_ids.insert(failed_ids.end(), job_ids.begin(), job_ids.end());
+    failed_exit_code = exit_code;
+  };
+
+  HashMap<CranedId, std::vector<task_id_t>> payload_missed;
+
+  auto all_job_ids = [](const crane::grpc::ExecuteStepsRequest& tasks) {
+    std::vector<job_id_t> job_ids;
+    job_ids.reserve(tasks.tasks_size());
+    for (const auto& task : tasks.tasks()) job_ids.push_back(task.task_id());
+    return job_ids;
+  };
+
+  HashMap<CranedId, std::vector<task_id_t>> tree_results;
+  if (UseLaunchTree_(craned_exec_requests_map.size())) {
+    std::vector<crane::grpc::LaunchTreeNode> nodes;
+    nodes.reserve(craned_exec_requests_map.size());
+    for (const auto& [craned_id, tasks] : craned_exec_requests_map) {
+      auto& node = nodes.emplace_back();
+      node.set_craned_id(craned_id);
+      *node.mutable_execute_steps() = *tasks;
+    }
+    tree_results = LaunchByTree_(std::move(nodes), &payload_missed);
+  }
+
+  for (auto& [craned_id, failed_task_ids] : tree_results) {
+    if (!failed_task_ids.empty())
+      record_failure(craned_id, std::move(failed_task_ids),
+                     ExitCode::kExitCodeExecutionError);
+  }
 
-        // Move failed tasks to the completed queue.
-        std::vector<TaskInCtld*> failed_task_raw_ptrs;
-        for (auto& it : failed_result_list) {
-          auto& task = it.first;
-          failed_task_raw_ptrs.emplace_back(task.get());
+  std::vector<CranedId> craned_ids =
+      craned_exec_requests_map | std::views::keys |
+      std::views::filter([&](const CranedId& craned_id) {
+        return !tree_results.contains(craned_id);
+      }) |
+      std::ranges::to<std::vector<CranedId>>();
+  std::vector<CraneErrCode> results = g_craned_keeper->Broadcast(
+      craned_ids,
+      [&](const CranedId& craned_id, CranedStub* stub) {
+        const auto& tasks = *craned_exec_requests_map.at(craned_id);
+        CRANE_TRACE("Send ExecuteTasks for {} tasks to {}", tasks.tasks_size(),
+                    craned_id);
 
-          task->SetStatus(crane::grpc::Failed);
-          task->SetExitCode(ExitCode::kExitCodeRpcError);
-          task->SetEndTime(absl::Now());
+        auto rpc_begin = std::chrono::steady_clock::now();
+        std::vector<task_id_t> missed_task_ids;
+        CraneExpected failed_task_ids =
+            stub->ExecuteSteps(tasks, &missed_task_ids);
+        g_scheduler_stats->RecordCranedDispatch(
+            craned_id, std::chrono::steady_clock::now() - rpc_begin);
+
+        if (!failed_task_ids.has_value()) return failed_task_ids.error();
+
+        if (!failed_task_ids.value().empty())
+          record_failure(craned_id, std::move(failed_task_ids.value()),
+                         ExitCode::kExitCodeExecutionError);
+        if (!missed_task_ids.empty()) {
+          LockGuard guard(&mtx);
+          payload_missed[craned_id] = std::move(missed_task_ids);
         }
-        ProcessFinalTasks_(failed_task_raw_ptrs);
+        return CraneErrCode::SUCCESS;
+      },
+      g_config.MaxConcurrentExecuteStepsRpc, absl::InfiniteDuration());
+
+  // All the jobs on a craned which is down or not reached failed.
+  for (size_t i = 0; i < craned_ids.size(); i++) {
+    if (results[i] == CraneErrCode::SUCCESS) continue;
+    record_failure(craned_ids[i],
+                   all_job_ids(*craned_exec_requests_map.at(craned_ids[i])),
+                   ExitCode::kExitCodeRpcError);
+  }
 
-        // Failed tasks have been handled properly. Free them explicitly.
-        failed_result_list.clear();
+  if (payload_missed.empty()) return;
 
-        end = std::chrono::steady_clock::now();
-        CRANE_TRACE(
-            "Handling failed tasks costed {} ms",
-            std::chrono::duration_cast<std::chrono::milliseconds>(end - begin)
-                .count());
-      }
-    } else {
-      m_pending_map_cached_size_.store(m_pending_task_map_.size(),
-                                       std::memory_order::release);
-      m_pending_task_map_mtx_.Unlock();
-    }
+  // The craned lost the payloads the mirror expects, e.g. by a restart. Its
+  // tasks without a payload are sent again with all the payloads attached.
+  HashMap<CranedId, crane::grpc::ExecuteStepsRequest> resend_requests;
+  for (const auto& [craned_id, task_ids] : payload_missed) {
+    if (g_step_payload_dedup) g_step_payload_dedup->Forget(craned_id);
 
-    std::this_thread::sleep_for(
-        std::chrono::milliseconds(kTaskScheduleIntervalMs));
+    HashSet<task_id_t> task_id_set(task_ids.begin(), task_ids.end());
+    auto& request = resend_requests[craned_id];
+    for (const auto& task : craned_exec_requests_map.at(craned_id)->tasks())
+      if (task_id_set.contains(task.task_id())) *request.add_tasks() = task;
+    StepPayloadDedup::AttachAll(payloads, &request);
+  }
+  CRANE_DEBUG("Sending the tasks again to {} craneds which missed payloads.",
+              resend_requests.size());
+
+  std::vector<CranedId> resend_craned_ids =
+      resend_requests | std::views::keys |
+      std::ranges::to<std::vector<CranedId>>();
+  results = g_craned_keeper->Broadcast(
+      resend_craned_ids,
+      [&](const CranedId& craned_id, CranedStub* stub) {
+        CraneExpected failed_task_ids =
+            stub->ExecuteSteps(resend_requests.at(craned_id));
+        if (!failed_task_ids.has_value()) return failed_task_ids.error();
+
+        if (!failed_task_ids.value().empty())
+          record_failure(craned_id, std::move(failed_task_ids.value()),
+                         ExitCode::kExitCodeExecutionError);
+        return CraneErrCode::SUCCESS;
+      },
+      g_config.MaxConcurrentExecuteStepsRpc, absl::InfiniteDuration());
+
+  for (size_t i = 0; i < resend_craned_ids.size(); i++) {
+    if (results[i] == CraneErrCode::SUCCESS) continue;
+    record_failure(resend_craned_ids[i],
+                   all_job_ids(resend_requests.at(resend_craned_ids[i])),
+                   ExitCode::kExitCodeRpcError);
+  }
+}
+
+HashMap<CranedId, std::vector<task_id_t>> TaskScheduler::LaunchByTree_(
+    std::vector<crane::grpc::LaunchTreeNode>&& nodes,
+    HashMap<CranedId, std::vector<task_id_t>>* payload_missed) {
+  const uint32_t fan_out = g_config.LaunchTreeFanOut;
+  std::ranges::sort(nodes, {}, &crane::grpc::LaunchTreeNode::craned_id);
+
+  // Ctld is the root of fan_out trees of neighbouring craneds. In each tree
+  // the children of node i are the nodes fan_out * i + 1 ... fan_out * i +
+  // fan_out, which are moved into it from the last one.
+  HashMap<CranedId, std::pair<crane::grpc::LaunchTreeRequest, uint32_t>>
+      tree_requests;
+  size_t tree_size = (nodes.size() + fan_out - 1) / fan_out;
+  for (size_t begin = 0; begin < nodes.size(); begin += tree_size) {
+    std::span tree(nodes.begin() + begin,
+                   std::min(tree_size, nodes.size() - begin));
+    for (size_t i = tree.size() - 1; i > 0; i--)
+      *tree[(i - 1) / fan_out].add_children() = std::move(tree[i]);
+
+    uint32_t depth = 0;
+    for (size_t i = 0; i * fan_out + 1 < tree.size(); i = i * fan_out + 1)
+      depth++;
+
+    CranedId root_id = tree[0].craned_id();
+    auto& [request, request_depth] = tree_requests[root_id];
+    *request.mutable_root() = std::move(tree[0]);
+    request_depth = depth;
   }
+
+  Mutex mtx;
+  HashMap<CranedId, std::vector<task_id_t>> tree_results;
+  g_craned_keeper->Broadcast(
+      tree_requests | std::views::keys |
+          std::ranges::to<std::vector<CranedId>>(),
+      [&](const CranedId& craned_id, CranedStub* stub) {
+        const auto& [request, depth] = tree_requests.at(craned_id);
+        auto reply = stub->LaunchTree(request, depth);
+        if (!reply.has_value()) return reply.error();
+
+        LockGuard guard(&mtx);
+        for (const auto& result : reply->results()) {
+          tree_results[result.craned_id()].assign(
+              result.failed_task_id_list().begin(),
+              result.failed_task_id_list().end());
+          if (payload_missed != nullptr &&
+              !result.payload_missed_task_id_list().empty())
+            (*payload_missed)[result.craned_id()].assign(
+                result.payload_missed_task_id_list().begin(),
+                result.payload_missed_task_id_list().end());
+        }
+        return CraneErrCode::SUCCESS;
+      },
+      g_config.MaxConcurrentExecuteStepsRpc, absl::InfiniteDuration());
+
+  CRANE_TRACE("{} of {} craneds launched through {} trees.",
+              tree_results.size(), nodes.size(), tree_requests.size());
+  return tree_results;
 }
 
 void TaskScheduler::SetNodeSelectionAlgo(
@@ -973,6 +1576,19 @@ void TaskScheduler::SetNodeSelectionAlgo(
   m_node_selection_algo_ = std::move(algo);
 }
 
+void TaskScheduler::TriggerSchedule() {
+  LockGuard trigger_guard(&m_schedule_trigger_mtx_);
+  m_schedule_triggered_ = true;
+}
+
+void TaskScheduler::TriggerFastLane_(std::vector<task_id_t>&& task_ids) {
+  if (task_ids.empty()) return;
+
+  LockGuard trigger_guard(&m_schedule_trigger_mtx_);
+  m_fast_lane_task_ids_.insert(m_fast_lane_task_ids_.end(), task_ids.begin(),
+                               task_ids.end());
+}
+
 std::future<task_id_t> TaskScheduler::SubmitTaskAsync(
     std::unique_ptr<TaskInCtld> task) {
   std::promise<task_id_t> promise;
@@ -984,6 +1600,28 @@ std::future<task_id_t> TaskScheduler::SubmitTaskAsync(
   return std::move(future);
 }
 
+std::vector<std::future<task_id_t>> TaskScheduler::SubmitTasksAsync(
+    std::vector<std::unique_ptr<TaskInCtld>> tasks) {
+  if (tasks.empty()) return {};
+
+  std::vector<std::future<task_id_t>> futures;
+  std::vector<std::pair<std::unique_ptr<TaskInCtld>, std::promise<task_id_t>>>
+      elems;
+  futures.reserve(tasks.size());
+  elems.reserve(tasks.size());
+  for (auto& task : tasks) {
+    std::promise<task_id_t> promise;
+    futures.emplace_back(promise.get_future());
+    elems.emplace_back(std::move(task), std::move(promise));
+  }
+
+  m_submit_task_queue_.enqueue_bulk(std::make_move_iterator(elems.begin()),
+                                    elems.size());
+  m_submit_task_async_handle_->send();
+
+  return futures;
+}
+
 std::future<CraneErrCode> TaskScheduler::HoldReleaseTaskAsync(task_id_t task_id,
                                                               int64_t secs) {
   std::promise<CraneErrCode> promise;
@@ -1003,8 +1641,10 @@ CraneErrCode TaskScheduler::ChangeTaskTimeLimit(task_id_t task_id,
   std::vector<CranedId> craned_ids;
 
   {
+    LockGuard buffer_guard(&m_submitted_task_buffer_mtx_);
     LockGuard pending_guard(&m_pending_task_map_mtx_);
     LockGuard running_guard(&m_running_task_map_mtx_);
+    MergeSubmittedTaskBufferNoLock_();
 
     TaskInCtld* task;
     bool found = false;
@@ -1029,6 +1669,10 @@ CraneErrCode TaskScheduler::ChangeTaskTimeLimit(task_id_t task_id,
         found = true, task = rn_iter->second.get();
         craned_ids = task->executing_craned_ids;
 
+        // The end time of this task on all allocated nodes changes.
+        for (const CranedId& craned_id : task->CranedIds())
+          g_meta_container->MarkCranedSchedStateChanged(craned_id);
+
         if (task->reservation != "") {
           const auto& reservation_meta =
               g_meta_container->GetResvMetaPtr(task->reservation);
@@ -1052,29 +1696,44 @@ CraneErrCode TaskScheduler::ChangeTaskTimeLimit(task_id_t task_id,
 
     task->time_limit = absl::Seconds(secs);
     task->MutableTaskToCtld()->mutable_time_limit()->set_seconds(secs);
-    g_embedded_db_client->UpdateTaskToCtldIfExists(0, task->TaskDbId(),
-                                                   task->TaskToCtld());
+
+    // Not waited for under the task map locks.
+    EmbeddedDbClient::WriteBatch db_batch;
+    db_batch.PutTaskToCtld(task->TaskDbId(), task->TaskToCtld(), true);
+    g_embedded_db_client->CommitAsync(std::move(db_batch));
   }
 
+  // Both a shorter running task and a shorter pending task may let pending
+  // tasks start earlier.
+  TriggerSchedule();
+
   // Only send request to the executing node
-  for (const CranedId& craned_id : craned_ids) {
-    auto stub = g_craned_keeper->GetCranedStub(craned_id);
-    if (stub && !stub->Invalid()) {
-      CraneErrCode err = stub->ChangeJobTimeLimit(task_id, secs);
-      if (err != CraneErrCode::SUCCESS) {
-        CRANE_ERROR("Failed to change time limit of task #{} on Node {}",
-                    task_id, craned_id);
-        return err;
-      }
-    }
+  std::vector<CraneErrCode> results = g_craned_keeper->Broadcast(
+      craned_ids, [task_id, secs](const CranedId&, CranedStub* stub) {
+        return stub->ChangeJobTimeLimit(task_id, secs);
+      });
+
+  CraneErrCode ret = CraneErrCode::SUCCESS;
+  for (size_t i = 0; i < craned_ids.size(); i++) {
+    // A craned down has nothing to change.
+    if (results[i] == CraneErrCode::SUCCESS ||
+        results[i] == CraneErrCode::ERR_INVALID_STUB)
+      continue;
+
+    CRANE_ERROR("Failed to change time limit of task #{} on Node {}", task_id,
+                craned_ids[i]);
+    ret = results[i];
   }
 
-  return CraneErrCode::SUCCESS;
+  return ret;
 }
 
 CraneErrCode TaskScheduler::ChangeTaskPriority(task_id_t task_id,
                                                double priority) {
+  m_submitted_task_buffer_mtx_.Lock();
   m_pending_task_map_mtx_.Lock();
+  MergeSubmittedTaskBufferNoLock_();
+  m_submitted_task_buffer_mtx_.Unlock();
 
   auto pd_iter = m_pending_task_map_.find(task_id);
   if (pd_iter == m_pending_task_map_.end()) {
@@ -1085,13 +1744,17 @@ CraneErrCode TaskScheduler::ChangeTaskPriority(task_id_t task_id,
 
   pd_iter->second->mandated_priority = priority;
   m_pending_task_map_mtx_.Unlock();
+
+  TriggerSchedule();
   return CraneErrCode::SUCCESS;
 }
 
 CraneErrCode TaskScheduler::ChangeTaskExtraAttrs(
     task_id_t task_id, const std::string& new_extra_attr) {
+  LockGuard buffer_guard(&m_submitted_task_buffer_mtx_);
   LockGuard pending_guard(&m_pending_task_map_mtx_);
   LockGuard running_guard(&m_running_task_map_mtx_);
+  MergeSubmittedTaskBufferNoLock_();
 
   TaskInCtld* task;
   bool found = false;
@@ -1113,15 +1776,16 @@ CraneErrCode TaskScheduler::ChangeTaskExtraAttrs(
     return CraneErrCode::ERR_NON_EXISTENT;
   }
 
-  task->extra_attr = new_extra_attr;
   task->MutableTaskToCtld()->set_extra_attr(new_extra_attr);
-  g_embedded_db_client->UpdateTaskToCtldIfExists(0, task->TaskDbId(),
-                                                 task->TaskToCtld());
+
+  // Not waited for under the task map locks.
+  EmbeddedDbClient::WriteBatch db_batch;
+  db_batch.PutTaskToCtld(task->TaskDbId(), task->TaskToCtld(), true);
+  g_embedded_db_client->CommitAsync(std::move(db_batch));
   return CraneErrCode::SUCCESS;
 }
 
-CraneExpected<std::future<task_id_t>> TaskScheduler::SubmitTaskToScheduler(
-    std::unique_ptr<TaskInCtld> task) {
+CraneExpected<void> TaskScheduler::ValidateSubmittedTask(TaskInCtld* task) {
   if (!task->password_entry->Valid()) {
     CRANE_DEBUG("Uid {} not found on the controller node", task->uid);
     return std::unexpected(CraneErrCode::ERR_INVALID_UID);
@@ -1172,26 +1836,78 @@ CraneExpected<std::future<task_id_t>> TaskScheduler::SubmitTaskToScheduler(
 
   task->SetSubmitTime(absl::Now());
 
-  result = TaskScheduler::HandleUnsetOptionalInTaskToCtld(task.get());
-  if (result) result = TaskScheduler::AcquireTaskAttributes(task.get());
-  if (result) result = TaskScheduler::CheckTaskValidity(task.get());
-  if (result) {
-    auto res = g_account_meta_container->TryMallocQosResource(*task);
+  result = TaskScheduler::HandleUnsetOptionalInTaskToCtld(task);
+  if (result) result = TaskScheduler::AcquireTaskAttributes(task);
+  if (result) result = TaskScheduler::CheckTaskValidity(task);
+  return result;
+}
+
+CraneExpected<std::future<task_id_t>> TaskScheduler::SubmitTaskToScheduler(
+    std::unique_ptr<TaskInCtld> task) {
+  auto result = ValidateSubmittedTask(task.get());
+  if (result) result = CheckTaskDependencies_(*task);
+  if (!result) return std::unexpected(result.error());
+
+  auto res = g_account_meta_container->TryMallocQosResource(*task);
+  if (res != CraneErrCode::SUCCESS) {
+    CRANE_ERROR("The requested QoS resources have reached the user's limit.");
+    return std::unexpected(res);
+  }
+  std::future<task_id_t> future = SubmitTaskAsync(std::move(task));
+  return {std::move(future)};
+}
+
+std::vector<CraneExpected<std::future<task_id_t>>>
+TaskScheduler::SubmitTasksToScheduler(
+    std::vector<std::unique_ptr<TaskInCtld>> tasks) {
+  std::vector<CraneExpected<void>> checks(tasks.size());
+  ParallelForChunks(tasks.size(), kSubmitValidationChunkNum,
+                    [&](size_t begin, size_t end) {
+                      for (size_t i = begin; i < end; i++) {
+                        checks[i] = ValidateSubmittedTask(tasks[i].get());
+                        if (checks[i])
+                          checks[i] = CheckTaskDependencies_(*tasks[i]);
+                      }
+                    });
+
+  // The QoS resources are taken in order, so that the tasks beyond a limit
+  // are the last ones as in sequential submissions.
+  std::vector<CraneExpected<std::future<task_id_t>>> results(tasks.size());
+  std::vector<size_t> valid_indexes;
+  std::vector<std::unique_ptr<TaskInCtld>> valid_tasks;
+  for (size_t i = 0; i < tasks.size(); i++) {
+    if (!checks[i]) {
+      results[i] = std::unexpected(checks[i].error());
+      continue;
+    }
+
+    auto res = g_account_meta_container->TryMallocQosResource(*tasks[i]);
     if (res != CraneErrCode::SUCCESS) {
-      CRANE_ERROR("The requested QoS resources have reached the user's limit.");
-      return std::unexpected(res);
+      results[i] = std::unexpected(res);
+      continue;
     }
-    std::future<task_id_t> future =
-        g_task_scheduler->SubmitTaskAsync(std::move(task));
-    return {std::move(future)};
+    valid_indexes.emplace_back(i);
+    valid_tasks.emplace_back(std::move(tasks[i]));
   }
 
-  return std::unexpected(result.error());
+  if (valid_tasks.size() < tasks.size())
+    CRANE_DEBUG("{} of {} tasks of a batch submission are rejected.",
+                tasks.size() - valid_tasks.size(), tasks.size());
+
+  std::vector<std::future<task_id_t>> futures =
+      SubmitTasksAsync(std::move(valid_tasks));
+  for (size_t i = 0; i < futures.size(); i++)
+    results[valid_indexes[i]] = std::move(futures[i]);
+
+  return results;
 }
 
 CraneErrCode TaskScheduler::SetHoldForTaskInRamAndDb_(task_id_t task_id,
                                                       bool hold) {
+  m_submitted_task_buffer_mtx_.Lock();
   m_pending_task_map_mtx_.Lock();
+  MergeSubmittedTaskBufferNoLock_();
+  m_submitted_task_buffer_mtx_.Unlock();
 
   auto pd_iter = m_pending_task_map_.find(task_id);
   if (pd_iter == m_pending_task_map_.end()) {
@@ -1203,19 +1919,115 @@ CraneErrCode TaskScheduler::SetHoldForTaskInRamAndDb_(task_id_t task_id,
   TaskInCtld* task = pd_iter->second.get();
   task->SetHeld(hold);
 
-  // Copy persisted data to prevent inconsistency.
-  task_db_id_t db_id = task->TaskDbId();
-  auto runtime_attr = task->RuntimeAttr();
+  crane::grpc::RuntimeAttrDeltaOfTask delta;
+  delta.set_held(hold);
+  EmbeddedDbClient::WriteBatch db_batch;
+  db_batch.PutRuntimeAttrDelta(task->TaskDbId(), delta);
 
   m_pending_task_map_mtx_.Unlock();
 
-  if (!g_embedded_db_client->UpdateRuntimeAttrOfTaskIfExists(0, db_id,
-                                                             runtime_attr))
+  if (!g_embedded_db_client->CommitAsync(std::move(db_batch)).get())
     CRANE_ERROR("Failed to update runtime attr of task #{} to DB", task_id);
 
+  if (!hold) TriggerSchedule();
   return CraneErrCode::SUCCESS;
 }
 
+void TaskScheduler::ReleaseHoldOfTasksInRamAndDb_(
+    const std::vector<task_id_t>& task_ids) {
+  crane::grpc::RuntimeAttrDeltaOfTask delta;
+  delta.set_held(false);
+  EmbeddedDbClient::WriteBatch db_batch;
+
+  m_submitted_task_buffer_mtx_.Lock();
+  m_pending_task_map_mtx_.Lock();
+  MergeSubmittedTaskBufferNoLock_();
+  m_submitted_task_buffer_mtx_.Unlock();
+
+  for (task_id_t task_id : task_ids) {
+    auto pd_iter = m_pending_task_map_.find(task_id);
+    if (pd_iter == m_pending_task_map_.end()) {
+      CRANE_TRACE("Task #{} not in Pd queue for release after hold", task_id);
+      continue;
+    }
+
+    TaskInCtld* task = pd_iter->second.get();
+    task->SetHeld(false);
+    db_batch.PutRuntimeAttrDelta(task->TaskDbId(), delta);
+  }
+
+  m_pending_task_map_mtx_.Unlock();
+
+  if (db_batch.Empty()) return;
+
+  if (!g_embedded_db_client->CommitAsync(std::move(db_batch)).get())
+    CRANE_ERROR("Failed to update runtime attr of released held tasks.");
+
+  TriggerSchedule();
+}
+
+void TaskScheduler::CommitNodeSelection_(
+    std::vector<INodeSelectionAlgo::SelectedTask>* selected_tasks,
+    std::list<INodeSelectionAlgo::NodeSelectionResult>* selection_result_list,
+    bool publish_sched_attrs) {
+  // The order of LockGuards matters.
+  LockGuard buffer_guard(&m_submitted_task_buffer_mtx_);
+  auto lock_begin = std::chrono::steady_clock::now();
+  LockGuard pending_guard(&m_pending_task_map_mtx_);
+  g_scheduler_stats->Record(SchedulerStats::Phase::PendingMapLockWait,
+                            std::chrono::steady_clock::now() - lock_begin);
+
+  for (auto& selected : *selected_tasks) {
+    auto pd_iter = m_pending_task_map_.find(selected.task_id);
+
+    // The pending map is unlocked between node selection and here. The task
+    // may have been cancelled, held or have had its time limit changed in the
+    // meantime. In that case, revoke the resources allocated to it and leave
+    // it for the next scheduling cycle.
+    if (pd_iter == m_pending_task_map_.end() || pd_iter->second->Held() ||
+        pd_iter->second->time_limit != selected.time_limit) {
+      CRANE_DEBUG(
+          "Task #{} was modified during node selection. "
+          "Revoke its allocation.",
+          selected.task_id);
+      HashMap<CranedId, std::vector<task_id_t>> craned_task_ids_map;
+      for (CranedId const& craned_id : selected.craned_ids)
+        craned_task_ids_map[craned_id].emplace_back(selected.task_id);
+      g_meta_container->FreeResourceFromNodes(craned_task_ids_map);
+      if (!selected.reservation.empty())
+        g_meta_container->FreeResourceFromResv(selected.reservation,
+                                               selected.task_id);
+      continue;
+    }
+
+    selection_result_list->emplace_back(std::move(pd_iter->second),
+                                        std::move(selected.craned_ids));
+    m_pending_task_map_.erase(pd_iter);
+    m_priority_sorter_->OnPendingTaskRemoved(selected.task_id);
+  }
+
+  if (publish_sched_attrs)
+    for (auto& task : m_pending_task_map_ | std::views::values)
+      task->PublishSchedAttr();
+
+  MergeSubmittedTaskBufferNoLock_();
+  m_node_selecting_ = false;
+
+  m_pending_map_cached_size_.store(m_pending_task_map_.size(),
+                                   std::memory_order::release);
+}
+
+void TaskScheduler::MergeSubmittedTaskBufferNoLock_() {
+  if (m_submitted_task_buffer_.empty()) return;
+
+  for (const auto& task : m_submitted_task_buffer_ | std::views::values)
+    m_priority_sorter_->OnPendingTaskAdded(*task);
+
+  // Task ids are unique, so all the nodes are moved.
+  m_pending_task_map_.merge(m_submitted_task_buffer_);
+  m_submitted_task_buffer_.clear();
+}
+
 CraneErrCode TaskScheduler::TerminateRunningTaskNoLock_(TaskInCtld* task) {
   task_id_t task_id = task->TaskId();
 
@@ -1231,6 +2043,14 @@ CraneErrCode TaskScheduler::TerminateRunningTaskNoLock_(TaskInCtld* task) {
   }
 
   if (need_to_be_terminated) {
+    {
+      LockGuard launching_guard(&m_launching_task_mtx_);
+      if (m_launching_task_ids_.contains(task_id)) {
+        m_launch_terminated_task_ids_.emplace(task_id);
+        return CraneErrCode::SUCCESS;
+      }
+    }
+
     for (CranedId const& craned_id : task->executing_craned_ids) {
       m_cancel_task_queue_.enqueue(
           CancelRunningTaskQueueElem{task_id, craned_id});
@@ -1328,11 +2148,13 @@ crane::grpc::CancelTaskReply TaskScheduler::CancelPendingOrRunningTask(
     } else {
       reply.add_cancelled_tasks(task_id);
 
+      m_task_query_index_.Remove(*task);
       m_cancel_task_queue_.enqueue(
           CancelPendingTaskQueueElem{std::move(it->second)});
       m_cancel_task_async_handle_->send();
 
       m_pending_task_map_.erase(it);
+      m_priority_sorter_->OnPendingTaskRemoved(task_id);
     }
   };
 
@@ -1377,8 +2199,10 @@ crane::grpc::CancelTaskReply TaskScheduler::CancelPendingOrRunningTask(
 
   std::vector<task_id_t> to_cancel_pd_task_ids;
 
+  LockGuard buffer_guard(&m_submitted_task_buffer_mtx_);
   LockGuard pending_guard(&m_pending_task_map_mtx_);
   LockGuard running_guard(&m_running_task_map_mtx_);
+  MergeSubmittedTaskBufferNoLock_();
 
   auto pending_task_id_rng = m_pending_task_map_ | joined_filters |
                              ranges::views::transform(rng_transformer_id);
@@ -1411,6 +2235,7 @@ crane::grpc::CreateReservationReply TaskScheduler::CreateResv(
     reply.set_reason(res.error());
   } else {
     reply.set_ok(true);
+    TriggerSchedule();
   }
 
   return reply;
@@ -1629,6 +2454,7 @@ std::expected<void, std::string> TaskScheduler::CreateResv_(
         CranedMeta::ResvInNode{.start_time = start_time,
                                .end_time = end_time,
                                .res_total = craned_meta->static_meta.res});
+    g_meta_container->BumpCranedSchedVersion(craned_meta.get());
     if (!ok) {
       CRANE_ERROR("Failed to insert reservation resource to {}",
                   craned_meta->static_meta.hostname);
@@ -1666,6 +2492,7 @@ crane::grpc::DeleteReservationReply TaskScheduler::DeleteResv(
   auto res = DeleteResvMeta_(resv_meta_map, resv_name);
   if (res.has_value()) {
     reply.set_ok(true);
+    TriggerSchedule();
   } else {
     reply.set_ok(false);
     reply.set_reason(res.error());
@@ -1704,6 +2531,7 @@ std::expected<void, std::string> TaskScheduler::DeleteResvMeta_(
       continue;
     }
     reservation_resource_map.erase(resv_id);
+    g_meta_container->BumpCranedSchedVersion(craned_meta_ptr.get());
   }
 
   resv_meta_map->erase(resv_id);
@@ -1736,8 +2564,7 @@ void TaskScheduler::TaskTimerAsyncCb_() {
   }
 }
 
-void TaskScheduler::CleanTaskTimerQueueCb_(
-    const std::shared_ptr<uvw::loop>& uvw_loop) {
+void TaskScheduler::CleanTaskTimerQueueCb_() {
   // It's ok to use an approximate size.
   size_t approximate_size = m_task_timer_queue_.size_approx();
 
@@ -1753,11 +2580,7 @@ void TaskScheduler::CleanTaskTimerQueueCb_(
     const auto& [task_id, secs] = req;
 
     // If any timer for the task exists, remove it.
-    auto timer_it = m_task_timer_handles_.find(task_id);
-    if (timer_it != m_task_timer_handles_.end()) {
-      timer_it->second->close();
-      m_task_timer_handles_.erase(timer_it);
-    }
+    m_hold_timer_wheel_.Cancel(task_id);
 
     CraneErrCode err;
     if (secs == 0) {  // Remove timer
@@ -1770,29 +2593,25 @@ void TaskScheduler::CleanTaskTimerQueueCb_(
       CRANE_TRACE("Add a hold constraint for task #{} with {}s timer.", task_id,
                   secs);
 
-      auto on_timer_cb = [this, task_id](const uvw::timer_event&,
-                                         uvw::timer_handle& handle) {
-        CraneErrCode err = SetHoldForTaskInRamAndDb_(task_id, false);
-        if (err != CraneErrCode::SUCCESS)
-          CRANE_ERROR("Failed to release task #{} after hold.", task_id);
-
-        handle.close();
-        m_task_timer_handles_.erase(task_id);
-      };
-
       err = SetHoldForTaskInRamAndDb_(task_id, true);
-
-      auto task_timer_handle_ = uvw_loop->resource<uvw::timer_handle>();
-      task_timer_handle_->on<uvw::timer_event>(std::move(on_timer_cb));
-      task_timer_handle_->start(std::chrono::seconds(secs),
-                                std::chrono::seconds(0));
-      m_task_timer_handles_[task_id] = std::move(task_timer_handle_);
+      if (err == CraneErrCode::SUCCESS)
+        m_hold_timer_wheel_.Schedule(task_id,
+                                     ToUnixSeconds(absl::Now()) + secs);
     }
 
     promise.set_value(err);
   }
 }
 
+void TaskScheduler::HoldTimerWheelCb_() {
+  std::vector<task_id_t> expired_task_ids;
+  m_hold_timer_wheel_.Advance(ToUnixSeconds(absl::Now()), &expired_task_ids);
+  if (expired_task_ids.empty()) return;
+
+  CRANE_TRACE("Hold timers of {} tasks expired.", expired_task_ids.size());
+  ReleaseHoldOfTasksInRamAndDb_(expired_task_ids);
+}
+
 void TaskScheduler::CleanResvTimerQueueCb_(
     const std::shared_ptr<uvw::loop>& uvw_loop) {
   // It's ok to use an approximate size.
@@ -1824,6 +2643,7 @@ void TaskScheduler::CleanResvTimerQueueCb_(
       if (err.has_value()) {
         handle.close();
         m_resv_timer_handles_.erase(reservation_id);
+        TriggerSchedule();
       } else {
         CRANE_WARN("Failed to clean up reservation {}: {}", reservation_id,
                    err.error());
@@ -1876,24 +2696,32 @@ void TaskScheduler::CleanCancelQueueCb_() {
         elem);
   }
 
-  for (auto&& [craned_id, task_ids] : running_task_craned_id_map) {
-    if (!g_meta_container->CheckCranedOnline(craned_id)) {
-      for (auto job_id : task_ids) {
-        TaskStatusChangeAsync(job_id, craned_id,
-                              crane::grpc::TaskStatus::Cancelled,
-                              ExitCode::kExitCodeTerminated);
-      }
-      continue;
+  absl::erase_if(running_task_craned_id_map, [this](const auto& kv) {
+    const auto& [craned_id, task_ids] = kv;
+    if (g_meta_container->CheckCranedOnline(craned_id)) return false;
+
+    for (auto job_id : task_ids) {
+      TaskStatusChangeAsync(job_id, craned_id,
+                            crane::grpc::TaskStatus::Cancelled,
+                            ExitCode::kExitCodeTerminated);
     }
-    g_thread_pool->detach_task(
-        [id = craned_id, task_ids_to_cancel = task_ids]() {
-          CRANE_TRACE("Craned {} is going to cancel tasks {}.", id,
-                      absl::StrJoin(task_ids_to_cancel, ","));
-          auto stub = g_craned_keeper->GetCranedStub(id);
-          if (stub && !stub->Invalid())
-            stub->TerminateSteps(task_ids_to_cancel);
-        });
-  }
+    return true;
+  });
+
+  // Cancelling a job on many nodes sends the RPCs concurrently.
+  if (!running_task_craned_id_map.empty())
+    g_thread_pool->detach_task([craned_task_ids_map = std::move(
+                                    running_task_craned_id_map)] {
+      g_craned_keeper->Broadcast(
+          craned_task_ids_map | std::views::keys |
+              std::ranges::to<std::vector<CranedId>>(),
+          [&](const CranedId& craned_id, CranedStub* stub) {
+            const auto& task_ids = craned_task_ids_map.at(craned_id);
+            CRANE_TRACE("Craned {} is going to cancel tasks {}.", craned_id,
+                        absl::StrJoin(task_ids, ","));
+            return stub->TerminateSteps(task_ids);
+          });
+    });
 
   if (pending_task_ptr_vec.empty()) return;
 
@@ -1962,6 +2790,8 @@ void TaskScheduler::CleanSubmitQueueCb_() {
   size_t accepted_actual_size;
   size_t rejected_actual_size;
 
+  EmbeddedDbClient::WriteBatch dependency_db_batch;
+
   // Accept tasks within queue capacity.
   do {
     if (accepted_size == 0) break;
@@ -1991,14 +2821,69 @@ void TaskScheduler::CleanSubmitQueueCb_() {
       }
       break;
     }
+    g_task_event_hub->Publish(accepted_task_ptrs);
+
+    LockGuard buffer_guard(&m_submitted_task_buffer_mtx_);
+
+    // The new tasks are registered before their ids are returned, which may
+    // be used by the dependencies of the next submissions. An upstream task
+    // ended meanwhile waits for the buffer lock to find the new dependents.
+    // The dependencies on tasks already ended are resolved at once and
+    // committed after the locks are released.
+    std::vector<TaskDependencyGraph::Resolution> resolutions;
+    m_dependency_graph_.AddTasks(accepted_task_ptrs, &resolutions);
+    if (!resolutions.empty()) {
+      HashMap<task_id_t, const TaskInCtld*> task_map;
+      for (const TaskInCtld* task : accepted_task_ptrs)
+        task_map.emplace(task->TaskId(), task);
+      for (const auto& resolution : resolutions)
+        PutDependencyDelta_(*task_map.at(resolution.dependent_id), resolution,
+                            &dependency_db_batch);
+    }
+
+    // Queued for the fast lane once they are visible to the scheduler.
+    std::vector<task_id_t> fast_lane_task_ids;
+    if (g_config.InteractiveFastLane) {
+      for (const TaskInCtld* task : accepted_task_ptrs)
+        if (task->type == crane::grpc::Interactive &&
+            task->reservation.empty() && !task->Blocked())
+          fast_lane_task_ids.emplace_back(task->TaskId());
+    }
+
+    // While the scheduling thread is selecting nodes, the pending map is
+    // read-locked by it. Park the new tasks in the buffer instead of waiting
+    // for the whole cycle. They are merged at the commit of node selection.
+    // Other holders of the pending map are not waited for either, since
+    // everyone who needs the buffer would be blocked meanwhile. The next
+    // writer of the pending map or the next scheduling cycle merges them.
+    if (m_node_selecting_ || !m_pending_task_map_mtx_.TryLock()) {
+      for (uint32_t i = 0; i < accepted_tasks.size(); i++) {
+        uint32_t pos = accepted_tasks.size() - 1 - i;
+        task_id_t id = accepted_tasks[pos].first->TaskId();
+        auto& task_id_promise = accepted_tasks[pos].second;
+
+        accepted_tasks[pos].first->PublishSchedAttr();
+        m_task_query_index_.Add(*accepted_tasks[pos].first);
+        m_submitted_task_buffer_.emplace(id,
+                                         std::move(accepted_tasks[pos].first));
+        task_id_promise.set_value(id);
+      }
 
-    m_pending_task_map_mtx_.Lock();
+      m_pending_map_cached_size_.fetch_add(accepted_tasks.size(),
+                                           std::memory_order_release);
+      TriggerFastLane_(std::move(fast_lane_task_ids));
+      TriggerSchedule();
+      break;
+    }
 
     for (uint32_t i = 0; i < accepted_tasks.size(); i++) {
       uint32_t pos = accepted_tasks.size() - 1 - i;
       task_id_t id = accepted_tasks[pos].first->TaskId();
       auto& task_id_promise = accepted_tasks[pos].second;
 
+      accepted_tasks[pos].first->PublishSchedAttr();
+      m_priority_sorter_->OnPendingTaskAdded(*accepted_tasks[pos].first);
+      m_task_query_index_.Add(*accepted_tasks[pos].first);
       m_pending_task_map_.emplace(id, std::move(accepted_tasks[pos].first));
       task_id_promise.set_value(id);
     }
@@ -2006,8 +2891,14 @@ void TaskScheduler::CleanSubmitQueueCb_() {
     m_pending_map_cached_size_.store(m_pending_task_map_.size(),
                                      std::memory_order_release);
     m_pending_task_map_mtx_.Unlock();
+    TriggerFastLane_(std::move(fast_lane_task_ids));
+    TriggerSchedule();
   } while (false);
 
+  if (!dependency_db_batch.Empty() &&
+      !g_embedded_db_client->CommitAsync(std::move(dependency_db_batch)).get())
+    CRANE_ERROR("Failed to persist the dependencies resolved at submission.");
+
   // Reject tasks beyond queue capacity
   do {
     if (rejected_size == 0) break;
@@ -2044,7 +2935,12 @@ void TaskScheduler::TaskStatusChangeAsyncCb_() {
 }
 
 void TaskScheduler::CleanTaskStatusChangeQueueCb_() {
-  size_t approximate_size = m_task_status_change_queue_.size_approx();
+  // Bound the work done in one callback so that a burst of ended tasks
+  // doesn't stall the other events on this loop. The rest are handled in the
+  // next callback triggered below.
+  size_t approximate_size =
+      std::min<size_t>(m_task_status_change_queue_.size_approx(),
+                       kTaskStatusChangeMaxDrainNum);
 
   std::vector<TaskStatusChangeArg> args;
   args.resize(approximate_size);
@@ -2054,6 +2950,9 @@ void TaskScheduler::CleanTaskStatusChangeQueueCb_() {
   if (actual_size == 0) return;
   args.resize(actual_size);
 
+  if (m_task_status_change_queue_.size_approx() > 0)
+    m_clean_task_status_change_handle_->send();
+
   CRANE_TRACE("Cleaning {} TaskStatusChanges...", actual_size);
 
   // Carry the ownership of TaskInCtld for automatic destruction.
@@ -2065,121 +2964,324 @@ void TaskScheduler::CleanTaskStatusChangeQueueCb_() {
   std::unordered_map<CranedId, std::vector<std::pair<task_id_t, uid_t>>>
       craned_cgroups_map;
 
-  LockGuard running_guard(&m_running_task_map_mtx_);
-  LockGuard indexes_guard(&m_task_indexes_mtx_);
+  // The locks are released before the ended tasks are persisted. They are
+  // also released between chunks of status changes, so that a burst of ended
+  // tasks doesn't block node selection and queries for the whole batch.
+  for (size_t chunk_begin = 0; chunk_begin < args.size();
+       chunk_begin += kTaskStatusChangeLockChunkNum) {
+    size_t chunk_end =
+        std::min<size_t>(chunk_begin + kTaskStatusChangeLockChunkNum,
+                         args.size());
 
-  for (const auto& [task_id, exit_code, new_status, craned_index] : args) {
-    auto iter = m_running_task_map_.find(task_id);
-    if (iter == m_running_task_map_.end()) {
-      CRANE_WARN(
-          "Ignoring unknown task id {} in CleanTaskStatusChangeQueueCb_.",
-          task_id);
-      continue;
-    }
+    // Resources are freed node by node after all the status changes of the
+    // chunk are applied, so that each craned is locked only once.
+    HashMap<CranedId, std::vector<task_id_t>> craned_ended_task_ids_map;
 
-    std::unique_ptr<TaskInCtld>& task = iter->second;
+    LockGuard running_guard(&m_running_task_map_mtx_);
+    LockGuard indexes_guard(&m_task_indexes_mtx_);
 
-    if (task->type == crane::grpc::Batch) {
-      task->SetStatus(new_status);
-    } else {
-      auto& meta = std::get<InteractiveMetaInTask>(task->meta);
-      if (meta.interactive_type == crane::grpc::Crun) {  // Crun
-        if (++meta.status_change_cnt < task->executing_craned_ids.size()) {
-          CRANE_TRACE(
-              "{}/{} TaskStatusChanges of Crun task #{} were received. "
-              "Keep waiting...",
-              meta.status_change_cnt, task->executing_craned_ids.size(),
-              task->TaskId());
-          continue;
-        }
+    for (const auto& [task_id, exit_code, new_status, craned_index] :
+         args | ranges::views::slice(chunk_begin, chunk_end)) {
+      auto iter = m_running_task_map_.find(task_id);
+      if (iter == m_running_task_map_.end()) {
+        CRANE_WARN(
+            "Ignoring unknown task id {} in CleanTaskStatusChangeQueueCb_.",
+            task_id);
+        continue;
       }
 
-      // TaskStatusChange may indicate the time limit has been reached and
-      // the task has been terminated. No more TerminateTask RPC should be
-      // sent to the craned node if any further CancelTask or
-      // TaskCompletionRequest RPC is received.
+      std::unique_ptr<TaskInCtld>& task = iter->second;
 
-      // Task end triggered by craned.
-      if (!meta.has_been_cancelled_on_front_end) {
-        meta.has_been_cancelled_on_front_end = true;
-        meta.cb_task_cancel(task->TaskId());
-        // Completion ack will send in grpc server triggered by task complete
-        // req
-        meta.cb_task_completed(task->TaskId(), false);
+      if (task->type == crane::grpc::Batch) {
+        task->SetStatus(new_status);
       } else {
-        // Send Completion Ack to frontend now.
-        meta.cb_task_completed(task->TaskId(), true);
-      }
+        auto& meta = std::get<InteractiveMetaInTask>(task->meta);
+        if (meta.interactive_type == crane::grpc::Crun) {  // Crun
+          if (++meta.status_change_cnt < task->executing_craned_ids.size()) {
+            CRANE_TRACE(
+                "{}/{} TaskStatusChanges of Crun task #{} were received. "
+                "Keep waiting...",
+                meta.status_change_cnt, task->executing_craned_ids.size(),
+                task->TaskId());
+            continue;
+          }
+        }
 
-      task->SetStatus(new_status);
-    }
+        // TaskStatusChange may indicate the time limit has been reached and
+        // the task has been terminated. No more TerminateTask RPC should be
+        // sent to the craned node if any further CancelTask or
+        // TaskCompletionRequest RPC is received.
 
-    task->SetExitCode(exit_code);
-    task->SetEndTime(absl::Now());
+        // Task end triggered by craned.
+        if (!meta.has_been_cancelled_on_front_end) {
+          meta.has_been_cancelled_on_front_end = true;
+          meta.cb_task_cancel(task->TaskId());
+          // Completion ack will send in grpc server triggered by task complete
+          // req
+          meta.cb_task_completed(task->TaskId(), false);
+        } else {
+          // Send Completion Ack to frontend now.
+          meta.cb_task_completed(task->TaskId(), true);
+        }
 
-    for (CranedId const& craned_id : task->executing_craned_ids) {
-      craned_cgroups_map[craned_id].emplace_back(task_id, task->uid);
-    }
-    for (CranedId const& craned_id : task->CranedIds()) {
-      auto node_to_task_map_it = m_node_to_tasks_map_.find(craned_id);
-      if (node_to_task_map_it == m_node_to_tasks_map_.end()) [[unlikely]] {
-        CRANE_ERROR("Failed to find craned_id {} in m_node_to_tasks_map_",
-                    craned_id);
-      } else {
-        node_to_task_map_it->second.erase(task_id);
-        if (node_to_task_map_it->second.empty()) {
-          m_node_to_tasks_map_.erase(node_to_task_map_it);
+        task->SetStatus(new_status);
+      }
+
+      task->SetExitCode(exit_code);
+      task->SetEndTime(absl::Now());
+
+      for (CranedId const& craned_id : task->executing_craned_ids) {
+        craned_cgroups_map[craned_id].emplace_back(task_id, task->uid);
+      }
+      for (CranedId const& craned_id : task->CranedIds()) {
+        auto node_to_task_map_it = m_node_to_tasks_map_.find(craned_id);
+        if (node_to_task_map_it == m_node_to_tasks_map_.end()) [[unlikely]] {
+          CRANE_ERROR("Failed to find craned_id {} in m_node_to_tasks_map_",
+                      craned_id);
+        } else {
+          node_to_task_map_it->second.erase(task_id);
+          if (node_to_task_map_it->second.empty()) {
+            m_node_to_tasks_map_.erase(node_to_task_map_it);
+          }
         }
       }
-    }
 
-    for (CranedId const& craned_id : task->CranedIds()) {
-      g_meta_container->FreeResourceFromNode(craned_id, task_id);
+      for (CranedId const& craned_id : task->CranedIds())
+        craned_ended_task_ids_map[craned_id].emplace_back(task_id);
+      if (task->reservation != "")
+        g_meta_container->FreeResourceFromResv(task->reservation,
+                                               task->TaskId());
+      g_account_meta_container->FreeQosResource(*task);
+
+      m_task_query_index_.Remove(*task);
+      task_raw_ptr_vec.emplace_back(task.get());
+      task_ptr_vec.emplace_back(std::move(task));
+
+      // As for now, task status change includes only
+      // Pending / Running -> Completed / Failed / Cancelled.
+      // It means all task status changes will put the task into mongodb,
+      // so we don't have any branch code here and just put it into mongodb.
+
+      CRANE_TRACE_EVERY_N(kPerTaskLogSampleNum,
+                          "Move task#{} to the Completed Queue", task_id);
+      m_running_task_map_.erase(iter);
+      m_priority_sorter_->OnRunningTaskRemoved(task_id);
     }
-    if (task->reservation != "")
-      g_meta_container->FreeResourceFromResv(task->reservation, task->TaskId());
-    g_account_meta_container->FreeQosResource(*task);
 
-    task_raw_ptr_vec.emplace_back(task.get());
-    task_ptr_vec.emplace_back(std::move(task));
+    // Must be done before the running map is unlocked since node selection
+    // looks up every task holding resources on a craned in the running map.
+    if (!craned_ended_task_ids_map.empty())
+      g_meta_container->FreeResourceFromNodes(craned_ended_task_ids_map);
+  }
+
+  // Resources of the ended tasks are freed.
+  if (!task_ptr_vec.empty()) TriggerSchedule();
+
+  // Craneds down are ignored.
+  if (!craned_cgroups_map.empty())
+    g_thread_pool->detach_task([craned_jobs_map =
+                                    std::move(craned_cgroups_map)] {
+      g_craned_keeper->Broadcast(
+          craned_jobs_map | std::views::keys |
+              std::ranges::to<std::vector<CranedId>>(),
+          [&](const CranedId& craned_id, CranedStub* stub) {
+            const auto& jobs = craned_jobs_map.at(craned_id);
+            CraneErrCode err =
+                stub->FreeSteps(jobs | std::views::keys |
+                                std::ranges::to<std::vector<task_id_t>>());
+            if (err != CraneErrCode::SUCCESS) {
+              CRANE_ERROR("Failed to FreeSteps RPC for {} tasks on Node {}",
+                          jobs.size(), craned_id);
+            }
+            err = stub->ReleaseCgroupForJobs(jobs);
+            if (err != CraneErrCode::SUCCESS) {
+              CRANE_ERROR(
+                  "Failed to Release cgroup RPC for {} tasks on Node {}",
+                  jobs.size(), craned_id);
+            }
+            return err;
+          });
+    });
 
-    // As for now, task status change includes only
-    // Pending / Running -> Completed / Failed / Cancelled.
-    // It means all task status changes will put the task into mongodb,
-    // so we don't have any branch code here and just put it into mongodb.
+  ProcessFinalTasks_(task_raw_ptr_vec);
+}
+
+void TaskScheduler::TaskInfoSnapshotThread_() {
+  util::SetCurrentThreadName("TaskSnapshotThr");
 
-    CRANE_TRACE("Move task#{} to the Completed Queue", task_id);
-    m_running_task_map_.erase(iter);
+  while (!m_thread_stop_) {
+    auto snapshot = BuildTaskInfoSnapshot_(m_task_info_snapshot_space_ / 4 * 5);
+    m_task_info_snapshot_space_ = snapshot->arena.SpaceUsed();
+    m_task_info_snapshot_.store(std::move(snapshot),
+                                std::memory_order_release);
+    std::this_thread::sleep_for(
+        std::chrono::milliseconds(g_config.TaskQuerySnapshotIntervalMs));
   }
+}
 
-  for (auto& [craned_id, cgroups] : craned_cgroups_map) {
-    g_thread_pool->detach_task([craned_id, jobs = std::move(cgroups)] {
-      auto stub = g_craned_keeper->GetCranedStub(craned_id);
+std::shared_ptr<const TaskScheduler::TaskInfoSnapshot>
+TaskScheduler::GetTaskInfoSnapshot() {
+  if (g_config.TaskQuerySnapshotIntervalMs > 0) {
+    auto snapshot = m_task_info_snapshot_.load(std::memory_order_acquire);
+    if (snapshot) return snapshot;
+  }
+  return BuildTaskInfoSnapshot_(0);
+}
 
-      // If the craned is down, just ignore it.
-      if (stub && !stub->Invalid()) {
-        CraneErrCode err =
-            stub->FreeSteps(jobs | std::views::keys |
-                            std::ranges::to<std::vector<task_id_t>>());
-        if (err != CraneErrCode::SUCCESS) {
-          CRANE_ERROR("Failed to FreeSteps RPC for {} tasks on Node {}",
-                      jobs.size(), craned_id);
-        }
-        err = stub->ReleaseCgroupForJobs(jobs);
-        if (err != CraneErrCode::SUCCESS) {
-          CRANE_ERROR("Failed to Release cgroup RPC for {} tasks on Node {}",
-                      jobs.size(), craned_id);
-        }
+std::shared_ptr<TaskScheduler::TaskInfoSnapshot>
+TaskScheduler::BuildTaskInfoSnapshot_(size_t arena_block_size) {
+  auto snapshot = std::make_shared<TaskInfoSnapshot>(arena_block_size);
+  auto add_to = [&](std::vector<const crane::grpc::TaskInfo*>* tasks,
+                    TaskInCtld* task) {
+    auto* task_info = snapshot->arena.Create<crane::grpc::TaskInfo>();
+    task->SetFieldsOfTaskInfo(task_info);
+    tasks->push_back(task_info);
+  };
+
+  {
+    LockGuard buffer_guard(&m_submitted_task_buffer_mtx_);
+    ReaderLockGuard pending_guard(&m_pending_task_map_mtx_);
+    ReaderLockGuard running_guard(&m_running_task_map_mtx_);
+
+    snapshot->build_time = absl::Now();
+
+    snapshot->pending_tasks.reserve(m_pending_task_map_.size() +
+                                    m_submitted_task_buffer_.size());
+    for (const auto& task : m_pending_task_map_ | std::views::values)
+      add_to(&snapshot->pending_tasks, task.get());
+    for (const auto& task : m_submitted_task_buffer_ | std::views::values)
+      add_to(&snapshot->pending_tasks, task.get());
+
+    snapshot->running_tasks.reserve(m_running_task_map_.size());
+    for (const auto& task : m_running_task_map_ | std::views::values)
+      add_to(&snapshot->running_tasks, task.get());
+  }
+
+  // Buffered tasks are submitted after all pending ones, but the running
+  // map is not ordered.
+  auto by_task_id = [](const crane::grpc::TaskInfo* lhs,
+                       const crane::grpc::TaskInfo* rhs) {
+    return lhs->task_id() < rhs->task_id();
+  };
+  std::ranges::sort(snapshot->pending_tasks, by_task_id);
+  std::ranges::sort(snapshot->running_tasks, by_task_id);
+
+  return snapshot;
+}
+
+void TaskScheduler::QueryTaskInfoLists(
+    std::span<const crane::grpc::TaskInfo* const> pending_tasks,
+    std::span<const crane::grpc::TaskInfo* const> running_tasks,
+    absl::Time build_time, const crane::grpc::QueryTasksInfoRequest* request,
+    crane::grpc::QueryTasksInfoReply* response) {
+  auto now = absl::Now();
+
+  std::unordered_set<uint32_t> req_task_ids(request->filter_task_ids().begin(),
+                                            request->filter_task_ids().end());
+  std::unordered_set<std::string> req_users(request->filter_users().begin(),
+                                            request->filter_users().end());
+  std::unordered_set<std::string> req_accounts(
+      request->filter_accounts().begin(), request->filter_accounts().end());
+  std::unordered_set<std::string> req_partitions(
+      request->filter_partitions().begin(), request->filter_partitions().end());
+  std::unordered_set<std::string> req_qos(request->filter_qos().begin(),
+                                          request->filter_qos().end());
+  std::unordered_set<std::string> req_task_names(
+      request->filter_task_names().begin(), request->filter_task_names().end());
+  std::unordered_set<int> req_task_states(request->filter_task_states().begin(),
+                                          request->filter_task_states().end());
+
+  auto in_interval = [](const google::protobuf::Timestamp& time,
+                        bool has_interval,
+                        const crane::grpc::TimeInterval& interval) {
+    return !has_interval ||
+           ((!interval.has_lower_bound() || time >= interval.lower_bound()) &&
+            (!interval.has_upper_bound() || time <= interval.upper_bound()));
+  };
+
+  // The start and end time of pending tasks in the snapshot are already
+  // those published by node selection.
+  auto match = [&](const crane::grpc::TaskInfo& task) {
+    return (req_task_ids.empty() || req_task_ids.contains(task.task_id())) &&
+           (req_users.empty() || req_users.contains(task.username())) &&
+           (req_accounts.empty() || req_accounts.contains(task.account())) &&
+           (req_partitions.empty() ||
+            req_partitions.contains(task.partition())) &&
+           (req_qos.empty() || req_qos.contains(task.qos())) &&
+           (req_task_names.empty() || req_task_names.contains(task.name())) &&
+           (req_task_states.empty() ||
+            req_task_states.contains(task.status())) &&
+           in_interval(task.submit_time(),
+                       request->has_filter_submit_time_interval(),
+                       request->filter_submit_time_interval()) &&
+           in_interval(task.start_time(),
+                       request->has_filter_start_time_interval(),
+                       request->filter_start_time_interval()) &&
+           in_interval(task.end_time(), request->has_filter_end_time_interval(),
+                       request->filter_end_time_interval());
+  };
+
+  auto* task_list = response->mutable_task_info_list();
+  auto append = [&](const crane::grpc::TaskInfo& task) {
+    auto* task_it = task_list->Add();
+    *task_it = task;
+    absl::Time start_time = absl::FromUnixSeconds(task.start_time().seconds());
+    task_it->mutable_elapsed_time()->set_seconds(
+        ToInt64Seconds(now - start_time));
+  };
+
+  if (request->page_size() > 0) {
+    // Merge the two id-ordered lists from the cursor. See QueryTasksInRam.
+    size_t page_limit = request->page_size() + 1;
+    auto after_cursor =
+        [&](std::span<const crane::grpc::TaskInfo* const> tasks) {
+          return std::ranges::upper_bound(
+              tasks, request->page_after_task_id(), {},
+              [](const crane::grpc::TaskInfo* task) {
+                return task->task_id();
+              });
+        };
+    auto pd_it = after_cursor(pending_tasks);
+    auto rn_it = after_cursor(running_tasks);
+    while (task_list->size() < page_limit) {
+      const crane::grpc::TaskInfo* task;
+      if (pd_it == pending_tasks.end() && rn_it == running_tasks.end()) break;
+      if (rn_it == running_tasks.end() ||
+          (pd_it != pending_tasks.end() &&
+           (*pd_it)->task_id() < (*rn_it)->task_id()))
+        task = *pd_it++;
+      else
+        task = *rn_it++;
+
+      if (match(*task)) append(*task);
+    }
+  } else {
+    size_t num_limit = request->num_limit() == 0 ? kDefaultQueryTaskNumLimit
+                                                 : request->num_limit();
+    for (auto tasks : {pending_tasks, running_tasks})
+      for (const auto* task : tasks) {
+        if (task_list->size() >= num_limit) break;
+        if (match(*task)) append(*task);
       }
-    });
   }
 
-  ProcessFinalTasks_(task_raw_ptr_vec);
+  response->set_from_snapshot(true);
+  response->set_snapshot_age_ms(
+      std::max<int64_t>(ToInt64Milliseconds(now - build_time), 0));
 }
 
 void TaskScheduler::QueryTasksInRam(
     const crane::grpc::QueryTasksInfoRequest* request,
     crane::grpc::QueryTasksInfoReply* response) {
+  if (g_config.TaskQuerySnapshotIntervalMs > 0) {
+    auto snapshot = m_task_info_snapshot_.load(std::memory_order_acquire);
+    if (snapshot) {
+      QueryTaskInfoLists(snapshot->pending_tasks, snapshot->running_tasks,
+                         snapshot->build_time, request, response);
+      return;
+    }
+  }
+
   auto now = absl::Now();
 
   auto* task_list = response->mutable_task_info_list();
@@ -2187,8 +3289,11 @@ void TaskScheduler::QueryTasksInRam(
     TaskInCtld& task = *it.second;
     auto* task_it = task_list->Add();
     task.SetFieldsOfTaskInfo(task_it);
+    absl::Time start_time = task.Status() == crane::grpc::Pending
+                                ? task.sched_attr_snapshot.start_time
+                                : task.StartTime();
     task_it->mutable_elapsed_time()->set_seconds(
-        ToInt64Seconds(now - task.StartTime()));
+        ToInt64Seconds(now - start_time));
   };
 
   auto task_rng_filter_time = [&](auto& it) {
@@ -2206,20 +3311,31 @@ void TaskScheduler::QueryTasksInRam(
                task.RuntimeAttr().submit_time() <= interval.upper_bound();
     }
 
+    // The expected start and end time of pending tasks are updated by node
+    // selection. Use the published value for them.
+    google::protobuf::Timestamp start_time = task.RuntimeAttr().start_time();
+    google::protobuf::Timestamp end_time = task.RuntimeAttr().end_time();
+    if (task.Status() == crane::grpc::Pending) {
+      start_time.set_seconds(ToUnixSeconds(task.sched_attr_snapshot.start_time));
+      start_time.set_nanos(0);
+      end_time.set_seconds(ToUnixSeconds(task.sched_attr_snapshot.end_time));
+      end_time.set_nanos(0);
+    }
+
     if (has_start_time_interval) {
       const auto& interval = request->filter_start_time_interval();
       valid &= !interval.has_lower_bound() ||
-               task.RuntimeAttr().start_time() >= interval.lower_bound();
+               start_time >= interval.lower_bound();
       valid &= !interval.has_upper_bound() ||
-               task.RuntimeAttr().start_time() <= interval.upper_bound();
+               start_time <= interval.upper_bound();
     }
 
     if (has_end_time_interval) {
       const auto& interval = request->filter_end_time_interval();
       valid &= !interval.has_lower_bound() ||
-               task.RuntimeAttr().end_time() >= interval.lower_bound();
+               end_time >= interval.lower_bound();
       valid &= !interval.has_upper_bound() ||
-               task.RuntimeAttr().end_time() <= interval.upper_bound();
+               end_time <= interval.upper_bound();
     }
 
     return valid;
@@ -2284,28 +3400,150 @@ void TaskScheduler::QueryTasksInRam(
            req_task_states.contains(task.RuntimeAttr().status());
   };
 
-  auto pending_rng = m_pending_task_map_ | ranges::views::all;
-  auto running_rng = m_running_task_map_ | ranges::views::all;
-  auto pd_r_rng = ranges::views::concat(pending_rng, running_rng);
-
   size_t num_limit = request->num_limit() == 0 ? kDefaultQueryTaskNumLimit
                                                : request->num_limit();
 
-  auto filtered_rng = pd_r_rng |
-                      ranges::views::filter(task_rng_filter_account) |
-                      ranges::views::filter(task_rng_filter_name) |
-                      ranges::views::filter(task_rng_filter_partition) |
-                      ranges::views::filter(task_rng_filter_id) |
-                      ranges::views::filter(task_rng_filter_state) |
-                      ranges::views::filter(task_rng_filter_username) |
-                      ranges::views::filter(task_rng_filter_time) |
-                      ranges::views::filter(task_rng_filter_qos) |
-                      ranges::views::take(num_limit);
+  // Tasks in RAM are pending in the pending map and the buffer, and running
+  // in the running map. Skip the maps the state filter excludes.
+  bool visit_pending = no_task_states_constraint ||
+                       req_task_states.contains(crane::grpc::Pending);
+  bool visit_running = no_task_states_constraint ||
+                       req_task_states.contains(crane::grpc::Running);
+
+  // Fields written by node selection are read from the published snapshot of
+  // pending tasks, so reader locks are enough here.
+  LockGuard buffer_guard(&m_submitted_task_buffer_mtx_);
+  ReaderLockGuard pending_guard(&m_pending_task_map_mtx_);
+  ReaderLockGuard running_guard(&m_running_task_map_mtx_);
+
+  auto task_rng_filter_all = [&](auto& it) {
+    return task_rng_filter_account(it) && task_rng_filter_name(it) &&
+           task_rng_filter_partition(it) && task_rng_filter_id(it) &&
+           task_rng_filter_state(it) && task_rng_filter_username(it) &&
+           task_rng_filter_time(it) && task_rng_filter_qos(it);
+  };
+  auto apply_filters = [&](auto&& rng) {
+    return rng | ranges::views::filter(task_rng_filter_all);
+  };
+
+  using TaskMapValue = std::pair<const task_id_t, std::unique_ptr<TaskInCtld>>;
+  auto find_task = [&](task_id_t task_id) -> TaskMapValue* {
+    if (visit_pending) {
+      if (auto it = m_pending_task_map_.find(task_id);
+          it != m_pending_task_map_.end())
+        return &*it;
+      if (auto it = m_submitted_task_buffer_.find(task_id);
+          it != m_submitted_task_buffer_.end())
+        return &*it;
+    }
+    if (visit_running) {
+      if (auto it = m_running_task_map_.find(task_id);
+          it != m_running_task_map_.end())
+        return &*it;
+    }
+    return nullptr;
+  };
+
+  std::optional<std::vector<task_id_t>> indexed_ids =
+      m_task_query_index_.Lookup(*request);
+
+  if (request->page_size() > 0) {
+    // A page holds the matching tasks after the cursor in ascending order of
+    // task id. One more task is returned to tell the caller whether there is
+    // a next page.
+    size_t page_limit = request->page_size() + 1;
+    std::vector<TaskMapValue*> page_tasks;
+    auto visit = [&](task_id_t task_id) {
+      TaskMapValue* value = find_task(task_id);
+      if (value != nullptr && task_rng_filter_all(*value))
+        page_tasks.emplace_back(value);
+      return page_tasks.size() < page_limit;
+    };
+
+    if (indexed_ids.has_value()) {
+      for (auto it = std::ranges::upper_bound(indexed_ids.value(),
+                                              request->page_after_task_id());
+           it != indexed_ids->end() && visit(*it); ++it);
+    } else {
+      m_task_query_index_.ForEachIdAfter(request->page_after_task_id(), visit);
+    }
+
+    for (TaskMapValue* value : page_tasks) append_fn(*value);
+    return;
+  }
+
+  if (!indexed_ids.has_value()) {
+    auto pending_rng =
+        m_pending_task_map_ |
+        ranges::views::take(visit_pending ? m_pending_task_map_.size() : 0);
+    auto buffered_rng =
+        m_submitted_task_buffer_ |
+        ranges::views::take(visit_pending ? m_submitted_task_buffer_.size()
+                                          : 0);
+    auto running_rng =
+        m_running_task_map_ |
+        ranges::views::take(visit_running ? m_running_task_map_.size() : 0);
+    auto pd_r_rng =
+        ranges::views::concat(pending_rng, buffered_rng, running_rng);
+
+    ranges::for_each(
+        apply_filters(pd_r_rng) | ranges::views::take(num_limit), append_fn);
+    return;
+  }
+
+  // Only the tasks matching the indexed filters are visited. The order of
+  // the pending, buffered and running tasks is kept.
+  std::vector<TaskMapValue*> pending_tasks;
+  std::vector<TaskMapValue*> buffered_tasks;
+  std::vector<TaskMapValue*> running_tasks;
+  for (task_id_t task_id : indexed_ids.value()) {
+    if (visit_pending) {
+      if (auto it = m_pending_task_map_.find(task_id);
+          it != m_pending_task_map_.end()) {
+        pending_tasks.emplace_back(&*it);
+        continue;
+      }
+      if (auto it = m_submitted_task_buffer_.find(task_id);
+          it != m_submitted_task_buffer_.end()) {
+        buffered_tasks.emplace_back(&*it);
+        continue;
+      }
+    }
+    if (visit_running) {
+      if (auto it = m_running_task_map_.find(task_id);
+          it != m_running_task_map_.end())
+        running_tasks.emplace_back(&*it);
+    }
+  }
+
+  auto indexed_rng =
+      ranges::views::concat(pending_tasks, buffered_tasks, running_tasks) |
+      ranges::views::transform(
+          [](TaskMapValue* value) -> TaskMapValue& { return *value; });
+  ranges::for_each(apply_filters(indexed_rng) | ranges::views::take(num_limit),
+                   append_fn);
+}
 
+void TaskScheduler::QueryTaskMemoryUsage(
+    crane::grpc::QuerySchedulerStatsReply* reply) {
+  auto add_usage = [reply](std::string state, const auto& task_map) {
+    auto* usage = reply->add_task_memory_usages();
+    usage->set_state(std::move(state));
+    usage->set_task_count(task_map.size());
+
+    size_t total_bytes = 0;
+    for (const auto& task : task_map | std::views::values)
+      total_bytes += task->ApproxMemoryUsage();
+    usage->set_total_bytes(total_bytes);
+  };
+
+  // The writer lock is needed since node selection modifies pending tasks
+  // under the reader lock.
   LockGuard pending_guard(&m_pending_task_map_mtx_);
-  LockGuard running_guard(&m_running_task_map_mtx_);
+  ReaderLockGuard running_guard(&m_running_task_map_mtx_);
 
-  ranges::for_each(filtered_rng, append_fn);
+  add_usage("Pending", m_pending_task_map_);
+  add_usage("Running", m_running_task_map_);
 }
 
 void TaskScheduler::QueryRnJobOnCtldForNodeConfig(
@@ -2369,7 +3607,180 @@ void TaskScheduler::TerminateOrphanedJobs(const std::set<task_id_t>& jobs,
   }
 }
 
-void MinLoadFirst::NodeSelectionInfo::InitCostAndTimeAvailResMap(
+namespace {
+
+void DenseResMinInPlace(DenseResourceInNode* lhs,
+                        const DenseResourceInNode& rhs) {
+  lhs->cpu_count = std::min(lhs->cpu_count, rhs.cpu_count);
+  lhs->memory_bytes = std::min(lhs->memory_bytes, rhs.memory_bytes);
+  lhs->memory_sw_bytes = std::min(lhs->memory_sw_bytes, rhs.memory_sw_bytes);
+
+  // Missing words are zero, so the common words are enough.
+  if (lhs->slot_bits.size() > rhs.slot_bits.size())
+    lhs->slot_bits.resize(rhs.slot_bits.size());
+  for (size_t i = 0; i < lhs->slot_bits.size(); i++)
+    lhs->slot_bits[i] &= rhs.slot_bits[i];
+
+  lhs->has_unknown_slots &= rhs.has_unknown_slots;
+}
+
+void DenseResMaxInPlace(DenseResourceInNode* lhs,
+                        const DenseResourceInNode& rhs) {
+  lhs->cpu_count = std::max(lhs->cpu_count, rhs.cpu_count);
+  lhs->memory_bytes = std::max(lhs->memory_bytes, rhs.memory_bytes);
+  lhs->memory_sw_bytes = std::max(lhs->memory_sw_bytes, rhs.memory_sw_bytes);
+
+  if (lhs->slot_bits.size() < rhs.slot_bits.size())
+    lhs->slot_bits.resize(rhs.slot_bits.size(), 0);
+  for (size_t i = 0; i < rhs.slot_bits.size(); i++)
+    lhs->slot_bits[i] |= rhs.slot_bits[i];
+
+  lhs->has_unknown_slots |= rhs.has_unknown_slots;
+}
+
+}  // namespace
+
+void MinLoadFirst::AvailResTimeline::Assign(
+    std::vector<absl::Time> times, std::vector<DenseResourceInNode> res) {
+  CRANE_ASSERT(times.size() == res.size());
+  m_times_ = std::move(times);
+  m_res_ = std::move(res);
+  RebuildTree_();
+}
+
+const DenseResourceInNode& MinLoadFirst::AvailResTimeline::ResAtTime(
+    absl::Time time) const {
+  auto it = std::ranges::upper_bound(m_times_, time);
+  CRANE_ASSERT(it != m_times_.begin());
+  return m_res_[std::distance(m_times_.begin(), it) - 1];
+}
+
+size_t MinLoadFirst::AvailResTimeline::LowerBound(absl::Time time) const {
+  return std::distance(m_times_.begin(),
+                       std::ranges::lower_bound(m_times_, time));
+}
+
+size_t MinLoadFirst::AvailResTimeline::NextFit(
+    size_t from, const DenseResourceInNode& req) const {
+  if (from >= Size()) return Size();
+  size_t pos = FindFirst_(1, 0, m_tree_capacity_, from, req, true);
+  return pos == kNpos ? Size() : pos;
+}
+
+size_t MinLoadFirst::AvailResTimeline::NextNonFit(
+    size_t from, const DenseResourceInNode& req) const {
+  if (from >= Size()) return Size();
+  size_t pos = FindFirst_(1, 0, m_tree_capacity_, from, req, false);
+  return pos == kNpos ? Size() : pos;
+}
+
+void MinLoadFirst::AvailResTimeline::Subtract(absl::Time start,
+                                              absl::Time end,
+                                              const DenseResourceInNode& res) {
+  CRANE_ASSERT(start < end);
+
+  size_t size_before = Size();
+  // The entry at `end` keeps the resource before subtraction, so it must be
+  // inserted first.
+  EnsureTimePoint_(end);
+  size_t start_pos = EnsureTimePoint_(start);
+  size_t end_pos = LowerBound(end);
+
+  for (size_t i = start_pos; i < end_pos; i++) {
+    CRANE_ASSERT(res <= m_res_[i]);
+    m_res_[i] -= res;
+  }
+
+  // An inserted time point shifts all the entries after it.
+  UpdateTree_(start_pos, Size() != size_before ? Size() : end_pos);
+}
+
+void MinLoadFirst::AvailResTimeline::SetToZeroAt(absl::Time time) {
+  size_t pos = LowerBound(time);
+  if (pos != Size() && m_times_[pos] == time) {
+    m_res_[pos].SetToZero();
+    UpdateTree_(pos, pos + 1);
+  } else {
+    m_times_.insert(m_times_.begin() + pos, time);
+    m_res_.insert(m_res_.begin() + pos, DenseResourceInNode{});
+    UpdateTree_(pos, Size());
+  }
+}
+
+size_t MinLoadFirst::AvailResTimeline::EnsureTimePoint_(absl::Time time) {
+  size_t pos = LowerBound(time);
+  if (pos != Size() && m_times_[pos] == time) return pos;
+
+  // There is always one time point (now) before any task starts or ends.
+  CRANE_ASSERT(pos > 0);
+  DenseResourceInNode prev_res = m_res_[pos - 1];
+  m_times_.insert(m_times_.begin() + pos, time);
+  m_res_.insert(m_res_.begin() + pos, std::move(prev_res));
+  return pos;
+}
+
+void MinLoadFirst::AvailResTimeline::RebuildTree_() {
+  m_tree_capacity_ = m_res_.empty() ? 0 : std::bit_ceil(m_res_.size());
+  m_min_tree_.assign(2 * m_tree_capacity_, DenseResourceInNode{});
+  m_max_tree_.assign(2 * m_tree_capacity_, DenseResourceInNode{});
+  if (m_tree_capacity_ != 0)
+    UpdateTreeNode_(1, 0, m_tree_capacity_, 0, m_res_.size());
+}
+
+void MinLoadFirst::AvailResTimeline::UpdateTree_(size_t from, size_t to) {
+  if (Size() > m_tree_capacity_) {
+    RebuildTree_();
+    return;
+  }
+  if (from < to) UpdateTreeNode_(1, 0, m_tree_capacity_, from, to);
+}
+
+void MinLoadFirst::AvailResTimeline::UpdateTreeNode_(size_t node, size_t lo,
+                                                     size_t hi, size_t from,
+                                                     size_t to) {
+  if (hi - lo == 1) {
+    m_min_tree_[node] = m_res_[lo];
+    m_max_tree_[node] = m_res_[lo];
+    return;
+  }
+
+  size_t mid = lo + (hi - lo) / 2;
+  if (from < mid) UpdateTreeNode_(2 * node, lo, mid, from, std::min(to, mid));
+  if (to > mid && mid < Size())
+    UpdateTreeNode_(2 * node + 1, mid, hi, std::max(from, mid), to);
+  PullTreeNode_(node, lo, hi);
+}
+
+void MinLoadFirst::AvailResTimeline::PullTreeNode_(size_t node, size_t lo,
+                                                   size_t hi) {
+  m_min_tree_[node] = m_min_tree_[2 * node];
+  m_max_tree_[node] = m_max_tree_[2 * node];
+
+  // The right half may lie past the last entry.
+  if (lo + (hi - lo) / 2 >= Size()) return;
+  DenseResMinInPlace(&m_min_tree_[node], m_min_tree_[2 * node + 1]);
+  DenseResMaxInPlace(&m_max_tree_[node], m_max_tree_[2 * node + 1]);
+}
+
+size_t MinLoadFirst::AvailResTimeline::FindFirst_(
+    size_t node, size_t lo, size_t hi, size_t from,
+    const DenseResourceInNode& req, bool fit) const {
+  if (hi <= from || lo >= Size()) return kNpos;
+
+  // `req <= res` is monotonic in `res`, so a whole range can be skipped by
+  // looking at its maximum (no entry fits) or its minimum (all entries fit).
+  if (fit ? !(req <= m_max_tree_[node]) : req <= m_min_tree_[node])
+    return kNpos;
+
+  if (hi - lo == 1) return lo;
+
+  size_t mid = lo + (hi - lo) / 2;
+  size_t pos = FindFirst_(2 * node, lo, mid, from, req, fit);
+  if (pos != kNpos) return pos;
+  return FindFirst_(2 * node + 1, mid, hi, from, req, fit);
+}
+
+void MinLoadFirst::CranedTimeline::Build(
     const CranedId& craned_id, const ResourceInNode& res_total,
     const ResourceInNode& res_avail, const absl::Time& now,
     const std::vector<std::pair<absl::Time, const ResourceInNode*>>&
@@ -2382,32 +3793,52 @@ void MinLoadFirst::NodeSelectionInfo::InitCostAndTimeAvailResMap(
   };
   std::vector<ResChange> changes;
 
-  uint64_t& cost = m_node_cost_map_[craned_id];
+  this->eval_time = now;
+  this->next_event_time = absl::InfiniteFuture();
+  this->res_total = res_total;
+  this->time_avail_res_map.clear();
+  this->cost_items.clear();
+  this->cost = 0;
+  this->has_resv = false;
+  this->first_resv_time = absl::InfiniteFuture();
+
   for (const auto& [end_time, res] : running_tasks) {
-    UpdateCostFunc(cost, now, end_time, *res, res_total);
+    double cpu_ratio = CpuRatio_(*res, res_total);
+    cost += CalculateCost_(now, end_time, cpu_ratio);
+    cost_items.emplace_back(CostItem{.start_time = absl::InfinitePast(),
+                                     .end_time = end_time,
+                                     .cpu_ratio = cpu_ratio,
+                                     .is_resv = false});
     changes.emplace_back(ResChange{end_time, res, false});
   }
 
   if (resv_map != nullptr && !resv_map->empty()) {
-    absl::Time first_resv_time = absl::InfiniteFuture();
+    has_resv = true;
     for (const auto& [resv_id, resv] : *resv_map) {
       const absl::Time& end_time = resv.end_time;
       if (end_time < now) {  // Already expired
         continue;
       }
       absl::Time start_time = std::max(now, resv.start_time);
-      UpdateCostFunc(cost, start_time, end_time, resv.res_total, res_total);
+      double cpu_ratio = CpuRatio_(resv.res_total, res_total);
+      cost += CalculateCost_(start_time, end_time, cpu_ratio);
+      cost_items.emplace_back(CostItem{.start_time = resv.start_time,
+                                       .end_time = end_time,
+                                       .cpu_ratio = cpu_ratio,
+                                       .is_resv = true});
       changes.emplace_back(ResChange{start_time, &resv.res_total, true});
       changes.emplace_back(ResChange{end_time, &resv.res_total, false});
       if (start_time < first_resv_time) {
         first_resv_time = start_time;
       }
     }
-    m_first_resv_time_map_[craned_id] = first_resv_time;
   }
 
-  m_cost_node_id_set_.emplace(cost, craned_id);
-  m_node_res_total_map_[craned_id] = res_total;
+  // Allocations made at `now` (reservations already started) stay at the
+  // first entry whatever `now` is, so they don't limit the reuse.
+  for (const auto& change : changes)
+    if (change.time > now || !change.is_alloc)
+      next_event_time = std::min(next_event_time, change.time);
 
   std::sort(changes.begin(), changes.end(),
             [](const ResChange& lhs, const ResChange& rhs) {
@@ -2416,7 +3847,6 @@ void MinLoadFirst::NodeSelectionInfo::InitCostAndTimeAvailResMap(
                                rhs.is_alloc  // release before  allocation
                          : lhs.time < rhs.time;
             });
-  TimeAvailResMap& time_avail_res_map = m_node_time_avail_res_map_[craned_id];
   {
     auto [cur_iter, ok] = time_avail_res_map.emplace(now, res_avail);
 
@@ -2452,6 +3882,17 @@ void MinLoadFirst::NodeSelectionInfo::InitCostAndTimeAvailResMap(
     }
   }
 
+  res_layout = std::make_shared<const ResourceInNodeLayout>(res_total);
+  std::vector<absl::Time> dense_times;
+  std::vector<DenseResourceInNode> dense_res;
+  dense_times.reserve(time_avail_res_map.size());
+  dense_res.reserve(time_avail_res_map.size());
+  for (const auto& [time, res] : time_avail_res_map) {
+    dense_times.emplace_back(time);
+    dense_res.emplace_back(res_layout->Encode(res));
+  }
+  dense_timeline.Assign(std::move(dense_times), std::move(dense_res));
+
   if constexpr (kAlgoTraceOutput) {
     std::string str;
     str.append(fmt::format("Node {}: ", craned_id));
@@ -2478,6 +3919,128 @@ void MinLoadFirst::NodeSelectionInfo::InitCostAndTimeAvailResMap(
   }
 }
 
+void MinLoadFirst::CranedTimeline::ShiftTo(absl::Time now) {
+  if (now == eval_time) return;
+
+  // All the events are after `now + 1s`, only the first entry is moved.
+  auto first_node = time_avail_res_map.extract(time_avail_res_map.begin());
+  first_node.key() = now;
+  time_avail_res_map.insert(std::move(first_node));
+
+  dense_timeline.SetFirstTime(now);
+
+  cost = 0;
+  first_resv_time = absl::InfiniteFuture();
+  for (const auto& item : cost_items) {
+    absl::Time start_time = std::max(now, item.start_time);
+    cost += CalculateCost_(start_time, item.end_time, item.cpu_ratio);
+    if (item.is_resv && start_time < first_resv_time)
+      first_resv_time = start_time;
+  }
+
+  eval_time = now;
+}
+
+void MinLoadFirst::NodeSelectionInfo::InitCostAndTimeAvailResMap(
+    const CranedId& craned_id, const ResourceInNode& res_total,
+    const ResourceInNode& res_avail, const absl::Time& now,
+    const std::vector<std::pair<absl::Time, const ResourceInNode*>>&
+        running_tasks,
+    const absl::flat_hash_map<ResvId, CranedMeta::ResvInNode>* resv_map) {
+  CranedTimeline timeline;
+  timeline.Build(craned_id, res_total, res_avail, now, running_tasks,
+                 resv_map);
+
+  InitEntry_(craned_id, timeline).owned_timeline =
+      std::move(timeline.dense_timeline);
+}
+
+void MinLoadFirst::NodeSelectionInfo::InitFromCranedTimeline(
+    const CranedId& craned_id, const CranedTimeline& timeline) {
+  InitEntry_(craned_id, timeline).shared_timeline = &timeline.dense_timeline;
+}
+
+MinLoadFirst::NodeSelectionInfo::NodeEntry&
+MinLoadFirst::NodeSelectionInfo::InitEntry_(const CranedId& craned_id,
+                                            const CranedTimeline& timeline) {
+  auto [it, ok] = m_node_entries_.try_emplace(craned_id);
+  NodeEntry& entry = it->second;
+  if (!ok) m_cost_node_id_set_.erase({entry.cost, &it->first});
+
+  entry.owned_timeline.reset();
+  entry.shared_timeline = nullptr;
+  entry.cost = timeline.cost;
+  entry.total_cpu_count = timeline.res_total.allocatable_res.cpu_count;
+  entry.res_layout = timeline.res_layout;
+  entry.first_resv_time =
+      timeline.has_resv ? timeline.first_resv_time : absl::InfiniteFuture();
+  m_cost_node_id_set_.emplace(entry.cost, &it->first);
+  return entry;
+}
+
+void MinLoadFirst::BuildCranedTimeline_(
+    const absl::flat_hash_map<uint32_t, std::unique_ptr<TaskInCtld>>&
+        running_tasks,
+    absl::Time now, const PartitionId& partition_id, const CranedId& craned_id,
+    const CranedMeta& craned_meta, CranedTimeline* timeline) {
+  std::vector<std::pair<absl::Time, const ResourceInNode*>>
+      end_time_task_res_vec;
+
+  for (const auto& [task_id, res] : craned_meta.rn_task_res_map) {
+    const auto& task = running_tasks.at(task_id);
+    absl::Time end_time = std::max(task->StartTime() + task->time_limit,
+                                   now + absl::Seconds(1));
+    if (task->reservation == "") {  // task using reserved resource is not
+                                    // considered here.
+      // For some completing tasks,
+      // task->StartTime() + task->time_limit <= absl::Now().
+      // In this case,
+      // max(task->StartTime() + task->time_limit, now + absl::Seconds(1))
+      // should be taken for end time,
+      // otherwise, tasks might be scheduled and executed even when
+      // res_avail = 0 and will cause a severe error where res_avail < 0.
+      end_time_task_res_vec.emplace_back(end_time, &res);
+    }
+  }
+
+  if constexpr (kAlgoTraceOutput) {
+    std::vector<std::pair<absl::Time, task_id_t>> end_time_task_id_vec;
+    for (const auto& [task_id, res] : craned_meta.rn_task_res_map) {
+      const auto& task = running_tasks.at(task_id);
+      absl::Time end_time = std::max(task->StartTime() + task->time_limit,
+                                     now + absl::Seconds(1));
+      if (task->reservation == "") {
+        end_time_task_id_vec.emplace_back(end_time, task_id);
+      }
+    }
+
+    std::string running_task_ids_str;
+    for (const auto& [end_time, task_id] : end_time_task_id_vec)
+      running_task_ids_str.append(fmt::format("{}, ", task_id));
+    CRANE_TRACE("Craned node {} has running non-reservation tasks: {}",
+                craned_id, running_task_ids_str);
+
+    std::sort(end_time_task_id_vec.begin(), end_time_task_id_vec.end(),
+              [](const auto& lhs, const auto& rhs) {
+                return lhs.first < rhs.first;
+              });
+    if (!end_time_task_id_vec.empty()) {
+      std::string str;
+      str.append(
+          fmt::format("Partition {}, Craned {}: ", partition_id, craned_id));
+      for (auto [end_time, task_id] : end_time_task_id_vec) {
+        str.append(fmt::format("Task #{} ends after {}s, ", task_id,
+                               absl::ToInt64Seconds(end_time - now)));
+      }
+      CRANE_TRACE("{}", str);
+    }
+  }
+
+  timeline->Build(craned_id, craned_meta.res_total, craned_meta.res_avail,
+                  now, end_time_task_res_vec, &craned_meta.resv_in_node_map);
+  timeline->sched_version = craned_meta.sched_version;
+}
+
 void MinLoadFirst::CalculateNodeSelectionInfoOfPartition_(
     const absl::flat_hash_map<uint32_t, std::unique_ptr<TaskInCtld>>&
         running_tasks,
@@ -2488,69 +4051,84 @@ void MinLoadFirst::CalculateNodeSelectionInfoOfPartition_(
   NodeSelectionInfo& node_selection_info_ref = *node_selection_info;
 
   for (const auto& craned_id : craned_ids) {
+    // A craned node may belong to multiple partitions. Its timeline is built
+    // or shifted only once per cycle and shared by all these partitions.
+    CranedTimeline& timeline = m_craned_timeline_cache_[craned_id];
+
+    // A craned unchanged since its meta was read is neither locked nor
+    // read. Only its timeline is moved to the new `now`.
+    if (timeline.meta_seen) {
+      if (!timeline.schedulable) continue;
+      if (timeline.FreshAt(now)) {
+        timeline.ShiftTo(now);
+#ifndef NDEBUG
+        auto craned_meta = craned_meta_map.at(craned_id).GetExclusivePtr();
+        // Changed after the change stream was read. Seen in the next cycle.
+        if (craned_meta->sched_version == timeline.sched_version)
+          DebugCheckCranedTimeline_(running_tasks, now, partition_id,
+                                    craned_id, *craned_meta, timeline);
+#endif
+        node_selection_info_ref.InitFromCranedTimeline(craned_id, timeline);
+        continue;
+      }
+    }
+
     auto& craned_meta_ptr = craned_meta_map.at(craned_id);
     auto craned_meta = craned_meta_ptr.GetExclusivePtr();
 
     // An offline craned shouldn't be scheduled.
-    if (!craned_meta->alive || craned_meta->drain) continue;
-
-    std::vector<std::pair<absl::Time, const ResourceInNode*>>
-        end_time_task_res_vec;
-
-    for (const auto& [task_id, res] : craned_meta->rn_task_res_map) {
-      const auto& task = running_tasks.at(task_id);
-      absl::Time end_time = std::max(task->StartTime() + task->time_limit,
-                                     now + absl::Seconds(1));
-      if (task->reservation == "") {  // task using reserved resource is not
-                                      // considered here.
-        // For some completing tasks,
-        // task->StartTime() + task->time_limit <= absl::Now().
-        // In this case,
-        // max(task->StartTime() + task->time_limit, now + absl::Seconds(1))
-        // should be taken for end time,
-        // otherwise, tasks might be scheduled and executed even when
-        // res_avail = 0 and will cause a severe error where res_avail < 0.
-        end_time_task_res_vec.emplace_back(end_time, &res);
-      }
+    timeline.meta_seen = true;
+    timeline.schedulable = craned_meta->alive && !craned_meta->drain;
+    if (!timeline.schedulable) continue;
+
+    if (timeline.ReusableAt(craned_meta->sched_version, now)) {
+      timeline.ShiftTo(now);
+      DebugCheckCranedTimeline_(running_tasks, now, partition_id, craned_id,
+                                *craned_meta, timeline);
+    } else {
+      BuildCranedTimeline_(running_tasks, now, partition_id, craned_id,
+                           *craned_meta, &timeline);
     }
 
-    if constexpr (kAlgoTraceOutput) {
-      std::vector<std::pair<absl::Time, task_id_t>> end_time_task_id_vec;
-      for (const auto& [task_id, res] : craned_meta->rn_task_res_map) {
-        const auto& task = running_tasks.at(task_id);
-        absl::Time end_time = std::max(task->StartTime() + task->time_limit,
-                                       now + absl::Seconds(1));
-        if (task->reservation == "") {
-          end_time_task_id_vec.emplace_back(end_time, task_id);
-        }
-      }
+    node_selection_info_ref.InitFromCranedTimeline(craned_id, timeline);
+  }
+}
 
-      std::string running_task_ids_str;
-      for (const auto& [end_time, task_id] : end_time_task_id_vec)
-        running_task_ids_str.append(fmt::format("{}, ", task_id));
-      CRANE_TRACE("Craned node {} has running non-reservation tasks: {}",
-                  craned_id, running_task_ids_str);
+void MinLoadFirst::DebugCheckCranedTimeline_(
+    const absl::flat_hash_map<uint32_t, std::unique_ptr<TaskInCtld>>&
+        running_tasks,
+    absl::Time now, const PartitionId& partition_id, const CranedId& craned_id,
+    const CranedMeta& craned_meta, const CranedTimeline& timeline) {
+#ifndef NDEBUG
+  CranedTimeline rebuilt_timeline;
+  BuildCranedTimeline_(running_tasks, now, partition_id, craned_id,
+                       craned_meta, &rebuilt_timeline);
+  CRANE_ASSERT_MSG_VA(
+      timeline.time_avail_res_map == rebuilt_timeline.time_avail_res_map &&
+          timeline.dense_timeline == rebuilt_timeline.dense_timeline &&
+          timeline.cost == rebuilt_timeline.cost &&
+          timeline.first_resv_time == rebuilt_timeline.first_resv_time,
+      "Cached timeline of craned {} differs from the rebuilt one", craned_id);
+#endif
+}
 
-      std::sort(end_time_task_id_vec.begin(), end_time_task_id_vec.end(),
-                [](const auto& lhs, const auto& rhs) {
-                  return lhs.first < rhs.first;
-                });
-      if (!end_time_task_id_vec.empty()) {
-        std::string str;
-        str.append(
-            fmt::format("Partition {}, Craned {}: ", partition_id, craned_id));
-        for (auto [end_time, task_id] : end_time_task_id_vec) {
-          str.append(fmt::format("Task #{} ends after {}s, ", task_id,
-                                 absl::ToInt64Seconds(end_time - now)));
-        }
-        CRANE_TRACE("{}", str);
-      }
-    }
+void MinLoadFirst::ConsumeCranedChanges_() {
+  HashSet<CranedId> changed_craned_ids;
+  auto seq = g_meta_container->ReadCranedChanges(m_craned_change_seq_,
+                                                 &changed_craned_ids);
+  if (!seq) {
+    CRANE_DEBUG("Craned changes were dropped. Rechecking all the craneds.");
+    for (auto& timeline : m_craned_timeline_cache_ | std::views::values)
+      timeline.meta_seen = false;
+    m_craned_change_seq_ = seq.error();
+    return;
+  }
 
-    node_selection_info_ref.InitCostAndTimeAvailResMap(
-        craned_id, craned_meta->res_total, craned_meta->res_avail, now,
-        end_time_task_res_vec, &craned_meta->resv_in_node_map);
+  for (const auto& craned_id : changed_craned_ids) {
+    auto iter = m_craned_timeline_cache_.find(craned_id);
+    if (iter != m_craned_timeline_cache_.end()) iter->second.meta_seen = false;
   }
+  m_craned_change_seq_ = seq.value();
 }
 
 void MinLoadFirst::CalculateNodeSelectionInfoOfReservation_(
@@ -2601,8 +4179,51 @@ void MinLoadFirst::CalculateNodeSelectionInfoOfReservation_(
     auto& time_avail_res_map =
         node_selection_info_ref.GetTimeAvailResMap(craned_id);
 
-    time_avail_res_map[resv_meta->logical_part.end_time].SetToZero();
+    time_avail_res_map.SetToZeroAt(resv_meta->logical_part.end_time);
+  }
+}
+
+CranedMetaContainer::CranedFilter MinLoadFirst::SchedulableCranedFilterOf_(
+    const TaskInCtld& task) {
+  CranedMetaContainer::CranedFilter filter;
+  filter.resource_states = {crane::grpc::CranedResourceState::CRANE_IDLE,
+                            crane::grpc::CranedResourceState::CRANE_MIX,
+                            crane::grpc::CranedResourceState::CRANE_ALLOC};
+  filter.drained = false;
+
+  for (const auto& [name, counts] :
+       task.requested_node_res_view.GetDeviceMap()) {
+    const auto& [untyped_count, type_count_map] = counts;
+    if (untyped_count > 0) filter.devices.emplace_back(name);
+    for (const auto& [type, count] : type_count_map)
+      if (count > 0) filter.devices.emplace_back(absl::StrCat(name, ":", type));
   }
+
+  return filter;
+}
+
+MinLoadFirst::TaskShape::TaskShape(const TaskInCtld& task)
+    : partition_id(task.partition_id),
+      reservation(task.reservation),
+      node_num(task.node_num),
+      time_limit(task.time_limit),
+      exclusive(task.TaskToCtld().exclusive()),
+      allocatable_res(task.requested_node_res_view.GetAllocatableRes()),
+      device_map(task.requested_node_res_view.GetDeviceMap()),
+      included_nodes(task.included_nodes.begin(), task.included_nodes.end()),
+      excluded_nodes(task.excluded_nodes.begin(), task.excluded_nodes.end()) {
+  std::ranges::sort(included_nodes);
+  std::ranges::sort(excluded_nodes);
+}
+
+bool MinLoadFirst::TaskShape::operator==(const TaskShape& rhs) const {
+  return partition_id == rhs.partition_id && reservation == rhs.reservation &&
+         node_num == rhs.node_num && time_limit == rhs.time_limit &&
+         exclusive == rhs.exclusive &&
+         allocatable_res == rhs.allocatable_res &&
+         device_map == rhs.device_map &&
+         included_nodes == rhs.included_nodes &&
+         excluded_nodes == rhs.excluded_nodes;
 }
 
 bool MinLoadFirst::CalculateRunningNodesAndStartTime_(
@@ -2621,14 +4242,24 @@ bool MinLoadFirst::CalculateRunningNodesAndStartTime_(
   std::vector<CranedId> craned_indexes_;
   std::vector<CranedId> ready_craned_indexes_;
 
+  // In topology-aware mode, all the ready nodes are collected before a
+  // subset of them is picked, unless one leaf switch has enough of them.
+  const NetworkTopology& topology = g_meta_container->GetTopology();
+  bool topology_aware = g_config.TopologyAwareSelection &&
+                        task->node_num > 1 && !topology.Empty();
+  std::vector<ResourceInNode> ready_feasible_res;
+  std::vector<uint32_t> switch_ready_counts;
+  if (topology_aware) switch_ready_counts.resize(topology.switches.size());
+  bool leaf_switch_found = false;
+
   ResourceV2 allocated_res;
   task->allocated_res_view.SetToZero();
 
   absl::Time earliest_end_time = now + task->time_limit;
   ResourceView requested_node_res_view;
 
-  for (const auto& craned_index :
-       node_selection_info.GetCostNodeIdSet() | std::views::values) {
+  for (const CranedId& craned_index :
+       node_selection_info.GetCostSortedCranedIds()) {
     if (!partition_meta_ptr.GetExclusivePtr()->craned_ids.contains(
             craned_index)) {
       // TODO: Performance issue! We can use cached available node set
@@ -2639,7 +4270,7 @@ bool MinLoadFirst::CalculateRunningNodesAndStartTime_(
         node_selection_info.GetTimeAvailResMap(craned_index);
     // Number of tasks is not less than map size.
     // When condition is true, the craned has too many tasks.
-    if (time_avail_res_map.size() >= kAlgoMaxTaskNumPerNode) {
+    if (time_avail_res_map.Size() >= kAlgoMaxTaskNumPerNode) {
       if constexpr (kAlgoTraceOutput) {
         CRANE_TRACE("Craned {} has too many tasks. Skipping this craned.",
                     craned_index);
@@ -2712,13 +4343,27 @@ bool MinLoadFirst::CalculateRunningNodesAndStartTime_(
       bool ok = requested_node_res_view.GetFeasibleResourceInNode(
           craned_meta->res_avail, &feasible_res);
       if (ok) {
-        bool is_node_satisfied_now = true;
-        for (const auto& [time, res] : time_avail_res_map) {
-          if (time >= earliest_end_time) break;
-          if (!(feasible_res <= res)) is_node_satisfied_now = false;
-        }
+        DenseResourceInNode dense_feasible_res =
+            node_selection_info.GetResLayout(craned_index)
+                .Encode(feasible_res);
+        bool is_node_satisfied_now = time_avail_res_map.FitsBefore(
+            earliest_end_time, dense_feasible_res);
 
-        if (is_node_satisfied_now) {
+        if (is_node_satisfied_now && topology_aware) {
+          ready_craned_indexes_.emplace_back(craned_index);
+          ready_feasible_res.emplace_back(std::move(feasible_res));
+
+          auto path_it = topology.craned_switch_path_map.find(craned_index);
+          if (path_it == topology.craned_switch_path_map.end()) continue;
+          for (uint32_t switch_index : path_it->second)
+            switch_ready_counts[switch_index]++;
+
+          uint32_t leaf_index = path_it->second.front();
+          if (switch_ready_counts[leaf_index] >= task->node_num) {
+            leaf_switch_found = true;
+            break;
+          }
+        } else if (is_node_satisfied_now) {
           ready_craned_indexes_.emplace_back(craned_index);
           allocated_res.AddResourceInNode(craned_index, feasible_res);
           task->allocated_res_view += feasible_res;
@@ -2735,6 +4380,31 @@ bool MinLoadFirst::CalculateRunningNodesAndStartTime_(
     }
   }
 
+  if (topology_aware && ready_craned_indexes_.size() >= task->node_num) {
+    std::vector<size_t> selected_indexes;
+    if (!SelectNodesByTopology_(topology, ready_craned_indexes_,
+                                switch_ready_counts, task->node_num,
+                                &selected_indexes)) {
+      // Not enough ready nodes under any single switch.
+      for (size_t i = 0; i < task->node_num; i++)
+        selected_indexes.emplace_back(i);
+    }
+    if constexpr (kAlgoTraceOutput) {
+      CRANE_TRACE("Task #{} placed by topology. One leaf switch: {}.",
+                  task->TaskId(), leaf_switch_found);
+    }
+
+    for (size_t i : selected_indexes) {
+      allocated_res.AddResourceInNode(ready_craned_indexes_[i],
+                                      ready_feasible_res[i]);
+      task->allocated_res_view += ready_feasible_res[i];
+      craned_ids->emplace_back(ready_craned_indexes_[i]);
+    }
+    task->SetAllocatedRes(std::move(allocated_res));
+    *start_time = now;
+    return true;
+  }
+
   if (craned_indexes_.size() < task->node_num) return false;
 
   allocated_res.SetToZero();
@@ -2774,14 +4444,23 @@ bool MinLoadFirst::CalculateRunningNodesAndStartTime_(
 void MinLoadFirst::NodeSelect(
     const absl::flat_hash_map<task_id_t, std::unique_ptr<TaskInCtld>>&
         running_tasks,
-    absl::btree_map<task_id_t, std::unique_ptr<TaskInCtld>>* pending_task_map,
-    std::list<NodeSelectionResult>* selection_result_list) {
+    const absl::btree_map<task_id_t, std::unique_ptr<TaskInCtld>>&
+        pending_task_map,
+    std::vector<SelectedTask>* selected_tasks) {
+  // Its timelines are shared with the cache, which is updated below.
+  m_last_part_id_node_info_map_.clear();
+
   std::unordered_map<PartitionId, NodeSelectionInfo> part_id_node_info_map;
 
   // Truncated by 1s.
   // We use the time now as the base time across the whole algorithm.
   absl::Time now = absl::FromUnixSeconds(ToUnixSeconds(absl::Now()));
 
+  bool budgeted = g_config.ScheduleCycleBudgetMs != 0;
+  absl::Time deadline = absl::InfiniteFuture();
+  if (budgeted)
+    deadline = absl::Now() + absl::Milliseconds(g_config.ScheduleCycleBudgetMs);
+
   std::unordered_map<ResvId, NodeSelectionInfo> resv_id_node_info_map;
 
   {
@@ -2802,6 +4481,8 @@ void MinLoadFirst::NodeSelect(
   }
 
   {
+    ConsumeCranedChanges_();
+
     auto all_partitions_meta_map =
         g_meta_container->GetAllPartitionsMetaMapConstPtr();
     auto craned_meta_map = g_meta_container->GetCranedMetaMapConstPtr();
@@ -2821,27 +4502,357 @@ void MinLoadFirst::NodeSelect(
   }
 
   std::vector<task_id_t> task_id_vec;
-  task_id_vec = m_priority_sorter_->GetOrderedTaskIdList(
-      *pending_task_map, running_tasks, g_config.ScheduledBatchSize, now);
+  if (!m_resume_task_ids_.empty()) {
+    // Go on with the pass stopped by the budget in the last cycle. Tasks
+    // submitted since then wait until the pass is finished.
+    for (task_id_t task_id : m_resume_task_ids_) {
+      auto it = pending_task_map.find(task_id);
+      if (it != pending_task_map.end() && !it->second->Blocked())
+        task_id_vec.emplace_back(task_id);
+    }
+    m_resume_task_ids_.clear();
+    SubtractPassPlans_(now, pending_task_map, &part_id_node_info_map);
+    CRANE_TRACE("Node selection resumed with {} tasks.", task_id_vec.size());
+  } else {
+    m_pass_planned_tasks_.clear();
+
+    SchedulerStats::ScopedTimer timer(g_scheduler_stats.get(),
+                                      SchedulerStats::Phase::PrioritySort);
+    task_id_vec = m_priority_sorter_->GetOrderedTaskIdList(
+        pending_task_map, running_tasks, g_config.ScheduledBatchSize, now);
+  }
+
+  std::vector<PlannedTask>* planned_tasks =
+      budgeted ? &m_pass_planned_tasks_ : nullptr;
+
+  std::vector<std::vector<task_id_t>> task_id_groups;
+  if (g_config.ParallelNodeSelection)
+    task_id_groups = GroupTasksByDisjointPartitions_(task_id_vec,
+                                                     pending_task_map);
+
+  size_t evaluated_num = 0;
+  if (task_id_groups.size() <= 1) {
+    evaluated_num = SelectNodesForTasks_(
+        task_id_vec, now, deadline, pending_task_map, &part_id_node_info_map,
+        &resv_id_node_info_map, selected_tasks, planned_tasks);
+    m_resume_task_ids_.assign(task_id_vec.begin() + evaluated_num,
+                              task_id_vec.end());
+  } else {
+    // Groups share no craned node, so the NodeSelectionInfo used by one group
+    // is never touched by another one and the selection can run concurrently.
+    std::vector<std::vector<SelectedTask>> group_selected_tasks(
+        task_id_groups.size());
+    std::vector<std::vector<PlannedTask>> group_planned_tasks(
+        task_id_groups.size());
+    std::vector<size_t> group_evaluated_nums(task_id_groups.size());
+
+    absl::BlockingCounter bl(task_id_groups.size());
+    for (size_t i = 0; i < task_id_groups.size(); i++) {
+      g_thread_pool->detach_task([&, i] {
+        group_evaluated_nums[i] = SelectNodesForTasks_(
+            task_id_groups[i], now, deadline, pending_task_map,
+            &part_id_node_info_map, &resv_id_node_info_map,
+            &group_selected_tasks[i],
+            budgeted ? &group_planned_tasks[i] : nullptr);
+        bl.DecrementCount();
+      });
+    }
+    bl.Wait();
+
+    // Keep the results in the priority order.
+    std::unordered_map<task_id_t, size_t> task_rank_map;
+    for (size_t i = 0; i < task_id_vec.size(); i++)
+      task_rank_map.emplace(task_id_vec[i], i);
+
+    for (auto& group_selected : group_selected_tasks)
+      for (auto& selected : group_selected)
+        selected_tasks->emplace_back(std::move(selected));
+
+    std::ranges::sort(*selected_tasks, [&](const SelectedTask& lhs,
+                                           const SelectedTask& rhs) {
+      return task_rank_map.at(lhs.task_id) < task_rank_map.at(rhs.task_id);
+    });
+
+    for (size_t i = 0; i < task_id_groups.size(); i++) {
+      evaluated_num += group_evaluated_nums[i];
+      m_resume_task_ids_.insert(
+          m_resume_task_ids_.end(),
+          task_id_groups[i].begin() + group_evaluated_nums[i],
+          task_id_groups[i].end());
+      std::ranges::move(group_planned_tasks[i],
+                        std::back_inserter(m_pass_planned_tasks_));
+    }
+    std::ranges::sort(m_resume_task_ids_, {}, [&](task_id_t task_id) {
+      return task_rank_map.at(task_id);
+    });
+
+    CRANE_TRACE("Node selection ran in {} disjoint partition groups.",
+                task_id_groups.size());
+  }
+
+  bool budget_hit = !m_resume_task_ids_.empty();
+  g_scheduler_stats->RecordNodeSelection(evaluated_num, budget_hit);
+  if (budget_hit)
+    CRANE_DEBUG(
+        "Node selection ran out of its budget after {} tasks. {} tasks are "
+        "left to the next cycle.",
+        evaluated_num, m_resume_task_ids_.size());
+  else
+    m_pass_planned_tasks_.clear();
+
+  m_last_part_id_node_info_map_ = std::move(part_id_node_info_map);
+}
+
+void MinLoadFirst::SubtractPassPlans_(
+    absl::Time now, const OrderedTaskMap& pending_task_map,
+    std::unordered_map<PartitionId, NodeSelectionInfo>*
+        part_id_node_info_map) {
+  auto craned_meta_map = g_meta_container->GetCranedMetaMapConstPtr();
+
+  for (const PlannedTask& planned : m_pass_planned_tasks_) {
+    auto it = pending_task_map.find(planned.task_id);
+    if (it == pending_task_map.end() || it->second->Blocked()) continue;
+    const TaskInCtld& task = *it->second;
+
+    // The part of the plan which has passed is dropped.
+    absl::Time start_time = std::max(planned.start_time, now);
+    absl::Time end_time = planned.start_time + task.time_limit;
+    if (end_time <= start_time) continue;
+
+    std::unordered_map<PartitionId, std::list<CranedId>> involved_part_craned;
+    for (const CranedId& craned_id : planned.craned_ids) {
+      auto craned_it = craned_meta_map->find(craned_id);
+      if (craned_it == craned_meta_map->end()) continue;
+      auto craned_meta = craned_it->second.GetExclusivePtr();
+      for (const PartitionId& partition_id :
+           craned_meta->static_meta.partition_ids) {
+        auto info_it = part_id_node_info_map->find(partition_id);
+        // Craneds no longer schedulable are not in the NodeSelectionInfo.
+        if (info_it != part_id_node_info_map->end() &&
+            info_it->second.Contains(craned_id))
+          involved_part_craned[partition_id].emplace_back(craned_id);
+      }
+    }
+
+    for (const auto& [partition_id, part_craned_ids] : involved_part_craned)
+      SubtractTaskResourceNodeSelectionInfo_(
+          start_time, end_time - start_time, task.AllocatedRes(),
+          part_craned_ids, &part_id_node_info_map->at(partition_id));
+  }
+}
+
+void MinLoadFirst::FastLaneSelect(
+    const absl::btree_map<task_id_t, std::unique_ptr<TaskInCtld>>&
+        pending_task_map,
+    const std::vector<task_id_t>& task_ids,
+    std::vector<SelectedTask>* selected_tasks) {
+  if (m_last_part_id_node_info_map_.empty()) return;
+
+  absl::Time now = absl::FromUnixSeconds(ToUnixSeconds(absl::Now()));
+
+  for (task_id_t task_id : task_ids) {
+    auto task_it = pending_task_map.find(task_id);
+    if (task_it == pending_task_map.end()) continue;
+    TaskInCtld* task = task_it->second.get();
+
+    // Tasks of reservations are left to the scheduling cycle, which builds
+    // the NodeSelectionInfo of reservations.
+    if (task->Blocked() || !task->reservation.empty()) continue;
+
+    auto node_info_it = m_last_part_id_node_info_map_.find(task->partition_id);
+    if (node_info_it == m_last_part_id_node_info_map_.end()) continue;
+
+    if (g_meta_container->CountCraneds(task->partition_id,
+                                       SchedulableCranedFilterOf_(*task)) <
+        task->node_num)
+      continue;
+
+    std::list<CranedId> craned_ids;
+    absl::Time start_time;
+    std::unordered_map<PartitionId, std::list<CranedId>> involved_part_craned;
+    {
+      auto all_partitions_meta_map =
+          g_meta_container->GetAllPartitionsMetaMapConstPtr();
+      auto craned_meta_map = g_meta_container->GetCranedMetaMapConstPtr();
+
+      // The timelines start at the time of the last cycle. The resources
+      // freed since then are not in them, which only makes the check
+      // stricter, while the current res_avail of the craneds is checked as
+      // well.
+      bool ok = CalculateRunningNodesAndStartTime_(
+          node_info_it->second, all_partitions_meta_map->at(task->partition_id),
+          *craned_meta_map, task, now, &craned_ids, &start_time);
+      if (!ok || start_time != now) continue;
+
+      // The craneds may have been drained or got a reservation since the
+      // timelines were built.
+      bool usable =
+          std::ranges::all_of(craned_ids, [&](const CranedId& craned_id) {
+            auto craned_meta = craned_meta_map->at(craned_id).GetExclusivePtr();
+            if (!craned_meta->alive || craned_meta->drain) return false;
+            return std::ranges::none_of(
+                craned_meta->resv_in_node_map | std::views::values,
+                [&](const CranedMeta::ResvInNode& resv) {
+                  return resv.start_time < now + task->time_limit &&
+                         resv.end_time > now;
+                });
+          });
+      if (!usable) continue;
+
+      for (CranedId const& craned_id : craned_ids) {
+        auto craned_meta = craned_meta_map->at(craned_id).GetExclusivePtr();
+        for (PartitionId const& partition_id :
+             craned_meta->static_meta.partition_ids)
+          involved_part_craned[partition_id].emplace_back(craned_id);
+      }
+    }
+
+    task->SetStartTime(now);
+    task->SetEndTime(now + task->time_limit);
+
+    // Keep the following fast lane tasks off the resources taken by this
+    // one.
+    for (const auto& [partition_id, part_craned_ids] : involved_part_craned) {
+      auto it = m_last_part_id_node_info_map_.find(partition_id);
+      if (it == m_last_part_id_node_info_map_.end()) continue;
+      SubtractTaskResourceNodeSelectionInfo_(now, task->time_limit,
+                                             task->AllocatedRes(),
+                                             part_craned_ids, &it->second);
+    }
+
+    g_meta_container->MallocResourceFromNodes(task->TaskId(),
+                                              task->AllocatedRes());
+    selected_tasks->emplace_back(
+        SelectedTask{.task_id = task_id,
+                     .craned_ids = std::move(craned_ids),
+                     .reservation = task->reservation,
+                     .time_limit = task->time_limit});
+  }
+}
+
+std::vector<std::vector<task_id_t>>
+MinLoadFirst::GroupTasksByDisjointPartitions_(
+    const std::vector<task_id_t>& task_ids,
+    const OrderedTaskMap& pending_task_map) {
+  // Union-find over partitions. Partitions sharing any craned node end up in
+  // the same set.
+  std::unordered_map<PartitionId, PartitionId> parent_map;
+  auto find_root = [&parent_map](const PartitionId& part_id) {
+    PartitionId root = part_id;
+    for (auto it = parent_map.find(root);
+         it != parent_map.end() && it->second != root;
+         it = parent_map.find(root))
+      root = it->second;
+    return root;
+  };
+  auto unite = [&](const PartitionId& lhs, const PartitionId& rhs) {
+    PartitionId lhs_root = find_root(lhs);
+    PartitionId rhs_root = find_root(rhs);
+    if (lhs_root != rhs_root) parent_map[lhs_root] = rhs_root;
+  };
+
+  std::unordered_map<ResvId, PartitionId> resv_part_map;
+  {
+    auto craned_meta_map = g_meta_container->GetCranedMetaMapConstPtr();
+    for (const auto& craned_meta_ptr : *craned_meta_map | std::views::values) {
+      auto craned_meta = craned_meta_ptr.GetExclusivePtr();
+      const auto& part_ids = craned_meta->static_meta.partition_ids;
+      for (const PartitionId& part_id : part_ids)
+        unite(part_ids.front(), part_id);
+    }
+
+    auto resv_meta_map = g_meta_container->GetResvMetaMapConstPtr();
+    for (const auto& [resv_id, resv_meta_ptr] : *resv_meta_map) {
+      auto resv_meta = resv_meta_ptr.GetExclusivePtr();
+      resv_part_map.emplace(resv_id, resv_meta->part_id);
+      for (const CranedId& craned_id : resv_meta->logical_part.craned_ids) {
+        auto craned_meta = craned_meta_map->at(craned_id).GetExclusivePtr();
+        for (const PartitionId& part_id :
+             craned_meta->static_meta.partition_ids)
+          unite(resv_meta->part_id, part_id);
+      }
+    }
+  }
+
+  // Tasks of a reservation share its NodeSelectionInfo.
+  for (task_id_t task_id : task_ids) {
+    const auto& task = pending_task_map.at(task_id);
+    if (task->reservation.empty()) continue;
+
+    auto it = resv_part_map.find(task->reservation);
+    if (it != resv_part_map.end()) unite(task->partition_id, it->second);
+  }
+
+  std::unordered_map<PartitionId, size_t> root_group_index_map;
+  std::vector<std::vector<task_id_t>> task_id_groups;
+  for (task_id_t task_id : task_ids) {
+    PartitionId root = find_root(pending_task_map.at(task_id)->partition_id);
+    auto [it, ok] = root_group_index_map.emplace(root, task_id_groups.size());
+    if (ok) task_id_groups.emplace_back();
+    task_id_groups[it->second].emplace_back(task_id);
+  }
+
+  return task_id_groups;
+}
+
+size_t MinLoadFirst::SelectNodesForTasks_(
+    const std::vector<task_id_t>& task_ids, absl::Time now,
+    absl::Time deadline, const OrderedTaskMap& pending_task_map,
+    std::unordered_map<PartitionId, NodeSelectionInfo>* part_id_node_info_map,
+    std::unordered_map<ResvId, NodeSelectionInfo>* resv_id_node_info_map,
+    std::vector<SelectedTask>* selected_tasks,
+    std::vector<PlannedTask>* planned_tasks) {
   // Now we know, on every node, the # of running tasks (which
   //  doesn't include those we select as the incoming running tasks in the
   //  following code) and how many resources are available at the end of each
   //  task.
   // Iterate over all the pending tasks and select the available node for the
   //  task to run in its partition.
-  for (task_id_t task_id : task_id_vec) {
-    auto pending_task_it = pending_task_map->find(task_id);
-    auto& task = pending_task_it->second;
+  // Shapes which can't start in this cycle are remembered with the pending
+  //  reason of the first such task, so the rest of the thousands of identical
+  //  tasks are not evaluated again.
+  absl::flat_hash_map<TaskShape, std::string> blocked_shape_reason_map;
+  size_t skipped_task_num = 0;
+
+  size_t evaluated_num = 0;
+  for (task_id_t task_id : task_ids) {
+    if (evaluated_num >= kBudgetCheckTaskNum &&
+        evaluated_num % kBudgetCheckTaskNum == 0 && absl::Now() >= deadline)
+      break;
+    evaluated_num++;
+
+    const auto& task = pending_task_map.at(task_id);
+
+    TaskShape shape(*task);
+    if (auto it = blocked_shape_reason_map.find(shape);
+        it != blocked_shape_reason_map.end()) {
+      task->pending_reason = it->second;
+      skipped_task_num++;
+      continue;
+    }
 
     PartitionId part_id = task->partition_id;
 
+    // Checked by the craned indexes without locking any craned meta. Too few
+    // such craneds is the common case of a partition being down or drained.
     const auto& reservation_id = task->reservation;
+    if (reservation_id == "" &&
+        g_meta_container->CountCraneds(part_id,
+                                       SchedulableCranedFilterOf_(*task)) <
+            task->node_num) {
+      task->pending_reason = "Resource";
+      task->planned_craneds_regex.clear();
+      task->start_estimate_time = absl::InfinitePast();
+      blocked_shape_reason_map.emplace(std::move(shape), task->pending_reason);
+      continue;
+    }
+
     NodeSelectionInfo* node_info_ptr = nullptr;
     if (reservation_id == "")
-      node_info_ptr = &part_id_node_info_map.at(part_id);
+      node_info_ptr = &part_id_node_info_map->at(part_id);
     else {
-      auto iter = resv_id_node_info_map.find(reservation_id);
-      if (iter == resv_id_node_info_map.end()) {
+      auto iter = resv_id_node_info_map->find(reservation_id);
+      if (iter == resv_id_node_info_map->end()) {
         task->pending_reason = "Unavailable Reservation";
         continue;
       } else {
@@ -2868,6 +4879,10 @@ void MinLoadFirst::NodeSelect(
           &expected_start_time);
       if (!ok) {
         task->pending_reason = "Resource";
+        task->planned_craneds_regex.clear();
+        task->start_estimate_time = absl::InfinitePast();
+        blocked_shape_reason_map.emplace(std::move(shape),
+                                         task->pending_reason);
         continue;
       }
 
@@ -2904,7 +4919,7 @@ void MinLoadFirst::NodeSelect(
              involved_part_craned) {
           SubtractTaskResourceNodeSelectionInfo_(
               expected_start_time, task->time_limit, task->AllocatedRes(),
-              part_craned_ids, &part_id_node_info_map.at(partition_id));
+              part_craned_ids, &part_id_node_info_map->at(partition_id));
         }
       } else {
         SubtractTaskResourceNodeSelectionInfo_(
@@ -2923,27 +4938,31 @@ void MinLoadFirst::NodeSelect(
       // takes effect right now. Otherwise, during the scheduling for the
       // next partition, the algorithm may use the resource which is already
       // allocated.
-      for (CranedId const& craned_id : craned_ids)
-        g_meta_container->MallocResourceFromNode(craned_id, task->TaskId(),
-                                                 task->AllocatedRes());
+      g_meta_container->MallocResourceFromNodes(task->TaskId(),
+                                                task->AllocatedRes());
       if (task->reservation != "") {
         g_meta_container->MallocResourceFromResv(
             task->reservation, task->TaskId(),
             {task->EndTime(), task->AllocatedRes()});
       }
-      std::unique_ptr<TaskInCtld> moved_task;
-
-      // Move task out of pending_task_map and insert it to the
-      // scheduling_result_list.
-      moved_task.swap(pending_task_it->second);
-
-      selection_result_list->emplace_back(std::move(moved_task),
-                                          std::move(craned_ids));
-
-      // Erase the task ready to run from temporary
-      // partition_pending_task_map and move to the next element
-      pending_task_map->erase(pending_task_it);
+      selected_tasks->emplace_back(
+          SelectedTask{.task_id = task_id,
+                       .craned_ids = std::move(craned_ids),
+                       .reservation = task->reservation,
+                       .time_limit = task->time_limit});
     } else {
+      // Kept for queries, so that the estimate is not recomputed for them.
+      task->planned_craneds_regex = util::HostNameListToStr(craned_ids);
+      task->start_estimate_time = now;
+
+      // Only the plans on partitions are kept. The NodeSelectionInfo of
+      // reservations is rebuilt from scratch in the resumed cycles.
+      if (planned_tasks != nullptr && task->reservation.empty())
+        planned_tasks->emplace_back(
+            PlannedTask{.task_id = task_id,
+                        .start_time = expected_start_time,
+                        .craned_ids = craned_ids});
+
       // The task can't be started now. Set pending reason and move to the
       // next pending task.
       for (auto& craned_id : craned_ids) {
@@ -2951,8 +4970,11 @@ void MinLoadFirst::NodeSelect(
           task->pending_reason = "Resource Reserved";
           break;
         }
-        auto& res_avail = node_info.GetTimeAvailResMap(craned_id).at(now);
-        if (!(task->AllocatedRes().EachNodeResMap().at(craned_id) <=
+        auto& res_avail =
+            std::as_const(node_info).GetTimeAvailResMap(craned_id).ResAtTime(
+                now);
+        if (!(node_info.GetResLayout(craned_id).Encode(
+                  task->AllocatedRes().EachNodeResMap().at(craned_id)) <=
               res_avail)) {
           task->pending_reason = "Resource";
           break;
@@ -2961,9 +4983,65 @@ void MinLoadFirst::NodeSelect(
       if (task->pending_reason == "") {
         task->pending_reason = "Priority";
       }
+      blocked_shape_reason_map.emplace(std::move(shape), task->pending_reason);
+      continue;
+    }
+  }
+
+  if (skipped_task_num > 0)
+    CRANE_TRACE("{} pending tasks skipped by {} blocked task shapes.",
+                skipped_task_num, blocked_shape_reason_map.size());
+
+  return evaluated_num;
+}
+
+bool MinLoadFirst::SelectNodesByTopology_(
+    const NetworkTopology& topology,
+    const std::vector<CranedId>& ready_craned_ids,
+    const std::vector<uint32_t>& switch_ready_counts, uint32_t node_num,
+    std::vector<size_t>* selected_indexes) {
+  // Best fit: the lowest switch with enough ready nodes, and the one with
+  // the fewest of them among the switches of the same level.
+  int64_t best_switch = -1;
+  for (uint32_t i = 0; i < topology.switches.size(); i++) {
+    if (switch_ready_counts[i] < node_num) continue;
+    if (best_switch == -1 ||
+        topology.switches[i].level < topology.switches[best_switch].level ||
+        (topology.switches[i].level == topology.switches[best_switch].level &&
+         switch_ready_counts[i] < switch_ready_counts[best_switch]))
+      best_switch = i;
+  }
+  if (best_switch == -1) return false;
+
+  // Group the ready nodes under the switch by their leaf switches. The nodes
+  // stay sorted by cost in each group.
+  std::vector<std::vector<size_t>> leaf_groups;
+  absl::flat_hash_map<uint32_t, size_t> leaf_group_index_map;
+  for (size_t i = 0; i < ready_craned_ids.size(); i++) {
+    auto path_it = topology.craned_switch_path_map.find(ready_craned_ids[i]);
+    if (path_it == topology.craned_switch_path_map.end() ||
+        !std::ranges::contains(path_it->second,
+                               static_cast<uint32_t>(best_switch)))
       continue;
+
+    auto [it, ok] = leaf_group_index_map.emplace(path_it->second.front(),
+                                                 leaf_groups.size());
+    if (ok) leaf_groups.emplace_back();
+    leaf_groups[it->second].emplace_back(i);
+  }
+
+  // Fill the largest leaf groups first to span as few leaf switches as
+  // possible.
+  std::ranges::stable_sort(leaf_groups, std::ranges::greater{},
+                           [](const auto& group) { return group.size(); });
+  for (const auto& group : leaf_groups) {
+    for (size_t i : group) {
+      selected_indexes->emplace_back(i);
+      if (selected_indexes->size() == node_num) return true;
     }
   }
+
+  return false;
 }
 
 void MinLoadFirst::SubtractTaskResourceNodeSelectionInfo_(
@@ -2971,138 +5049,144 @@ void MinLoadFirst::SubtractTaskResourceNodeSelectionInfo_(
     const ResourceV2& resources, std::list<CranedId> const& craned_ids,
     MinLoadFirst::NodeSelectionInfo* node_selection_info) {
   NodeSelectionInfo& node_info = *node_selection_info;
-  bool ok;
 
   absl::Time task_end_time = expected_start_time + duration;
 
   // Increase the running task num in Craned `crane_id`.
   for (CranedId const& craned_id : craned_ids) {
-    ResourceInNode const& task_res_in_node = resources.at(craned_id);
     node_info.UpdateCost(craned_id, expected_start_time, task_end_time,
-                         task_res_in_node);
-    TimeAvailResMap& time_avail_res_map =
-        node_info.GetTimeAvailResMap(craned_id);
-
-    auto task_duration_begin_it =
-        time_avail_res_map.upper_bound(expected_start_time);
-    if (task_duration_begin_it == time_avail_res_map.end()) {
-      --task_duration_begin_it;
-      // Situation #1
-      //                     task duration
-      //                   |<-------------->|
-      // *-----------------*----------------------> inf
-      //                   ^
-      //        task_duration_begin_it
-      //
-      // *-----------------*----------------|-----> inf
-      //                           ^        ^
-      //                           |      insert here
-      //                      subtract resource here
-      //
-      // OR Situation #2
-      //                        task duration
-      //                      |<-------------->|
-      // *-----------------*----------------------> inf
-      //                   ^
-      //        task_duration_begin_it
-      //
-      // *-----------------*--|----------------|--> inf
-      //                      ^      ^         ^
-      //                insert here  |     insert here
-      //                      subtract resource here
-
-      TimeAvailResMap::iterator inserted_it;
-      std::tie(inserted_it, ok) = time_avail_res_map.emplace(
-          task_end_time, task_duration_begin_it->second);
-      CRANE_ASSERT_MSG(ok == true, "Insertion must be successful.");
-
-      if (task_duration_begin_it->first == expected_start_time) {
-        // Situation #1
-        CRANE_ASSERT(task_res_in_node <= task_duration_begin_it->second);
-        task_duration_begin_it->second -= task_res_in_node;
-      } else {
-        // Situation #2
-        std::tie(inserted_it, ok) = time_avail_res_map.emplace(
-            expected_start_time, task_duration_begin_it->second);
-        CRANE_ASSERT_MSG(ok == true, "Insertion must be successful.");
-
-        CRANE_ASSERT(task_res_in_node <= inserted_it->second);
-        inserted_it->second -= task_res_in_node;
-      }
-    } else {
-      --task_duration_begin_it;
-      // Situation #3
-      //                    task duration
-      //                |<-------------->|
-      // *-------*----------*---------*------------
-      //         ^                    ^
-      //  task_duration_begin_it     task_duration_end_it
-      // *-------*------|---*---------*--|---------
-      //                ^  ^     ^     ^ ^
-      //       insert here |     |     | insert here
-      //                 subtract at these points
-      //
-      // Or Situation #4
-      //               task duration
-      //         |<----------------->|
-      // *-------*----------*--------*------------
-      //         ^                   ^
-      //  task_duration_begin_it   task_duration_end_it
-
-      // std::prev can be used without any check here.
-      // There will always be one time point (now) before task_end_time.
-
-      if (task_duration_begin_it->first != expected_start_time) {
-        // Situation #3 (begin)
-        TimeAvailResMap::iterator inserted_it;
-        std::tie(inserted_it, ok) = time_avail_res_map.emplace(
-            expected_start_time, task_duration_begin_it->second);
-        CRANE_ASSERT_MSG(ok == true, "Insertion must be successful.");
-
-        task_duration_begin_it = inserted_it;
-      }
-
-      auto task_duration_end_it =
-          std::prev(time_avail_res_map.upper_bound(task_end_time));
-
-      // Subtract the required resources within the interval.
-      for (auto in_duration_it = task_duration_begin_it;
-           in_duration_it != task_duration_end_it; in_duration_it++) {
-        CRANE_ASSERT(task_res_in_node <= in_duration_it->second);
-        in_duration_it->second -= task_res_in_node;
-      }
-
-      // Check if we need to insert a time point at
-      // `task_end_time_plus_1s` Detailed version of why: Assume one task
-      // end at time x-2, If "x+2" lies in the interval [x, y-1) in
-      // time__avail_res__map,
-      //  for example, x+2 in [x, y-1) with the available resources amount
-      //  `a`, we need to divide this interval into to two intervals: [x,
-      //  x+2]: a-k, where k is the resource amount that task requires,
-      //  [x+3, y-1]: a
-      // Therefore, we need to insert a key-value at x+3 to preserve this.
-      // However, if the length of [x+3, y-1] is 0, or more simply, the
-      // point x+3 exists, there's no need to save the interval [x+3,
-      // y-1].
-      if (task_duration_end_it->first != task_end_time) {
-        // Situation #3 (end)
-        TimeAvailResMap::iterator inserted_it;
-        std::tie(inserted_it, ok) = time_avail_res_map.emplace(
-            task_end_time, task_duration_end_it->second);
-        CRANE_ASSERT_MSG(ok == true, "Insertion must be successful.");
-
-        CRANE_ASSERT(task_res_in_node <= task_duration_end_it->second);
-        task_duration_end_it->second -= task_res_in_node;
-      }
-    }
+                         resources.at(craned_id));
+    DenseResourceInNode task_res_in_node =
+        node_info.GetResLayout(craned_id).Encode(resources.at(craned_id));
+
+    // Time points are inserted at the start and the end of the task if
+    // they don't exist, and the resource is subtracted in between:
+    //                    task duration
+    //                |<-------------->|
+    // *-------*----------*---------*------------
+    // *-------*------|---*---------*--|---------
+    //                ^  ^     ^     ^ ^
+    //       insert here |     |     | insert here
+    //                 subtract at these points
+    node_info.GetTimeAvailResMap(craned_id).Subtract(
+        expected_start_time, task_end_time, task_res_in_node);
   }
 }
 
 void TaskScheduler::ProcessFinalTasks_(const std::vector<TaskInCtld*>& tasks) {
-  PersistAndTransferTasksToMongodb_(tasks);
+  g_account_manager->AddUsageOfEndedTasks(tasks);
+  g_task_event_hub->Publish(tasks);
+
+  // The dependents are released in the same transaction as the final state
+  // of their upstream tasks, so that a restart doesn't lose either.
+  EmbeddedDbClient::WriteBatch db_batch;
+  bool released = ResolveDependenciesOnEndedTasks_(tasks, &db_batch);
+  PersistAndTransferTasksToMongodb_(tasks, std::move(db_batch));
+  if (released) TriggerSchedule();
+
   CallPluginHookForFinalTasks_(tasks);
 }
 
+bool TaskScheduler::ResolveDependenciesOnEndedTasks_(
+    std::vector<TaskInCtld*> const& tasks,
+    EmbeddedDbClient::WriteBatch* db_batch) {
+  std::vector<TaskDependencyGraph::Resolution> resolutions;
+  m_dependency_graph_.RemoveEndedTasks(tasks, &resolutions);
+  if (resolutions.empty()) return false;
+
+  bool released = false;
+  auto resolve = [&](TaskInCtld* task,
+                     const TaskDependencyGraph::Resolution& resolution) {
+    task->ResolveDependency(resolution.upstream_id, resolution.satisfied);
+    PutDependencyDelta_(*task, resolution, db_batch);
+    if (!task->Blocked()) released = true;
+  };
+
+  // A dependent is either parked in the submission buffer or pending. New
+  // tasks only enter the buffer, so the ones not found in it are looked up
+  // in the pending map without blocking submissions meanwhile.
+  std::vector<const TaskDependencyGraph::Resolution*> rest;
+  {
+    LockGuard buffer_guard(&m_submitted_task_buffer_mtx_);
+    for (const auto& resolution : resolutions) {
+      auto it = m_submitted_task_buffer_.find(resolution.dependent_id);
+      if (it != m_submitted_task_buffer_.end())
+        resolve(it->second.get(), resolution);
+      else
+        rest.emplace_back(&resolution);
+    }
+  }
+
+  if (!rest.empty()) {
+    LockGuard pending_guard(&m_pending_task_map_mtx_);
+    for (const auto* resolution : rest) {
+      // Dependents cancelled meanwhile are gone.
+      auto it = m_pending_task_map_.find(resolution->dependent_id);
+      if (it != m_pending_task_map_.end())
+        resolve(it->second.get(), *resolution);
+    }
+  }
+
+  CRANE_TRACE("{} dependencies resolved by {} ended tasks.",
+              resolutions.size(), tasks.size());
+  return released;
+}
+
+void TaskScheduler::PutDependencyDelta_(
+    const TaskInCtld& task, const TaskDependencyGraph::Resolution& resolution,
+    EmbeddedDbClient::WriteBatch* db_batch) {
+  crane::grpc::RuntimeAttrDeltaOfTask delta;
+  delta.add_resolved_dependency_ids(resolution.upstream_id);
+  if (!resolution.satisfied) delta.set_dependency_failed(true);
+  db_batch->PutRuntimeAttrDelta(task.TaskDbId(), delta);
+}
+
+CraneExpected<void> TaskScheduler::CheckTaskDependencies_(
+    const TaskInCtld& task) {
+  const crane::grpc::Dependencies& deps = task.TaskToCtld().dependencies();
+  if (deps.deps().empty()) return {};
+
+  std::vector<task_id_t> unknown_ids =
+      m_dependency_graph_.UnknownUpstreams(deps);
+  if (unknown_ids.empty()) return {};
+
+  std::vector<task_id_t> missing_ids;
+  if (!LoadEndedUpstreamTasks_(unknown_ids, &missing_ids))
+    return std::unexpected(CraneErrCode::ERR_GENERIC_FAILURE);
+
+  if (!missing_ids.empty()) {
+    CRANE_DEBUG("Task of user {} depends on unknown task(s) {}.", task.uid,
+                absl::StrJoin(missing_ids, ","));
+    return std::unexpected(CraneErrCode::ERR_INVALID_PARAM);
+  }
+  return {};
+}
+
+bool TaskScheduler::LoadEndedUpstreamTasks_(
+    const std::vector<task_id_t>& task_ids,
+    std::vector<task_id_t>* missing_ids) {
+  crane::grpc::QueryTasksInfoRequest request;
+  crane::grpc::QueryTasksInfoReply reply;
+  request.mutable_filter_task_ids()->Add(task_ids.begin(), task_ids.end());
+  request.set_option_include_completed_tasks(true);
+  if (!g_db_client->FetchJobRecords(&request, &reply, task_ids.size())) {
+    CRANE_ERROR("Failed to fetch the upstream tasks of dependencies.");
+    return false;
+  }
+
+  std::vector<std::pair<task_id_t, crane::grpc::TaskStatus>> ended_tasks;
+  HashSet<task_id_t> found_ids;
+  for (const auto& task_info : reply.task_info_list()) {
+    ended_tasks.emplace_back(task_info.task_id(), task_info.status());
+    found_ids.emplace(task_info.task_id());
+  }
+  m_dependency_graph_.AddEndedTasks(ended_tasks);
+
+  for (task_id_t task_id : task_ids)
+    if (!found_ids.contains(task_id)) missing_ids->emplace_back(task_id);
+  return true;
+}
+
 void TaskScheduler::CallPluginHookForFinalTasks_(
     std::vector<TaskInCtld*> const& tasks) {
   if (g_config.Plugin.Enabled && !tasks.empty()) {
@@ -3117,48 +5201,62 @@ void TaskScheduler::CallPluginHookForFinalTasks_(
 }
 
 void TaskScheduler::PersistAndTransferTasksToMongodb_(
-    std::vector<TaskInCtld*> const& tasks) {
+    std::vector<TaskInCtld*> const& tasks,
+    EmbeddedDbClient::WriteBatch&& db_batch) {
   if (tasks.empty()) return;
 
-  txn_id_t txn_id;
-  g_embedded_db_client->BeginVariableDbTransaction(&txn_id);
+  // Only the fields changed by ending a task are written. The full record
+  // was written when the task was submitted or started.
   for (TaskInCtld* task : tasks) {
-    if (!g_embedded_db_client->UpdateRuntimeAttrOfTask(txn_id, task->TaskDbId(),
-                                                       task->RuntimeAttr()))
-      CRANE_ERROR("Failed to call UpdateRuntimeAttrOfTask() for task #{}",
-                  task->TaskId());
-  }
-
-  g_embedded_db_client->CommitVariableDbTransaction(txn_id);
-
-  // Now tasks are in MongoDB.
-  if (!g_db_client->InsertJobs(tasks)) {
-    CRANE_ERROR("Failed to call g_db_client->InsertJobs() ");
-    return;
+    const crane::grpc::RuntimeAttrOfTask& runtime_attr = task->RuntimeAttr();
+
+    crane::grpc::RuntimeAttrDeltaOfTask delta;
+    delta.set_status(runtime_attr.status());
+    delta.set_exit_code(runtime_attr.exit_code());
+    *delta.mutable_start_time() = runtime_attr.start_time();
+    *delta.mutable_end_time() = runtime_attr.end_time();
+    db_batch.PutRuntimeAttrDelta(task->TaskDbId(), delta);
   }
 
-  // Remove tasks in final queue.
-  std::vector<task_db_id_t> db_ids;
-  for (TaskInCtld* task : tasks) db_ids.emplace_back(task->TaskDbId());
+  if (!g_embedded_db_client->CommitAsync(std::move(db_batch)).get())
+    CRANE_ERROR("Failed to update runtime attr of {} final tasks.",
+                tasks.size());
 
-  if (!g_embedded_db_client->PurgeEndedTasks(db_ids)) {
-    CRANE_ERROR(
-        "Failed to call g_embedded_db_client->PurgeEndedTasks() "
-        "for final tasks");
-  }
+  // The final state is durable in the embedded db now. The job writer moves
+  // the tasks into MongoDB and purges them from the embedded db afterwards.
+  g_mongodb_job_writer->InsertJobsAsync(tasks);
 }
 
 CraneExpected<void> TaskScheduler::HandleUnsetOptionalInTaskToCtld(
     TaskInCtld* task) {
-  if (task->type == crane::grpc::Batch) {
-    auto* batch_meta = task->MutableTaskToCtld()->mutable_batch_meta();
-    if (!batch_meta->has_open_mode_append())
-      batch_meta->set_open_mode_append(g_config.JobFileOpenModeAppend);
-  }
+  // Check before MutableTaskToCtld() to keep a shared TaskToCtld shared.
+  if (task->type == crane::grpc::Batch &&
+      !task->TaskToCtld().batch_meta().has_open_mode_append())
+    task->MutableTaskToCtld()->mutable_batch_meta()->set_open_mode_append(
+        g_config.JobFileOpenModeAppend);
 
   return {};
 }
 
+void TaskScheduler::FillDefaultsOfSharedTaskToCtld(
+    crane::grpc::TaskToCtld* task_to_ctld) {
+  if (task_to_ctld->type() == crane::grpc::Batch &&
+      !task_to_ctld->batch_meta().has_open_mode_append())
+    task_to_ctld->mutable_batch_meta()->set_open_mode_append(
+        g_config.JobFileOpenModeAppend);
+
+  if (task_to_ctld->account().empty()) {
+    // Errors are left to SubmitTaskToScheduler().
+    PasswordEntry entry(task_to_ctld->uid());
+    if (!entry.Valid()) return;
+
+    auto user_scoped_ptr =
+        g_account_manager->GetExistedUserInfo(entry.Username());
+    if (user_scoped_ptr)
+      task_to_ctld->set_account(user_scoped_ptr->default_account);
+  }
+}
+
 CraneExpected<void> TaskScheduler::AcquireTaskAttributes(TaskInCtld* task) {
   auto part_it = g_config.Partitions.find(task->partition_id);
   if (part_it == g_config.Partitions.end()) {
@@ -3358,22 +5456,48 @@ void TaskScheduler::TerminateTasksOnCraned(const CranedId& craned_id,
   }
 }
 
+void TaskScheduler::AddJobUsageSamples(
+    const CranedId& craned_id,
+    const google::protobuf::RepeatedPtrField<crane::grpc::JobUsageSample>&
+        samples) {
+  LockGuard running_guard(&m_running_task_map_mtx_);
+  for (const auto& sample : samples) {
+    auto it = m_running_task_map_.find(sample.job_id());
+    if (it == m_running_task_map_.end()) continue;
+
+    TaskInCtld* task = it->second.get();
+    if (!std::ranges::contains(task->executing_craned_ids, craned_id)) continue;
+    task->AddUsageSample(sample);
+  }
+}
+
 std::vector<task_id_t> MultiFactorPriority::GetOrderedTaskIdList(
     const OrderedTaskMap& pending_task_map,
     const UnorderedTaskMap& running_task_map, size_t limit_num,
     absl::Time now) {
-  CalculateFactorBound_(pending_task_map, running_task_map, now);
+  absl::MutexLock lock(&m_mtx_);
+
+  CalculateFactorBound_(now);
+  int64_t now_sec = ToUnixSeconds(now);
 
   std::vector<std::pair<TaskInCtld*, double>> task_priority_vec;
   for (const auto& [task_id, task] : pending_task_map) {
-    if (task->Held()) {
-      task->pending_reason = "Held";
+    if (task->Blocked()) {
+      task->pending_reason = task->BlockedReason();
       continue;
     }
+
+    auto record_it = m_pending_records_.find(task_id);
+    if (record_it == m_pending_records_.end()) {
+      CRANE_ERROR("Task #{} is not tracked by the priority sorter.", task_id);
+      AddPendingTaskNoLock_(*task);
+      record_it = m_pending_records_.find(task_id);
+    }
+
     // Admin may manually specify the priority of a task.
     // In this case, MultiFactorPriority will not calculate the priority.
     double priority = (task->mandated_priority == 0.0)
-                          ? CalculatePriority_(task.get(), now)
+                          ? CalculatePriority_(&record_it->second, now_sec)
                           : task->mandated_priority;
     task->SetCachedPriority(priority);
     task->pending_reason = "";
@@ -3397,167 +5521,286 @@ std::vector<task_id_t> MultiFactorPriority::GetOrderedTaskIdList(
   return task_id_vec;
 }
 
-void MultiFactorPriority::CalculateFactorBound_(
-    const OrderedTaskMap& pending_task_map,
-    const UnorderedTaskMap& running_task_map, absl::Time now) {
-  FactorBound& bound = m_factor_bound_;
+void MultiFactorPriority::OnPendingTaskAdded(const TaskInCtld& task) {
+  absl::MutexLock lock(&m_mtx_);
+  AddPendingTaskNoLock_(task);
+}
 
-  // Initialize the values of each max and min
-  bound.age_max = 0;
-  bound.age_min = std::numeric_limits<uint64_t>::max();
+void MultiFactorPriority::OnPendingTaskRemoved(task_id_t task_id) {
+  absl::MutexLock lock(&m_mtx_);
 
-  bound.qos_priority_max = 0;
-  bound.qos_priority_min = std::numeric_limits<uint32_t>::max();
+  auto it = m_pending_records_.find(task_id);
+  if (it == m_pending_records_.end()) return;
 
-  bound.part_priority_max = 0;
-  bound.part_priority_min = std::numeric_limits<uint32_t>::max();
+  const PendingTaskRecord& record = it->second;
+  m_submit_time_counter_.Remove(record.submit_time);
+  m_qos_priority_counter_.Remove(record.qos_priority);
+  m_part_priority_counter_.Remove(record.part_priority);
+  m_nodes_alloc_counter_.Remove(record.nodes_alloc);
+  m_mem_alloc_counter_.Remove(record.mem_alloc);
+  m_cpus_alloc_counter_.Remove(record.cpus_alloc);
 
-  bound.nodes_alloc_max = 0;
-  bound.nodes_alloc_min = std::numeric_limits<uint32_t>::max();
+  record.account_agg->pending_num--;
+  ReleaseAccountAggregateIfUnused_(record.account_agg);
 
-  bound.mem_alloc_max = 0;
-  bound.mem_alloc_min = std::numeric_limits<uint64_t>::max();
+  m_pending_records_.erase(it);
+}
 
-  bound.cpus_alloc_max = 0;
-  bound.cpus_alloc_min = std::numeric_limits<double>::max();
+void MultiFactorPriority::OnRunningTaskAdded(const TaskInCtld& task) {
+  absl::MutexLock lock(&m_mtx_);
 
-  bound.service_val_max = 0;
-  bound.service_val_min = std::numeric_limits<uint32_t>::max();
+  if (m_running_records_.contains(task.TaskId())) return;
 
-  bound.acc_service_val_map.clear();
+  RunningTaskRecord record{
+      .account_agg = AcquireAccountAggregate_(task.account),
+      .start_time = static_cast<double>(
+          ToInt64Seconds(task.StartTime() - m_time_origin_)),
+      .cpus_alloc = task.allocated_res_view.CpuCount(),
+      .nodes_alloc = static_cast<double>(task.node_num),
+      .mem_alloc = static_cast<double>(task.allocated_res_view.MemoryBytes()),
+  };
 
-  for (const auto& [task_id, task] : pending_task_map) {
-    uint64_t age = ToInt64Seconds(now - task->SubmitTime());
-    age = std::min(age, g_config.PriorityConfig.MaxAge);
+  AccountAggregate* agg = record.account_agg;
+  agg->running_num++;
+  agg->start_sum += record.start_time;
+  agg->cpus_sum += record.cpus_alloc;
+  agg->cpus_start_sum += record.cpus_alloc * record.start_time;
+  agg->nodes_sum += record.nodes_alloc;
+  agg->nodes_start_sum += record.nodes_alloc * record.start_time;
+  agg->mem_sum += record.mem_alloc;
+  agg->mem_start_sum += record.mem_alloc * record.start_time;
+
+  m_running_records_.emplace(task.TaskId(), record);
+}
 
-    bound.acc_service_val_map[task->account] = 0.0;
+void MultiFactorPriority::OnRunningTaskRemoved(task_id_t task_id) {
+  absl::MutexLock lock(&m_mtx_);
+
+  auto it = m_running_records_.find(task_id);
+  if (it == m_running_records_.end()) return;
+
+  const RunningTaskRecord& record = it->second;
+  AccountAggregate* agg = record.account_agg;
+  agg->running_num--;
+  if (agg->running_num == 0) {
+    // Reset the sums to drop the accumulated rounding error.
+    agg->start_sum = 0;
+    agg->cpus_sum = agg->cpus_start_sum = 0;
+    agg->nodes_sum = agg->nodes_start_sum = 0;
+    agg->mem_sum = agg->mem_start_sum = 0;
+  } else {
+    agg->start_sum -= record.start_time;
+    agg->cpus_sum -= record.cpus_alloc;
+    agg->cpus_start_sum -= record.cpus_alloc * record.start_time;
+    agg->nodes_sum -= record.nodes_alloc;
+    agg->nodes_start_sum -= record.nodes_alloc * record.start_time;
+    agg->mem_sum -= record.mem_alloc;
+    agg->mem_start_sum -= record.mem_alloc * record.start_time;
+  }
+  ReleaseAccountAggregateIfUnused_(agg);
+
+  m_running_records_.erase(it);
+}
 
-    bound.age_min = std::min(age, bound.age_min);
-    bound.age_max = std::max(age, bound.age_max);
+void MultiFactorPriority::AddPendingTaskNoLock_(const TaskInCtld& task) {
+  if (m_pending_records_.contains(task.TaskId())) return;
+
+  PendingTaskRecord record{
+      .account_agg = AcquireAccountAggregate_(task.account),
+      .submit_time = task.SubmitTimeInUnixSecond(),
+      .qos_priority = task.qos_priority,
+      .part_priority = task.partition_priority,
+      .nodes_alloc = task.node_num,
+      .mem_alloc = task.allocated_res_view.MemoryBytes(),
+      .cpus_alloc = task.allocated_res_view.CpuCount(),
+      .mem_req = task.requested_node_res_view.MemoryBytes(),
+      .cpus_req = static_cast<double>(task.requested_node_res_view.CpuCount()),
+  };
 
-    uint32_t nodes_alloc = task->node_num;
-    bound.nodes_alloc_min = std::min(nodes_alloc, bound.nodes_alloc_min);
-    bound.nodes_alloc_max = std::max(nodes_alloc, bound.nodes_alloc_max);
+  m_submit_time_counter_.Add(record.submit_time);
+  m_qos_priority_counter_.Add(record.qos_priority);
+  m_part_priority_counter_.Add(record.part_priority);
+  m_nodes_alloc_counter_.Add(record.nodes_alloc);
+  m_mem_alloc_counter_.Add(record.mem_alloc);
+  m_cpus_alloc_counter_.Add(record.cpus_alloc);
 
-    uint64_t mem_alloc = task->allocated_res_view.MemoryBytes();
-    bound.mem_alloc_min = std::min(mem_alloc, bound.mem_alloc_min);
-    bound.mem_alloc_max = std::max(mem_alloc, bound.mem_alloc_max);
+  record.account_agg->pending_num++;
 
-    double cpus_alloc = task->allocated_res_view.CpuCount();
-    bound.cpus_alloc_min = std::min(cpus_alloc, bound.cpus_alloc_min);
-    bound.cpus_alloc_max = std::max(cpus_alloc, bound.cpus_alloc_max);
+  m_pending_records_.emplace(task.TaskId(), record);
+}
 
-    uint32_t qos_priority = task->qos_priority;
-    bound.qos_priority_min = std::min(qos_priority, bound.qos_priority_min);
-    bound.qos_priority_max = std::max(qos_priority, bound.qos_priority_max);
+MultiFactorPriority::AccountAggregate*
+MultiFactorPriority::AcquireAccountAggregate_(const std::string& account) {
+  auto [it, _] = m_account_aggs_.try_emplace(account);
+  it->second.name = account;
+  return &it->second;
+}
 
-    uint32_t part_priority = task->partition_priority;
-    bound.part_priority_min = std::min(part_priority, bound.part_priority_min);
-    bound.part_priority_max = std::max(part_priority, bound.part_priority_max);
+void MultiFactorPriority::ReleaseAccountAggregateIfUnused_(
+    AccountAggregate* agg) {
+  if (agg->pending_num == 0 && agg->running_num == 0) {
+    std::string name = agg->name;
+    m_account_aggs_.erase(name);
   }
+}
 
-  for (const auto& [task_id, task] : running_task_map) {
-    double service_val = 0;
-    if (bound.cpus_alloc_max != bound.cpus_alloc_min)
-      service_val +=
-          1.0 * (task->allocated_res_view.CpuCount() - bound.cpus_alloc_min) /
-          (bound.cpus_alloc_max - bound.cpus_alloc_min);
-    else
-      // += 1.0 here rather than 0.0 in case that the final service_val is 0.
-      // If the final service_val is 0, the running time of the task will not
-      // be ruled out in calculation. We must avoid that.
-      service_val += 1.0;
-
-    if (bound.nodes_alloc_max != bound.nodes_alloc_min)
-      service_val += 1.0 * (task->node_num - bound.nodes_alloc_min) /
-                     (bound.nodes_alloc_max - bound.nodes_alloc_min);
-    else
-      service_val += 1.0;
-
-    if (bound.mem_alloc_max != bound.mem_alloc_min)
-      service_val +=
-          1.0 *
-          static_cast<double>(task->allocated_res_view.MemoryBytes() -
-                              bound.mem_alloc_min) /
-          static_cast<double>(bound.mem_alloc_max - bound.mem_alloc_min);
-    else
-      service_val += 1.0;
+void MultiFactorPriority::CalculateFactorBound_(absl::Time now) {
+  FactorBound bound{};
+
+  // No priority is calculated without pending tasks.
+  if (m_submit_time_counter_.Empty()) return;
+
+  auto age_of = [now_sec = ToUnixSeconds(now)](int64_t submit_time) {
+    uint64_t age = std::max(now_sec - submit_time, int64_t{0});
+    return std::min(age, g_config.PriorityConfig.MaxAge);
+  };
+
+  // The latest submitted task is the youngest one.
+  bound.age_min = age_of(m_submit_time_counter_.Max());
+  bound.age_max = age_of(m_submit_time_counter_.Min());
+
+  bound.qos_priority_min = m_qos_priority_counter_.Min();
+  bound.qos_priority_max = m_qos_priority_counter_.Max();
+
+  bound.part_priority_min = m_part_priority_counter_.Min();
+  bound.part_priority_max = m_part_priority_counter_.Max();
+
+  bound.nodes_alloc_min = m_nodes_alloc_counter_.Min();
+  bound.nodes_alloc_max = m_nodes_alloc_counter_.Max();
+
+  bound.mem_alloc_min = m_mem_alloc_counter_.Min();
+  bound.mem_alloc_max = m_mem_alloc_counter_.Max();
+
+  bound.cpus_alloc_min = m_cpus_alloc_counter_.Min();
+  bound.cpus_alloc_max = m_cpus_alloc_counter_.Max();
+
+  // The cached static part of priority is only invalidated when its bounds
+  // actually move.
+  if (!bound.StaticPartEqual(m_factor_bound_)) m_static_bound_version_++;
+
+  // With usage decay, fair-share is taken from the decayed usage tree of
+  // AccountManager, which also covers the tasks that have ended.
+  if (g_config.PriorityConfig.DecayHalfLife != 0) {
+    for (auto& [acc_name, agg] : m_account_aggs_)
+      agg.fair_share_factor =
+          g_account_manager->GetFairShareFactor(acc_name, now);
+    m_factor_bound_ = bound;
+    return;
+  }
 
-    uint64_t run_time = ToInt64Seconds(now - task->StartTime());
-    bound.acc_service_val_map[task->account] +=
-        service_val * static_cast<double>(run_time);
+  bound.service_val_max = 0;
+  bound.service_val_min = std::numeric_limits<uint32_t>::max();
+
+  // The service value of a running task is the sum of its normalized cpus,
+  // nodes and memory multiplied by its run time. The sum over an account is
+  // expanded into the aggregates kept in AccountAggregate.
+  // If all the pending tasks request the same amount of some resource, the
+  // normalized value is 1.0 rather than 0.0 in case that the final service
+  // value is 0 and the running time of the task is ruled out in calculation.
+  double now_rel = static_cast<double>(ToInt64Seconds(now - m_time_origin_));
+  auto normalized_sum = [now_rel](double run_time_sum, double val_sum,
+                                  double val_start_sum, double min,
+                                  double max) {
+    if (max == min) return run_time_sum;
+    double weighted_sum = now_rel * val_sum - val_start_sum;
+    return (weighted_sum - min * run_time_sum) / (max - min);
+  };
+
+  for (auto& [acc_name, agg] : m_account_aggs_) {
+    double run_time_sum = now_rel * agg.running_num - agg.start_sum;
+
+    agg.service_val = 0;
+    if (agg.running_num != 0) {
+      agg.service_val +=
+          normalized_sum(run_time_sum, agg.cpus_sum, agg.cpus_start_sum,
+                         bound.cpus_alloc_min, bound.cpus_alloc_max);
+      agg.service_val += normalized_sum(
+          run_time_sum, agg.nodes_sum, agg.nodes_start_sum,
+          static_cast<double>(bound.nodes_alloc_min),
+          static_cast<double>(bound.nodes_alloc_max));
+      agg.service_val +=
+          normalized_sum(run_time_sum, agg.mem_sum, agg.mem_start_sum,
+                         static_cast<double>(bound.mem_alloc_min),
+                         static_cast<double>(bound.mem_alloc_max));
+    }
+
+    bound.service_val_min = std::min(agg.service_val, bound.service_val_min);
+    bound.service_val_max = std::max(agg.service_val, bound.service_val_max);
   }
 
-  for (const auto& [acc_name, ser_val] : bound.acc_service_val_map) {
-    bound.service_val_min = std::min(ser_val, bound.service_val_min);
-    bound.service_val_max = std::max(ser_val, bound.service_val_max);
+  for (auto& agg : m_account_aggs_ | std::views::values) {
+    agg.fair_share_factor = 0;
+    if (bound.service_val_max != bound.service_val_min)
+      agg.fair_share_factor =
+          1.0 - (agg.service_val - bound.service_val_min) /
+                    (bound.service_val_max - bound.service_val_min);
   }
+
+  m_factor_bound_ = bound;
 }
 
-double MultiFactorPriority::CalculatePriority_(Ctld::TaskInCtld* task,
-                                               absl::Time now) const {
+double MultiFactorPriority::CalculateStaticPriority_(
+    const PendingTaskRecord& record) const {
   FactorBound const& bound = m_factor_bound_;
 
-  uint64_t task_age = ToUnixSeconds(now) - task->SubmitTimeInUnixSecond();
-  task_age = std::min(task_age, g_config.PriorityConfig.MaxAge);
-
-  uint32_t task_qos_priority = task->qos_priority;
-  uint32_t task_part_priority = task->partition_priority;
-  uint32_t task_nodes_alloc = task->node_num;
-  uint64_t task_mem_alloc = task->requested_node_res_view.MemoryBytes();
-  double task_cpus_alloc =
-      static_cast<double>(task->requested_node_res_view.CpuCount());
-  double task_service_val = bound.acc_service_val_map.at(task->account);
-
   double qos_factor{0};
-  double age_factor{0};
   double partition_factor{0};
   double job_size_factor{0};
-  double fair_share_factor{0};
-
-  // age_factor
-  if (bound.age_max != bound.age_min)
-    age_factor = 1.0 * static_cast<double>(task_age - bound.age_min) /
-                 static_cast<double>(bound.age_max - bound.age_min);
 
   // qos_factor
   if (bound.qos_priority_min != bound.qos_priority_max)
-    qos_factor = 1.0 * (task_qos_priority - bound.qos_priority_min) /
+    qos_factor = 1.0 * (record.qos_priority - bound.qos_priority_min) /
                  (bound.qos_priority_max - bound.qos_priority_min);
 
   // partition_factor
   if (bound.part_priority_max != bound.part_priority_min)
-    partition_factor = 1.0 * (task_part_priority - bound.part_priority_min) /
+    partition_factor = 1.0 * (record.part_priority - bound.part_priority_min) /
                        (bound.part_priority_max - bound.part_priority_min);
 
   // job_size_factor
   if (bound.cpus_alloc_max != bound.cpus_alloc_min)
-    job_size_factor += 1.0 * (task_cpus_alloc - bound.cpus_alloc_min) /
+    job_size_factor += 1.0 * (record.cpus_req - bound.cpus_alloc_min) /
                        (bound.cpus_alloc_max - bound.cpus_alloc_min);
   if (bound.nodes_alloc_max != bound.nodes_alloc_min)
-    job_size_factor += 1.0 * (task_nodes_alloc - bound.nodes_alloc_min) /
+    job_size_factor += 1.0 * (record.nodes_alloc - bound.nodes_alloc_min) /
                        (bound.nodes_alloc_max - bound.nodes_alloc_min);
   if (bound.mem_alloc_max != bound.mem_alloc_min)
     job_size_factor +=
-        1.0 * static_cast<double>(task_mem_alloc - bound.mem_alloc_min) /
+        1.0 * static_cast<double>(record.mem_req - bound.mem_alloc_min) /
         static_cast<double>(bound.mem_alloc_max - bound.mem_alloc_min);
   if (g_config.PriorityConfig.FavorSmall)
     job_size_factor = 1.0 - job_size_factor / 3;
   else
     job_size_factor /= 3.0;
 
-  // fair_share_factor
-  if (bound.service_val_max != bound.service_val_min)
-    fair_share_factor =
-        1.0 - (task_service_val - bound.service_val_min) /
-                  (bound.service_val_max - bound.service_val_min);
-
-  double priority =
-      g_config.PriorityConfig.WeightAge * age_factor +
-      g_config.PriorityConfig.WeightPartition * partition_factor +
-      g_config.PriorityConfig.WeightJobSize * job_size_factor +
-      g_config.PriorityConfig.WeightFairShare * fair_share_factor +
-      g_config.PriorityConfig.WeightQOS * qos_factor;
+  return g_config.PriorityConfig.WeightPartition * partition_factor +
+         g_config.PriorityConfig.WeightJobSize * job_size_factor +
+         g_config.PriorityConfig.WeightQOS * qos_factor;
+}
+
+double MultiFactorPriority::CalculatePriority_(PendingTaskRecord* record,
+                                               int64_t now) const {
+  FactorBound const& bound = m_factor_bound_;
+
+  if (record->static_bound_version != m_static_bound_version_) {
+    record->static_priority = CalculateStaticPriority_(*record);
+    record->static_bound_version = m_static_bound_version_;
+  }
+
+  uint64_t task_age = std::max(now - record->submit_time, int64_t{0});
+  task_age = std::min(task_age, g_config.PriorityConfig.MaxAge);
+
+  double age_factor{0};
+  double fair_share_factor = record->account_agg->fair_share_factor;
+
+  // age_factor
+  if (bound.age_max != bound.age_min)
+    age_factor = 1.0 * static_cast<double>(task_age - bound.age_min) /
+                 static_cast<double>(bound.age_max - bound.age_min);
+
+  double priority = record->static_priority +
+                    g_config.PriorityConfig.WeightAge * age_factor +
+                    g_config.PriorityConfig.WeightFairShare * fair_share_factor;
 
   return priority;
 }
@@ -22,6 +22,11 @@
 // Precompiled header comes first!
 
 #include "CranedMetaContainer.h"
+#include "EmbeddedDbClient.h"
+#include "StepPayloadDedup.h"
+#include "TaskDependencyGraph.h"
+#include "TaskQueryIndex.h"
+#include "TimerWheel.h"
 #include "protos/Crane.pb.h"
 
 namespace Ctld {
@@ -38,6 +43,15 @@ class IPrioritySorter {
       const UnorderedTaskMap& running_task_map, size_t limit,
       absl::Time now) = 0;
 
+  // Called by TaskScheduler when a task enters or leaves the pending map or
+  // the running map. Sorters which keep incremental state override them.
+  // Pending hooks are called with the pending map locked and running hooks
+  // with the running map locked.
+  virtual void OnPendingTaskAdded(const TaskInCtld& task) {}
+  virtual void OnPendingTaskRemoved(task_id_t task_id) {}
+  virtual void OnRunningTaskAdded(const TaskInCtld& task) {}
+  virtual void OnRunningTaskRemoved(task_id_t task_id) {}
+
   virtual ~IPrioritySorter() = default;
 };
 
@@ -55,8 +69,8 @@ class BasicPriority : public IPrioritySorter {
     int i = 0;
     for (auto it = pending_task_map.begin(); i < len; i++, it++) {
       TaskInCtld* task = it->second.get();
-      if (task->Held()) {
-        it->second->pending_reason = "Held";
+      if (task->Blocked()) {
+        it->second->pending_reason = task->BlockedReason();
         continue;
       }
       it->second->pending_reason = "";
@@ -74,7 +88,78 @@ class MultiFactorPriority : public IPrioritySorter {
       const UnorderedTaskMap& running_task_map, size_t limit_num,
       absl::Time now) override;
 
+  void OnPendingTaskAdded(const TaskInCtld& task) override;
+  void OnPendingTaskRemoved(task_id_t task_id) override;
+  void OnRunningTaskAdded(const TaskInCtld& task) override;
+  void OnRunningTaskRemoved(task_id_t task_id) override;
+
  private:
+  // Multiset of the values of one factor over pending tasks.
+  // Min and max are available in O(1).
+  template <typename T>
+  class BoundCounter {
+   public:
+    void Add(T val) { m_counts_[val]++; }
+    void Remove(T val) {
+      auto it = m_counts_.find(val);
+      if (--it->second == 0) m_counts_.erase(it);
+    }
+
+    bool Empty() const { return m_counts_.empty(); }
+    T Min() const { return m_counts_.begin()->first; }
+    T Max() const { return m_counts_.rbegin()->first; }
+
+   private:
+    absl::btree_map<T, uint32_t> m_counts_;
+  };
+
+  // Aggregates of the tasks of one account. The service value of an account is
+  // linear in the resources and the start time of its running tasks, so it
+  // can be evaluated from these sums without visiting the tasks.
+  struct AccountAggregate {
+    std::string name;
+
+    uint32_t pending_num{0};
+    uint32_t running_num{0};
+
+    // Start times are in seconds relative to m_time_origin_.
+    double start_sum{0};
+    double cpus_sum{0}, cpus_start_sum{0};
+    double nodes_sum{0}, nodes_start_sum{0};
+    double mem_sum{0}, mem_start_sum{0};
+
+    // Updated in each scheduling cycle.
+    double service_val{0};
+    double fair_share_factor{0};
+  };
+
+  struct PendingTaskRecord {
+    AccountAggregate* account_agg;
+
+    int64_t submit_time;
+    uint32_t qos_priority;
+    uint32_t part_priority;
+    uint32_t nodes_alloc;
+    uint64_t mem_alloc;
+    double cpus_alloc;
+    uint64_t mem_req;
+    double cpus_req;
+
+    // The part of priority from the factors which do not change over time.
+    // Valid if static_bound_version == m_static_bound_version_.
+    double static_priority{0};
+    uint64_t static_bound_version{0};
+  };
+
+  struct RunningTaskRecord {
+    AccountAggregate* account_agg;
+
+    double start_time;
+    double cpus_alloc;
+    double nodes_alloc;
+    double mem_alloc;
+  };
+
   struct FactorBound {
     uint64_t age_max, age_min;
     uint32_t qos_priority_max, qos_priority_min;
@@ -84,15 +169,59 @@ class MultiFactorPriority : public IPrioritySorter {
     double cpus_alloc_max, cpus_alloc_min;
     double service_val_max, service_val_min;
 
-    absl::flat_hash_map<std::string, double> acc_service_val_map;
+    bool StaticPartEqual(const FactorBound& other) const {
+      return qos_priority_max == other.qos_priority_max &&
+             qos_priority_min == other.qos_priority_min &&
+             part_priority_max == other.part_priority_max &&
+             part_priority_min == other.part_priority_min &&
+             nodes_alloc_max == other.nodes_alloc_max &&
+             nodes_alloc_min == other.nodes_alloc_min &&
+             mem_alloc_max == other.mem_alloc_max &&
+             mem_alloc_min == other.mem_alloc_min &&
+             cpus_alloc_max == other.cpus_alloc_max &&
+             cpus_alloc_min == other.cpus_alloc_min;
+    }
   };
 
-  void CalculateFactorBound_(const OrderedTaskMap& pending_task_map,
-                             const UnorderedTaskMap& running_task_map,
-                             absl::Time now);
-  double CalculatePriority_(Ctld::TaskInCtld* task, absl::Time now) const;
-
-  FactorBound m_factor_bound_;
+  void CalculateFactorBound_(absl::Time now)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(m_mtx_);
+  double CalculateStaticPriority_(const PendingTaskRecord& record) const
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(m_mtx_);
+  double CalculatePriority_(PendingTaskRecord* record, int64_t now) const
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(m_mtx_);
+
+  void AddPendingTaskNoLock_(const TaskInCtld& task)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(m_mtx_);
+
+  AccountAggregate* AcquireAccountAggregate_(const std::string& account)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(m_mtx_);
+  void ReleaseAccountAggregateIfUnused_(AccountAggregate* agg)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(m_mtx_);
+
+  // Pending hooks and running hooks are called under different locks.
+  absl::Mutex m_mtx_;
+
+  absl::flat_hash_map<task_id_t, PendingTaskRecord> m_pending_records_
+      ABSL_GUARDED_BY(m_mtx_);
+  absl::flat_hash_map<task_id_t, RunningTaskRecord> m_running_records_
+      ABSL_GUARDED_BY(m_mtx_);
+
+  // Node-based so that records can keep pointers to the aggregates.
+  absl::node_hash_map<std::string, AccountAggregate> m_account_aggs_
+      ABSL_GUARDED_BY(m_mtx_);
+
+  BoundCounter<int64_t> m_submit_time_counter_ ABSL_GUARDED_BY(m_mtx_);
+  BoundCounter<uint32_t> m_qos_priority_counter_ ABSL_GUARDED_BY(m_mtx_);
+  BoundCounter<uint32_t> m_part_priority_counter_ ABSL_GUARDED_BY(m_mtx_);
+  BoundCounter<uint32_t> m_nodes_alloc_counter_ ABSL_GUARDED_BY(m_mtx_);
+  BoundCounter<uint64_t> m_mem_alloc_counter_ ABSL_GUARDED_BY(m_mtx_);
+  BoundCounter<double> m_cpus_alloc_counter_ ABSL_GUARDED_BY(m_mtx_);
+
+  // Keeps the magnitude of the sums in AccountAggregate small.
+  const absl::Time m_time_origin_{absl::Now()};
+
+  FactorBound m_factor_bound_ ABSL_GUARDED_BY(m_mtx_){};
+  uint64_t m_static_bound_version_ ABSL_GUARDED_BY(m_mtx_){1};
 };
 
 class INodeSelectionAlgo {
@@ -116,28 +245,62 @@ class INodeSelectionAlgo {
   using NodeSelectionResult =
       std::pair<std::unique_ptr<TaskInCtld>, std::list<CranedId>>;
 
+  // A task selected to run. It stays in the pending map until the selection
+  // is committed by the caller.
+  struct SelectedTask {
+    task_id_t task_id;
+    std::list<CranedId> craned_ids;
+
+    // Needed to revoke the allocation if the task is cancelled or modified
+    // before the selection is committed.
+    ResvId reservation;
+    absl::Duration time_limit;
+  };
+
   virtual ~INodeSelectionAlgo() = default;
 
   /**
    * Do node selection for all pending tasks.
-   * Note: During this function call, the global meta is locked. This function
-   * should return as quick as possible.
-   * @param[in,out] all_partitions_meta_map Callee should make necessary
-   * modification in this structure to keep the consistency of global meta data.
-   * e.g. When a task is added to \b selection_result_list, corresponding
-   * resource should be subtracted from the fields in all_partitions_meta.
-   * @param[in,out] pending_task_map A list that contains all pending task. The
-   * list is order by committing time. The later committed task is at the tail
-   * of the list. When scheduling is done, scheduled tasks \b SHOULD be removed
-   * from \b pending_task_list
-   * @param[out] selected_tasks A list that contains the result of
-   * scheduling. See the annotation of \b SchedulingResult
+   * Note: During this function call, the task maps are only locked for
+   * reading. Except the scheduling fields of pending tasks, nothing in them
+   * should be modified.
+   * Callee should make necessary modification in g_meta_container to keep
+   * the consistency of global meta data, e.g. when a task is added to
+   * \b selected_tasks, corresponding resource should be subtracted.
+   * @param[in] pending_task_map A map that contains all pending task ordered by
+   * task id.
+   * @param[out] selected_tasks The tasks which can be started now and the
+   * craned nodes on which they will be run. The caller \b SHOULD move them
+   * from \b pending_task_map to the running map.
    */
   virtual void NodeSelect(
       const absl::flat_hash_map<task_id_t, std::unique_ptr<TaskInCtld>>&
           running_tasks,
-      absl::btree_map<task_id_t, std::unique_ptr<TaskInCtld>>* pending_task_map,
-      std::list<NodeSelectionResult>* selection_result_list) = 0;
+      const absl::btree_map<task_id_t, std::unique_ptr<TaskInCtld>>&
+          pending_task_map,
+      std::vector<SelectedTask>* selected_tasks) = 0;
+
+  /**
+   * Try to start the given pending tasks between two calls of NodeSelect(),
+   * using only the resources which are idle now and not planned by the last
+   * NodeSelect() call for any task it has seen. Tasks which can't be started
+   * now are left to the next NodeSelect() call.
+   * The same rules as NodeSelect() apply to the task maps, g_meta_container
+   * and \b selected_tasks.
+   * The default implementation selects nothing.
+   */
+  virtual void FastLaneSelect(
+      const absl::btree_map<task_id_t, std::unique_ptr<TaskInCtld>>&
+          pending_task_map,
+      const std::vector<task_id_t>& task_ids,
+      std::vector<SelectedTask>* selected_tasks) {}
+
+  /**
+   * Whether the last NodeSelect() call ran out of its time budget before
+   * evaluating all the tasks it took, in which case the next call goes on
+   * with the rest of them.
+   */
+  virtual bool SelectionResumable() const { return false; }
 };
 
 class MinLoadFirst : public INodeSelectionAlgo {
@@ -148,14 +311,119 @@ class MinLoadFirst : public INodeSelectionAlgo {
   void NodeSelect(
       const absl::flat_hash_map<task_id_t, std::unique_ptr<TaskInCtld>>&
           running_tasks,
-      absl::btree_map<task_id_t, std::unique_ptr<TaskInCtld>>* pending_task_map,
-      std::list<NodeSelectionResult>* selection_result_list) override;
+      const absl::btree_map<task_id_t, std::unique_ptr<TaskInCtld>>&
+          pending_task_map,
+      std::vector<SelectedTask>* selected_tasks) override;
+
+  void FastLaneSelect(
+      const absl::btree_map<task_id_t, std::unique_ptr<TaskInCtld>>&
+          pending_task_map,
+      const std::vector<task_id_t>& task_ids,
+      std::vector<SelectedTask>* selected_tasks) override;
+
+  bool SelectionResumable() const override {
+    return !m_resume_task_ids_.empty();
+  }
 
  private:
   static constexpr bool kAlgoTraceOutput = false;
   static constexpr bool kAlgoRedundantNode = false;
   static constexpr uint32_t kAlgoMaxTaskNumPerNode = 1000;
   static constexpr absl::Duration kAlgoMaxTimeWindow = absl::Hours(24 * 7);
+  // The time budget of a cycle is checked once every kBudgetCheckTaskNum
+  // tasks, and at least that many tasks are evaluated in each cycle.
+  static constexpr size_t kBudgetCheckTaskNum = 64;
+
+  // A task planned to start later by a pass of node selection which is not
+  // finished yet. Its resources are subtracted again when the pass resumes.
+  struct PlannedTask {
+    task_id_t task_id;
+    absl::Time start_time;
+    std::list<CranedId> craned_ids;
+  };
+
+  // TimeAvailResMap encoded by the ResourceInNodeLayout of the craned and
+  // stored in sorted contiguous arrays. A segment tree over the entries keeps
+  // the element-wise minimum and maximum of each range, so that the next
+  // entry where a resource fits (or does not fit) is found without visiting
+  // every entry. The tree spans a power-of-two capacity, so that a change
+  // only updates the changed leaves and their ancestors.
+  class AvailResTimeline {
+   public:
+    static constexpr size_t kNpos = std::numeric_limits<size_t>::max();
+
+    // `times` must be in ascending order and have the same size as `res`.
+    void Assign(std::vector<absl::Time> times,
+                std::vector<DenseResourceInNode> res);
+
+    size_t Size() const { return m_times_.size(); }
+    bool Empty() const { return m_times_.empty(); }
+    absl::Time TimeAt(size_t i) const { return m_times_[i]; }
+    const DenseResourceInNode& ResAt(size_t i) const { return m_res_[i]; }
+
+    // The available resource at `time`, which must not be before the first
+    // entry.
+    const DenseResourceInNode& ResAtTime(absl::Time time) const;
+
+    // Only the key of the first entry can be changed, as long as the order is
+    // kept.
+    void SetFirstTime(absl::Time time) { m_times_.front() = time; }
+
+    // Index of the first entry not before `time`, or Size().
+    size_t LowerBound(absl::Time time) const;
+
+    // Index of the first entry at or after `from` in which `req` fits, or
+    // Size() if there is none.
+    size_t NextFit(size_t from, const DenseResourceInNode& req) const;
+    // Index of the first entry at or after `from` in which `req` doesn't fit,
+    // or Size() if there is none.
+    size_t NextNonFit(size_t from, const DenseResourceInNode& req) const;
+
+    // Whether `req` fits in all the entries before `end`.
+    bool FitsBefore(absl::Time end, const DenseResourceInNode& req) const {
+      return NextNonFit(0, req) >= LowerBound(end);
+    }
+
+    // Subtract `res` from the available resource in [start, end). Time points
+    // are inserted at `start` and `end` if they don't exist.
+    void Subtract(absl::Time start, absl::Time end,
+                  const DenseResourceInNode& res);
+
+    // Insert a time point with zero available resource at `time`.
+    void SetToZeroAt(absl::Time time);
+
+    friend bool operator==(const AvailResTimeline& lhs,
+                           const AvailResTimeline& rhs) {
+      return lhs.m_times_ == rhs.m_times_ && lhs.m_res_ == rhs.m_res_;
+    }
+
+   private:
+    // Insert a time point which copies the resource of the preceding entry.
+    // Return the index of the entry at `time`.
+    size_t EnsureTimePoint_(absl::Time time);
+
+    // The tree is updated eagerly, since the timelines in the cache are read
+    // by the selection of several partition groups at the same time.
+    void RebuildTree_();
+    // Update the tree after the entries in [from, to) changed. The tree is
+    // rebuilt if the entries outgrew its capacity.
+    void UpdateTree_(size_t from, size_t to);
+    void UpdateTreeNode_(size_t node, size_t lo, size_t hi, size_t from,
+                         size_t to);
+    void PullTreeNode_(size_t node, size_t lo, size_t hi);
+    size_t FindFirst_(size_t node, size_t lo, size_t hi, size_t from,
+                      const DenseResourceInNode& req, bool fit) const;
+
+    std::vector<absl::Time> m_times_;
+    std::vector<DenseResourceInNode> m_res_;
+
+    // Segment tree rooted at 1 over [0, m_tree_capacity_). The node covering
+    // [lo, hi) keeps the element-wise minimum and maximum of m_res_[lo, hi),
+    // ignoring the positions past the last entry.
+    size_t m_tree_capacity_{0};
+    std::vector<DenseResourceInNode> m_min_tree_;
+    std::vector<DenseResourceInNode> m_max_tree_;
+  };
 
   class TimeAvailResMapIter;
 
@@ -221,35 +489,33 @@ class MinLoadFirst : public INodeSelectionAlgo {
   class TimeAvailResMapIter {
    public:
     TimeAvailResMapIter(const CranedId& craned_id,
-                        const TimeAvailResMap::const_iterator& it,
-                        const TimeAvailResMap::const_iterator& end,
+                        const AvailResTimeline* timeline,
                         ResMapIterList* tracker_list,
-                        const ResourceInNode* task_res)
+                        const DenseResourceInNode* task_res)
         : m_craned_id_(craned_id),
-          m_it_(it),
-          m_end_(end),
+          m_timeline_(timeline),
+          m_pos_(0),
           task_res(task_res),
           m_tracker_list_it_(tracker_list->m_tracker_list_.end()) {
       m_satisfied_flag_ = Satisfied();
     }
 
     bool IsCurrentPosSatisfied() const { return m_satisfied_flag_; }
-    bool ReachEnd() const { return m_it_ == m_end_; }
+    bool ReachEnd() const { return m_pos_ == m_timeline_->Size(); }
 
     TimeAvailResMapIter& operator++(int) {
       MoveToNext();
       return *this;
     }
 
-    const TimeAvailResMap::value_type& operator*() const { return *m_it_; }
-    const TimeAvailResMap::value_type* operator->() const { return &*m_it_; }
+    absl::Time Time() const { return m_timeline_->TimeAt(m_pos_); }
 
     const std::string& GetCranedId() const { return m_craned_id_; }
 
    private:
     friend ResMapIterList;
 
-    bool Satisfied() const { return *task_res <= m_it_->second; }
+    bool Satisfied() const { return *task_res <= m_timeline_->ResAt(m_pos_); }
 
     void MoveToNext() {
       m_satisfied_flag_ = !m_satisfied_flag_;  // target state
@@ -259,22 +525,89 @@ class MinLoadFirst : public INodeSelectionAlgo {
         MoveToNextUnsatisfied();
     }
 
-    void MoveToNextUnsatisfied() { while (++m_it_ != m_end_ && Satisfied()); }
-    void MoveToNextSatisfied() { while (++m_it_ != m_end_ && !Satisfied()); }
+    void MoveToNextUnsatisfied() {
+      m_pos_ = m_timeline_->NextNonFit(m_pos_ + 1, *task_res);
+    }
+    void MoveToNextSatisfied() {
+      m_pos_ = m_timeline_->NextFit(m_pos_ + 1, *task_res);
+    }
 
-    const ResourceInNode* task_res;
+    const DenseResourceInNode* task_res;
 
     ResMapIterList::ListContainer::iterator m_tracker_list_it_;
 
-    TimeAvailResMap::const_iterator m_it_;
-    const TimeAvailResMap::const_iterator m_end_;
+    const AvailResTimeline* m_timeline_;
+    size_t m_pos_;
 
     const CranedId m_craned_id_;
     bool m_satisfied_flag_;
   };
 
+  // The availability timeline of a single craned node derived from its
+  // running tasks and reservations. Timelines of partition nodes are kept
+  // across scheduling cycles and rebuilt only when the craned changes (see
+  // CranedMeta::sched_version) or when the earliest event in it is about to
+  // be clamped to `now + 1s`. Otherwise, only the first entry is moved to the
+  // new `now` and the cost is recalculated.
+  struct CranedTimeline {
+    struct CostItem {
+      absl::Time start_time;  // InfinitePast() for running tasks.
+      absl::Time end_time;
+      double cpu_ratio;
+      bool is_resv;
+    };
+
+    void Build(
+        const CranedId& craned_id, const ResourceInNode& res_total,
+        const ResourceInNode& res_avail, const absl::Time& now,
+        const std::vector<std::pair<absl::Time, const ResourceInNode*>>&
+            running_tasks,
+        const absl::flat_hash_map<ResvId, CranedMeta::ResvInNode>* resv_map);
+
+    bool ReusableAt(uint64_t version, absl::Time now) const {
+      return version == sched_version && FreshAt(now);
+    }
+
+    // Whether the timeline is still right at `now` if the craned is
+    // unchanged since it was built.
+    bool FreshAt(absl::Time now) const {
+      return now >= eval_time && now + absl::Seconds(1) <= next_event_time;
+    }
+
+    void ShiftTo(absl::Time now);
+
+    uint64_t sched_version{0};
+    // Set once the craned meta is read. Cleared when the craned may have
+    // changed since then, so its meta must be read again.
+    bool meta_seen{false};
+    // Whether the craned was alive and not drained when its meta was read.
+    bool schedulable{false};
+    absl::Time eval_time;
+    // The earliest change of available resource after `eval_time`.
+    absl::Time next_event_time{absl::InfinitePast()};
+
+    ResourceInNode res_total;
+    TimeAvailResMap time_avail_res_map;
+    // Encoded from time_avail_res_map by res_layout when built.
+    std::shared_ptr<const ResourceInNodeLayout> res_layout;
+    AvailResTimeline dense_timeline;
+    std::vector<CostItem> cost_items;
+
+    uint64_t cost{0};
+    bool has_resv{false};
+    absl::Time first_resv_time{absl::InfiniteFuture()};
+  };
+
+  // Built for each partition and reservation in every scheduling cycle and
+  // dropped at the end of it. All the data of a craned is kept in one entry
+  // so that it's found by a single lookup, and the cost set, which is updated
+  // for every selected task, is allocated from an arena owned by this object.
   class NodeSelectionInfo {
    public:
+    NodeSelectionInfo() = default;
+    NodeSelectionInfo(const NodeSelectionInfo&) = delete;
+    NodeSelectionInfo& operator=(const NodeSelectionInfo&) = delete;
+
     void InitCostAndTimeAvailResMap(
         const CranedId& craned_id, const ResourceInNode& res_total,
         const ResourceInNode& res_avail, const absl::Time& now,
@@ -282,59 +615,107 @@ class MinLoadFirst : public INodeSelectionAlgo {
             running_tasks,
         const absl::flat_hash_map<ResvId, CranedMeta::ResvInNode>* resv_map);
 
+    // The timeline is referenced instead of copied and MUST outlive this
+    // object. It is copied only when modified by GetTimeAvailResMap().
+    void InitFromCranedTimeline(const CranedId& craned_id,
+                                const CranedTimeline& timeline);
+
     void UpdateCost(const CranedId& craned_id, const absl::Time& start_time,
                     const absl::Time& end_time,
                     const ResourceInNode& resources) {
-      uint64_t& cost = m_node_cost_map_.at(craned_id);
-      m_cost_node_id_set_.erase({cost, craned_id});
-      UpdateCostFunc(cost, start_time, end_time, resources,
-                     m_node_res_total_map_.at(craned_id));
-      m_cost_node_id_set_.emplace(cost, craned_id);
+      auto it = m_node_entries_.find(craned_id);
+      NodeEntry& entry = it->second;
+      m_cost_node_id_set_.erase({entry.cost, &it->first});
+      entry.cost += CalculateCost_(
+          start_time, end_time,
+          static_cast<double>(resources.allocatable_res.cpu_count) /
+              static_cast<double>(entry.total_cpu_count));
+      m_cost_node_id_set_.emplace(entry.cost, &it->first);
+    }
+
+    AvailResTimeline& GetTimeAvailResMap(const CranedId& craned_id) {
+      NodeEntry& entry = m_node_entries_.at(craned_id);
+      // Copy on first write.
+      if (!entry.owned_timeline.has_value())
+        entry.owned_timeline.emplace(*entry.shared_timeline);
+      return entry.owned_timeline.value();
     }
 
-    TimeAvailResMap& GetTimeAvailResMap(const CranedId& craned_id) {
-      return m_node_time_avail_res_map_.at(craned_id);
+    const AvailResTimeline& GetTimeAvailResMap(
+        const CranedId& craned_id) const {
+      const NodeEntry& entry = m_node_entries_.at(craned_id);
+      if (entry.owned_timeline.has_value())
+        return entry.owned_timeline.value();
+      return *entry.shared_timeline;
     }
 
-    const TimeAvailResMap& GetTimeAvailResMap(const CranedId& craned_id) const {
-      return m_node_time_avail_res_map_.at(craned_id);
+    bool Contains(const CranedId& craned_id) const {
+      return m_node_entries_.contains(craned_id);
     }
 
-    const std::set<std::pair<uint64_t, CranedId>>& GetCostNodeIdSet() const {
-      return m_cost_node_id_set_;
+    const ResourceInNodeLayout& GetResLayout(const CranedId& craned_id) const {
+      return *m_node_entries_.at(craned_id).res_layout;
+    }
+
+    // Craned ids sorted by cost in ascending order.
+    auto GetCostSortedCranedIds() const {
+      return m_cost_node_id_set_ |
+             std::views::transform(
+                 [](const auto& cost_node) -> const CranedId& {
+                   return *cost_node.second;
+                 });
     }
 
     // Todo: Move to Reservation Mini-Scheduler.
-    absl::Time GetFirstResvTime(const CranedId& craned_id) {
-      auto iter = m_first_resv_time_map_.find(craned_id);
-      if (iter == m_first_resv_time_map_.end()) return absl::InfiniteFuture();
-      return iter->second;
+    absl::Time GetFirstResvTime(const CranedId& craned_id) const {
+      auto iter = m_node_entries_.find(craned_id);
+      if (iter == m_node_entries_.end()) return absl::InfiniteFuture();
+      return iter->second.first_resv_time;
     }
 
+    // Craneds not in this NodeSelectionInfo are ignored, since an entry
+    // without a timeline must not be created.
     void SetFirstResvTime(const CranedId& craned_id, absl::Time time) {
-      m_first_resv_time_map_[craned_id] = time;
+      auto iter = m_node_entries_.find(craned_id);
+      if (iter == m_node_entries_.end()) return;
+      iter->second.first_resv_time = time;
     }
 
    private:
-    void UpdateCostFunc(uint64_t& cost, const absl::Time& start_time,
-                        const absl::Time& end_time,
-                        const ResourceInNode& resources,
-                        const ResourceInNode& total_res) {
-      double cpu_ratio =
-          static_cast<double>(resources.allocatable_res.cpu_count) /
-          static_cast<double>(total_res.allocatable_res.cpu_count);
-      cost += std::round((end_time - start_time) / absl::Seconds(1) *
-                         cpu_ratio * 256);
-    }
+    struct NodeEntry {
+      uint64_t cost{0};
+      cpu_t total_cpu_count{};
+      // The timeline of reservations and the ones modified in this
+      // scheduling cycle are owned here. Others are shared with
+      // MinLoadFirst::m_craned_timeline_cache_.
+      std::optional<AvailResTimeline> owned_timeline;
+      const AvailResTimeline* shared_timeline{nullptr};
+      std::shared_ptr<const ResourceInNodeLayout> res_layout;
+      absl::Time first_resv_time{absl::InfiniteFuture()};
+    };
+
+    // Entries are ordered by cost and then craned id. The craned ids point
+    // to the keys of m_node_entries_, which are stable.
+    struct CostNodeLess {
+      bool operator()(const std::pair<uint64_t, const CranedId*>& lhs,
+                      const std::pair<uint64_t, const CranedId*>& rhs) const {
+        if (lhs.first != rhs.first) return lhs.first < rhs.first;
+        return *lhs.second < *rhs.second;
+      }
+    };
 
-    // Craned_ids are sorted by cost.
-    std::set<std::pair<uint64_t, CranedId>> m_cost_node_id_set_;
-    std::unordered_map<CranedId, uint64_t> m_node_cost_map_;
-    std::unordered_map<CranedId, TimeAvailResMap> m_node_time_avail_res_map_;
-    std::unordered_map<CranedId, absl::Time> m_first_resv_time_map_;
+    NodeEntry& InitEntry_(const CranedId& craned_id,
+                          const CranedTimeline& timeline);
 
-    // TODO: High copy cost, consider using pointer.
-    std::unordered_map<CranedId, ResourceInNode> m_node_res_total_map_;
+    static constexpr size_t kArenaInitialSize = 64 * 1024;
+
+    absl::node_hash_map<CranedId, NodeEntry> m_node_entries_;
+
+    // Memory of the erased elements is reclaimed only when this object is
+    // destroyed at the end of the cycle.
+    std::pmr::monotonic_buffer_resource m_arena_{kArenaInitialSize};
+    std::pmr::set<std::pair<uint64_t, const CranedId*>, CostNodeLess>
+        m_cost_node_id_set_{&m_arena_};
   };
 
   // Select a subset of craned nodes that can start the task as early as
@@ -348,15 +729,19 @@ class MinLoadFirst : public INodeSelectionAlgo {
         : m_satisfied_iters_(task->node_num),
           m_time_priority_queue_([](const TimeAvailResMapIter* lhs,
                                     const TimeAvailResMapIter* rhs) {
-            return (*lhs)->first > (*rhs)->first;
+            return lhs->Time() > rhs->Time();
           }) {
+      // Iterators keep pointers to the elements of both vectors.
+      m_task_res_.reserve(craned_indexes.size());
       m_res_map_iters_.reserve(craned_indexes.size());
       for (const CranedId& craned_id : craned_indexes) {
         const auto& time_avail_res_map =
             node_selection_info.GetTimeAvailResMap(craned_id);
-        m_res_map_iters_.emplace_back(
-            craned_id, time_avail_res_map.begin(), time_avail_res_map.end(),
-            &m_satisfied_iters_, &task->AllocatedRes().at(craned_id));
+        m_task_res_.emplace_back(
+            node_selection_info.GetResLayout(craned_id).Encode(
+                task->AllocatedRes().at(craned_id)));
+        m_res_map_iters_.emplace_back(craned_id, &time_avail_res_map,
+                                      &m_satisfied_iters_, &m_task_res_.back());
         m_time_priority_queue_.emplace(&m_res_map_iters_.back());
       }
     }
@@ -365,7 +750,7 @@ class MinLoadFirst : public INodeSelectionAlgo {
                                absl::Time* start_time,
                                std::list<CranedId>* craned_ids) {
       while (!m_time_priority_queue_.empty()) {
-        absl::Time current_time = (*m_time_priority_queue_.top())->first;
+        absl::Time current_time = m_time_priority_queue_.top()->Time();
         if (current_time - now > kAlgoMaxTimeWindow) return false;
 
         // Iterate over all iterators that have the same time.
@@ -373,7 +758,7 @@ class MinLoadFirst : public INodeSelectionAlgo {
           if (m_time_priority_queue_.empty()) break;
 
           TimeAvailResMapIter* it = m_time_priority_queue_.top();
-          if ((*it)->first != current_time) break;
+          if (it->Time() != current_time) break;
 
           m_time_priority_queue_.pop();
           if (it->IsCurrentPosSatisfied())
@@ -390,7 +775,7 @@ class MinLoadFirst : public INodeSelectionAlgo {
 
         if (m_time_priority_queue_.empty() ||
             kth_time + task->time_limit <=
-                (*m_time_priority_queue_.top())->first) {
+                m_time_priority_queue_.top()->Time()) {
           *start_time = kth_time;
 
           craned_ids->clear();
@@ -411,6 +796,7 @@ class MinLoadFirst : public INodeSelectionAlgo {
    private:
     ResMapIterList m_satisfied_iters_;
 
+    std::vector<DenseResourceInNode> m_task_res_;
     std::vector<TimeAvailResMapIter> m_res_map_iters_;
     std::priority_queue<TimeAvailResMapIter*, std::vector<TimeAvailResMapIter*>,
                         std::function<bool(const TimeAvailResMapIter*,
@@ -418,7 +804,19 @@ class MinLoadFirst : public INodeSelectionAlgo {
         m_time_priority_queue_;
   };
 
-  static void CalculateNodeSelectionInfoOfPartition_(
+  static double CpuRatio_(const ResourceInNode& resources,
+                          const ResourceInNode& total_res) {
+    return static_cast<double>(resources.allocatable_res.cpu_count) /
+           static_cast<double>(total_res.allocatable_res.cpu_count);
+  }
+
+  static uint64_t CalculateCost_(const absl::Time& start_time,
+                                 const absl::Time& end_time, double cpu_ratio) {
+    return std::round((end_time - start_time) / absl::Seconds(1) * cpu_ratio *
+                      256);
+  }
+
+  void CalculateNodeSelectionInfoOfPartition_(
       const absl::flat_hash_map<uint32_t, std::unique_ptr<TaskInCtld>>&
           running_tasks,
       absl::Time now, const PartitionId& partition_id,
@@ -426,6 +824,22 @@ class MinLoadFirst : public INodeSelectionAlgo {
       const CranedMetaContainer::CranedMetaRawMap& craned_meta_map,
       NodeSelectionInfo* node_selection_info);
 
+  static void BuildCranedTimeline_(
+      const absl::flat_hash_map<uint32_t, std::unique_ptr<TaskInCtld>>&
+          running_tasks,
+      absl::Time now, const PartitionId& partition_id,
+      const CranedId& craned_id, const CranedMeta& craned_meta,
+      CranedTimeline* timeline);
+
+  // Assert that a reused timeline equals the one rebuilt from the craned
+  // meta. No-op in release builds.
+  static void DebugCheckCranedTimeline_(
+      const absl::flat_hash_map<uint32_t, std::unique_ptr<TaskInCtld>>&
+          running_tasks,
+      absl::Time now, const PartitionId& partition_id,
+      const CranedId& craned_id, const CranedMeta& craned_meta,
+      const CranedTimeline& timeline);
+
   // TODO: Move to Reservation Mini-Scheduler.
   static void CalculateNodeSelectionInfoOfReservation_(
       const absl::flat_hash_map<uint32_t, std::unique_ptr<TaskInCtld>>&
@@ -434,6 +848,39 @@ class MinLoadFirst : public INodeSelectionAlgo {
       const CranedMetaContainer::CranedMetaRawMap& craned_meta_map,
       NodeSelectionInfo* node_selection_info);
 
+  // Everything CalculateRunningNodesAndStartTime_ looks at in a task.
+  // Within one cycle the timelines only lose resources, so once a task of
+  // some shape can't start now, no later task of the same shape can either.
+  struct TaskShape {
+    PartitionId partition_id;
+    ResvId reservation;
+    uint32_t node_num;
+    absl::Duration time_limit;
+    bool exclusive;
+    AllocatableResource allocatable_res;
+    DeviceMap device_map;
+    std::vector<CranedId> included_nodes;
+    std::vector<CranedId> excluded_nodes;
+
+    explicit TaskShape(const TaskInCtld& task);
+
+    bool operator==(const TaskShape& rhs) const;
+
+    template <typename H>
+    friend H AbslHashValue(H h, const TaskShape& shape) {
+      return H::combine(std::move(h), shape.partition_id, shape.reservation,
+                        shape.node_num, shape.time_limit, shape.exclusive,
+                        shape.allocatable_res.memory_bytes,
+                        shape.device_map.size(), shape.included_nodes,
+                        shape.excluded_nodes);
+    }
+  };
+
+  // The craneds a task could ever run on in its partition: alive, not
+  // drained and having every device type the task requests.
+  static CranedMetaContainer::CranedFilter SchedulableCranedFilterOf_(
+      const TaskInCtld& task);
+
   static bool CalculateRunningNodesAndStartTime_(
       const NodeSelectionInfo& node_selection_info,
       const util::Synchronized<PartitionMeta>& partition_meta_ptr,
@@ -441,19 +888,78 @@ class MinLoadFirst : public INodeSelectionAlgo {
       TaskInCtld* task, absl::Time now, std::list<CranedId>* craned_ids,
       absl::Time* start_time);
 
+  // Pick node_num of the ready craneds, which are sorted by cost, under the
+  // lowest switch having enough of them and on as few leaf switches as
+  // possible. switch_ready_counts holds the number of the ready craneds under
+  // each switch. Return false if no switch has enough of them.
+  static bool SelectNodesByTopology_(
+      const NetworkTopology& topology,
+      const std::vector<CranedId>& ready_craned_ids,
+      const std::vector<uint32_t>& switch_ready_counts, uint32_t node_num,
+      std::vector<size_t>* selected_indexes);
+
+  // Split the tasks into groups of partitions sharing no craned node.
+  // The priority order is kept inside each group.
+  static std::vector<std::vector<task_id_t>> GroupTasksByDisjointPartitions_(
+      const std::vector<task_id_t>& task_ids,
+      const OrderedTaskMap& pending_task_map);
+
+  // Return the number of the leading tasks evaluated before `deadline`.
+  // The tasks planned to start later are added to planned_tasks if it's not
+  // null.
+  static size_t SelectNodesForTasks_(
+      const std::vector<task_id_t>& task_ids, absl::Time now,
+      absl::Time deadline, const OrderedTaskMap& pending_task_map,
+      std::unordered_map<PartitionId, NodeSelectionInfo>* part_id_node_info_map,
+      std::unordered_map<ResvId, NodeSelectionInfo>* resv_id_node_info_map,
+      std::vector<SelectedTask>* selected_tasks,
+      std::vector<PlannedTask>* planned_tasks);
+
+  // Subtract the plans made by the finished part of the current pass from
+  // the rebuilt NodeSelectionInfo, so that the rest of the pass doesn't take
+  // the resources planned for the tasks before it.
+  void SubtractPassPlans_(
+      absl::Time now, const OrderedTaskMap& pending_task_map,
+      std::unordered_map<PartitionId, NodeSelectionInfo>*
+          part_id_node_info_map);
+
   static void SubtractTaskResourceNodeSelectionInfo_(
       absl::Time const& expected_start_time, absl::Duration const& duration,
       ResourceV2 const& resources, std::list<CranedId> const& craned_ids,
       NodeSelectionInfo* node_selection_info);
 
   IPrioritySorter* m_priority_sorter_;
+
+  // Clear CranedTimeline::meta_seen of the craneds changed since the last
+  // scheduling cycle, as published by the craned change stream.
+  void ConsumeCranedChanges_();
+
+  // Only accessed by the scheduling thread.
+  std::unordered_map<CranedId, CranedTimeline> m_craned_timeline_cache_;
+  uint64_t m_craned_change_seq_{0};
+
+  // The NodeSelectionInfo of the partitions at the end of the last
+  // NodeSelect() call, where the resources of all the tasks it started or
+  // planned are subtracted. FastLaneSelect() places tasks on what is left
+  // and subtracts them as well. The timelines are shared with
+  // m_craned_timeline_cache_, so it is cleared before the cache is updated.
+  // Only accessed by the scheduling thread.
+  std::unordered_map<PartitionId, NodeSelectionInfo>
+      m_last_part_id_node_info_map_;
+  // The tasks of the current pass not evaluated yet in the priority order
+  // and the plans made by the part done, if the last cycle ran out of
+  // ScheduleCycleBudgetMs. Only accessed by the scheduling thread.
+  std::vector<task_id_t> m_resume_task_ids_;
+  std::vector<PlannedTask> m_pass_planned_tasks_;
 };
 
 class TaskScheduler {
   using TaskInEmbeddedDb = crane::grpc::TaskInEmbeddedDb;
 
   using Mutex = absl::Mutex;
-  using LockGuard = absl::MutexLock;
+  using ProfiledMutex = util::ProfiledMutex;
+  using LockGuard = util::ProfiledMutexLock;
+  using ReaderLockGuard = util::ProfiledReaderMutexLock;
 
   template <typename K, typename V,
             typename Hash = absl::container_internal::hash_default_hash<K>>
@@ -474,10 +980,20 @@ class TaskScheduler {
 
   void SetNodeSelectionAlgo(std::unique_ptr<INodeSelectionAlgo> algo);
 
+  // Wake up the scheduling thread for a new cycle. Called when something
+  // which may let more pending tasks start has changed.
+  void TriggerSchedule();
+
   /// \return The future is set to 0 if task submission is failed.
   /// Otherwise, it is set to newly allocated task id.
   std::future<task_id_t> SubmitTaskAsync(std::unique_ptr<TaskInCtld> task);
 
+  // Same as SubmitTaskAsync() for each task, with one wake-up of the
+  // scheduler thread so that the tasks are appended to the embedded db in
+  // the same batch.
+  std::vector<std::future<task_id_t>> SubmitTasksAsync(
+      std::vector<std::unique_ptr<TaskInCtld>> tasks);
+
   std::future<CraneErrCode> HoldReleaseTaskAsync(task_id_t task_id,
                                                  int64_t secs);
 
@@ -491,6 +1007,12 @@ class TaskScheduler {
   CraneExpected<std::future<task_id_t>> SubmitTaskToScheduler(
       std::unique_ptr<TaskInCtld> task);
 
+  // Validates the tasks in parallel on g_thread_pool and submits the valid
+  // ones at once. The results are in the order of the tasks, and the QoS
+  // limits are applied in that order as if they were submitted one by one.
+  std::vector<CraneExpected<std::future<task_id_t>>> SubmitTasksToScheduler(
+      std::vector<std::unique_ptr<TaskInCtld>> tasks);
+
   void StepStatusChangeWithReasonAsync(uint32_t task_id,
                                        const CranedId& craned_index,
                                        crane::grpc::TaskStatus new_status,
@@ -506,11 +1028,47 @@ class TaskScheduler {
 
   void TerminateTasksOnCraned(const CranedId& craned_id, uint32_t exit_code);
 
+  // Accumulate the usage samples of running jobs sent by a craned. Samples
+  // of jobs which have ended or don't run on the craned are dropped.
+  void AddJobUsageSamples(
+      const CranedId& craned_id,
+      const google::protobuf::RepeatedPtrField<crane::grpc::JobUsageSample>&
+          samples);
+
   // Temporary inconsistency may happen. If 'false' is returned, just ignore
   // it.
   void QueryTasksInRam(const crane::grpc::QueryTasksInfoRequest* request,
                        crane::grpc::QueryTasksInfoReply* response);
 
+  struct TaskInfoSnapshot {
+    explicit TaskInfoSnapshot(size_t arena_block_size)
+        : arena(arena_block_size) {}
+
+    absl::Time build_time;
+    // Holds all the TaskInfo below. Readers may keep a snapshot for a while,
+    // so the arena is not reused, but it is sized from the last snapshot.
+    util::ReusableArena arena;
+    // Pending tasks including the buffered ones and running tasks, each in
+    // ascending order of task id.
+    std::vector<const crane::grpc::TaskInfo*> pending_tasks;
+    std::vector<const crane::grpc::TaskInfo*> running_tasks;
+  };
+
+  // The last published snapshot, or a new one if the snapshot thread is
+  // disabled.
+  std::shared_ptr<const TaskInfoSnapshot> GetTaskInfoSnapshot();
+
+  // Answers the query from id-ordered lists of pending and running tasks read
+  // at build_time, such as a snapshot or the state of a read replica.
+  static void QueryTaskInfoLists(
+      std::span<const crane::grpc::TaskInfo* const> pending_tasks,
+      std::span<const crane::grpc::TaskInfo* const> running_tasks,
+      absl::Time build_time, const crane::grpc::QueryTasksInfoRequest* request,
+      crane::grpc::QueryTasksInfoReply* response);
+
+  // Walks all pending and running tasks, so it's meant for diagnosis only.
+  void QueryTaskMemoryUsage(crane::grpc::QuerySchedulerStatsReply* reply);
+
   void QueryRnJobOnCtldForNodeConfig(const CranedId& craned_id,
                                      crane::grpc::ConfigureCranedRequest* req);
 
@@ -521,8 +1079,10 @@ class TaskScheduler {
       const crane::grpc::CancelTaskRequest& request);
 
   CraneErrCode TerminatePendingOrRunningIaTask(uint32_t task_id) {
+    LockGuard buffer_guard(&m_submitted_task_buffer_mtx_);
     LockGuard pending_guard(&m_pending_task_map_mtx_);
     LockGuard running_guard(&m_running_task_map_mtx_);
+    MergeSubmittedTaskBufferNoLock_();
 
     auto pd_it = m_pending_task_map_.find(task_id);
     if (pd_it != m_pending_task_map_.end()) {
@@ -535,6 +1095,7 @@ class TaskScheduler {
           CancelPendingTaskQueueElem{.task = std::move(task)});
       m_cancel_task_async_handle_->send();
       m_pending_task_map_.erase(pd_it);
+      m_priority_sorter_->OnPendingTaskRemoved(task_id);
       return CraneErrCode::SUCCESS;
     }
 
@@ -563,9 +1124,20 @@ class TaskScheduler {
   }
 
   static CraneExpected<void> HandleUnsetOptionalInTaskToCtld(TaskInCtld* task);
+
+  // Fill the fields of a TaskToCtld shared by many tasks which
+  // SubmitTaskToScheduler() would otherwise set in each of them, so that the
+  // tasks don't have to copy the shared one.
+  static void FillDefaultsOfSharedTaskToCtld(
+      crane::grpc::TaskToCtld* task_to_ctld);
+
   static CraneExpected<void> AcquireTaskAttributes(TaskInCtld* task);
   static CraneExpected<void> CheckTaskValidity(TaskInCtld* task);
 
+  // All the checks of a submitted task except its QoS limits. Safe to be
+  // called on many tasks concurrently.
+  static CraneExpected<void> ValidateSubmittedTask(TaskInCtld* task);
+
   // TODO: Move to Reservation Mini-Scheduler.
   crane::grpc::CreateReservationReply CreateResv(
       const crane::grpc::CreateReservationRequest& request);
@@ -590,41 +1162,117 @@ class TaskScheduler {
   template <class... Ts>
   VariantVisitor(Ts...) -> VariantVisitor<Ts...>;
 
-  void RequeueRecoveredTaskIntoPendingQueueLock_(
-      std::unique_ptr<TaskInCtld> task);
+  // Each takes the map locks once for all the tasks.
+  void RequeueRecoveredTasksIntoPendingQueueLock_(
+      std::vector<std::unique_ptr<TaskInCtld>>&& tasks);
 
-  void PutRecoveredTaskIntoRunningQueueLock_(std::unique_ptr<TaskInCtld> task);
+  void PutRecoveredTasksIntoRunningQueueLock_(
+      std::vector<std::unique_ptr<TaskInCtld>>&& tasks);
 
-  static void ProcessFinalTasks_(std::vector<TaskInCtld*> const& tasks);
+  void ProcessFinalTasks_(std::vector<TaskInCtld*> const& tasks);
 
   static void CallPluginHookForFinalTasks_(
       std::vector<TaskInCtld*> const& tasks);
 
+  // The final state of the tasks is committed together with db_batch.
   static void PersistAndTransferTasksToMongodb_(
-      std::vector<TaskInCtld*> const& tasks);
+      std::vector<TaskInCtld*> const& tasks,
+      EmbeddedDbClient::WriteBatch&& db_batch);
+
+  // Reject dependencies on tasks which are unknown to ctld.
+  CraneExpected<void> CheckTaskDependencies_(const TaskInCtld& task);
+
+  // Look up the final status of ended tasks in MongoDB for the dependency
+  // graph. The ids not found are returned in missing_ids.
+  bool LoadEndedUpstreamTasks_(const std::vector<task_id_t>& task_ids,
+                               std::vector<task_id_t>* missing_ids);
+
+  // Resolve the dependencies on the ended tasks and put the changes of the
+  // dependents into db_batch. Returns whether any dependent is released.
+  bool ResolveDependenciesOnEndedTasks_(
+      std::vector<TaskInCtld*> const& tasks,
+      EmbeddedDbClient::WriteBatch* db_batch);
+
+  static void PutDependencyDelta_(
+      const TaskInCtld& task,
+      const TaskDependencyGraph::Resolution& resolution,
+      EmbeddedDbClient::WriteBatch* db_batch);
 
   CraneErrCode TerminateRunningTaskNoLock_(TaskInCtld* task);
 
   CraneErrCode SetHoldForTaskInRamAndDb_(task_id_t task_id, bool hold);
 
+  // Release the tasks whose hold timers expired at once. The maps are locked
+  // once and the runtime attributes are written in one transaction.
+  void ReleaseHoldOfTasksInRamAndDb_(const std::vector<task_id_t>& task_ids);
+
+  // Move the selected tasks out of the pending map after validating that they
+  // are not cancelled or modified during node selection, merge the tasks
+  // submitted meanwhile and, if publish_sched_attrs is set, publish the
+  // scheduling fields of pending tasks.
+  void CommitNodeSelection_(
+      std::vector<INodeSelectionAlgo::SelectedTask>* selected_tasks,
+      std::list<INodeSelectionAlgo::NodeSelectionResult>*
+          selection_result_list,
+      bool publish_sched_attrs);
+
+  // Set the running fields of the selected tasks, move them into the running
+  // map and hand them over to the launch stage.
+  void StartSelectedTasks_(
+      std::list<INodeSelectionAlgo::NodeSelectionResult>*
+          selection_result_list);
+
+  // Queue the interactive tasks just added to the pending map for the fast
+  // lane and wake up the scheduling thread for them.
+  void TriggerFastLane_(std::vector<task_id_t>&& task_ids);
+
+  // Start the interactive tasks queued for the fast lane if they fit in the
+  // resources left by the last scheduling cycle.
+  void RunFastLane_(const std::vector<task_id_t>& task_ids);
+
+  // Called by writers of the pending map so that tasks parked in the
+  // submission buffer during node selection are visible to them.
+  void MergeSubmittedTaskBufferNoLock_()
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(m_submitted_task_buffer_mtx_,
+                                    m_pending_task_map_mtx_);
+
   std::unique_ptr<INodeSelectionAlgo> m_node_selection_algo_;
 
+  // The scheduler only holds the reader lock of the pending map during node
+  // selection. Tasks submitted meanwhile are parked here and merged into the
+  // pending map when the scheduling cycle is committed.
+  TreeMap<task_id_t, std::unique_ptr<TaskInCtld>> m_submitted_task_buffer_
+      ABSL_GUARDED_BY(m_submitted_task_buffer_mtx_);
+  bool m_node_selecting_ ABSL_GUARDED_BY(m_submitted_task_buffer_mtx_){false};
+  Mutex m_submitted_task_buffer_mtx_;
+
   // Ordered by task id. Those who comes earlier are in the head,
   // Because they have smaller task id.
   TreeMap<task_id_t, std::unique_ptr<TaskInCtld>> m_pending_task_map_
       ABSL_GUARDED_BY(m_pending_task_map_mtx_);
-  Mutex m_pending_task_map_mtx_;
+  ProfiledMutex m_pending_task_map_mtx_ ABSL_ACQUIRED_AFTER(
+      m_submitted_task_buffer_mtx_){"pending_task_map"};
 
   std::atomic_uint32_t m_pending_map_cached_size_;
 
   HashMap<task_id_t, std::unique_ptr<TaskInCtld>> m_running_task_map_
       ABSL_GUARDED_BY(m_running_task_map_mtx_);
-  Mutex m_running_task_map_mtx_ ABSL_ACQUIRED_AFTER(m_pending_task_map_mtx_);
+  ProfiledMutex m_running_task_map_mtx_ ABSL_ACQUIRED_AFTER(
+      m_pending_task_map_mtx_){"running_task_map"};
 
   // Task Indexes
   HashMap<CranedId, HashSet<uint32_t /* Task ID*/>> m_node_to_tasks_map_
       ABSL_GUARDED_BY(m_task_indexes_mtx_);
-  Mutex m_task_indexes_mtx_ ABSL_ACQUIRED_AFTER(m_running_task_map_mtx_);
+  ProfiledMutex m_task_indexes_mtx_ ABSL_ACQUIRED_AFTER(
+      m_running_task_map_mtx_){"task_indexes"};
+
+  // Updated together with the task buffer, the pending map and the running
+  // map while their locks are held. It has its own leaf lock.
+  TaskQueryIndex m_task_query_index_;
+
+  // Updated with the tasks entering the maps while their locks are held and
+  // with the tasks ended. It has its own leaf lock.
+  TaskDependencyGraph m_dependency_graph_;
 
   std::unique_ptr<IPrioritySorter> m_priority_sorter_;
 
@@ -634,6 +1282,110 @@ class TaskScheduler {
   std::thread m_schedule_thread_;
   void ScheduleThread_();
 
+  // Block until a scheduling cycle is triggered or the max interval passes.
+  // Tasks queued for the fast lane meanwhile are handled while waiting.
+  // \return Whether the cycle is triggered by an event.
+  bool WaitForScheduleTrigger_();
+
+  // Whether a craned changed or a reservation started since the last call.
+  // A cycle not triggered by any event is skipped otherwise, since none of
+  // its inputs has changed.
+  bool ScheduleInputsChanged_();
+
+  // Only accessed by the scheduling thread.
+  uint64_t m_cycle_craned_change_seq_{0};
+  absl::Time m_cycle_inputs_time_{absl::InfinitePast()};
+
+  // Send the ExecuteSteps RPCs to all the craneds concurrently and collect
+  // the job ids which failed to execute on each craned. payloads are those
+  // replaced by hashes in the requests, see StepPayloadDedup.
+  static void DispatchExecuteSteps_(
+      const HashMap<CranedId, crane::grpc::ExecuteStepsRequest*>&
+          craned_exec_requests_map,
+      const StepPayloadDedup::PayloadMap& payloads,
+      std::unordered_map<CranedId, std::pair<std::vector<job_id_t>, uint16_t>>*
+          failed_to_exec_job_id_map);
+
+  static bool UseLaunchTree_(size_t craned_num) {
+    return g_config.LaunchTreeFanOut != 0 &&
+           craned_num >= kLaunchTreeMinCraneds;
+  }
+
+  // Send the payloads of the nodes through launch trees of LaunchTreeFanOut
+  // children per craned and return the failed task ids of each craned
+  // reached. The craneds not in the result are to be sent directly. The
+  // tasks whose StepPayload was missed are added to payload_missed if set.
+  static HashMap<CranedId, std::vector<task_id_t>> LaunchByTree_(
+      std::vector<crane::grpc::LaunchTreeNode>&& nodes,
+      HashMap<CranedId, std::vector<task_id_t>>* payload_missed = nullptr);
+
+  Mutex m_schedule_trigger_mtx_;
+  bool m_schedule_triggered_ ABSL_GUARDED_BY(m_schedule_trigger_mtx_){false};
+  // Interactive tasks added to the pending map and waiting for the fast lane.
+  std::vector<task_id_t> m_fast_lane_task_ids_
+      ABSL_GUARDED_BY(m_schedule_trigger_mtx_);
+
+  // Everything the launch stage needs about the tasks scheduled in one
+  // cycle. These tasks are already in the running queue and may end at any
+  // time, so nothing here refers to TaskInCtld.
+  struct LaunchBatch {
+    struct TaskLaunchInfo {
+      uid_t uid;
+      std::vector<CranedId> craned_ids;
+      std::vector<CranedId> executing_craned_ids;
+      // Only set for interactive tasks.
+      std::function<void()> cb_res_allocated;
+    };
+
+    HashMap<CranedId, std::vector<crane::grpc::JobToD>> craned_cgroup_map;
+    // The requests carry the scripts and environments of all the tasks and
+    // are the bulk of a batch, so they are built on the arena.
+    std::unique_ptr<util::ReusableArena> arena;
+    HashMap<CranedId, crane::grpc::ExecuteStepsRequest*>
+        craned_exec_requests_map;
+    // Kept to send the tasks again to a craned which missed payloads.
+    StepPayloadDedup::PayloadMap payloads;
+    std::vector<crane::grpc::TaskInfo> tasks_post_start;
+    HashMap<task_id_t, TaskLaunchInfo> task_launch_info_map;
+  };
+
+  // Creates the cgroups and executes the tasks of the last cycle while the
+  // schedule thread goes on with the next one.
+  std::thread m_launch_thread_;
+  void LaunchThread_();
+  void LaunchTasks_(LaunchBatch* batch);
+
+  Mutex m_launch_batch_mtx_;
+  std::optional<LaunchBatch> m_launch_batch_
+      ABSL_GUARDED_BY(m_launch_batch_mtx_);
+  bool m_launch_thread_stop_ ABSL_GUARDED_BY(m_launch_batch_mtx_){false};
+  // The arena of the last launched batch, handed back to the schedule thread
+  // for the next one. Together with the batch in the slot and the one being
+  // built, two arenas take turns and keep their blocks across cycles.
+  std::unique_ptr<util::ReusableArena> m_spare_launch_arena_
+      ABSL_GUARDED_BY(m_launch_batch_mtx_);
+
+  // The tasks in the running queue whose steps are not on the craneds yet.
+  // Terminating one of them is left to the launch stage, which drops it
+  // before ExecuteSteps or terminates it on the craneds afterwards.
+  Mutex m_launching_task_mtx_;
+  HashSet<task_id_t> m_launching_task_ids_
+      ABSL_GUARDED_BY(m_launching_task_mtx_);
+  HashSet<task_id_t> m_launch_terminated_task_ids_
+      ABSL_GUARDED_BY(m_launching_task_mtx_);
+
+  // Summaries of the tasks in RAM, published by the snapshot thread every
+  // TaskQuerySnapshotIntervalMs if it is enabled. Query RPCs read it without
+  // taking any lock of the scheduler.
+  std::atomic<std::shared_ptr<const TaskInfoSnapshot>> m_task_info_snapshot_;
+  // Arena space taken by the last snapshot. Only used by the snapshot thread.
+  size_t m_task_info_snapshot_space_{0};
+  std::thread m_task_info_snapshot_thread_;
+  void TaskInfoSnapshotThread_();
+
+  std::shared_ptr<TaskInfoSnapshot> BuildTaskInfoSnapshot_(
+      size_t arena_block_size);
+
   std::thread m_task_release_thread_;
   void ReleaseTaskThread_(const std::shared_ptr<uvw::loop>& uvw_loop);
 
@@ -650,8 +1402,11 @@ class TaskScheduler {
   std::shared_ptr<uvw::timer_handle> m_task_timer_handle_;
   void CleanTaskTimerCb_();
 
-  std::unordered_map<task_id_t, std::shared_ptr<uvw::timer_handle>>
-      m_task_timer_handles_;
+  // Deadlines of the hold timers, ticked every second by
+  // m_hold_timer_wheel_handle_. Only accessed in the loop of the handles.
+  TimerWheel m_hold_timer_wheel_{ToUnixSeconds(absl::Now())};
+  std::shared_ptr<uvw::timer_handle> m_hold_timer_wheel_handle_;
+  void HoldTimerWheelCb_();
 
   std::shared_ptr<uvw::async_handle> m_task_timeout_async_handle_;
 
@@ -662,7 +1417,7 @@ class TaskScheduler {
   void TaskTimerAsyncCb_();
 
   std::shared_ptr<uvw::async_handle> m_clean_task_timer_queue_handle_;
-  void CleanTaskTimerQueueCb_(const std::shared_ptr<uvw::loop>& uvw_loop);
+  void CleanTaskTimerQueueCb_();
 
   std::shared_ptr<uvw::timer_handle> m_cancel_task_timer_handle_;
   void CancelTaskTimerCb_();
@@ -728,6 +1483,10 @@ class TaskScheduler {
 
   std::shared_ptr<uvw::async_handle> m_clean_resv_timer_queue_handle_;
   void CleanResvTimerQueueCb_(const std::shared_ptr<uvw::loop>& uvw_loop);
+
+  // Gauges of the queue depths read at every scrape of the metrics.
+  std::vector<util::metrics::Registry::CallbackId> m_metric_callback_ids_;
+  void AddMetricCallbacks_();
 };
 
 }  // namespace Ctld
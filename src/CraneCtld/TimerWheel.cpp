@@ -0,0 +1,108 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "TimerWheel.h"
+
+namespace Ctld {
+
+void TimerWheel::Schedule(task_id_t id, int64_t deadline_sec) {
+  auto [it, inserted] = m_entries_.try_emplace(id);
+  if (!inserted) Unlink_(it->second);
+
+  it->second.deadline = std::max(deadline_sec, m_now_ + 1);
+  Insert_(id, &it->second);
+}
+
+bool TimerWheel::Cancel(task_id_t id) {
+  auto it = m_entries_.find(id);
+  if (it == m_entries_.end()) return false;
+
+  Unlink_(it->second);
+  m_entries_.erase(it);
+  return true;
+}
+
+void TimerWheel::Advance(int64_t now_sec,
+                         std::vector<task_id_t>* expired_ids) {
+  while (m_now_ < now_sec) {
+    m_now_++;
+
+    // Bring down the upper slots that start at this tick, highest first, so
+    // that their timers reach the lowest level in the same tick.
+    int top_level = 0;
+    while (top_level + 1 < kLevelNum &&
+           (m_now_ & ((int64_t{1} << (kSlotBits * (top_level + 1))) - 1)) == 0)
+      top_level++;
+    for (int level = top_level; level >= 1; level--) Cascade_(level);
+
+    auto& slot = m_slots_[0][m_now_ & kSlotMask];
+    for (task_id_t id : slot) {
+      m_entries_.erase(id);
+      expired_ids->emplace_back(id);
+    }
+    slot.clear();
+  }
+}
+
+void TimerWheel::Insert_(task_id_t id, Entry* entry) {
+  int64_t delta = entry->deadline - m_now_;
+
+  uint32_t level = 0;
+  int64_t slot_time = entry->deadline;
+  if (delta >= kMaxSpan) {
+    // Kept in the top level and moved down again when it's reached.
+    level = kLevelNum - 1;
+    slot_time = m_now_ + kMaxSpan - 1;
+  } else {
+    while (level + 1 < kLevelNum &&
+           delta >= (int64_t{1} << (kSlotBits * (level + 1))))
+      level++;
+  }
+
+  // A timer due at the current tick only comes from a cascade and goes to
+  // the lowest slot which is about to expire.
+  if (delta <= 0) slot_time = m_now_;
+
+  auto& slot = m_slots_[level][(slot_time >> (kSlotBits * level)) & kSlotMask];
+  entry->level = level;
+  entry->slot = (slot_time >> (kSlotBits * level)) & kSlotMask;
+  entry->pos = slot.size();
+  slot.emplace_back(id);
+}
+
+void TimerWheel::Unlink_(const Entry& entry) {
+  auto& slot = m_slots_[entry.level][entry.slot];
+
+  // Swap with the last one so that removal is O(1).
+  task_id_t last_id = slot.back();
+  if (entry.pos != slot.size() - 1) {
+    slot[entry.pos] = last_id;
+    m_entries_.at(last_id).pos = entry.pos;
+  }
+  slot.pop_back();
+}
+
+void TimerWheel::Cascade_(int level) {
+  auto& slot = m_slots_[level][(m_now_ >> (kSlotBits * level)) & kSlotMask];
+
+  std::vector<task_id_t> ids;
+  ids.swap(slot);
+  for (task_id_t id : ids) Insert_(id, &m_entries_.at(id));
+}
+
+}  // namespace Ctld
@@ -0,0 +1,75 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "CtldPublicDefs.h"
+// Precompiled header comes first!
+
+namespace Ctld {
+
+// Hierarchical timing wheel of task deadlines in seconds. Each level has
+// kSlotNum slots and each slot of a level spans kSlotNum slots of the level
+// below, so deadlines up to kSlotNum^kLevelNum seconds away are kept without
+// sorting. Insertion, cancellation and rescheduling are O(1), and a slot of
+// an upper level is moved down only when the wheel reaches it.
+// Not thread-safe. It's driven by a single uv timer in the owner's loop.
+class TimerWheel {
+ public:
+  explicit TimerWheel(int64_t now_sec) : m_now_(now_sec) {}
+
+  // Insert a timer or reschedule the existing one of the same id. A deadline
+  // not after the current time expires at the next tick.
+  void Schedule(task_id_t id, int64_t deadline_sec);
+
+  // Return false if no timer of the id exists.
+  bool Cancel(task_id_t id);
+
+  bool Contains(task_id_t id) const { return m_entries_.contains(id); }
+  size_t Size() const { return m_entries_.size(); }
+
+  // Move the wheel forward to now_sec and append the ids of the expired
+  // timers to expired_ids.
+  void Advance(int64_t now_sec, std::vector<task_id_t>* expired_ids);
+
+ private:
+  static constexpr int kSlotBits = 6;
+  static constexpr int64_t kSlotNum = int64_t{1} << kSlotBits;
+  static constexpr int64_t kSlotMask = kSlotNum - 1;
+  static constexpr int kLevelNum = 4;
+  static constexpr int64_t kMaxSpan = int64_t{1} << (kSlotBits * kLevelNum);
+
+  struct Entry {
+    int64_t deadline;
+    uint32_t level;
+    uint32_t slot;
+    // Position in the vector of the slot.
+    uint32_t pos;
+  };
+
+  void Insert_(task_id_t id, Entry* entry);
+  void Unlink_(const Entry& entry);
+  void Cascade_(int level);
+
+  int64_t m_now_;
+  absl::flat_hash_map<task_id_t, Entry> m_entries_;
+  std::array<std::array<std::vector<task_id_t>, kSlotNum>, kLevelNum>
+      m_slots_;
+};
+
+}  // namespace Ctld
@@ -61,6 +61,12 @@ CraneErrCode CgroupManager::Init(spdlog::level::level_enum debug_level) {
   m_cg_version_ = CgConstant::CgroupVersion::CGROUP_V1;
 #endif
 
+  if (m_cg_backend_ == CgConstant::CgroupBackend::CGROUPFS &&
+      m_cg_version_ != CgConstant::CgroupVersion::CGROUP_V2) {
+    CRANE_WARN("Cgroupfs backend requires cgroup v2. Using libcgroup.");
+    m_cg_backend_ = CgConstant::CgroupBackend::LIBCGROUP;
+  }
+
   using CgConstant::Controller;
   using CgConstant::GetControllerStringView;
 
@@ -177,6 +183,10 @@ CraneErrCode CgroupManager::Init(spdlog::level::level_enum debug_level) {
     bpf_runtime_info.SetLogEnabled(debug_level < spdlog::level::info);
 #endif
 
+    if (m_cg_backend_ == CgConstant::CgroupBackend::CGROUPFS &&
+        !InitCgroupFsRoot_())
+      return CraneErrCode::ERR_CGROUP;
+
   } else {
     CRANE_WARN("Error Cgroup version is not supported");
     return CraneErrCode::ERR_CGROUP;
@@ -276,6 +286,271 @@ int CgroupManager::InitializeController_(struct cgroup &cgroup,
   return 0;
 }
 
+bool CgroupManager::InitCgroupFsRoot_() {
+  std::filesystem::path root_path =
+      CgConstant::kSystemCgPathPrefix / CgConstant::kRootCgNamePrefix;
+  if (mkdir(root_path.c_str(), 0755) != 0 && errno != EEXIST) {
+    CRANE_ERROR("Failed to create cgroup {}: {}", root_path,
+                std::strerror(errno));
+    return false;
+  }
+
+  int system_root_fd = open(CgConstant::kSystemCgPathPrefix.c_str(),
+                            O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (system_root_fd < 0) {
+    CRANE_ERROR("Failed to open {}: {}", CgConstant::kSystemCgPathPrefix,
+                std::strerror(errno));
+    return false;
+  }
+  EnableSubtreeControllers_(
+      system_root_fd, CG_V2_REQUIRED_CONTROLLERS |
+                          CgConstant::Controller::CPUSET_CONTROLLER_V2);
+  close(system_root_fd);
+
+  m_cgfs_root_fd_ = open(root_path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (m_cgfs_root_fd_ < 0) {
+    CRANE_ERROR("Failed to open cgroup {}: {}", root_path,
+                std::strerror(errno));
+    return false;
+  }
+  EnableSubtreeControllers_(
+      m_cgfs_root_fd_, CG_V2_REQUIRED_CONTROLLERS |
+                           CgConstant::Controller::CPUSET_CONTROLLER_V2);
+
+  CRANE_DEBUG("Using cgroupfs backend at {}.", root_path);
+  return true;
+}
+
+bool CgroupManager::EnableSubtreeControllers_(int dir_fd,
+                                              ControllerFlags controllers) {
+  using CgConstant::Controller;
+
+  bool ok = true;
+  for (Controller controller :
+       {Controller::CPU_CONTROLLER_V2, Controller::MEMORY_CONTROLLER_V2,
+        Controller::IO_CONTROLLER_V2, Controller::CPUSET_CONTROLLER_V2,
+        Controller::PIDS_CONTROLLER_V2}) {
+    if (!(controllers & controller) || !IsMounted(controller)) continue;
+
+    // One controller per write, so that one which cannot be enabled does not
+    // keep the others disabled.
+    std::string value =
+        fmt::format("+{}", CgConstant::GetControllerStringView(controller));
+    int fd = openat(dir_fd, "cgroup.subtree_control", O_WRONLY | O_CLOEXEC);
+    if (fd < 0 || write(fd, value.data(), value.size()) < 0) {
+      CRANE_WARN("Failed to enable cgroup controller {} for children: {}",
+                 CgConstant::GetControllerStringView(controller),
+                 std::strerror(errno));
+      ok = false;
+    }
+    if (fd >= 0) close(fd);
+  }
+  return ok;
+}
+
+std::unique_ptr<CgroupInterface> CgroupManager::CreateOrOpenCgroupFs_(
+    const std::string &cgroup_str, ControllerFlags preferred_controllers,
+    ControllerFlags required_controllers, bool retrieve) {
+  using CgConstant::Controller;
+
+  for (Controller controller :
+       {Controller::CPU_CONTROLLER_V2, Controller::MEMORY_CONTROLLER_V2,
+        Controller::IO_CONTROLLER_V2, Controller::CPUSET_CONTROLLER_V2,
+        Controller::PIDS_CONTROLLER_V2}) {
+    if ((required_controllers & controller) && !IsMounted(controller)) {
+      CRANE_WARN("Error - cgroup controller {} not mounted, but required.",
+                 CgConstant::GetControllerStringView(controller));
+      return nullptr;
+    }
+  }
+
+  std::string full_cg_name = CgConstant::kRootCgNamePrefix + "/" + cgroup_str;
+
+  // A job cgroup may come from the pool. The mkdirat() below then sees it.
+  if (!retrieve && cgroup_str.find('/') == std::string::npos &&
+      ClaimPooledCgroup_(cgroup_str))
+    CRANE_TRACE("Cgroup {} is taken from the pool.", full_cg_name);
+
+  int dir_fd = fcntl(m_cgfs_root_fd_, F_DUPFD_CLOEXEC, 0);
+  if (dir_fd < 0) {
+    CRANE_ERROR("Failed to dup cgroup root fd: {}", std::strerror(errno));
+    return nullptr;
+  }
+
+  // Walk down from the crane root. A job cgroup which got step or task
+  // cgroups created under it has to delegate the controllers to them.
+  bool at_root = true;
+  for (auto component : cgroup_str | std::views::split('/')) {
+    std::string name(component.begin(), component.end());
+    if (name.empty()) continue;
+
+    if (!retrieve) {
+      if (!at_root)
+        EnableSubtreeControllers_(dir_fd,
+                                  preferred_controllers | required_controllers);
+      if (mkdirat(dir_fd, name.c_str(), 0755) != 0 && errno != EEXIST) {
+        CRANE_WARN("Unable to create cgroup {}: {}", full_cg_name,
+                   std::strerror(errno));
+        close(dir_fd);
+        return nullptr;
+      }
+    }
+
+    int child_fd =
+        openat(dir_fd, name.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    close(dir_fd);
+    if (child_fd < 0) {
+      if (!retrieve || errno != ENOENT)
+        CRANE_WARN("Unable to open cgroup {}: {}", full_cg_name,
+                   std::strerror(errno));
+      return nullptr;
+    }
+    dir_fd = child_fd;
+    at_root = false;
+  }
+
+  // For cgroup v2, we need save the inode.
+  struct stat cgroup_stat{};
+  if (fstat(dir_fd, &cgroup_stat) != 0) {
+    CRANE_ERROR("Cgroup {} created but stat failed: {}", full_cg_name,
+                std::strerror(errno));
+    close(dir_fd);
+    return nullptr;
+  }
+
+  return std::make_unique<CgroupV2Fs>(full_cg_name, dir_fd,
+                                      cgroup_stat.st_ino);
+}
+
+void CgroupManager::InitCgroupPool(uint32_t size) {
+  if (m_cg_backend_ != CgConstant::CgroupBackend::CGROUPFS || size == 0)
+    return;
+
+  absl::MutexLock lock_guard(&m_cg_pool_mtx_);
+  m_cg_pool_size_ = size;
+
+  // Pooled cgroups left by the last run of craned are still empty.
+  std::filesystem::path root_path =
+      CgConstant::kSystemCgPathPrefix / CgConstant::kRootCgNamePrefix;
+  try {
+    for (const auto &it : std::filesystem::directory_iterator(root_path)) {
+      std::string name = it.path().filename();
+      if (!it.is_directory() ||
+          !name.starts_with(CgConstant::kPoolCgNamePrefix))
+        continue;
+
+      if (m_pooled_cgroups_.size() < size) {
+        m_pooled_cgroups_.emplace_back(std::move(name));
+      } else if (unlinkat(m_cgfs_root_fd_, name.c_str(), AT_REMOVEDIR) != 0) {
+        CRANE_WARN("Unable to remove pooled cgroup {}: {}", name,
+                   std::strerror(errno));
+      }
+    }
+  } catch (const std::filesystem::filesystem_error &e) {
+    CRANE_ERROR("Error: {}", e.what());
+  }
+
+  while (m_pooled_cgroups_.size() < size) {
+    std::string name = NextPooledCgroupName_();
+    if (mkdirat(m_cgfs_root_fd_, name.c_str(), 0755) != 0) {
+      CRANE_WARN("Unable to create pooled cgroup {}: {}", name,
+                 std::strerror(errno));
+      break;
+    }
+    m_pooled_cgroups_.emplace_back(std::move(name));
+  }
+
+  CRANE_DEBUG("{} cgroups are pooled for jobs.", m_pooled_cgroups_.size());
+}
+
+bool CgroupManager::ClaimPooledCgroup_(const std::string &cgroup_str) {
+  std::string pooled;
+  {
+    absl::MutexLock lock_guard(&m_cg_pool_mtx_);
+    if (m_pooled_cgroups_.empty()) return false;
+    pooled = std::move(m_pooled_cgroups_.back());
+    m_pooled_cgroups_.pop_back();
+  }
+
+  if (renameat(m_cgfs_root_fd_, pooled.c_str(), m_cgfs_root_fd_,
+               cgroup_str.c_str()) == 0)
+    return true;
+
+  // E.g. the job cgroup exists already. Keep the pooled one for later.
+  CRANE_DEBUG("Unable to rename pooled cgroup {} to {}: {}", pooled,
+              cgroup_str, std::strerror(errno));
+  absl::MutexLock lock_guard(&m_cg_pool_mtx_);
+  m_pooled_cgroups_.emplace_back(std::move(pooled));
+  return false;
+}
+
+bool CgroupManager::RecycleCgroup(int dir_fd, const std::string &cgroup_name) {
+  std::string_view cgroup_str = cgroup_name;
+  if (!cgroup_str.starts_with(CgConstant::kRootCgNamePrefix + "/"))
+    return false;
+  cgroup_str.remove_prefix(CgConstant::kRootCgNamePrefix.size() + 1);
+  // Only job cgroups, which are directly under the crane root, are pooled.
+  if (cgroup_str.find('/') != std::string_view::npos) return false;
+
+  {
+    absl::MutexLock lock_guard(&m_cg_pool_mtx_);
+    if (m_pooled_cgroups_.size() >= m_cg_pool_size_) return false;
+  }
+
+  // The directory of a cgroup links to each of its child cgroups, so a link
+  // count of 2 means there are none left.
+  struct stat cg_stat{};
+  if (fstat(dir_fd, &cg_stat) != 0 || cg_stat.st_nlink != 2) return false;
+
+  int fd = openat(dir_fd, "cgroup.events", O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return false;
+  std::array<char, 256> buf{};
+  ssize_t n = read(fd, buf.data(), buf.size() - 1);
+  close(fd);
+  if (n <= 0 || !std::string_view(buf.data(), n).contains("populated 0"))
+    return false;
+
+  // The next job may run unbound, so drop the cpus and mems bound to the
+  // last one. An empty cpuset inherits the one of the parent.
+  for (const char *file : {"cpuset.cpus", "cpuset.mems"}) {
+    fd = openat(dir_fd, file, O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+      if (errno == ENOENT) continue;  // The cpuset controller is not enabled.
+      return false;
+    }
+    bool ok = write(fd, "\n", 1) == 1;
+    close(fd);
+    if (!ok) {
+      CRANE_DEBUG("Unable to reset {} of cgroup {}: {}", file, cgroup_name,
+                  std::strerror(errno));
+      return false;
+    }
+  }
+
+  absl::MutexLock lock_guard(&m_cg_pool_mtx_);
+  if (m_pooled_cgroups_.size() >= m_cg_pool_size_) return false;
+
+  std::string pooled = NextPooledCgroupName_();
+  if (renameat(m_cgfs_root_fd_, std::string(cgroup_str).c_str(),
+               m_cgfs_root_fd_, pooled.c_str()) != 0) {
+    CRANE_DEBUG("Unable to put cgroup {} back to the pool: {}", cgroup_name,
+                std::strerror(errno));
+    return false;
+  }
+
+  m_pooled_cgroups_.emplace_back(std::move(pooled));
+  return true;
+}
+
+std::string CgroupManager::NextPooledCgroupName_() {
+  // Skip the names taken by pooled cgroups of the last run.
+  while (true) {
+    std::string name = fmt::format("{}{}", CgConstant::kPoolCgNamePrefix,
+                                   m_next_pooled_cg_id_++);
+    if (faccessat(m_cgfs_root_fd_, name.c_str(), F_OK, 0) != 0) return name;
+  }
+}
+
 std::string CgroupManager::CgroupStrByJobId(job_id_t job_id) {
   return std::format("{}{}", CgConstant::kJobCgNamePrefix, job_id);
 }
@@ -322,6 +597,10 @@ std::unique_ptr<CgroupInterface> CgroupManager::CreateOrOpen_(
   using CgConstant::Controller;
   using CgConstant::GetControllerStringView;
 
+  if (m_cg_backend_ == CgConstant::CgroupBackend::CGROUPFS)
+    return CreateOrOpenCgroupFs_(cgroup_str, preferred_controllers,
+                                 required_controllers, retrieve);
+
   // Full cgroup name = RootCgNamePrefix / cgroup_str;
   std::string full_cg_name = CgConstant::kRootCgNamePrefix + "/" + cgroup_str;
 
@@ -475,8 +754,13 @@ CgroupManager::AllocateAndGetCgroup(const std::string &cgroup_str,
     cg_unique_ptr = CreateOrOpen_(cgroup_str, CG_V1_REQUIRED_CONTROLLERS,
                                   NO_CONTROLLER_FLAG, recover);
   } else if (GetCgroupVersion() == CgConstant::CgroupVersion::CGROUP_V2) {
-    cg_unique_ptr = CreateOrOpen_(cgroup_str, CG_V2_REQUIRED_CONTROLLERS,
-                                  NO_CONTROLLER_FLAG, recover);
+    // cpuset is only used when cpus are bound. Its files left unset put no
+    // limit.
+    cg_unique_ptr = CreateOrOpen_(
+        cgroup_str,
+        CG_V2_REQUIRED_CONTROLLERS |
+            CgConstant::Controller::CPUSET_CONTROLLER_V2,
+        NO_CONTROLLER_FLAG, recover);
   } else {
     CRANE_WARN("cgroup version is not supported.");
   }
@@ -950,6 +1234,12 @@ bool CgroupV1::SetBlockioWeight(uint64_t weight) {
       CgConstant::ControllerFile::BLOCKIO_WEIGHT, weight);
 }
 
+bool CgroupV1::SetCpuset(const std::string &cpus, const std::string &mems) {
+  // The cpuset controller is not among those set up for cgroup v1.
+  CRANE_WARN("Cpuset binding is not supported in cgroup v1.");
+  return false;
+}
+
 bool CgroupV1::SetDeviceAccess(const std::unordered_set<SlotId> &devices,
                                bool set_read, bool set_write, bool set_mknod) {
   std::string op;
@@ -1145,6 +1435,84 @@ void BpfRuntimeInfo::Destroy() {
   }
 }
 
+namespace {
+
+// Errors of kernels which lack batch operations for the map.
+bool IsBatchUnsupported(int err) {
+  // ENOTSUPP is internal to the kernel but still leaks to user space.
+  constexpr int kENOTSUPP = 524;
+  return err == -EINVAL || err == -EOPNOTSUPP || err == -kENOTSUPP;
+}
+
+}  // namespace
+
+bool BpfRuntimeInfo::UpdateDevMapEntries(
+    const std::vector<BpfKey> &keys, const std::vector<BpfDeviceMeta> &metas) {
+  if (keys.empty()) return true;
+
+  int map_fd = bpf_map__fd(dev_map_);
+  if (batch_supported_.load(std::memory_order_relaxed)) {
+    LIBBPF_OPTS(bpf_map_batch_opts, opts, .elem_flags = BPF_ANY);
+    auto count = static_cast<uint32_t>(keys.size());
+    if (bpf_map_update_batch(map_fd, keys.data(), metas.data(), &count,
+                             &opts) == 0)
+      return true;
+    // Legacy libbpf returns -1 and sets errno only.
+    int err = -errno;
+    if (!IsBatchUnsupported(err)) {
+      CRANE_ERROR("Failed to update {} BPF map entries of cgroup id {}: {}",
+                  keys.size(), keys.front().cgroup_id, std::strerror(-err));
+      return false;
+    }
+    CRANE_DEBUG("BPF map batch operations are not supported by the kernel.");
+    batch_supported_.store(false, std::memory_order_relaxed);
+  }
+
+  // Entries already written by a failed batch are just written again.
+  for (size_t i = 0; i < keys.size(); ++i) {
+    if (bpf_map_update_elem(map_fd, &keys[i], &metas[i], BPF_ANY) < 0) {
+      CRANE_ERROR("Failed to update BPF map major {},minor {} cgroup id {}",
+                  keys[i].major, keys[i].minor, keys[i].cgroup_id);
+      return false;
+    }
+  }
+  return true;
+}
+
+bool BpfRuntimeInfo::DeleteDevMapEntries(const std::vector<BpfKey> &keys) {
+  if (keys.empty()) return true;
+
+  int map_fd = bpf_map__fd(dev_map_);
+  size_t start = 0;
+  if (batch_supported_.load(std::memory_order_relaxed)) {
+    LIBBPF_OPTS(bpf_map_batch_opts, opts);
+    auto count = static_cast<uint32_t>(keys.size());
+    if (bpf_map_delete_batch(map_fd, keys.data(), &count, &opts) == 0)
+      return true;
+    int err = -errno;
+    if (IsBatchUnsupported(err)) {
+      CRANE_DEBUG("BPF map batch operations are not supported by the kernel.");
+      batch_supported_.store(false, std::memory_order_relaxed);
+    } else if (err == -ENOENT) {
+      // The batch stops at a missing key. The rest go one by one.
+      start = count;
+    } else {
+      CRANE_ERROR("Failed to delete {} BPF map entries of cgroup id {}: {}",
+                  keys.size(), keys.front().cgroup_id, std::strerror(-err));
+      return false;
+    }
+  }
+
+  for (size_t i = start; i < keys.size(); ++i) {
+    if (bpf_map_delete_elem(map_fd, &keys[i]) < 0 && errno != ENOENT) {
+      CRANE_ERROR("Failed to delete BPF map major {},minor {} in cgroup id {}",
+                  keys[i].major, keys[i].minor, keys[i].cgroup_id);
+      return false;
+    }
+  }
+  return true;
+}
+
 void BpfRuntimeInfo::RmBpfDeviceMap() {
   try {
     if (std::filesystem::exists(CgConstant::kBpfDeviceMapFilePath)) {
@@ -1227,6 +1595,15 @@ bool CgroupV2::SetBlockioWeight(uint64_t weight) {
       CgConstant::ControllerFile::IO_WEIGHT_V2, weight);
 }
 
+bool CgroupV2::SetCpuset(const std::string &cpus, const std::string &mems) {
+  return m_cgroup_info_.SetControllerStr(
+             CgConstant::Controller::CPUSET_CONTROLLER_V2,
+             CgConstant::ControllerFile::CPUSET_CPUS_V2, cpus) &&
+         m_cgroup_info_.SetControllerStr(
+             CgConstant::Controller::CPUSET_CONTROLLER_V2,
+             CgConstant::ControllerFile::CPUSET_MEMS_V2, mems);
+}
+
 bool CgroupV2::SetDeviceAccess(const std::unordered_set<SlotId> &devices,
                                bool set_read, bool set_write, bool set_mknod) {
 #ifdef CRANE_ENABLE_BPF
@@ -1267,20 +1644,18 @@ bool CgroupV2::SetDeviceAccess(const std::unordered_set<SlotId> &devices,
       }
     }
   }
+  std::vector<BpfKey> keys;
+  keys.reserve(bpf_devices.size());
+  for (const auto &bpf_device : bpf_devices)
+    keys.push_back({.cgroup_id = m_cgroup_info_.GetCgroupId(),
+                    .major = bpf_device.major,
+                    .minor = bpf_device.minor});
   {
-    absl::MutexLock lk(CgroupManager::bpf_runtime_info.BpfMutex());
-    for (auto &bpf_device : bpf_devices) {
-      struct BpfKey key = {.cgroup_id = m_cgroup_info_.GetCgroupId(),
-                           .major = bpf_device.major,
-                           .minor = bpf_device.minor};
-      if (bpf_map__update_elem(CgroupManager::bpf_runtime_info.BpfDevMap(),
-                               &key, sizeof(BpfKey), &bpf_device,
-                               sizeof(BpfDeviceMeta), BPF_ANY) < 0) {
-        CRANE_ERROR("Failed to update BPF map major {},minor {} cgroup id {}",
-                    bpf_device.major, bpf_device.minor, key.cgroup_id);
-        close(cgroup_fd);
-        return false;
-      }
+    absl::ReaderMutexLock lk(CgroupManager::bpf_runtime_info.BpfMutex());
+    if (!CgroupManager::bpf_runtime_info.UpdateDevMapEntries(keys,
+                                                             bpf_devices)) {
+      close(cgroup_fd);
+      return false;
     }
 
     // No need to attach ebpf prog twice.
@@ -1363,20 +1738,15 @@ bool CgroupV2::EraseBpfDeviceMap() {
     CRANE_WARN("BPF is not initialized.");
     return false;
   }
-  absl::MutexLock lk(CgroupManager::bpf_runtime_info.BpfMutex());
-  for (const auto &bpf_meta : m_cgroup_bpf_devices) {
-    struct BpfKey key = {.cgroup_id = m_cgroup_info_.GetCgroupId(),
-                         .major = bpf_meta.major,
-                         .minor = bpf_meta.minor};
-    if (bpf_map__delete_elem(CgroupManager::bpf_runtime_info.BpfDevMap(), &key,
-                             sizeof(BpfKey), BPF_ANY) < 0) {
-      CRANE_ERROR("Failed to delete BPF map major {},minor {} in cgroup id {}",
-                  bpf_meta.major, bpf_meta.minor, key.cgroup_id);
-      return false;
-    }
-  }
-
-  return true;
+  std::vector<BpfKey> keys;
+  keys.reserve(m_cgroup_bpf_devices.size());
+  for (const auto &bpf_meta : m_cgroup_bpf_devices)
+    keys.push_back({.cgroup_id = m_cgroup_info_.GetCgroupId(),
+                    .major = bpf_meta.major,
+                    .minor = bpf_meta.minor});
+
+  absl::ReaderMutexLock lk(CgroupManager::bpf_runtime_info.BpfMutex());
+  return CgroupManager::bpf_runtime_info.DeleteDevMapEntries(keys);
 }
 #endif
 
@@ -1443,6 +1813,166 @@ void CgroupV2::Destroy() {
 #endif
 }
 
+CgroupV2Fs::CgroupV2Fs(const std::string &name, int dir_fd, uint64_t id)
+    : CgroupV2(name, nullptr, id), m_dir_fd_(dir_fd) {}
+
+CgroupV2Fs::~CgroupV2Fs() {
+  if (m_dir_fd_ >= 0) close(m_dir_fd_);
+}
+
+bool CgroupV2Fs::SetCpuCoreLimit(double core_num) {
+  constexpr uint32_t period = 1 << 16;
+  auto quota = static_cast<uint64_t>(period * core_num);
+  return SetControllerFile_(CgConstant::Controller::CPU_CONTROLLER_V2,
+                            CgConstant::ControllerFile::CPU_MAX_V2,
+                            fmt::format("{} {}", quota, period));
+}
+
+bool CgroupV2Fs::SetCpuShares(uint64_t share) {
+  return SetControllerFile_(CgConstant::Controller::CPU_CONTROLLER_V2,
+                            CgConstant::ControllerFile::CPU_WEIGHT_V2,
+                            std::to_string(share));
+}
+
+bool CgroupV2Fs::SetMemoryLimitBytes(uint64_t memory_bytes) {
+  return SetControllerFile_(CgConstant::Controller::MEMORY_CONTROLLER_V2,
+                            CgConstant::ControllerFile::MEMORY_MAX_V2,
+                            std::to_string(memory_bytes));
+}
+
+bool CgroupV2Fs::SetMemorySoftLimitBytes(uint64_t memory_bytes) {
+  return SetControllerFile_(CgConstant::Controller::MEMORY_CONTROLLER_V2,
+                            CgConstant::ControllerFile::MEMORY_HIGH_V2,
+                            std::to_string(memory_bytes));
+}
+
+bool CgroupV2Fs::SetMemorySwLimitBytes(uint64_t memory_bytes) {
+  return SetControllerFile_(CgConstant::Controller::MEMORY_CONTROLLER_V2,
+                            CgConstant::ControllerFile::MEMORY_SWAP_MAX_V2,
+                            std::to_string(memory_bytes));
+}
+
+bool CgroupV2Fs::SetBlockioWeight(uint64_t weight) {
+  return SetControllerFile_(CgConstant::Controller::IO_CONTROLLER_V2,
+                            CgConstant::ControllerFile::IO_WEIGHT_V2,
+                            std::to_string(weight));
+}
+
+bool CgroupV2Fs::SetCpuset(const std::string &cpus, const std::string &mems) {
+  return SetControllerFile_(CgConstant::Controller::CPUSET_CONTROLLER_V2,
+                            CgConstant::ControllerFile::CPUSET_CPUS_V2,
+                            cpus) &&
+         SetControllerFile_(CgConstant::Controller::CPUSET_CONTROLLER_V2,
+                            CgConstant::ControllerFile::CPUSET_MEMS_V2, mems);
+}
+
+bool CgroupV2Fs::KillAllProcesses() {
+  // cgroup.kill kills the whole subtree at once, available since Linux 5.14.
+  if (faccessat(m_dir_fd_, "cgroup.kill", W_OK, 0) == 0)
+    return WriteFile_("cgroup.kill", "1");
+
+  auto pids = ReadProcs_();
+  if (!pids) return false;
+  for (pid_t pid : pids.value()) kill(pid, SIGKILL);
+  return true;
+}
+
+bool CgroupV2Fs::Empty() {
+  auto pids = ReadProcs_();
+  return pids.has_value() && pids->empty();
+}
+
+void CgroupV2Fs::Destroy() {
+  if (m_dir_fd_ >= 0) {
+    CRANE_DEBUG("Destroying cgroup {}.", CgroupName());
+    bool recycled = CgroupManager::RecycleCgroup(m_dir_fd_, CgroupName());
+    close(m_dir_fd_);
+    m_dir_fd_ = -1;
+
+    // Like libcgroup with CGFLAG_DELETE_EMPTY_ONLY, rmdir() refuses to
+    // remove a cgroup which still has processes.
+    if (!recycled && rmdir(CgroupPath().c_str()) != 0 && errno != ENOENT)
+      CRANE_ERROR("Unable to completely remove cgroup {}: {}", CgroupName(),
+                  std::strerror(errno));
+  }
+
+  CgroupV2::Destroy();
+}
+
+bool CgroupV2Fs::MigrateProcIn(pid_t pid) {
+  return WriteFile_("cgroup.procs", std::to_string(pid));
+}
+
+bool CgroupV2Fs::SetControllerFile_(CgConstant::Controller controller,
+                                    CgConstant::ControllerFile controller_file,
+                                    const std::string &value) {
+  if (!CgroupManager::IsMounted(controller)) {
+    CRANE_ERROR("Unable to set {} because cgroup {} is not mounted.",
+                CgConstant::GetControllerFileStringView(controller_file),
+                CgConstant::GetControllerStringView(controller));
+    return false;
+  }
+
+  return WriteFile_(
+      CgConstant::GetControllerFileStringView(controller_file).data(), value);
+}
+
+bool CgroupV2Fs::WriteFile_(const char *file, const std::string &value) const {
+  int fd = openat(m_dir_fd_, file, O_WRONLY | O_CLOEXEC);
+  if (fd < 0) {
+    CRANE_ERROR("Unable to open {} in cgroup {}: {}", file, CgroupName(),
+                std::strerror(errno));
+    return false;
+  }
+
+  ssize_t written;
+  do {
+    written = write(fd, value.data(), value.size());
+  } while (written < 0 && errno == EINTR);
+  int err = errno;
+  close(fd);
+
+  if (written != static_cast<ssize_t>(value.size())) {
+    CRANE_ERROR("Unable to write \"{}\" to {} in cgroup {}: {}", value, file,
+                CgroupName(), std::strerror(err));
+    return false;
+  }
+  return true;
+}
+
+std::optional<std::vector<pid_t>> CgroupV2Fs::ReadProcs_() const {
+  int fd = openat(m_dir_fd_, "cgroup.procs", O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    CRANE_ERROR("Unable to open cgroup.procs in cgroup {}: {}", CgroupName(),
+                std::strerror(errno));
+    return std::nullopt;
+  }
+
+  std::string content;
+  std::array<char, 4096> buf;
+  while (true) {
+    ssize_t n = read(fd, buf.data(), buf.size());
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0) {
+      CRANE_ERROR("Unable to read cgroup.procs in cgroup {}: {}", CgroupName(),
+                  std::strerror(errno));
+      close(fd);
+      return std::nullopt;
+    }
+    if (n == 0) break;
+    content.append(buf.data(), n);
+  }
+  close(fd);
+
+  std::vector<pid_t> pids;
+  for (auto line : content | std::views::split('\n')) {
+    pid_t pid;
+    auto [_, ec] = std::from_chars(line.data(), line.data() + line.size(), pid);
+    if (ec == std::errc()) pids.push_back(pid);
+  }
+  return pids;
+}
+
 bool AllocatableResourceAllocator::Allocate(const AllocatableResource &resource,
                                             CgroupInterface *cg) {
   bool ok;
@@ -30,6 +30,7 @@
 #include <libcgroup.h>
 
 #ifdef CRANE_ENABLE_BPF
+#  include <bpf/bpf.h>
 #  include <bpf/libbpf.h>
 #endif
 
@@ -43,6 +44,13 @@ enum class CgroupVersion : uint8_t {
   UNDEFINED,
 };
 
+// How job cgroups are manipulated. CGROUPFS writes the cgroup v2 interface
+// files directly instead of going through libcgroup and is ignored on v1.
+enum class CgroupBackend : uint8_t {
+  LIBCGROUP = 0,
+  CGROUPFS,
+};
+
 enum class Controller : uint8_t {
   MEMORY_CONTROLLER = 0,
   CPUACCT_CONTROLLER,
@@ -83,6 +91,9 @@ enum class ControllerFile : uint8_t {
   MEMORY_HIGH_V2,
 
   IO_WEIGHT_V2,
+
+  CPUSET_CPUS_V2,
+  CPUSET_MEMS_V2,
   // root cgroup controller can't be change or created
 
   CONTROLLER_FILE_COUNT,
@@ -101,6 +112,8 @@ inline constexpr std::string kRootCgNamePrefix = "crane";
 inline constexpr std::string kJobCgNamePrefix = "job_";
 inline constexpr std::string kStepCgNamePrefix = "step_";
 inline constexpr std::string kTaskCgNamePrefix = "task_";
+// Empty cgroups created ahead and renamed to job cgroups on allocation.
+inline constexpr std::string kPoolCgNamePrefix = "pool_";
 
 #ifdef CRANE_ENABLE_BPF
 inline const char *kBpfObjectFilePath = "/usr/local/lib64/bpf/cgroup_dev_bpf.o";
@@ -153,6 +166,9 @@ constexpr std::array<std::string_view,
         "memory.high",
 
         "io.weight",
+
+        "cpuset.cpus",
+        "cpuset.mems",
     };
 
 }  // namespace Internal
@@ -304,10 +320,24 @@ class BpfRuntimeInfo {
 
   struct bpf_object *BpfObj() { return bpf_obj_; }
   struct bpf_program *BpfProgram() { return bpf_prog_; }
+  // Held in writer mode while the BPF object is loaded or closed. Map entries
+  // are updated under the reader lock, since map operations are atomic in the
+  // kernel, so that cgroups of concurrent jobs don't wait for each other.
   absl::Mutex *BpfMutex() { return bpf_mtx_.get(); }
   struct bpf_map *BpfDevMap() { return dev_map_; }
   int BpfProgFd() { return bpf_prog_fd_; }
   void SetLogEnabled(bool enabled) { bpf_enable_logging_ = enabled; }
+
+  /**
+   * @brief Write the entries of the device map with one syscall, or one per
+   * entry on kernels without batch operations of hash maps (before 5.6).
+   * Called with BpfMutex() held.
+   */
+  bool UpdateDevMapEntries(const std::vector<BpfKey> &keys,
+                           const std::vector<BpfDeviceMeta> &metas);
+  // Entries which don't exist are skipped.
+  bool DeleteDevMapEntries(const std::vector<BpfKey> &keys);
+
   bool Valid() const {
     return bpf_obj_ && bpf_prog_ && dev_map_ && bpf_prog_fd_ != -1 &&
            cgroup_count_ > 0;
@@ -321,6 +351,7 @@ class BpfRuntimeInfo {
   int bpf_prog_fd_;
   std::unique_ptr<absl::Mutex> bpf_mtx_;
   size_t cgroup_count_;
+  std::atomic_bool batch_supported_{true};
 };
 #endif
 
@@ -374,6 +405,8 @@ class CgroupInterface {
   virtual bool SetMemorySwLimitBytes(uint64_t mem_bytes) = 0;
   virtual bool SetMemorySoftLimitBytes(uint64_t memory_bytes) = 0;
   virtual bool SetBlockioWeight(uint64_t weight) = 0;
+  // cpus and mems are cpu and NUMA node lists like "0-3,8".
+  virtual bool SetCpuset(const std::string &cpus, const std::string &mems) = 0;
   virtual bool SetDeviceAccess(const std::unordered_set<SlotId> &devices,
                                bool set_read, bool set_write,
                                bool set_mknod) = 0;
@@ -384,7 +417,7 @@ class CgroupInterface {
 
   virtual void Destroy();
 
-  bool MigrateProcIn(pid_t pid);
+  virtual bool MigrateProcIn(pid_t pid);
 
   std::string CgroupName() const { return m_cgroup_info_.GetCgroupName(); }
   std::filesystem::path CgroupPath() const {
@@ -407,6 +440,7 @@ class CgroupV1 : public CgroupInterface {
   bool SetMemorySwLimitBytes(uint64_t mem_bytes) override;
   bool SetMemorySoftLimitBytes(uint64_t memory_bytes) override;
   bool SetBlockioWeight(uint64_t weight) override;
+  bool SetCpuset(const std::string &cpus, const std::string &mems) override;
 
   bool SetDeviceAccess(const std::unordered_set<SlotId> &devices, bool set_read,
                        bool set_write, bool set_mknod) override;
@@ -434,6 +468,7 @@ class CgroupV2 : public CgroupInterface {
   bool SetMemorySwLimitBytes(uint64_t mem_bytes) override;
   bool SetMemorySoftLimitBytes(uint64_t memory_bytes) override;
   bool SetBlockioWeight(uint64_t weight) override;
+  bool SetCpuset(const std::string &cpus, const std::string &mems) override;
 
   // use BPF
   /**
@@ -481,6 +516,48 @@ class CgroupV2 : public CgroupInterface {
 #endif
 };
 
+/**
+ * Cgroup v2 without libcgroup. The directory of the cgroup is kept open and
+ * every limit is a single openat()/write() of its interface file, while
+ * libcgroup rewrites all the values it knows of on each change.
+ * Device access still goes through the BPF program of CgroupV2.
+ */
+class CgroupV2Fs : public CgroupV2 {
+ public:
+  CgroupV2Fs(const std::string &name, int dir_fd, uint64_t id);
+  ~CgroupV2Fs() override;
+
+  CgroupV2Fs(const CgroupV2Fs &) = delete;
+  CgroupV2Fs &operator=(const CgroupV2Fs &) = delete;
+
+  bool SetCpuCoreLimit(double core_num) override;
+  bool SetCpuShares(uint64_t share) override;
+  bool SetMemoryLimitBytes(uint64_t memory_bytes) override;
+  bool SetMemorySwLimitBytes(uint64_t mem_bytes) override;
+  bool SetMemorySoftLimitBytes(uint64_t memory_bytes) override;
+  bool SetBlockioWeight(uint64_t weight) override;
+  bool SetCpuset(const std::string &cpus, const std::string &mems) override;
+
+  bool KillAllProcesses() override;
+
+  bool Empty() override;
+
+  void Destroy() override;
+
+  bool MigrateProcIn(pid_t pid) override;
+
+ private:
+  bool SetControllerFile_(CgConstant::Controller controller,
+                          CgConstant::ControllerFile controller_file,
+                          const std::string &value);
+
+  bool WriteFile_(const char *file, const std::string &value) const;
+
+  std::optional<std::vector<pid_t>> ReadProcs_() const;
+
+  int m_dir_fd_;
+};
+
 class AllocatableResourceAllocator {
  public:
   static bool Allocate(const AllocatableResource &resource,
@@ -554,6 +631,28 @@ class CgroupManager {
     return m_cg_version_;
   }
 
+  // Must be called before Init().
+  static void SetCgroupBackend(CgConstant::CgroupBackend backend) {
+    m_cg_backend_ = backend;
+  }
+  [[nodiscard]] static CgConstant::CgroupBackend GetCgroupBackend() {
+    return m_cg_backend_;
+  }
+
+  /**
+   * @brief Keep up to `size` empty cgroups under the crane root, so that a
+   * job cgroup is got by a rename instead of a mkdir with its controllers
+   * set up. Only the CGROUPFS backend has a pool. Called after Init().
+   */
+  static void InitCgroupPool(uint32_t size);
+
+  /**
+   * @brief Put a job cgroup which is being destroyed back into the pool.
+   * @return false if the pool is full or the cgroup cannot be reused, in
+   * which case the caller removes it.
+   */
+  static bool RecycleCgroup(int dir_fd, const std::string &cgroup_name);
+
   static CraneExpected<CgroupStrParsedIds> GetIdsByPid(pid_t pid);
 
   // Make these functions public for use in Craned.cpp
@@ -587,9 +686,40 @@ class CgroupManager {
   static std::unordered_map<ino_t, job_id_t> GetCgJobIdMapCgroupV2_(
       const std::filesystem::path &root_cgroup_path);
 
+  // Create the crane root cgroup for the CGROUPFS backend and delegate the
+  // controllers to it.
+  static bool InitCgroupFsRoot_();
+
+  static bool EnableSubtreeControllers_(int dir_fd,
+                                        ControllerFlags controllers);
+
+  static std::unique_ptr<CgroupInterface> CreateOrOpenCgroupFs_(
+      const std::string &cgroup_str, ControllerFlags preferred_controllers,
+      ControllerFlags required_controllers, bool retrieve);
+
+  // Rename a pooled cgroup to cgroup_str under the crane root.
+  static bool ClaimPooledCgroup_(const std::string &cgroup_str);
+
+  static std::string NextPooledCgroupName_()
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(m_cg_pool_mtx_);
+
   inline static ControllerFlags m_mounted_controllers_ = NO_CONTROLLER_FLAG;
 
   inline static CgConstant::CgroupVersion m_cg_version_;
+
+  inline static CgConstant::CgroupBackend m_cg_backend_ =
+      CgConstant::CgroupBackend::LIBCGROUP;
+
+  // Directory fd of kSystemCgPathPrefix / kRootCgNamePrefix for CGROUPFS.
+  inline static int m_cgfs_root_fd_ = -1;
+
+  inline static absl::Mutex m_cg_pool_mtx_;
+  inline static uint32_t m_cg_pool_size_ ABSL_GUARDED_BY(m_cg_pool_mtx_) = 0;
+  inline static uint64_t m_next_pooled_cg_id_ ABSL_GUARDED_BY(m_cg_pool_mtx_) =
+      0;
+  // Names of the idle cgroups directly under the crane root.
+  inline static std::vector<std::string> m_pooled_cgroups_
+      ABSL_GUARDED_BY(m_cg_pool_mtx_);
 };
 
 }  // namespace Craned::Common
\ No newline at end of file
@@ -0,0 +1,333 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "CpuBinding.h"
+
+#include <absl/strings/ascii.h>
+#include <absl/strings/numbers.h>
+
+#include <fstream>
+
+namespace Craned {
+
+namespace {
+
+std::optional<std::string> ReadLine(const std::filesystem::path& path) {
+  std::ifstream ifs(path);
+  std::string line;
+  if (!ifs || !std::getline(ifs, line)) return std::nullopt;
+  return std::string(absl::StripAsciiWhitespace(line));
+}
+
+std::optional<uint32_t> ReadNumber(const std::filesystem::path& path) {
+  auto line = ReadLine(path);
+  uint32_t value;
+  if (!line || !absl::SimpleAtoi(line.value(), &value)) return std::nullopt;
+  return value;
+}
+
+// MemTotal in the meminfo of a NUMA node, e.g. "Node 0 MemTotal: 1024 kB".
+std::optional<uint64_t> ReadNumaMemTotal(const std::filesystem::path& path) {
+  std::ifstream ifs(path);
+  std::string line;
+  while (std::getline(ifs, line)) {
+    std::vector<std::string_view> fields =
+        absl::StrSplit(line, ' ', absl::SkipEmpty());
+    if (fields.size() < 4 || fields[2] != "MemTotal:") continue;
+    uint64_t kb;
+    if (!absl::SimpleAtoi(fields[3], &kb)) return std::nullopt;
+    return kb * 1024;
+  }
+  return std::nullopt;
+}
+
+}  // namespace
+
+std::optional<CpuTopology> CpuTopology::Discover(
+    const std::filesystem::path& sysfs_root) {
+  auto online_line = ReadLine(sysfs_root / "cpu" / "online");
+  std::optional<std::vector<uint32_t>> online;
+  if (online_line) online = CpuBinder::ParseCpuList(online_line.value());
+  if (!online || online->empty()) {
+    CRANE_WARN("Failed to read the online cpus under {}.",
+               sysfs_root.string());
+    return std::nullopt;
+  }
+
+  CpuTopology topology;
+
+  // Cpus not listed by any NUMA node are taken as on node 0.
+  absl::flat_hash_map<uint32_t, uint32_t> numa_of_cpu;
+  std::error_code ec;
+  std::filesystem::directory_iterator it(sysfs_root / "node", ec);
+  for (; !ec && it != std::filesystem::directory_iterator(); it.increment(ec)) {
+    std::string name = it->path().filename().string();
+    uint32_t numa;
+    if (!name.starts_with("node") ||
+        !absl::SimpleAtoi(std::string_view(name).substr(4), &numa))
+      continue;
+
+    auto cpu_list = ReadLine(it->path() / "cpulist");
+    if (cpu_list) {
+      auto cpus = CpuBinder::ParseCpuList(cpu_list.value());
+      for (uint32_t cpu : cpus.value_or(std::vector<uint32_t>{}))
+        numa_of_cpu[cpu] = numa;
+    }
+    auto mem_bytes = ReadNumaMemTotal(it->path() / "meminfo");
+    if (mem_bytes) topology.numa_mem_bytes[numa] = mem_bytes.value();
+  }
+
+  std::map<std::pair<uint32_t, uint32_t>, uint32_t> core_indexes;
+  std::map<std::string, uint32_t> l3_indexes;
+  for (uint32_t cpu : online.value()) {
+    auto cpu_dir = sysfs_root / "cpu" / fmt::format("cpu{}", cpu);
+    uint32_t package =
+        ReadNumber(cpu_dir / "topology" / "physical_package_id").value_or(0);
+    uint32_t core_id =
+        ReadNumber(cpu_dir / "topology" / "core_id").value_or(cpu);
+
+    // Kernels without cache ids only tell the cpus sharing the cache. Cpus
+    // without an L3 cache are grouped by package.
+    std::string l3_key = fmt::format("{}", package);
+    std::filesystem::directory_iterator cache_it(cpu_dir / "cache", ec);
+    for (; !ec && cache_it != std::filesystem::directory_iterator();
+         cache_it.increment(ec)) {
+      const auto& index_dir = cache_it->path();
+      if (!index_dir.filename().string().starts_with("index") ||
+          ReadNumber(index_dir / "level") != 3)
+        continue;
+
+      auto id = ReadLine(index_dir / "id");
+      if (!id) id = ReadLine(index_dir / "shared_cpu_list");
+      l3_key = fmt::format("{}-{}", package, id.value_or(""));
+      break;
+    }
+    ec.clear();
+
+    auto core_it = core_indexes.try_emplace({package, core_id},
+                                            core_indexes.size());
+    auto l3_it = l3_indexes.try_emplace(l3_key, l3_indexes.size());
+    auto numa_it = numa_of_cpu.find(cpu);
+    topology.cpus.push_back({
+        .id = cpu,
+        .core = core_it.first->second,
+        .l3 = l3_it.first->second,
+        .numa = numa_it == numa_of_cpu.end() ? 0 : numa_it->second,
+    });
+  }
+
+  std::ranges::sort(topology.cpus, {}, [](const Cpu& cpu) {
+    return std::tuple(cpu.numa, cpu.l3, cpu.core, cpu.id);
+  });
+  return topology;
+}
+
+CpuBinder::CpuBinder(CpuTopology topology)
+    : m_topology_(std::move(topology)),
+      m_used_(m_topology_.cpus.size(), false) {
+  for (size_t i = 0; i < m_topology_.cpus.size(); ++i)
+    m_cpu_index_[m_topology_.cpus[i].id] = i;
+}
+
+std::optional<CpuBinding> CpuBinder::Allocate(job_id_t job_id,
+                                              uint32_t cpu_num,
+                                              uint64_t mem_bytes) {
+  if (cpu_num == 0) return std::nullopt;
+
+  absl::MutexLock lock_guard(&m_mtx_);
+  if (m_job_cpus_.contains(job_id)) {
+    CRANE_WARN("[Job #{}] Cpus are bound again.", job_id);
+    for (size_t i : m_job_cpus_.at(job_id)) m_used_[i] = false;
+    m_job_cpus_.erase(job_id);
+  }
+
+  std::vector<size_t> picked = PickCpus_(cpu_num);
+  if (picked.empty()) return std::nullopt;
+
+  CpuBinding binding;
+  std::set<uint32_t> mems;
+  for (size_t i : picked) {
+    m_used_[i] = true;
+    binding.cpus.push_back(m_topology_.cpus[i].id);
+    mems.insert(m_topology_.cpus[i].numa);
+  }
+  std::ranges::sort(binding.cpus);
+
+  // Memory beyond the cpuset.mems of a cgroup can't be used at all, so the
+  // job gets the largest other NUMA nodes until its limit fits.
+  const auto& numa_mem_bytes = m_topology_.numa_mem_bytes;
+  if (!numa_mem_bytes.empty()) {
+    uint64_t mems_bytes = 0;
+    for (uint32_t numa : mems) {
+      auto it = numa_mem_bytes.find(numa);
+      if (it != numa_mem_bytes.end()) mems_bytes += it->second;
+    }
+    while (mems_bytes < mem_bytes) {
+      auto largest = numa_mem_bytes.end();
+      for (auto it = numa_mem_bytes.begin(); it != numa_mem_bytes.end(); ++it)
+        if (!mems.contains(it->first) &&
+            (largest == numa_mem_bytes.end() || it->second > largest->second))
+          largest = it;
+      if (largest == numa_mem_bytes.end()) break;
+
+      mems.insert(largest->first);
+      mems_bytes += largest->second;
+    }
+  }
+  binding.mems.assign(mems.begin(), mems.end());
+
+  m_job_cpus_.emplace(job_id, std::move(picked));
+  return binding;
+}
+
+void CpuBinder::Restore(job_id_t job_id,
+                        const std::filesystem::path& cgroup_path) {
+  auto line = ReadLine(cgroup_path / "cpuset.cpus");
+  if (!line || line->empty()) return;
+
+  auto cpus = ParseCpuList(line.value());
+  if (!cpus) {
+    CRANE_WARN("[Job #{}] Illegal cpuset.cpus: {}", job_id, line.value());
+    return;
+  }
+
+  absl::MutexLock lock_guard(&m_mtx_);
+  std::vector<size_t> indexes;
+  for (uint32_t cpu : cpus.value()) {
+    auto it = m_cpu_index_.find(cpu);
+    if (it == m_cpu_index_.end()) continue;
+    m_used_[it->second] = true;
+    indexes.push_back(it->second);
+  }
+  m_job_cpus_[job_id] = std::move(indexes);
+}
+
+void CpuBinder::Free(job_id_t job_id) {
+  absl::MutexLock lock_guard(&m_mtx_);
+  auto it = m_job_cpus_.find(job_id);
+  if (it == m_job_cpus_.end()) return;
+
+  for (size_t i : it->second) m_used_[i] = false;
+  m_job_cpus_.erase(it);
+}
+
+std::string CpuBinder::CpuListToString(const std::vector<uint32_t>& cpus) {
+  std::vector<uint32_t> sorted(cpus);
+  std::ranges::sort(sorted);
+
+  std::vector<std::string> ranges;
+  for (size_t i = 0; i < sorted.size();) {
+    size_t j = i;
+    while (j + 1 < sorted.size() && sorted[j + 1] == sorted[j] + 1) ++j;
+    if (i == j)
+      ranges.emplace_back(std::to_string(sorted[i]));
+    else
+      ranges.emplace_back(fmt::format("{}-{}", sorted[i], sorted[j]));
+    i = j + 1;
+  }
+  return absl::StrJoin(ranges, ",");
+}
+
+std::optional<std::vector<uint32_t>> CpuBinder::ParseCpuList(
+    std::string_view list) {
+  std::vector<uint32_t> cpus;
+  for (std::string_view range : absl::StrSplit(
+           absl::StripAsciiWhitespace(list), ',', absl::SkipEmpty())) {
+    std::vector<std::string_view> ends = absl::StrSplit(range, '-');
+    uint32_t first, last;
+    if (ends.size() > 2 || !absl::SimpleAtoi(ends.front(), &first) ||
+        !absl::SimpleAtoi(ends.back(), &last) || first > last)
+      return std::nullopt;
+    for (uint32_t cpu = first; cpu <= last; ++cpu) cpus.push_back(cpu);
+  }
+  return cpus;
+}
+
+std::vector<uint32_t> CpuBinder::ChooseDomains_(
+    const std::map<uint32_t, uint32_t>& free_num, uint32_t need) {
+  // The fullest domain which still fits.
+  auto best = free_num.end();
+  for (auto it = free_num.begin(); it != free_num.end(); ++it)
+    if (it->second >= need &&
+        (best == free_num.end() || it->second < best->second))
+      best = it;
+  if (best != free_num.end()) return {best->first};
+
+  std::vector<std::pair<uint32_t, uint32_t>> domains(free_num.begin(),
+                                                     free_num.end());
+  std::ranges::stable_sort(domains, std::greater{},
+                           [](const auto& domain) { return domain.second; });
+
+  std::vector<uint32_t> chosen;
+  uint32_t taken = 0;
+  for (const auto& [id, num] : domains) {
+    if (taken >= need) break;
+    chosen.push_back(id);
+    taken += num;
+  }
+  return chosen;
+}
+
+std::vector<size_t> CpuBinder::PickCpus_(uint32_t cpu_num) {
+  const auto& cpus = m_topology_.cpus;
+
+  // NUMA node -> L3 domain -> free cpus, in topology order.
+  std::map<uint32_t, std::map<uint32_t, std::vector<size_t>>> free_cpus;
+  size_t free_num = 0;
+  for (size_t i = 0; i < cpus.size(); ++i) {
+    if (m_used_[i]) continue;
+    free_cpus[cpus[i].numa][cpus[i].l3].push_back(i);
+    ++free_num;
+  }
+  if (free_num < cpu_num) return {};
+
+  std::map<uint32_t, uint32_t> numa_free_num;
+  for (const auto& [numa, l3s] : free_cpus)
+    for (const auto& l3_cpus : l3s | std::views::values)
+      numa_free_num[numa] += l3_cpus.size();
+
+  std::vector<size_t> picked;
+  uint32_t need = cpu_num;
+  for (uint32_t numa : ChooseDomains_(numa_free_num, need)) {
+    auto& l3s = free_cpus.at(numa);
+    std::map<uint32_t, uint32_t> l3_free_num;
+    for (const auto& [l3, l3_cpus] : l3s) l3_free_num[l3] = l3_cpus.size();
+
+    uint32_t numa_need = std::min(need, numa_free_num.at(numa));
+    for (uint32_t l3 : ChooseDomains_(l3_free_num, numa_need)) {
+      auto& candidates = l3s.at(l3);
+
+      // Cpus of a core stay adjacent, since the sort is stable.
+      absl::flat_hash_map<uint32_t, uint32_t> core_free_num;
+      for (size_t i : candidates) ++core_free_num[cpus[i].core];
+      std::ranges::stable_sort(candidates, std::greater{}, [&](size_t i) {
+        return core_free_num.at(cpus[i].core);
+      });
+
+      for (size_t i : candidates) {
+        if (need == 0) break;
+        picked.push_back(i);
+        --need;
+      }
+      if (need == 0) return picked;
+    }
+  }
+  return picked;
+}
+
+}  // namespace Craned
@@ -0,0 +1,115 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "CranedPublicDefs.h"
+// Precompiled header comes first.
+
+namespace Craned {
+
+/**
+ * Logical cpus of this node with the physical core, L3 cache domain and NUMA
+ * node each belongs to, read from sysfs.
+ */
+struct CpuTopology {
+  struct Cpu {
+    uint32_t id;
+    // Dense indexes over the node, not the ids in sysfs.
+    uint32_t core;
+    uint32_t l3;
+    // NUMA node id.
+    uint32_t numa;
+  };
+
+  // Sorted by NUMA node, L3 domain, core and id, so that close cpus are
+  // adjacent.
+  std::vector<Cpu> cpus;
+  // MemTotal of each NUMA node.
+  std::map<uint32_t, uint64_t> numa_mem_bytes;
+
+  // Discover the topology of online cpus under sysfs_root, which is
+  // /sys/devices/system on a real node.
+  static std::optional<CpuTopology> Discover(
+      const std::filesystem::path& sysfs_root = "/sys/devices/system");
+};
+
+struct CpuBinding {
+  std::vector<uint32_t> cpus;
+  std::vector<uint32_t> mems;
+};
+
+/**
+ * Assigns whole sets of cpus to jobs on this node. Ctld only counts cpus, so
+ * the cpus of a job are picked here when its cgroup is created and written to
+ * cpuset.cpus and cpuset.mems of the job cgroup.
+ *
+ * A job is packed into the NUMA node, and within it the L3 domain, which has
+ * the fewest free cpus that still fit it. A job larger than any NUMA node
+ * takes the emptiest domains first. Cores with the most free cpus are taken
+ * first, so that jobs share physical cores as little as possible. More NUMA
+ * nodes are added to the mems of a job whose memory limit doesn't fit in the
+ * memory of the NUMA nodes of its cpus.
+ */
+class CpuBinder {
+ public:
+  explicit CpuBinder(CpuTopology topology);
+
+  /**
+   * @return the binding of the job, or nullopt if fewer than cpu_num cpus are
+   * free, in which case the job runs on all cpus under its cpu quota.
+   */
+  std::optional<CpuBinding> Allocate(job_id_t job_id, uint32_t cpu_num,
+                                     uint64_t mem_bytes);
+
+  /**
+   * @brief Mark the cpus of a job found at recovery in the cpuset.cpus of its
+   * cgroup as used.
+   */
+  void Restore(job_id_t job_id, const std::filesystem::path& cgroup_path);
+
+  void Free(job_id_t job_id);
+
+  uint32_t CpuNum() const { return m_topology_.cpus.size(); }
+
+  // Format cpus as a cpu list like "0-3,8".
+  static std::string CpuListToString(const std::vector<uint32_t>& cpus);
+  static std::optional<std::vector<uint32_t>> ParseCpuList(
+      std::string_view list);
+
+ private:
+  // Pick the domains to take need cpus from out of {domain: free cpu number}.
+  static std::vector<uint32_t> ChooseDomains_(
+      const std::map<uint32_t, uint32_t>& free_num, uint32_t need);
+
+  std::vector<size_t> PickCpus_(uint32_t cpu_num)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(m_mtx_);
+
+  const CpuTopology m_topology_;
+  // Index into m_topology_.cpus of each cpu id.
+  absl::flat_hash_map<uint32_t, size_t> m_cpu_index_;
+
+  absl::Mutex m_mtx_;
+  std::vector<bool> m_used_ ABSL_GUARDED_BY(m_mtx_);
+  absl::flat_hash_map<job_id_t, std::vector<size_t>> m_job_cpus_
+      ABSL_GUARDED_BY(m_mtx_);
+};
+
+}  // namespace Craned
+
+inline std::unique_ptr<Craned::CpuBinder> g_cpu_binder;
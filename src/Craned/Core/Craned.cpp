@@ -36,12 +36,16 @@
 #include <cxxopts.hpp>
 
 #include "CgroupManager.h"
+#include "CpuBinding.h"
 #include "CranedForPamServer.h"
 #include "CranedServer.h"
 #include "CtldClient.h"
 #include "DeviceManager.h"
 #include "JobManager.h"
+#include "JobUsageSampler.h"
+#include "StepPayloadCache.h"
 #include "SupervisorKeeper.h"
+#include "SupervisorPool.h"
 #include "crane/PluginClient.h"
 #include "crane/String.h"
 
@@ -81,14 +85,8 @@ CraneErrCode TryToRecoverCgForJobs(
       if (rn_jobs_from_ctld.find(job_id) != rn_jobs_from_ctld.end()) continue;
 
       CRANE_DEBUG("Erase bpf map entry for rn job {} not in Ctld.", job_id);
-      for (const auto& key : bpf_key_vec) {
-        if (bpf_map__delete_elem(CgroupManager::bpf_runtime_info.BpfDevMap(),
-                                 &key, sizeof(BpfKey), BPF_ANY) < 0) {
-          CRANE_ERROR(
-              "Failed to delete BPF map major {},minor {} in cgroup id {}",
-              key.major, key.minor, key.cgroup_id);
-        }
-      }
+      absl::ReaderMutexLock lk(CgroupManager::bpf_runtime_info.BpfMutex());
+      CgroupManager::bpf_runtime_info.DeleteDevMapEntries(bpf_key_vec);
     }
 #endif
   } else {
@@ -107,6 +105,8 @@ CraneErrCode TryToRecoverCgForJobs(
       if (cg_expt.has_value()) {
         // Job cgroup is recovered.
         job.cgroup = std::move(cg_expt.value());
+        if (g_cpu_binder)
+          g_cpu_binder->Restore(job_id, job.cgroup->CgroupPath());
       } else {
         // If the cgroup is found but is unrecoverable, just logging out.
         CRANE_ERROR("Cgroup for job #{} is found but not recoverable.", job_id);
@@ -145,17 +145,72 @@ CraneErrCode TryToRecoverCgForJobs(
   return CraneErrCode::SUCCESS;
 }
 
+// Wall time spent in each phase of startup, reported once craned begins to
+// register to ctld.
+class StartupPhaseTimer {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  // Ends the current phase, which began at the end of the previous one or at
+  // process start.
+  void EndPhase(std::string_view phase) {
+    Clock::time_point now = Clock::now();
+    m_phases_.emplace_back(phase, now - m_last_);
+    m_last_ = now;
+  }
+
+  std::string Report() const {
+    auto to_ms = [](Clock::duration d) {
+      return std::chrono::duration_cast<std::chrono::milliseconds>(d).count();
+    };
+    std::vector<std::string> parts;
+    parts.reserve(m_phases_.size());
+    for (const auto& [phase, duration] : m_phases_)
+      parts.emplace_back(fmt::format("{} {}ms", phase, to_ms(duration)));
+    return fmt::format("{}, total {}ms", absl::StrJoin(parts, ", "),
+                       to_ms(m_last_ - m_begin_));
+  }
+
+ private:
+  Clock::time_point m_begin_{Clock::now()};
+  Clock::time_point m_last_{m_begin_};
+  std::vector<std::pair<std::string_view, Clock::duration>> m_phases_;
+};
+
+StartupPhaseTimer g_startup_phase_timer;
+
 void ParseCranedConfig(const YAML::Node& config) {
   Craned::Config::CranedConfig conf{};
   using util::YamlValueOr;
   conf.PingIntervalSec = kCranedPingIntervalSec;
   conf.CtldTimeoutSec = Craned::kCtldClientTimeoutSec;
+  conf.CgroupBackend = CgConstant::CgroupBackend::LIBCGROUP;
+  conf.CgroupPoolSize = 0;
+  conf.JobUsageSampleIntervalSec = Craned::kJobUsageSampleIntervalSec;
+  conf.CpuBinding = false;
   if (config["Craned"]) {
     auto craned_config = config["Craned"];
     if (craned_config["PingInterval"])
       conf.PingIntervalSec = craned_config["PingInterval"].as<uint32_t>();
     if (craned_config["CraneCtldTimeout"])
       conf.CtldTimeoutSec = craned_config["CraneCtldTimeout"].as<uint32_t>();
+
+    auto backend = YamlValueOr(craned_config["CgroupBackend"], "libcgroup");
+    if (backend == "cgroupfs") {
+      conf.CgroupBackend = CgConstant::CgroupBackend::CGROUPFS;
+    } else if (backend != "libcgroup") {
+      fmt::print(stderr,
+                 "Illegal CgroupBackend: {}, should be libcgroup or "
+                 "cgroupfs.\n",
+                 backend);
+      std::exit(1);
+    }
+    conf.CgroupPoolSize =
+        YamlValueOr<uint32_t>(craned_config["CgroupPoolSize"], 0);
+    conf.JobUsageSampleIntervalSec =
+        YamlValueOr<uint32_t>(craned_config["JobUsageSampleInterval"],
+                              Craned::kJobUsageSampleIntervalSec);
+    conf.CpuBinding = YamlValueOr<bool>(craned_config["CpuBinding"], false);
   }
   g_config.CranedConf = std::move(conf);
 }
@@ -181,6 +236,8 @@ void ParseSupervisorConfig(const YAML::Node& supervisor_config) {
   g_config.Supervisor.LogDir =
       g_config.CraneBaseDir /
       YamlValueOr(supervisor_config["LogDir"], "supervisor");
+  g_config.Supervisor.WarmPoolSize =
+      YamlValueOr<uint32_t>(supervisor_config["WarmPoolSize"], 0);
 }
 
 void ParseConfig(int argc, char** argv) {
@@ -204,6 +261,11 @@ void ParseConfig(int argc, char** argv) {
       ;
   // clang-format on
 
+  // Node names are resolved and devices probed on this pool. It is joined
+  // on return, before StartDaemon() forks.
+  BS::thread_pool startup_pool(Craned::kStartupProbeThreadNum);
+  std::future<std::vector<crane::NetworkInterface>> net_ifs_future;
+
   cxxopts::ParseResult parsed_args;
   try {
     parsed_args = options.parse(argc, argv);
@@ -273,12 +335,34 @@ void ParseConfig(int argc, char** argv) {
         std::exit(1);
       }
 
+      if (config["Metrics"]) {
+        const auto& metrics_config = config["Metrics"];
+        g_config.Metrics.Enabled =
+            YamlValueOr<bool>(metrics_config["Enabled"], false);
+        g_config.Metrics.ListenAddr =
+            YamlValueOr(metrics_config["ListenAddr"], kDefaultHost);
+        g_config.Metrics.ListenPort = YamlValueOr(
+            metrics_config["CranedListenPort"], kCranedMetricsDefaultPort);
+      }
+
+      LogQueueOptions log_queue_options{
+          .size = YamlValueOr<uint32_t>(config["LogQueueSize"],
+                                        kDefaultLogQueueSize),
+          .drop_on_full = YamlValueOr<std::string>(
+                              config["LogQueueFullPolicy"], "Block") == "Drop",
+      };
+
       // spdlog should be initialized as soon as possible
       std::optional log_level = StrToLogLevel(g_config.CranedDebugLevel);
       if (log_level.has_value()) {
-        InitLogger(log_level.value(), g_config.CranedLogFile, true);
+        InitLogger(log_level.value(), g_config.CranedLogFile, true,
+                   log_queue_options);
         Craned::g_runtime_status.conn_logger =
             AddLogger("conn", log_level.value(), true);
+        // Right after boot this may wait for the interfaces to get an
+        // address, so it overlaps with the rest of the startup.
+        net_ifs_future = startup_pool.submit_task(
+            [] { return crane::GetNetworkInterfaces(); });
       } else {
         fmt::print(stderr, "Illegal Craned debug-level format: {}.\n",
                    g_config.CranedDebugLevel);
@@ -320,6 +404,11 @@ void ParseConfig(int argc, char** argv) {
       g_config.CompressedRpc =
           YamlValueOr<bool>(config["CompressedRpc"], false);
 
+      g_config.StepPayloadCacheBytes =
+          YamlValueOr<uint64_t>(config["StepPayloadCacheMB"],
+                                kDefaultStepPayloadCacheMB) *
+          1024 * 1024;
+
       ParseCranedConfig(config);
 
       if (config["TLS"]) {
@@ -372,6 +461,7 @@ void ParseConfig(int argc, char** argv) {
                       kCtldForInternalDefaultPort);
 
       if (config["Nodes"]) {
+        std::vector<std::string> hostnames_to_resolve;
         for (auto it = config["Nodes"].begin(); it != config["Nodes"].end();
              ++it) {
           auto node = it->as<YAML::Node>();
@@ -484,26 +574,7 @@ void ParseConfig(int argc, char** argv) {
             ipv6_t ipv6;
             switch (crane::GetIpAddrVer(name)) {
             case -1: {
-              bool ip_resolved = false;
-              if (crane::ResolveIpv4FromHostname(name, &ipv4)) {
-                g_config.Ipv4ToCranedHostname[ipv4] = name;
-                CRANE_INFO("Resolve hostname `{}` to `{}`", name,
-                           crane::Ipv4ToStr(ipv4));
-                ip_resolved = true;
-              }
-
-              if (crane::ResolveIpv6FromHostname(name, &ipv6)) {
-                g_config.Ipv6ToCranedHostname[ipv6] = name;
-                CRANE_INFO("Resolve hostname `{}` to `{}`", name,
-                           crane::Ipv6ToStr(ipv6));
-                ip_resolved = true;
-              }
-
-              if (!ip_resolved) {
-                CRANE_ERROR("Init error: Cannot resolve hostname of `{}`",
-                            name);
-                std::exit(1);
-              }
+              hostnames_to_resolve.emplace_back(name);
               break;
             }
 
@@ -536,7 +607,50 @@ void ParseConfig(int argc, char** argv) {
             }
             g_config.CranedRes[name] = node_res;
           }
+          crane::SeedResolveCache({name_list.begin(), name_list.end()});
+        }
+
+        g_startup_phase_timer.EndPhase("config");
+
+        // Resolving the names one by one takes long in a large cluster.
+        struct ResolvedAddr {
+          std::optional<ipv4_t> ipv4;
+          std::optional<ipv6_t> ipv6;
+        };
+        std::vector<ResolvedAddr> resolved(hostnames_to_resolve.size());
+        startup_pool
+            .submit_loop(size_t{0}, hostnames_to_resolve.size(),
+                         [&](size_t i) {
+                           const std::string& name = hostnames_to_resolve[i];
+                           ipv4_t ipv4;
+                           if (crane::ResolveIpv4FromHostname(name, &ipv4))
+                             resolved[i].ipv4 = ipv4;
+                           ipv6_t ipv6;
+                           if (crane::ResolveIpv6FromHostname(name, &ipv6))
+                             resolved[i].ipv6 = ipv6;
+                         })
+            .wait();
+
+        for (size_t i = 0; i < hostnames_to_resolve.size(); i++) {
+          const std::string& name = hostnames_to_resolve[i];
+          const auto& [ipv4, ipv6] = resolved[i];
+          if (ipv4) {
+            g_config.Ipv4ToCranedHostname[*ipv4] = name;
+            CRANE_INFO("Resolve hostname `{}` to `{}`", name,
+                       crane::Ipv4ToStr(*ipv4));
+          }
+          if (ipv6) {
+            g_config.Ipv6ToCranedHostname[*ipv6] = name;
+            CRANE_INFO("Resolve hostname `{}` to `{}`", name,
+                       crane::Ipv6ToStr(*ipv6));
+          }
+          if (!ipv4 && !ipv6) {
+            CRANE_ERROR("Init error: Cannot resolve hostname of `{}`", name);
+            std::exit(1);
+          }
         }
+
+        g_startup_phase_timer.EndPhase("resolve nodes");
       }
 
       if (config["Partitions"]) {
@@ -645,9 +759,31 @@ void ParseConfig(int argc, char** argv) {
               CRANE_ERROR("RuntimeRun is not configured.");
               std::exit(1);
             }
+
+            g_config.Container.BundleCacheDir =
+                g_config.CraneBaseDir /
+                YamlValueOr(container_config["BundleCacheDir"],
+                            kDefaultContainerBundleCacheDir);
+            g_config.Container.BundleCacheQuota =
+                YamlValueOr<uint64_t>(container_config["BundleCacheSizeMB"],
+                                      0) *
+                1024 * 1024;
           }
         }
 
+        if (config["OutputSpool"]) {
+          const auto& spool_config = config["OutputSpool"];
+          g_config.OutputSpool.Enabled =
+              YamlValueOr<bool>(spool_config["Enabled"], false);
+          g_config.OutputSpool.SpoolDir =
+              g_config.CraneBaseDir / YamlValueOr(spool_config["SpoolDir"],
+                                                  kDefaultOutputSpoolDir);
+          g_config.OutputSpool.FlushThreshold =
+              YamlValueOr<uint64_t>(spool_config["FlushThresholdMB"],
+                                    kDefaultOutputSpoolFlushThresholdMB) *
+              1024 * 1024;
+        }
+
         if (config["Plugin"]) {
           const auto& plugin_config = config["Plugin"];
           g_config.Plugin.Enabled =
@@ -656,6 +792,12 @@ void ParseConfig(int argc, char** argv) {
               fmt::format("unix://{}{}", g_config.CraneBaseDir,
                           YamlValueOr(plugin_config["PlugindSockPath"],
                                       kDefaultPlugindUnixSockPath));
+          g_config.Plugin.MaxQueuedEvents =
+              YamlValueOr<uint32_t>(plugin_config["MaxQueuedEvents"],
+                                    kDefaultPluginMaxQueuedEvents);
+          g_config.Plugin.BlockOnQueueFull =
+              YamlValueOr<std::string>(plugin_config["QueueFullPolicy"],
+                                       "Drop") == "Block";
         }
       }
     } catch (YAML::BadFile& e) {
@@ -718,6 +860,7 @@ void ParseConfig(int argc, char** argv) {
   {
     auto node_res = g_config.CranedRes.at(g_config.Hostname);
     auto& devices = each_node_device[g_config.Hostname];
+    std::vector<std::unique_ptr<BasicDevice>> node_devices;
     for (auto& dev_arg : devices) {
       auto& [name, type, path_vec, env_injector] = dev_arg;
       auto env_injector_enum = GetDeviceEnvInjectorFromStr(env_injector);
@@ -726,10 +869,22 @@ void ParseConfig(int argc, char** argv) {
                     env_injector.value_or("EmptyVal"), path_vec);
         std::exit(1);
       }
+      node_devices.emplace_back(DeviceManager::ConstructDevice(
+          name, type, path_vec, env_injector_enum));
+    }
 
-      std::unique_ptr dev = DeviceManager::ConstructDevice(name, type, path_vec,
-                                                           env_injector_enum);
-      if (!dev->Init()) {
+    // A node may have many device files, some on slow device drivers.
+    std::vector<char> dev_init_ok(node_devices.size());
+    startup_pool
+        .submit_loop(size_t{0}, node_devices.size(),
+                     [&](size_t i) {
+                       dev_init_ok[i] = node_devices[i]->Init();
+                     })
+        .wait();
+
+    for (size_t i = 0; i < node_devices.size(); i++) {
+      std::unique_ptr<BasicDevice>& dev = node_devices[i];
+      if (!dev_init_ok[i]) {
         CRANE_ERROR("Access Device {} failed.", static_cast<std::string>(*dev));
         std::exit(1);
       }
@@ -741,6 +896,7 @@ void ParseConfig(int argc, char** argv) {
     }
     each_node_device.clear();
   }
+  g_startup_phase_timer.EndPhase("devices");
 
   uint32_t part_id, node_index;
   std::string part_name;
@@ -768,7 +924,8 @@ void ParseConfig(int argc, char** argv) {
 
   g_config.CranedMeta.CranedStartTime = absl::Now();
   g_config.CranedMeta.SystemBootTime = util::os::GetSystemBootTime();
-  g_config.CranedMeta.NetworkInterfaces = crane::GetNetworkInterfaces();
+  g_config.CranedMeta.NetworkInterfaces = net_ifs_future.get();
+  g_startup_phase_timer.EndPhase("node info");
 }
 
 void CreateRequiredDirectories() {
@@ -835,6 +992,7 @@ void Recover(const crane::grpc::ConfigureCranedRequest& config_from_ctld) {
   }
 
   g_server->MarkSupervisorAsRecovered();
+  g_supervisor_keeper->ReconcileStragglersAsync();
 }
 
 void GlobalVariableInit() {
@@ -853,6 +1011,7 @@ void GlobalVariableInit() {
   g_supervisor_keeper = std::make_unique<Craned::SupervisorKeeper>();
 
   using CgConstant::Controller;
+  CgroupManager::SetCgroupBackend(g_config.CranedConf.CgroupBackend);
   CgroupManager::Init(StrToLogLevel(g_config.CranedDebugLevel).value());
   if (CgroupManager::GetCgroupVersion() ==
           CgConstant::CgroupVersion::CGROUP_V1 &&
@@ -873,6 +1032,31 @@ void GlobalVariableInit() {
     std::exit(1);
   }
 
+  CgroupManager::InitCgroupPool(g_config.CranedConf.CgroupPoolSize);
+
+  if (g_config.CranedConf.JobUsageSampleIntervalSec != 0 &&
+      CgroupManager::GetCgroupVersion() ==
+          CgConstant::CgroupVersion::CGROUP_V2)
+    g_job_usage_sampler = std::make_unique<Craned::JobUsageSampler>(
+        std::chrono::seconds(g_config.CranedConf.JobUsageSampleIntervalSec));
+
+  if (g_config.CranedConf.CpuBinding) {
+    std::optional<Craned::CpuTopology> topology;
+    if (CgroupManager::GetCgroupVersion() !=
+            CgConstant::CgroupVersion::CGROUP_V2 ||
+        !CgroupManager::IsMounted(Controller::CPUSET_CONTROLLER_V2))
+      CRANE_WARN("CpuBinding needs the cpuset controller of cgroup v2.");
+    else if (!(topology = Craned::CpuTopology::Discover()))
+      CRANE_WARN("CpuBinding is disabled for the unknown cpu topology.");
+    else
+      g_cpu_binder = std::make_unique<Craned::CpuBinder>(
+          std::move(topology.value()));
+  }
+
+  if (g_config.StepPayloadCacheBytes > 0)
+    g_step_payload_cache = std::make_unique<Craned::StepPayloadCache>(
+        g_config.StepPayloadCacheBytes);
+
   g_server = std::make_unique<Craned::CranedServer>(g_config.ListenConf);
 
   g_job_mgr = std::make_unique<Craned::JobManager>();
@@ -882,6 +1066,10 @@ void GlobalVariableInit() {
     CRANE_INFO("Grpc Server Shutdown() was called.");
   });
 
+  g_supervisor_pool = std::make_unique<Craned::SupervisorPool>(
+      g_config.Supervisor.WarmPoolSize);
+  g_supervisor_pool->Init();
+
   g_ctld_client_sm = std::make_unique<Craned::CtldClientStateMachine>();
   g_ctld_client = std::make_unique<Craned::CtldClient>();
 
@@ -899,12 +1087,24 @@ void GlobalVariableInit() {
   if (g_config.Plugin.Enabled) {
     CRANE_INFO("[Plugin] Plugin module is enabled.");
     g_plugin_client = std::make_unique<plugin::PluginClient>();
-    g_plugin_client->InitChannelAndStub(g_config.Plugin.PlugindSockPath);
+    g_plugin_client->InitChannelAndStub(
+        g_config.Plugin.PlugindSockPath, g_config.Plugin.MaxQueuedEvents,
+        g_config.Plugin.BlockOnQueueFull
+            ? plugin::PluginClient::QueueFullPolicy::BLOCK
+            : plugin::PluginClient::QueueFullPolicy::DROP);
   }
 
   g_craned_for_pam_server =
       std::make_unique<Craned::CranedForPamServer>(g_config.ListenConf);
 
+  if (g_config.Metrics.Enabled) {
+    util::metrics::AddLoggerMetrics(&util::metrics::DefaultRegistry());
+    g_metrics_server = std::make_unique<util::metrics::MetricsServer>();
+    if (!g_metrics_server->Start(g_config.Metrics.ListenAddr,
+                                 g_config.Metrics.ListenPort))
+      g_metrics_server.reset();
+  }
+
   // Make sure all grpc server is ready to receive requests.
   std::this_thread::sleep_for(std::chrono::milliseconds(1000));
 }
@@ -916,6 +1116,9 @@ void WaitForStopAndDoGvarFini() {
    */
   g_server->Wait();
 
+  // The endpoint reads the queues of the objects destroyed below.
+  g_metrics_server.reset();
+
   /*
    * No more status change from supervisor, clean up CtldClient, stop register
    * this craned
@@ -925,6 +1128,7 @@ void WaitForStopAndDoGvarFini() {
 
   g_server.reset();
   g_craned_for_pam_server.reset();
+  g_step_payload_cache.reset();
 
   /* Called from
    * PAM_SERVER, G_SERVER
@@ -938,8 +1142,11 @@ void WaitForStopAndDoGvarFini() {
    */
   g_thread_pool->wait();
   g_job_mgr.reset();
+  g_supervisor_pool.reset();
+  g_cpu_binder.reset();
 
   g_ctld_client.reset();
+  g_job_usage_sampler.reset();
   // After ctld client destroyed, it is ok to destroy ctld client state machine
   g_ctld_client_sm.reset();
 
@@ -966,6 +1173,8 @@ void StartServer() {
   }
 
   GlobalVariableInit();
+  g_startup_phase_timer.EndPhase("global init");
+  CRANE_INFO("Startup phases: {}.", g_startup_phase_timer.Report());
 
   // Set FD_CLOEXEC on stdin, stdout, stderr
   util::os::SetCloseOnExecOnFdRange(STDIN_FILENO, STDERR_FILENO + 1);
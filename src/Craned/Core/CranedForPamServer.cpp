@@ -18,8 +18,11 @@
 
 #include "CranedForPamServer.h"
 
+#include <sys/stat.h>
+
 #include "CranedServer.h"
 #include "JobManager.h"
+#include "crane/PamFastPath.h"
 
 namespace Craned {
 
@@ -280,6 +283,40 @@ grpc::Status CranedForPamServiceImpl::QuerySshStepEnvVariablesForward(
   // return Status::OK;
 }
 
+grpc::Status CranedForPamServiceImpl::AuthorizeSshProc(
+    grpc::ServerContext *context,
+    const crane::grpc::AuthorizeSshProcRequest *request,
+    crane::grpc::AuthorizeSshProcReply *response) {
+  response->set_ok(false);
+
+  crane::grpc::QueryStepFromPortForwardRequest query_request;
+  crane::grpc::QueryStepFromPortForwardReply query_reply;
+  query_request.set_ssh_remote_port(request->ssh_remote_port());
+  query_request.set_ssh_remote_address(request->ssh_remote_address());
+  query_request.set_uid(request->uid());
+  QueryStepFromPortForward(context, &query_request, &query_reply);
+  if (!query_reply.ok()) return Status::OK;
+
+  crane::grpc::MigrateSshProcToCgroupRequest migrate_request;
+  crane::grpc::MigrateSshProcToCgroupReply migrate_reply;
+  migrate_request.set_pid(request->pid());
+  migrate_request.set_task_id(query_reply.task_id());
+  Status status =
+      MigrateSshProcToCgroup(context, &migrate_request, &migrate_reply);
+  if (!status.ok() || !migrate_reply.ok()) return status;
+
+  crane::grpc::QuerySshStepEnvVariablesForwardRequest env_request;
+  crane::grpc::QuerySshStepEnvVariablesForwardReply env_reply;
+  env_request.set_task_id(query_reply.task_id());
+  status = QuerySshStepEnvVariablesForward(context, &env_request, &env_reply);
+  if (!status.ok() || !env_reply.ok()) return status;
+
+  response->set_ok(true);
+  response->set_task_id(query_reply.task_id());
+  response->mutable_env_map()->swap(*env_reply.mutable_env_map());
+  return Status::OK;
+}
+
 CranedForPamServer::CranedForPamServer(
     const Config::CranedListenConf &listen_conf) {
   m_service_impl_ = std::make_unique<CranedForPamServiceImpl>();
@@ -298,6 +335,104 @@ CranedForPamServer::CranedForPamServer(
 
   CRANE_INFO("Craned for pam unix socket is listening on {}",
              listen_conf.UnixSocketForPamListenAddr);
+
+  // pam_crane falls back to gRPC without the fast path.
+  if (StartFastPath_(crane::pam_fast_path::SockPath(
+          g_config.CranedForPamUnixSockPath.string())))
+    m_fast_path_thread_ = std::thread([this] { FastPathThread_(); });
+}
+
+void CranedForPamServer::Wait() {
+  m_server_->Wait();
+  if (m_fast_path_thread_.joinable()) m_fast_path_thread_.join();
+  if (m_fast_path_fd_ != -1) {
+    close(m_fast_path_fd_);
+    unlink(m_fast_path_sock_path_.c_str());
+  }
+}
+
+bool CranedForPamServer::StartFastPath_(const std::string &sock_path) {
+  sockaddr_un addr{};
+  if (sock_path.size() >= sizeof(addr.sun_path)) {
+    CRANE_ERROR("Pam fast path socket path {} is too long.", sock_path);
+    return false;
+  }
+  addr.sun_family = AF_UNIX;
+  std::memcpy(addr.sun_path, sock_path.c_str(), sock_path.size() + 1);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    CRANE_ERROR("Failed to create pam fast path socket: {}", strerror(errno));
+    return false;
+  }
+
+  // Only root, which sshd runs pam_crane as, may connect.
+  unlink(sock_path.c_str());
+  if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+      chmod(sock_path.c_str(), S_IRUSR | S_IWUSR) != 0 ||
+      listen(fd, SOMAXCONN) != 0) {
+    CRANE_ERROR("Failed to listen on pam fast path socket {}: {}", sock_path,
+                strerror(errno));
+    close(fd);
+    unlink(sock_path.c_str());
+    return false;
+  }
+
+  m_fast_path_sock_path_ = sock_path;
+  m_fast_path_fd_ = fd;
+  CRANE_INFO("Craned for pam fast path is listening on {}", sock_path);
+  return true;
+}
+
+void CranedForPamServer::FastPathThread_() {
+  util::SetCurrentThreadName("PamFastPathThr");
+
+  while (true) {
+    int fd = accept4(m_fast_path_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) continue;
+      // The socket is shut down by Shutdown().
+      if (errno != EINVAL)
+        CRANE_ERROR("Pam fast path accept failed: {}", strerror(errno));
+      break;
+    }
+
+    // The query may wait for a remote craned or cfored, so the logins are
+    // handled concurrently.
+    g_thread_pool->detach_task([this, fd] {
+      HandleFastPathConn_(fd);
+      close(fd);
+    });
+  }
+}
+
+void CranedForPamServer::HandleFastPathConn_(int fd) {
+  ucred cred{};
+  socklen_t cred_len = sizeof(cred);
+  if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) != 0 ||
+      cred.uid != 0) {
+    CRANE_WARN("Pam fast path connection from uid {} rejected.", cred.uid);
+    return;
+  }
+
+  crane::pam_fast_path::SetTimeout(fd, crane::pam_fast_path::kTimeoutMs);
+
+  crane::grpc::AuthorizeSshProcRequest request;
+  crane::grpc::AuthorizeSshProcReply reply;
+  if (!crane::pam_fast_path::ReadMessage(fd, &request)) {
+    CRANE_DEBUG("Failed to read pam fast path request.");
+    return;
+  }
+
+  if (!g_server->ReadyFor(RequestSource::PAM)) {
+    CRANE_ERROR("CranedServer is not ready.");
+    reply.set_ok(false);
+  } else {
+    m_service_impl_->AuthorizeSshProc(nullptr, &request, &reply);
+  }
+
+  if (!crane::pam_fast_path::WriteMessage(fd, reply))
+    CRANE_DEBUG("Failed to write pam fast path reply.");
 }
 
 }  // namespace Craned
\ No newline at end of file
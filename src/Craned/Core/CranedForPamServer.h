@@ -50,6 +50,12 @@ class CranedForPamServiceImpl : public crane::grpc::CranedForPam::Service {
       grpc::ServerContext *context,
       const ::crane::grpc::QuerySshStepEnvVariablesForwardRequest *request,
       crane::grpc::QuerySshStepEnvVariablesForwardReply *response) override;
+
+  // Also served on the socket of pam_fast_path with a null context.
+  grpc::Status AuthorizeSshProc(
+      grpc::ServerContext *context,
+      const crane::grpc::AuthorizeSshProcRequest *request,
+      crane::grpc::AuthorizeSshProcReply *response) override;
 };
 
 class CranedForPamServer {
@@ -59,14 +65,24 @@ class CranedForPamServer {
   void Shutdown() {
     m_server_->Shutdown(std::chrono::system_clock::now() +
                         std::chrono::seconds(1));
+    // Wakes up the accept() of the fast path thread.
+    if (m_fast_path_fd_ != -1) shutdown(m_fast_path_fd_, SHUT_RDWR);
   }
 
-  void Wait() { m_server_->Wait(); }
+  void Wait();
 
  private:
+  bool StartFastPath_(const std::string &sock_path);
+  void FastPathThread_();
+  void HandleFastPathConn_(int fd);
+
   std::unique_ptr<CranedForPamServiceImpl> m_service_impl_;
   std::unique_ptr<Server> m_server_;
 
+  std::string m_fast_path_sock_path_;
+  int m_fast_path_fd_{-1};
+  std::thread m_fast_path_thread_;
+
   friend class CranedForPamServiceImpl;
 };
 
@@ -25,6 +25,7 @@
 
 #include "CgroupManager.h"
 #include "CommonPublicDefs.h"
+#include "crane/Metrics.h"
 #include "crane/Network.h"
 #include "crane/OS.h"
 
@@ -32,7 +33,16 @@ namespace Craned {
 
 inline constexpr uint64_t kEvSigChldResendMs = 500;
 constexpr uint64_t kCtldClientTimeoutSec = 30;
+constexpr uint32_t kJobUsageSampleIntervalSec = 30;
 constexpr int64_t kCranedRpcTimeoutSeconds = 5;
+// A subtree of a tree launch is forwarded with the deadline of the request
+// minus this, leaving time to reply to the parent.
+constexpr int64_t kLaunchTreeForwardMarginMs = 500;
+constexpr size_t kStepStatusChangeBatchMaxNum = 128;
+constexpr uint32_t kStepStatusChangeRetryMinMs = 100;
+constexpr uint32_t kStepStatusChangeRetryMaxMs = 3000;
+// Node names are resolved and devices probed on this many threads at startup.
+constexpr uint32_t kStartupProbeThreadNum = 16;
 
 using Common::CgroupInterface;
 using Common::CgroupManager;
@@ -72,6 +82,10 @@ struct Config {
   struct CranedConfig {
     uint32_t PingIntervalSec;
     uint32_t CtldTimeoutSec;
+    Common::CgConstant::CgroupBackend CgroupBackend;
+    uint32_t CgroupPoolSize;
+    uint32_t JobUsageSampleIntervalSec;
+    bool CpuBinding;
   };
   CranedConfig CranedConf;
   struct CranedListenConf {
@@ -97,12 +111,26 @@ struct Config {
     std::string RuntimeRun;
     std::string RuntimeKill;
     std::string RuntimeDelete;
+    // Rootfs of bundles are cached here when BundleCacheQuota is not 0.
+    std::filesystem::path BundleCacheDir;
+    uint64_t BundleCacheQuota{0};
   };
   ContainerConfig Container;
 
+  // Batch output is written to SpoolDir and copied to the final paths.
+  struct OutputSpoolConfig {
+    bool Enabled{false};
+    std::filesystem::path SpoolDir;
+    uint64_t FlushThreshold{0};
+  };
+  OutputSpoolConfig OutputSpool;
+
   struct PluginConfig {
     bool Enabled{false};
     std::string PlugindSockPath;
+    uint32_t MaxQueuedEvents{kDefaultPluginMaxQueuedEvents};
+    // Hook calls wait for the queue instead of dropping the events if set.
+    bool BlockOnQueueFull{false};
   };
   PluginConfig Plugin;
 
@@ -110,11 +138,21 @@ struct Config {
     std::filesystem::path Path;
     std::string DebugLevel;
     std::filesystem::path LogDir;
+    uint32_t WarmPoolSize;
   };
   SupervisorConfig Supervisor;
 
+  struct MetricsConfig {
+    bool Enabled{false};
+    std::string ListenAddr;
+    std::string ListenPort;
+  };
+  MetricsConfig Metrics;
+
   CranedListenConf ListenConf;
   bool CompressedRpc{};
+  // 0 if ctld sends the scripts and the environments in full.
+  uint64_t StepPayloadCacheBytes{0};
 
   std::string ControlMachine;
   std::string CraneCtldForInternalListenPort;
@@ -158,4 +196,6 @@ struct RunTimeStatus {
 inline RunTimeStatus g_runtime_status{};
 }  // namespace Craned
 
-inline std::unique_ptr<BS::thread_pool> g_thread_pool;
\ No newline at end of file
+inline std::unique_ptr<BS::thread_pool> g_thread_pool;
+
+inline std::unique_ptr<util::metrics::MetricsServer> g_metrics_server;
\ No newline at end of file
@@ -24,6 +24,7 @@
 #include "CranedForPamServer.h"
 #include "CtldClient.h"
 #include "JobManager.h"
+#include "StepPayloadCache.h"
 #include "SupervisorKeeper.h"
 
 namespace Craned {
@@ -53,16 +54,56 @@ grpc::Status CranedServiceImpl::ExecuteSteps(
   CRANE_TRACE("Requested from CraneCtld to execute {} tasks.",
               request->tasks_size());
 
-  CraneErrCode err;
-  for (auto const &step_to_d : request->tasks()) {
-    err = g_job_mgr->ExecuteStepAsync(step_to_d);
-    if (err != CraneErrCode::SUCCESS)
-      response->add_failed_task_id_list(step_to_d.task_id());
-  }
+  ExecuteStepsLocal_(*request, response->mutable_failed_task_id_list(),
+                     response->mutable_payload_missed_task_id_list());
 
   return Status::OK;
 }
 
+void CranedServiceImpl::ExecuteStepsLocal_(
+    const crane::grpc::ExecuteStepsRequest &request,
+    google::protobuf::RepeatedField<uint32_t> *failed_task_ids,
+    google::protobuf::RepeatedField<uint32_t> *missed_task_ids) {
+  CraneErrCode err;
+  for (auto const &step_to_d : request.tasks()) {
+    if (step_to_d.payload_hash().empty()) {
+      err = g_job_mgr->ExecuteStepAsync(step_to_d);
+      if (err != CraneErrCode::SUCCESS)
+        failed_task_ids->Add(step_to_d.task_id());
+      continue;
+    }
+
+    // The cache is updated in the order of the tasks, like its mirror in
+    // ctld when the request was built. The attached one is used even if it
+    // is too large to be cached.
+    const crane::grpc::StepPayload *payload = nullptr;
+    std::shared_ptr<const crane::grpc::StepPayload> cached;
+    if (auto it = request.payloads().find(step_to_d.payload_hash());
+        it != request.payloads().end()) {
+      payload = &it->second;
+      if (g_step_payload_cache) g_step_payload_cache->Put(it->first, *payload);
+    } else if (g_step_payload_cache &&
+               (cached = g_step_payload_cache->Get(step_to_d.payload_hash()))) {
+      payload = cached.get();
+    }
+
+    if (payload == nullptr) {
+      CRANE_DEBUG("[Step #{}] Payload {} is not cached.", step_to_d.task_id(),
+                  step_to_d.payload_hash());
+      missed_task_ids->Add(step_to_d.task_id());
+      continue;
+    }
+
+    crane::grpc::TaskToD full_step_to_d = step_to_d;
+    full_step_to_d.clear_payload_hash();
+    *full_step_to_d.mutable_env() = payload->env();
+    if (full_step_to_d.has_batch_meta())
+      full_step_to_d.mutable_batch_meta()->set_sh_script(payload->sh_script());
+    err = g_job_mgr->ExecuteStepAsync(full_step_to_d);
+    if (err != CraneErrCode::SUCCESS) failed_task_ids->Add(step_to_d.task_id());
+  }
+}
+
 grpc::Status CranedServiceImpl::TerminateSteps(
     grpc::ServerContext *context,
     const crane::grpc::TerminateStepsRequest *request,
@@ -112,23 +153,10 @@ grpc::Status CranedServiceImpl::QueryStepFromPort(
   CRANE_TRACE("Receive QueryStepFromPort RPC from {}: port: {}",
               context->peer(), request->port());
 
-  ino_t inode;
-  bool inode_found = false;
-
   // find inode
-  // 1._find_match_in_tcp_file
-  inode_found =
-      crane::FindTcpInodeByPort("/proc/net/tcp", request->port(), &inode);
-  if (!inode_found) {
-    CRANE_TRACE(
-        "Inode num for port {} is not found in /proc/net/tcp, try "
-        "/proc/net/tcp6.",
-        request->port());
-    inode_found =
-        crane::FindTcpInodeByPort("/proc/net/tcp6", request->port(), &inode);
-  }
-
-  if (!inode_found) {
+  // 1. find the socket of the port
+  crane::TcpSocketInfo sock_info{};
+  if (!crane::FindTcpSocketByPort(request->port(), &sock_info)) {
     CRANE_TRACE("Inode num for port {} is not found.", request->port());
     response->set_ok(false);
     return Status::OK;
@@ -137,34 +165,27 @@ grpc::Status CranedServiceImpl::QueryStepFromPort(
   // 2.find_pid_by_inode
   pid_t pid_i = -1;
   std::filesystem::path proc_path{"/proc"};
-  for (auto const &dir_entry : std::filesystem::directory_iterator(proc_path)) {
-    if (isdigit(dir_entry.path().filename().string()[0])) {
-      std::string pid_s = dir_entry.path().filename().string();
-      std::string proc_fd_path =
-          fmt::format("{}/{}/fd", proc_path.string(), pid_s);
-      if (!std::filesystem::exists(proc_fd_path)) {
-        continue;
-      }
-      for (auto const &fd_dir_entry :
-           std::filesystem::directory_iterator(proc_fd_path)) {
-        struct stat statbuf{};
-        std::string fdpath = fmt::format(
-            "{}/{}", proc_fd_path, fd_dir_entry.path().filename().string());
-        const char *fdchar = fdpath.c_str();
-        if (stat(fdchar, &statbuf) != 0) {
-          continue;
-        }
-        if (statbuf.st_ino == inode) {
-          pid_i = std::stoi(pid_s);
-          CRANE_TRACE("Pid for the process that owns port {} is {}",
-                      request->port(), pid_i);
-          break;
-        }
+  std::error_code ec;
+  for (auto const &dir_entry :
+       std::filesystem::directory_iterator(proc_path, ec)) {
+    std::string pid_s = dir_entry.path().filename().string();
+    if (!isdigit(pid_s[0])) continue;
+
+    std::string proc_fd_path =
+        fmt::format("{}/{}/fd", proc_path.string(), pid_s);
+    // The process may exit at any time.
+    for (auto const &fd_dir_entry :
+         std::filesystem::directory_iterator(proc_fd_path, ec)) {
+      struct stat statbuf{};
+      if (stat(fd_dir_entry.path().c_str(), &statbuf) != 0) continue;
+      if (statbuf.st_ino == sock_info.inode) {
+        pid_i = std::stoi(pid_s);
+        CRANE_TRACE("Pid for the process that owns port {} is {}",
+                    request->port(), pid_i);
+        break;
       }
     }
-    if (pid_i != -1) {
-      break;
-    }
+    if (pid_i != -1) break;
   }
   if (pid_i == -1) {
     CRANE_TRACE("Pid for the process that owns port {} is not found.",
@@ -218,8 +239,15 @@ grpc::Status CranedServiceImpl::CreateCgroupForJobs(
     return Status(grpc::StatusCode::UNAVAILABLE, "CranedServer is not ready");
   }
 
+  CreateCgroupForJobsLocal_(*request);
+
+  return Status::OK;
+}
+
+void CranedServiceImpl::CreateCgroupForJobsLocal_(
+    const crane::grpc::CreateCgroupForJobsRequest &request) {
   std::vector<JobInD> jobs;
-  for (const auto &job_to_d : request->job_list()) {
+  for (const auto &job_to_d : request.job_list()) {
     CRANE_TRACE("Allocating job #{}, uid {}", job_to_d.job_id(),
                 job_to_d.uid());
     jobs.emplace_back(job_to_d);
@@ -229,10 +257,95 @@ grpc::Status CranedServiceImpl::CreateCgroupForJobs(
   if (!ok) {
     CRANE_ERROR("Failed to alloc some jobs.");
   }
+}
+
+grpc::Status CranedServiceImpl::LaunchTree(
+    grpc::ServerContext *context, const crane::grpc::LaunchTreeRequest *request,
+    crane::grpc::LaunchTreeReply *response) {
+  // The sender dispatches the whole subtree directly then.
+  if (!g_server->ReadyFor(RequestSource::CTLD)) {
+    CRANE_ERROR("CranedServer is not ready.");
+    return Status(grpc::StatusCode::UNAVAILABLE, "CranedServer is not ready");
+  }
+
+  const auto &node = request->root();
+  auto deadline = context->deadline();
+  if (deadline == std::chrono::system_clock::time_point::max())
+    deadline = std::chrono::system_clock::now() +
+               std::chrono::seconds(kCranedRpcTimeoutSeconds);
+  deadline -= std::chrono::milliseconds(kLaunchTreeForwardMarginMs);
+
+  // The subtrees are sent first to launch while this craned handles its
+  // own payload.
+  std::vector<crane::grpc::LaunchTreeReply> child_replies(
+      node.children_size());
+  std::latch latch(node.children_size());
+  for (int i = 0; i < node.children_size(); i++) {
+    g_thread_pool->detach_task([&, i] {
+      ForwardLaunchTree_(node.children(i), deadline, &child_replies[i]);
+      latch.count_down();
+    });
+  }
+
+  auto *result = response->add_results();
+  result->set_craned_id(g_config.CranedIdOfThisNode);
+  if (node.has_create_cgroup())
+    CreateCgroupForJobsLocal_(node.create_cgroup());
+  else if (node.has_execute_steps())
+    ExecuteStepsLocal_(node.execute_steps(),
+                       result->mutable_failed_task_id_list(),
+                       result->mutable_payload_missed_task_id_list());
+
+  latch.wait();
+  for (auto &child_reply : child_replies)
+    for (auto &child_result : *child_reply.mutable_results())
+      *response->add_results() = std::move(child_result);
 
   return Status::OK;
 }
 
+void CranedServiceImpl::ForwardLaunchTree_(
+    const crane::grpc::LaunchTreeNode &node,
+    std::chrono::system_clock::time_point deadline,
+    crane::grpc::LaunchTreeReply *reply) {
+  crane::grpc::LaunchTreeRequest request;
+  *request.mutable_root() = node;
+
+  grpc::ClientContext context;
+  context.set_deadline(deadline);
+  Status status =
+      GetPeerStub_(node.craned_id())->LaunchTree(&context, request, reply);
+  if (!status.ok()) {
+    CRANE_DEBUG("LaunchTree to {} failed: {}", node.craned_id(),
+                status.error_message());
+    reply->Clear();
+  }
+}
+
+Craned::Stub *CranedServiceImpl::GetPeerStub_(const CranedId &craned_id) {
+  absl::MutexLock lock(&m_peer_mtx_);
+  auto &stub = m_peer_stubs_[craned_id];
+  if (stub) return stub.get();
+
+  grpc::ChannelArguments channel_args;
+  SetGrpcClientKeepAliveChannelArgs(&channel_args);
+  if (g_config.CompressedRpc)
+    channel_args.SetCompressionAlgorithm(GRPC_COMPRESS_GZIP);
+
+  std::shared_ptr<Channel> channel;
+  if (g_config.ListenConf.TlsConfig.Enabled)
+    channel = CreateTcpTlsCustomChannelByHostname(
+        craned_id, g_config.ListenConf.CranedListenPort,
+        g_config.ListenConf.TlsConfig.TlsCerts,
+        g_config.ListenConf.TlsConfig.DomainSuffix, channel_args);
+  else
+    channel = CreateTcpInsecureCustomChannel(
+        craned_id, g_config.ListenConf.CranedListenPort, channel_args);
+
+  stub = Craned::NewStub(channel);
+  return stub.get();
+}
+
 grpc::Status CranedServiceImpl::FreeSteps(
     grpc::ServerContext *context, const crane::grpc::FreeStepsRequest *request,
     crane::grpc::FreeStepsReply *response) {
@@ -347,6 +460,7 @@ CranedServer::CranedServer(const Config::CranedListenConf &listen_conf) {
                                             listen_conf.UnixSocketListenAddr);
 
   if (g_config.CompressedRpc) ServerBuilderSetCompression(&builder);
+  if (g_config.Metrics.Enabled) ServerBuilderAddMetricsInterceptor(&builder);
 
   std::string craned_listen_addr = listen_conf.CranedListenAddr;
   if (listen_conf.TlsConfig.Enabled) {
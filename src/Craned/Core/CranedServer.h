@@ -105,6 +105,33 @@ class CranedServiceImpl : public Craned::Service {
       grpc::ServerContext *context,
       const crane::grpc::StepStatusChangeRequest *request,
       crane::grpc::StepStatusChangeReply *response) override;
+
+  grpc::Status LaunchTree(grpc::ServerContext *context,
+                          const crane::grpc::LaunchTreeRequest *request,
+                          crane::grpc::LaunchTreeReply *response) override;
+
+ private:
+  // The requests of ctld on this craned, sent directly or in a tree launch.
+  static void CreateCgroupForJobsLocal_(
+      const crane::grpc::CreateCgroupForJobsRequest &request);
+  // The tasks sent by the hash of a payload which is neither attached nor
+  // cached are added to missed_task_ids and not started.
+  static void ExecuteStepsLocal_(
+      const crane::grpc::ExecuteStepsRequest &request,
+      google::protobuf::RepeatedField<uint32_t> *failed_task_ids,
+      google::protobuf::RepeatedField<uint32_t> *missed_task_ids);
+
+  // Send the subtree to its root craned and add the results to reply. The
+  // craneds of a subtree which is not reached are left out.
+  void ForwardLaunchTree_(const crane::grpc::LaunchTreeNode &node,
+                          std::chrono::system_clock::time_point deadline,
+                          crane::grpc::LaunchTreeReply *reply);
+
+  Craned::Stub *GetPeerStub_(const CranedId &craned_id);
+
+  absl::Mutex m_peer_mtx_;
+  absl::flat_hash_map<CranedId, std::unique_ptr<Craned::Stub>> m_peer_stubs_
+      ABSL_GUARDED_BY(m_peer_mtx_);
 };
 
 class CranedServer {
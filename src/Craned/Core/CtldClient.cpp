@@ -20,6 +20,7 @@
 
 #include "CranedServer.h"
 #include "JobManager.h"
+#include "JobUsageSampler.h"
 #include "SupervisorKeeper.h"
 #include "crane/GrpcHelper.h"
 #include "crane/String.h"
@@ -491,17 +492,18 @@ void CtldClient::SetPingFailedCb(std::function<void()>&& cb) {
 void CtldClient::StepStatusChangeAsync(
     TaskStatusChangeQueueElem&& task_status_change) {
   absl::MutexLock lock(&m_step_status_change_mtx_);
+  if (!m_step_status_change_ids_.emplace(task_status_change.step_id).second) {
+    CRANE_TRACE("Status change of step #{} is already queued. Drop {}.",
+                task_status_change.step_id,
+                static_cast<int>(task_status_change.new_status));
+    return;
+  }
   m_step_status_change_list_.emplace_back(std::move(task_status_change));
 }
 
 std::set<task_id_t> CtldClient::GetAllStepStatusChangeId() {
   absl::MutexLock lock(&m_step_status_change_mtx_);
-  return m_step_status_change_list_ |
-         std::ranges::views::transform(
-             [](const TaskStatusChangeQueueElem& elem) {
-               return elem.step_id;
-             }) |
-         std::ranges::to<std::set<task_id_t>>();
+  return {m_step_status_change_ids_.begin(), m_step_status_change_ids_.end()};
 }
 
 bool CtldClient::RequestConfigFromCtld_(RegToken const& token) {
@@ -658,48 +660,72 @@ void CtldClient::SendStatusChanges_() {
     context.set_deadline(std::chrono::system_clock::now() +
                          std::chrono::seconds(kCranedRpcTimeoutSeconds));
 
-    crane::grpc::StepStatusChangeRequest request;
-    crane::grpc::StepStatusChangeReply reply;
+    crane::grpc::StepStatusChangeBatchRequest request;
+    crane::grpc::StepStatusChangeBatchReply reply;
     grpc::Status status;
 
-    auto status_change = changes.front();
-
-    CRANE_TRACE("Sending TaskStatusChange for task #{}", status_change.step_id);
-
     request.set_craned_id(m_craned_id_);
-    request.set_task_id(status_change.step_id);
-    request.set_new_status(status_change.new_status);
-    request.set_exit_code(status_change.exit_code);
-    if (status_change.reason.has_value())
-      request.set_reason(status_change.reason.value());
+    auto batch_end = changes.begin();
+    while (batch_end != changes.end() &&
+           static_cast<size_t>(request.changes_size()) <
+               kStepStatusChangeBatchMaxNum) {
+      auto* change = request.add_changes();
+      change->set_task_id(batch_end->step_id);
+      change->set_new_status(batch_end->new_status);
+      change->set_exit_code(batch_end->exit_code);
+      if (batch_end->reason.has_value())
+        change->set_reason(batch_end->reason.value());
+
+      if (g_job_usage_sampler)
+        g_job_usage_sampler->SampleJob(batch_end->step_id);
+      ++batch_end;
+    }
+    if (g_job_usage_sampler)
+      g_job_usage_sampler->TakeSamples(request.mutable_job_usage());
+
+    CRANE_TRACE("Sending {} StepStatusChanges from step #{}",
+                request.changes_size(), changes.front().step_id);
 
-    status = m_stub_->StepStatusChange(&context, request, &reply);
+    status = m_stub_->StepStatusChangeBatch(&context, request, &reply);
     if (!status.ok()) {
+      if (g_job_usage_sampler)
+        g_job_usage_sampler->ReturnSamples(request.job_usage());
+
+      uint32_t retry_ms = m_step_status_change_retry_ms_.load();
       CRANE_ERROR(
-          "Failed to send TaskStatusChange: "
-          "{{TaskId: {}, NewStatus: {}}}, reason: {} | {}, code: {}",
-          status_change.step_id, static_cast<int>(status_change.new_status),
+          "Failed to send {} StepStatusChanges from step #{}, retry in {} ms, "
+          "reason: {} | {}, code: {}",
+          request.changes_size(), changes.front().step_id, retry_ms,
           status.error_message(), context.debug_error_string(),
           static_cast<int>(status.error_code()));
 
       if (m_stopping_) return;
       // If some messages are not sent due to channel failure,
       // put them back into m_task_status_change_list_
-      if (!changes.empty()) {
-        m_step_status_change_mtx_.Lock();
-        m_step_status_change_list_.splice(m_step_status_change_list_.begin(),
-                                          std::move(changes));
-        m_step_status_change_mtx_.Unlock();
-      }
-      // Sleep for a while to avoid too many retries.
-      std::this_thread::sleep_for(std::chrono::milliseconds(100));
-      break;
+      m_step_status_change_mtx_.Lock();
+      m_step_status_change_list_.splice(m_step_status_change_list_.begin(),
+                                        std::move(changes));
+      m_step_status_change_mtx_.Unlock();
 
-    } else {
-      CRANE_TRACE("StepStatusChange for step #{} sent. reply.ok={}",
-                  status_change.step_id, reply.ok());
-      changes.pop_front();
+      // Back off while ctld is unreachable or overloaded instead of
+      // retrying at a fixed rate.
+      std::this_thread::sleep_for(std::chrono::milliseconds(retry_ms));
+      m_step_status_change_retry_ms_.store(
+          std::min(retry_ms * 2, kStepStatusChangeRetryMaxMs));
+      break;
     }
+
+    CRANE_TRACE("{} StepStatusChanges sent. reply.ok={}",
+                request.changes_size(), reply.ok());
+    m_step_status_change_retry_ms_.store(kStepStatusChangeRetryMinMs);
+    // Ctld took it as a heartbeat, so the next ping can be skipped.
+    if (reply.craned_active()) UpdateLastActiveTime();
+
+    m_step_status_change_mtx_.Lock();
+    for (auto it = changes.begin(); it != batch_end; ++it)
+      m_step_status_change_ids_.erase(it->step_id);
+    m_step_status_change_mtx_.Unlock();
+    changes.erase(changes.begin(), batch_end);
   }
 }
 
@@ -710,11 +736,15 @@ bool CtldClient::Ping_() {
 
   crane::grpc::CranedPingRequest req;
   req.set_craned_id(m_craned_id_);
+  if (g_job_usage_sampler)
+    g_job_usage_sampler->TakeSamples(req.mutable_job_usage());
   crane::grpc::CranedPingReply reply;
   CRANE_LOGGER_DEBUG(g_runtime_status.conn_logger,
                      "Sending CranedPing request to CraneCtlD.");
   auto status = m_stub_->CranedPing(&context, req, &reply);
   if (!status.ok()) {
+    if (g_job_usage_sampler)
+      g_job_usage_sampler->ReturnSamples(req.job_usage());
     CRANE_LOGGER_ERROR(g_runtime_status.conn_logger, "Craned Ping failed: {}",
                        status.error_message());
     g_ctld_client_sm->EvPingFailed();
@@ -191,6 +191,11 @@ class CtldClient {
     m_last_active_time_ = std::chrono::steady_clock::now();
   }
 
+  /**
+   * Queue a status change of a step to be sent to ctld in batches. Ctld ends
+   * the step on its first status change, so later ones of a step already
+   * queued are dropped. The queue holds at most one change per step.
+   */
   void StepStatusChangeAsync(TaskStatusChangeQueueElem&& task_status_change);
 
   [[nodiscard]] std::set<step_id_t> GetAllStepStatusChangeId();
@@ -213,6 +218,13 @@ class CtldClient {
 
   std::list<TaskStatusChangeQueueElem> m_step_status_change_list_
       ABSL_GUARDED_BY(m_step_status_change_mtx_);
+  // Steps with a change queued or being sent.
+  absl::flat_hash_set<step_id_t> m_step_status_change_ids_
+      ABSL_GUARDED_BY(m_step_status_change_mtx_);
+  // Delay before resending, doubled on each failure while ctld is
+  // unreachable.
+  std::atomic<uint32_t> m_step_status_change_retry_ms_{
+      kStepStatusChangeRetryMinMs};
 
   std::thread m_async_send_thread_;
   std::atomic_bool m_stopping_{false};
@@ -23,9 +23,11 @@
 #include <pty.h>
 #include <sys/wait.h>
 
+#include "CpuBinding.h"
 #include "CranedPublicDefs.h"
 #include "CtldClient.h"
 #include "SupervisorKeeper.h"
+#include "SupervisorPool.h"
 #include "crane/PluginClient.h"
 #include "crane/String.h"
 #include "protos/PublicDefs.pb.h"
@@ -68,10 +70,10 @@ JobManager::JobManager() {
     CRANE_ERROR("Failed to start the SIGTERM handle: {}", uv_err_name(rc));
   }
 
-  m_check_supervisor_async_handle_ = m_uvw_loop_->resource<uvw::async_handle>();
-  m_check_supervisor_async_handle_->on<uvw::async_event>(
+  m_ev_cmd_async_handle_ = m_uvw_loop_->resource<uvw::async_handle>();
+  m_ev_cmd_async_handle_->on<uvw::async_event>(
       [this](const uvw::async_event&, uvw::async_handle&) {
-        EvCleanCheckSupervisorQueueCb_();
+        EvCleanCommandQueueCb_();
       });
 
   m_check_supervisor_timer_handle_ = m_uvw_loop_->resource<uvw::timer_handle>();
@@ -80,35 +82,6 @@ JobManager::JobManager() {
         if (EvCheckSupervisorRunning_()) handle.stop();
       });
 
-  // gRPC Execute Task Event
-  m_grpc_execute_step_async_handle_ =
-      m_uvw_loop_->resource<uvw::async_handle>();
-  m_grpc_execute_step_async_handle_->on<uvw::async_event>(
-      [this](const uvw::async_event&, uvw::async_handle&) {
-        EvCleanGrpcExecuteStepQueueCb_();
-      });
-
-  // Task Status Change Event
-  m_task_status_change_async_handle_ =
-      m_uvw_loop_->resource<uvw::async_handle>();
-  m_task_status_change_async_handle_->on<uvw::async_event>(
-      [this](const uvw::async_event&, uvw::async_handle&) {
-        EvCleanTaskStatusChangeQueueCb_();
-      });
-
-  m_change_task_time_limit_async_handle_ =
-      m_uvw_loop_->resource<uvw::async_handle>();
-  m_change_task_time_limit_async_handle_->on<uvw::async_event>(
-      [this](const uvw::async_event&, uvw::async_handle&) {
-        EvCleanChangeTaskTimeLimitQueueCb_();
-      });
-
-  m_terminate_step_async_handle_ = m_uvw_loop_->resource<uvw::async_handle>();
-  m_terminate_step_async_handle_->on<uvw::async_event>(
-      [this](const uvw::async_event&, uvw::async_handle&) {
-        EvCleanTerminateTaskQueueCb_();
-      });
-
   m_uvw_thread_ = std::thread([this]() {
     util::SetCurrentThreadName("JobMgrLoopThr");
     auto idle_handle = m_uvw_loop_->resource<uvw::idle_handle>();
@@ -203,17 +176,46 @@ CgroupInterface* JobManager::GetCgForJob(task_id_t job_id) {
   }
   if (job->cgroup) return job->cgroup.get();
 
-  auto cg_expt = CgroupManager::AllocateAndGetCgroup(
-      CgroupManager::CgroupStrByJobId(job->job_id), job->job_to_d.res(), false);
-  if (cg_expt.has_value()) {
-    job->cgroup = std::move(cg_expt.value());
-    return job->cgroup.get();
-  }
+  if (AllocJobCgroup_(job.get())) return job->cgroup.get();
 
   CRANE_ERROR("Failed to get cgroup for job#{}", job_id);
   return nullptr;
 }
 
+bool JobManager::AllocJobCgroup_(JobInD* job) {
+  const auto& res = job->job_to_d.res();
+  auto cg_expt = CgroupManager::AllocateAndGetCgroup(
+      CgroupManager::CgroupStrByJobId(job->job_id), res, false);
+  if (!cg_expt.has_value()) return false;
+  job->cgroup = std::move(cg_expt.value());
+
+  if (!g_cpu_binder) return true;
+
+  // The cpu quota still caps a job with a fractional cpu number.
+  const auto& alloc_res = res.allocatable_res_in_node();
+  auto cpu_num =
+      static_cast<uint32_t>(std::ceil(alloc_res.cpu_core_limit()));
+  auto binding = g_cpu_binder->Allocate(job->job_id, cpu_num,
+                                        alloc_res.memory_limit_bytes());
+  if (!binding) {
+    CRANE_WARN("[Job #{}] No {} free cpus to bind, running unbound.",
+               job->job_id, cpu_num);
+    return true;
+  }
+
+  std::string cpus = CpuBinder::CpuListToString(binding->cpus);
+  std::string mems = CpuBinder::CpuListToString(binding->mems);
+  if (!job->cgroup->SetCpuset(cpus, mems)) {
+    CRANE_WARN("[Job #{}] Failed to bind cpus {} and mems {}.", job->job_id,
+               cpus, mems);
+    g_cpu_binder->Free(job->job_id);
+    return true;
+  }
+  CRANE_DEBUG("[Job #{}] Bound to cpus {} and mems {}.", job->job_id, cpus,
+              mems);
+  return true;
+}
+
 // Wait for supervisor exit and release cgroup
 bool JobManager::FreeJobs(std::set<task_id_t>&& job_ids) {
   // We do noting here, just check if supervisor exist and remove its cgroup
@@ -227,26 +229,66 @@ bool JobManager::FreeJobs(std::set<task_id_t>&& job_ids) {
     }
   }
 
-  m_check_supervisor_queue_.enqueue(job_ids | std::ranges::to<std::vector>());
-  m_check_supervisor_async_handle_->send();
+  PushEvCommand_(EvQueueCheckSupervisorElem{
+      .job_ids = job_ids | std::ranges::to<std::vector>()});
   return true;
 }
 
-void JobManager::EvCleanCheckSupervisorQueueCb_() {
-  std::vector<task_id_t> job_ids;
+void JobManager::PushEvCommand_(EvCommand&& cmd) {
+  bool was_empty;
+  {
+    absl::MutexLock lk(&m_ev_cmd_mtx_);
+    was_empty = m_ev_cmd_queue_.empty();
+    m_ev_cmd_queue_.push_back(
+        {.cmd = std::move(cmd),
+         .enqueue_time = std::chrono::steady_clock::now()});
+  }
+  if (was_empty) m_ev_cmd_async_handle_->send();
+}
+
+void JobManager::EvCleanCommandQueueCb_() {
+  std::vector<EvQueuedCommand> cmds;
+  {
+    absl::MutexLock lk(&m_ev_cmd_mtx_);
+    cmds.swap(m_ev_cmd_queue_);
+  }
+
+  for (auto& [cmd, enqueue_time] : cmds) {
+    RecordEvCommandLatency_(cmd.index(),
+                            std::chrono::steady_clock::now() - enqueue_time);
+    std::visit([this](auto& elem) { EvHandleCommand_(elem); }, cmd);
+  }
+}
+
+void JobManager::RecordEvCommandLatency_(
+    size_t kind, std::chrono::steady_clock::duration latency) {
+  auto us = static_cast<uint64_t>(std::max<int64_t>(
+      std::chrono::duration_cast<std::chrono::microseconds>(latency).count(),
+      0));
+  EvCommandLatency& stat = m_ev_cmd_latency_[kind];
+  ++stat.count;
+  stat.sum_us += us;
+  stat.max_us = std::max(stat.max_us, us);
+
+  constexpr uint64_t kLatencyReportInterval = 1000;
+  if (stat.count % kLatencyReportInterval == 0)
+    CRANE_DEBUG("[JobMgr] {} queue latency: n={} avg={}us max={}us",
+                kEvCommandNames[kind], stat.count, stat.sum_us / stat.count,
+                stat.max_us);
+}
+
+void JobManager::EvHandleCommand_(EvQueueCheckSupervisorElem& elem) {
   absl::MutexLock lk(&m_release_cg_mtx_);
-  while (m_check_supervisor_queue_.try_dequeue(job_ids)) {
-    for (task_id_t job_id : job_ids) {
-      if (m_release_job_retry_map_.contains(job_id)) {
-        CRANE_DEBUG("[Job #{}] already waiting to release, ignored.", job_id);
-        continue;
-      }
-      m_release_job_retry_map_.emplace(job_id, 0);
+  for (task_id_t job_id : elem.job_ids) {
+    if (m_release_job_retry_map_.contains(job_id)) {
+      CRANE_DEBUG("[Job #{}] already waiting to release, ignored.", job_id);
+      continue;
     }
-    if (!m_check_supervisor_timer_handle_->active())
-      m_check_supervisor_timer_handle_->start(uvw::timer_handle::time{0},
-                                              uvw::timer_handle::time{1000});
+    m_release_job_retry_map_.emplace(job_id, 0);
   }
+  if (!m_check_supervisor_timer_handle_->active())
+    m_check_supervisor_timer_handle_->start(uvw::timer_handle::time{0},
+                                            uvw::timer_handle::time{1000});
 }
 
 bool JobManager::EvCheckSupervisorRunning_() {
@@ -369,6 +411,67 @@ void JobManager::SetSigintCallback(std::function<void()> cb) {
 }
 
 CraneErrCode JobManager::SpawnSupervisor_(JobInD* job, StepInstance* step) {
+  auto start = std::chrono::steady_clock::now();
+
+  std::optional<WarmSupervisor> warm = g_supervisor_pool->Take();
+  CraneErrCode code = warm.has_value()
+                          ? BindWarmSupervisor_(job, step, warm.value())
+                          : SpawnColdSupervisor_(job, step);
+
+  static auto& registry = util::metrics::DefaultRegistry();
+  constexpr const char* kLaunchHelp = "Latency of launching the supervisor.";
+  static util::metrics::Histogram* const warm_latency = registry.GetHistogram(
+      "crane_craned_step_launch_seconds", kLaunchHelp,
+      {{"supervisor", "warm"}});
+  static util::metrics::Histogram* const cold_latency = registry.GetHistogram(
+      "crane_craned_step_launch_seconds", kLaunchHelp,
+      {{"supervisor", "cold"}});
+  static util::metrics::Counter* const launch_failures = registry.GetCounter(
+      "crane_craned_step_launch_failures_total",
+      "Number of steps whose supervisor failed to launch.");
+
+  if (code == CraneErrCode::SUCCESS) {
+    auto latency = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start);
+    g_supervisor_pool->RecordLaunchLatency(step->step_to_d.task_id(),
+                                           warm.has_value(), latency);
+    (warm.has_value() ? warm_latency : cold_latency)->ObserveDuration(latency);
+  } else {
+    launch_failures->Inc();
+  }
+
+  return code;
+}
+
+CraneErrCode JobManager::BindWarmSupervisor_(JobInD* job, StepInstance* step,
+                                            const WarmSupervisor& supervisor) {
+  task_id_t task_id = step->step_to_d.task_id();
+  CRANE_DEBUG("Warm supervisor {} was taken for task #{}", supervisor.pid,
+              task_id);
+
+  // The supervisor is already running, so all of its threads are moved into
+  // the job cgroup together with it. Processes it forks later inherit the
+  // cgroup as in the cold path.
+  if (!job->cgroup->MigrateProcIn(supervisor.pid)) {
+    CRANE_ERROR(
+        "[Task #{}] Terminate warm supervisor {} due to failure of cgroup "
+        "migration.",
+        task_id, supervisor.pid);
+
+    job->err_before_supervisor_ready = CraneErrCode::ERR_CGROUP;
+    KillPid_(supervisor.pid, SIGKILL);
+    close(supervisor.to_supervisor_fd);
+    close(supervisor.from_supervisor_fd);
+    return CraneErrCode::ERR_CGROUP;
+  }
+
+  return InitSupervisor_(job, step, supervisor.pid,
+                         supervisor.to_supervisor_fd,
+                         supervisor.from_supervisor_fd);
+}
+
+CraneErrCode JobManager::SpawnColdSupervisor_(JobInD* job,
+                                             StepInstance* step) {
   using google::protobuf::io::FileInputStream;
   using google::protobuf::io::FileOutputStream;
   using google::protobuf::util::ParseDelimitedFromZeroCopyStream;
@@ -493,105 +596,8 @@ CraneErrCode JobManager::SpawnSupervisor_(JobInD* job, StepInstance* step) {
       return CraneErrCode::ERR_PROTOBUF;
     }
 
-    // Do Supervisor Init
-    crane::grpc::supervisor::InitSupervisorRequest init_req;
-    init_req.set_job_id(task_id);
-    init_req.set_debug_level(g_config.Supervisor.DebugLevel);
-    init_req.set_craned_id(g_config.CranedIdOfThisNode);
-    init_req.set_craned_unix_socket_path(g_config.CranedUnixSockPath);
-    init_req.set_crane_base_dir(g_config.CraneBaseDir);
-    init_req.set_crane_script_dir(g_config.CranedScriptDir);
-    init_req.mutable_step_spec()->CopyFrom(step->step_to_d);
-    init_req.set_log_dir(g_config.Supervisor.LogDir);
-    auto* cfored_listen_conf = init_req.mutable_cfored_listen_conf();
-    cfored_listen_conf->set_use_tls(g_config.ListenConf.TlsConfig.Enabled);
-    cfored_listen_conf->set_domain_suffix(
-        g_config.ListenConf.TlsConfig.DomainSuffix);
-    auto* tls_certs = cfored_listen_conf->mutable_tls_certs();
-    tls_certs->set_cert_content(
-        g_config.ListenConf.TlsConfig.TlsCerts.CertContent);
-    tls_certs->set_ca_content(g_config.ListenConf.TlsConfig.TlsCerts.CaContent);
-    tls_certs->set_key_content(
-        g_config.ListenConf.TlsConfig.TlsCerts.KeyContent);
-
-    // Pass job env to supervisor
-    EnvMap res_env_map = job->GetJobEnvMap();
-    init_req.mutable_env()->clear();
-    init_req.mutable_env()->insert(res_env_map.begin(), res_env_map.end());
-
-    if (g_config.Container.Enabled) {
-      auto* container_conf = init_req.mutable_container_config();
-      container_conf->set_temp_dir(g_config.Container.TempDir);
-      container_conf->set_runtime_bin(g_config.Container.RuntimeBin);
-      container_conf->set_state_cmd(g_config.Container.RuntimeState);
-      container_conf->set_run_cmd(g_config.Container.RuntimeRun);
-      container_conf->set_kill_cmd(g_config.Container.RuntimeKill);
-      container_conf->set_delete_cmd(g_config.Container.RuntimeDelete);
-    }
-
-    if (g_config.Plugin.Enabled) {
-      auto* plugin_conf = init_req.mutable_plugin_config();
-      plugin_conf->set_socket_path(g_config.Plugin.PlugindSockPath);
-    }
-
-    ok = SerializeDelimitedToZeroCopyStream(init_req, &ostream);
-    if (!ok) {
-      CRANE_ERROR("[Task #{}] Failed to serialize msg to ostream: {}", task_id,
-                  strerror(ostream.GetErrno()));
-    }
-
-    if (ok) ok &= ostream.Flush();
-    if (!ok) {
-      CRANE_ERROR("[Task #{}] Failed to send init msg to supervisor: {}",
-                  child_pid, task_id, strerror(ostream.GetErrno()));
-
-      job->err_before_supervisor_ready = CraneErrCode::ERR_PROTOBUF;
-      KillPid_(child_pid, SIGKILL);
-
-      close(craned_supervisor_fd);
-      close(supervisor_craned_fd);
-      return CraneErrCode::ERR_PROTOBUF;
-    }
-
-    CRANE_TRACE("[Task #{}] Supervisor init msg send.", task_id);
-
-    crane::grpc::supervisor::SupervisorReady supervisor_ready;
-    ok = ParseDelimitedFromZeroCopyStream(&supervisor_ready, &istream, nullptr);
-    if (!ok || !supervisor_ready.ok()) {
-      if (!ok)
-        CRANE_ERROR("[Task #{}] Pipe child endpoint failed: {}", task_id,
-                    strerror(istream.GetErrno()));
-      if (!supervisor_ready.ok())
-        CRANE_ERROR("[Task #{}] False from subprocess {}.", child_pid, task_id);
-
-      job->err_before_supervisor_ready = CraneErrCode::ERR_PROTOBUF;
-      KillPid_(child_pid, SIGKILL);
-
-      close(craned_supervisor_fd);
-      close(supervisor_craned_fd);
-      return CraneErrCode::ERR_PROTOBUF;
-    }
-
-    close(craned_supervisor_fd);
-    close(supervisor_craned_fd);
-
-    CRANE_TRACE("[Task #{}] Supervisor init msg received.", task_id);
-    g_supervisor_keeper->AddSupervisor(task_id);
-
-    auto stub = g_supervisor_keeper->GetStub(task_id);
-    auto code = stub->ExecuteTask();
-    if (code != CraneErrCode::SUCCESS) {
-      CRANE_ERROR("[Job #{}] Supervisor failed to execute task, code:{}.",
-                  task_id, static_cast<int>(code));
-      KillPid_(child_pid, SIGKILL);
-      close(craned_supervisor_fd);
-      close(supervisor_craned_fd);
-      return CraneErrCode::ERR_SUPERVISOR;
-    }
-
-    // TODO: replace this with step_id
-    step->supv_pid = child_pid;
-    return CraneErrCode::SUCCESS;
+    return InitSupervisor_(job, step, child_pid, craned_supervisor_fd,
+                           supervisor_craned_fd);
   } else {  // Child proc, NOLINT(readability-else-after-return)
     // Disable SIGABRT backtrace from child processes.
     signal(SIGABRT, SIG_DFL);
@@ -665,6 +671,129 @@ CraneErrCode JobManager::SpawnSupervisor_(JobInD* job, StepInstance* step) {
   }
 }
 
+CraneErrCode JobManager::InitSupervisor_(JobInD* job, StepInstance* step,
+                                        pid_t child_pid,
+                                        int craned_supervisor_fd,
+                                        int supervisor_craned_fd) {
+  using google::protobuf::io::FileInputStream;
+  using google::protobuf::io::FileOutputStream;
+  using google::protobuf::util::ParseDelimitedFromZeroCopyStream;
+  using google::protobuf::util::SerializeDelimitedToZeroCopyStream;
+
+  task_id_t task_id = step->step_to_d.task_id();
+
+  FileInputStream istream(supervisor_craned_fd);
+  FileOutputStream ostream(craned_supervisor_fd);
+
+  crane::grpc::supervisor::InitSupervisorRequest init_req;
+  init_req.set_job_id(task_id);
+  init_req.set_debug_level(g_config.Supervisor.DebugLevel);
+  init_req.set_craned_id(g_config.CranedIdOfThisNode);
+  init_req.set_craned_unix_socket_path(g_config.CranedUnixSockPath);
+  init_req.set_crane_base_dir(g_config.CraneBaseDir);
+  init_req.set_crane_script_dir(g_config.CranedScriptDir);
+  init_req.mutable_step_spec()->CopyFrom(step->step_to_d);
+  init_req.set_log_dir(g_config.Supervisor.LogDir);
+  auto* cfored_listen_conf = init_req.mutable_cfored_listen_conf();
+  cfored_listen_conf->set_use_tls(g_config.ListenConf.TlsConfig.Enabled);
+  cfored_listen_conf->set_domain_suffix(
+      g_config.ListenConf.TlsConfig.DomainSuffix);
+  auto* tls_certs = cfored_listen_conf->mutable_tls_certs();
+  tls_certs->set_cert_content(
+      g_config.ListenConf.TlsConfig.TlsCerts.CertContent);
+  tls_certs->set_ca_content(g_config.ListenConf.TlsConfig.TlsCerts.CaContent);
+  tls_certs->set_key_content(
+      g_config.ListenConf.TlsConfig.TlsCerts.KeyContent);
+
+  // Pass job env to supervisor
+  EnvMap res_env_map = job->GetJobEnvMap();
+  init_req.mutable_env()->clear();
+  init_req.mutable_env()->insert(res_env_map.begin(), res_env_map.end());
+
+  if (g_config.Container.Enabled) {
+    auto* container_conf = init_req.mutable_container_config();
+    container_conf->set_temp_dir(g_config.Container.TempDir);
+    container_conf->set_runtime_bin(g_config.Container.RuntimeBin);
+    container_conf->set_state_cmd(g_config.Container.RuntimeState);
+    container_conf->set_run_cmd(g_config.Container.RuntimeRun);
+    container_conf->set_kill_cmd(g_config.Container.RuntimeKill);
+    container_conf->set_delete_cmd(g_config.Container.RuntimeDelete);
+    container_conf->set_bundle_cache_dir(g_config.Container.BundleCacheDir);
+    container_conf->set_bundle_cache_quota(
+        g_config.Container.BundleCacheQuota);
+  }
+
+  if (g_config.OutputSpool.Enabled) {
+    auto* spool_conf = init_req.mutable_output_spool_config();
+    spool_conf->set_spool_dir(g_config.OutputSpool.SpoolDir);
+    spool_conf->set_flush_threshold(g_config.OutputSpool.FlushThreshold);
+  }
+
+  if (g_config.Plugin.Enabled) {
+    auto* plugin_conf = init_req.mutable_plugin_config();
+    plugin_conf->set_socket_path(g_config.Plugin.PlugindSockPath);
+    plugin_conf->set_max_queued_events(g_config.Plugin.MaxQueuedEvents);
+    plugin_conf->set_block_on_queue_full(g_config.Plugin.BlockOnQueueFull);
+  }
+
+  bool ok = SerializeDelimitedToZeroCopyStream(init_req, &ostream);
+  if (!ok) {
+    CRANE_ERROR("[Task #{}] Failed to serialize msg to ostream: {}", task_id,
+                strerror(ostream.GetErrno()));
+  }
+
+  if (ok) ok &= ostream.Flush();
+  if (!ok) {
+    CRANE_ERROR("[Task #{}] Failed to send init msg to supervisor: {}",
+                child_pid, task_id, strerror(ostream.GetErrno()));
+
+    job->err_before_supervisor_ready = CraneErrCode::ERR_PROTOBUF;
+    KillPid_(child_pid, SIGKILL);
+
+    close(craned_supervisor_fd);
+    close(supervisor_craned_fd);
+    return CraneErrCode::ERR_PROTOBUF;
+  }
+
+  CRANE_TRACE("[Task #{}] Supervisor init msg send.", task_id);
+
+  crane::grpc::supervisor::SupervisorReady supervisor_ready;
+  ok = ParseDelimitedFromZeroCopyStream(&supervisor_ready, &istream, nullptr);
+  if (!ok || !supervisor_ready.ok()) {
+    if (!ok)
+      CRANE_ERROR("[Task #{}] Pipe child endpoint failed: {}", task_id,
+                  strerror(istream.GetErrno()));
+    if (!supervisor_ready.ok())
+      CRANE_ERROR("[Task #{}] False from subprocess {}.", child_pid, task_id);
+
+    job->err_before_supervisor_ready = CraneErrCode::ERR_PROTOBUF;
+    KillPid_(child_pid, SIGKILL);
+
+    close(craned_supervisor_fd);
+    close(supervisor_craned_fd);
+    return CraneErrCode::ERR_PROTOBUF;
+  }
+
+  close(craned_supervisor_fd);
+  close(supervisor_craned_fd);
+
+  CRANE_TRACE("[Task #{}] Supervisor init msg received.", task_id);
+  g_supervisor_keeper->AddSupervisor(task_id);
+
+  auto stub = g_supervisor_keeper->GetStub(task_id);
+  auto code = stub->ExecuteTask();
+  if (code != CraneErrCode::SUCCESS) {
+    CRANE_ERROR("[Job #{}] Supervisor failed to execute task, code:{}.",
+                task_id, static_cast<int>(code));
+    KillPid_(child_pid, SIGKILL);
+    return CraneErrCode::ERR_SUPERVISOR;
+  }
+
+  // TODO: replace this with step_id
+  step->supv_pid = child_pid;
+  return CraneErrCode::SUCCESS;
+}
+
 CraneErrCode JobManager::ExecuteStepAsync(StepToD const& step) {
   if (m_is_ending_now_.load(std::memory_order_acquire)) {
     return CraneErrCode::ERR_SHUTTING_DOWN;
@@ -682,32 +811,55 @@ CraneErrCode JobManager::ExecuteStepAsync(StepToD const& step) {
   // in the corresponding handler (EvGrpcExecuteTaskCb_).
   auto step_inst = std::make_unique<StepInstance>();
   step_inst->step_to_d = step;
-  EvQueueExecuteStepElem elem{.step_inst = std::move(step_inst)};
-
-  m_grpc_execute_step_queue_.enqueue(std::move(elem));
-  m_grpc_execute_step_async_handle_->send();
+  PushEvCommand_(EvQueueExecuteStepElem{.step_inst = std::move(step_inst)});
 
   return CraneErrCode::SUCCESS;
 }
 
-void JobManager::EvCleanGrpcExecuteStepQueueCb_() {
-  EvQueueExecuteStepElem elem;
+void JobManager::EvHandleCommand_(EvQueueExecuteStepElem& elem) {
+  // Once ExecuteTask RPC is processed, the Execution goes into m_job_map_.
+  std::unique_ptr execution = std::move(elem.step_inst);
 
-  while (m_grpc_execute_step_queue_.try_dequeue(elem)) {
-    // Once ExecuteTask RPC is processed, the Execution goes into m_job_map_.
-    std::unique_ptr execution = std::move(elem.step_inst);
+  if (!m_job_map_.Contains(execution->step_to_d.task_id())) {
+    CRANE_ERROR("Failed to find job #{} allocation",
+                execution->step_to_d.task_id());
+    elem.ok_prom.set_value(CraneErrCode::ERR_CGROUP);
+    return;
+  }
+  elem.ok_prom.set_value(CraneErrCode::SUCCESS);
 
-    if (!m_job_map_.Contains(execution->step_to_d.task_id())) {
-      CRANE_ERROR("Failed to find job #{} allocation",
-                  execution->step_to_d.task_id());
-      elem.ok_prom.set_value(CraneErrCode::ERR_CGROUP);
-      continue;
+  LaunchStepAsync_(std::move(execution));
+}
+
+void JobManager::LaunchStepAsync_(std::unique_ptr<StepInstance> step) {
+  job_id_t job_id = step->step_to_d.task_id();
+  {
+    absl::MutexLock lock_guard(&m_pending_launch_mtx_);
+    auto [it, inserted] = m_pending_launch_steps_.try_emplace(job_id);
+    it->second.emplace_back(std::move(step));
+    // The worker launching the previous steps of this job picks it up.
+    if (!inserted) return;
+  }
+
+  m_step_launch_pool_.detach_task(
+      [this, job_id] { LaunchStepsOfJobMt_(job_id); });
+}
+
+void JobManager::LaunchStepsOfJobMt_(job_id_t job_id) {
+  while (true) {
+    std::unique_ptr<StepInstance> step;
+    {
+      absl::MutexLock lock_guard(&m_pending_launch_mtx_);
+      auto it = m_pending_launch_steps_.find(job_id);
+      if (it->second.empty()) {
+        m_pending_launch_steps_.erase(it);
+        return;
+      }
+      step = std::move(it->second.front());
+      it->second.pop_front();
     }
-    elem.ok_prom.set_value(CraneErrCode::SUCCESS);
 
-    g_thread_pool->detach_task([this, execution = execution.release()] {
-      LaunchStepMt_(std::unique_ptr<StepInstance>(execution));
-    });
+    LaunchStepMt_(std::move(step));
   }
 }
 
@@ -723,6 +875,7 @@ bool JobManager::FreeJobAllocation_(const std::vector<task_id_t>& job_ids) {
       job_cg_map[job_id] = job->cgroup.release();
       uid_vec.push_back(job->Uid());
       map_ptr->erase(job_id);
+      if (g_cpu_binder) g_cpu_binder->Free(job_id);
     }
   }
   {
@@ -801,12 +954,7 @@ void JobManager::LaunchStepMt_(std::unique_ptr<StepInstance> step) {
   }
 
   if (!job->cgroup) {
-    auto cg_expt = CgroupManager::AllocateAndGetCgroup(
-        CgroupManager::CgroupStrByJobId(job->job_id), job->job_to_d.res(),
-        false);
-    if (cg_expt.has_value()) {
-      job->cgroup = std::move(cg_expt.value());
-    } else {
+    if (!AllocJobCgroup_(job)) {
       CRANE_ERROR("Failed to get cgroup for job#{}", job_id);
       ActivateTaskStatusChangeAsync_(
           job_id, crane::grpc::TaskStatus::Failed,
@@ -840,22 +988,18 @@ void JobManager::LaunchStepMt_(std::unique_ptr<StepInstance> step) {
   }
 }
 
-void JobManager::EvCleanTaskStatusChangeQueueCb_() {
-  TaskStatusChangeQueueElem status_change;
-  while (m_task_status_change_queue_.try_dequeue(status_change)) {
-    auto job_ptr = m_job_map_.GetValueExclusivePtr(status_change.step_id);
-    if (!job_ptr) {
-      // When Ctrl+C is pressed for Craned, all tasks including just forked
-      // tasks will be terminated.
-      // In some error cases, a double TaskStatusChange might be triggered.
-      // Just ignore it. See comments in SpawnProcessInInstance_().
-      continue;
-    }
-
-    bool orphaned = job_ptr->orphaned;
-    if (!orphaned)
-      g_ctld_client->StepStatusChangeAsync(std::move(status_change));
+void JobManager::EvHandleCommand_(TaskStatusChangeQueueElem& status_change) {
+  auto job_ptr = m_job_map_.GetValueExclusivePtr(status_change.step_id);
+  if (!job_ptr) {
+    // When Ctrl+C is pressed for Craned, all tasks including just forked
+    // tasks will be terminated.
+    // In some error cases, a double TaskStatusChange might be triggered.
+    // Just ignore it. See comments in SpawnProcessInInstance_().
+    return;
   }
+
+  bool orphaned = job_ptr->orphaned;
+  if (!orphaned) g_ctld_client->StepStatusChangeAsync(std::move(status_change));
 }
 
 void JobManager::ActivateTaskStatusChangeAsync_(
@@ -864,8 +1008,7 @@ void JobManager::ActivateTaskStatusChangeAsync_(
   TaskStatusChangeQueueElem status_change{task_id, new_status, exit_code};
   if (reason.has_value()) status_change.reason = std::move(reason);
 
-  m_task_status_change_queue_.enqueue(std::move(status_change));
-  m_task_status_change_async_handle_->send();
+  PushEvCommand_(std::move(status_change));
 }
 
 /**
@@ -912,80 +1055,75 @@ std::optional<TaskInfoOfUid> JobManager::QueryTaskInfoOfUid(uid_t uid) {
   return info;
 }
 
-void JobManager::EvCleanTerminateTaskQueueCb_() {
-  StepTerminateQueueElem elem;
-  while (m_step_terminate_queue_.try_dequeue(elem)) {
-    CRANE_TRACE(
-        "Receive TerminateRunningTask Request from internal queue. "
-        "Task id: {}",
-        elem.step_id);
-
-    auto job_instance = m_job_map_.GetValueExclusivePtr(elem.step_id);
-    if (!job_instance || job_instance->step_map.empty()) {
-      CRANE_DEBUG("Terminating a non-existent task #{}.", elem.step_id);
-
-      // Note if Ctld wants to terminate some tasks that are not running,
-      // it might indicate other nodes allocated to the task might have
-      // crashed. We should mark the task as kind of not runnable by removing
-      // its cgroup.
-      //
-      // Considering such a situation:
-      // In Task Scheduler of Ctld,
-      // the task index from node id to task id have just been added and
-      // Ctld are sending CreateCgroupForTasks.
-      // Right at the moment, one Craned allocated to this task and
-      // designated as the executing node crashes,
-      // but it has been sent a CreateCgroupForTasks and replied.
-      // Then the CranedKeeper search the task index and
-      // send TerminateTasksOnCraned to all Craned allocated to this task
-      // including this node.
-      // In order to give Ctld kind of feedback without adding complicated
-      // synchronizing mechanism in ScheduleThread_(),
-      // we just remove the cgroup for such task, Ctld will fail in the
-      // following ExecuteTasks and the task will go to the right place as
-      // well as the completed queue.
-
-      if (job_instance)
-        FreeJobAllocation_({job_instance->job_id});
-      else {
-        ActivateTaskStatusChangeAsync_(
-            elem.step_id, crane::grpc::TaskStatus::Cancelled,
-            ExitCode::kExitCodeTerminated, "Job not found.");
-      }
-      continue;
-    }
-
-    auto* instance = job_instance.get();
-    instance->orphaned = elem.mark_as_orphaned;
-
-    auto stub = g_supervisor_keeper->GetStub(elem.step_id);
-    if (!stub) {
-      CRANE_ERROR("Supervisor for task #{} not found", elem.step_id);
-      continue;
-    }
-    auto err =
-        stub->TerminateTask(elem.mark_as_orphaned, elem.terminated_by_user);
-    if (err != CraneErrCode::SUCCESS) {
-      CRANE_ERROR("Failed to terminate task #{}", elem.step_id);
-      // Supervisor dead for some reason.
-      g_supervisor_keeper->RemoveSupervisor(elem.step_id);
+void JobManager::EvHandleCommand_(StepTerminateQueueElem& elem) {
+  CRANE_TRACE(
+      "Receive TerminateRunningTask Request from internal queue. "
+      "Task id: {}",
+      elem.step_id);
+
+  auto job_instance = m_job_map_.GetValueExclusivePtr(elem.step_id);
+  if (!job_instance || job_instance->step_map.empty()) {
+    CRANE_DEBUG("Terminating a non-existent task #{}.", elem.step_id);
+
+    // Note if Ctld wants to terminate some tasks that are not running,
+    // it might indicate other nodes allocated to the task might have
+    // crashed. We should mark the task as kind of not runnable by removing
+    // its cgroup.
+    //
+    // Considering such a situation:
+    // In Task Scheduler of Ctld,
+    // the task index from node id to task id have just been added and
+    // Ctld are sending CreateCgroupForTasks.
+    // Right at the moment, one Craned allocated to this task and
+    // designated as the executing node crashes,
+    // but it has been sent a CreateCgroupForTasks and replied.
+    // Then the CranedKeeper search the task index and
+    // send TerminateTasksOnCraned to all Craned allocated to this task
+    // including this node.
+    // In order to give Ctld kind of feedback without adding complicated
+    // synchronizing mechanism in ScheduleThread_(),
+    // we just remove the cgroup for such task, Ctld will fail in the
+    // following ExecuteTasks and the task will go to the right place as
+    // well as the completed queue.
+
+    if (job_instance)
+      FreeJobAllocation_({job_instance->job_id});
+    else {
       ActivateTaskStatusChangeAsync_(
           elem.step_id, crane::grpc::TaskStatus::Cancelled,
-          ExitCode::kExitCodeTerminated, "Terminated failed.");
+          ExitCode::kExitCodeTerminated, "Job not found.");
     }
+    return;
+  }
+
+  auto* instance = job_instance.get();
+  instance->orphaned = elem.mark_as_orphaned;
+
+  auto stub = g_supervisor_keeper->GetStub(elem.step_id);
+  if (!stub) {
+    CRANE_ERROR("Supervisor for task #{} not found", elem.step_id);
+    return;
+  }
+  auto err =
+      stub->TerminateTask(elem.mark_as_orphaned, elem.terminated_by_user);
+  if (err != CraneErrCode::SUCCESS) {
+    CRANE_ERROR("Failed to terminate task #{}", elem.step_id);
+    // Supervisor dead for some reason.
+    g_supervisor_keeper->RemoveSupervisor(elem.step_id);
+    ActivateTaskStatusChangeAsync_(
+        elem.step_id, crane::grpc::TaskStatus::Cancelled,
+        ExitCode::kExitCodeTerminated, "Terminated failed.");
   }
 }
 
 void JobManager::TerminateStepAsync(step_id_t step_id) {
   StepTerminateQueueElem elem{.step_id = step_id, .terminated_by_user = true};
-  m_step_terminate_queue_.enqueue(std::move(elem));
-  m_terminate_step_async_handle_->send();
+  PushEvCommand_(std::move(elem));
 }
 
 void JobManager::MarkStepAsOrphanedAndTerminateAsync(step_id_t step_id) {
   StepTerminateQueueElem elem{.step_id = step_id, .mark_as_orphaned = true};
-  m_step_terminate_queue_.enqueue(std::move(elem));
-  m_terminate_step_async_handle_->send();
+  PushEvCommand_(std::move(elem));
 }
 
 bool JobManager::ChangeJobTimeLimitAsync(job_id_t job_id,
@@ -996,8 +1134,7 @@ bool JobManager::ChangeJobTimeLimitAsync(job_id_t job_id,
   ChangeTaskTimeLimitQueueElem elem{.job_id = job_id, .time_limit = time_limit};
 
   std::future<bool> ok_fut = elem.ok_prom.get_future();
-  m_task_time_limit_change_queue_.enqueue(std::move(elem));
-  m_change_task_time_limit_async_handle_->send();
+  PushEvCommand_(std::move(elem));
   return ok_fut.get();
 }
 
@@ -1014,27 +1151,26 @@ void JobManager::StepStopAndDoStatusChangeAsync(
                                  std::move(reason));
 }
 
-void JobManager::EvCleanChangeTaskTimeLimitQueueCb_() {
-  ChangeTaskTimeLimitQueueElem elem;
-  while (m_task_time_limit_change_queue_.try_dequeue(elem)) {
-    if (auto job_ptr = m_job_map_.GetValueExclusivePtr(elem.job_id); job_ptr) {
-      auto stub = g_supervisor_keeper->GetStub(elem.job_id);
-      if (!stub) {
-        CRANE_ERROR("Supervisor for task #{} not found", elem.job_id);
-        continue;
-      }
-      auto err = stub->ChangeTaskTimeLimit(elem.time_limit);
-      if (err != CraneErrCode::SUCCESS) {
-        CRANE_ERROR("Failed to change task time limit for task #{}",
-                    elem.job_id);
-        continue;
-      }
-      elem.ok_prom.set_value(true);
-    } else {
-      CRANE_ERROR("Try to update the time limit of a non-existent task #{}.",
+void JobManager::EvHandleCommand_(ChangeTaskTimeLimitQueueElem& elem) {
+  if (auto job_ptr = m_job_map_.GetValueExclusivePtr(elem.job_id); job_ptr) {
+    auto stub = g_supervisor_keeper->GetStub(elem.job_id);
+    if (!stub) {
+      CRANE_ERROR("Supervisor for task #{} not found", elem.job_id);
+      elem.ok_prom.set_value(false);
+      return;
+    }
+    auto err = stub->ChangeTaskTimeLimit(elem.time_limit);
+    if (err != CraneErrCode::SUCCESS) {
+      CRANE_ERROR("Failed to change task time limit for task #{}",
                   elem.job_id);
       elem.ok_prom.set_value(false);
+      return;
     }
+    elem.ok_prom.set_value(true);
+  } else {
+    CRANE_ERROR("Try to update the time limit of a non-existent task #{}.",
+                elem.job_id);
+    elem.ok_prom.set_value(false);
   }
 }
 
@@ -31,9 +31,14 @@
 namespace Craned {
 
 constexpr int kMaxSupervisorCheckRetryCount = 10;
+// Launching a step mostly waits for the supervisor to come up, so the number
+// of launch workers does not follow the number of cores.
+constexpr uint32_t kStepLaunchWorkerNum = 32;
 // TODO: Replace this with tak execution info.
 using StepToD = crane::grpc::TaskToD;
 
+struct WarmSupervisor;
+
 struct StepInstance {
   StepToD step_to_d;
   pid_t supv_pid;
@@ -159,12 +164,63 @@ class JobManager {
     std::promise<std::pair<bool, crane::grpc::TaskStatus>> status_prom;
   };
 
+  struct EvQueueCheckSupervisorElem {
+    std::vector<task_id_t> job_ids;
+  };
+
+  // All the commands to the event loop go through one queue, so that those
+  // of a job are handled in the order they are issued whatever their kinds.
+  using EvCommand =
+      std::variant<EvQueueExecuteStepElem, TaskStatusChangeQueueElem,
+                   StepTerminateQueueElem, ChangeTaskTimeLimitQueueElem,
+                   EvQueueCheckSupervisorElem>;
+  static constexpr std::array<std::string_view,
+                              std::variant_size_v<EvCommand>>
+      kEvCommandNames{"ExecuteStep", "StatusChange", "TerminateStep",
+                      "ChangeTimeLimit", "CheckSupervisor"};
+
+  struct EvQueuedCommand {
+    EvCommand cmd;
+    std::chrono::steady_clock::time_point enqueue_time;
+  };
+
+  // Time commands of a kind waited in the queue. Only touched by the loop.
+  struct EvCommandLatency {
+    uint64_t count{0};
+    uint64_t sum_us{0};
+    uint64_t max_us{0};
+  };
+
   bool FreeJobAllocation_(const std::vector<task_id_t>& job_ids);
 
+  // Create the cgroup of the job and bind the job to cpus of its own if cpu
+  // binding is enabled.
+  bool AllocJobCgroup_(JobInD* job);
+
+  // Queue the step behind the other steps of its job and make sure a launch
+  // worker is draining that queue.
+  void LaunchStepAsync_(std::unique_ptr<StepInstance> step);
+
+  // Launch the queued steps of the job in order until none is left.
+  void LaunchStepsOfJobMt_(job_id_t job_id);
+
   void LaunchStepMt_(std::unique_ptr<StepInstance> step);
 
+  // Launch the supervisor of a step, either by binding an idle one taken
+  // from g_supervisor_pool or by spawning a new one.
   CraneErrCode SpawnSupervisor_(JobInD* job, StepInstance* step);
 
+  CraneErrCode SpawnColdSupervisor_(JobInD* job, StepInstance* step);
+
+  CraneErrCode BindWarmSupervisor_(JobInD* job, StepInstance* step,
+                                   const WarmSupervisor& supervisor);
+
+  // Send the InitSupervisorRequest of the step over the init pipes, wait for
+  // the supervisor to be ready and start the task. Closes the fds.
+  CraneErrCode InitSupervisor_(JobInD* job, StepInstance* step,
+                               pid_t child_pid, int craned_supervisor_fd,
+                               int supervisor_craned_fd);
+
   /**
    * Inform CraneCtld of the status change of a task.
    * This method is called when the status of a task is changed:
@@ -199,7 +255,15 @@ class JobManager {
                       absl::flat_hash_set<job_id_t>>
       m_uid_to_job_ids_map_;
 
-  void EvCleanCheckSupervisorQueueCb_();
+  // Wake the loop up only if the queue was empty. The loop takes all the
+  // queued commands at once.
+  void PushEvCommand_(EvCommand&& cmd);
+
+  void EvCleanCommandQueueCb_();
+  void RecordEvCommandLatency_(size_t kind,
+                               std::chrono::steady_clock::duration latency);
+
+  void EvHandleCommand_(EvQueueCheckSupervisorElem& elem);
   bool EvCheckSupervisorRunning_();
 
   void EvSigchldCb_();
@@ -207,13 +271,13 @@ class JobManager {
   // Callback function to handle SIGINT sent by Ctrl+C
   void EvSigintCb_();
 
-  void EvCleanGrpcExecuteStepQueueCb_();
+  void EvHandleCommand_(EvQueueExecuteStepElem& elem);
 
-  void EvCleanTaskStatusChangeQueueCb_();
+  void EvHandleCommand_(TaskStatusChangeQueueElem& status_change);
 
-  void EvCleanTerminateTaskQueueCb_();
+  void EvHandleCommand_(StepTerminateQueueElem& elem);
 
-  void EvCleanChangeTaskTimeLimitQueueCb_();
+  void EvHandleCommand_(ChangeTaskTimeLimitQueueElem& elem);
 
   std::shared_ptr<uvw::loop> m_uvw_loop_;
 
@@ -227,25 +291,16 @@ class JobManager {
   absl::Mutex m_release_cg_mtx_;
   std::unordered_map<task_id_t, int /*retry count*/> m_release_job_retry_map_
       ABSL_GUARDED_BY(m_release_cg_mtx_);
-  ConcurrentQueue<std::vector<task_id_t>> m_check_supervisor_queue_;
-  std::shared_ptr<uvw::async_handle> m_check_supervisor_async_handle_;
   std::shared_ptr<uvw::timer_handle> m_check_supervisor_timer_handle_;
 
   std::shared_ptr<uvw::async_handle> m_grpc_alloc_job_async_handle_;
   ConcurrentQueue<EvQueueAllocateJobElem> m_grpc_alloc_job_queue_;
 
-  std::shared_ptr<uvw::async_handle> m_grpc_execute_step_async_handle_;
-  // A custom event that handles the ExecuteTask RPC.
-  ConcurrentQueue<EvQueueExecuteStepElem> m_grpc_execute_step_queue_;
-
-  std::shared_ptr<uvw::async_handle> m_task_status_change_async_handle_;
-  ConcurrentQueue<TaskStatusChangeQueueElem> m_task_status_change_queue_;
-
-  std::shared_ptr<uvw::async_handle> m_change_task_time_limit_async_handle_;
-  ConcurrentQueue<ChangeTaskTimeLimitQueueElem> m_task_time_limit_change_queue_;
-
-  std::shared_ptr<uvw::async_handle> m_terminate_step_async_handle_;
-  ConcurrentQueue<StepTerminateQueueElem> m_step_terminate_queue_;
+  absl::Mutex m_ev_cmd_mtx_;
+  std::vector<EvQueuedCommand> m_ev_cmd_queue_ ABSL_GUARDED_BY(m_ev_cmd_mtx_);
+  std::shared_ptr<uvw::async_handle> m_ev_cmd_async_handle_;
+  std::array<EvCommandLatency, std::variant_size_v<EvCommand>>
+      m_ev_cmd_latency_{};
 
   // The function which will be called when SIGINT is triggered.
   std::function<void()> m_sigint_cb_;
@@ -256,6 +311,17 @@ class JobManager {
   std::atomic_bool m_is_ending_now_{false};
 
   std::thread m_uvw_thread_;
+
+  // Steps of different jobs are launched in parallel, those of the same job
+  // one after another. A job has an entry here while a worker is launching
+  // its steps.
+  absl::Mutex m_pending_launch_mtx_;
+  absl::flat_hash_map<job_id_t, std::deque<std::unique_ptr<StepInstance>>>
+      m_pending_launch_steps_ ABSL_GUARDED_BY(m_pending_launch_mtx_);
+
+  // Declared last so that it is joined before the members used by the
+  // launch workers are destroyed.
+  BS::thread_pool m_step_launch_pool_{kStepLaunchWorkerNum};
 };
 }  // namespace Craned
 
@@ -0,0 +1,290 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "JobUsageSampler.h"
+
+#include <absl/strings/ascii.h>
+#include <absl/strings/numbers.h>
+#include <fcntl.h>
+
+namespace Craned {
+
+namespace {
+
+// Value of key in a flat keyed file like cpu.stat.
+uint64_t FlatKeyedValue(std::string_view text, std::string_view key) {
+  for (std::string_view line : absl::StrSplit(text, '\n')) {
+    if (line.size() <= key.size() || !line.starts_with(key) ||
+        line[key.size()] != ' ')
+      continue;
+    uint64_t value;
+    if (absl::SimpleAtoi(line.substr(key.size() + 1), &value)) return value;
+  }
+  return 0;
+}
+
+// Sum of key=value over a nested keyed file like io.stat, which has a line
+// for each device.
+uint64_t NestedKeyedSum(std::string_view text, std::string_view key) {
+  uint64_t sum = 0;
+  for (std::string_view field :
+       absl::StrSplit(text, absl::ByAnyChar(" \n"), absl::SkipEmpty())) {
+    if (field.size() <= key.size() || !field.starts_with(key) ||
+        field[key.size()] != '=')
+      continue;
+    uint64_t value;
+    if (absl::SimpleAtoi(field.substr(key.size() + 1), &value)) sum += value;
+  }
+  return sum;
+}
+
+// Total stall time in the "some" line of a PSI file.
+uint64_t PressureSomeTotal(std::string_view text) {
+  for (std::string_view line : absl::StrSplit(text, '\n'))
+    if (line.starts_with("some ")) return NestedKeyedSum(line, "total");
+  return 0;
+}
+
+uint64_t CounterDelta(uint64_t cur, uint64_t last) {
+  return cur >= last ? cur - last : 0;
+}
+
+}  // namespace
+
+JobUsageSampler::JobCgroup::~JobCgroup() {
+  for (int fd : {cpu_stat_fd, memory_current_fd, memory_peak_fd, io_stat_fd,
+                 cpu_pressure_fd, memory_pressure_fd, io_pressure_fd})
+    if (fd >= 0) close(fd);
+}
+
+JobUsageSampler::JobUsageSampler(std::chrono::seconds interval)
+    : m_interval_(absl::FromChrono(interval)),
+      m_root_path_(Common::CgConstant::kSystemCgPathPrefix /
+                   Common::CgConstant::kRootCgNamePrefix) {
+  m_sample_thread_ = std::thread([this] { SampleThread_(); });
+}
+
+JobUsageSampler::~JobUsageSampler() {
+  {
+    absl::MutexLock lk(&m_mtx_);
+    m_stopping_ = true;
+  }
+  if (m_sample_thread_.joinable()) m_sample_thread_.join();
+}
+
+void JobUsageSampler::SampleJob(job_id_t job_id) {
+  absl::MutexLock lk(&m_mtx_);
+  auto it = m_job_cgroups_.find(job_id);
+  if (it != m_job_cgroups_.end()) Sample_(job_id, it->second.get());
+}
+
+void JobUsageSampler::TakeSamples(
+    google::protobuf::RepeatedPtrField<crane::grpc::JobUsageSample>*
+        samples) {
+  absl::MutexLock lk(&m_mtx_);
+  samples->Reserve(samples->size() + m_pending_samples_.size());
+  for (auto& [job_id, sample] : m_pending_samples_)
+    *samples->Add() = std::move(sample);
+  m_pending_samples_.clear();
+}
+
+void JobUsageSampler::ReturnSamples(
+    const google::protobuf::RepeatedPtrField<crane::grpc::JobUsageSample>&
+        samples) {
+  absl::MutexLock lk(&m_mtx_);
+  for (const auto& sample : samples) {
+    auto [it, ok] = m_pending_samples_.try_emplace(sample.job_id(), sample);
+    if (!ok) MergeSample_(sample, &it->second);
+  }
+}
+
+void JobUsageSampler::SampleThread_() {
+  util::SetCurrentThreadName("JobUsageThr");
+
+  absl::MutexLock lk(&m_mtx_);
+  ScanJobCgroups_();
+  while (!m_mtx_.AwaitWithTimeout(absl::Condition(&m_stopping_),
+                                  m_interval_)) {
+    for (auto& [job_id, cg] : m_job_cgroups_) Sample_(job_id, cg.get());
+    ScanJobCgroups_();
+  }
+}
+
+void JobUsageSampler::ScanJobCgroups_() {
+  std::error_code ec;
+  std::filesystem::directory_iterator it(m_root_path_, ec);
+  absl::flat_hash_set<job_id_t> existing_jobs;
+  for (; !ec && it != std::filesystem::directory_iterator(); it.increment(ec)) {
+    std::string name = it->path().filename().string();
+    if (!name.starts_with(Common::CgConstant::kJobCgNamePrefix)) continue;
+
+    job_id_t job_id;
+    if (!absl::SimpleAtoi(
+            std::string_view(name).substr(
+                Common::CgConstant::kJobCgNamePrefix.size()),
+            &job_id))
+      continue;
+
+    existing_jobs.insert(job_id);
+    if (m_job_cgroups_.contains(job_id)) continue;
+
+    auto cg = OpenJobCgroup_(job_id);
+    if (cg) m_job_cgroups_.emplace(job_id, std::move(cg));
+  }
+  if (ec) {
+    CRANE_WARN("Failed to scan job cgroups under {}: {}",
+               m_root_path_.string(), ec.message());
+    return;
+  }
+
+  absl::erase_if(m_job_cgroups_, [&](const auto& kv) {
+    return !existing_jobs.contains(kv.first);
+  });
+}
+
+std::unique_ptr<JobUsageSampler::JobCgroup> JobUsageSampler::OpenJobCgroup_(
+    job_id_t job_id) {
+  auto path = m_root_path_ / CgroupManager::CgroupStrByJobId(job_id);
+  int dir_fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir_fd == -1) {
+    CRANE_TRACE("[Job #{}] Failed to open cgroup {} for sampling: {}", job_id,
+                path.string(), strerror(errno));
+    return nullptr;
+  }
+
+  auto open_file = [dir_fd](const char* name, int flags = O_RDONLY) {
+    return openat(dir_fd, name, flags | O_CLOEXEC);
+  };
+
+  auto cg = std::make_unique<JobCgroup>();
+  cg->cpu_stat_fd = open_file("cpu.stat");
+  cg->memory_current_fd = open_file("memory.current");
+  cg->io_stat_fd = open_file("io.stat");
+  cg->cpu_pressure_fd = open_file("cpu.pressure");
+  cg->memory_pressure_fd = open_file("memory.pressure");
+  cg->io_pressure_fd = open_file("io.pressure");
+
+  // Writing to memory.peak resets the peak seen through this fd.
+  cg->memory_peak_fd = open_file("memory.peak", O_RDWR);
+  if (cg->memory_peak_fd != -1)
+    cg->memory_peak_reset = write(cg->memory_peak_fd, "reset", 5) == 5;
+  else
+    cg->memory_peak_fd = open_file("memory.peak");
+  close(dir_fd);
+
+  cg->last = ReadCounters_(*cg);
+  cg->last_time = std::chrono::steady_clock::now();
+  return cg;
+}
+
+JobUsageSampler::Counters JobUsageSampler::ReadCounters_(
+    const JobCgroup& cg) {
+  Counters c;
+  c.cpu_usage_usec = FlatKeyedValue(ReadFile_(cg.cpu_stat_fd), "usage_usec");
+
+  std::string_view io_stat = ReadFile_(cg.io_stat_fd);
+  c.io_read_bytes = NestedKeyedSum(io_stat, "rbytes");
+  c.io_write_bytes = NestedKeyedSum(io_stat, "wbytes");
+
+  c.cpu_pressure_usec = PressureSomeTotal(ReadFile_(cg.cpu_pressure_fd));
+  c.memory_pressure_usec = PressureSomeTotal(ReadFile_(cg.memory_pressure_fd));
+  c.io_pressure_usec = PressureSomeTotal(ReadFile_(cg.io_pressure_fd));
+  return c;
+}
+
+std::string_view JobUsageSampler::ReadFile_(int fd) {
+  if (fd == -1) return {};
+  ssize_t n = pread(fd, m_buf_.data(), m_buf_.size(), 0);
+  if (n <= 0) return {};
+  return {m_buf_.data(), static_cast<size_t>(n)};
+}
+
+void JobUsageSampler::Sample_(job_id_t job_id, JobCgroup* cg) {
+  auto now = std::chrono::steady_clock::now();
+  auto interval_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                         now - cg->last_time)
+                         .count();
+  if (interval_ms <= 0) return;
+
+  // Reading a removed cgroup fails. It is closed by the next scan.
+  uint64_t memory_current;
+  if (!absl::SimpleAtoi(
+          absl::StripAsciiWhitespace(ReadFile_(cg->memory_current_fd)),
+          &memory_current))
+    return;
+
+  Counters cur = ReadCounters_(*cg);
+  cg->max_memory_current = std::max(cg->max_memory_current, memory_current);
+
+  // A peak which may have been left by a former job of a reused cgroup is
+  // replaced by the highest sampled usage.
+  uint64_t memory_peak = cg->max_memory_current;
+  if (cg->memory_peak_reset || g_config.CranedConf.CgroupPoolSize == 0)
+    absl::SimpleAtoi(absl::StripAsciiWhitespace(ReadFile_(cg->memory_peak_fd)),
+                     &memory_peak);
+
+  crane::grpc::JobUsageSample sample;
+  sample.set_job_id(job_id);
+  sample.set_interval_ms(interval_ms);
+  sample.set_cpu_usage_usec(
+      CounterDelta(cur.cpu_usage_usec, cg->last.cpu_usage_usec));
+  sample.set_memory_avg_bytes(memory_current);
+  sample.set_memory_peak_bytes(memory_peak);
+  sample.set_io_read_bytes(
+      CounterDelta(cur.io_read_bytes, cg->last.io_read_bytes));
+  sample.set_io_write_bytes(
+      CounterDelta(cur.io_write_bytes, cg->last.io_write_bytes));
+  sample.set_cpu_pressure_usec(
+      CounterDelta(cur.cpu_pressure_usec, cg->last.cpu_pressure_usec));
+  sample.set_memory_pressure_usec(
+      CounterDelta(cur.memory_pressure_usec, cg->last.memory_pressure_usec));
+  sample.set_io_pressure_usec(
+      CounterDelta(cur.io_pressure_usec, cg->last.io_pressure_usec));
+
+  cg->last = cur;
+  cg->last_time = now;
+
+  auto [it, ok] = m_pending_samples_.try_emplace(job_id, std::move(sample));
+  if (!ok) MergeSample_(sample, &it->second);
+}
+
+void JobUsageSampler::MergeSample_(const crane::grpc::JobUsageSample& from,
+                                   crane::grpc::JobUsageSample* to) {
+  uint64_t interval_ms =
+      static_cast<uint64_t>(from.interval_ms()) + to->interval_ms();
+  if (interval_ms == 0) return;
+
+  to->set_memory_avg_bytes((static_cast<double>(from.memory_avg_bytes()) *
+                                from.interval_ms() +
+                            static_cast<double>(to->memory_avg_bytes()) *
+                                to->interval_ms()) /
+                           interval_ms);
+  to->set_interval_ms(std::min<uint64_t>(interval_ms, UINT32_MAX));
+  to->set_memory_peak_bytes(
+      std::max(to->memory_peak_bytes(), from.memory_peak_bytes()));
+  to->set_cpu_usage_usec(to->cpu_usage_usec() + from.cpu_usage_usec());
+  to->set_io_read_bytes(to->io_read_bytes() + from.io_read_bytes());
+  to->set_io_write_bytes(to->io_write_bytes() + from.io_write_bytes());
+  to->set_cpu_pressure_usec(to->cpu_pressure_usec() +
+                            from.cpu_pressure_usec());
+  to->set_memory_pressure_usec(to->memory_pressure_usec() +
+                               from.memory_pressure_usec());
+  to->set_io_pressure_usec(to->io_pressure_usec() + from.io_pressure_usec());
+}
+
+}  // namespace Craned
@@ -0,0 +1,141 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "CranedPublicDefs.h"
+// Precompiled header comes first.
+
+namespace Craned {
+
+/**
+ * Samples cpu.stat, memory.current, memory.peak, io.stat and the PSI files of
+ * every job cgroup on a single thread. The files are kept open between
+ * samples and re-read with pread(), so a sample costs a few syscalls per job.
+ *
+ * Counters are reported as deltas since the previous sample of a job. The
+ * first read of a newly seen cgroup is only taken as the baseline, since a
+ * cgroup reused from the cgroup pool keeps the counters of its former jobs.
+ * Pending samples of the same job are merged until CtldClient piggybacks them
+ * on its next request to ctld. Only cgroup v2 is supported.
+ */
+class JobUsageSampler {
+ public:
+  explicit JobUsageSampler(std::chrono::seconds interval);
+  ~JobUsageSampler();
+
+  JobUsageSampler(const JobUsageSampler&) = delete;
+  JobUsageSampler& operator=(const JobUsageSampler&) = delete;
+
+  JobUsageSampler(JobUsageSampler&&) = delete;
+  JobUsageSampler& operator=(JobUsageSampler&&) = delete;
+
+  /**
+   * @brief Sample a job out of schedule, e.g. right before its status change
+   * is sent, so that the usage up to that point goes along with it.
+   */
+  void SampleJob(job_id_t job_id);
+
+  /**
+   * @brief Move all pending samples to samples.
+   */
+  void TakeSamples(
+      google::protobuf::RepeatedPtrField<crane::grpc::JobUsageSample>*
+          samples);
+
+  /**
+   * @brief Put back the samples taken by TakeSamples() which failed to be
+   * sent. They are merged with the samples taken in the meantime.
+   */
+  void ReturnSamples(
+      const google::protobuf::RepeatedPtrField<crane::grpc::JobUsageSample>&
+          samples);
+
+ private:
+  struct Counters {
+    uint64_t cpu_usage_usec{0};
+    uint64_t io_read_bytes{0};
+    uint64_t io_write_bytes{0};
+    uint64_t cpu_pressure_usec{0};
+    uint64_t memory_pressure_usec{0};
+    uint64_t io_pressure_usec{0};
+  };
+
+  // Open files of a job cgroup. A file which failed to open is -1 and its
+  // values are taken as 0.
+  struct JobCgroup {
+    JobCgroup() = default;
+    ~JobCgroup();
+
+    JobCgroup(const JobCgroup&) = delete;
+    JobCgroup& operator=(const JobCgroup&) = delete;
+
+    int cpu_stat_fd{-1};
+    int memory_current_fd{-1};
+    int memory_peak_fd{-1};
+    int io_stat_fd{-1};
+    int cpu_pressure_fd{-1};
+    int memory_pressure_fd{-1};
+    int io_pressure_fd{-1};
+
+    // Set if memory.peak was reset for our fd, which needs Linux 6.12.
+    // Otherwise the peak is only trusted when cgroups are never reused.
+    bool memory_peak_reset{false};
+    uint64_t max_memory_current{0};
+
+    Counters last;
+    std::chrono::steady_clock::time_point last_time;
+  };
+
+  void SampleThread_();
+
+  // Open the cgroups of new jobs and close those of ended ones.
+  void ScanJobCgroups_() ABSL_EXCLUSIVE_LOCKS_REQUIRED(m_mtx_);
+
+  std::unique_ptr<JobCgroup> OpenJobCgroup_(job_id_t job_id)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(m_mtx_);
+
+  Counters ReadCounters_(const JobCgroup& cg)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(m_mtx_);
+
+  // Read the whole file into m_buf_. Returns an empty view on failure.
+  std::string_view ReadFile_(int fd) ABSL_EXCLUSIVE_LOCKS_REQUIRED(m_mtx_);
+
+  void Sample_(job_id_t job_id, JobCgroup* cg)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(m_mtx_);
+
+  static void MergeSample_(const crane::grpc::JobUsageSample& from,
+                           crane::grpc::JobUsageSample* to);
+
+  const absl::Duration m_interval_;
+  const std::filesystem::path m_root_path_;
+
+  absl::Mutex m_mtx_;
+  bool m_stopping_ ABSL_GUARDED_BY(m_mtx_){false};
+  absl::flat_hash_map<job_id_t, std::unique_ptr<JobCgroup>> m_job_cgroups_
+      ABSL_GUARDED_BY(m_mtx_);
+  absl::flat_hash_map<job_id_t, crane::grpc::JobUsageSample> m_pending_samples_
+      ABSL_GUARDED_BY(m_mtx_);
+  std::array<char, 16384> m_buf_ ABSL_GUARDED_BY(m_mtx_);
+
+  std::thread m_sample_thread_;
+};
+
+}  // namespace Craned
+
+inline std::unique_ptr<Craned::JobUsageSampler> g_job_usage_sampler;
@@ -0,0 +1,78 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "StepPayloadCache.h"
+
+namespace Craned {
+
+StepPayloadCache::StepPayloadCache(uint64_t capacity_bytes)
+    : m_capacity_bytes_(capacity_bytes),
+      m_hit_counter_(util::metrics::DefaultRegistry().GetCounter(
+          "crane_craned_step_payload_lookups_total",
+          "Lookups of job scripts and environments sent by hash.",
+          {{"result", "hit"}})),
+      m_miss_counter_(util::metrics::DefaultRegistry().GetCounter(
+          "crane_craned_step_payload_lookups_total",
+          "Lookups of job scripts and environments sent by hash.",
+          {{"result", "miss"}})) {}
+
+void StepPayloadCache::TouchLocked_(std::list<Entry>::iterator it) {
+  m_entries_.splice(m_entries_.begin(), m_entries_, it);
+}
+
+void StepPayloadCache::Put(const std::string& key,
+                           const crane::grpc::StepPayload& payload) {
+  uint64_t size = payload.ByteSizeLong();
+  if (size > m_capacity_bytes_) return;
+
+  absl::MutexLock lock(&m_mtx_);
+  if (auto it = m_index_.find(key); it != m_index_.end()) {
+    TouchLocked_(it->second);
+    return;
+  }
+
+  m_entries_.emplace_front(Entry{
+      .key = key,
+      .payload = std::make_shared<const crane::grpc::StepPayload>(payload),
+      .size = size});
+  m_index_.emplace(key, m_entries_.begin());
+  m_bytes_ += size;
+
+  while (m_bytes_ > m_capacity_bytes_) {
+    const Entry& oldest = m_entries_.back();
+    m_bytes_ -= oldest.size;
+    m_index_.erase(oldest.key);
+    m_entries_.pop_back();
+  }
+}
+
+std::shared_ptr<const crane::grpc::StepPayload> StepPayloadCache::Get(
+    const std::string& key) {
+  absl::MutexLock lock(&m_mtx_);
+  auto it = m_index_.find(key);
+  if (it == m_index_.end()) {
+    m_miss_counter_->Inc();
+    return nullptr;
+  }
+
+  m_hit_counter_->Inc();
+  TouchLocked_(it->second);
+  return it->second->payload;
+}
+
+}  // namespace Craned
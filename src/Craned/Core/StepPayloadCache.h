@@ -0,0 +1,67 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "CranedPublicDefs.h"
+// Precompiled header comes first.
+
+namespace Craned {
+
+/**
+ * LRU of the scripts and environments attached to the ExecuteSteps requests
+ * by hash, so that ctld sends each of them to this craned once for all the
+ * tasks of an array or of a multi-node job. Ctld mirrors this LRU to decide
+ * what to attach, see StepPayloadDedup of ctld, so both are bounded by
+ * StepPayloadCacheMB and count the serialized size of the payloads.
+ */
+class StepPayloadCache {
+ public:
+  explicit StepPayloadCache(uint64_t capacity_bytes);
+
+  // A payload larger than the capacity is not kept.
+  void Put(const std::string& key, const crane::grpc::StepPayload& payload);
+
+  std::shared_ptr<const crane::grpc::StepPayload> Get(const std::string& key);
+
+ private:
+  struct Entry {
+    std::string key;
+    std::shared_ptr<const crane::grpc::StepPayload> payload;
+    uint64_t size;
+  };
+
+  void TouchLocked_(std::list<Entry>::iterator it)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(m_mtx_);
+
+  const uint64_t m_capacity_bytes_;
+
+  absl::Mutex m_mtx_;
+  // Most recently used first.
+  std::list<Entry> m_entries_ ABSL_GUARDED_BY(m_mtx_);
+  std::unordered_map<std::string, std::list<Entry>::iterator> m_index_
+      ABSL_GUARDED_BY(m_mtx_);
+  uint64_t m_bytes_ ABSL_GUARDED_BY(m_mtx_){0};
+
+  util::metrics::Counter* const m_hit_counter_;
+  util::metrics::Counter* const m_miss_counter_;
+};
+
+}  // namespace Craned
+
+inline std::unique_ptr<Craned::StepPayloadCache> g_step_payload_cache;
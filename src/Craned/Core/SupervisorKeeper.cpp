@@ -17,7 +17,10 @@
  */
 #include "SupervisorKeeper.h"
 
+#include <absl/strings/numbers.h>
 #include <protos/Supervisor.grpc.pb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 namespace Craned {
 using grpc::ClientContext;
@@ -50,8 +53,10 @@ CraneExpected<EnvMap> SupervisorStub::QueryStepEnv() {
   return std::unexpected(CraneErrCode::ERR_NON_EXISTENT);
 }
 
-CraneExpected<std::pair<task_id_t, pid_t>> SupervisorStub::CheckStatus() {
+CraneExpected<std::pair<task_id_t, pid_t>> SupervisorStub::CheckStatus(
+    absl::Duration timeout) {
   ClientContext context;
+  context.set_deadline(absl::ToChronoTime(absl::Now() + timeout));
   crane::grpc::supervisor::CheckStatusRequest request;
   crane::grpc::supervisor::CheckStatusReply reply;
 
@@ -61,6 +66,8 @@ CraneExpected<std::pair<task_id_t, pid_t>> SupervisorStub::CheckStatus() {
   }
 
   CRANE_WARN("CheckStatus failed: reply {},{}", reply.ok(), ok.error_message());
+  if (ok.error_code() == grpc::StatusCode::DEADLINE_EXCEEDED)
+    return std::unexpected(CraneErrCode::ERR_CONNECTION_TIMEOUT);
   return std::unexpected(CraneErrCode::ERR_RPC_FAILURE);
 }
 
@@ -105,7 +112,16 @@ CraneErrCode SupervisorStub::ShutdownSupervisor() {
 }
 
 void SupervisorStub::InitChannelAndStub(const std::string& endpoint) {
-  m_channel_ = CreateUnixInsecureChannel(endpoint);
+  // The channels of all steps on the node share the executor threads of
+  // grpc. What is left per step is the HTTP/2 transport while connected, so
+  // keep it only while the step is being controlled.
+  grpc::ChannelArguments args;
+  args.SetInt(GRPC_ARG_CLIENT_IDLE_TIMEOUT_MS, kSupervisorChannelIdleTimeoutMs);
+  args.SetInt(GRPC_ARG_HTTP2_BDP_PROBE, 0);
+  args.SetInt(GRPC_ARG_HTTP2_STREAM_LOOKAHEAD_BYTES,
+              kSupervisorChannelLookaheadBytes);
+
+  m_channel_ = CreateUnixInsecureCustomChannel(endpoint, args);
   // std::unique_ptr will automatically release the dangling stub.
   m_stub_ = crane::grpc::supervisor::Supervisor::NewStub(m_channel_);
 }
@@ -127,37 +143,57 @@ SupervisorKeeper::InitAndGetRecoveredMap() {
 
     std::unordered_map<task_id_t, pid_t> supervisor_pid;
     supervisor_pid.reserve(files.size());
+    if (files.empty()) return supervisor_pid;
 
-    std::latch latch(files.size());
+    // The checks mostly wait on the supervisors, so they run on their own
+    // pool rather than occupying g_thread_pool, which runs the callbacks of
+    // the registration itself.
+    BS::thread_pool pool(
+        std::min<size_t>(files.size(), kSupervisorRecoverWorkerNum));
     for (const auto& file : files) {
-      g_thread_pool->detach_task([this, file, &latch, &supervisor_pid] {
+      pool.detach_task([this, file, &supervisor_pid] {
         auto sock_path = fmt::format("unix://{}", file.string());
         std::shared_ptr stub = std::make_shared<SupervisorStub>();
         stub->InitChannelAndStub(sock_path);
 
         CraneExpected<std::pair<task_id_t, pid_t>> supv_task_id_pid_pair =
-            stub->CheckStatus();
+            stub->CheckStatus(kSupervisorCheckStatusTimeout);
+        bool straggler = false;
         if (supv_task_id_pid_pair) {
           CRANE_DEBUG("Supervisor socket {} recovered, task_id: {}, pid: {}",
                       file.string(), supv_task_id_pid_pair.value().first,
                       supv_task_id_pid_pair.value().second);
+        } else if (supv_task_id_pid_pair.error() ==
+                   CraneErrCode::ERR_CONNECTION_TIMEOUT) {
+          // A busy supervisor is still alive. Don't remove its socket.
+          auto owner = ReadSocketOwner_(file);
+          if (!owner) {
+            CRANE_ERROR("CheckTaskStatus for {} timed out, skip it.",
+                        file.string());
+            return;
+          }
+          CRANE_WARN(
+              "CheckTaskStatus for {} timed out. Recovered task_id: {}, "
+              "pid: {} from the socket, check it again later.",
+              file.string(), owner->first, owner->second);
+          supv_task_id_pid_pair = owner.value();
+          straggler = true;
         } else {
           CRANE_ERROR("CheckTaskStatus for {} failed, removing it.",
                       file.string());
           std::filesystem::remove(file);
-          latch.count_down();
           return;
         }
 
         absl::WriterMutexLock lk(&m_mutex_);
         m_supervisor_map_.emplace(supv_task_id_pid_pair.value().first, stub);
         supervisor_pid.emplace(supv_task_id_pid_pair.value());
-
-        latch.count_down();
+        if (straggler)
+          m_stragglers_.emplace_back(supv_task_id_pid_pair.value().first, file);
       });
     }
 
-    latch.wait();
+    pool.wait();
     return supervisor_pid;
 
   } catch (const std::exception& e) {
@@ -204,6 +240,84 @@ std::shared_ptr<SupervisorStub> SupervisorKeeper::GetStub(task_id_t task_id) {
   return nullptr;
 }
 
+void SupervisorKeeper::ReconcileStragglersAsync() {
+  std::vector<std::pair<task_id_t, std::filesystem::path>> stragglers;
+  {
+    absl::WriterMutexLock lk(&m_mutex_);
+    stragglers.swap(m_stragglers_);
+  }
+
+  for (auto& [task_id, file] : stragglers) {
+    g_thread_pool->detach_task([this, task_id, file] {
+      for (int i = 0; i < kSupervisorReconcileRetryNum; ++i) {
+        // Removed meanwhile, e.g. not recorded in ctld.
+        auto stub = GetStub(task_id);
+        if (!stub) return;
+
+        auto supv_task_id_pid_pair =
+            stub->CheckStatus(kSupervisorReconcileTimeout);
+        if (supv_task_id_pid_pair &&
+            supv_task_id_pid_pair.value().first == task_id) {
+          CRANE_INFO("Supervisor of task #{} answered after recovery.",
+                     task_id);
+          return;
+        }
+        if (supv_task_id_pid_pair) {
+          CRANE_ERROR("Supervisor socket {} belongs to task #{}, not #{}.",
+                      file.string(), supv_task_id_pid_pair.value().first,
+                      task_id);
+          break;
+        }
+        if (supv_task_id_pid_pair.error() !=
+            CraneErrCode::ERR_CONNECTION_TIMEOUT)
+          break;
+      }
+
+      CRANE_ERROR("Supervisor of task #{} is unreachable after recovery.",
+                  task_id);
+      g_job_mgr->StepStopAndDoStatusChangeAsync(
+          task_id, crane::grpc::TaskStatus::Failed, ExitCode::kExitCodeRpcError,
+          "Supervisor unreachable after craned restart.");
+    });
+  }
+}
+
+std::optional<std::pair<task_id_t, pid_t>> SupervisorKeeper::ReadSocketOwner_(
+    const std::filesystem::path& sock_path) {
+  // Sockets are named task_<id>.sock, see AddSupervisor().
+  task_id_t task_id;
+  std::string stem = sock_path.stem().string();
+  if (!stem.starts_with("task_") ||
+      !absl::SimpleAtoi(std::string_view(stem).substr(5), &task_id))
+    return std::nullopt;
+
+  // SO_PEERCRED of a unix socket client is the process which listens on the
+  // socket, i.e. the supervisor. Connecting doesn't need the supervisor to
+  // accept, so it works while its grpc server is busy.
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) return std::nullopt;
+
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  std::string path = sock_path.string();
+  if (path.size() >= sizeof(addr.sun_path)) {
+    close(fd);
+    return std::nullopt;
+  }
+  std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+  ucred cred{};
+  socklen_t len = sizeof(cred);
+  bool ok =
+      connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0 &&
+      getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 &&
+      cred.pid > 0;
+  close(fd);
+  if (!ok) return std::nullopt;
+
+  return std::pair{task_id, cred.pid};
+}
+
 std::set<task_id_t> SupervisorKeeper::GetRunningSteps() {
   absl::ReaderMutexLock lk(&m_mutex_);
   return m_supervisor_map_ | std::views::keys |
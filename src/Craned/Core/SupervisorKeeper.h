@@ -27,11 +27,29 @@
 #include "crane/AtomicHashMap.h"
 namespace Craned {
 
+// Supervisors are checked concurrently on craned restart, each within
+// kSupervisorCheckStatusTimeout so that a few slow ones don't hold back
+// the registration to ctld.
+constexpr uint32_t kSupervisorRecoverWorkerNum = 32;
+constexpr absl::Duration kSupervisorCheckStatusTimeout = absl::Seconds(2);
+// A supervisor which didn't answer in time is checked again after the
+// registration, with a longer timeout.
+constexpr absl::Duration kSupervisorReconcileTimeout = absl::Seconds(10);
+constexpr int kSupervisorReconcileRetryNum = 3;
+// Most steps talk to craned only when they start and end, so the connection
+// to an idle supervisor is released and made again on the next call.
+constexpr int kSupervisorChannelIdleTimeoutMs = 10 * 1000;
+// Control messages are small, so the transport doesn't need the default
+// per-stream buffering.
+constexpr int kSupervisorChannelLookaheadBytes = 16 * 1024;
+
 class SupervisorStub {
  public:
   CraneErrCode ExecuteTask();
   CraneExpected<EnvMap> QueryStepEnv();
-  CraneExpected<std::pair<task_id_t, pid_t>> CheckStatus();
+  // ERR_CONNECTION_TIMEOUT if the supervisor doesn't answer within timeout.
+  CraneExpected<std::pair<task_id_t, pid_t>> CheckStatus(
+      absl::Duration timeout);
 
   CraneErrCode TerminateTask(bool mark_as_orphaned, bool terminated_by_user);
   CraneErrCode ChangeTaskTimeLimit(absl::Duration time_limit);
@@ -61,9 +79,18 @@ class SupervisorKeeper {
    * @return job_id and pid from supervisors. Error when socket file
    * scanning fails, supervisors are unreachable, or task status queries fail
    * with specific error codes.
+   * Supervisors timing out are included with the task id from their socket
+   * name and the pid of the socket owner, and are kept as stragglers to be
+   * checked by ReconcileStragglersAsync().
    */
   CraneExpected<std::unordered_map<task_id_t, pid_t>> InitAndGetRecoveredMap();
 
+  /**
+   * @brief Check the stragglers of InitAndGetRecoveredMap() again. Those
+   * still recovered but not answering are reported failed to ctld.
+   */
+  void ReconcileStragglersAsync();
+
   void AddSupervisor(task_id_t task_id);
   void RemoveSupervisor(task_id_t task_id);
 
@@ -72,8 +99,13 @@ class SupervisorKeeper {
   std::set<task_id_t> GetRunningSteps();
 
  private:
+  static std::optional<std::pair<task_id_t, pid_t>> ReadSocketOwner_(
+      const std::filesystem::path& sock_path);
+
   absl::flat_hash_map<task_id_t, std::shared_ptr<SupervisorStub>>
       m_supervisor_map_;
+  std::vector<std::pair<task_id_t, std::filesystem::path>> m_stragglers_
+      ABSL_GUARDED_BY(m_mutex_);
   absl::Mutex m_mutex_;
 };
 }  // namespace Craned
@@ -0,0 +1,243 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "SupervisorPool.h"
+
+#include <google/protobuf/util/delimited_message_util.h>
+#include <poll.h>
+
+#include "protos/Supervisor.pb.h"
+
+namespace Craned {
+
+std::vector<double> LaunchLatencyHistogram::BucketBounds_() {
+  std::vector<double> bounds;
+  bounds.reserve(kBucketNum - 1);
+  for (size_t i = 0; i + 1 < kBucketNum; ++i)
+    bounds.emplace_back(static_cast<double>(uint64_t{1} << i) / 1000);
+  return bounds;
+}
+
+void LaunchLatencyHistogram::Record(std::chrono::microseconds latency) {
+  m_histogram_.ObserveDuration(
+      std::max(latency, std::chrono::microseconds::zero()));
+}
+
+std::string LaunchLatencyHistogram::ToString() const {
+  util::metrics::Histogram::Snapshot snapshot = m_histogram_.Collect();
+  std::string str = fmt::format(
+      "n={} avg={}ms", snapshot.count,
+      snapshot.count == 0
+          ? 0
+          : static_cast<uint64_t>(snapshot.sum * 1000 / snapshot.count));
+
+  for (size_t i = 0; i < kBucketNum; ++i) {
+    uint64_t n = snapshot.bucket_counts[i];
+    if (n == 0) continue;
+    if (i + 1 < kBucketNum)
+      str += fmt::format(" <={}ms:{}", 1 << i, n);
+    else
+      str += fmt::format(" >{}ms:{}", 1 << (i - 1), n);
+  }
+  return str;
+}
+
+SupervisorPool::SupervisorPool(uint32_t size) : m_size_(size) {}
+
+SupervisorPool::~SupervisorPool() {
+  m_stopping_.store(true, std::memory_order_release);
+
+  absl::MutexLock lock_guard(&m_mtx_);
+  m_mtx_.Await(absl::Condition(
+      +[](uint32_t* spawning_num) { return *spawning_num == 0; },
+      &m_spawning_num_));
+
+  for (const auto& supervisor : m_idle_supervisors_) Discard_(supervisor);
+  m_idle_supervisors_.clear();
+
+  if (m_cold_latency_.Count() > 0)
+    CRANE_INFO("[Supervisor] Cold launch latency: {}",
+               m_cold_latency_.ToString());
+  if (m_warm_latency_.Count() > 0)
+    CRANE_INFO("[Supervisor] Warm launch latency: {}",
+               m_warm_latency_.ToString());
+}
+
+void SupervisorPool::Init() {
+  if (m_size_ == 0) return;
+
+  CRANE_INFO("[Supervisor] Keeping {} warm supervisors.", m_size_);
+  g_thread_pool->detach_task([this] { Refill_(); });
+}
+
+std::optional<WarmSupervisor> SupervisorPool::Take() {
+  if (m_size_ == 0) return std::nullopt;
+
+  std::optional<WarmSupervisor> taken;
+  {
+    absl::MutexLock lock_guard(&m_mtx_);
+    while (!m_idle_supervisors_.empty()) {
+      WarmSupervisor supervisor = m_idle_supervisors_.front();
+      m_idle_supervisors_.pop_front();
+      if (IsAlive_(supervisor)) {
+        taken = supervisor;
+        break;
+      }
+
+      CRANE_WARN("[Supervisor] Idle supervisor {} exited unexpectedly.",
+                 supervisor.pid);
+      Discard_(supervisor);
+    }
+  }
+
+  if (!m_stopping_.load(std::memory_order_acquire))
+    g_thread_pool->detach_task([this] { Refill_(); });
+
+  return taken;
+}
+
+void SupervisorPool::RecordLaunchLatency(task_id_t task_id, bool warm,
+                                         std::chrono::microseconds latency) {
+  LaunchLatencyHistogram& histogram = warm ? m_warm_latency_ : m_cold_latency_;
+  histogram.Record(latency);
+
+  CRANE_DEBUG("[Job #{}] {} supervisor launch took {} ms.", task_id,
+              warm ? "Warm" : "Cold", latency.count() / 1000);
+
+  constexpr uint64_t kLatencyReportInterval = 100;
+  if (histogram.Count() % kLatencyReportInterval == 0)
+    CRANE_INFO("[Supervisor] {} launch latency: {}", warm ? "Warm" : "Cold",
+               histogram.ToString());
+}
+
+void SupervisorPool::Refill_() {
+  while (!m_stopping_.load(std::memory_order_acquire)) {
+    {
+      absl::MutexLock lock_guard(&m_mtx_);
+      if (m_idle_supervisors_.size() + m_spawning_num_ >= m_size_) return;
+      ++m_spawning_num_;
+    }
+
+    std::optional<WarmSupervisor> supervisor = SpawnWarmSupervisor_();
+
+    absl::MutexLock lock_guard(&m_mtx_);
+    --m_spawning_num_;
+    // Do not keep forking a csupervisor that cannot start. The next Take()
+    // will try again.
+    if (!supervisor) return;
+
+    if (m_stopping_.load(std::memory_order_acquire)) {
+      Discard_(supervisor.value());
+      return;
+    }
+
+    CRANE_TRACE("[Supervisor] Warm supervisor {} is idle.", supervisor->pid);
+    m_idle_supervisors_.emplace_back(supervisor.value());
+  }
+}
+
+std::optional<WarmSupervisor> SupervisorPool::SpawnWarmSupervisor_() {
+  using google::protobuf::io::FileInputStream;
+  using google::protobuf::util::ParseDelimitedFromZeroCopyStream;
+
+  std::array<int, 2> supervisor_craned_pipe{};
+  std::array<int, 2> craned_supervisor_pipe{};
+
+  if (pipe(supervisor_craned_pipe.data()) == -1) {
+    CRANE_ERROR("Pipe creation failed!");
+    return std::nullopt;
+  }
+
+  if (pipe(craned_supervisor_pipe.data()) == -1) {
+    close(supervisor_craned_pipe[0]);
+    close(supervisor_craned_pipe[1]);
+    CRANE_ERROR("Pipe creation failed!");
+    return std::nullopt;
+  }
+
+  pid_t child_pid = fork();
+
+  if (child_pid == -1) {
+    CRANE_ERROR("fork() failed for warm supervisor: {}", strerror(errno));
+
+    close(craned_supervisor_pipe[0]);
+    close(craned_supervisor_pipe[1]);
+    close(supervisor_craned_pipe[0]);
+    close(supervisor_craned_pipe[1]);
+    return std::nullopt;
+  }
+
+  if (child_pid == 0) {
+    // Disable SIGABRT backtrace from child processes.
+    signal(SIGABRT, SIG_DFL);
+
+    close(craned_supervisor_pipe[1]);
+    close(supervisor_craned_pipe[0]);
+
+    dup2(craned_supervisor_pipe[0], STDIN_FILENO);
+    dup2(supervisor_craned_pipe[1], STDOUT_FILENO);
+    close(craned_supervisor_pipe[0]);
+    close(supervisor_craned_pipe[1]);
+
+    util::os::CloseFdFrom(3);
+
+    std::array<const char*, 3> argv{"csupervisor: [warm]", "--warm", nullptr};
+    execvp(g_config.Supervisor.Path.c_str(),
+           const_cast<char* const*>(argv.data()));
+
+    fmt::print(stderr, "[Craned Subprocess] Failed to execvp {}. Error: {}\n",
+               g_config.Supervisor.Path.c_str(), strerror(errno));
+    abort();
+  }
+
+  close(craned_supervisor_pipe[0]);
+  close(supervisor_craned_pipe[1]);
+
+  WarmSupervisor supervisor{.pid = child_pid,
+                            .to_supervisor_fd = craned_supervisor_pipe[1],
+                            .from_supervisor_fd = supervisor_craned_pipe[0]};
+
+  // The warm supervisor sends a SupervisorReady once it is idle.
+  FileInputStream istream(supervisor.from_supervisor_fd);
+  crane::grpc::supervisor::SupervisorReady idle;
+  bool ok = ParseDelimitedFromZeroCopyStream(&idle, &istream, nullptr);
+  if (!ok || !idle.ok()) {
+    CRANE_ERROR("[Supervisor] Warm supervisor {} failed to start: {}",
+                child_pid,
+                ok ? "not ready" : strerror(istream.GetErrno()));
+    Discard_(supervisor);
+    return std::nullopt;
+  }
+
+  return supervisor;
+}
+
+bool SupervisorPool::IsAlive_(const WarmSupervisor& supervisor) {
+  pollfd pfd{.fd = supervisor.from_supervisor_fd, .events = POLLIN};
+  return poll(&pfd, 1, 0) == 0;
+}
+
+void SupervisorPool::Discard_(const WarmSupervisor& supervisor) {
+  // A dead supervisor may have been reaped by the SIGCHLD handler of
+  // JobManager already and its pid reused, so only kill a live one.
+  if (IsAlive_(supervisor)) kill(supervisor.pid, SIGKILL);
+  close(supervisor.to_supervisor_fd);
+  close(supervisor.from_supervisor_fd);
+}
+
+}  // namespace Craned
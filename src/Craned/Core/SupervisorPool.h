@@ -0,0 +1,117 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "CranedPublicDefs.h"
+// Precompiled header comes first.
+
+namespace Craned {
+
+/**
+ * A csupervisor which has been exec'ed with --warm and is blocked on its
+ * stdin waiting for the InitSupervisorRequest of a job. The fds are the
+ * craned ends of the init pipes and are owned by whoever holds the struct.
+ */
+struct WarmSupervisor {
+  pid_t pid;
+  int to_supervisor_fd;
+  int from_supervisor_fd;
+};
+
+/**
+ * Latency histogram with power-of-two millisecond buckets, kept in a
+ * util::metrics::Histogram.
+ * Bucket i counts launches taking at most 2^i ms; the last one is unbounded.
+ */
+class LaunchLatencyHistogram {
+ public:
+  void Record(std::chrono::microseconds latency);
+
+  uint64_t Count() const { return m_histogram_.Collect().count; }
+
+  std::string ToString() const;
+
+ private:
+  static constexpr size_t kBucketNum = 14;
+
+  // The upper bounds in seconds of all the buckets but the last one.
+  static std::vector<double> BucketBounds_();
+
+  util::metrics::Histogram m_histogram_{BucketBounds_()};
+};
+
+/**
+ * Keeps Supervisor.WarmPoolSize idle supervisors around so that launching a
+ * step only costs a cgroup migration and the init handshake instead of a
+ * fork/exec and the cold start-up of csupervisor.
+ * Taken supervisors are replaced asynchronously on g_thread_pool.
+ */
+class SupervisorPool {
+ public:
+  explicit SupervisorPool(uint32_t size);
+  ~SupervisorPool();
+
+  SupervisorPool(const SupervisorPool&) = delete;
+  SupervisorPool& operator=(const SupervisorPool&) = delete;
+
+  SupervisorPool(SupervisorPool&&) = delete;
+  SupervisorPool& operator=(SupervisorPool&&) = delete;
+
+  /**
+   * @brief Fill the pool in background.
+   */
+  void Init();
+
+  /**
+   * @return an idle supervisor if there is a live one, otherwise nullopt and
+   * the caller should spawn a supervisor the cold way.
+   */
+  std::optional<WarmSupervisor> Take();
+
+  void RecordLaunchLatency(task_id_t task_id, bool warm,
+                           std::chrono::microseconds latency);
+
+ private:
+  void Refill_();
+
+  // Fork and exec a csupervisor --warm and wait for it to become idle.
+  static std::optional<WarmSupervisor> SpawnWarmSupervisor_();
+
+  // An idle supervisor never writes to its pipe, so anything readable on it
+  // means EOF, i.e. the supervisor has died.
+  static bool IsAlive_(const WarmSupervisor& supervisor);
+
+  static void Discard_(const WarmSupervisor& supervisor);
+
+  const uint32_t m_size_;
+
+  std::atomic_bool m_stopping_{false};
+
+  absl::Mutex m_mtx_;
+  std::deque<WarmSupervisor> m_idle_supervisors_ ABSL_GUARDED_BY(m_mtx_);
+  // Number of supervisors being spawned by Refill_().
+  uint32_t m_spawning_num_ ABSL_GUARDED_BY(m_mtx_){0};
+
+  LaunchLatencyHistogram m_cold_latency_;
+  LaunchLatencyHistogram m_warm_latency_;
+};
+
+}  // namespace Craned
+
+inline std::unique_ptr<Craned::SupervisorPool> g_supervisor_pool;
@@ -0,0 +1,357 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "BundleCache.h"
+
+#include <fcntl.h>
+#include <grp.h>
+#include <sys/file.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/wait.h>
+
+#include <fstream>
+
+namespace Craned::Supervisor {
+
+namespace {
+
+// Exclusive flock, released when the object goes away.
+class FileLock {
+ public:
+  FileLock(const std::filesystem::path& path, bool blocking) {
+    m_fd_ = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (m_fd_ < 0) return;
+    if (flock(m_fd_, LOCK_EX | (blocking ? 0 : LOCK_NB)) != 0) {
+      close(m_fd_);
+      m_fd_ = -1;
+    }
+  }
+  ~FileLock() {
+    if (m_fd_ >= 0) close(m_fd_);
+  }
+
+  FileLock(const FileLock&) = delete;
+  FileLock& operator=(const FileLock&) = delete;
+
+  bool Locked() const { return m_fd_ >= 0; }
+
+ private:
+  int m_fd_{-1};
+};
+
+// FNV-1a, which unlike absl::Hash is the same in every process.
+class Fnv1a64 {
+ public:
+  void Update(std::string_view data) {
+    for (unsigned char c : data) {
+      m_hash_ ^= c;
+      m_hash_ *= 0x100000001b3ULL;
+    }
+  }
+  uint64_t Digest() const { return m_hash_; }
+
+ private:
+  uint64_t m_hash_{0xcbf29ce484222325ULL};
+};
+
+bool IsAlive(pid_t pid) { return kill(pid, 0) == 0 || errno == EPERM; }
+
+}  // namespace
+
+BundleCache::BundleCache(std::filesystem::path dir, uint64_t quota_bytes)
+    : m_dir_(std::move(dir)), m_quota_bytes_(quota_bytes) {}
+
+std::optional<BundleCache::Fingerprint> BundleCache::Fingerprint_(
+    const std::filesystem::path& bundle, uid_t uid) {
+  std::ifstream fin{bundle / "config.json", std::ios::binary};
+  if (!fin) return std::nullopt;
+  std::string config{std::istreambuf_iterator<char>(fin), {}};
+
+  // Only metadata of the rootfs is hashed, like the quick check of rsync.
+  // Reading every file would cost as much as copying the bundle.
+  std::filesystem::path rootfs = bundle / "rootfs";
+  std::vector<std::string> records;
+  uint64_t size = 0;
+  std::error_code ec;
+  for (std::filesystem::recursive_directory_iterator
+           it(rootfs, std::filesystem::directory_options::none, ec),
+       end;
+       !ec && it != end; it.increment(ec)) {
+    struct stat st{};
+    if (lstat(it->path().c_str(), &st) != 0) return std::nullopt;
+    if (S_ISREG(st.st_mode)) size += st.st_size;
+    // File names may contain anything but NUL.
+    std::string record = it->path().lexically_relative(rootfs).string();
+    record.push_back('\0');
+    record += fmt::format("{:o} {} {} {} {}.{} {}", st.st_mode, st.st_uid,
+                          st.st_gid, st.st_size, st.st_mtim.tv_sec,
+                          st.st_mtim.tv_nsec, st.st_rdev);
+    records.emplace_back(std::move(record));
+  }
+  if (ec) return std::nullopt;
+  std::ranges::sort(records);
+
+  Fnv1a64 hash;
+  hash.Update(config);
+  for (const auto& record : records) {
+    hash.Update(record);
+    hash.Update(std::string_view("\n", 1));
+  }
+  // Entries are copied with the permissions of their user and are not
+  // shared across users.
+  return Fingerprint{.key = fmt::format("{}-{:016x}", uid, hash.Digest()),
+                     .size = size};
+}
+
+bool BundleCache::RunAs_(const std::vector<std::string>& argv, uid_t uid,
+                         gid_t gid) {
+  // Built before fork(), the child may only make async-signal-safe calls.
+  std::vector<char*> c_argv;
+  for (const auto& arg : argv) c_argv.push_back(const_cast<char*>(arg.data()));
+  c_argv.push_back(nullptr);
+
+  pid_t pid = fork();
+  if (pid < 0) {
+    CRANE_ERROR("[Bundle cache] fork() failed: {}", strerror(errno));
+    return false;
+  }
+
+  if (pid == 0) {
+    // The bundle belongs to the user, so it is only read with the
+    // permissions of the user. A symlink swapped in by the user can't
+    // reach files the user could not read anyway.
+    if (setgroups(1, &gid) != 0 || setresgid(gid, gid, gid) != 0 ||
+        setresuid(uid, uid, uid) != 0)
+      _exit(127);
+    execv(c_argv[0], c_argv.data());
+    _exit(127);
+  }
+
+  // Called in the event loop of the supervisor, so the SIGCHLD handler,
+  // which reaps any child, can't run before this waitpid().
+  int status;
+  while (waitpid(pid, &status, 0) < 0) {
+    if (errno != EINTR) {
+      CRANE_ERROR("[Bundle cache] waitpid() failed: {}", strerror(errno));
+      return false;
+    }
+  }
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    CRANE_WARN("[Bundle cache] {} failed with status {}.", argv[0], status);
+    return false;
+  }
+  return true;
+}
+
+bool BundleCache::RemoveEntry_(const std::filesystem::path& entry_dir) {
+  std::error_code ec;
+  std::filesystem::path rootfs = entry_dir / "rootfs";
+
+  // rootfs belongs to the user and is removed as the user, see RunAs_.
+  struct stat st{};
+  if (lstat(rootfs.c_str(), &st) == 0) {
+    if (!S_ISDIR(st.st_mode) ||
+        !RunAs_({kRmPath, "-rf", "--", rootfs.string()}, st.st_uid,
+                st.st_gid))
+      return false;
+  }
+  std::filesystem::remove_all(entry_dir, ec);
+  return !ec;
+}
+
+std::optional<BundleCache::Entry> BundleCache::Acquire(
+    const std::filesystem::path& bundle, task_id_t task_id, uid_t uid,
+    gid_t gid) {
+  std::optional<Fingerprint> fingerprint = Fingerprint_(bundle, uid);
+  if (!fingerprint) {
+    CRANE_WARN("[Bundle cache] Failed to fingerprint bundle {}.",
+               bundle.string());
+    return std::nullopt;
+  }
+  const std::string& key = fingerprint->key;
+
+  std::error_code ec;
+  std::filesystem::create_directories(m_dir_, ec);
+  std::filesystem::path entry_dir = m_dir_ / key;
+
+  // Keeps the entry from being evicted before it is referenced below.
+  FileLock entry_lock(m_dir_ / fmt::format("{}{}", key, kLockFileName), true);
+  if (!entry_lock.Locked()) return std::nullopt;
+
+  Entry entry{.key = key, .rootfs = entry_dir / "rootfs"};
+  entry.hit = std::filesystem::exists(entry_dir / "size", ec);
+  if (!entry.hit) {
+    // Leftover of a supervisor which died while copying.
+    if (!RemoveEntry_(entry_dir)) return std::nullopt;
+
+    // The entry directory stays with root, only rootfs is the user's.
+    std::filesystem::create_directories(entry_dir / "refs", ec);
+    if (ec || mkdir(entry.rootfs.c_str(), 0755) != 0 ||
+        chown(entry.rootfs.c_str(), uid, gid) != 0 ||
+        !RunAs_({kCpPath, "-R", "--no-dereference",
+                 "--preserve=mode,timestamps,links", "--reflink=auto", "--",
+                 (bundle / "rootfs").string() + "/.", entry.rootfs.string()},
+                uid, gid)) {
+      CRANE_WARN("[Bundle cache] Failed to copy the rootfs of bundle {}.",
+                 bundle.string());
+      RemoveEntry_(entry_dir);
+      return std::nullopt;
+    }
+
+    // Written last, marking the entry complete.
+    std::ofstream fout{entry_dir / "size"};
+    fout << fingerprint->size;
+    if (!fout.flush()) {
+      RemoveEntry_(entry_dir);
+      return std::nullopt;
+    }
+  }
+
+  FileLock cache_lock(m_dir_ / kLockFileName, true);
+  if (!cache_lock.Locked()) return std::nullopt;
+
+  std::ofstream ref{entry_dir / "refs" / std::to_string(task_id)};
+  ref << getpid();
+  if (!ref.flush()) return std::nullopt;
+
+  UpdateStatsLocked_(entry.hit, &entry);
+  EvictLocked_();
+  return entry;
+}
+
+void BundleCache::Release(const std::string& key, task_id_t task_id) {
+  FileLock cache_lock(m_dir_ / kLockFileName, true);
+  std::error_code ec;
+  std::filesystem::remove(m_dir_ / key / "refs" / std::to_string(task_id),
+                          ec);
+}
+
+void BundleCache::UpdateStatsLocked_(bool hit, Entry* entry) {
+  uint64_t hits = 0, lookups = 0;
+  {
+    std::ifstream fin{m_dir_ / kStatsFileName};
+    fin >> hits >> lookups;
+  }
+  hits += hit;
+  lookups += 1;
+
+  std::ofstream fout{m_dir_ / kStatsFileName, std::ios::trunc};
+  fout << hits << ' ' << lookups;
+
+  entry->node_hits = hits;
+  entry->node_lookups = lookups;
+}
+
+void BundleCache::EvictLocked_() {
+  struct Candidate {
+    std::filesystem::path dir;
+    std::filesystem::file_time_type last_use;
+    uint64_t size;
+  };
+
+  std::vector<Candidate> candidates;
+  uint64_t total = 0;
+  std::error_code ec;
+  try {
+    for (const auto& it : std::filesystem::directory_iterator(m_dir_)) {
+      if (!it.is_directory()) continue;
+
+      uint64_t size = 0;
+      std::ifstream fin{it.path() / "size"};
+      if (!(fin >> size)) continue;  // Being copied.
+      total += size;
+
+      bool in_use = false;
+      for (const auto& ref :
+           std::filesystem::directory_iterator(it.path() / "refs")) {
+        pid_t pid = 0;
+        std::ifstream ref_in{ref.path()};
+        if (ref_in >> pid && IsAlive(pid)) {
+          in_use = true;
+        } else {
+          // The supervisor died without releasing the entry.
+          std::filesystem::remove(ref.path(), ec);
+        }
+      }
+      if (in_use) continue;
+
+      candidates.push_back(
+          {.dir = it.path(),
+           .last_use = std::filesystem::last_write_time(it.path() / "refs"),
+           .size = size});
+    }
+  } catch (const std::filesystem::filesystem_error& e) {
+    CRANE_ERROR("[Bundle cache] Failed to scan {}: {}", m_dir_.string(),
+                e.what());
+    return;
+  }
+  if (total <= m_quota_bytes_) return;
+
+  std::ranges::sort(candidates, {}, &Candidate::last_use);
+  for (const auto& candidate : candidates) {
+    if (total <= m_quota_bytes_) break;
+
+    FileLock entry_lock(candidate.dir.string() + std::string(kLockFileName),
+                        false);
+    if (!entry_lock.Locked()) continue;  // Being acquired.
+
+    CRANE_INFO("[Bundle cache] Evicting {} of {} bytes.",
+               candidate.dir.filename().string(), candidate.size);
+    if (RemoveEntry_(candidate.dir)) total -= candidate.size;
+  }
+}
+
+bool BundleCache::MountSnapshot(const std::filesystem::path& lower,
+                                const std::filesystem::path& upper,
+                                const std::filesystem::path& work,
+                                const std::filesystem::path& merged, uid_t uid,
+                                gid_t gid) {
+  for (const auto& path : {lower, upper, work}) {
+    // The overlay options are separated by commas and colons.
+    if (path.string().find_first_of(",:") != std::string::npos) {
+      CRANE_WARN("[Bundle cache] Path {} can't be used in an overlay.",
+                 path.string());
+      return false;
+    }
+  }
+
+  std::error_code ec;
+  for (const auto& path : {upper, work, merged})
+    std::filesystem::create_directories(path, ec);
+  if (ec || chown(upper.c_str(), uid, gid) != 0) return false;
+
+  std::string options =
+      fmt::format("lowerdir={},upperdir={},workdir={}", lower.string(),
+                  upper.string(), work.string());
+  if (mount("overlay", merged.c_str(), "overlay", 0, options.c_str()) != 0) {
+    CRANE_WARN("[Bundle cache] Failed to mount overlay at {}: {}",
+               merged.string(), strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+void BundleCache::UnmountSnapshot(const std::filesystem::path& merged) {
+  if (umount2(merged.c_str(), MNT_DETACH) != 0)
+    CRANE_WARN("[Bundle cache] Failed to unmount overlay at {}: {}",
+               merged.string(), strerror(errno));
+}
+
+}  // namespace Craned::Supervisor
@@ -0,0 +1,111 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "SupervisorPublicDefs.h"
+// Precompiled header comes first.
+
+namespace Craned::Supervisor {
+
+/**
+ * Node-local cache of the rootfs of OCI bundles, shared by the supervisors
+ * on the node through file locks.
+ *
+ * An entry is named by the uid of the task and a fingerprint of the bundle
+ * content: config.json and the path, type, mode, owner, size and mtime of
+ * every file in the rootfs. A changed bundle hence gets a new entry. The
+ * rootfs is copied and removed by cp and rm running as the user. Tasks use
+ * an entry as the lower layer of an overlay of their own, so the cached
+ * copy is never written.
+ *
+ * Layout of an entry <dir>/<key>/:
+ *   rootfs/     the copied rootfs
+ *   size        bytes of the files in rootfs
+ *   refs/<id>   one file per task using the entry, holding the supervisor
+ *               pid. The mtime of refs/ is the last use of the entry.
+ * Entries not used by a live supervisor are evicted in LRU order once the
+ * total size exceeds the quota.
+ */
+class BundleCache {
+ public:
+  struct Entry {
+    std::string key;
+    std::filesystem::path rootfs;
+    bool hit{false};
+    // Lookups of all the supervisors on the node.
+    uint64_t node_hits{0};
+    uint64_t node_lookups{0};
+  };
+
+  BundleCache(std::filesystem::path dir, uint64_t quota_bytes);
+
+  /**
+   * @brief Reference the cached rootfs of the bundle for the task, copying
+   * it into the cache on a miss.
+   */
+  std::optional<Entry> Acquire(const std::filesystem::path& bundle,
+                               task_id_t task_id, uid_t uid, gid_t gid);
+
+  void Release(const std::string& key, task_id_t task_id);
+
+  /**
+   * @brief Mount an overlay of lower at merged, whose writes go to upper.
+   * upper and work are created, upper is owned by uid and gid.
+   */
+  static bool MountSnapshot(const std::filesystem::path& lower,
+                            const std::filesystem::path& upper,
+                            const std::filesystem::path& work,
+                            const std::filesystem::path& merged, uid_t uid,
+                            gid_t gid);
+
+  static void UnmountSnapshot(const std::filesystem::path& merged);
+
+ private:
+  // Held while the entry is populated or referenced.
+  static constexpr std::string_view kLockFileName = ".lock";
+  static constexpr std::string_view kStatsFileName = ".stats";
+  static constexpr const char* kCpPath = "/bin/cp";
+  static constexpr const char* kRmPath = "/bin/rm";
+
+  struct Fingerprint {
+    std::string key;
+    // Bytes of the regular files in the rootfs.
+    uint64_t size;
+  };
+
+  static std::optional<Fingerprint> Fingerprint_(
+      const std::filesystem::path& bundle, uid_t uid);
+
+  // Run argv[0] with the credentials of uid and gid and wait for it.
+  static bool RunAs_(const std::vector<std::string>& argv, uid_t uid,
+                     gid_t gid);
+
+  static bool RemoveEntry_(const std::filesystem::path& entry_dir);
+
+  // Called with the lock of the cache held.
+  void EvictLocked_();
+  void UpdateStatsLocked_(bool hit, Entry* entry);
+
+  const std::filesystem::path m_dir_;
+  const uint64_t m_quota_bytes_;
+};
+
+}  // namespace Craned::Supervisor
+
+inline std::unique_ptr<Craned::Supervisor::BundleCache> g_bundle_cache;
@@ -114,10 +114,9 @@ bool CforedClient::InitFwdMetaAndUvStdoutFwdHandler(pid_t pid, int stdin_write,
   auto poll_cb = [this, meta](const uvw::poll_event&, uvw::poll_handle& h) {
     CRANE_TRACE("Detect task #{} output.", g_config.JobId);
 
-    constexpr int MAX_BUF_SIZE = 4096;
-    char buf[MAX_BUF_SIZE];
-
-    auto ret = read(meta.stdout_read, buf, MAX_BUF_SIZE);
+    auto buf = m_output_buffer_pool_.Get();
+    auto ret =
+        read(meta.stdout_read, buf->data, OutputBufferPool::kBufferSize);
     bool read_finished{false};
 
     if (ret == 0) {
@@ -168,9 +167,9 @@ bool CforedClient::InitFwdMetaAndUvStdoutFwdHandler(pid_t pid, int stdin_write,
       return;
     }
 
-    std::string output(buf, ret);
+    buf->len = ret;
     CRANE_TRACE("Fwd to task #{}: len[{}]", g_config.JobId, ret);
-    this->TaskOutPutForward(output);
+    this->TaskOutPutForward(std::move(buf));
   };
   poll_handle->on<uvw::poll_event>(poll_cb);
   int ret = poll_handle->start(uvw::poll_handle::poll_event_flags::READABLE);
@@ -210,6 +209,7 @@ uint16_t CforedClient::SetupX11forwarding_() {
   constexpr uint16_t x11_port_end = 6100;
 
   auto x11_data = std::make_shared<X11FdInfo>();
+  x11_data->client = this;
   x11_data->proxy_handle = x11_proxy_h;
 
   x11_proxy_h->data(x11_data);
@@ -246,22 +246,11 @@ uint16_t CforedClient::SetupX11forwarding_() {
 
     auto sock = h.parent().resource<uvw::tcp_handle>();
 
-    sock->on<uvw::data_event>([this](uvw::data_event& e, uvw::tcp_handle& s) {
-      CRANE_TRACE("Read x11 output. Forwarding...");
-
-      TaskX11OutPutForward(std::move(e.data), e.length);
-    });
     sock->on<uvw::write_event>(
         [this](const uvw::write_event&, uvw::tcp_handle&) {
           CRANE_TRACE("Write x11 input done.");
         });
 
-    sock->on<uvw::end_event>([](uvw::end_event&, uvw::tcp_handle& h) {
-      // EOF
-      CRANE_TRACE("X11 proxy connection ended. Closing it.");
-      if (auto* p = h.data<X11FdInfo>().get(); p) p->sock_stopped = true;
-      h.close();
-    });
     sock->on<uvw::error_event>([](uvw::error_event& e, uvw::tcp_handle& h) {
       CRANE_ERROR("Error on x11 proxy of {}. Closing it.", e.what());
       if (auto* p = h.data<X11FdInfo>().get(); p) p->sock_stopped = true;
@@ -275,7 +264,13 @@ uint16_t CforedClient::SetupX11forwarding_() {
 
     h.data<X11FdInfo>()->fd = sock->fd();
     h.data<X11FdInfo>()->sock = sock;
-    sock->read();
+    sock->data(h.data<X11FdInfo>());
+    int err = uv_read_start(sock->raw<uv_stream_t>(), &X11AllocCb_,
+                            &X11ReadCb_);
+    if (err != 0) {
+      CRANE_ERROR("Failed to read x11 proxy connection: {}", uv_strerror(err));
+      sock->close();
+    }
 
     // Currently only 1 connection of x11 client will be accepted.
     // Close it once we accept one x11 client.
@@ -301,6 +296,42 @@ uint16_t CforedClient::SetupX11forwarding_() {
   return port;
 }
 
+void CforedClient::X11AllocCb_(uv_handle_t* handle, size_t, uv_buf_t* buf) {
+  auto& sock = *static_cast<uvw::tcp_handle*>(handle->data);
+  X11BufferPool::Buffer* buffer =
+      sock.data<X11FdInfo>()->client->m_x11_buffer_pool_.Acquire();
+  *buf = uv_buf_init(buffer->data, X11BufferPool::kBufferSize);
+}
+
+void CforedClient::X11ReadCb_(uv_stream_t* stream, ssize_t nread,
+                              const uv_buf_t* buf) {
+  auto& sock = *static_cast<uvw::tcp_handle*>(stream->data);
+  auto* info = sock.data<X11FdInfo>().get();
+  CforedClient* self = info->client;
+
+  // libuv may pass no buffer on errors.
+  X11BufferPool::BufferPtr buffer =
+      buf->base == nullptr
+          ? X11BufferPool::BufferPtr{}
+          : self->m_x11_buffer_pool_.Adopt(
+                X11BufferPool::FromData(buf->base));
+
+  if (nread > 0) {
+    CRANE_TRACE("Read x11 output. Forwarding...");
+    buffer->len = nread;
+    self->TaskX11OutPutForward(std::move(buffer));
+  } else if (nread == UV_EOF) {
+    CRANE_TRACE("X11 proxy connection ended. Closing it.");
+    info->sock_stopped = true;
+    sock.close();
+  } else if (nread < 0) {
+    CRANE_ERROR("Error on x11 proxy of {}. Closing it.",
+                uv_strerror(static_cast<int>(nread)));
+    info->sock_stopped = true;
+    sock.close();
+  }
+}
+
 void CforedClient::StartUvLoopThread() {
   m_ev_thread_ = std::thread([this] {
     util::SetCurrentThreadName("CforedClient");
@@ -353,58 +384,88 @@ void CforedClient::CleanOutputQueueAndWriteToStreamThread_(
         stream,
     std::atomic<bool>* write_pending) {
   CRANE_TRACE("CleanOutputQueueThread started.");
-  std::string output;
-  std::pair<std::unique_ptr<char[]>, size_t> x11_output;
-  bool ok = m_output_queue_.try_dequeue(output);
-  bool x11_ok = m_x11_output_queue_.try_dequeue(x11_output);
+
+  // Reused, so the batch keeps its capacity. Write() serializes the
+  // request before it returns.
+  StreamTaskIORequest output_request;
+  output_request.set_type(StreamTaskIORequest::TASK_OUTPUT);
+  std::string* batch =
+      output_request.mutable_payload_task_output_req()->mutable_msg();
+  batch->reserve(kOutputBatchMaxBytes + OutputBufferPool::kBufferSize);
+
+  OutputChunk chunk;
+  X11BufferPool::BufferPtr x11_output;
+  bool x11_ok = false;
 
   // Make sure before exit all output has been drained.
-  while (!m_stopped_ || ok || x11_ok) {
-    if (!ok && !x11_ok) {
+  while (true) {
+    // Chunks queued while the previous write is in flight join one batch.
+    while (batch->size() < kOutputBatchMaxBytes &&
+           m_output_queue_.try_dequeue(chunk)) {
+      batch->append(chunk.buf->data, chunk.buf->len);
+
+      uint64_t latency_us =
+          std::chrono::duration_cast<std::chrono::microseconds>(
+              std::chrono::steady_clock::now() - chunk.enqueue_time)
+              .count();
+      m_output_stats_.chunks++;
+      m_output_stats_.queue_latency_sum_us += latency_us;
+      m_output_stats_.queue_latency_max_us =
+          std::max(m_output_stats_.queue_latency_max_us, latency_us);
+      // The batch holds a copy, so the buffer can be reused.
+      chunk.buf.reset();
+    }
+    if (!x11_ok) x11_ok = m_x11_output_queue_.try_dequeue(x11_output);
+
+    if (batch->empty() && !x11_ok) {
+      if (m_stopped_) break;
       std::this_thread::sleep_for(std::chrono::milliseconds(75));
-      ok = m_output_queue_.try_dequeue(output);
-      x11_ok = m_x11_output_queue_.try_dequeue(x11_output);
       continue;
     }
 
-    if (ok) {
-      StreamTaskIORequest request;
-      request.set_type(StreamTaskIORequest::TASK_OUTPUT);
-
-      auto* payload = request.mutable_payload_task_output_req();
-      payload->set_msg(output);
+    if (write_pending->load(std::memory_order::acquire)) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      continue;
+    }
 
-      while (write_pending->load(std::memory_order::acquire))
-        std::this_thread::sleep_for(std::chrono::milliseconds(25));
+    if (!batch->empty()) {
+      m_output_stats_.bytes += batch->size();
+      m_output_stats_.messages++;
 
-      CRANE_TRACE("Writing output...");
+      CRANE_TRACE("Writing output of {} bytes...", batch->size());
       write_pending->store(true, std::memory_order::release);
-      stream->Write(request, (void*)Tag::Write);
+      stream->Write(output_request, (void*)Tag::Write);
 
-      ok = m_output_queue_.try_dequeue(output);
+      batch->clear();
+      continue;
     }
 
-    if (x11_ok) {
-      StreamTaskIORequest request;
-      request.set_type(StreamTaskIORequest::TASK_X11_OUTPUT);
+    StreamTaskIORequest request;
+    request.set_type(StreamTaskIORequest::TASK_X11_OUTPUT);
 
-      auto* payload = request.mutable_payload_task_x11_output_req();
+    auto* payload = request.mutable_payload_task_x11_output_req();
 
-      auto& [p, len] = x11_output;
-      payload->set_msg(p.get(), len);
+    payload->set_msg(x11_output->data, x11_output->len);
 
-      while (write_pending->load(std::memory_order::acquire))
-        std::this_thread::sleep_for(std::chrono::milliseconds(25));
+    CRANE_TRACE("Forwarding x11 output from task to cfored {}",
+                this->m_cfored_name_);
+    write_pending->store(true, std::memory_order::release);
+    stream->Write(request, (void*)Tag::Write);
 
-      CRANE_TRACE("Forwarding x11 output from task to cfored {}",
-                  this->m_cfored_name_);
-      write_pending->store(true, std::memory_order::release);
-      stream->Write(request, (void*)Tag::Write);
-
-      x11_ok = m_x11_output_queue_.try_dequeue(x11_output);
-    }
+    // Write() has serialized the request, so the buffer can be reused.
+    x11_output.reset();
+    x11_ok = false;
   }
 
+  const auto& stats = m_output_stats_;
+  CRANE_DEBUG(
+      "[Step #{}.{}] Forwarded {} bytes of output in {} messages from {} "
+      "chunks, queue latency avg {} us, max {} us.",
+      g_config.JobId, g_config.StepId, stats.bytes, stats.messages,
+      stats.chunks,
+      stats.chunks == 0 ? 0 : stats.queue_latency_sum_us / stats.chunks,
+      stats.queue_latency_max_us);
+
   m_output_drained_.store(true, std::memory_order::release);
   CRANE_TRACE("CleanOutputQueueThread exited.");
 }
@@ -653,15 +714,15 @@ void CforedClient::TaskEnd(pid_t pid) {
   g_task_mgr->TaskStopAndDoStatusChange(g_config.JobId);
 };
 
-void CforedClient::TaskOutPutForward(const std::string& msg) {
-  CRANE_TRACE("Receive TaskOutputForward len: {}.", msg.size());
-  m_output_queue_.enqueue(msg);
+void CforedClient::TaskOutPutForward(OutputBufferPool::BufferPtr&& buf) {
+  CRANE_TRACE("Receive TaskOutputForward len: {}.", buf->len);
+  m_output_queue_.enqueue({.buf = std::move(buf),
+                           .enqueue_time = std::chrono::steady_clock::now()});
 }
 
-void CforedClient::TaskX11OutPutForward(std::unique_ptr<char[]>&& data,
-                                        size_t len) {
-  CRANE_TRACE("Receive TaskX11OutPutForward len: {}.", len);
-  m_x11_output_queue_.enqueue({std::move(data), len});
+void CforedClient::TaskX11OutPutForward(X11BufferPool::BufferPtr&& buf) {
+  CRANE_TRACE("Receive TaskX11OutPutForward len: {}.", buf->len);
+  m_x11_output_queue_.enqueue(std::move(buf));
 }
 
 }  // namespace Craned::Supervisor
@@ -21,12 +21,14 @@
 #include "SupervisorPublicDefs.h"
 // Precompiled header comes first.
 
+#include "crane/SlabBufferPool.h"
 #include "protos/Crane.grpc.pb.h"
 
 namespace Craned::Supervisor {
 
 class CforedClient {
   struct X11FdInfo {
+    CforedClient* client;
     int fd;
     uint16_t port;
     std::shared_ptr<uvw::tcp_handle> sock;
@@ -50,9 +52,24 @@ class CforedClient {
     bool proc_stopped{false};
   };
 
+  // The uv loop reads output straight into these buffers and hands them to
+  // the writer thread, which recycles them once they are written.
+  using OutputBufferPool = util::SlabBufferPool<4096>;
+  // Slabs of 8 buffers of 16 KiB for the single X11 connection of a client.
+  using X11BufferPool = util::SlabBufferPool<16 * 1024, 8>;
+
+  struct OutputChunk {
+    OutputBufferPool::BufferPtr buf;
+    std::chrono::steady_clock::time_point enqueue_time;
+  };
+
   template <class T>
   using ConcurrentQueue = moodycamel::ConcurrentQueue<T>;
 
+  // Output read while a write is in flight is sent in one request of at
+  // most this size.
+  static constexpr size_t kOutputBatchMaxBytes = 64 * 1024;
+
  public:
   CforedClient();
   ~CforedClient();
@@ -79,9 +96,16 @@ class CforedClient {
 
   void AsyncSendRecvThread_();
 
-  void TaskOutPutForward(const std::string& msg);
+  void TaskOutPutForward(OutputBufferPool::BufferPtr&& buf);
 
-  void TaskX11OutPutForward(std::unique_ptr<char[]>&& data, size_t len);
+  void TaskX11OutPutForward(X11BufferPool::BufferPtr&& buf);
+
+  // Read callbacks of the X11 connection, which is read into the buffers of
+  // m_x11_buffer_pool_ instead of those uvw allocates for each read.
+  static void X11AllocCb_(uv_handle_t* handle, size_t suggested_size,
+                          uv_buf_t* buf);
+  static void X11ReadCb_(uv_stream_t* stream, ssize_t nread,
+                         const uv_buf_t* buf);
 
   void CleanOutputQueueAndWriteToStreamThread_(
       grpc::ClientAsyncReaderWriter<crane::grpc::StreamTaskIORequest,
@@ -91,11 +115,23 @@ class CforedClient {
   std::atomic<bool> m_stopped_{false};
   std::atomic<bool> m_output_drained_{false};
 
-  ConcurrentQueue<std::string> m_output_queue_;
+  // Declared before the queue so that queued buffers are returned first.
+  OutputBufferPool m_output_buffer_pool_;
+  ConcurrentQueue<OutputChunk> m_output_queue_;
+
+  // Output forwarding statistics of the step, owned by the writer thread.
+  struct OutputStats {
+    uint64_t bytes{0};
+    uint64_t chunks{0};
+    uint64_t messages{0};
+    uint64_t queue_latency_sum_us{0};
+    uint64_t queue_latency_max_us{0};
+  };
+  OutputStats m_output_stats_;
   ConcurrentQueue<std::pair<std::unique_ptr<char[]>, size_t>>
       m_x11_input_queue_;
-  ConcurrentQueue<std::pair<std::unique_ptr<char[]>, size_t>>
-      m_x11_output_queue_;
+  X11BufferPool m_x11_buffer_pool_;
+  ConcurrentQueue<X11BufferPool::BufferPtr> m_x11_output_queue_;
 
   std::thread m_fwd_thread_;
 
@@ -0,0 +1,282 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OutputSpool.h"
+
+#include <fcntl.h>
+#include <grp.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "crane/PasswordEntry.h"
+
+namespace Craned::Supervisor {
+
+OutputSpool::OutputSpool(std::filesystem::path dir,
+                         uint64_t flush_threshold_bytes, uid_t uid,
+                         gid_t gid)
+    : m_dir_(std::move(dir)),
+      m_flush_threshold_bytes_(flush_threshold_bytes),
+      m_uid_(uid),
+      m_gid_(gid) {
+  std::error_code ec;
+  std::filesystem::create_directories(m_dir_, ec);
+  if (ec)
+    CRANE_ERROR("[Output spool] Failed to create {}: {}", m_dir_.string(),
+                ec.message());
+
+  m_copier_thread_ = std::thread([this] { CopierThread_(); });
+}
+
+OutputSpool::~OutputSpool() {
+  {
+    absl::MutexLock lock(&m_mtx_);
+    m_stopped_ = true;
+  }
+  m_copier_thread_.join();
+
+  absl::MutexLock lock(&m_mtx_);
+  for (auto& [task_id, task] : m_tasks_) {
+    for (Stream* stream : {&task->output, &task->error}) {
+      if (stream->spool_fd >= 0) close(stream->spool_fd);
+      if (stream->final_fd >= 0) close(stream->final_fd);
+    }
+  }
+}
+
+bool OutputSpool::CreateSpoolFile_(const std::string& suffix,
+                                   task_id_t task_id,
+                                   const std::string& final_path,
+                                   Stream* stream) const {
+  stream->final_path = final_path;
+  stream->spool_path =
+      m_dir_ / fmt::format("{}.{}.{}.{}", g_config.JobId, g_config.StepId,
+                           task_id, suffix);
+
+  // The spool directory belongs to root, so the user can open the file but
+  // can't replace it.
+  int fd = open(stream->spool_path.c_str(),
+                O_RDWR | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    CRANE_ERROR("[Output spool] Failed to create {}: {}",
+                stream->spool_path.string(), strerror(errno));
+    return false;
+  }
+  if (fchown(fd, m_uid_, m_gid_) != 0) {
+    CRANE_ERROR("[Output spool] Failed to chown {}: {}",
+                stream->spool_path.string(), strerror(errno));
+    close(fd);
+    unlink(stream->spool_path.c_str());
+    return false;
+  }
+
+  stream->spool_fd = fd;
+  return true;
+}
+
+std::optional<OutputSpool::Paths> OutputSpool::Register(
+    task_id_t task_id, const std::string& output_path,
+    const std::string& error_path, bool append) {
+  auto task = std::make_unique<Task>();
+  task->append = append;
+
+  if (!CreateSpoolFile_("out", task_id, output_path, &task->output))
+    return std::nullopt;
+  if (!error_path.empty() &&
+      !CreateSpoolFile_("err", task_id, error_path, &task->error)) {
+    close(task->output.spool_fd);
+    unlink(task->output.spool_path.c_str());
+    return std::nullopt;
+  }
+
+  Paths paths{.output = task->output.spool_path};
+  if (!error_path.empty()) paths.error = task->error.spool_path;
+
+  absl::MutexLock lock(&m_mtx_);
+  m_tasks_[task_id] = std::move(task);
+  return paths;
+}
+
+bool OutputSpool::FinishAsync(task_id_t task_id, FinishCallback callback) {
+  absl::MutexLock lock(&m_mtx_);
+  auto it = m_tasks_.find(task_id);
+  if (it == m_tasks_.end()) return false;
+
+  it->second->finishing = true;
+  it->second->on_finished = std::move(callback);
+  return true;
+}
+
+std::optional<std::string> OutputSpool::ReleaseTask_(task_id_t task_id,
+                                                     Task* task) {
+  std::vector<std::string> errors;
+  for (Stream* stream : {&task->output, &task->error}) {
+    if (stream->spool_fd < 0) continue;
+    close(stream->spool_fd);
+    stream->spool_fd = -1;
+    if (stream->final_fd >= 0) close(stream->final_fd);
+    stream->final_fd = -1;
+
+    if (stream->error) {
+      CRANE_WARN("[Output spool] Task #{}: {}", task_id, *stream->error);
+      errors.emplace_back(
+          fmt::format("{}, kept at {} on {}", *stream->error,
+                      stream->spool_path.string(),
+                      g_config.CranedIdOfThisNode));
+    } else {
+      unlink(stream->spool_path.c_str());
+    }
+  }
+
+  if (errors.empty()) return std::nullopt;
+  return fmt::format("Failed to copy spooled output: {}",
+                     absl::StrJoin(errors, "; "));
+}
+
+std::optional<std::string> OutputSpool::SwitchThreadCredentials_() const {
+  // The output paths may only be writable through a supplementary group of
+  // the user, like for the processes of the task.
+  PasswordEntry pwd(m_uid_);
+  if (!pwd.Valid()) return fmt::format("uid {} not found", m_uid_);
+
+  int ngroups = 0;
+  // We should not check rc here. It must be -1.
+  getgrouplist(pwd.Username().c_str(), m_gid_, nullptr, &ngroups);
+  std::vector<gid_t> gids(ngroups);
+  if (getgrouplist(pwd.Username().c_str(), m_gid_, gids.data(), &ngroups) ==
+      -1)
+    return fmt::format("getgrouplist() failed for user '{}'", pwd.Username());
+  gids.resize(ngroups);
+
+  // The glibc wrappers change the credentials of all the threads of the
+  // process, the raw system calls only those of the calling thread.
+  if (syscall(SYS_setgroups, gids.size(), gids.data()) != 0 ||
+      syscall(SYS_setresgid, m_gid_, m_gid_, m_gid_) != 0 ||
+      syscall(SYS_setresuid, m_uid_, m_uid_, m_uid_) != 0)
+    return fmt::format("failed to switch to uid {}: {}", m_uid_,
+                       strerror(errno));
+  return std::nullopt;
+}
+
+bool OutputSpool::CopierWoken_() const {
+  if (m_stopped_) return true;
+  return std::ranges::any_of(
+      m_tasks_, [](const auto& kv) { return kv.second->finishing; });
+}
+
+void OutputSpool::CopierThread_() {
+  util::SetCurrentThreadName("OutputSpool");
+
+  m_credential_error_ = SwitchThreadCredentials_();
+  if (m_credential_error_)
+    CRANE_ERROR("[Output spool] Copier {}.", *m_credential_error_);
+  m_buffer_.resize(kCopyChunkBytes);
+
+  m_mtx_.Lock();
+  while (!m_stopped_) {
+    m_mtx_.AwaitWithTimeout(
+        absl::Condition(this, &OutputSpool::CopierWoken_), kPollInterval);
+
+    std::vector<std::tuple<task_id_t, Task*, bool>> work;
+    for (auto& [task_id, task] : m_tasks_)
+      work.emplace_back(task_id, task.get(), task->finishing);
+    m_mtx_.Unlock();
+
+    for (auto [task_id, task, last] : work) {
+      CopyStream_(task->append, last, &task->output);
+      CopyStream_(task->append, last, &task->error);
+    }
+
+    std::vector<std::pair<task_id_t, std::unique_ptr<Task>>> finished;
+    m_mtx_.Lock();
+    for (auto [task_id, task, last] : work) {
+      if (!last) continue;
+      finished.emplace_back(task_id, std::move(m_tasks_.at(task_id)));
+      m_tasks_.erase(task_id);
+    }
+    m_mtx_.Unlock();
+
+    // The callbacks are called without the lock, so they may register or
+    // finish other tasks.
+    for (auto& [task_id, task] : finished)
+      task->on_finished(ReleaseTask_(task_id, task.get()));
+
+    m_mtx_.Lock();
+  }
+  m_mtx_.Unlock();
+}
+
+void OutputSpool::CopyStream_(bool append, bool last, Stream* stream) {
+  if (stream->spool_fd < 0 || stream->error) return;
+
+  if (m_credential_error_) {
+    stream->error = fmt::format("{}: {}", stream->final_path,
+                                *m_credential_error_);
+    return;
+  }
+
+  struct stat st{};
+  if (fstat(stream->spool_fd, &st) != 0) {
+    stream->error = fmt::format("stat {}: {}", stream->spool_path.string(),
+                                strerror(errno));
+    return;
+  }
+  uint64_t size = st.st_size;
+  if (!last && size - stream->copied < m_flush_threshold_bytes_) return;
+
+  if (stream->final_fd < 0) {
+    // Truncated only once, later copies go on from the end of the last one.
+    int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (append ? O_APPEND : O_TRUNC);
+    stream->final_fd = open(stream->final_path.c_str(), flags, 0644);
+    if (stream->final_fd < 0) {
+      stream->error =
+          fmt::format("open {}: {}", stream->final_path, strerror(errno));
+      return;
+    }
+  }
+
+  while (stream->copied < size) {
+    size_t len = std::min<uint64_t>(kCopyChunkBytes, size - stream->copied);
+    ssize_t n = pread(stream->spool_fd, m_buffer_.data(), len,
+                      static_cast<off_t>(stream->copied));
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) {
+      stream->error = fmt::format("read {}: {}", stream->spool_path.string(),
+                                  n < 0 ? strerror(errno) : "unexpected EOF");
+      return;
+    }
+
+    if (!util::os::WriteAll(stream->final_fd, m_buffer_.data(), n)) {
+      stream->error =
+          fmt::format("write {}: {}", stream->final_path, strerror(errno));
+      return;
+    }
+    stream->copied += n;
+  }
+
+  if (last) {
+    // Shared file systems may report failed writes only on close().
+    int err = close(stream->final_fd);
+    stream->final_fd = -1;
+    if (err != 0)
+      stream->error =
+          fmt::format("close {}: {}", stream->final_path, strerror(errno));
+  }
+}
+
+}  // namespace Craned::Supervisor
@@ -0,0 +1,136 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "SupervisorPublicDefs.h"
+// Precompiled header comes first.
+
+namespace Craned::Supervisor {
+
+/**
+ * Spools the stdout and stderr of batch tasks to node-local files and
+ * copies them to the paths asked by the user, which are usually on a
+ * shared file system, in large sequential writes.
+ *
+ * The final files are opened only when the first copy happens, so tasks
+ * starting together don't create their output files at once, and the small
+ * writes of the task stay on the node. A spooled stream is copied once it
+ * grows by the flush threshold since the last copy and once more when the
+ * task ends.
+ *
+ * Copies run in a thread whose credentials are switched to the user of the
+ * step, so the final files are created and written as the user, even on
+ * file systems squashing root. The spool files are owned by the user and
+ * kept on a failed copy for recovery.
+ */
+class OutputSpool {
+ public:
+  struct Paths {
+    std::string output;
+    // Empty if stderr goes to the output file.
+    std::string error;
+  };
+
+  OutputSpool(std::filesystem::path dir, uint64_t flush_threshold_bytes,
+              uid_t uid, gid_t gid);
+  ~OutputSpool();
+
+  /**
+   * @brief Create the spool files of the task, which its process opens
+   * instead of output_path and error_path.
+   * @return std::nullopt if the files can't be created, in which case the
+   * task writes to the final paths directly.
+   */
+  std::optional<Paths> Register(task_id_t task_id,
+                                const std::string& output_path,
+                                const std::string& error_path, bool append);
+
+  using FinishCallback = std::function<void(std::optional<std::string>)>;
+
+  /**
+   * @brief Copy what is left of the output of an ended task and remove its
+   * spool files in the copier thread.
+   * @param callback Called in the copier thread once the copy is done, with
+   * the reason of a failed copy or std::nullopt on success.
+   * @return false if the task was not spooled, in which case callback is not
+   * called. Neither is it if the spool is destroyed before the copy.
+   */
+  bool FinishAsync(task_id_t task_id, FinishCallback callback);
+
+ private:
+  static constexpr absl::Duration kPollInterval = absl::Seconds(1);
+  static constexpr size_t kCopyChunkBytes = 4 * 1024 * 1024;
+
+  struct Stream {
+    std::string final_path;
+    std::filesystem::path spool_path;
+    int spool_fd{-1};
+    int final_fd{-1};
+    uint64_t copied{0};
+    std::optional<std::string> error;
+  };
+
+  struct Task {
+    Stream output;
+    Stream error;
+    bool append{false};
+    // Set by FinishAsync(). The copier erases the task after the last copy.
+    bool finishing{false};
+    FinishCallback on_finished;
+  };
+
+  bool CreateSpoolFile_(const std::string& suffix, task_id_t task_id,
+                        const std::string& final_path, Stream* stream) const;
+
+  // Switch the credentials of the calling thread only.
+  std::optional<std::string> SwitchThreadCredentials_() const;
+
+  void CopierThread_();
+  bool CopierWoken_() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(m_mtx_);
+
+  // Called in the copier thread without the lock. Copies once the stream
+  // grew by the threshold, or everything if last is set.
+  void CopyStream_(bool append, bool last, Stream* stream);
+
+  // Closes and removes the spool files of a finished task.
+  static std::optional<std::string> ReleaseTask_(task_id_t task_id,
+                                                 Task* task);
+
+  const std::filesystem::path m_dir_;
+  const uint64_t m_flush_threshold_bytes_;
+  const uid_t m_uid_;
+  const gid_t m_gid_;
+
+  // Only touched by the copier thread.
+  std::vector<char> m_buffer_;
+  std::optional<std::string> m_credential_error_;
+
+  absl::Mutex m_mtx_;
+  // Entries are only erased by the copier, so it reads them without the
+  // lock.
+  std::unordered_map<task_id_t, std::unique_ptr<Task>> m_tasks_
+      ABSL_GUARDED_BY(m_mtx_);
+  bool m_stopped_ ABSL_GUARDED_BY(m_mtx_){false};
+
+  std::thread m_copier_thread_;
+};
+
+}  // namespace Craned::Supervisor
+
+inline std::unique_ptr<Craned::Supervisor::OutputSpool> g_output_spool;
@@ -22,7 +22,9 @@
 
 #include <cxxopts.hpp>
 
+#include "BundleCache.h"
 #include "CranedClient.h"
+#include "OutputSpool.h"
 #include "SupervisorServer.h"
 #include "TaskManager.h"
 #include "crane/PasswordEntry.h"
@@ -30,6 +32,40 @@
 
 using Craned::Supervisor::g_config;
 
+// Job independent part of the process setup, done before the job is known
+// when started with --warm.
+void PrepareProcess() {
+  // Ignore following sig
+  signal(SIGINT, SIG_IGN);
+  signal(SIGTERM, SIG_IGN);
+  signal(SIGTSTP, SIG_IGN);
+  signal(SIGQUIT, SIG_IGN);
+  // Mask SIGPIPE to prevent Supervisor from crushing due to
+  // SIGPIPE while communicating with spawned task processes.
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGUSR1, SIG_IGN);
+  signal(SIGUSR2, SIG_IGN);
+  signal(SIGALRM, SIG_IGN);
+  signal(SIGHUP, SIG_IGN);
+
+  std::filesystem::path oom_adj_file =
+      fmt::format("/proc/{}/oom_score_adj", getpid());
+
+  std::ofstream oom_adj_file_stream(oom_adj_file);
+  if (!oom_adj_file_stream.is_open()) {
+    std::exit(1);
+  }
+
+  oom_adj_file_stream << "-1000";
+  oom_adj_file_stream.close();
+
+  if (oom_adj_file_stream.fail()) {
+    std::exit(1);
+  }
+
+  PasswordEntry::InitializeEntrySize();
+}
+
 void InitFromStdin(int argc, char** argv) {
   cxxopts::Options options("CSupervisor");
 
@@ -37,6 +73,7 @@ void InitFromStdin(int argc, char** argv) {
   options.add_options()
       ("v,version", "Display version information")
       ("h,help", "Display help for CSupervisor")
+      ("w,warm", "Start idle and wait for a job from Craned")
       ;
   // clang-format on
 
@@ -59,12 +96,32 @@ void InitFromStdin(int argc, char** argv) {
   }
 
   using google::protobuf::io::FileInputStream;
+  using google::protobuf::io::FileOutputStream;
   using google::protobuf::util::ParseDelimitedFromZeroCopyStream;
+  using google::protobuf::util::SerializeDelimitedToZeroCopyStream;
+
+  if (parsed_args.count("warm") > 0) {
+    g_config.WarmStarted = true;
+    PrepareProcess();
+
+    // Tell Craned that this supervisor is idle. The init request below is
+    // not sent until a job is bound to it.
+    auto ostream = FileOutputStream(STDOUT_FILENO);
+    crane::grpc::supervisor::SupervisorReady idle;
+    idle.set_ok(true);
+    if (!SerializeDelimitedToZeroCopyStream(idle, &ostream) ||
+        !ostream.Flush())
+      std::abort();
+  }
 
   auto istream = FileInputStream(STDIN_FILENO);
   crane::grpc::supervisor::InitSupervisorRequest msg;
-  auto ok = ParseDelimitedFromZeroCopyStream(&msg, &istream, nullptr);
+  bool clean_eof = false;
+  auto ok = ParseDelimitedFromZeroCopyStream(&msg, &istream, &clean_eof);
   if (!ok) {
+    // Craned dropped this idle supervisor.
+    if (g_config.WarmStarted && clean_eof) std::exit(0);
+
     fmt::print(stderr, "[Supervisor] Failed to recv message from Craned.\n");
     std::abort();
   }
@@ -104,12 +161,28 @@ void InitFromStdin(int argc, char** argv) {
     g_config.Container.RuntimeRun = msg.container_config().run_cmd();
     g_config.Container.RuntimeKill = msg.container_config().kill_cmd();
     g_config.Container.RuntimeDelete = msg.container_config().delete_cmd();
+    g_config.Container.BundleCacheDir =
+        msg.container_config().bundle_cache_dir();
+    g_config.Container.BundleCacheQuota =
+        msg.container_config().bundle_cache_quota();
+  }
+
+  // Output spool config
+  g_config.OutputSpool.Enabled = msg.has_output_spool_config();
+  if (g_config.OutputSpool.Enabled) {
+    g_config.OutputSpool.SpoolDir = msg.output_spool_config().spool_dir();
+    g_config.OutputSpool.FlushThreshold =
+        msg.output_spool_config().flush_threshold();
   }
 
   // Plugin config
   g_config.Plugin.Enabled = msg.has_plugin_config();
-  if (g_config.Plugin.Enabled)
+  if (g_config.Plugin.Enabled) {
     g_config.Plugin.PlugindSockPath = msg.plugin_config().socket_path();
+    g_config.Plugin.MaxQueuedEvents = msg.plugin_config().max_queued_events();
+    g_config.Plugin.BlockOnQueueFull =
+        msg.plugin_config().block_on_queue_full();
+  }
 
   g_config.SupervisorLogFile = std::filesystem::path(msg.log_dir()) /
                                fmt::format("{}.log", g_config.JobId);
@@ -124,8 +197,6 @@ void InitFromStdin(int argc, char** argv) {
   }
 
   if (!ok) {
-    using google::protobuf::io::FileOutputStream;
-    using google::protobuf::util::SerializeDelimitedToZeroCopyStream;
     auto ostream = FileOutputStream(STDOUT_FILENO);
     crane::grpc::supervisor::SupervisorReady msg;
     msg.set_ok(ok);
@@ -164,35 +235,7 @@ void GlobalVariableInit() {
     std::abort();
   }
 
-  // Ignore following sig
-  signal(SIGINT, SIG_IGN);
-  signal(SIGTERM, SIG_IGN);
-  signal(SIGTSTP, SIG_IGN);
-  signal(SIGQUIT, SIG_IGN);
-  // Mask SIGPIPE to prevent Supervisor from crushing due to
-  // SIGPIPE while communicating with spawned task processes.
-  signal(SIGPIPE, SIG_IGN);
-  signal(SIGUSR1, SIG_IGN);
-  signal(SIGUSR2, SIG_IGN);
-  signal(SIGALRM, SIG_IGN);
-  signal(SIGHUP, SIG_IGN);
-
-  std::filesystem::path oom_adj_file =
-      fmt::format("/proc/{}/oom_score_adj", getpid());
-
-  std::ofstream oom_adj_file_stream(oom_adj_file);
-  if (!oom_adj_file_stream.is_open()) {
-    std::exit(1);
-  }
-
-  oom_adj_file_stream << "-1000";
-  oom_adj_file_stream.close();
-
-  if (oom_adj_file_stream.fail()) {
-    std::exit(1);
-  }
-
-  PasswordEntry::InitializeEntrySize();
+  if (!g_config.WarmStarted) PrepareProcess();
 
   Craned::Common::CgroupManager::Init(
       StrToLogLevel(g_config.SupervisorDebugLevel).value());
@@ -200,6 +243,17 @@ void GlobalVariableInit() {
       std::make_unique<BS::thread_pool>(std::thread::hardware_concurrency());
   g_task_mgr = std::make_unique<Craned::Supervisor::TaskManager>();
 
+  if (g_config.Container.Enabled && g_config.Container.BundleCacheQuota > 0)
+    g_bundle_cache = std::make_unique<Craned::Supervisor::BundleCache>(
+        g_config.Container.BundleCacheDir,
+        g_config.Container.BundleCacheQuota);
+
+  if (g_config.OutputSpool.Enabled &&
+      g_config.StepSpec.type() == crane::grpc::Batch)
+    g_output_spool = std::make_unique<Craned::Supervisor::OutputSpool>(
+        g_config.OutputSpool.SpoolDir, g_config.OutputSpool.FlushThreshold,
+        g_config.StepSpec.uid(), g_config.StepSpec.gid());
+
   g_craned_client = std::make_unique<Craned::Supervisor::CranedClient>();
   g_craned_client->InitChannelAndStub(
       fmt::format("unix://{}", g_config.CranedUnixSocketPath.string()));
@@ -207,13 +261,20 @@ void GlobalVariableInit() {
   if (g_config.Plugin.Enabled) {
     CRANE_INFO("[Plugin] Plugin module is enabled.");
     g_plugin_client = std::make_unique<plugin::PluginClient>();
-    g_plugin_client->InitChannelAndStub(g_config.Plugin.PlugindSockPath);
+    g_plugin_client->InitChannelAndStub(
+        g_config.Plugin.PlugindSockPath, g_config.Plugin.MaxQueuedEvents,
+        g_config.Plugin.BlockOnQueueFull
+            ? plugin::PluginClient::QueueFullPolicy::BLOCK
+            : plugin::PluginClient::QueueFullPolicy::DROP);
   }
 
   g_server = std::make_unique<Craned::Supervisor::SupervisorServer>();
 
   // Make sure grpc server is ready to receive requests.
-  std::this_thread::sleep_for(std::chrono::seconds(1));
+  // BuildAndStart() has bound the socket already, so a warm supervisor, which
+  // exists to cut the launch latency, does not wait.
+  if (!g_config.WarmStarted)
+    std::this_thread::sleep_for(std::chrono::seconds(1));
 
   ok = SerializeDelimitedToZeroCopyStream(msg, &ostream);
   ok &= ostream.Flush();
@@ -238,6 +299,7 @@ void StartServer() {
   g_server.reset();
   g_task_mgr->Wait();
   g_task_mgr.reset();
+  g_output_spool.reset();
 
   g_craned_client.reset();
   g_plugin_client.reset();
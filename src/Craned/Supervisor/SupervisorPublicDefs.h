@@ -56,17 +56,33 @@ struct Config {
     std::string RuntimeRun;
     std::string RuntimeKill;
     std::string RuntimeDelete;
+    // Rootfs of bundles are cached here when BundleCacheQuota is not 0.
+    std::filesystem::path BundleCacheDir;
+    uint64_t BundleCacheQuota{0};
   };
   ContainerConfig Container;
 
+  struct OutputSpoolConfig {
+    bool Enabled{false};
+    std::filesystem::path SpoolDir;
+    uint64_t FlushThreshold{0};
+  };
+  OutputSpoolConfig OutputSpool;
+
   struct PluginConfig {
     bool Enabled{false};
     std::string PlugindSockPath;
+    uint32_t MaxQueuedEvents{kDefaultPluginMaxQueuedEvents};
+    // Hook calls wait for the queue instead of dropping the events if set.
+    bool BlockOnQueueFull{false};
   };
   PluginConfig Plugin;
 
   bool CompressedRpc{};
 
+  // Started by the warm supervisor pool of Craned before the job was known.
+  bool WarmStarted{false};
+
   std::string SupervisorDebugLevel;
 
   std::filesystem::path CraneBaseDir;
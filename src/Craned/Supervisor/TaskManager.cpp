@@ -27,8 +27,10 @@
 
 #include <nlohmann/json.hpp>
 
+#include "BundleCache.h"
 #include "CforedClient.h"
 #include "CranedClient.h"
+#include "OutputSpool.h"
 #include "SupervisorPublicDefs.h"
 #include "SupervisorServer.h"
 #include "crane/OS.h"
@@ -151,8 +153,10 @@ ITaskInstance::~ITaskInstance() {
   }
 }
 
-EnvMap ITaskInstance::GetChildProcessEnv() const {
-  std::unordered_map<std::string, std::string> env_map;
+const EnvMap& StepInstance::GetTaskBaseEnv() {
+  if (m_task_base_env_.has_value()) return m_task_base_env_.value();
+
+  EnvMap& env_map = m_task_base_env_.emplace();
 
   // Job env from CraneD
   for (auto& [name, value] : g_config.JobEnv) {
@@ -160,14 +164,20 @@ EnvMap ITaskInstance::GetChildProcessEnv() const {
   }
 
   // Crane env will override user task env;
-  for (auto& [name, value] : this->m_parent_step_inst_->GetStep().env()) {
+  for (auto& [name, value] : m_step_to_supv_.env()) {
     env_map.emplace(name, value);
   }
 
-  for (auto& [name, value] : this->m_parent_step_inst_->GetStepProcessEnv()) {
+  for (auto& [name, value] : GetStepProcessEnv()) {
     env_map.emplace(name, value);
   }
 
+  return env_map;
+}
+
+EnvMap ITaskInstance::GetChildProcessEnv() const {
+  EnvMap env_map = m_parent_step_inst_->GetTaskBaseEnv();
+
   // TODO: Move this to step instance.
   if (this->m_parent_step_inst_->IsCrun()) {
     auto const& ia_meta =
@@ -176,18 +186,20 @@ EnvMap ITaskInstance::GetChildProcessEnv() const {
       env_map.emplace("TERM", ia_meta.term_env());
 
     if (ia_meta.x11()) {
-      auto const& x11_meta = ia_meta.x11_meta();
-
-      std::string target =
-          ia_meta.x11_meta().enable_forwarding() ? "" : x11_meta.target();
-      env_map["DISPLAY"] =
-          fmt::format("{}:{}", target, this->GetCrunMeta()->x11_port - 6000);
+      env_map["DISPLAY"] = GetCrunX11Display_();
       env_map["XAUTHORITY"] = this->GetCrunMeta()->x11_auth_path;
     }
   }
   return env_map;
 }
 
+std::string ITaskInstance::GetCrunX11Display_() const {
+  const auto& x11_meta =
+      m_parent_step_inst_->GetStep().interactive_meta().x11_meta();
+  std::string target = x11_meta.enable_forwarding() ? "" : x11_meta.target();
+  return fmt::format("{}:{}", target, this->GetCrunMeta()->x11_port - 6000);
+}
+
 std::string ITaskInstance::ParseFilePathPattern_(const std::string& pattern,
                                                  const std::string& cwd) const {
   std::filesystem::path resolved_path(pattern);
@@ -434,10 +446,19 @@ CraneErrCode ITaskInstance::SetChildProcessBatchFd_() {
   int stdout_fd, stderr_fd;
 
   auto* meta = dynamic_cast<BatchInstanceMeta*>(m_meta_.get());
-  const std::string& stdout_file_path = meta->parsed_output_file_pattern;
-  const std::string& stderr_file_path = meta->parsed_error_file_pattern;
-
-  int open_mode = m_parent_step_inst_->GetStep().batch_meta().open_mode_append()
+  bool spooled = !meta->spool_output_path.empty();
+  const std::string& stdout_file_path = spooled
+                                            ? meta->spool_output_path
+                                            : meta->parsed_output_file_pattern;
+  const std::string& stderr_file_path = spooled
+                                            ? meta->spool_error_path
+                                            : meta->parsed_error_file_pattern;
+
+  // The spool files are created empty by the supervisor, which applies the
+  // open mode when copying them.
+  int open_mode = spooled || m_parent_step_inst_->GetStep()
+                                 .batch_meta()
+                                 .open_mode_append()
                       ? O_APPEND
                       : O_TRUNC;
   stdout_fd =
@@ -468,6 +489,21 @@ CraneErrCode ITaskInstance::SetChildProcessBatchFd_() {
   return CraneErrCode::SUCCESS;
 }
 
+void ITaskInstance::SpoolBatchOutput_(BatchInstanceMeta* meta) {
+  std::optional<OutputSpool::Paths> paths = g_output_spool->Register(
+      task_id, meta->parsed_output_file_pattern,
+      meta->parsed_error_file_pattern,
+      m_parent_step_inst_->GetStep().batch_meta().open_mode_append());
+  if (!paths) {
+    CRANE_WARN("[Task #{}] Failed to spool the output, writing to {} directly.",
+               task_id, meta->parsed_output_file_pattern);
+    return;
+  }
+
+  meta->spool_output_path = std::move(paths->output);
+  meta->spool_error_path = std::move(paths->error);
+}
+
 void ITaskInstance::SetupCrunFwdAtChild_() {
   const auto* meta = GetCrunInstanceMeta();
 
@@ -552,6 +588,14 @@ CraneErrCode ITaskInstance::SetChildProcessEnv_() const {
   return CraneErrCode::SUCCESS;
 }
 
+std::vector<std::string> ITaskInstance::GetChildProcessEnvBlock_() const {
+  std::vector<std::string> env_block;
+  env_block.reserve(m_env_.size() + 1);
+  for (const auto& [name, value] : m_env_)
+    env_block.emplace_back(fmt::format("{}={}", name, value));
+  return env_block;
+}
+
 std::vector<std::string> ITaskInstance::GetChildProcessExecArgv_() const {
   // "bash (--login) -c 'm_executable_ [m_arguments_...]'"
   std::vector<std::string> argv;
@@ -619,7 +663,7 @@ CraneErrCode ContainerInstance::ModifyOCIBundleConfig_(
     // Set root object, see:
     // https://github.com/opencontainers/runtime-spec/blob/main/config.md#root
     // Set real rootfs path in the modified config.
-    config["root"]["path"] = src_rootfs;
+    config["root"]["path"] = m_rootfs_path_;
 
     // Set mounts array, see:
     // https://github.com/opencontainers/runtime-spec/blob/main/config.md#mounts
@@ -676,6 +720,41 @@ CraneErrCode ContainerInstance::ModifyOCIBundleConfig_(
   return CraneErrCode::SUCCESS;
 }
 
+void ContainerInstance::PrepareCachedRootfs_() {
+  const auto& step = m_parent_step_inst_->GetStep();
+  auto start = std::chrono::steady_clock::now();
+
+  auto entry = g_bundle_cache->Acquire(m_bundle_path_, step.task_id(),
+                                       step.uid(), step.gid());
+  if (!entry) {
+    CRANE_WARN("[Task #{}] Bundle cache unavailable, using bundle in place.",
+               step.task_id());
+    return;
+  }
+
+  std::filesystem::path merged = m_temp_path_ / "rootfs";
+  if (!BundleCache::MountSnapshot(entry->rootfs, m_temp_path_ / "upper",
+                                  m_temp_path_ / "work", merged, step.uid(),
+                                  step.gid())) {
+    g_bundle_cache->Release(entry->key, step.task_id());
+    CRANE_WARN("[Task #{}] Failed to mount bundle snapshot, using bundle in "
+               "place.",
+               step.task_id());
+    return;
+  }
+
+  m_rootfs_path_ = std::move(merged);
+  m_cache_key_ = std::move(entry->key);
+
+  auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - start);
+  CRANE_INFO(
+      "[Task #{}] Bundle cache {} for {}, prepared in {} ms. Node hit "
+      "rate {}/{}.",
+      step.task_id(), entry->hit ? "hit" : "miss", m_bundle_path_.string(),
+      elapsed.count(), entry->node_hits, entry->node_lookups);
+}
+
 CraneErrCode ContainerInstance::Prepare() {
   // Generate path and params.
   m_temp_path_ = g_config.Container.TempDir /
@@ -745,12 +824,16 @@ CraneErrCode ContainerInstance::Prepare() {
           m_parent_step_inst_->GetStep().cwd());
     }
 
+    if (g_output_spool) SpoolBatchOutput_(meta.get());
     m_meta_ = std::move(meta);
   } else {
     m_meta_ = std::make_unique<CrunInstanceMeta>();
   }
   m_meta_->parsed_sh_script_path = sh_path;
 
+  m_rootfs_path_ = m_bundle_path_ / "rootfs";
+  if (g_bundle_cache) PrepareCachedRootfs_();
+
   // Modify bundle
   auto err = ModifyOCIBundleConfig_(m_bundle_path_, m_temp_path_);
   if (err != CraneErrCode::SUCCESS) {
@@ -1048,6 +1131,15 @@ CraneErrCode ContainerInstance::Kill(int signum) {
 }
 
 CraneErrCode ContainerInstance::Cleanup() {
+  if (!m_cache_key_.empty()) {
+    // Unmounted before the temp folder, which holds the mount point, is
+    // removed.
+    BundleCache::UnmountSnapshot(m_rootfs_path_);
+    g_bundle_cache->Release(m_cache_key_,
+                            m_parent_step_inst_->GetStep().task_id());
+    m_cache_key_.clear();
+  }
+
   if (m_parent_step_inst_->IsBatch() || m_parent_step_inst_->IsCrun()) {
     if (!m_temp_path_.empty())
       g_thread_pool->detach_task(
@@ -1143,6 +1235,7 @@ CraneErrCode ProcInstance::Prepare() {
           m_parent_step_inst_->GetStep().cwd());
     }
 
+    if (g_output_spool) SpoolBatchOutput_(meta.get());
     m_meta_ = std::move(meta);
   } else {
     m_meta_ = std::make_unique<CrunInstanceMeta>();
@@ -1192,6 +1285,15 @@ CraneErrCode ProcInstance::Spawn() {
     return CraneErrCode::ERR_SYSTEM_ERR;
   }
 
+  // Everything but the DISPLAY of x11, which depends on the port the
+  // parent forwards after fork(), is known here.
+  m_env_ = GetChildProcessEnv();
+  bool x11 = m_parent_step_inst_->IsCrun() &&
+             m_parent_step_inst_->GetStep().interactive_meta().x11();
+  if (x11) m_env_.erase("DISPLAY");
+  std::vector<std::string> env_block = GetChildProcessEnvBlock_();
+  auto argv = GetChildProcessExecArgv_();
+
   pid_t child_pid = -1;
   if (m_parent_step_inst_->IsBatch())
     child_pid = fork();
@@ -1338,36 +1440,30 @@ CraneErrCode ProcInstance::Spawn() {
     if (m_parent_step_inst_->IsBatch()) close(0);
     util::os::CloseFdFrom(3);
 
-    if (m_parent_step_inst_->IsCrun() &&
-        m_parent_step_inst_->GetStep().interactive_meta().x11()) {
+    if (x11) {
       this->GetCrunMeta()->x11_port = msg.x11_port();
       SetupChildProcessCrunX11_();
+      env_block.emplace_back(fmt::format("DISPLAY={}", GetCrunX11Display_()));
     }
 
-    m_env_ = GetChildProcessEnv();
-
-    // Apply environment variables
-    err = SetChildProcessEnv_();
-    if (err != CraneErrCode::SUCCESS) {
-      fmt::print(stderr, "[Subprocess] Error: Failed to set environment ");
-    }
-
-    // Prepare the command line arguments.
-    auto argv = GetChildProcessExecArgv_();
-    auto argv_ptrs = argv |
-                     std::ranges::views::transform(
-                         [](const std::string& s) { return s.c_str(); }) |
-                     std::ranges::to<std::vector<const char*>>();
+    auto to_c_str = std::ranges::views::transform(
+        [](const std::string& s) { return s.c_str(); });
+    auto argv_ptrs =
+        argv | to_c_str | std::ranges::to<std::vector<const char*>>();
     argv_ptrs.push_back(nullptr);
+    auto envp_ptrs =
+        env_block | to_c_str | std::ranges::to<std::vector<const char*>>();
+    envp_ptrs.push_back(nullptr);
 
     // Exec
     // fmt::print(stderr, "DEBUG\n");
     // for (const auto& arg : argv) fmt::print(stderr, "\"{}\" ", arg);
-    execv(argv_ptrs[0], const_cast<char* const*>(argv_ptrs.data()));
+    execve(argv_ptrs[0], const_cast<char* const*>(argv_ptrs.data()),
+           const_cast<char* const*>(envp_ptrs.data()));
 
-    // Error occurred since execv returned. At this point, errno is set.
+    // Error occurred since execve returned. At this point, errno is set.
     // Ctld use SIGABRT to inform the client of this failure.
-    fmt::print(stderr, "[Subprocess] Error: execv failed: {}\n",
+    fmt::print(stderr, "[Subprocess] Error: execve failed: {}\n",
                strerror(errno));
     // TODO: See https://tldp.org/LDP/abs/html/exitcodes.html, return standard
     //  exit codes
@@ -1471,6 +1567,12 @@ TaskManager::TaskManager()
         EvCleanChangeTaskTimeLimitQueueCb_();
       });
 
+  m_spool_finished_async_handle_ = m_uvw_loop_->resource<uvw::async_handle>();
+  m_spool_finished_async_handle_->on<uvw::async_event>(
+      [this](const uvw::async_event&, uvw::async_handle&) {
+        EvCleanSpoolFinishedQueueCb_();
+      });
+
   m_grpc_execute_task_async_handle_ =
       m_uvw_loop_->resource<uvw::async_handle>();
   m_grpc_execute_task_async_handle_->on<uvw::async_event>(
@@ -1532,9 +1634,44 @@ void TaskManager::ActivateTaskStatusChange_(task_id_t task_id,
                                             std::optional<std::string> reason) {
   auto task = m_step_.RemoveTaskInstance(task_id);
   task->Cleanup();
+
+  // The last copy of the spooled output may take long on a shared file
+  // system, so the status is only changed once it is done.
+  if (g_output_spool &&
+      g_output_spool->FinishAsync(
+          task_id, [this, task_id, new_status, exit_code,
+                    reason](std::optional<std::string> spool_err) mutable {
+            if (spool_err)
+              reason = reason ? fmt::format("{}; {}", *reason, *spool_err)
+                              : std::move(spool_err);
+            m_spool_finished_queue_.enqueue({.task_id = task_id,
+                                             .new_status = new_status,
+                                             .exit_code = exit_code,
+                                             .reason = std::move(reason)});
+            m_spool_finished_async_handle_->send();
+          })) {
+    m_spool_finishing_num_++;
+    return;
+  }
+
+  TaskDone_(new_status, exit_code, std::move(reason));
+}
+
+void TaskManager::EvCleanSpoolFinishedQueueCb_() {
+  SpoolFinishedQueueElem elem;
+  while (m_spool_finished_queue_.try_dequeue(elem)) {
+    CRANE_TRACE("[Task #{}] Spooled output is copied.", elem.task_id);
+    m_spool_finishing_num_--;
+    TaskDone_(elem.new_status, elem.exit_code, std::move(elem.reason));
+  }
+}
+
+void TaskManager::TaskDone_(crane::grpc::TaskStatus new_status,
+                            uint32_t exit_code,
+                            std::optional<std::string> reason) {
   bool orphaned = m_step_.orphaned;
   // No need to free the TaskInstance structure,will destruct with TaskMgr.
-  if (m_step_.AllTaskFinished()) {
+  if (m_step_.AllTaskFinished() && m_spool_finishing_num_ == 0) {
     if (!orphaned)
       g_craned_client->StepStatusChangeAsync(new_status, exit_code,
                                              std::move(reason));
@@ -1582,7 +1719,9 @@ void TaskManager::LaunchExecution_(ITaskInstance* task) {
   // In this case, SIGCHLD will NOT be received for this task, and
   // we should send TaskStatusChange manually.
 
-  if (m_step_.IsCrun()) m_step_.InitCforedClient();
+  // Shared by all the tasks of the step.
+  if (m_step_.IsCrun() && m_step_.GetCforedClient() == nullptr)
+    m_step_.InitCforedClient();
 
   err = task->Spawn();
   if (err != CraneErrCode::SUCCESS) {
@@ -1846,6 +1985,11 @@ void TaskManager::EvCleanChangeTaskTimeLimitQueueCb_() {
 }
 
 void TaskManager::EvGrpcExecuteTaskCb_() {
+  // Tasks queued together are launched in one round, whose spread of launch
+  // times is reported as the startup skew of the tasks.
+  auto round_start = std::chrono::steady_clock::now();
+  std::vector<std::chrono::steady_clock::duration> launch_times;
+
   struct ExecuteTaskElem elem;
   while (m_grpc_execute_task_queue_.try_dequeue(elem)) {
     auto task = std::move(elem.instance);
@@ -1857,7 +2001,7 @@ void TaskManager::EvGrpcExecuteTaskCb_() {
     AddTerminationTimer_(sec);
     CRANE_TRACE("Add a timer of {} seconds", sec);
 
-    m_step_.pwd.Init(m_step_.uid);
+    if (!m_step_.pwd.Valid()) m_step_.pwd.Init(m_step_.uid);
     if (!m_step_.pwd.Valid()) {
       CRANE_DEBUG(
           "[Job #{}] Failed to look up password entry for uid {} of task",
@@ -1891,8 +2035,20 @@ void TaskManager::EvGrpcExecuteTaskCb_() {
       m_pid_task_id_map_[task->GetPid()] = task->task_id;
       m_step_.AddTaskInstance(m_step_.job_id, std::move(task));
       elem.ok_prom.set_value(CraneErrCode::SUCCESS);
+      launch_times.emplace_back(std::chrono::steady_clock::now() -
+                                round_start);
     }
   }
+
+  if (launch_times.size() > 1) {
+    auto to_ms = [](std::chrono::steady_clock::duration d) {
+      return std::chrono::duration_cast<std::chrono::milliseconds>(d).count();
+    };
+    auto [first, last] = std::ranges::minmax(launch_times);
+    CRANE_DEBUG("[Step #{}.{}] Launched {} tasks in {} ms, startup skew {} ms.",
+                m_step_.job_id, m_step_.step_id, launch_times.size(),
+                to_ms(last), to_ms(last - first));
+  }
 }
 
 void TaskManager::EvGrpcQueryStepEnvCb_() {
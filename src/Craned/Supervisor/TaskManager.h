@@ -101,6 +101,10 @@ class StepInstance {
 
   EnvMap GetStepProcessEnv() const;
 
+  // Environment shared by all the tasks of the step, built on first use so
+  // that the tasks launched together only add their own variables.
+  const EnvMap& GetTaskBaseEnv();
+
   void AddTaskInstance(task_id_t task_id,
                        std::unique_ptr<ITaskInstance>&& task);
   ITaskInstance* GetTaskInstance(task_id_t task_id);
@@ -112,6 +116,7 @@ class StepInstance {
   crane::grpc::TaskToD m_step_to_supv_;
   std::unique_ptr<CforedClient> m_cfored_client_;
   std::unordered_map<task_id_t, std::unique_ptr<ITaskInstance>> m_task_map_;
+  std::optional<EnvMap> m_task_base_env_;
 };
 
 struct TaskInstanceMeta {
@@ -125,6 +130,11 @@ struct BatchInstanceMeta : TaskInstanceMeta {
 
   std::string parsed_output_file_pattern;
   std::string parsed_error_file_pattern;
+
+  // Node-local files opened by the task instead of the ones above when the
+  // output is spooled. See OutputSpool.
+  std::string spool_output_path;
+  std::string spool_error_path;
 };
 
 struct CrunInstanceMeta : TaskInstanceMeta {
@@ -216,12 +226,22 @@ class ITaskInstance {
 
   virtual CraneErrCode SetChildProcessBatchFd_();
 
+  // Called in Prepare() of batch tasks when the output spool is enabled.
+  void SpoolBatchOutput_(BatchInstanceMeta* meta);
+
   virtual void SetupCrunFwdAtChild_();
 
   virtual void SetupChildProcessCrunX11_();
 
   virtual CraneErrCode SetChildProcessEnv_() const;
 
+  // "name=value" strings of m_env_ for execve(), built before fork() so
+  // that the child does not have to build the environment itself.
+  std::vector<std::string> GetChildProcessEnvBlock_() const;
+
+  // DISPLAY of a crun task with x11, which depends on the forwarded port.
+  std::string GetCrunX11Display_() const;
+
   virtual std::vector<std::string> GetChildProcessExecArgv_() const;
 
   std::string ParseFilePathPattern_(const std::string& pattern,
@@ -265,9 +285,16 @@ class ContainerInstance : public ITaskInstance {
   CraneErrCode ModifyOCIBundleConfig_(const std::string& src,
                                       const std::string& dst) const;
   std::string ParseOCICmdPattern_(const std::string& cmd) const;
+  // Mount a snapshot of the cached bundle rootfs as m_rootfs_path_.
+  void PrepareCachedRootfs_();
 
   std::filesystem::path m_bundle_path_;
   std::filesystem::path m_temp_path_;
+  // The rootfs given to the runtime, the one in the bundle unless it is
+  // served from g_bundle_cache.
+  std::filesystem::path m_rootfs_path_;
+  // Key of the referenced g_bundle_cache entry, empty if none.
+  std::string m_cache_key_;
 };
 
 class ProcInstance : public ITaskInstance {
@@ -373,6 +400,13 @@ class TaskManager {
     std::promise<CraneErrCode> ok_prom;
   };
 
+  struct SpoolFinishedQueueElem {
+    task_id_t task_id;
+    crane::grpc::TaskStatus new_status;
+    uint32_t exit_code;
+    std::optional<std::string> reason;
+  };
+
   void EvSigchldCb_();
   void EvSigchldTimerCb_();
   void EvCleanSigchldQueueCb_();
@@ -381,6 +415,11 @@ class TaskManager {
 
   void EvCleanTerminateTaskQueueCb_();
   void EvCleanChangeTaskTimeLimitQueueCb_();
+  void EvCleanSpoolFinishedQueueCb_();
+
+  // Reports the status of the step once its last task is done.
+  void TaskDone_(crane::grpc::TaskStatus new_status, uint32_t exit_code,
+                 std::optional<std::string> reason);
 
   void EvGrpcExecuteTaskCb_();
   void EvGrpcQueryStepEnvCb_();
@@ -401,6 +440,11 @@ class TaskManager {
   std::shared_ptr<uvw::async_handle> m_change_task_time_limit_async_handle_;
   ConcurrentQueue<ChangeTaskTimeLimitQueueElem> m_task_time_limit_change_queue_;
 
+  std::shared_ptr<uvw::async_handle> m_spool_finished_async_handle_;
+  ConcurrentQueue<SpoolFinishedQueueElem> m_spool_finished_queue_;
+  // Tasks whose spooled output is still being copied.
+  uint32_t m_spool_finishing_num_{0};
+
   std::shared_ptr<uvw::async_handle> m_grpc_execute_task_async_handle_;
   ConcurrentQueue<ExecuteTaskElem> m_grpc_execute_task_queue_;
 
@@ -24,6 +24,7 @@
 #define PAM_STR_FALSE ("F")
 #define PAM_ITEM_AUTH_RESULT ("AUTH_RES")
 #define PAM_ITEM_TASK_ID ("TASK_ID")
+#define PAM_ITEM_MIGRATED_PID ("MIGRATED_PID")
 
 static std::once_flag g_init_flag;
 static bool g_module_initialized{false};
@@ -83,7 +84,15 @@ extern "C" {
   pam_syslog(pamh, LOG_ERR, "[Crane] Try to query %s for remote port %hu",
              remote_address.c_str(), port);
 
-  ok = GrpcQueryPortFromCraned(pamh, uid, remote_address, port, &task_id);
+  // The fast path also migrates this process and sets the env, which
+  // open_session is then left with nothing to do.
+  bool migrated = false;
+  ok = FastAuthorizeSshProc(pamh, uid, remote_address, port, getpid(),
+                            &migrated, &task_id);
+  if (!ok)
+    ok = GrpcQueryPortFromCraned(pamh, uid, remote_address, port, &task_id);
+  else
+    ok = migrated;
 
   if (ok) {
     pam_syslog(pamh, LOG_ERR,
@@ -94,6 +103,10 @@ extern "C" {
 
     pam_set_data(pamh, PAM_ITEM_AUTH_RESULT, auth_result, clean_up_cb);
     pam_set_data(pamh, PAM_ITEM_TASK_ID, task_id_str, clean_up_cb);
+    if (migrated) {
+      char *pid_str = strdup(std::to_string(getpid()).c_str());
+      pam_set_data(pamh, PAM_ITEM_MIGRATED_PID, pid_str, clean_up_cb);
+    }
 
     return PAM_SUCCESS;
   } else {
@@ -141,6 +154,15 @@ extern "C" {
 
   pam_get_data(pamh, PAM_ITEM_AUTH_RESULT, (const void **)&auth_result);
   if (strcmp(auth_result, PAM_STR_TRUE) == 0) {
+    char *migrated_pid_str = nullptr;
+    if (pam_get_data(pamh, PAM_ITEM_MIGRATED_PID,
+                     (const void **)&migrated_pid_str) == PAM_SUCCESS &&
+        std::atoi(migrated_pid_str) == getpid()) {
+      pam_syslog(pamh, LOG_ERR,
+                 "[Crane] open_session: already moved to cgroups.");
+      return PAM_SUCCESS;
+    }
+
     pam_get_data(pamh, PAM_ITEM_TASK_ID, (const void **)&task_id_str);
 
     pam_syslog(
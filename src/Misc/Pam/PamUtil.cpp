@@ -34,6 +34,7 @@
 #include <unordered_map>
 #include <vector>
 
+#include "crane/PamFastPath.h"
 #include "protos/Crane.grpc.pb.h"
 
 static void FreePamResp(struct pam_response *pr, int num_msg) {
@@ -453,3 +454,59 @@ bool GrpcMigrateSshProcToCgroupAndSetEnv(pam_handle_t *pamh, pid_t pid,
     return true;
   }
 }
+
+bool FastAuthorizeSshProc(pam_handle_t *pamh, uid_t uid,
+                          const std::string &remote_address,
+                          uint16_t port_to_query, pid_t pid, bool *migrated,
+                          uint32_t *task_id) {
+  std::string sock_path =
+      crane::pam_fast_path::SockPath(g_pam_config.CranedUnixSockPath);
+
+  int fd =
+      crane::pam_fast_path::Connect(sock_path, crane::pam_fast_path::kTimeoutMs);
+  if (fd < 0) {
+    pam_syslog(pamh, LOG_ERR, "[Crane] Fast path %s is not available: %s",
+               sock_path.c_str(), strerror(errno));
+    return false;
+  }
+
+  crane::grpc::AuthorizeSshProcRequest request;
+  crane::grpc::AuthorizeSshProcReply reply;
+  request.set_ssh_remote_address(remote_address);
+  request.set_ssh_remote_port(port_to_query);
+  request.set_uid(uid);
+  request.set_pid(pid);
+
+  bool ok = crane::pam_fast_path::WriteMessage(fd, request) &&
+            crane::pam_fast_path::ReadMessage(fd, &reply);
+  close(fd);
+  if (!ok) {
+    pam_syslog(pamh, LOG_ERR, "[Crane] AuthorizeSshProc on %s failed.",
+               sock_path.c_str());
+    return false;
+  }
+
+  *migrated = false;
+  if (!reply.ok()) {
+    pam_syslog(pamh, LOG_ERR,
+               "ssh client with remote port %u can't be moved into any task",
+               port_to_query);
+    return true;
+  }
+
+  for (const auto &[name, value] : reply.env_map()) {
+    int ret = pam_putenv(pamh, fmt::format("{}={}", name, value).c_str());
+    if (ret != PAM_SUCCESS) {
+      pam_syslog(pamh, LOG_ERR, "[Crane] Set env %s=%s  failed", name.c_str(),
+                 value.c_str());
+      return true;
+    }
+  }
+
+  pam_syslog(pamh, LOG_ERR,
+             "ssh client with remote port %u is moved into task #%u",
+             port_to_query, reply.task_id());
+  *migrated = true;
+  *task_id = reply.task_id();
+  return true;
+}
@@ -46,6 +46,14 @@ bool GrpcQueryPortFromCraned(pam_handle_t *pamh, uid_t uid,
 bool GrpcMigrateSshProcToCgroupAndSetEnv(pam_handle_t *pamh, pid_t pid,
                                          task_id_t task_id);
 
+// Query the task of the ssh connection, move pid into its cgroup and set its
+// env in one round trip on the fast path socket of craned. Returns false if
+// craned can't be asked this way, otherwise *migrated tells the result.
+bool FastAuthorizeSshProc(pam_handle_t *pamh, uid_t uid,
+                          const std::string &remote_address,
+                          uint16_t port_to_query, pid_t pid, bool *migrated,
+                          uint32_t *task_id);
+
 struct PamConfig {
   std::string CraneConfigFilePath;
   std::string CraneBaseDir;
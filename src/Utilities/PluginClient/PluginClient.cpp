@@ -26,6 +26,7 @@
 #include <unistd.h>
 
 #include <chrono>
+#include <algorithm>
 #include <cstddef>
 #include <iterator>
 #include <memory>
@@ -46,24 +47,119 @@ namespace plugin {
 
 PluginClient::~PluginClient() {
   m_thread_stop_.store(true);
+  // Wake up the hook calls blocked on a full queue.
+  { absl::MutexLock lock(&m_queue_space_mtx_); }
   CRANE_TRACE("PluginClient is ending. Waiting for the thread to finish.");
   if (m_async_send_thread_.joinable()) m_async_send_thread_.join();
 }
 
 // Note that we do not support TLS in plugin yet.
-void PluginClient::InitChannelAndStub(const std::string& endpoint) {
+void PluginClient::InitChannelAndStub(const std::string& endpoint,
+                                      uint32_t max_queued_events,
+                                      QueueFullPolicy queue_full_policy) {
+  m_max_queued_events_ = std::max(max_queued_events, 1u);
+  m_queue_full_policy_ = queue_full_policy;
+
   m_channel_ = CreateUnixInsecureChannel(endpoint);
   // std::unique_ptr will automatically release the dangling stub.
   m_stub_ = CranePluginD::NewStub(m_channel_);
   m_async_send_thread_ = std::thread([this] { AsyncSendThread_(); });
 }
 
+PluginClient::Stats PluginClient::GetStats() const {
+  Stats stats{};
+  stats.dropped_events = m_dropped_events_.load();
+  stats.queued_events = m_queued_events_.load();
+
+  absl::MutexLock lock(&m_stats_mtx_);
+  stats.sent_events = m_sent_events_;
+  stats.sent_rpcs = m_sent_rpcs_;
+  if (m_sent_rpcs_ != 0)
+    stats.avg_delivery_lag =
+        m_delivery_lag_sum_ / static_cast<int64_t>(m_sent_rpcs_);
+  stats.max_delivery_lag = m_delivery_lag_max_;
+  return stats;
+}
+
+void PluginClient::Enqueue_(HookType type,
+                            std::unique_ptr<google::protobuf::Message> msg) {
+  // The bound is approximate, which concurrent hook calls may exceed a bit.
+  if (m_queued_events_.load() >= m_max_queued_events_) {
+    if (m_queue_full_policy_ == QueueFullPolicy::DROP) {
+      uint64_t dropped = m_dropped_events_.fetch_add(1) + 1;
+      if ((dropped & (dropped - 1)) == 0)
+        CRANE_WARN("[Plugin] Event queue is full. {} hook events dropped.",
+                   dropped);
+      return;
+    }
+
+    absl::MutexLock lock(&m_queue_space_mtx_);
+    m_queue_space_mtx_.Await(absl::Condition(
+        +[](PluginClient* self) {
+          return self->m_queued_events_.load() < self->m_max_queued_events_ ||
+                 self->m_thread_stop_.load();
+        },
+        this));
+  }
+
+  m_queued_events_.fetch_add(1);
+  m_event_queue_.enqueue(
+      HookEvent{type, std::move(msg), std::chrono::steady_clock::now()});
+}
+
+std::vector<PluginClient::HookEvent> PluginClient::MergeEvents_(
+    std::vector<HookEvent>&& events) {
+  std::vector<HookEvent> merged;
+  merged.reserve(events.size());
+  for (auto& e : events) {
+    // Only consecutive events are merged so that the order of the different
+    // hooks of a task is kept, e.g. EndHook after StartHook.
+    bool mergeable = e.type == HookType::START || e.type == HookType::END ||
+                     e.type == HookType::INSERT_EVENT;
+    if (mergeable && !merged.empty() && merged.back().type == e.type &&
+        merged.back().event_num < kMaxEventsPerHookRpc) {
+      auto& batch = merged.back();
+      // The requests of these hooks only have a repeated field, which
+      // MergeFrom appends.
+      batch.msg->MergeFrom(*e.msg);
+      batch.event_num += e.event_num;
+      continue;
+    }
+    merged.emplace_back(std::move(e));
+  }
+  return merged;
+}
+
+void PluginClient::RecordSent_(const HookEvent& e) {
+  absl::Duration lag = absl::FromChrono(std::chrono::steady_clock::now() -
+                                        e.enqueue_time);
+  absl::MutexLock lock(&m_stats_mtx_);
+  m_sent_events_ += e.event_num;
+  m_sent_rpcs_++;
+  m_delivery_lag_sum_ += lag;
+  m_delivery_lag_max_ = std::max(m_delivery_lag_max_, lag);
+}
+
 void PluginClient::AsyncSendThread_() {
   bool prev_conn_state = false;
+  auto last_stats_time = std::chrono::steady_clock::now();
 
   while (true) {
     if (m_thread_stop_.load()) break;
 
+    auto now = std::chrono::steady_clock::now();
+    if (now - last_stats_time >= std::chrono::seconds(kStatsLogIntervalSec)) {
+      last_stats_time = now;
+      Stats stats = GetStats();
+      CRANE_DEBUG(
+          "[Plugin] {} events sent in {} RPCs, {} dropped, {} queued. "
+          "Delivery lag avg {} ms, max {} ms.",
+          stats.sent_events, stats.sent_rpcs, stats.dropped_events,
+          stats.queued_events,
+          absl::ToInt64Milliseconds(stats.avg_delivery_lag),
+          absl::ToInt64Milliseconds(stats.max_delivery_lag));
+    }
+
     // Check channel connection
     auto connected = m_channel_->WaitForConnected(
         std::chrono::system_clock::now() + std::chrono::milliseconds(3000));
@@ -86,16 +182,17 @@ void PluginClient::AsyncSendThread_() {
     }
 
     // Move events to local list
-    std::list<HookEvent> events;
-    events.resize(approx_size);
-
+    std::vector<HookEvent> dequeued(approx_size);
     auto actual_size =
-        m_event_queue_.try_dequeue_bulk(events.begin(), approx_size);
-    events.resize(actual_size);
+        m_event_queue_.try_dequeue_bulk(dequeued.begin(), approx_size);
+    dequeued.resize(actual_size);
     CRANE_DEBUG("[Plugin] Dequeued {} hook events.", actual_size);
 
-    while (!events.empty()) {
-      auto& e = events.front();
+    std::vector<HookEvent> events = MergeEvents_(std::move(dequeued));
+
+    size_t i = 0;
+    for (; i < events.size(); i++) {
+      auto& e = events[i];
       grpc::ClientContext context;
 
       HookDispatchFunc f = s_hook_dispatch_funcs_[size_t(e.type)];
@@ -108,20 +205,24 @@ void PluginClient::AsyncSendThread_() {
             int(e.type), context.debug_error_string(), status.error_message(),
             int(status.error_code()));
 
-        if (status.error_code() == grpc::UNAVAILABLE) {
-          // If some messages are not sent due to channel failure,
-          // put them back into m_event_queue_
-          if (!events.empty()) {
-            m_event_queue_.enqueue_bulk(std::make_move_iterator(events.begin()),
-                                        events.size());
-          }
-          break;
-        }
+        // If some messages are not sent due to channel failure, put them
+        // back into m_event_queue_. They stay counted as queued.
+        if (status.error_code() == grpc::UNAVAILABLE) break;
       } else {
         CRANE_TRACE("[Plugin] Hook event sent: hook type: {}", int(e.type));
+        RecordSent_(e);
       }
 
-      events.pop_front();
+      m_queued_events_.fetch_sub(e.event_num);
+    }
+
+    if (i < events.size())
+      m_event_queue_.enqueue_bulk(
+          std::make_move_iterator(events.begin() + i), events.size() - i);
+
+    // Wake up the hook calls blocked on a full queue.
+    if (m_queue_full_policy_ == QueueFullPolicy::BLOCK) {
+      absl::MutexLock lock(&m_queue_space_mtx_);
     }
   }
 }
@@ -232,9 +333,7 @@ void PluginClient::StartHookAsync(std::vector<crane::grpc::TaskInfo> tasks) {
     task_it->CopyFrom(task);
   }
 
-  HookEvent e{HookType::START,
-              std::unique_ptr<google::protobuf::Message>(std::move(request))};
-  m_event_queue_.enqueue(std::move(e));
+  Enqueue_(HookType::START, std::move(request));
 }
 
 void PluginClient::EndHookAsync(std::vector<crane::grpc::TaskInfo> tasks) {
@@ -249,9 +348,7 @@ void PluginClient::EndHookAsync(std::vector<crane::grpc::TaskInfo> tasks) {
                                                  task.start_time().seconds());
   }
 
-  HookEvent e{HookType::END,
-              std::unique_ptr<google::protobuf::Message>(std::move(request))};
-  m_event_queue_.enqueue(std::move(e));
+  Enqueue_(HookType::END, std::move(request));
 }
 
 void PluginClient::CreateCgroupHookAsync(
@@ -263,9 +360,7 @@ void PluginClient::CreateCgroupHookAsync(
   request->set_cgroup(cgroup);
   request->mutable_resource()->CopyFrom(resource);
 
-  HookEvent e{HookType::CREATE_CGROUP,
-              std::unique_ptr<google::protobuf::Message>(std::move(request))};
-  m_event_queue_.enqueue(std::move(e));
+  Enqueue_(HookType::CREATE_CGROUP, std::move(request));
 }
 
 void PluginClient::DestroyCgroupHookAsync(task_id_t task_id,
@@ -275,9 +370,7 @@ void PluginClient::DestroyCgroupHookAsync(task_id_t task_id,
   request->set_task_id(task_id);
   request->set_cgroup(cgroup);
 
-  HookEvent e{HookType::DESTROY_CGROUP,
-              std::unique_ptr<google::protobuf::Message>(std::move(request))};
-  m_event_queue_.enqueue(std::move(e));
+  Enqueue_(HookType::DESTROY_CGROUP, std::move(request));
 }
 
 void PluginClient::NodeEventHookAsync(
@@ -289,9 +382,7 @@ void PluginClient::NodeEventHookAsync(
     event_it->CopyFrom(event);
   }
 
-  HookEvent e{HookType::INSERT_EVENT,
-              std::unique_ptr<google::protobuf::Message>(std::move(request))};
-  m_event_queue_.enqueue(std::move(e));
+  Enqueue_(HookType::INSERT_EVENT, std::move(request));
 }
 
 void PluginClient::UpdatePowerStateHookAsync(
@@ -303,9 +394,7 @@ void PluginClient::UpdatePowerStateHookAsync(
   request->set_state(state);
   request->set_enable_auto_power_control(enable_auto_power_control);
 
-  HookEvent e{HookType::UPDATE_POWER_STATE,
-              std::unique_ptr<google::protobuf::Message>(std::move(request))};
-  m_event_queue_.enqueue(std::move(e));
+  Enqueue_(HookType::UPDATE_POWER_STATE, std::move(request));
 }
 
 void PluginClient::RegisterCranedHookAsync(
@@ -319,9 +408,7 @@ void PluginClient::RegisterCranedHookAsync(
     request->mutable_network_interfaces()->Add()->CopyFrom(interface);
   }
 
-  HookEvent e{HookType::REGISTER_CRANED,
-              std::unique_ptr<google::protobuf::Message>(std::move(request))};
-  m_event_queue_.enqueue(std::move(e));
+  Enqueue_(HookType::REGISTER_CRANED, std::move(request));
 }
 
 }  // namespace plugin
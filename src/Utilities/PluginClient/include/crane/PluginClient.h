@@ -19,12 +19,16 @@
 #pragma once
 
 #include <absl/container/flat_hash_map.h>
+#include <absl/synchronization/mutex.h>
+#include <absl/time/time.h>
 #include <concurrentqueue/concurrentqueue.h>
 #include <google/protobuf/message.h>
 #include <grpcpp/channel.h>
 #include <grpcpp/support/status.h>
 
 #include <array>
+#include <atomic>
+#include <chrono>
 #include <memory>
 #include <thread>
 #include <vector>
@@ -62,9 +66,36 @@ class PluginClient {
   struct HookEvent {
     HookType type;
     std::unique_ptr<google::protobuf::Message> msg;
+    std::chrono::steady_clock::time_point enqueue_time;
+    // The number of events merged into msg.
+    uint32_t event_num{1};
   };
 
-  void InitChannelAndStub(const std::string& endpoint);
+  // What a hook call does when max_queued_events are waiting to be sent.
+  enum class QueueFullPolicy : uint8_t {
+    DROP,
+    BLOCK,
+  };
+
+  struct Stats {
+    uint64_t sent_events;
+    uint64_t sent_rpcs;
+    uint64_t dropped_events;
+    uint64_t queued_events;
+    // The time from enqueueing to being sent.
+    absl::Duration avg_delivery_lag;
+    absl::Duration max_delivery_lag;
+  };
+
+  static constexpr uint32_t kMaxEventsPerHookRpc = 1000;
+  static constexpr int64_t kStatsLogIntervalSec = 60;
+
+  void InitChannelAndStub(
+      const std::string& endpoint,
+      uint32_t max_queued_events = kDefaultPluginMaxQueuedEvents,
+      QueueFullPolicy queue_full_policy = QueueFullPolicy::DROP);
+
+  Stats GetStats() const;
 
   // These functions are used to add HookEvent into the event queue.
   // Launched by Ctld
@@ -107,6 +138,14 @@ class PluginClient {
                                        google::protobuf::Message* msg);
   void AsyncSendThread_();
 
+  void Enqueue_(HookType type, std::unique_ptr<google::protobuf::Message> msg);
+
+  // Merge the consecutive events of the hooks with only a repeated field
+  // into one request.
+  static std::vector<HookEvent> MergeEvents_(std::vector<HookEvent>&& events);
+
+  void RecordSent_(const HookEvent& e);
+
   std::shared_ptr<Channel> m_channel_;
   std::unique_ptr<CranePluginD::Stub> m_stub_;
 
@@ -115,6 +154,20 @@ class PluginClient {
 
   ConcurrentQueue<HookEvent> m_event_queue_;
 
+  uint32_t m_max_queued_events_{kDefaultPluginMaxQueuedEvents};
+  QueueFullPolicy m_queue_full_policy_{QueueFullPolicy::DROP};
+  std::atomic<uint32_t> m_queued_events_{0};
+  // Hook calls blocked on a full queue wait on this, which the send thread
+  // locks after taking events out of the queue.
+  absl::Mutex m_queue_space_mtx_;
+
+  std::atomic<uint64_t> m_dropped_events_{0};
+  mutable absl::Mutex m_stats_mtx_;
+  uint64_t m_sent_events_ ABSL_GUARDED_BY(m_stats_mtx_){0};
+  uint64_t m_sent_rpcs_ ABSL_GUARDED_BY(m_stats_mtx_){0};
+  absl::Duration m_delivery_lag_sum_ ABSL_GUARDED_BY(m_stats_mtx_);
+  absl::Duration m_delivery_lag_max_ ABSL_GUARDED_BY(m_stats_mtx_);
+
   // Use this array to dispatch the hook event to the corresponding function in
   // O(1) time.
   static constexpr std::array<HookDispatchFunc, size_t(HookType::HookTypeCount)>
@@ -18,6 +18,9 @@
 
 #include "crane/GrpcHelper.h"
 
+#include <grpcpp/support/server_interceptor.h>
+
+#include "crane/Metrics.h"
 #include "crane/Network.h"
 
 std::string_view GrpcConnStateStr(grpc_connectivity_state state) {
@@ -77,6 +80,70 @@ void ServerBuilderSetKeepAliveArgs(grpc::ServerBuilder* builder) {
                               0 /* unlimited */);
 }
 
+namespace {
+
+class MetricsInterceptor : public grpc::experimental::Interceptor {
+ public:
+  explicit MetricsInterceptor(util::metrics::Histogram* histogram)
+      : m_histogram_(histogram), m_begin_(std::chrono::steady_clock::now()) {}
+
+  void Intercept(
+      grpc::experimental::InterceptorBatchMethods* methods) override {
+    if (methods->QueryInterceptionHookPoint(
+            grpc::experimental::InterceptionHookPoints::PRE_SEND_STATUS))
+      m_histogram_->ObserveDuration(std::chrono::steady_clock::now() -
+                                    m_begin_);
+    methods->Proceed();
+  }
+
+ private:
+  util::metrics::Histogram* m_histogram_;
+  std::chrono::steady_clock::time_point m_begin_;
+};
+
+class MetricsInterceptorFactory
+    : public grpc::experimental::ServerInterceptorFactoryInterface {
+ public:
+  grpc::experimental::Interceptor* CreateServerInterceptor(
+      grpc::experimental::ServerRpcInfo* info) override {
+    const char* method = info->method();
+    return new MetricsInterceptor(
+        HistogramOf_(method != nullptr ? method : "unknown"));
+  }
+
+ private:
+  // The registry is only asked once for each method.
+  util::metrics::Histogram* HistogramOf_(const char* method) {
+    {
+      absl::ReaderMutexLock lock(&m_mtx_);
+      auto it = m_histograms_.find(method);
+      if (it != m_histograms_.end()) return it->second;
+    }
+
+    auto* histogram = util::metrics::DefaultRegistry().GetHistogram(
+        "crane_grpc_server_handling_seconds",
+        "Time from receiving an RPC to sending its status.",
+        {{"method", method}});
+    absl::WriterMutexLock lock(&m_mtx_);
+    m_histograms_.emplace(method, histogram);
+    return histogram;
+  }
+
+  absl::Mutex m_mtx_;
+  absl::flat_hash_map<std::string, util::metrics::Histogram*> m_histograms_
+      ABSL_GUARDED_BY(m_mtx_);
+};
+
+}  // namespace
+
+void ServerBuilderAddMetricsInterceptor(grpc::ServerBuilder* builder) {
+  std::vector<
+      std::unique_ptr<grpc::experimental::ServerInterceptorFactoryInterface>>
+      creators;
+  creators.emplace_back(std::make_unique<MetricsInterceptorFactory>());
+  builder->experimental().SetInterceptorCreators(std::move(creators));
+}
+
 void ServerBuilderAddUnixInsecureListeningPort(grpc::ServerBuilder* builder,
                                                const std::string& address) {
   builder->AddListeningPort(address, grpc::InsecureServerCredentials());
@@ -161,6 +228,12 @@ std::shared_ptr<grpc::Channel> CreateUnixInsecureChannel(
   return grpc::CreateChannel(socket_addr, grpc::InsecureChannelCredentials());
 }
 
+std::shared_ptr<grpc::Channel> CreateUnixInsecureCustomChannel(
+    const std::string& socket_addr, const grpc::ChannelArguments& args) {
+  return grpc::CreateCustomChannel(socket_addr,
+                                   grpc::InsecureChannelCredentials(), args);
+}
+
 std::shared_ptr<grpc::Channel> CreateTcpInsecureChannel(
     const std::string& address, const std::string& port) {
   std::string target = fmt::format("{}:{}", GrpcFormatIpAddress(address), port);
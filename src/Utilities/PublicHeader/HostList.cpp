@@ -0,0 +1,370 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "crane/HostList.h"
+
+#include <absl/strings/ascii.h>
+#include <absl/strings/str_join.h>
+#include <absl/strings/str_split.h>
+
+#include <algorithm>
+#include <charconv>
+#include <list>
+#include <tuple>
+
+#include "crane/Logger.h"
+#include "crane/String.h"
+
+namespace util {
+
+namespace {
+
+uint32_t DecimalDigits(uint64_t n) {
+  uint32_t digits = 1;
+  while (n >= 10) {
+    n /= 10;
+    ++digits;
+  }
+  return digits;
+}
+
+uint64_t Pow10(uint32_t exp) {
+  uint64_t res = 1;
+  while (exp-- > 0) res *= 10;
+  return res;
+}
+
+bool IsDigit(char c) { return c >= '0' && c <= '9'; }
+
+bool ParseIndex(std::string_view str, uint64_t* index) {
+  if (str.empty() || !std::ranges::all_of(str, IsDigit)) return false;
+  auto [ptr, ec] = std::from_chars(str.data(), str.data() + str.size(), *index);
+  return ec == std::errc() && ptr == str.data() + str.size();
+}
+
+}  // namespace
+
+bool HostList::IsSingleIndexName(std::string_view name) {
+  if (!name.empty() && IsDigit(name.front())) return false;
+
+  // stoi() in HostNameListToStr_() takes no more than 9 digits for sure.
+  constexpr size_t kMaxStoiDigits = 9;
+  size_t runs = 0;
+  size_t run_len = 0;
+  for (char c : name) {
+    if (c == '[' || c == ']') return false;
+    if (IsDigit(c)) {
+      if (run_len++ == 0) ++runs;
+      if (run_len > kMaxStoiDigits) return false;
+    } else {
+      run_len = 0;
+    }
+  }
+  return runs <= 1;
+}
+
+bool HostList::SplitName_(std::string_view name, Pattern* pattern,
+                          uint64_t* index) {
+  auto begin = std::ranges::find_if(name, IsDigit);
+  if (begin == name.end()) return false;
+  auto end = std::find_if_not(begin, name.end(), IsDigit);
+
+  std::string_view digits(begin, end);
+  if (digits.size() > kMaxIndexDigits || !ParseIndex(digits, index))
+    return false;
+
+  pattern->prefix.assign(name.begin(), begin);
+  pattern->suffix.assign(end, name.end());
+  pattern->width = digits.size() > DecimalDigits(*index) ? digits.size() : 0;
+  return true;
+}
+
+void HostList::AddInterval_(RangeSet* set, uint64_t lo, uint64_t hi) {
+  // First interval overlapping or adjacent to [lo, hi]. Names usually come
+  // sorted, so this is mostly the end of the set.
+  auto first = std::lower_bound(
+      set->begin(), set->end(), lo,
+      [](const Interval& iv, uint64_t v) { return iv.hi + 1 < v; });
+  auto last = first;
+  while (last != set->end() && last->lo <= hi + 1) {
+    lo = std::min(lo, last->lo);
+    hi = std::max(hi, last->hi);
+    ++last;
+  }
+
+  if (first == last) {
+    set->insert(first, Interval{lo, hi});
+  } else {
+    *first = Interval{lo, hi};
+    set->erase(first + 1, last);
+  }
+}
+
+HostList::RangeSet HostList::UnionOf_(const RangeSet& a, const RangeSet& b) {
+  RangeSet res;
+  res.reserve(a.size() + b.size());
+  auto i = a.begin(), j = b.begin();
+  while (i != a.end() || j != b.end()) {
+    const Interval& next =
+        (j == b.end() || (i != a.end() && i->lo < j->lo)) ? *i++ : *j++;
+    if (!res.empty() && next.lo <= res.back().hi + 1)
+      res.back().hi = std::max(res.back().hi, next.hi);
+    else
+      res.push_back(next);
+  }
+  return res;
+}
+
+HostList::RangeSet HostList::IntersectionOf_(const RangeSet& a,
+                                             const RangeSet& b) {
+  RangeSet res;
+  auto i = a.begin(), j = b.begin();
+  while (i != a.end() && j != b.end()) {
+    uint64_t lo = std::max(i->lo, j->lo);
+    uint64_t hi = std::min(i->hi, j->hi);
+    if (lo <= hi) res.push_back(Interval{lo, hi});
+    if (i->hi < j->hi)
+      ++i;
+    else
+      ++j;
+  }
+  return res;
+}
+
+void HostList::InsertRange_(std::string_view prefix, std::string_view suffix,
+                            uint64_t lo, uint64_t hi, uint32_t width) {
+  if (lo > hi) return;
+
+  Pattern pattern{std::string(prefix), std::string(suffix), 0};
+  // Indexes shorter than the width are padded, the others are not.
+  uint64_t unpadded_from = width > 1 ? Pow10(width - 1) : 0;
+  if (lo < unpadded_from) {
+    pattern.width = width;
+    AddInterval_(&m_patterns_[pattern], lo, std::min(hi, unpadded_from - 1));
+  }
+  if (hi >= unpadded_from) {
+    pattern.width = 0;
+    AddInterval_(&m_patterns_[pattern], std::max(lo, unpadded_from), hi);
+  }
+}
+
+void HostList::Insert(std::string_view name) {
+  if (name.empty()) return;
+
+  Pattern pattern;
+  uint64_t index;
+  if (SplitName_(name, &pattern, &index))
+    AddInterval_(&m_patterns_[std::move(pattern)], index, index);
+  else
+    m_names_.emplace(name);
+}
+
+bool HostList::Contains(std::string_view name) const {
+  Pattern pattern;
+  uint64_t index;
+  if (!SplitName_(name, &pattern, &index)) return m_names_.contains(name);
+
+  auto it = m_patterns_.find(pattern);
+  if (it == m_patterns_.end()) return false;
+
+  const RangeSet& ranges = it->second;
+  auto next = std::upper_bound(
+      ranges.begin(), ranges.end(), index,
+      [](uint64_t v, const Interval& iv) { return v < iv.lo; });
+  return next != ranges.begin() && std::prev(next)->hi >= index;
+}
+
+size_t HostList::Size() const {
+  size_t size = m_names_.size();
+  for (const auto& [_, ranges] : m_patterns_)
+    for (const auto& [lo, hi] : ranges) size += hi - lo + 1;
+  return size;
+}
+
+HostList& HostList::Union(const HostList& other) {
+  for (const auto& [pattern, ranges] : other.m_patterns_) {
+    RangeSet& mine = m_patterns_[pattern];
+    mine = mine.empty() ? ranges : UnionOf_(mine, ranges);
+  }
+  m_names_.insert(other.m_names_.begin(), other.m_names_.end());
+  return *this;
+}
+
+HostList& HostList::Intersect(const HostList& other) {
+  for (auto it = m_patterns_.begin(); it != m_patterns_.end();) {
+    auto other_it = other.m_patterns_.find(it->first);
+    if (other_it != other.m_patterns_.end())
+      it->second = IntersectionOf_(it->second, other_it->second);
+
+    if (other_it == other.m_patterns_.end() || it->second.empty())
+      it = m_patterns_.erase(it);
+    else
+      ++it;
+  }
+  std::erase_if(m_names_, [&other](const std::string& name) {
+    return !other.m_names_.contains(name);
+  });
+  return *this;
+}
+
+bool HostList::Parse(const std::string& host_str, HostList* host_list) {
+  std::string name_str;
+  name_str.reserve(host_str.size() + 1);
+  for (char c : host_str)
+    if (c != ' ') name_str += c;  // remove all spaces
+  name_str += ',';                // uniform end format
+
+  std::vector<std::string_view> items;
+  bool in_brackets = false;
+  size_t item_begin = 0;
+  for (size_t i = 0; i < name_str.size(); ++i) {
+    char c = name_str[i];
+    if (c == '[') {
+      if (in_brackets) {
+        CRANE_ERROR("Illegal node name string format: duplicate brackets");
+        return false;
+      }
+      in_brackets = true;
+    } else if (c == ']') {
+      if (!in_brackets) {
+        CRANE_ERROR("Illegal node name string format: isolated bracket");
+        return false;
+      }
+      in_brackets = false;
+    } else if (c == ',' && !in_brackets) {
+      items.emplace_back(name_str.data() + item_begin, i - item_begin);
+      item_begin = i + 1;
+    }
+  }
+  if (in_brackets) {
+    CRANE_ERROR("Illegal node name string format: isolated bracket");
+    return false;
+  }
+
+  for (std::string_view item : items) {
+    item = absl::StripAsciiWhitespace(item);
+    if (item.empty()) continue;
+
+    size_t open = item.find('[');
+    if (open == std::string_view::npos) {
+      host_list->Insert(item);
+      continue;
+    }
+
+    size_t close = item.find(']', open);
+    std::string_view prefix = item.substr(0, open);
+    std::string_view ranges = item.substr(open + 1, close - open - 1);
+    std::string_view suffix = item.substr(close + 1);
+
+    // The bracket must be the first run of digits of every name it makes,
+    // and ParseHostList() takes names not ending in "]" or "]." literally.
+    if (std::ranges::any_of(prefix, IsDigit) ||
+        (!suffix.empty() && suffix.front() != '.') ||
+        suffix.find('[') != std::string_view::npos) {
+      std::list<std::string> names;
+      if (!ParseHostList(std::string(item), &names)) return false;
+      for (const auto& name : names) host_list->Insert(name);
+      continue;
+    }
+
+    for (std::string_view range : absl::StrSplit(ranges, ',')) {
+      size_t dash = range.find('-');
+      std::string_view first = range.substr(0, dash);
+      std::string_view last =
+          dash == std::string_view::npos ? first : range.substr(dash + 1);
+
+      uint64_t lo, hi;
+      if (first.size() > kMaxIndexDigits || last.size() > kMaxIndexDigits ||
+          !ParseIndex(first, &lo) || !ParseIndex(last, &hi)) {
+        CRANE_ERROR("Illegal node name string format: bad range {}", range);
+        return false;
+      }
+      host_list->InsertRange_(prefix, suffix, lo, hi, first.size());
+    }
+  }
+  return true;
+}
+
+std::string HostList::ToString() const {
+  // A run of indexes printed with the same number of digits.
+  struct Piece {
+    uint32_t len;
+    uint64_t lo;
+    uint64_t hi;
+    uint32_t width;
+  };
+
+  std::vector<std::string> groups;
+  std::vector<Piece> pieces;
+  for (auto it = m_patterns_.begin(); it != m_patterns_.end();) {
+    // Patterns differing only in width are next to each other and printed
+    // in one bracket.
+    const Pattern& head = it->first;
+    pieces.clear();
+    for (; it != m_patterns_.end() && it->first.prefix == head.prefix &&
+           it->first.suffix == head.suffix;
+         ++it) {
+      uint32_t width = it->first.width;
+      for (auto [lo, hi] : it->second) {
+        if (width != 0) {
+          pieces.push_back(Piece{width, lo, hi, width});
+          continue;
+        }
+        while (true) {
+          uint32_t len = DecimalDigits(lo);
+          uint64_t len_max = Pow10(len) - 1;
+          pieces.push_back(Piece{len, lo, std::min(hi, len_max), 0});
+          if (hi <= len_max) break;
+          lo = len_max + 1;
+        }
+      }
+    }
+
+    // Same order as HostNameListToStr_(): shorter indexes first.
+    std::ranges::sort(pieces, [](const Piece& a, const Piece& b) {
+      return std::tie(a.len, a.lo) < std::tie(b.len, b.lo);
+    });
+
+    std::string group{head.prefix};
+    group += '[';
+    auto out = std::back_inserter(group);
+    for (size_t i = 0; i < pieces.size();) {
+      // A range is parsed with the width of its first index, so only the
+      // indexes of the same length are joined, e.g. not 08 with 009.
+      size_t j = i;
+      while (j + 1 < pieces.size() && pieces[j + 1].lo == pieces[j].hi + 1 &&
+             pieces[j + 1].len == pieces[j].len)
+        ++j;
+
+      if (i != 0) group += ',';
+      fmt::format_to(out, "{:0{}}", pieces[i].lo, pieces[i].width);
+      if (pieces[j].hi != pieces[i].lo)
+        fmt::format_to(out, "-{:0{}}", pieces[j].hi, pieces[i].width);
+      i = j + 1;
+    }
+    group += ']';
+    group += head.suffix;
+    groups.emplace_back(std::move(group));
+  }
+  groups.insert(groups.end(), m_names_.begin(), m_names_.end());
+
+  std::ranges::sort(groups);
+  return RemoveBracketsWithoutDashOrComma(absl::StrJoin(groups, ","));
+}
+
+}  // namespace util
@@ -0,0 +1,102 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "crane/LockProfiler.h"
+
+#include <absl/container/flat_hash_map.h>
+#include <absl/strings/str_cat.h>
+
+#include <tuple>
+#include <vector>
+
+namespace util::lock_profiler {
+
+namespace {
+
+// The file name of a call site is a string literal, so its address tells
+// the file apart.
+using SiteKey = std::tuple<const void*, const char*, uint32_t, Mode>;
+
+struct SharedHoldBegin {
+  const void* lock;
+  metrics::Histogram* hold;
+  Clock::time_point begin;
+};
+
+// A thread holds few shared locks at a time, so a vector is searched. Holds
+// released on another thread are never ended, so the oldest ones are dropped
+// past this number.
+constexpr size_t kMaxSharedHoldNum = 64;
+
+thread_local std::vector<SharedHoldBegin> t_shared_holds;
+
+}  // namespace
+
+void Enable(metrics::Registry* registry) {
+  internal::g_registry.store(registry, std::memory_order_release);
+}
+
+Site GetSite(const void* lock, std::string_view lock_name,
+             const std::source_location& loc, Mode mode) {
+  thread_local absl::flat_hash_map<SiteKey, Site> sites;
+
+  SiteKey key{lock, loc.file_name(), loc.line(), mode};
+  auto it = sites.find(key);
+  if (it != sites.end()) return it->second;
+
+  std::string_view file = loc.file_name();
+  file.remove_prefix(file.rfind('/') + 1);
+  metrics::Labels labels{
+      {"lock", std::string(lock_name)},
+      {"site", absl::StrCat(file, ":", loc.line())},
+      {"mode", mode == Mode::kExclusive ? "exclusive" : "shared"}};
+
+  metrics::Registry* registry =
+      internal::g_registry.load(std::memory_order_acquire);
+  Site site{
+      .wait = registry->GetHistogram("crane_lock_wait_seconds",
+                                     "Time to acquire a profiled lock.",
+                                     labels, kLockBuckets),
+      .hold = registry->GetHistogram("crane_lock_hold_seconds",
+                                     "Time a profiled lock is held.", labels,
+                                     kLockBuckets),
+  };
+  sites.emplace(key, site);
+  return site;
+}
+
+void BeginSharedHold(const void* lock, metrics::Histogram* hold,
+                     Clock::time_point begin) {
+  if (t_shared_holds.size() == kMaxSharedHoldNum)
+    t_shared_holds.erase(t_shared_holds.begin());
+  t_shared_holds.push_back({lock, hold, begin});
+}
+
+std::optional<SharedHold> EndSharedHold(const void* lock) {
+  // The latest hold first, since locks are mostly released in reverse.
+  for (auto it = t_shared_holds.rbegin(); it != t_shared_holds.rend(); ++it) {
+    if (it->lock != lock) continue;
+
+    SharedHold hold{it->hold, Clock::now() - it->begin};
+    t_shared_holds.erase(std::next(it).base());
+    return hold;
+  }
+  return std::nullopt;
+}
+
+}  // namespace util::lock_profiler
@@ -18,8 +18,23 @@
 
 #include "crane/Logger.h"
 
+#include <spdlog/details/periodic_worker.h>
+
 static LoggerSinks default_sinks{};
 
+static spdlog::async_overflow_policy overflow_policy{
+    spdlog::async_overflow_policy::block};
+
+// Reports the messages dropped since the last report.
+static std::unique_ptr<spdlog::details::periodic_worker> drop_reporter;
+static constexpr std::chrono::seconds kLogDropReportInterval{10};
+
+static size_t DroppedLogMessages() {
+  auto pool = spdlog::thread_pool();
+  if (!pool) return 0;
+  return pool->overrun_counter() + pool->discard_counter();
+}
+
 std::optional<spdlog::level::level_enum> StrToLogLevel(
     const std::string& level) {
   if (level == "trace") {
@@ -40,7 +55,8 @@ std::optional<spdlog::level::level_enum> StrToLogLevel(
 }
 
 void InitLogger(spdlog::level::level_enum level,
-                const std::string& log_file_path, bool enable_console) {
+                const std::string& log_file_path, bool enable_console,
+                const LogQueueOptions& queue_options) {
   std::vector<spdlog::sink_ptr> sinks;
   auto file_sink = std::make_shared<spdlog::sinks::rotating_file_sink_mt>(
       log_file_path, 1024 * 1024 * 50 /*MB*/, 3);
@@ -58,16 +74,41 @@ void InitLogger(spdlog::level::level_enum level,
     default_sinks.console_sink = console_sink;
   }
 
-  spdlog::init_thread_pool(256, 1);
+  overflow_policy = queue_options.drop_on_full
+                        ? spdlog::async_overflow_policy::discard_new
+                        : spdlog::async_overflow_policy::block;
+  spdlog::init_thread_pool(std::max<size_t>(queue_options.size, 1), 1);
   auto logger = std::make_shared<spdlog::async_logger>(
       "default", sinks.begin(), sinks.end(), spdlog::thread_pool(),
-      spdlog::async_overflow_policy::block);
+      overflow_policy);
   spdlog::set_default_logger(logger);
 
   spdlog::flush_on(spdlog::level::err);
   spdlog::flush_every(std::chrono::seconds(1));
 
   spdlog::set_level(level);
+
+  if (queue_options.drop_on_full) {
+    drop_reporter = std::make_unique<spdlog::details::periodic_worker>(
+        [reported = size_t{0}]() mutable {
+          size_t dropped = DroppedLogMessages();
+          if (dropped == reported) return;
+          CRANE_WARN("{} log messages dropped in the last {}s: queue full.",
+                     dropped - reported, kLogDropReportInterval.count());
+          reported = dropped;
+        },
+        kLogDropReportInterval);
+  }
+}
+
+LoggerStats GetLoggerStats() {
+  auto pool = spdlog::thread_pool();
+  return LoggerStats{
+      .queued = pool ? pool->queue_size() : 0,
+      .dropped = DroppedLogMessages(),
+      .sampled_out = crane::logger_internal::g_sampled_out.load(
+          std::memory_order_relaxed),
+  };
 }
 
 std::shared_ptr<spdlog::async_logger> AddLogger(
@@ -92,7 +133,7 @@ std::shared_ptr<spdlog::async_logger> AddLogger(
   }
   auto logger = std::make_shared<spdlog::async_logger>(
       name, sinks.begin(), sinks.end(), spdlog::thread_pool(),
-      spdlog::async_overflow_policy::block);
+      overflow_policy);
   logger->set_level(level);
   spdlog::register_logger(logger);
   return logger;
@@ -117,7 +158,7 @@ std::shared_ptr<spdlog::async_logger> AddLogger(const std::string& name,
 
   auto logger = std::make_shared<spdlog::async_logger>(
       name, sinks.begin(), sinks.end(), spdlog::thread_pool(),
-      spdlog::async_overflow_policy::block);
+      overflow_policy);
   logger->set_level(level);
   spdlog::register_logger(logger);
   return logger;
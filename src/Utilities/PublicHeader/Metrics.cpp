@@ -0,0 +1,440 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "crane/Metrics.h"
+
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "crane/Logger.h"
+#include "crane/String.h"
+
+namespace util::metrics {
+
+namespace {
+
+void SetConnTimeout(int fd, int timeout_ms) {
+  timeval tv{.tv_sec = timeout_ms / 1000,
+             .tv_usec = (timeout_ms % 1000) * 1000};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+std::string EscapeLabelValue(const std::string& value) {
+  std::string escaped;
+  escaped.reserve(value.size());
+  for (char c : value) {
+    if (c == '\\' || c == '"') {
+      escaped += '\\';
+      escaped += c;
+    } else if (c == '\n') {
+      escaped += "\\n";
+    } else {
+      escaped += c;
+    }
+  }
+  return escaped;
+}
+
+std::string EscapeHelp(const std::string& help) {
+  std::string escaped;
+  escaped.reserve(help.size());
+  for (char c : help) {
+    if (c == '\\')
+      escaped += "\\\\";
+    else if (c == '\n')
+      escaped += "\\n";
+    else
+      escaped += c;
+  }
+  return escaped;
+}
+
+// `a="1",b="2"`, in the order given.
+std::string RenderLabels(const Labels& labels) {
+  std::string rendered;
+  for (const auto& [key, value] : labels) {
+    if (!rendered.empty()) rendered += ',';
+    rendered += fmt::format("{}=\"{}\"", key, EscapeLabelValue(value));
+  }
+  return rendered;
+}
+
+std::string FormatValue(double value) {
+  if (std::isnan(value)) return "NaN";
+  if (std::isinf(value)) return value > 0 ? "+Inf" : "-Inf";
+  return fmt::format("{}", value);
+}
+
+// name{labels,extra} value
+void AppendSample(std::string* out, const std::string& name,
+                  const std::string& labels, const std::string& extra_label,
+                  const std::string& value) {
+  *out += name;
+  if (!labels.empty() || !extra_label.empty()) {
+    *out += '{';
+    *out += labels;
+    if (!labels.empty() && !extra_label.empty()) *out += ',';
+    *out += extra_label;
+    *out += '}';
+  }
+  *out += ' ';
+  *out += value;
+  *out += '\n';
+}
+
+}  // namespace
+
+Histogram::Histogram(std::vector<double> bounds)
+    : m_bounds_(std::move(bounds)),
+      m_bucket_counts_(
+          std::make_unique<std::atomic_uint64_t[]>(m_bounds_.size() + 1)) {}
+
+void Histogram::Observe(double value) {
+  size_t bucket =
+      std::ranges::lower_bound(m_bounds_, value) - m_bounds_.begin();
+  m_bucket_counts_[bucket].fetch_add(1, std::memory_order_relaxed);
+  m_sum_.fetch_add(value, std::memory_order_relaxed);
+}
+
+Histogram::Snapshot Histogram::Collect() const {
+  Snapshot snapshot;
+  snapshot.bucket_counts.resize(m_bounds_.size() + 1);
+  for (size_t i = 0; i <= m_bounds_.size(); ++i) {
+    snapshot.bucket_counts[i] =
+        m_bucket_counts_[i].load(std::memory_order_relaxed);
+    snapshot.count += snapshot.bucket_counts[i];
+  }
+  snapshot.sum = m_sum_.load(std::memory_order_relaxed);
+  return snapshot;
+}
+
+Registry::Family* Registry::GetFamily_(const std::string& name,
+                                       const std::string& help, Type type) {
+  auto [it, inserted] = m_families_.try_emplace(name);
+  if (inserted) {
+    it->second.type = type;
+    it->second.help = help;
+  } else if (it->second.type != type) {
+    CRANE_ERROR("Metric {} is registered with another type.", name);
+    return nullptr;
+  }
+  return &it->second;
+}
+
+Counter* Registry::GetCounter(const std::string& name, const std::string& help,
+                              const Labels& labels) {
+  absl::MutexLock lock(&m_mtx_);
+  Family* family = GetFamily_(name, help, Type::kCounter);
+  if (family == nullptr) {
+    auto* counter = new Counter;
+    m_orphans_.emplace_back(std::unique_ptr<Counter>(counter));
+    return counter;
+  }
+
+  auto [it, inserted] = family->metrics.try_emplace(RenderLabels(labels));
+  if (inserted) it->second = std::make_unique<Counter>();
+  return std::get<std::unique_ptr<Counter>>(it->second).get();
+}
+
+Gauge* Registry::GetGauge(const std::string& name, const std::string& help,
+                          const Labels& labels) {
+  absl::MutexLock lock(&m_mtx_);
+  Family* family = GetFamily_(name, help, Type::kGauge);
+  std::string rendered = RenderLabels(labels);
+  // A callback may already own these labels.
+  if (family == nullptr || (family->metrics.contains(rendered) &&
+                            !std::holds_alternative<std::unique_ptr<Gauge>>(
+                                family->metrics.at(rendered)))) {
+    auto* gauge = new Gauge;
+    m_orphans_.emplace_back(std::unique_ptr<Gauge>(gauge));
+    return gauge;
+  }
+
+  auto [it, inserted] = family->metrics.try_emplace(std::move(rendered));
+  if (inserted) it->second = std::make_unique<Gauge>();
+  return std::get<std::unique_ptr<Gauge>>(it->second).get();
+}
+
+Histogram* Registry::GetHistogram(const std::string& name,
+                                  const std::string& help, const Labels& labels,
+                                  const std::vector<double>& bounds) {
+  absl::MutexLock lock(&m_mtx_);
+  Family* family = GetFamily_(name, help, Type::kHistogram);
+  if (family == nullptr) {
+    auto* histogram = new Histogram(bounds);
+    m_orphans_.emplace_back(std::unique_ptr<Histogram>(histogram));
+    return histogram;
+  }
+
+  auto [it, inserted] = family->metrics.try_emplace(RenderLabels(labels));
+  if (inserted) it->second = std::make_unique<Histogram>(bounds);
+  return std::get<std::unique_ptr<Histogram>>(it->second).get();
+}
+
+Registry::CallbackId Registry::AddCounterCallback(const std::string& name,
+                                                  const std::string& help,
+                                                  const Labels& labels,
+                                                  std::function<double()> cb) {
+  return AddCallback_(name, help, labels, Type::kCounter, std::move(cb));
+}
+
+Registry::CallbackId Registry::AddGaugeCallback(const std::string& name,
+                                                const std::string& help,
+                                                const Labels& labels,
+                                                std::function<double()> cb) {
+  return AddCallback_(name, help, labels, Type::kGauge, std::move(cb));
+}
+
+Registry::CallbackId Registry::AddCallback_(const std::string& name,
+                                            const std::string& help,
+                                            const Labels& labels, Type type,
+                                            std::function<double()> cb) {
+  absl::MutexLock cb_lock(&m_cb_mtx_);
+  CallbackId id = m_next_callback_id_++;
+  std::string rendered = RenderLabels(labels);
+
+  {
+    absl::MutexLock lock(&m_mtx_);
+    Family* family = GetFamily_(name, help, type);
+    if (family == nullptr) return id;
+    auto [it, inserted] = family->metrics.try_emplace(rendered, id);
+    if (!inserted) {
+      CRANE_ERROR("Metric {}{{{}}} is registered twice.", name, rendered);
+      return id;
+    }
+  }
+
+  m_callbacks_.emplace(id, Callback{.cb = std::move(cb),
+                                    .name = name,
+                                    .labels = std::move(rendered)});
+  return id;
+}
+
+void Registry::RemoveCallback(CallbackId id) {
+  absl::MutexLock cb_lock(&m_cb_mtx_);
+  auto cb_it = m_callbacks_.find(id);
+  if (cb_it == m_callbacks_.end()) return;
+
+  {
+    absl::MutexLock lock(&m_mtx_);
+    auto family_it = m_families_.find(cb_it->second.name);
+    if (family_it != m_families_.end()) {
+      family_it->second.metrics.erase(cb_it->second.labels);
+      if (family_it->second.metrics.empty()) m_families_.erase(family_it);
+    }
+  }
+
+  m_callbacks_.erase(cb_it);
+}
+
+std::string Registry::Serialize() const {
+  absl::MutexLock cb_lock(&m_cb_mtx_);
+
+  // User code is called before m_mtx_ is taken, so that it may take locks
+  // of its own which are also held while metrics are created.
+  absl::flat_hash_map<CallbackId, double> cb_values;
+  cb_values.reserve(m_callbacks_.size());
+  for (const auto& [id, callback] : m_callbacks_)
+    cb_values.emplace(id, callback.cb());
+
+  absl::MutexLock lock(&m_mtx_);
+  std::string out;
+  for (const auto& [name, family] : m_families_) {
+    static constexpr std::array<const char*, 3> kTypeNames{"counter", "gauge",
+                                                           "histogram"};
+    out += fmt::format("# HELP {} {}\n# TYPE {} {}\n", name,
+                       EscapeHelp(family.help), name,
+                       kTypeNames[size_t(family.type)]);
+
+    for (const auto& [labels, metric] : family.metrics) {
+      if (const auto* counter = std::get_if<std::unique_ptr<Counter>>(&metric))
+        AppendSample(&out, name, labels, "",
+                     std::to_string((*counter)->Value()));
+      else if (const auto* gauge = std::get_if<std::unique_ptr<Gauge>>(&metric))
+        AppendSample(&out, name, labels, "", std::to_string((*gauge)->Value()));
+      else if (const auto* id = std::get_if<CallbackId>(&metric))
+        AppendSample(&out, name, labels, "", FormatValue(cb_values.at(*id)));
+      else {
+        const auto& histogram = *std::get<std::unique_ptr<Histogram>>(metric);
+        Histogram::Snapshot snapshot = histogram.Collect();
+
+        uint64_t cumulative = 0;
+        for (size_t i = 0; i < snapshot.bucket_counts.size(); ++i) {
+          cumulative += snapshot.bucket_counts[i];
+          std::string le = i < histogram.Bounds().size()
+                               ? FormatValue(histogram.Bounds()[i])
+                               : "+Inf";
+          AppendSample(&out, name + "_bucket", labels,
+                       fmt::format("le=\"{}\"", le),
+                       std::to_string(cumulative));
+        }
+        AppendSample(&out, name + "_sum", labels, "",
+                     FormatValue(snapshot.sum));
+        AppendSample(&out, name + "_count", labels, "",
+                     std::to_string(snapshot.count));
+      }
+    }
+  }
+
+  return out;
+}
+
+Registry& DefaultRegistry() {
+  static Registry registry;
+  return registry;
+}
+
+void AddLoggerMetrics(Registry* registry) {
+  registry->AddGaugeCallback(
+      "crane_log_queue_messages", "Log messages waiting for the log thread.",
+      {}, [] { return double(GetLoggerStats().queued); });
+  registry->AddCounterCallback(
+      "crane_log_dropped_messages_total",
+      "Log messages dropped because the log queue was full.", {},
+      [] { return double(GetLoggerStats().dropped); });
+  registry->AddCounterCallback(
+      "crane_log_sampled_out_messages_total",
+      "Log messages skipped by the sampled log macros.", {},
+      [] { return double(GetLoggerStats().sampled_out); });
+}
+
+MetricsServer::MetricsServer(Registry* registry) : m_registry_(registry) {}
+
+MetricsServer::~MetricsServer() { Shutdown(); }
+
+bool MetricsServer::Start(const std::string& address,
+                          const std::string& port) {
+  addrinfo hints{};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE | AI_NUMERICHOST;
+
+  addrinfo* result = nullptr;
+  int err = getaddrinfo(address.c_str(), port.c_str(), &hints, &result);
+  if (err != 0) {
+    CRANE_ERROR("Invalid metrics listen address {}:{}: {}", address, port,
+                gai_strerror(err));
+    return false;
+  }
+
+  int fd = socket(result->ai_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  int on = 1;
+  if (fd < 0 ||
+      setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) != 0 ||
+      bind(fd, result->ai_addr, result->ai_addrlen) != 0 ||
+      listen(fd, SOMAXCONN) != 0) {
+    CRANE_ERROR("Failed to listen on metrics address {}:{}: {}", address,
+                port, strerror(errno));
+    if (fd >= 0) close(fd);
+    freeaddrinfo(result);
+    return false;
+  }
+  freeaddrinfo(result);
+
+  m_listen_fd_ = fd;
+  m_accept_thread_ = std::thread([this] { AcceptThread_(); });
+  CRANE_INFO("Metrics are served on http://{}:{}/metrics", address, port);
+  return true;
+}
+
+void MetricsServer::Shutdown() {
+  if (m_listen_fd_ == -1) return;
+
+  // Wakes up the accept() of the accept thread.
+  shutdown(m_listen_fd_, SHUT_RDWR);
+  if (m_accept_thread_.joinable()) m_accept_thread_.join();
+  close(m_listen_fd_);
+  m_listen_fd_ = -1;
+}
+
+void MetricsServer::AcceptThread_() {
+  util::SetCurrentThreadName("MetricsThr");
+
+  while (true) {
+    int fd = accept4(m_listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) continue;
+      // The socket is shut down by Shutdown().
+      if (errno != EINVAL)
+        CRANE_ERROR("Metrics server accept failed: {}", strerror(errno));
+      break;
+    }
+
+    HandleConn_(fd);
+    close(fd);
+  }
+}
+
+void MetricsServer::HandleConn_(int fd) {
+  SetConnTimeout(fd, kConnTimeoutMs);
+
+  // Only the request line matters, but the headers are read too, so that
+  // the client doesn't get a reset for unread data.
+  std::string request;
+  char buf[1024];
+  while (request.find("\r\n\r\n") == std::string::npos &&
+         request.size() < kMaxRequestSize) {
+    ssize_t n = recv(fd, buf, sizeof(buf), 0);
+    if (n <= 0) return;
+    request.append(buf, n);
+  }
+
+  std::string_view line(request);
+  line = line.substr(0, line.find("\r\n"));
+  std::string_view target;
+  if (line.starts_with("GET ")) {
+    target = line.substr(4);
+    target = target.substr(0, target.find(' '));
+    target = target.substr(0, target.find('?'));
+  }
+
+  std::string status;
+  std::string body;
+  std::string content_type = "text/plain; charset=utf-8";
+  if (target == "/metrics") {
+    status = "200 OK";
+    body = m_registry_->Serialize();
+    content_type = "text/plain; version=0.0.4; charset=utf-8";
+  } else if (line.starts_with("GET ")) {
+    status = "404 Not Found";
+    body = "Metrics are served on /metrics.\n";
+  } else {
+    status = "405 Method Not Allowed";
+  }
+
+  std::string response = fmt::format(
+      "HTTP/1.1 {}\r\nContent-Type: {}\r\nContent-Length: {}\r\n"
+      "Connection: close\r\n\r\n{}",
+      status, content_type, body.size(), body);
+
+  std::string_view rest(response);
+  while (!rest.empty()) {
+    ssize_t n = send(fd, rest.data(), rest.size(), MSG_NOSIGNAL);
+    if (n <= 0) return;
+    rest.remove_prefix(n);
+  }
+}
+
+}  // namespace util::metrics
@@ -21,14 +21,27 @@
 #include <arpa/inet.h>
 #include <ifaddrs.h>
 #include <linux/if_packet.h>
+#include <linux/inet_diag.h>
+#include <linux/netlink.h>
+#include <linux/sock_diag.h>
 #include <net/if.h>
 #include <netinet/in.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <unistd.h>
 
+#include <absl/synchronization/mutex.h>
+#include <absl/time/clock.h>
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <optional>
 #include <ranges>
+#include <thread>
 
 #include "crane/Logger.h"
+#include "crane/String.h"
 
 namespace crane {
 
@@ -143,16 +156,293 @@ class HostsMap {
 
 std::unique_ptr<HostsMap> g_hosts_map;
 
+// A resolved name is kept for kResolvePositiveTtl and refreshed in the
+// background when used after that, a failed one is retried after
+// kResolveNegativeTtl.
+constexpr absl::Duration kResolvePositiveTtl = absl::Minutes(5);
+constexpr absl::Duration kResolveNegativeTtl = absl::Seconds(30);
+
+std::atomic<uint64_t> g_resolve_hits;
+std::atomic<uint64_t> g_resolve_stale_hits;
+std::atomic<uint64_t> g_resolve_negative_hits;
+std::atomic<uint64_t> g_resolve_misses;
+
+// Runs the background refreshes and seeding of the resolve caches one by one
+// so that a slow resolver never blocks more than this thread.
+class ResolveRefresher {
+ public:
+  void Post(std::function<void()> job) {
+    absl::MutexLock lock(&m_mtx_);
+    m_jobs_.emplace_back(std::move(job));
+
+    // The thread is started in the process posting, since a daemon forked
+    // after the config is parsed doesn't have the thread of its parent.
+    if (m_thread_pid_ != getpid()) {
+      m_thread_pid_ = getpid();
+      std::thread([this] { Run_(); }).detach();
+    }
+  }
+
+ private:
+  void Run_() {
+    util::SetCurrentThreadName("ResolveRefresh");
+    while (true) {
+      std::function<void()> job;
+      {
+        absl::MutexLock lock(&m_mtx_);
+        m_mtx_.Await(absl::Condition(
+            +[](std::deque<std::function<void()>>* jobs) {
+              return !jobs->empty();
+            },
+            &m_jobs_));
+        job = std::move(m_jobs_.front());
+        m_jobs_.pop_front();
+      }
+      job();
+    }
+  }
+
+  absl::Mutex m_mtx_;
+  std::deque<std::function<void()>> m_jobs_ ABSL_GUARDED_BY(m_mtx_);
+  pid_t m_thread_pid_ ABSL_GUARDED_BY(m_mtx_){-1};
+};
+
+ResolveRefresher* g_resolve_refresher;
+
+// The results of the system resolver for one direction and address family.
+// Only the first lookup of a key and the one after a failure expired wait
+// for the resolver. An entry which fails to refresh keeps its value.
+template <typename Key, typename Value>
+class ResolveCache {
+ public:
+  using Resolver = bool (*)(const Key&, Value*);
+
+  explicit ResolveCache(Resolver resolver) : m_resolver_(resolver) {}
+
+  bool Lookup(const Key& key, Value* value) {
+    {
+      absl::MutexLock lock(&m_mtx_);
+      auto it = m_entries_.find(key);
+      if (it != m_entries_.end()) {
+        Entry& entry = it->second;
+        if (absl::Now() < entry.expire_time) {
+          if (!entry.value.has_value()) {
+            g_resolve_negative_hits.fetch_add(1, std::memory_order_relaxed);
+            return false;
+          }
+          g_resolve_hits.fetch_add(1, std::memory_order_relaxed);
+          *value = entry.value.value();
+          return true;
+        }
+
+        if (entry.value.has_value()) {
+          g_resolve_stale_hits.fetch_add(1, std::memory_order_relaxed);
+          *value = entry.value.value();
+          if (!entry.refreshing) {
+            entry.refreshing = true;
+            g_resolve_refresher->Post([this, key] { Resolve_(key, nullptr); });
+          }
+          return true;
+        }
+      }
+    }
+
+    g_resolve_misses.fetch_add(1, std::memory_order_relaxed);
+    return Resolve_(key, value);
+  }
+
+  void Insert(const Key& key, const Value& value) {
+    absl::MutexLock lock(&m_mtx_);
+    Entry& entry = m_entries_[key];
+    entry.value = value;
+    entry.expire_time = absl::Now() + kResolvePositiveTtl;
+  }
+
+ private:
+  struct Entry {
+    std::optional<Value> value;
+    absl::Time expire_time;
+    bool refreshing{false};
+  };
+
+  bool Resolve_(const Key& key, Value* value) {
+    Value resolved{};
+    bool ok = m_resolver_(key, &resolved);
+
+    absl::MutexLock lock(&m_mtx_);
+    Entry& entry = m_entries_[key];
+    entry.refreshing = false;
+    if (ok) {
+      entry.value = resolved;
+      entry.expire_time = absl::Now() + kResolvePositiveTtl;
+      if (value != nullptr) *value = std::move(resolved);
+    } else {
+      entry.expire_time = absl::Now() + kResolveNegativeTtl;
+    }
+    return ok;
+  }
+
+  Resolver m_resolver_;
+  absl::Mutex m_mtx_;
+  absl::flat_hash_map<Key, Entry> m_entries_ ABSL_GUARDED_BY(m_mtx_);
+};
+
+bool SystemResolveHostnameFromIpv4(const ipv4_t& addr, std::string* hostname);
+bool SystemResolveHostnameFromIpv6(const ipv6_t& addr, std::string* hostname);
+bool SystemResolveIpv4FromHostname(const std::string& hostname, ipv4_t* addr);
+bool SystemResolveIpv6FromHostname(const std::string& hostname, ipv6_t* addr);
+
+struct ResolveCaches {
+  ResolveCache<ipv4_t, std::string> hostname_of_ipv4{
+      SystemResolveHostnameFromIpv4};
+  ResolveCache<ipv6_t, std::string> hostname_of_ipv6{
+      SystemResolveHostnameFromIpv6};
+  ResolveCache<std::string, ipv4_t> ipv4_of_hostname{
+      SystemResolveIpv4FromHostname};
+  ResolveCache<std::string, ipv6_t> ipv6_of_hostname{
+      SystemResolveIpv6FromHostname};
+};
+
+// Neither is freed since the refresh thread may still use them at exit.
+ResolveCaches* g_resolve_caches;
+
+// Returns 1 if the socket of family with local port port is found, 0 if not
+// and -1 if netlink failed.
+int SockDiagFindTcpByPort(int family, int port, TcpSocketInfo* info) {
+  int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_SOCK_DIAG);
+  if (fd < 0) {
+    CRANE_DEBUG("Failed to open NETLINK_SOCK_DIAG socket: {}",
+                strerror(errno));
+    return -1;
+  }
+
+  struct {
+    nlmsghdr nlh;
+    inet_diag_req_v2 req;
+  } request{};
+  request.nlh.nlmsg_len = sizeof(request);
+  request.nlh.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+  request.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+  request.req.sdiag_family = family;
+  request.req.sdiag_protocol = IPPROTO_TCP;
+  request.req.idiag_states = ~0U;
+  // The dump only returns the sockets with this source port.
+  request.req.id.idiag_sport = htons(port);
+
+  sockaddr_nl kernel{.nl_family = AF_NETLINK};
+  if (sendto(fd, &request, sizeof(request), 0,
+             reinterpret_cast<sockaddr*>(&kernel), sizeof(kernel)) < 0) {
+    CRANE_DEBUG("Failed to send sock_diag request: {}", strerror(errno));
+    close(fd);
+    return -1;
+  }
+
+  int result = 0;
+  alignas(nlmsghdr) char buf[8192];
+  bool done = false;
+  while (!done) {
+    ssize_t len = recv(fd, buf, sizeof(buf), 0);
+    if (len < 0) {
+      if (errno == EINTR) continue;
+      CRANE_DEBUG("Failed to receive sock_diag reply: {}", strerror(errno));
+      result = -1;
+      break;
+    }
+
+    auto* nlh = reinterpret_cast<nlmsghdr*>(buf);
+    for (; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+      if (nlh->nlmsg_type == NLMSG_DONE) {
+        done = true;
+        break;
+      }
+      if (nlh->nlmsg_type == NLMSG_ERROR) {
+        result = -1;
+        done = true;
+        break;
+      }
+
+      auto* diag = static_cast<inet_diag_msg*>(NLMSG_DATA(nlh));
+      if (result == 0 && ntohs(diag->id.idiag_sport) == port) {
+        info->inode = diag->idiag_inode;
+        info->uid = diag->idiag_uid;
+        result = 1;
+      }
+    }
+  }
+
+  close(fd);
+  return result;
+}
+
 }  // namespace internal
 
 void InitializeNetworkFunctions() {
   internal::g_hosts_map = std::make_unique<internal::HostsMap>();
+  if (internal::g_resolve_caches == nullptr) {
+    internal::g_resolve_refresher = new internal::ResolveRefresher;
+    internal::g_resolve_caches = new internal::ResolveCaches;
+  }
+}
+
+void SeedResolveCache(std::vector<std::string> hostnames) {
+  internal::g_resolve_refresher->Post([hostnames = std::move(hostnames)] {
+    for (const auto& hostname : hostnames) {
+      if (GetIpAddrVer(hostname) != -1) continue;
+
+      // The reverse lookups of the nodes, e.g. for the TLS hostname of a
+      // peer, give the node names without asking the resolver.
+      ipv4_t ipv4;
+      if (ResolveIpv4FromHostname(hostname, &ipv4))
+        internal::g_resolve_caches->hostname_of_ipv4.Insert(ipv4, hostname);
+      ipv6_t ipv6;
+      if (ResolveIpv6FromHostname(hostname, &ipv6))
+        internal::g_resolve_caches->hostname_of_ipv6.Insert(ipv6, hostname);
+    }
+    CRANE_DEBUG("Resolve cache is seeded with {} hostnames.",
+                hostnames.size());
+  });
+}
+
+ResolveCacheStats GetResolveCacheStats() {
+  return {
+      .hits = internal::g_resolve_hits.load(std::memory_order_relaxed),
+      .stale_hits =
+          internal::g_resolve_stale_hits.load(std::memory_order_relaxed),
+      .negative_hits =
+          internal::g_resolve_negative_hits.load(std::memory_order_relaxed),
+      .misses = internal::g_resolve_misses.load(std::memory_order_relaxed),
+  };
 }
 
 bool ResolveHostnameFromIpv4(ipv4_t addr, std::string* hostname) {
   if (internal::g_hosts_map->FindFirstHostnameOfIpv4(addr, hostname))
     return true;
 
+  return internal::g_resolve_caches->hostname_of_ipv4.Lookup(addr, hostname);
+}
+
+bool ResolveHostnameFromIpv6(const ipv6_t& addr, std::string* hostname) {
+  if (internal::g_hosts_map->FindFirstHostnameOfIpv6(addr, hostname))
+    return true;
+
+  return internal::g_resolve_caches->hostname_of_ipv6.Lookup(addr, hostname);
+}
+
+bool ResolveIpv4FromHostname(const std::string& hostname, ipv4_t* addr) {
+  if (internal::g_hosts_map->FindIpv4OfHostname(hostname, addr)) return true;
+
+  return internal::g_resolve_caches->ipv4_of_hostname.Lookup(hostname, addr);
+}
+
+bool ResolveIpv6FromHostname(const std::string& hostname, ipv6_t* addr) {
+  if (internal::g_hosts_map->FindIpv6OfHostname(hostname, addr)) return true;
+
+  return internal::g_resolve_caches->ipv6_of_hostname.Lookup(hostname, addr);
+}
+
+namespace internal {
+
+bool SystemResolveHostnameFromIpv4(const ipv4_t& addr, std::string* hostname) {
   struct sockaddr_in sa{};
   char hbuf[NI_MAXHOST];
 
@@ -175,10 +465,7 @@ bool ResolveHostnameFromIpv4(ipv4_t addr, std::string* hostname) {
   return true;
 }
 
-bool ResolveHostnameFromIpv6(const ipv6_t& addr, std::string* hostname) {
-  if (internal::g_hosts_map->FindFirstHostnameOfIpv6(addr, hostname))
-    return true;
-
+bool SystemResolveHostnameFromIpv6(const ipv6_t& addr, std::string* hostname) {
   struct sockaddr_in6 sa6{};
   char hbuf[NI_MAXHOST];
 
@@ -203,9 +490,7 @@ bool ResolveHostnameFromIpv6(const ipv6_t& addr, std::string* hostname) {
   return true;
 }
 
-bool ResolveIpv4FromHostname(const std::string& hostname, ipv4_t* addr) {
-  if (internal::g_hosts_map->FindIpv4OfHostname(hostname, addr)) return true;
-
+bool SystemResolveIpv4FromHostname(const std::string& hostname, ipv4_t* addr) {
   struct addrinfo hints{};
   struct addrinfo* res;
   char host[NI_MAXHOST];
@@ -234,9 +519,7 @@ bool ResolveIpv4FromHostname(const std::string& hostname, ipv4_t* addr) {
   return true;
 }
 
-bool ResolveIpv6FromHostname(const std::string& hostname, ipv6_t* addr) {
-  if (internal::g_hosts_map->FindIpv6OfHostname(hostname, addr)) return true;
-
+bool SystemResolveIpv6FromHostname(const std::string& hostname, ipv6_t* addr) {
   struct addrinfo hints{};
   struct addrinfo *res, *tmp;
   char host[NI_MAXHOST];
@@ -277,6 +560,8 @@ bool ResolveIpv6FromHostname(const std::string& hostname, ipv6_t* addr) {
   return true;
 }
 
+}  // namespace internal
+
 bool StrToIpv4(const std::string& ip, ipv4_t* addr) {
   struct in_addr ipv4_addr;
   if (inet_pton(AF_INET, ip.c_str(), &ipv4_addr) != 1) {
@@ -331,7 +616,8 @@ int GetIpAddrVer(const std::string& ip) {
   return -1;
 }
 
-bool FindTcpInodeByPort(const std::string& tcp_path, int port, ino_t* inode) {
+bool FindTcpInodeByPort(const std::string& tcp_path, int port, ino_t* inode,
+                        uid_t* uid) {
   std::ifstream tcp_in(tcp_path, std::ios::in);
   std::string tcp_line;
   std::string port_hex = fmt::format("{:0>4X}", port);
@@ -344,6 +630,7 @@ bool FindTcpInodeByPort(const std::string& tcp_path, int port, ino_t* inode) {
       CRANE_TRACE("Checking port {} == {}", port_hex, tcp_line_vec[2]);
       if (port_hex == tcp_line_vec[2]) {
         *inode = std::stoul(tcp_line_vec[13]);
+        if (uid != nullptr) *uid = std::stoul(tcp_line_vec[11]);
         CRANE_TRACE("Inode num for port {} is {}", port, *inode);
         return true;
       }
@@ -354,6 +641,26 @@ bool FindTcpInodeByPort(const std::string& tcp_path, int port, ino_t* inode) {
   return false;
 }
 
+bool FindTcpSocketByPort(int port, TcpSocketInfo* info) {
+  bool netlink_failed = false;
+  for (int family : {AF_INET, AF_INET6}) {
+    int ret = internal::SockDiagFindTcpByPort(family, port, info);
+    if (ret == 1) {
+      CRANE_TRACE("Inode num for port {} is {}, uid {}", port, info->inode,
+                  info->uid);
+      return true;
+    }
+    if (ret < 0) netlink_failed = true;
+  }
+  if (!netlink_failed) return false;
+
+  CRANE_TRACE("sock_diag lookup for port {} failed. Parsing /proc/net/tcp.",
+              port);
+  return FindTcpInodeByPort("/proc/net/tcp", port, &info->inode,
+                            &info->uid) ||
+         FindTcpInodeByPort("/proc/net/tcp6", port, &info->inode, &info->uid);
+}
+
 std::vector<NetworkInterface> GetNetworkInterfaces() {
   std::unordered_map<std::string, NetworkInterface> interface_map;
   constexpr int kMaxRetries = 10;
@@ -151,6 +151,19 @@ bool SetFdNonBlocking(int fd) {
   return true;
 }
 
+bool WriteAll(int fd, const char* data, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, data, len);
+    if (n == -1) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    data += n;
+    len -= n;
+  }
+  return true;
+}
+
 void CloseFdRange(int fd_begin, int fd_end) {
   int fd_max = std::min(GetFdOpenMax(), fd_end);
   for (int i = fd_begin; i < fd_max; i++) close(i);
@@ -18,6 +18,14 @@
 
 #include "crane/PublicHeader.h"
 
+#include <absl/synchronization/mutex.h>
+
+#include <atomic>
+#include <bit>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+
 AllocatableResource& AllocatableResource::operator+=(
     const AllocatableResource& rhs) {
   cpu_count += rhs.cpu_count;
@@ -104,6 +112,7 @@ bool operator<=(const DeviceMap& lhs, const DedicatedResourceInNode& rhs) {
     auto rhs_it = rhs.name_type_slots_map.find(lhs_name);
     if (rhs_it == rhs.name_type_slots_map.end()) {
       if (untyped_req_count != 0 || !req_type_count_map.empty()) return false;
+      continue;
     }
 
     uint32_t avail_count = 0;
@@ -190,12 +199,16 @@ AllocatableResource& AllocatableResource::operator=(
 
 AllocatableResource::operator crane::grpc::AllocatableResource() const {
   auto val = crane::grpc::AllocatableResource();
-  val.set_cpu_core_limit(static_cast<double>(this->cpu_count));
-  val.set_memory_limit_bytes(this->memory_bytes);
-  val.set_memory_sw_limit_bytes(this->memory_sw_bytes);
+  ToGrpc(&val);
   return val;
 }
 
+void AllocatableResource::ToGrpc(crane::grpc::AllocatableResource* val) const {
+  val->set_cpu_core_limit(static_cast<double>(this->cpu_count));
+  val->set_memory_limit_bytes(this->memory_bytes);
+  val->set_memory_sw_limit_bytes(this->memory_sw_bytes);
+}
+
 double AllocatableResource::CpuCount() const {
   return static_cast<double>(cpu_count);
 }
@@ -302,24 +315,29 @@ DedicatedResourceInNode::operator crane::grpc::DeviceMap() const {
 
 DedicatedResourceInNode::operator crane::grpc::DedicatedResourceInNode() const {
   crane::grpc::DedicatedResourceInNode val{};
-  auto* grpc_name_type_map = val.mutable_name_type_map();
-
-  for (const auto& [device_name, type_slots_map] : this->name_type_slots_map) {
-    auto& grpc_type_slots_map = (*grpc_name_type_map)[device_name];
-    grpc_type_slots_map =
-        static_cast<crane::grpc::DeviceTypeSlotsMap>(type_slots_map);
-  }
-
+  ToGrpc(&val);
   return val;
 }
 
+void DedicatedResourceInNode::ToGrpc(
+    crane::grpc::DedicatedResourceInNode* val) const {
+  auto* grpc_name_type_map = val->mutable_name_type_map();
+  for (const auto& [device_name, type_slots_map] : this->name_type_slots_map)
+    type_slots_map.ToGrpc(&(*grpc_name_type_map)[device_name]);
+}
+
 void DedicatedResourceInNode::SetToZero() { name_type_slots_map.clear(); }
 
 crane::grpc::DeviceMap ToGrpcDeviceMap(const DeviceMap& device_map) {
   crane::grpc::DeviceMap grpc_device_map{};
+  ToGrpcDeviceMap(device_map, &grpc_device_map);
+  return grpc_device_map;
+}
 
+void ToGrpcDeviceMap(const DeviceMap& device_map,
+                     crane::grpc::DeviceMap* grpc_device_map) {
   for (const auto& [device_name, cnt_pair] : device_map) {
-    auto& grpc_name_type_map = *grpc_device_map.mutable_name_type_map();
+    auto& grpc_name_type_map = *grpc_device_map->mutable_name_type_map();
 
     auto& grpc_type_cnt = grpc_name_type_map[device_name];
     grpc_type_cnt.set_total(cnt_pair.first);
@@ -335,8 +353,6 @@ crane::grpc::DeviceMap ToGrpcDeviceMap(const DeviceMap& device_map) {
       grpc_type_count_map[dev_type] = typed_cnt;
     }
   }
-
-  return grpc_device_map;
 }
 
 DeviceMap FromGrpcDeviceMap(const crane::grpc::DeviceMap& grpc_device_map) {
@@ -390,6 +406,174 @@ void operator*=(DeviceMap& lhs, uint32_t rhs) {
   }
 }
 
+namespace {
+
+// Assigns the fixed indexes of SlotSet. Slot ids are stored in chunks which
+// are never moved, so an index is turned back into its slot id without any
+// lock.
+class SlotIdRegistry {
+ public:
+  static SlotIdRegistry& Instance() {
+    static SlotIdRegistry registry;
+    return registry;
+  }
+
+  uint32_t IndexOf(const SlotId& slot) {
+    {
+      absl::ReaderMutexLock lock(&m_mtx_);
+      auto iter = m_indexes_.find(slot);
+      if (iter != m_indexes_.end()) return iter->second;
+    }
+
+    absl::MutexLock lock(&m_mtx_);
+    auto [iter, inserted] = m_indexes_.try_emplace(slot, m_indexes_.size());
+    if (!inserted) return iter->second;
+
+    uint32_t index = iter->second;
+    if (index >= kChunkSize * kMaxChunkNum)
+      throw std::length_error("Too many distinct device slots.");
+
+    auto& chunk = m_chunks_[index / kChunkSize];
+    if (chunk == nullptr) chunk = std::make_unique<SlotId[]>(kChunkSize);
+    chunk[index % kChunkSize] = slot;
+    m_chunk_ptrs_[index / kChunkSize].store(chunk.get(),
+                                            std::memory_order_release);
+    return index;
+  }
+
+  std::optional<uint32_t> FindIndex(const SlotId& slot) const {
+    absl::ReaderMutexLock lock(&m_mtx_);
+    auto iter = m_indexes_.find(slot);
+    if (iter == m_indexes_.end()) return std::nullopt;
+    return iter->second;
+  }
+
+  // The index must have been returned by IndexOf.
+  const SlotId& SlotOf(uint32_t index) const {
+    return m_chunk_ptrs_[index / kChunkSize].load(
+        std::memory_order_acquire)[index % kChunkSize];
+  }
+
+ private:
+  static constexpr uint32_t kChunkSize = 256;
+  static constexpr uint32_t kMaxChunkNum = 1024;
+
+  mutable absl::Mutex m_mtx_;
+  std::unordered_map<SlotId, uint32_t> m_indexes_ ABSL_GUARDED_BY(m_mtx_);
+  std::array<std::unique_ptr<SlotId[]>, kMaxChunkNum> m_chunks_
+      ABSL_GUARDED_BY(m_mtx_);
+  std::array<std::atomic<const SlotId*>, kMaxChunkNum> m_chunk_ptrs_{};
+};
+
+}  // namespace
+
+SlotSet::const_iterator::reference SlotSet::const_iterator::operator*()
+    const {
+  return SlotIdRegistry::Instance().SlotOf(m_index_);
+}
+
+void SlotSet::insert(const SlotId& slot) {
+  uint32_t index = SlotIdRegistry::Instance().IndexOf(slot);
+  MutableWord_(index / 64) |= uint64_t{1} << (index % 64);
+}
+
+void SlotSet::erase(const SlotId& slot) {
+  auto index = SlotIdRegistry::Instance().FindIndex(slot);
+  if (!index.has_value() || *index / 64 >= WordNum_()) return;
+  MutableWord_(*index / 64) &= ~(uint64_t{1} << (*index % 64));
+}
+
+bool SlotSet::contains(const SlotId& slot) const {
+  auto index = SlotIdRegistry::Instance().FindIndex(slot);
+  if (!index.has_value()) return false;
+  return (Word_(*index / 64) >> (*index % 64)) & 1;
+}
+
+size_t SlotSet::size() const {
+  size_t count = std::popcount(m_word0_);
+  for (uint64_t word : m_more_words_) count += std::popcount(word);
+  return count;
+}
+
+bool SlotSet::empty() const {
+  return m_word0_ == 0 &&
+         std::ranges::all_of(m_more_words_, [](uint64_t w) { return w == 0; });
+}
+
+void SlotSet::clear() {
+  m_word0_ = 0;
+  m_more_words_.clear();
+}
+
+SlotSet SlotSet::First(size_t n) const {
+  SlotSet result;
+  for (size_t i = 0; i < WordNum_() && n > 0; i++) {
+    uint64_t word = Word_(i);
+    if (static_cast<size_t>(std::popcount(word)) > n) {
+      uint64_t kept = 0;
+      for (; n > 0; n--) {
+        kept |= word & -word;
+        word &= word - 1;
+      }
+      word = kept;
+    } else {
+      n -= std::popcount(word);
+    }
+    if (word != 0) result.MutableWord_(i) = word;
+  }
+  return result;
+}
+
+bool SlotSet::Includes(const SlotSet& rhs) const {
+  for (size_t i = 0; i < rhs.WordNum_(); i++)
+    if (rhs.Word_(i) & ~Word_(i)) return false;
+  return true;
+}
+
+SlotSet& SlotSet::operator|=(const SlotSet& rhs) {
+  for (size_t i = 0; i < rhs.WordNum_(); i++)
+    if (rhs.Word_(i) != 0) MutableWord_(i) |= rhs.Word_(i);
+  return *this;
+}
+
+SlotSet& SlotSet::operator&=(const SlotSet& rhs) {
+  for (size_t i = 0; i < WordNum_(); i++) MutableWord_(i) &= rhs.Word_(i);
+  return *this;
+}
+
+SlotSet& SlotSet::operator-=(const SlotSet& rhs) {
+  size_t words = std::min(WordNum_(), rhs.WordNum_());
+  for (size_t i = 0; i < words; i++) MutableWord_(i) &= ~rhs.Word_(i);
+  return *this;
+}
+
+bool operator==(const SlotSet& lhs, const SlotSet& rhs) {
+  size_t words = std::max(lhs.WordNum_(), rhs.WordNum_());
+  for (size_t i = 0; i < words; i++)
+    if (lhs.Word_(i) != rhs.Word_(i)) return false;
+  return true;
+}
+
+uint32_t SlotSet::NextIndex_(uint32_t from) const {
+  if (from == kEndIndex) return kEndIndex;
+
+  size_t i = from / 64;
+  if (i >= WordNum_()) return kEndIndex;
+
+  uint64_t word = Word_(i) & (~uint64_t{0} << (from % 64));
+  while (word == 0) {
+    if (++i >= WordNum_()) return kEndIndex;
+    word = Word_(i);
+  }
+  return i * 64 + std::countr_zero(word);
+}
+
+uint64_t& SlotSet::MutableWord_(size_t i) {
+  if (i == 0) return m_word0_;
+  if (i > m_more_words_.size()) m_more_words_.resize(i, 0);
+  return m_more_words_[i - 1];
+}
+
 TypeSlotsMap::TypeSlotsMap(const crane::grpc::DeviceTypeSlotsMap& rhs) {
   for (const auto& [type, slots] : rhs.type_slots_map())
     this->type_slots_map[type].insert(slots.slots().begin(),
@@ -407,21 +591,25 @@ TypeSlotsMap& TypeSlotsMap::operator=(
 
 TypeSlotsMap::operator crane::grpc::DeviceTypeSlotsMap() const {
   crane::grpc::DeviceTypeSlotsMap val{};
+  ToGrpc(&val);
+  return val;
+}
+
+void TypeSlotsMap::ToGrpc(crane::grpc::DeviceTypeSlotsMap* val) const {
   for (const auto& [type, slots] : type_slots_map) {
-    auto* grpc_type_slots_map = val.mutable_type_slots_map();
+    auto* grpc_type_slots_map = val->mutable_type_slots_map();
     auto* grpc_slots = (*grpc_type_slots_map)[type].mutable_slots();
     grpc_slots->Assign(slots.begin(), slots.end());
   }
-  return val;
 }
 
 bool TypeSlotsMap::IsZero() const { return type_slots_map.empty(); }
 
-std::set<SlotId>& TypeSlotsMap::operator[](const std::string& type) {
+SlotSet& TypeSlotsMap::operator[](const std::string& type) {
   return type_slots_map[type];
 }
 
-const std::set<SlotId>& TypeSlotsMap::at(const std::string& type) const {
+const SlotSet& TypeSlotsMap::at(const std::string& type) const {
   return type_slots_map.at(type);
 }
 
@@ -431,20 +619,18 @@ bool TypeSlotsMap::contains(const std::string& type) const {
 
 TypeSlotsMap& TypeSlotsMap::operator+=(const TypeSlotsMap& rhs) {
   for (const auto& [rhs_type, rhs_slots] : rhs.type_slots_map)
-    this->type_slots_map[rhs_type].insert(rhs_slots.begin(), rhs_slots.end());
+    this->type_slots_map[rhs_type] |= rhs_slots;
 
   return *this;
 }
 
 TypeSlotsMap& TypeSlotsMap::operator-=(const TypeSlotsMap& rhs) {
   for (const auto& [rhs_type, rhs_slots] : rhs.type_slots_map) {
-    std::set<SlotId> temp;
-    std::ranges::set_difference(this->type_slots_map.at(rhs_type), rhs_slots,
-                                std::inserter(temp, temp.begin()));
-    if (temp.empty())
-      this->type_slots_map.erase(rhs_type);
-    else
-      this->type_slots_map[rhs_type] = std::move(temp);
+    auto lhs_it = this->type_slots_map.find(rhs_type);
+    if (lhs_it == this->type_slots_map.end()) continue;
+
+    lhs_it->second -= rhs_slots;
+    if (lhs_it->second.empty()) this->type_slots_map.erase(lhs_it);
   }
 
   return *this;
@@ -459,7 +645,7 @@ bool operator<=(const TypeSlotsMap& lhs, const TypeSlotsMap& rhs) {
     auto rhs_it = rhs.type_slots_map.find(lhs_type);
     if (rhs_it == rhs.type_slots_map.end()) return false;
 
-    if (!std::ranges::includes(rhs_it->second, lhs_slots)) return false;
+    if (!rhs_it->second.Includes(lhs_slots)) return false;
   }
 
   return true;
@@ -472,9 +658,8 @@ TypeSlotsMap Intersection(const TypeSlotsMap& lhs, const TypeSlotsMap& rhs) {
     auto rhs_it = rhs.type_slots_map.find(lhs_type);
     if (rhs_it == rhs.type_slots_map.end()) continue;
 
-    std::set<SlotId> temp;
-    std::ranges::set_intersection(lhs_slots, rhs_it->second,
-                                  std::inserter(temp, temp.begin()));
+    SlotSet temp = lhs_slots;
+    temp &= rhs_it->second;
     if (!temp.empty()) result.type_slots_map[lhs_type] = std::move(temp);
   }
 
@@ -488,18 +673,15 @@ ResourceInNode::ResourceInNode(const crane::grpc::ResourceInNode& rhs) {
 
 ResourceInNode::operator crane::grpc::ResourceInNode() const {
   crane::grpc::ResourceInNode val{};
-
-  auto* grpc_allocatable_res_in_node = val.mutable_allocatable_res_in_node();
-  *grpc_allocatable_res_in_node =
-      static_cast<crane::grpc::AllocatableResource>(allocatable_res);
-
-  auto* grpc_dedicated_res_in_node = val.mutable_dedicated_res_in_node();
-  *grpc_dedicated_res_in_node =
-      static_cast<crane::grpc::DedicatedResourceInNode>(dedicated_res);
-
+  ToGrpc(&val);
   return val;
 }
 
+void ResourceInNode::ToGrpc(crane::grpc::ResourceInNode* val) const {
+  allocatable_res.ToGrpc(val->mutable_allocatable_res_in_node());
+  dedicated_res.ToGrpc(val->mutable_dedicated_res_in_node());
+}
+
 ResourceInNode& ResourceInNode::operator+=(const ResourceInNode& rhs) {
   allocatable_res += rhs.allocatable_res;
   dedicated_res += rhs.dedicated_res;
@@ -531,7 +713,151 @@ bool operator==(const ResourceInNode& lhs, const ResourceInNode& rhs) {
          lhs.dedicated_res == rhs.dedicated_res;
 }
 
+DenseResourceInNode& DenseResourceInNode::operator+=(
+    const DenseResourceInNode& rhs) {
+  cpu_count += rhs.cpu_count;
+  memory_bytes += rhs.memory_bytes;
+  memory_sw_bytes += rhs.memory_sw_bytes;
+
+  if (slot_bits.size() < rhs.slot_bits.size())
+    slot_bits.resize(rhs.slot_bits.size(), 0);
+  for (size_t i = 0; i < rhs.slot_bits.size(); i++)
+    slot_bits[i] |= rhs.slot_bits[i];
+
+  has_unknown_slots |= rhs.has_unknown_slots;
+  return *this;
+}
+
+DenseResourceInNode& DenseResourceInNode::operator-=(
+    const DenseResourceInNode& rhs) {
+  cpu_count -= rhs.cpu_count;
+  memory_bytes -= rhs.memory_bytes;
+  memory_sw_bytes -= rhs.memory_sw_bytes;
+
+  size_t words = std::min(slot_bits.size(), rhs.slot_bits.size());
+  for (size_t i = 0; i < words; i++) slot_bits[i] &= ~rhs.slot_bits[i];
+
+  return *this;
+}
+
+bool DenseResourceInNode::IsZero() const {
+  return cpu_count == cpu_t{0} && memory_bytes == 0 && memory_sw_bytes == 0 &&
+         !has_unknown_slots &&
+         std::ranges::all_of(slot_bits, [](uint64_t w) { return w == 0; });
+}
+
+void DenseResourceInNode::SetToZero() {
+  cpu_count = cpu_t{0};
+  memory_bytes = 0;
+  memory_sw_bytes = 0;
+  std::ranges::fill(slot_bits, 0);
+  has_unknown_slots = false;
+}
+
+bool operator<=(const DenseResourceInNode& lhs,
+                const DenseResourceInNode& rhs) {
+  if (lhs.has_unknown_slots) return false;
+
+  if (lhs.cpu_count > rhs.cpu_count || lhs.memory_bytes > rhs.memory_bytes ||
+      lhs.memory_sw_bytes > rhs.memory_sw_bytes)
+    return false;
+
+  size_t common_words = std::min(lhs.slot_bits.size(), rhs.slot_bits.size());
+  for (size_t i = 0; i < common_words; i++)
+    if (lhs.slot_bits[i] & ~rhs.slot_bits[i]) return false;
+  for (size_t i = common_words; i < lhs.slot_bits.size(); i++)
+    if (lhs.slot_bits[i] != 0) return false;
+
+  return true;
+}
+
+bool operator==(const DenseResourceInNode& lhs,
+                const DenseResourceInNode& rhs) {
+  if (lhs.cpu_count != rhs.cpu_count || lhs.memory_bytes != rhs.memory_bytes ||
+      lhs.memory_sw_bytes != rhs.memory_sw_bytes ||
+      lhs.has_unknown_slots != rhs.has_unknown_slots)
+    return false;
+
+  size_t words = std::max(lhs.slot_bits.size(), rhs.slot_bits.size());
+  for (size_t i = 0; i < words; i++) {
+    uint64_t l = i < lhs.slot_bits.size() ? lhs.slot_bits[i] : 0;
+    uint64_t r = i < rhs.slot_bits.size() ? rhs.slot_bits[i] : 0;
+    if (l != r) return false;
+  }
+
+  return true;
+}
+
+ResourceInNodeLayout::ResourceInNodeLayout(const ResourceInNode& res_total) {
+  // Names and types are sorted so that the same resource always gets the same
+  // layout regardless of the iteration order of the hash maps.
+  std::map<std::string_view, std::map<std::string_view, const SlotSet*>>
+      sorted_slots;
+  for (const auto& [name, type_slots_map] :
+       res_total.dedicated_res.name_type_slots_map)
+    for (const auto& [type, slots] : type_slots_map.type_slots_map)
+      sorted_slots[name][type] = &slots;
+
+  for (const auto& [name, type_slots_map] : sorted_slots) {
+    auto& type_bits = m_slot_bits_[std::string(name)];
+    for (const auto& [type, slots] : type_slots_map) {
+      TypeSlots& type_slots = type_bits[std::string(type)];
+      type_slots.first_bit = m_slot_num_;
+      // SlotSet is iterated in the order of the indexes.
+      for (auto it = slots->begin(); it != slots->end(); ++it)
+        type_slots.slot_indexes.emplace_back(it.Index());
+      m_slot_num_ += type_slots.slot_indexes.size();
+    }
+  }
+}
+
+DenseResourceInNode ResourceInNodeLayout::Encode(
+    const ResourceInNode& res) const {
+  DenseResourceInNode dense;
+  dense.cpu_count = res.allocatable_res.cpu_count;
+  dense.memory_bytes = res.allocatable_res.memory_bytes;
+  dense.memory_sw_bytes = res.allocatable_res.memory_sw_bytes;
+  dense.slot_bits.assign(WordNum(), 0);
+
+  for (const auto& [name, type_slots_map] :
+       res.dedicated_res.name_type_slots_map) {
+    auto name_it = m_slot_bits_.find(name);
+    for (const auto& [type, slots] : type_slots_map.type_slots_map) {
+      if (slots.empty()) continue;
+
+      if (name_it == m_slot_bits_.end()) {
+        dense.has_unknown_slots = true;
+        break;
+      }
+
+      auto type_it = name_it->second.find(type);
+      if (type_it == name_it->second.end()) {
+        dense.has_unknown_slots = true;
+        continue;
+      }
+
+      const TypeSlots& type_slots = type_it->second;
+      for (auto it = slots.begin(); it != slots.end(); ++it) {
+        auto slot_it =
+            std::ranges::lower_bound(type_slots.slot_indexes, it.Index());
+        if (slot_it == type_slots.slot_indexes.end() ||
+            *slot_it != it.Index()) {
+          dense.has_unknown_slots = true;
+          continue;
+        }
+
+        uint32_t bit = type_slots.first_bit +
+                       (slot_it - type_slots.slot_indexes.begin());
+        dense.slot_bits[bit / 64] |= uint64_t{1} << (bit % 64);
+      }
+    }
+  }
+
+  return dense;
+}
+
 ResourceV2::ResourceV2(const crane::grpc::ResourceV2& rhs) {
+  this->each_node_res_map.reserve(rhs.each_node_res().size());
   for (const auto& [node_id, res_in_node] : rhs.each_node_res())
     this->each_node_res_map.emplace(node_id, res_in_node);
 }
@@ -540,16 +866,15 @@ ResourceV2::operator crane::grpc::ResourceV2() const {
   crane::grpc::ResourceV2 val{};
 
   auto* grpc_each_node_res = val.mutable_each_node_res();
-  for (const auto& [node_id, res_in_node] : this->each_node_res_map) {
-    auto& grpc_res_in_node = (*grpc_each_node_res)[node_id];
-    grpc_res_in_node = static_cast<crane::grpc::ResourceInNode>(res_in_node);
-  }
+  for (const auto& [node_id, res_in_node] : this->each_node_res_map)
+    res_in_node.ToGrpc(&(*grpc_each_node_res)[node_id]);
 
   return val;
 }
 
 ResourceV2& ResourceV2::operator=(const crane::grpc::ResourceV2& rhs) {
   this->each_node_res_map.clear();
+  this->each_node_res_map.reserve(rhs.each_node_res().size());
 
   for (const auto& [node_id, res_in_node] : rhs.each_node_res())
     this->each_node_res_map.emplace(node_id, res_in_node);
@@ -631,17 +956,15 @@ ResourceView::ResourceView(const crane::grpc::ResourceView& rhs) {
 
 ResourceView::operator crane::grpc::ResourceView() const {
   crane::grpc::ResourceView val{};
-
-  auto* mutable_allocatable_res = val.mutable_allocatable_res();
-  *mutable_allocatable_res =
-      static_cast<crane::grpc::AllocatableResource>(allocatable_res);
-
-  auto* mutable_dev_map = val.mutable_device_map();
-  *mutable_dev_map = ToGrpcDeviceMap(device_map);
-
+  ToGrpc(&val);
   return val;
 }
 
+void ResourceView::ToGrpc(crane::grpc::ResourceView* val) const {
+  allocatable_res.ToGrpc(val->mutable_allocatable_res());
+  ToGrpcDeviceMap(device_map, val->mutable_device_map());
+}
+
 ResourceView& ResourceView::operator+=(const ResourceV2& rhs) {
   for (const auto& [_, rhs_res_in_node] : rhs.each_node_res_map)
     *this += rhs_res_in_node;
@@ -738,14 +1061,13 @@ bool ResourceView::GetFeasibleResourceInNode(const ResourceInNode& avail_res,
       const auto& avail_slots = avail_slots_it->second;
       auto& feasible_res_dev_name_type = feasible_res_dev_name[dev_type];
 
-      if (avail_slots.size() < typed_cnt) return false;
-
-      auto it = avail_slots.begin();
-      for (size_t i = 0; i < typed_cnt; ++i, ++it)
-        feasible_res_dev_name_type.emplace(*it);
+      size_t avail_cnt = avail_slots.size();
+      if (avail_cnt < typed_cnt) return false;
 
-      for (; untyped_cnt > 0 && it != avail_slots.end(); ++it, --untyped_cnt)
-        feasible_res_dev_name_type.emplace(*it);
+      // The untyped request also takes the redundant slots of this type.
+      size_t taken_cnt = std::min<uint64_t>(avail_cnt, typed_cnt + untyped_cnt);
+      feasible_res_dev_name_type |= avail_slots.First(taken_cnt);
+      untyped_cnt -= taken_cnt - typed_cnt;
     }
 
     // If there are still untyped slots to be allocated,
@@ -754,9 +1076,10 @@ bool ResourceView::GetFeasibleResourceInNode(const ResourceInNode& avail_res,
       for (const auto& [type, slots] : dres_avail.type_slots_map) {
         if (typed_cnt_map.contains(type)) continue;
 
-        auto it = slots.begin();
-        for (; untyped_cnt > 0 && it != slots.end(); ++it, --untyped_cnt)
-          feasible_res_dev_name[type].emplace(*it);
+        size_t taken_cnt = std::min<uint64_t>(slots.size(), untyped_cnt);
+        if (taken_cnt == 0) continue;
+        feasible_res_dev_name[type] |= slots.First(taken_cnt);
+        untyped_cnt -= taken_cnt;
 
         if (untyped_cnt == 0) break;
       }
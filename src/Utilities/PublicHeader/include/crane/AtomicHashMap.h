@@ -19,6 +19,12 @@
 #pragma once
 
 #include <absl/container/flat_hash_map.h>
+#include <absl/hash/hash.h>
+
+#include <array>
+#include <bit>
+#include <source_location>
+#include <string_view>
 
 #include "Lock.h"
 #include "Pointer.h"
@@ -123,13 +129,20 @@ class AtomicHashMap {
     };
 
     void unlock() {
-      global_map_shared_mutex_->unlock_shared();
+      // The value first: once the map lock is released, a writer may erase
+      // the value or move it in a rehash, together with its mutex.
       value_mutex_->Unlock();
+      global_map_shared_mutex_->unlock_shared();
     }
   };
 
   AtomicHashMap() = default;
 
+  // The map lock is profiled under `lock_name` (see LockProfiler.h), with
+  // the callers of the methods below as the call sites.
+  explicit AtomicHashMap(std::string_view lock_name)
+      : m_global_rw_mutex_(lock_name) {}
+
   // This function should be called only once!
   void InitFromMap(MapType<Key, T>&& other_map) {
     m_value_map_.reserve(other_map.size());
@@ -140,13 +153,16 @@ class AtomicHashMap {
     }
   }
 
-  bool Contains(const Key& key) {
-    read_lock_guard lock_guard(m_global_rw_mutex_);
+  bool Contains(const Key& key,
+                std::source_location loc = std::source_location::current()) {
+    read_lock_guard lock_guard(m_global_rw_mutex_, loc);
     return m_value_map_.contains(key);
   }
 
-  ValueExclusivePtr GetValueExclusivePtr(const Key& key) {
-    m_global_rw_mutex_.lock_shared();
+  ValueExclusivePtr GetValueExclusivePtr(
+      const Key& key,
+      std::source_location loc = std::source_location::current()) {
+    m_global_rw_mutex_.lock_shared(loc);
     auto iter = m_value_map_.find(key);
 
     if (iter == m_value_map_.end()) {
@@ -163,18 +179,21 @@ class AtomicHashMap {
     return GetValueExclusivePtr(key);
   }
 
-  MapConstSharedPtr GetMapConstSharedPtr() {
-    m_global_rw_mutex_.lock_shared();
+  MapConstSharedPtr GetMapConstSharedPtr(
+      std::source_location loc = std::source_location::current()) {
+    m_global_rw_mutex_.lock_shared(loc);
     return MapConstSharedPtr{&m_value_map_, &m_global_rw_mutex_};
   }
 
-  MapSharedPtr GetMapSharedPtr() {
-    m_global_rw_mutex_.lock_shared();
+  MapSharedPtr GetMapSharedPtr(
+      std::source_location loc = std::source_location::current()) {
+    m_global_rw_mutex_.lock_shared(loc);
     return MapSharedPtr{&m_value_map_, &m_global_rw_mutex_};
   }
 
-  MapExclusivePtr GetMapExclusivePtr() {
-    m_global_rw_mutex_.lock();
+  MapExclusivePtr GetMapExclusivePtr(
+      std::source_location loc = std::source_location::current()) {
+    m_global_rw_mutex_.lock(loc);
     return MapExclusivePtr{&m_value_map_, &m_global_rw_mutex_};
   }
 
@@ -196,4 +215,126 @@ class AtomicHashMap {
   rw_mutex m_global_rw_mutex_;
 };
 
+/**
+ * A hash map split into ShardNum maps, each behind its own reader-writer
+ * lock. Unlike AtomicHashMap, inserting or erasing a key only blocks the
+ * readers of one shard, and readers of a value share its lock instead of
+ * taking turns on a per-value mutex.
+ *
+ * There is no pointer to the whole map. Walking it with ForEach() or
+ * GetShardConstSharedPtr() locks one shard at a time, so the walk is not a
+ * snapshot of the map.
+ */
+template <template <typename...> class MapType, typename Key, typename T,
+          size_t ShardNum = 16>
+class ShardedHashMap {
+  static_assert(std::has_single_bit(ShardNum) && ShardNum > 1,
+                "ShardNum must be a power of 2 larger than 1");
+
+ public:
+  using ShardMap = MapType<Key, T>;
+
+  using ValueExclusivePtr = util::ScopeExclusivePtr<T, rw_mutex>;
+  using ValueConstSharedPtr = util::ScopeConstSharedPtr<T, rw_mutex>;
+  using ShardConstSharedPtr = util::ScopeConstSharedPtr<ShardMap, rw_mutex>;
+
+  static constexpr size_t kShardNum = ShardNum;
+
+  ShardedHashMap() = default;
+
+  ShardedHashMap(const ShardedHashMap&) = delete;
+  ShardedHashMap& operator=(const ShardedHashMap&) = delete;
+
+  // This function should be called only once!
+  void InitFromMap(MapType<Key, T>&& other_map) {
+    for (auto& [k, v] : other_map)
+      m_shards_[ShardIndex_(k)].map.emplace(k, std::move(v));
+  }
+
+  bool Contains(const Key& key) const {
+    const Shard_& shard = m_shards_[ShardIndex_(key)];
+    read_lock_guard lock_guard(shard.mtx);
+    return shard.map.contains(key);
+  }
+
+  // Null if the key does not exist.
+  ValueConstSharedPtr GetValueConstSharedPtr(const Key& key) const {
+    const Shard_& shard = m_shards_[ShardIndex_(key)];
+    shard.mtx.lock_shared();
+    auto iter = shard.map.find(key);
+    if (iter == shard.map.end()) {
+      shard.mtx.unlock_shared();
+      return ValueConstSharedPtr{nullptr};
+    }
+    return ValueConstSharedPtr{&iter->second, &shard.mtx};
+  }
+
+  // Null if the key does not exist. Blocks the whole shard while held.
+  ValueExclusivePtr GetValueExclusivePtr(const Key& key) {
+    Shard_& shard = m_shards_[ShardIndex_(key)];
+    shard.mtx.lock();
+    auto iter = shard.map.find(key);
+    if (iter == shard.map.end()) {
+      shard.mtx.unlock();
+      return ValueExclusivePtr{nullptr};
+    }
+    return ValueExclusivePtr{&iter->second, &shard.mtx};
+  }
+
+  ShardConstSharedPtr GetShardConstSharedPtr(size_t shard_index) const {
+    const Shard_& shard = m_shards_[shard_index];
+    shard.mtx.lock_shared();
+    return ShardConstSharedPtr{&shard.map, &shard.mtx};
+  }
+
+  // False if the key already exists.
+  template <typename... Args>
+  bool Emplace(const Key& key, Args&&... args) {
+    Shard_& shard = m_shards_[ShardIndex_(key)];
+    write_lock_guard lock_guard(shard.mtx);
+    return shard.map.try_emplace(key, std::forward<Args>(args)...).second;
+  }
+
+  bool Erase(const Key& key) {
+    Shard_& shard = m_shards_[ShardIndex_(key)];
+    write_lock_guard lock_guard(shard.mtx);
+    return shard.map.erase(key) > 0;
+  }
+
+  size_t Size() const {
+    size_t size = 0;
+    for (const Shard_& shard : m_shards_) {
+      read_lock_guard lock_guard(shard.mtx);
+      size += shard.map.size();
+    }
+    return size;
+  }
+
+  // Calls fn(const Key&, const T&) with the shard of the entry read-locked.
+  template <typename Fn>
+  void ForEach(Fn&& fn) const {
+    for (const Shard_& shard : m_shards_) {
+      read_lock_guard lock_guard(shard.mtx);
+      for (const auto& [k, v] : shard.map) fn(k, v);
+    }
+  }
+
+ private:
+  // Each shard on its own cache line, so that the lock words of adjacent
+  // shards do not bounce together.
+  struct alignas(64) Shard_ {
+    mutable rw_mutex mtx;
+    ShardMap map;
+  };
+
+  // The high bits of the hash, since absl::flat_hash_map places entries by
+  // the low bits and would see every key of a shard share them otherwise.
+  static size_t ShardIndex_(const Key& key) {
+    constexpr int kShift = 64 - std::countr_zero(ShardNum);
+    return static_cast<uint64_t>(absl::Hash<Key>{}(key)) >> kShift;
+  }
+
+  std::array<Shard_, ShardNum> m_shards_;
+};
+
 }  // namespace util
@@ -57,6 +57,11 @@ void ServerBuilderSetCompression(grpc::ServerBuilder* builder);
 
 void ServerBuilderSetKeepAliveArgs(grpc::ServerBuilder* builder);
 
+// Record the handling time of every RPC of the server into the histogram
+// crane_grpc_server_handling_seconds of the default metrics registry,
+// labeled by the full method name.
+void ServerBuilderAddMetricsInterceptor(grpc::ServerBuilder* builder);
+
 void ServerBuilderAddUnixInsecureListeningPort(grpc::ServerBuilder* builder,
                                                const std::string& address);
 
@@ -82,6 +87,9 @@ void SetTlsHostnameOverride(grpc::ChannelArguments* args,
 std::shared_ptr<grpc::Channel> CreateUnixInsecureChannel(
     const std::string& socket_addr);
 
+std::shared_ptr<grpc::Channel> CreateUnixInsecureCustomChannel(
+    const std::string& socket_addr, const grpc::ChannelArguments& args);
+
 std::shared_ptr<grpc::Channel> CreateTcpInsecureChannel(
     const std::string& address, const std::string& port);
 
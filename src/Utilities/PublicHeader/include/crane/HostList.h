@@ -0,0 +1,136 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <spdlog/fmt/fmt.h>
+
+#include <compare>
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace util {
+
+/**
+ * A set of host names kept as "prefix<index>suffix" patterns, each holding a
+ * set of index ranges, so that "cn[00001-10000]" costs a few dozen bytes
+ * instead of ten thousand strings. The index of a name is its first run of
+ * digits; names without digits are kept as they are.
+ *
+ * "cn9" and "cn09" are different hosts, so every pattern also records the
+ * zero-padded width of its indexes. An index whose natural length reaches
+ * the width is stored unpadded, which keeps cn[08-10] and cn[08-09],cn10
+ * the same set.
+ */
+class HostList {
+ public:
+  HostList() = default;
+
+  // Parse a host expression in the format accepted by ParseHostList().
+  // Bracket ranges are inserted as ranges and never expanded, except for
+  // the rare forms (several brackets in one name, digits right before a
+  // bracket) whose first run of digits is not the bracket.
+  static bool Parse(const std::string& host_str, HostList* host_list);
+
+  // True if the name has at most one run of digits, which does not start
+  // the name and is short enough for HostNameListToStr_() to compare. The
+  // compressed form of such names does not depend on which algorithm built
+  // it.
+  static bool IsSingleIndexName(std::string_view name);
+
+  void Insert(std::string_view name);
+
+  bool Contains(std::string_view name) const;
+
+  bool Empty() const { return m_patterns_.empty() && m_names_.empty(); }
+
+  // Number of hosts, not of patterns.
+  size_t Size() const;
+
+  HostList& Union(const HostList& other);
+  HostList& Intersect(const HostList& other);
+
+  // Call fn(const std::string&) for every host, ordered by pattern and then
+  // by index, reusing one buffer for all of them.
+  template <typename Fn>
+  void ForEach(Fn&& fn) const;
+
+  // Compressed expression, e.g. "cn[01-10,12],login". It is the same as
+  // what HostNameListToStr() returns for names passing IsSingleIndexName();
+  // names with several runs of digits are compressed on the first only.
+  std::string ToString() const;
+
+ private:
+  struct Pattern {
+    std::string prefix;
+    std::string suffix;
+    // 0 if the indexes are printed without padding.
+    uint32_t width;
+
+    auto operator<=>(const Pattern&) const = default;
+  };
+
+  struct Interval {
+    uint64_t lo;
+    uint64_t hi;
+  };
+
+  // Sorted, disjoint and non-adjacent intervals.
+  using RangeSet = std::vector<Interval>;
+
+  // Longest index that fits in uint64_t for sure.
+  static constexpr size_t kMaxIndexDigits = 18;
+
+  // Split a name into its pattern and index. False if it has no index.
+  static bool SplitName_(std::string_view name, Pattern* pattern,
+                         uint64_t* index);
+
+  // Insert the indexes [lo, hi] printed with at least `width` digits.
+  void InsertRange_(std::string_view prefix, std::string_view suffix,
+                    uint64_t lo, uint64_t hi, uint32_t width);
+
+  static void AddInterval_(RangeSet* set, uint64_t lo, uint64_t hi);
+  static RangeSet UnionOf_(const RangeSet& a, const RangeSet& b);
+  static RangeSet IntersectionOf_(const RangeSet& a, const RangeSet& b);
+
+  std::map<Pattern, RangeSet> m_patterns_;
+  std::set<std::string, std::less<>> m_names_;
+};
+
+template <typename Fn>
+void HostList::ForEach(Fn&& fn) const {
+  std::string name;
+  for (const auto& [pattern, ranges] : m_patterns_) {
+    for (const auto& [lo, hi] : ranges) {
+      for (uint64_t i = lo;; ++i) {
+        name.assign(pattern.prefix);
+        fmt::format_to(std::back_inserter(name), "{:0{}}", i, pattern.width);
+        name.append(pattern.suffix);
+        fn(static_cast<const std::string&>(name));
+        if (i == hi) break;
+      }
+    }
+  }
+  for (const auto& plain : m_names_) fn(plain);
+}
+
+}  // namespace util
@@ -22,6 +22,10 @@
 
 #include <mutex>
 #include <shared_mutex>
+#include <source_location>
+#include <string_view>
+
+#include "LockProfiler.h"
 
 namespace util {
 
@@ -44,9 +48,180 @@ using lock_guard = AbslMutexLockGuard;
 using recursive_mutex = std::recursive_mutex;
 using recursive_lock_guard = std::lock_guard<std::recursive_mutex>;
 
-using rw_mutex = std::shared_mutex;
-using read_lock_guard = std::shared_lock<std::shared_mutex>;
-using write_lock_guard = std::unique_lock<std::shared_mutex>;
+/**
+ * An absl::Mutex whose acquisitions are profiled with the call site if it is
+ * named and lock profiling is enabled (see LockProfiler.h).
+ */
+class ABSL_LOCKABLE ProfiledMutex {
+ public:
+  ProfiledMutex() = default;
+  explicit ProfiledMutex(std::string_view name) : m_profile_(name) {}
+
+  ProfiledMutex(const ProfiledMutex&) = delete;
+  ProfiledMutex& operator=(const ProfiledMutex&) = delete;
+
+  void Lock(std::source_location loc = std::source_location::current())
+      ABSL_EXCLUSIVE_LOCK_FUNCTION() ABSL_NO_THREAD_SAFETY_ANALYSIS {
+    m_profile_.Lock([this] { m_mtx_.Lock(); }, loc);
+  }
+
+  bool TryLock(std::source_location loc = std::source_location::current())
+      ABSL_EXCLUSIVE_TRYLOCK_FUNCTION(true) ABSL_NO_THREAD_SAFETY_ANALYSIS {
+    return m_profile_.TryLock([this] { return m_mtx_.TryLock(); }, loc);
+  }
+
+  void Unlock() ABSL_UNLOCK_FUNCTION() ABSL_NO_THREAD_SAFETY_ANALYSIS {
+    m_profile_.Unlock([this] { m_mtx_.Unlock(); });
+  }
+
+  void ReaderLock(std::source_location loc = std::source_location::current())
+      ABSL_SHARED_LOCK_FUNCTION() ABSL_NO_THREAD_SAFETY_ANALYSIS {
+    m_profile_.LockShared([this] { m_mtx_.ReaderLock(); }, loc);
+  }
+
+  void ReaderUnlock() ABSL_UNLOCK_FUNCTION() ABSL_NO_THREAD_SAFETY_ANALYSIS {
+    m_profile_.UnlockShared([this] { m_mtx_.ReaderUnlock(); });
+  }
+
+  void AssertHeld() const ABSL_ASSERT_EXCLUSIVE_LOCK() { m_mtx_.AssertHeld(); }
+  void AssertReaderHeld() const ABSL_ASSERT_SHARED_LOCK() {
+    m_mtx_.AssertReaderHeld();
+  }
+
+ private:
+  absl::Mutex m_mtx_;
+  lock_profiler::LockProfile m_profile_;
+};
+
+// absl::MutexLock, which also takes a ProfiledMutex.
+class ABSL_SCOPED_LOCKABLE ProfiledMutexLock {
+ public:
+  explicit ProfiledMutexLock(absl::Mutex* mu) ABSL_EXCLUSIVE_LOCK_FUNCTION(mu)
+      : m_mu_(mu) {
+    mu->Lock();
+  }
+
+  explicit ProfiledMutexLock(
+      ProfiledMutex* mu,
+      std::source_location loc = std::source_location::current())
+      ABSL_EXCLUSIVE_LOCK_FUNCTION(mu)
+      : m_profiled_mu_(mu) {
+    mu->Lock(loc);
+  }
+
+  ~ProfiledMutexLock() ABSL_UNLOCK_FUNCTION() {
+    if (m_profiled_mu_ != nullptr)
+      m_profiled_mu_->Unlock();
+    else
+      m_mu_->Unlock();
+  }
+
+  ProfiledMutexLock(const ProfiledMutexLock&) = delete;
+  ProfiledMutexLock& operator=(const ProfiledMutexLock&) = delete;
+
+ private:
+  absl::Mutex* m_mu_{nullptr};
+  ProfiledMutex* m_profiled_mu_{nullptr};
+};
+
+// absl::ReaderMutexLock, which also takes a ProfiledMutex.
+class ABSL_SCOPED_LOCKABLE ProfiledReaderMutexLock {
+ public:
+  explicit ProfiledReaderMutexLock(absl::Mutex* mu)
+      ABSL_SHARED_LOCK_FUNCTION(mu)
+      : m_mu_(mu) {
+    mu->ReaderLock();
+  }
+
+  explicit ProfiledReaderMutexLock(
+      ProfiledMutex* mu,
+      std::source_location loc = std::source_location::current())
+      ABSL_SHARED_LOCK_FUNCTION(mu)
+      : m_profiled_mu_(mu) {
+    mu->ReaderLock(loc);
+  }
+
+  ~ProfiledReaderMutexLock() ABSL_UNLOCK_FUNCTION() {
+    if (m_profiled_mu_ != nullptr)
+      m_profiled_mu_->ReaderUnlock();
+    else
+      m_mu_->ReaderUnlock();
+  }
+
+  ProfiledReaderMutexLock(const ProfiledReaderMutexLock&) = delete;
+  ProfiledReaderMutexLock& operator=(const ProfiledReaderMutexLock&) = delete;
+
+ private:
+  absl::Mutex* m_mu_{nullptr};
+  ProfiledMutex* m_profiled_mu_{nullptr};
+};
+
+// A std::shared_mutex profiled in the same way as ProfiledMutex.
+class ProfiledSharedMutex {
+ public:
+  ProfiledSharedMutex() = default;
+  explicit ProfiledSharedMutex(std::string_view name) : m_profile_(name) {}
+
+  ProfiledSharedMutex(const ProfiledSharedMutex&) = delete;
+  ProfiledSharedMutex& operator=(const ProfiledSharedMutex&) = delete;
+
+  void lock(std::source_location loc = std::source_location::current()) {
+    m_profile_.Lock([this] { m_mtx_.lock(); }, loc);
+  }
+  bool try_lock() { return m_mtx_.try_lock(); }
+  void unlock() {
+    m_profile_.Unlock([this] { m_mtx_.unlock(); });
+  }
+
+  void lock_shared(
+      std::source_location loc = std::source_location::current()) {
+    m_profile_.LockShared([this] { m_mtx_.lock_shared(); }, loc);
+  }
+  bool try_lock_shared() { return m_mtx_.try_lock_shared(); }
+  void unlock_shared() {
+    m_profile_.UnlockShared([this] { m_mtx_.unlock_shared(); });
+  }
+
+ private:
+  std::shared_mutex m_mtx_;
+  lock_profiler::LockProfile m_profile_;
+};
+
+using rw_mutex = ProfiledSharedMutex;
+
+// Take the call site, which std::shared_lock and std::unique_lock can't pass
+// to a ProfiledSharedMutex.
+class read_lock_guard {
+ public:
+  explicit read_lock_guard(
+      rw_mutex& mtx, std::source_location loc = std::source_location::current())
+      : m_mtx_(mtx) {
+    m_mtx_.lock_shared(loc);
+  }
+  ~read_lock_guard() { m_mtx_.unlock_shared(); }
+
+  read_lock_guard(const read_lock_guard&) = delete;
+  read_lock_guard& operator=(const read_lock_guard&) = delete;
+
+ private:
+  rw_mutex& m_mtx_;
+};
+
+class write_lock_guard {
+ public:
+  explicit write_lock_guard(
+      rw_mutex& mtx, std::source_location loc = std::source_location::current())
+      : m_mtx_(mtx) {
+    m_mtx_.lock(loc);
+  }
+  ~write_lock_guard() { m_mtx_.unlock(); }
+
+  write_lock_guard(const write_lock_guard&) = delete;
+  write_lock_guard& operator=(const write_lock_guard&) = delete;
+
+ private:
+  rw_mutex& m_mtx_;
+};
 
 class flexible_latch {
   absl::Mutex mtx;
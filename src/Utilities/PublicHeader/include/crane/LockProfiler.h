@@ -0,0 +1,165 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <optional>
+#include <source_location>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "Metrics.h"
+
+namespace util::lock_profiler {
+
+/**
+ * Opt-in profiling of the named locks, i.e. util::ProfiledMutex and
+ * util::rw_mutex constructed with a name. Once Enable() is called, the time
+ * to acquire a named lock and the time it is held are observed into the
+ * histograms crane_lock_wait_seconds and crane_lock_hold_seconds, labeled by
+ * the lock, the acquiring call site and the mode. Until then, a lock costs a
+ * relaxed load more than the plain mutex. Try-locks are never profiled.
+ */
+
+namespace internal {
+
+inline std::atomic<metrics::Registry*> g_registry{nullptr};
+
+}  // namespace internal
+
+inline bool Enabled() {
+  return internal::g_registry.load(std::memory_order_relaxed) != nullptr;
+}
+
+// Profiling can't be turned off once enabled.
+void Enable(metrics::Registry* registry = &metrics::DefaultRegistry());
+
+// Upper bounds in seconds, from 1us to 10s.
+inline const std::vector<double> kLockBuckets{1e-6, 1e-5, 1e-4, 1e-3,
+                                              1e-2, 0.1,  1,    10};
+
+enum class Mode : uint8_t { kExclusive, kShared };
+
+using Clock = std::chrono::steady_clock;
+
+struct Site {
+  metrics::Histogram* wait;
+  metrics::Histogram* hold;
+};
+
+// The histograms of a lock at a call site. They are cached per thread, keyed
+// by the address of the lock, so named locks must live as long as the
+// process. Only called once profiling is enabled.
+Site GetSite(const void* lock, std::string_view lock_name,
+             const std::source_location& loc, Mode mode);
+
+// Shared holds are kept per thread, since a lock has many shared holders.
+void BeginSharedHold(const void* lock, metrics::Histogram* hold,
+                     Clock::time_point begin);
+
+struct SharedHold {
+  metrics::Histogram* hold;
+  Clock::duration duration;
+};
+
+// Null if this thread didn't begin a profiled shared hold of the lock.
+std::optional<SharedHold> EndSharedHold(const void* lock);
+
+// The profiling state embedded in a lock. `lock_fn` and `unlock_fn` acquire
+// and release the underlying mutex.
+class LockProfile {
+ public:
+  LockProfile() = default;
+  explicit LockProfile(std::string_view name) : m_name_(name) {}
+
+  template <typename F>
+  void Lock(F&& lock_fn, const std::source_location& loc) {
+    if (!Profiled_()) {
+      lock_fn();
+      return;
+    }
+
+    Site site = GetSite(this, m_name_, loc, Mode::kExclusive);
+    Clock::time_point begin = Clock::now();
+    lock_fn();
+    // Only the holder touches the hold state.
+    m_hold_begin_ = Clock::now();
+    m_hold_ = site.hold;
+    site.wait->ObserveDuration(m_hold_begin_ - begin);
+  }
+
+  // Only the hold time is observed, since a try never waits.
+  template <typename F>
+  bool TryLock(F&& try_lock_fn, const std::source_location& loc) {
+    if (!Profiled_()) return try_lock_fn();
+
+    Site site = GetSite(this, m_name_, loc, Mode::kExclusive);
+    if (!try_lock_fn()) return false;
+    m_hold_begin_ = Clock::now();
+    m_hold_ = site.hold;
+    return true;
+  }
+
+  template <typename F>
+  void Unlock(F&& unlock_fn) {
+    if (m_hold_ == nullptr) {
+      unlock_fn();
+      return;
+    }
+
+    metrics::Histogram* hold = std::exchange(m_hold_, nullptr);
+    Clock::duration duration = Clock::now() - m_hold_begin_;
+    unlock_fn();
+    hold->ObserveDuration(duration);
+  }
+
+  template <typename F>
+  void LockShared(F&& lock_fn, const std::source_location& loc) {
+    if (!Profiled_()) {
+      lock_fn();
+      return;
+    }
+
+    Site site = GetSite(this, m_name_, loc, Mode::kShared);
+    Clock::time_point begin = Clock::now();
+    lock_fn();
+    Clock::time_point acquired = Clock::now();
+    BeginSharedHold(this, site.hold, acquired);
+    site.wait->ObserveDuration(acquired - begin);
+  }
+
+  template <typename F>
+  void UnlockShared(F&& unlock_fn) {
+    std::optional<SharedHold> hold;
+    if (Profiled_()) hold = EndSharedHold(this);
+    unlock_fn();
+    if (hold) hold->hold->ObserveDuration(hold->duration);
+  }
+
+ private:
+  bool Profiled_() const { return !m_name_.empty() && Enabled(); }
+
+  std::string_view m_name_;
+  metrics::Histogram* m_hold_{nullptr};
+  Clock::time_point m_hold_begin_;
+};
+
+}  // namespace util::lock_profiler
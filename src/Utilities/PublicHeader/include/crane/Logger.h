@@ -20,6 +20,8 @@
 
 #include <spdlog/fmt/bundled/format.h>
 
+#include <atomic>
+#include <chrono>
 #include <source_location>
 
 // For better logging inside lambda functions
@@ -67,6 +69,96 @@
 #define CRANE_LOGGER_CALL(logger, level, ...)    \
   SPDLOG_LOGGER_CALL(logger, level, __VA_ARGS__)
 
+namespace crane::logger_internal {
+
+// Calls skipped by the sampled and rate-limited macros below.
+inline std::atomic<size_t> g_sampled_out{0};
+
+// Claim the next log slot of a rate-limited call site.
+inline bool TakeLogSlot(std::atomic<int64_t>* next_ms, int64_t interval_ms) {
+  int64_t now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                       std::chrono::steady_clock::now().time_since_epoch())
+                       .count();
+  int64_t expected = next_ms->load(std::memory_order_relaxed);
+  return now_ms >= expected &&
+         next_ms->compare_exchange_strong(expected, now_ms + interval_ms,
+                                          std::memory_order_relaxed);
+}
+
+}  // namespace crane::logger_internal
+
+// For messages logged once per task or step on hot paths. The arguments are
+// only evaluated for the calls which are logged, and a disabled level costs
+// no more than a plain CRANE_TRACE.
+#define CRANE_LOG_EVERY_N_(level, n, ...)                                  \
+  do {                                                                     \
+    if (spdlog::default_logger_raw()->should_log(level)) {                 \
+      static std::atomic<uint64_t> crane_log_calls_{0};                    \
+      uint64_t crane_log_call_ =                                           \
+          crane_log_calls_.fetch_add(1, std::memory_order_relaxed);        \
+      if (crane_log_call_ % (n) == 0)                                      \
+        SPDLOG_LOGGER_CALL(spdlog::default_logger_raw(), level,            \
+                           __VA_ARGS__);                                   \
+      else                                                                 \
+        crane::logger_internal::g_sampled_out.fetch_add(                   \
+            1, std::memory_order_relaxed);                                 \
+    }                                                                      \
+  } while (false)
+
+#define CRANE_LOG_EVERY_MS_(level, interval_ms, ...)               \
+  do {                                                             \
+    if (spdlog::default_logger_raw()->should_log(level)) {         \
+      static std::atomic<int64_t> crane_log_next_ms_{0};           \
+      if (crane::logger_internal::TakeLogSlot(&crane_log_next_ms_, \
+                                              (interval_ms)))      \
+        SPDLOG_LOGGER_CALL(spdlog::default_logger_raw(), level,    \
+                           __VA_ARGS__);                           \
+      else                                                         \
+        crane::logger_internal::g_sampled_out.fetch_add(           \
+            1, std::memory_order_relaxed);                         \
+    }                                                              \
+  } while (false)
+
+#if CRANE_LOG_LEVEL <= CRANE_LOG_LEVEL_TRACE
+#  define CRANE_TRACE_EVERY_N(n, ...) \
+    CRANE_LOG_EVERY_N_(spdlog::level::trace, n, __VA_ARGS__)
+#  define CRANE_TRACE_EVERY_MS(interval_ms, ...) \
+    CRANE_LOG_EVERY_MS_(spdlog::level::trace, interval_ms, __VA_ARGS__)
+#else
+#  define CRANE_TRACE_EVERY_N(n, ...) (void)0
+#  define CRANE_TRACE_EVERY_MS(interval_ms, ...) (void)0
+#endif
+
+#if CRANE_LOG_LEVEL <= CRANE_LOG_LEVEL_DEBUG
+#  define CRANE_DEBUG_EVERY_N(n, ...) \
+    CRANE_LOG_EVERY_N_(spdlog::level::debug, n, __VA_ARGS__)
+#  define CRANE_DEBUG_EVERY_MS(interval_ms, ...) \
+    CRANE_LOG_EVERY_MS_(spdlog::level::debug, interval_ms, __VA_ARGS__)
+#else
+#  define CRANE_DEBUG_EVERY_N(n, ...) (void)0
+#  define CRANE_DEBUG_EVERY_MS(interval_ms, ...) (void)0
+#endif
+
+#if CRANE_LOG_LEVEL <= CRANE_LOG_LEVEL_INFO
+#  define CRANE_INFO_EVERY_N(n, ...) \
+    CRANE_LOG_EVERY_N_(spdlog::level::info, n, __VA_ARGS__)
+#  define CRANE_INFO_EVERY_MS(interval_ms, ...) \
+    CRANE_LOG_EVERY_MS_(spdlog::level::info, interval_ms, __VA_ARGS__)
+#else
+#  define CRANE_INFO_EVERY_N(n, ...) (void)0
+#  define CRANE_INFO_EVERY_MS(interval_ms, ...) (void)0
+#endif
+
+#if CRANE_LOG_LEVEL <= CRANE_LOG_LEVEL_WARN
+#  define CRANE_WARN_EVERY_N(n, ...) \
+    CRANE_LOG_EVERY_N_(spdlog::level::warn, n, __VA_ARGS__)
+#  define CRANE_WARN_EVERY_MS(interval_ms, ...) \
+    CRANE_LOG_EVERY_MS_(spdlog::level::warn, interval_ms, __VA_ARGS__)
+#else
+#  define CRANE_WARN_EVERY_N(n, ...) (void)0
+#  define CRANE_WARN_EVERY_MS(interval_ms, ...) (void)0
+#endif
+
 #if CRANE_ACTIVE_LEVEL <= CRANE_LEVEL_TRACE
 #  define CRANE_LOGGER_TRACE(logger, ...)                        \
     CRANE_LOGGER_CALL(logger, spdlog::level::trace, __VA_ARGS__)
@@ -152,11 +244,31 @@ struct LoggerSinks {
   std::shared_ptr<spdlog::sinks::sink> console_sink;
 };
 
+// Messages are formatted on the calling thread and written to the sinks by
+// one logging thread, which takes them from a bounded queue.
+struct LogQueueOptions {
+  size_t size{kDefaultLogQueueSize};
+  // Drop new messages while the queue is full instead of making the callers
+  // wait for the logging thread. Drops are counted and reported in the log.
+  bool drop_on_full{false};
+};
+
+struct LoggerStats {
+  size_t queued;
+  // Lost because the queue was full.
+  size_t dropped;
+  // Skipped by the CRANE_*_EVERY_N and CRANE_*_EVERY_MS macros.
+  size_t sampled_out;
+};
+
 std::optional<spdlog::level::level_enum> StrToLogLevel(
     const std::string& level);
 
 void InitLogger(spdlog::level::level_enum level,
-                const std::string& log_file_path, bool enable_console);
+                const std::string& log_file_path, bool enable_console,
+                const LogQueueOptions& queue_options = {});
+
+LoggerStats GetLoggerStats();
 
 std::shared_ptr<spdlog::async_logger> AddLogger(
     const std::string& name, spdlog::level::level_enum level,
@@ -0,0 +1,259 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <absl/base/thread_annotations.h>
+#include <absl/container/flat_hash_map.h>
+#include <absl/synchronization/mutex.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace util::metrics {
+
+/**
+ * Runtime metrics of cranectld and craned, served in the Prometheus text
+ * exposition format by MetricsServer. Metrics are created once through a
+ * Registry, usually DefaultRegistry(), and the returned pointers are kept
+ * and updated on the hot path without any lock or lookup.
+ */
+
+using Labels = std::vector<std::pair<std::string, std::string>>;
+
+namespace internal {
+
+inline constexpr size_t kCounterStripeNum = 16;
+
+// Threads are spread over the stripes round robin on their first increment.
+inline size_t ThisThreadStripe() {
+  static std::atomic_size_t next_stripe{0};
+  thread_local size_t stripe =
+      next_stripe.fetch_add(1, std::memory_order_relaxed) % kCounterStripeNum;
+  return stripe;
+}
+
+}  // namespace internal
+
+// A monotonically increasing count. Each thread adds to its own cache line,
+// so concurrent increments are a few nanoseconds and don't contend.
+class Counter {
+ public:
+  void Inc(uint64_t n = 1) {
+    m_stripes_[internal::ThisThreadStripe()].value.fetch_add(
+        n, std::memory_order_relaxed);
+  }
+
+  uint64_t Value() const {
+    uint64_t sum = 0;
+    for (const auto& stripe : m_stripes_)
+      sum += stripe.value.load(std::memory_order_relaxed);
+    return sum;
+  }
+
+ private:
+  struct alignas(64) Stripe {
+    std::atomic_uint64_t value{0};
+  };
+
+  std::array<Stripe, internal::kCounterStripeNum> m_stripes_;
+};
+
+class Gauge {
+ public:
+  void Set(int64_t value) { m_value_.store(value, std::memory_order_relaxed); }
+  void Inc(int64_t n = 1) { m_value_.fetch_add(n, std::memory_order_relaxed); }
+  void Dec(int64_t n = 1) { m_value_.fetch_sub(n, std::memory_order_relaxed); }
+
+  int64_t Value() const { return m_value_.load(std::memory_order_relaxed); }
+
+ private:
+  std::atomic_int64_t m_value_{0};
+};
+
+// Upper bounds in seconds, from 100us to 10s.
+inline const std::vector<double> kLatencyBuckets{
+    0.0001, 0.0005, 0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1, 5, 10};
+
+class Histogram {
+ public:
+  // `bounds` are the sorted upper bounds of the buckets. The +Inf bucket is
+  // implied.
+  explicit Histogram(std::vector<double> bounds);
+
+  void Observe(double value);
+
+  template <typename Rep, typename Period>
+  void ObserveDuration(std::chrono::duration<Rep, Period> duration) {
+    Observe(std::chrono::duration<double>(duration).count());
+  }
+
+  struct Snapshot {
+    // Not cumulative. The last one is the +Inf bucket.
+    std::vector<uint64_t> bucket_counts;
+    uint64_t count{0};
+    double sum{0};
+  };
+
+  Snapshot Collect() const;
+
+  const std::vector<double>& Bounds() const { return m_bounds_; }
+
+ private:
+  std::vector<double> m_bounds_;
+  std::unique_ptr<std::atomic_uint64_t[]> m_bucket_counts_;
+  std::atomic<double> m_sum_{0};
+};
+
+// Observes the time the enclosing scope takes.
+class ScopedTimer {
+ public:
+  explicit ScopedTimer(Histogram* histogram)
+      : m_histogram_(histogram), m_begin_(std::chrono::steady_clock::now()) {}
+  ~ScopedTimer() {
+    m_histogram_->ObserveDuration(std::chrono::steady_clock::now() - m_begin_);
+  }
+
+  ScopedTimer(const ScopedTimer&) = delete;
+  ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+ private:
+  Histogram* m_histogram_;
+  std::chrono::steady_clock::time_point m_begin_;
+};
+
+class Registry {
+ public:
+  using CallbackId = uint64_t;
+
+  Registry() = default;
+  Registry(const Registry&) = delete;
+  Registry& operator=(const Registry&) = delete;
+
+  // Return the metric of the name and labels, which is created on the first
+  // call and lives as long as the registry. The help text of the first call
+  // is kept.
+  Counter* GetCounter(const std::string& name, const std::string& help,
+                      const Labels& labels = {});
+  Gauge* GetGauge(const std::string& name, const std::string& help,
+                  const Labels& labels = {});
+  Histogram* GetHistogram(const std::string& name, const std::string& help,
+                          const Labels& labels = {},
+                          const std::vector<double>& bounds = kLatencyBuckets);
+
+  /**
+   * Add a metric whose value is read by calling `cb` at every scrape, e.g.
+   * the size of a queue or a counter kept elsewhere. `cb` is not called any
+   * more once RemoveCallback() returns, so an object can remove its
+   * callbacks in its destructor. `cb` must not call back into the registry.
+   */
+  CallbackId AddCounterCallback(const std::string& name,
+                                const std::string& help, const Labels& labels,
+                                std::function<double()> cb);
+  CallbackId AddGaugeCallback(const std::string& name, const std::string& help,
+                              const Labels& labels, std::function<double()> cb);
+  void RemoveCallback(CallbackId id);
+
+  // All the metrics in the Prometheus text exposition format 0.0.4.
+  std::string Serialize() const;
+
+ private:
+  enum class Type : uint8_t { kCounter, kGauge, kHistogram };
+
+  using Metric = std::variant<std::unique_ptr<Counter>, std::unique_ptr<Gauge>,
+                              std::unique_ptr<Histogram>, CallbackId>;
+
+  struct Family {
+    Type type;
+    std::string help;
+    // Rendered labels, e.g. queue="submit", -> metric.
+    std::map<std::string, Metric> metrics;
+  };
+
+  struct Callback {
+    std::function<double()> cb;
+    std::string name;
+    std::string labels;
+  };
+
+  // Returns nullptr if the name is taken by a family of another type.
+  Family* GetFamily_(const std::string& name, const std::string& help,
+                     Type type) ABSL_EXCLUSIVE_LOCKS_REQUIRED(m_mtx_);
+
+  CallbackId AddCallback_(const std::string& name, const std::string& help,
+                          const Labels& labels, Type type,
+                          std::function<double()> cb);
+
+  // Held while the callbacks are called, which is never under m_mtx_.
+  mutable absl::Mutex m_cb_mtx_ ABSL_ACQUIRED_BEFORE(m_mtx_);
+  absl::flat_hash_map<CallbackId, Callback> m_callbacks_
+      ABSL_GUARDED_BY(m_cb_mtx_);
+  CallbackId m_next_callback_id_ ABSL_GUARDED_BY(m_cb_mtx_){1};
+
+  mutable absl::Mutex m_mtx_;
+  std::map<std::string, Family> m_families_ ABSL_GUARDED_BY(m_mtx_);
+  // Metrics whose name was taken by another type. They are updated as usual
+  // but never exported.
+  std::vector<Metric> m_orphans_ ABSL_GUARDED_BY(m_mtx_);
+};
+
+Registry& DefaultRegistry();
+
+// Export the counters of the logger (see GetLoggerStats()).
+void AddLoggerMetrics(Registry* registry);
+
+/**
+ * Serves GET /metrics over HTTP/1.1 with the metrics of a registry. A scrape
+ * is answered in the accept thread and the connection is closed afterwards,
+ * which is all Prometheus needs.
+ */
+class MetricsServer {
+ public:
+  explicit MetricsServer(Registry* registry = &DefaultRegistry());
+  ~MetricsServer();
+
+  MetricsServer(const MetricsServer&) = delete;
+  MetricsServer& operator=(const MetricsServer&) = delete;
+
+  // Returns false if the address cannot be listened on.
+  bool Start(const std::string& address, const std::string& port);
+  void Shutdown();
+
+ private:
+  // The time a scraper may take to send the request or read the reply.
+  static constexpr int kConnTimeoutMs = 5000;
+  static constexpr size_t kMaxRequestSize = 8192;
+
+  void AcceptThread_();
+  void HandleConn_(int fd);
+
+  Registry* m_registry_;
+  int m_listen_fd_{-1};
+  std::thread m_accept_thread_;
+};
+
+}  // namespace util::metrics
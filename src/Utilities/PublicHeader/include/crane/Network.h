@@ -54,6 +54,22 @@ struct NetworkInterface {
 
 void InitializeNetworkFunctions();
 
+/// The Resolve* functions below first look in /etc/hosts, then in a cache of
+/// the system resolver shared by all the threads.
+struct ResolveCacheStats {
+  uint64_t hits;
+  // Expired entries returned while they are refreshed in the background.
+  uint64_t stale_hits;
+  uint64_t negative_hits;
+  uint64_t misses;
+};
+
+ResolveCacheStats GetResolveCacheStats();
+
+/// Resolve the hostnames in the background, e.g. the nodes in the config,
+/// so that the later lookups of them and of their addresses hit the cache.
+void SeedResolveCache(std::vector<std::string> hostnames);
+
 bool ResolveHostnameFromIpv4(ipv4_t addr, std::string* hostname);
 
 bool ResolveHostnameFromIpv6(const ipv6_t& addr, std::string* hostname);
@@ -75,7 +91,20 @@ std::string Ipv6ToStr(const ipv6_t& addr);
 /// for IPv4 or 6 is returned for IPv6.
 int GetIpAddrVer(const std::string& ip);
 
-bool FindTcpInodeByPort(const std::string& tcp_path, int port, ino_t* inode);
+/// Look up the local port of a TCP socket in the text of /proc/net/tcp or
+/// /proc/net/tcp6. uid gets the owner of the socket if not null.
+bool FindTcpInodeByPort(const std::string& tcp_path, int port, ino_t* inode,
+                        uid_t* uid = nullptr);
+
+struct TcpSocketInfo {
+  ino_t inode;
+  uid_t uid;
+};
+
+/// Find the IPv4 or IPv6 TCP socket with local port port. The sockets are
+/// filtered by the kernel through a NETLINK_SOCK_DIAG dump and
+/// /proc/net/tcp{,6} are only parsed if netlink is not available.
+bool FindTcpSocketByPort(int port, TcpSocketInfo* info);
 
 std::vector<NetworkInterface> GetNetworkInterfaces();
 
@@ -59,6 +59,9 @@ bool CreateFoldersForFileEx(const std::string& p, uid_t owner, gid_t group,
 
 bool SetFdNonBlocking(int fd);
 
+// Write all the len bytes to fd, retrying short writes and EINTR.
+bool WriteAll(int fd, const char* data, size_t len);
+
 // Close file descriptors within [fd_begin, fd_end)
 void CloseFdRange(int fd_begin, int fd_end);
 
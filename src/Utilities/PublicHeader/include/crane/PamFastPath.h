@@ -0,0 +1,88 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <google/protobuf/io/zero_copy_stream_impl.h>
+#include <google/protobuf/message_lite.h>
+#include <google/protobuf/util/delimited_message_util.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <string>
+
+namespace crane::pam_fast_path {
+
+/**
+ * pam_crane asks craned with one varint-delimited AuthorizeSshProcRequest
+ * on a unix socket and reads one AuthorizeSshProcReply back, which spares
+ * the channel setup and HTTP/2 handshake of gRPC on every ssh login. The
+ * socket lives next to the CranedForPam one with this suffix.
+ */
+inline constexpr const char* kSockSuffix = ".fast";
+
+// The time each side waits for the other to send or receive.
+inline constexpr int kTimeoutMs = 5000;
+
+inline std::string SockPath(const std::string& craned_for_pam_sock_path) {
+  return craned_for_pam_sock_path + kSockSuffix;
+}
+
+// Both directions of fd time out after timeout_ms.
+inline bool SetTimeout(int fd, int timeout_ms) {
+  timeval tv{.tv_sec = timeout_ms / 1000,
+             .tv_usec = (timeout_ms % 1000) * 1000};
+  return setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == 0 &&
+         setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) == 0;
+}
+
+// Returns the connected fd or -1.
+inline int Connect(const std::string& sock_path, int timeout_ms) {
+  sockaddr_un addr{};
+  if (sock_path.size() >= sizeof(addr.sun_path)) return -1;
+  addr.sun_family = AF_UNIX;
+  std::memcpy(addr.sun_path, sock_path.c_str(), sock_path.size() + 1);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) return -1;
+  if (!SetTimeout(fd, timeout_ms) ||
+      connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+inline bool WriteMessage(int fd, const google::protobuf::MessageLite& msg) {
+  google::protobuf::io::FileOutputStream ostream(fd);
+  return google::protobuf::util::SerializeDelimitedToZeroCopyStream(
+             msg, &ostream) &&
+         ostream.Flush();
+}
+
+inline bool ReadMessage(int fd, google::protobuf::MessageLite* msg) {
+  google::protobuf::io::FileInputStream istream(fd);
+  return google::protobuf::util::ParseDelimitedFromZeroCopyStream(msg,
+                                                                  &istream,
+                                                                  nullptr);
+}
+
+}  // namespace crane::pam_fast_path
@@ -67,6 +67,8 @@ class PasswordEntry {
   gid_t Gid() const { return m_pw_gid_; }
   uid_t Uid() const { return m_pw_uid_; }
 
+  bool operator==(const PasswordEntry&) const = default;
+
  private:
   bool m_valid_{false};
   uid_t m_uid_{};
@@ -0,0 +1,112 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <google/protobuf/arena.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <optional>
+
+namespace util {
+
+// Create a message on the arena, or on the heap if there is none. Before
+// protobuf 26 Arena::Create() leaves the fields of a message on the heap.
+template <typename T>
+T* ArenaCreate(google::protobuf::Arena* arena) {
+#if defined(GOOGLE_PROTOBUF_VERSION) && GOOGLE_PROTOBUF_VERSION < 5026000
+  return google::protobuf::Arena::CreateMessage<T>(arena);
+#else
+  return google::protobuf::Arena::Create<T>(arena);
+#endif
+}
+
+/**
+ * A protobuf arena for message trees built again and again, such as the
+ * requests of every scheduling cycle. The first block of the arena is owned
+ * here and sized from what the previous use took, so that a tree of about
+ * the same size is built without going to the heap at all.
+ * Not thread-safe, like the messages it holds.
+ */
+class ReusableArena {
+ public:
+  static constexpr size_t kMinBlockSize = size_t{64} << 10;
+  static constexpr size_t kMaxBlockSize = size_t{256} << 20;
+
+  explicit ReusableArena(size_t block_size = kMinBlockSize) {
+    ResizeBlock_(block_size);
+    InitArena_();
+  }
+
+  ReusableArena(const ReusableArena&) = delete;
+  ReusableArena& operator=(const ReusableArena&) = delete;
+
+  // The arena must go before the block it allocates from.
+  ~ReusableArena() { m_arena_.reset(); }
+
+  google::protobuf::Arena* get() { return &*m_arena_; }
+
+  template <typename T>
+  T* Create() {
+    return ArenaCreate<T>(get());
+  }
+
+  // Bytes taken by the messages since the last Reset().
+  size_t SpaceUsed() const { return m_arena_->SpaceUsed(); }
+  size_t BlockSize() const { return m_block_size_; }
+
+  // Destroy all the messages and size the block for the next use: grow it
+  // to hold what was used with some headroom, and shrink it only when much
+  // less was used, so that one small cycle doesn't throw a large block away.
+  void Reset() {
+    size_t want = SpaceUsed() / 4 * 5;
+    m_arena_.reset();
+    if (want > m_block_size_ || want < m_block_size_ / 4) ResizeBlock_(want);
+    InitArena_();
+  }
+
+ private:
+  static constexpr size_t kPageSize = 4096;
+
+  void ResizeBlock_(size_t want) {
+    want = std::clamp(want, kMinBlockSize, kMaxBlockSize);
+    want = (want + kPageSize - 1) / kPageSize * kPageSize;
+    if (want == m_block_size_) return;
+    m_block_ = std::make_unique_for_overwrite<char[]>(want);
+    m_block_size_ = want;
+  }
+
+  void InitArena_() {
+    google::protobuf::ArenaOptions options;
+    options.initial_block = m_block_.get();
+    options.initial_block_size = m_block_size_;
+    // Later blocks are only needed if this use is larger than the previous
+    // one, so start them large.
+    options.start_block_size = m_block_size_;
+    options.max_block_size = std::max(options.max_block_size, m_block_size_);
+    m_arena_.emplace(options);
+  }
+
+  std::unique_ptr<char[]> m_block_;
+  size_t m_block_size_{0};
+  std::optional<google::protobuf::Arena> m_arena_;
+};
+
+}  // namespace util
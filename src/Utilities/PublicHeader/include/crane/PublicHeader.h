@@ -18,14 +18,20 @@
 
 #pragma once
 
+#include <absl/container/flat_hash_map.h>
+#include <absl/container/inlined_vector.h>
 #include <google/protobuf/util/time_util.h>
 
 #include <array>
 #include <expected>
 #include <format>
 #include <fpm/fixed.hpp>
+#include <initializer_list>
+#include <iterator>
 #include <unordered_map>
+#include <vector>
 
+#include "crane/SmallFlatMap.h"
 #include "protos/Crane.pb.h"
 
 #if !defined(CRANE_VERSION_STRING)
@@ -48,6 +54,7 @@ using CraneExpectedRich = std::expected<T, CraneRichError>;
 
 constexpr const char* kLogPattern =
     "[%^%L%$ %C-%m-%d %H:%M:%S.%e %s:%#][%n] %v";
+constexpr size_t kDefaultLogQueueSize = 8192;
 
 inline const char* const kDefaultHost = "0.0.0.0";
 
@@ -55,6 +62,8 @@ inline const char* kCtldDefaultPort = "10011";
 inline const char* kCranedDefaultPort = "10010";
 inline const char* kCforedDefaultPort = "10012";
 inline const char* kCtldForInternalDefaultPort = "10013";
+inline const char* kCtldMetricsDefaultPort = "10014";
+inline const char* kCranedMetricsDefaultPort = "10015";
 
 inline const char* const kDefaultConfigPath = "/etc/crane/config.yaml";
 inline const char* const kDefaultDbConfigPath = "/etc/crane/database.yaml";
@@ -82,11 +91,20 @@ inline const char* const kDefaultCranedMutexFile = "craned/craned.lock";
 inline const char* const kDefaultCranedLogPath = "craned/craned.log";
 
 inline const char* const kDefaultContainerTempDir = "craned/container";
+inline const char* const kDefaultContainerBundleCacheDir =
+    "craned/bundle-cache";
+
+inline const char* const kDefaultOutputSpoolDir = "craned/output-spool";
+constexpr uint64_t kDefaultOutputSpoolFlushThresholdMB = 64;
+
+// Read by both ctld and craned. 0 disables the cache.
+constexpr uint64_t kDefaultStepPayloadCacheMB = 0;
 
 inline const char* const kDefaultSupervisorPath = "/usr/libexec/csupervisor";
 inline const char* const kDefaultSupervisorUnixSockDir = "/tmp/crane";
 
 inline const char* const kDefaultPlugindUnixSockPath = "cplugind/cplugind.sock";
+constexpr uint32_t kDefaultPluginMaxQueuedEvents = 100000;
 
 constexpr uint64_t kTaskMinTimeLimitSec = 11;
 constexpr int64_t kTaskMaxTimeLimitSec =
@@ -230,6 +248,13 @@ constexpr std::array<std::string_view, crane::grpc::ErrCode_ARRAYSIZE>
         // 70 - 74
         "Supervisor error",
         "Service shutting down",
+        "Failed to sign the certificate",
+        "The certificate already exists",
+        "Failed to revoke the certificate",
+
+        // 75 - 79
+        "The identity does not match",
+        "The CPUs reached the account's limit of the QoS (MaxCpusPerAccount)",
     };
 // clang-format on
 }  // namespace Internal
@@ -280,6 +305,8 @@ struct AllocatableResource {
   AllocatableResource& operator*=(uint32_t rhs);
 
   explicit operator crane::grpc::AllocatableResource() const;
+  // Fill a message in place, which may live on an arena.
+  void ToGrpc(crane::grpc::AllocatableResource* val) const;
 
   double CpuCount() const;
 
@@ -292,8 +319,124 @@ bool operator<=(const AllocatableResource& lhs, const AllocatableResource& rhs);
 bool operator<(const AllocatableResource& lhs, const AllocatableResource& rhs);
 bool operator==(const AllocatableResource& lhs, const AllocatableResource& rhs);
 
+// A set of device slots as a bitmap. Each slot id gets an index fixed for
+// the lifetime of the process the first time it is seen, so the set
+// operations are word operations and need no allocation for the first 64
+// slots. Slot ids are only converted at the RPC boundary and when iterated.
+// Iteration is in the order of the indexes.
+class SlotSet {
+ public:
+  class const_iterator {
+   public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = SlotId;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const SlotId*;
+    using reference = const SlotId&;
+
+    const_iterator() = default;
+
+    reference operator*() const;
+    pointer operator->() const { return &**this; }
+
+    const_iterator& operator++() {
+      m_index_ = m_set_->NextIndex_(m_index_ + 1);
+      return *this;
+    }
+    const_iterator operator++(int) {
+      const_iterator prev = *this;
+      ++*this;
+      return prev;
+    }
+
+    uint32_t Index() const { return m_index_; }
+
+    friend bool operator==(const const_iterator& lhs,
+                           const const_iterator& rhs) {
+      return lhs.m_index_ == rhs.m_index_;
+    }
+
+   private:
+    friend class SlotSet;
+
+    const_iterator(const SlotSet* set, uint32_t index)
+        : m_set_(set), m_index_(index) {}
+
+    const SlotSet* m_set_{nullptr};
+    uint32_t m_index_{kEndIndex};
+  };
+
+  using iterator = const_iterator;
+  using value_type = SlotId;
+
+  SlotSet() = default;
+  SlotSet(std::initializer_list<SlotId> slots) { insert(slots); }
+  template <typename InputIt>
+  SlotSet(InputIt first, InputIt last) {
+    insert(first, last);
+  }
+
+  void insert(const SlotId& slot);
+  void insert(std::initializer_list<SlotId> slots) {
+    for (const SlotId& slot : slots) insert(slot);
+  }
+  template <typename InputIt>
+  void insert(InputIt first, InputIt last) {
+    for (; first != last; ++first) insert(*first);
+  }
+  template <typename... Args>
+  void emplace(Args&&... args) {
+    insert(SlotId(std::forward<Args>(args)...));
+  }
+
+  void erase(const SlotId& slot);
+  bool contains(const SlotId& slot) const;
+
+  size_t size() const;
+  bool empty() const;
+  void clear();
+
+  const_iterator begin() const { return {this, NextIndex_(0)}; }
+  const_iterator end() const { return {this, kEndIndex}; }
+
+  // The first n slots in the iteration order, or all of them if fewer.
+  SlotSet First(size_t n) const;
+
+  // Whether every slot of rhs is in this set.
+  bool Includes(const SlotSet& rhs) const;
+
+  SlotSet& operator|=(const SlotSet& rhs);
+  SlotSet& operator&=(const SlotSet& rhs);
+  SlotSet& operator-=(const SlotSet& rhs);
+
+  friend bool operator==(const SlotSet& lhs, const SlotSet& rhs);
+
+ private:
+  static constexpr uint32_t kEndIndex = UINT32_MAX;
+
+  // The first index >= from in the set, or kEndIndex.
+  uint32_t NextIndex_(uint32_t from) const;
+
+  size_t WordNum_() const { return 1 + m_more_words_.size(); }
+  uint64_t Word_(size_t i) const {
+    if (i == 0) return m_word0_;
+    return i <= m_more_words_.size() ? m_more_words_[i - 1] : 0;
+  }
+  uint64_t& MutableWord_(size_t i);
+
+  // Indexes 0-63 are kept inline, which covers every slot of most clusters.
+  // Missing words are regarded as zero.
+  uint64_t m_word0_{0};
+  std::vector<uint64_t> m_more_words_;
+};
+
+// A node rarely has more than a couple of device names, or of types under
+// one name, so these maps are kept inline and the resource arithmetic on the
+// scheduling path doesn't allocate.
+inline constexpr size_t kInlineDeviceNum = 2;
+
 struct TypeSlotsMap {
-  std::unordered_map<std::string /*type*/, std::set<SlotId> /*index*/>
+  util::SmallFlatMap<std::string /*type*/, SlotSet /*index*/, kInlineDeviceNum>
       type_slots_map;
 
   TypeSlotsMap() = default;
@@ -308,12 +451,13 @@ struct TypeSlotsMap {
   TypeSlotsMap& operator=(const crane::grpc::DeviceTypeSlotsMap& rhs);
 
   explicit operator crane::grpc::DeviceTypeSlotsMap() const;
+  void ToGrpc(crane::grpc::DeviceTypeSlotsMap* val) const;
 
   bool IsZero() const;
   bool contains(const std::string& type) const;
 
-  std::set<SlotId>& operator[](const std::string& type);
-  const std::set<SlotId>& at(const std::string& type) const;
+  SlotSet& operator[](const std::string& type);
+  const SlotSet& at(const std::string& type) const;
 
   TypeSlotsMap& operator+=(const TypeSlotsMap& rhs);
   TypeSlotsMap& operator-=(const TypeSlotsMap& rhs);
@@ -355,11 +499,13 @@ struct DedicatedResourceInNode {
 
   explicit operator crane::grpc::DeviceMap() const;
   explicit operator crane::grpc::DedicatedResourceInNode() const;
+  void ToGrpc(crane::grpc::DedicatedResourceInNode* val) const;
 
  public:
   // config: gpu:a100 whit file /dev/nvidia[0-3]
   // parsed: name:gpu,slot:a100,index:/dev/nvidia0,....,/dev/nvidia3
-  std::unordered_map<std::string /*name*/, TypeSlotsMap> name_type_slots_map;
+  util::SmallFlatMap<std::string /*name*/, TypeSlotsMap, kInlineDeviceNum>
+      name_type_slots_map;
 };
 
 bool operator<=(const DedicatedResourceInNode& lhs,
@@ -367,13 +513,17 @@ bool operator<=(const DedicatedResourceInNode& lhs,
 bool operator==(const DedicatedResourceInNode& lhs,
                 const DedicatedResourceInNode& rhs);
 
+using TypeCountMap =
+    util::SmallFlatMap<std::string /*type*/, uint64_t /*type total*/,
+                       kInlineDeviceNum>;
 using DeviceMap =
-    std::unordered_map<std::string /*name*/,
-                       std::pair<uint64_t /*untyped req count*/,
-                                 std::unordered_map<std::string /*type*/,
-                                                    uint64_t /*type total*/>>>;
+    util::SmallFlatMap<std::string /*name*/,
+                       std::pair<uint64_t /*untyped req count*/, TypeCountMap>,
+                       kInlineDeviceNum>;
 
 crane::grpc::DeviceMap ToGrpcDeviceMap(const DeviceMap& device_map);
+void ToGrpcDeviceMap(const DeviceMap& device_map,
+                     crane::grpc::DeviceMap* grpc_device_map);
 DeviceMap FromGrpcDeviceMap(const crane::grpc::DeviceMap& grpc_device_map);
 
 void operator+=(DeviceMap& lhs, const DedicatedResourceInNode& rhs);
@@ -394,6 +544,7 @@ struct ResourceInNode {
   explicit ResourceInNode(const crane::grpc::ResourceInNode& rhs);
 
   explicit operator crane::grpc::ResourceInNode() const;
+  void ToGrpc(crane::grpc::ResourceInNode* val) const;
 
   ResourceInNode& operator+=(const ResourceInNode& rhs);
   ResourceInNode& operator-=(const ResourceInNode& rhs);
@@ -405,6 +556,61 @@ struct ResourceInNode {
 bool operator<=(const ResourceInNode& lhs, const ResourceInNode& rhs);
 bool operator==(const ResourceInNode& lhs, const ResourceInNode& rhs);
 
+// Fixed-width encoding of a ResourceInNode on one node. Each device slot of
+// the node is mapped to a bit by ResourceInNodeLayout, so that the comparison
+// and the arithmetic need no lookup of device names, types or slots.
+// Only resources encoded by the same layout can be operated together.
+struct DenseResourceInNode {
+  cpu_t cpu_count{0};
+  uint64_t memory_bytes{0};
+  uint64_t memory_sw_bytes{0};
+
+  // Bit i is set if the i-th slot of the layout is included.
+  // Missing words are regarded as zero. Nodes rarely have more than 128
+  // slots, so the words are kept inline and copying one does not allocate.
+  absl::InlinedVector<uint64_t, 2> slot_bits;
+
+  // Set if the encoded resource has slots which are not on the node.
+  bool has_unknown_slots{false};
+
+  DenseResourceInNode& operator+=(const DenseResourceInNode& rhs);
+  DenseResourceInNode& operator-=(const DenseResourceInNode& rhs);
+
+  bool IsZero() const;
+  void SetToZero();
+};
+
+bool operator<=(const DenseResourceInNode& lhs,
+                const DenseResourceInNode& rhs);
+bool operator==(const DenseResourceInNode& lhs,
+                const DenseResourceInNode& rhs);
+
+class ResourceInNodeLayout {
+ public:
+  ResourceInNodeLayout() = default;
+
+  // All the slots in `res_total` get a bit. Slots of the same type are
+  // adjacent.
+  explicit ResourceInNodeLayout(const ResourceInNode& res_total);
+
+  DenseResourceInNode Encode(const ResourceInNode& res) const;
+
+  uint32_t SlotNum() const { return m_slot_num_; }
+  uint32_t WordNum() const { return (m_slot_num_ + 63) / 64; }
+
+ private:
+  struct TypeSlots {
+    uint32_t first_bit;
+    // Indexes of the slots in SlotSet, which are sorted.
+    std::vector<uint32_t> slot_indexes;
+  };
+
+  std::unordered_map<std::string /*name*/,
+                     std::unordered_map<std::string /*type*/, TypeSlots>>
+      m_slot_bits_;
+  uint32_t m_slot_num_{0};
+};
+
 class ResourceView;
 
 class ResourceV2 {
@@ -430,17 +636,14 @@ class ResourceV2 {
   bool IsZero() const;
   void SetToZero();
 
-  std::unordered_map<std::string, ResourceInNode>& EachNodeResMap() {
-    return each_node_res_map;
-  }
-  const std::unordered_map<std::string, ResourceInNode>& EachNodeResMap()
-      const {
-    return each_node_res_map;
-  }
+  using NodeResMap =
+      absl::flat_hash_map<std::string /*craned id*/, ResourceInNode>;
+
+  NodeResMap& EachNodeResMap() { return each_node_res_map; }
+  const NodeResMap& EachNodeResMap() const { return each_node_res_map; }
 
  private:
-  std::unordered_map<std::string /*craned id*/, ResourceInNode>
-      each_node_res_map;
+  NodeResMap each_node_res_map;
 
  public:
   friend bool operator<=(const ResourceV2& lhs, const ResourceV2& rhs);
@@ -460,6 +663,7 @@ class ResourceView {
   explicit ResourceView(const crane::grpc::ResourceView& rhs);
   ResourceView& operator=(const crane::grpc::ResourceView& rhs);
   explicit operator crane::grpc::ResourceView() const;
+  void ToGrpc(crane::grpc::ResourceView* val) const;
 
   // Cluster level resource operations
   ResourceView& operator+=(const ResourceV2& rhs);
@@ -0,0 +1,101 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <absl/synchronization/mutex.h>
+
+#include <memory>
+#include <vector>
+
+namespace util {
+
+/**
+ * Fixed-size buffers carved out of slabs, which live as long as the pool.
+ * A buffer may be taken on one thread and put back on another, so a reader
+ * can hand what it read to a writer without copying or allocating it.
+ */
+template <size_t BufferSize, size_t BuffersPerSlab = 16>
+class SlabBufferPool {
+ public:
+  static constexpr size_t kBufferSize = BufferSize;
+
+  struct Buffer {
+    // First member, so that FromData() can recover the buffer from the
+    // pointer a C API was given.
+    char data[BufferSize];
+    size_t len{0};
+  };
+
+  class Recycler {
+   public:
+    explicit Recycler(SlabBufferPool* pool = nullptr) : m_pool_(pool) {}
+    void operator()(Buffer* buf) const {
+      if (m_pool_ != nullptr) m_pool_->Release(buf);
+    }
+
+   private:
+    SlabBufferPool* m_pool_;
+  };
+
+  using BufferPtr = std::unique_ptr<Buffer, Recycler>;
+
+  SlabBufferPool() = default;
+
+  SlabBufferPool(const SlabBufferPool&) = delete;
+  SlabBufferPool& operator=(const SlabBufferPool&) = delete;
+
+  BufferPtr Get() { return BufferPtr(Acquire(), Recycler(this)); }
+
+  // Wrap a buffer taken by Acquire().
+  BufferPtr Adopt(Buffer* buf) { return BufferPtr(buf, Recycler(this)); }
+
+  Buffer* Acquire() {
+    absl::MutexLock lock(&m_mtx_);
+    if (m_free_.empty()) {
+      auto& slab = m_slabs_.emplace_back(
+          std::make_unique_for_overwrite<Buffer[]>(BuffersPerSlab));
+      for (size_t i = 0; i < BuffersPerSlab; ++i) m_free_.push_back(&slab[i]);
+    }
+    Buffer* buf = m_free_.back();
+    m_free_.pop_back();
+    buf->len = 0;
+    return buf;
+  }
+
+  void Release(Buffer* buf) {
+    absl::MutexLock lock(&m_mtx_);
+    m_free_.push_back(buf);
+  }
+
+  static Buffer* FromData(char* data) {
+    return reinterpret_cast<Buffer*>(data);
+  }
+
+  size_t SlabNum() const {
+    absl::MutexLock lock(&m_mtx_);
+    return m_slabs_.size();
+  }
+
+ private:
+  mutable absl::Mutex m_mtx_;
+  std::vector<std::unique_ptr<Buffer[]>> m_slabs_ ABSL_GUARDED_BY(m_mtx_);
+  std::vector<Buffer*> m_free_ ABSL_GUARDED_BY(m_mtx_);
+};
+
+}  // namespace util
@@ -0,0 +1,169 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <absl/container/inlined_vector.h>
+
+#include <algorithm>
+#include <initializer_list>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+namespace util {
+
+/**
+ * A map kept as an unsorted array of key-value pairs, the first N of which
+ * are stored inline. It is meant for the handful of device names and types
+ * in a node, where a linear scan beats hashing and a map of up to N entries
+ * never touches the heap. Erasing moves the last pair into the hole, so
+ * erase(it) returns `it` itself and loops over erase keep working; any
+ * insertion may invalidate iterators and references to other entries.
+ */
+template <typename Key, typename T, size_t N>
+class SmallFlatMap {
+  using Storage = absl::InlinedVector<std::pair<Key, T>, N>;
+
+ public:
+  using key_type = Key;
+  using mapped_type = T;
+  using value_type = std::pair<Key, T>;
+  using size_type = size_t;
+  using iterator = typename Storage::iterator;
+  using const_iterator = typename Storage::const_iterator;
+
+  SmallFlatMap() = default;
+  SmallFlatMap(std::initializer_list<value_type> init) {
+    for (const auto& item : init) emplace(item);
+  }
+
+  iterator begin() { return m_items_.begin(); }
+  iterator end() { return m_items_.end(); }
+  const_iterator begin() const { return m_items_.begin(); }
+  const_iterator end() const { return m_items_.end(); }
+  const_iterator cbegin() const { return m_items_.cbegin(); }
+  const_iterator cend() const { return m_items_.cend(); }
+
+  size_t size() const { return m_items_.size(); }
+  bool empty() const { return m_items_.empty(); }
+  void clear() { m_items_.clear(); }
+  void reserve(size_t n) { m_items_.reserve(n); }
+
+  template <typename K>
+  iterator find(const K& key) {
+    return std::ranges::find_if(
+        m_items_, [&key](const value_type& item) { return item.first == key; });
+  }
+  template <typename K>
+  const_iterator find(const K& key) const {
+    return std::ranges::find_if(
+        m_items_, [&key](const value_type& item) { return item.first == key; });
+  }
+
+  template <typename K>
+  bool contains(const K& key) const {
+    return find(key) != end();
+  }
+  template <typename K>
+  size_t count(const K& key) const {
+    return contains(key) ? 1 : 0;
+  }
+
+  template <typename K>
+  T& at(const K& key) {
+    auto it = find(key);
+    if (it == end()) throw std::out_of_range("SmallFlatMap::at");
+    return it->second;
+  }
+  template <typename K>
+  const T& at(const K& key) const {
+    auto it = find(key);
+    if (it == end()) throw std::out_of_range("SmallFlatMap::at");
+    return it->second;
+  }
+
+  T& operator[](const Key& key) { return try_emplace(key).first->second; }
+  T& operator[](Key&& key) {
+    return try_emplace(std::move(key)).first->second;
+  }
+
+  template <typename... Args>
+  std::pair<iterator, bool> try_emplace(const Key& key, Args&&... args) {
+    auto it = find(key);
+    if (it != end()) return {it, false};
+    m_items_.emplace_back(std::piecewise_construct, std::forward_as_tuple(key),
+                          std::forward_as_tuple(std::forward<Args>(args)...));
+    return {std::prev(end()), true};
+  }
+  template <typename... Args>
+  std::pair<iterator, bool> try_emplace(Key&& key, Args&&... args) {
+    auto it = find(key);
+    if (it != end()) return {it, false};
+    m_items_.emplace_back(std::piecewise_construct,
+                          std::forward_as_tuple(std::move(key)),
+                          std::forward_as_tuple(std::forward<Args>(args)...));
+    return {std::prev(end()), true};
+  }
+
+  template <typename... Args>
+  std::pair<iterator, bool> emplace(Args&&... args) {
+    value_type item(std::forward<Args>(args)...);
+    auto it = find(item.first);
+    if (it != end()) return {it, false};
+    m_items_.push_back(std::move(item));
+    return {std::prev(end()), true};
+  }
+
+  std::pair<iterator, bool> insert(const value_type& item) {
+    return emplace(item);
+  }
+  std::pair<iterator, bool> insert(value_type&& item) {
+    return emplace(std::move(item));
+  }
+
+  // Returns the iterator to the element taking the erased one's place.
+  iterator erase(const_iterator pos) {
+    auto it = m_items_.begin() + (pos - m_items_.cbegin());
+    if (it != std::prev(end())) *it = std::move(m_items_.back());
+    m_items_.pop_back();
+    return it;
+  }
+  template <typename K>
+    requires(!std::is_convertible_v<const K&, const_iterator>)
+  size_t erase(const K& key) {
+    auto it = find(key);
+    if (it == end()) return 0;
+    erase(it);
+    return 1;
+  }
+
+  // The order of the entries does not matter.
+  friend bool operator==(const SmallFlatMap& lhs, const SmallFlatMap& rhs) {
+    if (lhs.size() != rhs.size()) return false;
+    return std::ranges::all_of(lhs, [&rhs](const value_type& item) {
+      auto it = rhs.find(item.first);
+      return it != rhs.end() && it->second == item.second;
+    });
+  }
+
+ private:
+  Storage m_items_;
+};
+
+}  // namespace util
@@ -35,6 +35,7 @@
 #include <ranges>
 #include <string>
 
+#include "crane/HostList.h"
 #include "crane/PublicHeader.h"
 
 namespace util {
@@ -69,6 +70,19 @@ template <std::ranges::range T>
 std::string HostNameListToStr(T const &host_list)
   requires std::same_as<std::ranges::range_value_t<T>, std::string>
 {
+  // Names with one index need no rounds of string rewriting, which is
+  // what every node list of a regular cluster looks like.
+  HostList compact;
+  bool single_index = true;
+  for (const auto &host : host_list) {
+    if (!HostList::IsSingleIndexName(host)) {
+      single_index = false;
+      break;
+    }
+    compact.Insert(host);
+  }
+  if (single_index) return compact.ToString();
+
   std::list<std::string> source_list{host_list.begin(), host_list.end()};
   while (true) {
     std::list<std::string> res_list;
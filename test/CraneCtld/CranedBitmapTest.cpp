@@ -0,0 +1,73 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include "CranedBitmap.h"
+
+using Ctld::CranedBitmap;
+
+namespace {
+
+std::vector<size_t> IndexesOf(const CranedBitmap& bitmap) {
+  std::vector<size_t> indexes;
+  bitmap.ForEach([&](size_t index) { indexes.emplace_back(index); });
+  return indexes;
+}
+
+}  // namespace
+
+TEST(CranedBitmapTest, SetResetAcrossWords) {
+  CranedBitmap bitmap(130);
+  EXPECT_EQ(bitmap.Size(), 130);
+  EXPECT_EQ(bitmap.Count(), 0);
+
+  for (size_t index : {0, 63, 64, 129}) bitmap.Set(index);
+  EXPECT_EQ(bitmap.Count(), 4);
+  EXPECT_TRUE(bitmap.Test(64));
+  EXPECT_FALSE(bitmap.Test(65));
+  EXPECT_EQ(IndexesOf(bitmap), (std::vector<size_t>{0, 63, 64, 129}));
+
+  bitmap.Reset(63);
+  bitmap.Assign(64, false);
+  bitmap.Assign(100, true);
+  EXPECT_EQ(IndexesOf(bitmap), (std::vector<size_t>{0, 100, 129}));
+}
+
+TEST(CranedBitmapTest, Combine) {
+  CranedBitmap lhs(200);
+  CranedBitmap rhs(200);
+  for (size_t i = 0; i < 200; i += 2) lhs.Set(i);
+  for (size_t i = 0; i < 200; i += 3) rhs.Set(i);
+
+  CranedBitmap both = lhs;
+  both &= rhs;
+  CranedBitmap either = lhs;
+  either |= rhs;
+  CranedBitmap only_lhs = lhs;
+  only_lhs.AndNot(rhs);
+
+  for (size_t i = 0; i < 200; i++) {
+    EXPECT_EQ(both.Test(i), i % 2 == 0 && i % 3 == 0) << i;
+    EXPECT_EQ(either.Test(i), i % 2 == 0 || i % 3 == 0) << i;
+    EXPECT_EQ(only_lhs.Test(i), i % 2 == 0 && i % 3 != 0) << i;
+  }
+  EXPECT_EQ(both.Count(), 34);
+  EXPECT_EQ(either.Count(), 133);
+  EXPECT_EQ(only_lhs.Count(), 66);
+}
@@ -0,0 +1,193 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <random>
+
+#include "CranedConnectScheduler.h"
+
+using Ctld::CranedConnectScheduler;
+
+namespace {
+
+constexpr auto kNoSkip = [](const CranedId&) { return false; };
+
+// Drives the scheduler the way CranedKeeper does against simulated craneds,
+// on a simulated clock. A craned starts after a random delay. An attempt to
+// a started craned succeeds after the connect latency, an attempt to one not
+// started yet fails after the connecting timeout of the completion queue.
+struct ConnectSimulation {
+  static constexpr int64_t kTickMs = 300;
+  static constexpr int64_t kConnectLatencyMs = 200;
+  static constexpr int64_t kConnectTimeoutMs =
+      Ctld::kCompletionQueueConnectingTimeoutSeconds * 1000;
+
+  struct Result {
+    int64_t all_connected_ms{-1};
+    uint32_t max_connecting_num{0};
+    uint64_t attempt_num{0};
+  };
+
+  static Result Run(uint32_t craned_num, int64_t max_start_delay_ms,
+                    CranedConnectScheduler* scheduler, int64_t deadline_ms) {
+    std::mt19937_64 rng(1);
+    std::uniform_int_distribution<int64_t> delay(0, max_start_delay_ms);
+
+    std::unordered_map<CranedId, int64_t> start_ms;
+    for (uint32_t i = 0; i < craned_num; i++) {
+      CranedId craned_id = fmt::format("cn{:05}", i);
+      start_ms.emplace(craned_id, delay(rng));
+      scheduler->Add(craned_id);
+    }
+
+    // Attempts in flight, ordered by the time they finish.
+    std::multimap<int64_t, std::pair<CranedId, bool>> in_flight;
+
+    Result result;
+    std::vector<CranedId> picked;
+    for (int64_t now = 0; now <= deadline_ms; now += kTickMs) {
+      while (!in_flight.empty() && in_flight.begin()->first <= now) {
+        auto node = in_flight.extract(in_flight.begin());
+        auto& [craned_id, ok] = node.mapped();
+        if (ok)
+          scheduler->Remove(craned_id);
+        else
+          scheduler->OnConnectFailed(craned_id, node.key());
+      }
+      if (scheduler->Size() == 0) {
+        result.all_connected_ms = now;
+        break;
+      }
+
+      picked.clear();
+      scheduler->Pick(now, kNoSkip, &picked);
+      result.attempt_num += picked.size();
+      result.max_connecting_num =
+          std::max(result.max_connecting_num, scheduler->ConnectingNum());
+
+      for (auto& craned_id : picked) {
+        bool ok = start_ms.at(craned_id) <= now;
+        int64_t finish_ms = now + (ok ? kConnectLatencyMs : kConnectTimeoutMs);
+        in_flight.emplace(finish_ms, std::make_pair(std::move(craned_id), ok));
+      }
+    }
+
+    return result;
+  }
+};
+
+}  // namespace
+
+TEST(CranedConnectScheduler, PickAtMostWindow) {
+  CranedConnectScheduler scheduler(2, 1000, 8000, 1);
+  for (auto id : {"a", "b", "c"}) scheduler.Add(id);
+
+  std::vector<CranedId> picked;
+  scheduler.Pick(0, kNoSkip, &picked);
+  EXPECT_EQ(picked.size(), 2);
+  EXPECT_EQ(scheduler.ConnectingNum(), 2);
+
+  picked.clear();
+  scheduler.Pick(0, kNoSkip, &picked);
+  EXPECT_TRUE(picked.empty());
+
+  scheduler.Remove("a");
+  scheduler.Remove("b");
+  scheduler.Pick(0, kNoSkip, &picked);
+  EXPECT_EQ(picked, std::vector<CranedId>{"c"});
+  EXPECT_EQ(scheduler.Size(), 1);
+}
+
+TEST(CranedConnectScheduler, SkipConnectedCraned) {
+  CranedConnectScheduler scheduler(8, 1000, 8000, 1);
+  scheduler.Add("a");
+  scheduler.Add("b");
+
+  std::vector<CranedId> picked;
+  scheduler.Pick(
+      0, [](const CranedId& id) { return id == "a"; }, &picked);
+  EXPECT_EQ(picked, std::vector<CranedId>{"b"});
+  EXPECT_FALSE(scheduler.IsConnecting("a"));
+  EXPECT_TRUE(scheduler.IsConnecting("b"));
+}
+
+TEST(CranedConnectScheduler, BackoffDoublesUpToMax) {
+  CranedConnectScheduler scheduler(8, 1000, 8000, 1);
+  EXPECT_EQ(scheduler.BackoffMsOf(0), 0);
+  EXPECT_EQ(scheduler.BackoffMsOf(1), 1000);
+  EXPECT_EQ(scheduler.BackoffMsOf(2), 2000);
+  EXPECT_EQ(scheduler.BackoffMsOf(4), 8000);
+  EXPECT_EQ(scheduler.BackoffMsOf(100), 8000);
+}
+
+TEST(CranedConnectScheduler, RetryAfterJitteredBackoff) {
+  constexpr uint32_t kCranedNum = 1000;
+  CranedConnectScheduler scheduler(kCranedNum, 1000, 60000, 1);
+  for (uint32_t i = 0; i < kCranedNum; i++)
+    scheduler.Add(fmt::format("cn{}", i));
+
+  std::vector<CranedId> picked;
+  scheduler.Pick(0, kNoSkip, &picked);
+  ASSERT_EQ(picked.size(), kCranedNum);
+  for (auto& id : picked) scheduler.OnConnectFailed(id, 0);
+
+  // No craned is retried before half of the backoff, and the retries of the
+  // craneds failing together spread over the other half.
+  std::vector<CranedId> retried;
+  scheduler.Pick(499, kNoSkip, &retried);
+  EXPECT_TRUE(retried.empty());
+
+  scheduler.Pick(750, kNoSkip, &retried);
+  EXPECT_GT(retried.size(), kCranedNum / 4);
+  EXPECT_LT(retried.size(), kCranedNum * 3 / 4);
+
+  scheduler.Pick(1000, kNoSkip, &retried);
+  EXPECT_EQ(retried.size(), kCranedNum);
+}
+
+TEST(CranedConnectScheduler, FailureOfUnknownCranedIsIgnored) {
+  CranedConnectScheduler scheduler(8, 1000, 8000, 1);
+  scheduler.OnConnectFailed("a", 0);
+  scheduler.Add("a");
+  scheduler.OnConnectFailed("a", 0);
+
+  std::vector<CranedId> picked;
+  scheduler.Pick(0, kNoSkip, &picked);
+  EXPECT_EQ(picked, std::vector<CranedId>{"a"});
+}
+
+// 10k craneds starting within a minute of each other, e.g. after a power
+// outage of the cluster, are all connected within two minutes while at most
+// `window` of them are connecting at a time.
+TEST(CranedConnectScheduler, TenThousandCranedsRegister) {
+  constexpr uint32_t kCranedNum = 10000;
+  constexpr uint32_t kWindow = 3000;
+  constexpr int64_t kMaxStartDelayMs = 60 * 1000;
+  constexpr int64_t kTargetMs = 120 * 1000;
+
+  CranedConnectScheduler scheduler(kWindow, 1000, 60000, 1);
+  auto result = ConnectSimulation::Run(kCranedNum, kMaxStartDelayMs,
+                                       &scheduler, kTargetMs);
+
+  EXPECT_GE(result.all_connected_ms, 0);
+  EXPECT_LE(result.max_connecting_num, kWindow);
+  // The backoff keeps the attempts to craneds not started yet from taking
+  // the window: a few attempts per craned, not one per tick.
+  EXPECT_LT(result.attempt_num, kCranedNum * 8);
+}
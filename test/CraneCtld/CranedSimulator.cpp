@@ -0,0 +1,1034 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Virtual craneds for load testing a real cranectld.
+//
+// Every node of the config (or of --nodes) is simulated in this process. A
+// virtual craned goes through the same handshake as craned
+// (CranedTriggerReverseConn, Configure, CranedRegister), pings ctld and
+// serves the Craned service. Steps are not run: each one ends after a
+// synthetic run time, and its status is sent by StepStatusChangeBatch.
+//
+// Ctld connects to a craned at the address of its name and a single
+// CranedListenPort, so every virtual craned needs an address of its own.
+// Map the names to loopback addresses in /etc/hosts, e.g. with the output of
+//   craned_simulator --print-hosts 127.1.0.0
+// All of them are served by one gRPC server, which tells the nodes apart
+// by the :authority of the requests. TLS is not supported.
+//
+// The run time of a step and whether it fails are derived from its task id,
+// so that all the nodes of a job agree on them.
+
+#include <absl/container/flat_hash_map.h>
+#include <absl/container/flat_hash_set.h>
+#include <absl/synchronization/mutex.h>
+#include <grpcpp/grpcpp.h>
+#include <yaml-cpp/yaml.h>
+
+#include <BS_thread_pool.hpp>
+#include <csignal>
+#include <cxxopts.hpp>
+#include <queue>
+#include <random>
+
+#include "crane/GrpcHelper.h"
+#include "crane/Logger.h"
+#include "crane/Network.h"
+#include "crane/PublicHeader.h"
+#include "crane/String.h"
+#include "protos/Crane.grpc.pb.h"
+#include "protos/Crane.pb.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+using crane::grpc::TaskStatus;
+
+struct SimOptions {
+  std::string ctld_host;
+  std::string ctld_port;
+  std::string craned_port;
+  uint32_t config_crc;
+
+  uint32_t ping_interval_sec;
+  uint32_t ctld_timeout_sec;
+  uint32_t register_delay_ms;
+
+  uint32_t rpc_delay_ms;
+  double rpc_fail_ratio;
+  double ping_drop_ratio;
+
+  uint64_t min_run_ms;
+  uint64_t max_run_ms;
+  double exec_fail_ratio;
+  double step_fail_ratio;
+};
+
+constexpr int64_t kCtldRpcTimeoutSec = 5;
+constexpr uint32_t kStatusChangeBatchMaxNum = 1000;
+constexpr uint32_t kStatusChangeRetryMs = 1000;
+
+// splitmix64, which spreads consecutive task ids over the whole range.
+uint64_t Mix(uint64_t x) {
+  x += 0x9e3779b97f4a7c15;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+  return x ^ (x >> 31);
+}
+
+// Maps key to [0, 1). Different salts make independent draws of a key.
+double UnitOf(uint64_t key, uint64_t salt) {
+  return static_cast<double>(Mix(key ^ Mix(salt)) >> 11) * 0x1.0p-53;
+}
+
+bool RandomChance(double ratio) {
+  if (ratio <= 0) return false;
+  thread_local std::mt19937_64 rng{std::random_device{}()};
+  return std::uniform_real_distribution<double>(0, 1)(rng) < ratio;
+}
+
+// Runs callbacks on a thread pool at the times they are due.
+class TimerQueue {
+ public:
+  explicit TimerQueue(BS::thread_pool* pool) : m_pool_(pool) {
+    m_thread_ = std::thread([this] { Run_(); });
+  }
+
+  ~TimerQueue() { Stop(); }
+
+  // Callbacks which are not due yet are dropped.
+  void Stop() {
+    {
+      absl::MutexLock lock(&m_mtx_);
+      m_stopping_ = true;
+    }
+    if (m_thread_.joinable()) m_thread_.join();
+  }
+
+  void After(std::chrono::milliseconds delay, std::function<void()> cb) {
+    absl::MutexLock lock(&m_mtx_);
+    m_queue_.emplace(Clock::now() + delay, m_seq_++, std::move(cb));
+  }
+
+ private:
+  struct Entry {
+    Clock::time_point due;
+    uint64_t seq;
+    std::function<void()> cb;
+
+    bool operator>(const Entry& rhs) const {
+      return std::tie(due, seq) > std::tie(rhs.due, rhs.seq);
+    }
+  };
+
+  void Run_() {
+    util::SetCurrentThreadName("SimTimerThr");
+    absl::MutexLock lock(&m_mtx_);
+    while (!m_stopping_) {
+      if (m_queue_.empty() || m_queue_.top().due > Clock::now()) {
+        absl::Duration wait = absl::Milliseconds(10);
+        if (!m_queue_.empty())
+          wait = std::min(wait, absl::FromChrono(m_queue_.top().due -
+                                                 Clock::now()));
+        m_mtx_.AwaitWithTimeout(absl::Condition(&m_stopping_), wait);
+        continue;
+      }
+      auto cb = std::move(const_cast<Entry&>(m_queue_.top()).cb);
+      m_queue_.pop();
+      m_pool_->detach_task(std::move(cb));
+    }
+  }
+
+  BS::thread_pool* m_pool_;
+
+  absl::Mutex m_mtx_;
+  std::priority_queue<Entry, std::vector<Entry>, std::greater<>> m_queue_
+      ABSL_GUARDED_BY(m_mtx_);
+  uint64_t m_seq_ ABSL_GUARDED_BY(m_mtx_){0};
+  bool m_stopping_ ABSL_GUARDED_BY(m_mtx_){false};
+
+  std::thread m_thread_;
+};
+
+struct SimStats {
+  std::atomic_uint64_t registered{0};
+  std::atomic_uint64_t reconnects{0};
+  std::atomic_uint64_t steps_started{0};
+  std::atomic_uint64_t steps_ended{0};
+  std::atomic_uint64_t steps_cancelled{0};
+  std::atomic_uint64_t exec_failures{0};
+  std::atomic_uint64_t injected_rpc_failures{0};
+  std::atomic_uint64_t ctld_rpc_errors{0};
+};
+
+struct VirtualCraned {
+  enum class State : uint8_t {
+    kRequestingConfig,
+    kConfiguring,
+    kReady,
+  };
+
+  struct Step {
+    Clock::time_point start;
+    uint64_t run_ms;
+    uint64_t limit_ms;
+    // Bumped when the end of the step is rescheduled, so that stale timers
+    // are ignored.
+    uint64_t generation{0};
+  };
+
+  CranedId id;
+  std::string ip;
+  std::unique_ptr<crane::grpc::CraneCtldForInternal::Stub> stub;
+
+  absl::Mutex mtx;
+  State state ABSL_GUARDED_BY(mtx){State::kRequestingConfig};
+  google::protobuf::Timestamp token ABSL_GUARDED_BY(mtx);
+  // Bumped at every new handshake. Timers of older ones do nothing.
+  uint64_t epoch ABSL_GUARDED_BY(mtx){0};
+
+  absl::flat_hash_set<job_id_t> jobs ABSL_GUARDED_BY(mtx);
+  absl::flat_hash_map<task_id_t, Step> steps ABSL_GUARDED_BY(mtx);
+
+  std::deque<crane::grpc::StepStatusChangeRequest> changes
+      ABSL_GUARDED_BY(mtx);
+  bool flushing ABSL_GUARDED_BY(mtx){false};
+};
+
+class Simulator {
+ public:
+  Simulator(SimOptions opts,
+            std::vector<std::pair<CranedId, std::string>> nodes_and_ips,
+            uint32_t thread_num);
+
+  bool Start();
+  void Shutdown();
+
+  void ReportStats() const;
+
+  VirtualCraned* FindByAuthority(grpc::string_ref authority) const;
+
+  const SimOptions& Options() const { return m_opts_; }
+  TimerQueue& Timers() { return *m_timers_; }
+  SimStats& Stats() { return m_stats_; }
+
+  // Handlers of the Craned service.
+  void OnConfigure(VirtualCraned* node,
+                   const crane::grpc::ConfigureCranedRequest& req);
+  void OnCreateCgroupForJobs(
+      VirtualCraned* node, const crane::grpc::CreateCgroupForJobsRequest& req);
+  void OnExecuteSteps(VirtualCraned* node,
+                      const crane::grpc::ExecuteStepsRequest& req,
+                      std::vector<task_id_t>* failed);
+  void OnLaunchTree(const crane::grpc::LaunchTreeNode& tree,
+                    crane::grpc::LaunchTreeReply* reply);
+  void OnTerminateSteps(VirtualCraned* node,
+                        const google::protobuf::RepeatedField<uint32_t>& ids,
+                        bool report);
+  void OnFreeJobs(VirtualCraned* node,
+                  const google::protobuf::RepeatedField<uint32_t>& job_ids);
+  bool OnChangeJobTimeLimit(VirtualCraned* node, task_id_t task_id,
+                            int64_t limit_sec);
+
+ private:
+  void RequestConfig_(VirtualCraned* node);
+  void Register_(VirtualCraned* node, uint64_t epoch,
+                 std::vector<job_id_t> lost_jobs,
+                 std::vector<task_id_t> lost_steps);
+  void Ping_(VirtualCraned* node, uint64_t epoch);
+
+  void ScheduleStepEnd_(VirtualCraned* node, task_id_t task_id,
+                        const VirtualCraned::Step& step)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(node->mtx);
+  void EndStep_(VirtualCraned* node, task_id_t task_id, uint64_t generation);
+
+  void QueueChange_(VirtualCraned* node, task_id_t task_id, TaskStatus status,
+                    uint32_t exit_code)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(node->mtx);
+  void FlushChanges_(VirtualCraned* node);
+
+  grpc::ClientContext* NewContext_(grpc::ClientContext* context,
+                                   int64_t timeout_sec) const;
+
+  SimOptions m_opts_;
+  SimStats m_stats_;
+
+  std::vector<std::unique_ptr<VirtualCraned>> m_nodes_;
+  absl::flat_hash_map<std::string, VirtualCraned*> m_ip_node_map_;
+  absl::flat_hash_map<CranedId, VirtualCraned*> m_id_node_map_;
+
+  std::unique_ptr<BS::thread_pool> m_pool_;
+  std::unique_ptr<TimerQueue> m_timers_;
+
+  std::unique_ptr<crane::grpc::Craned::CallbackService> m_service_;
+  std::unique_ptr<grpc::Server> m_server_;
+};
+
+// Answers after --rpc-delay-ms, or fails with UNAVAILABLE at
+// --rpc-fail-ratio. `handle` runs right before the answer, on a thread of
+// the simulator.
+grpc::ServerUnaryReactor* Reply(Simulator* sim,
+                                grpc::CallbackServerContext* context,
+                                std::function<grpc::Status()> handle) {
+  auto* reactor = context->DefaultReactor();
+
+  std::function<void()> finish;
+  if (RandomChance(sim->Options().rpc_fail_ratio)) {
+    sim->Stats().injected_rpc_failures.fetch_add(1);
+    finish = [reactor] {
+      reactor->Finish({grpc::StatusCode::UNAVAILABLE, "Injected failure"});
+    };
+  } else {
+    finish = [reactor, handle = std::move(handle)] {
+      reactor->Finish(handle());
+    };
+  }
+
+  if (sim->Options().rpc_delay_ms == 0)
+    finish();
+  else
+    sim->Timers().After(std::chrono::milliseconds(sim->Options().rpc_delay_ms),
+                        std::move(finish));
+  return reactor;
+}
+
+class SimCranedService final : public crane::grpc::Craned::CallbackService {
+ public:
+  explicit SimCranedService(Simulator* sim) : m_sim_(sim) {}
+
+  grpc::ServerUnaryReactor* Configure(
+      grpc::CallbackServerContext* context,
+      const crane::grpc::ConfigureCranedRequest* request,
+      google::protobuf::Empty* response) override {
+    return Handle_(context, [=, this](VirtualCraned* node) {
+      m_sim_->OnConfigure(node, *request);
+      return grpc::Status::OK;
+    });
+  }
+
+  grpc::ServerUnaryReactor* CreateCgroupForJobs(
+      grpc::CallbackServerContext* context,
+      const crane::grpc::CreateCgroupForJobsRequest* request,
+      crane::grpc::CreateCgroupForJobsReply* response) override {
+    return Handle_(context, [=, this](VirtualCraned* node) {
+      m_sim_->OnCreateCgroupForJobs(node, *request);
+      return grpc::Status::OK;
+    });
+  }
+
+  grpc::ServerUnaryReactor* ExecuteSteps(
+      grpc::CallbackServerContext* context,
+      const crane::grpc::ExecuteStepsRequest* request,
+      crane::grpc::ExecuteStepsReply* response) override {
+    return Handle_(context, [=, this](VirtualCraned* node) {
+      std::vector<task_id_t> failed;
+      m_sim_->OnExecuteSteps(node, *request, &failed);
+      response->mutable_failed_task_id_list()->Assign(failed.begin(),
+                                                      failed.end());
+      return grpc::Status::OK;
+    });
+  }
+
+  // All craneds of a tree are in this process, so the whole tree is
+  // handled here instead of being forwarded.
+  grpc::ServerUnaryReactor* LaunchTree(
+      grpc::CallbackServerContext* context,
+      const crane::grpc::LaunchTreeRequest* request,
+      crane::grpc::LaunchTreeReply* response) override {
+    return Handle_(context, [=, this](VirtualCraned*) {
+      m_sim_->OnLaunchTree(request->root(), response);
+      return grpc::Status::OK;
+    });
+  }
+
+  grpc::ServerUnaryReactor* FreeSteps(
+      grpc::CallbackServerContext* context,
+      const crane::grpc::FreeStepsRequest* request,
+      crane::grpc::FreeStepsReply* response) override {
+    return Handle_(context, [=, this](VirtualCraned* node) {
+      m_sim_->OnFreeJobs(node, request->job_id_list());
+      return grpc::Status::OK;
+    });
+  }
+
+  grpc::ServerUnaryReactor* ReleaseCgroupForJobs(
+      grpc::CallbackServerContext* context,
+      const crane::grpc::ReleaseCgroupForJobsRequest* request,
+      crane::grpc::ReleaseCgroupForJobsReply* response) override {
+    return Handle_(context, [=, this](VirtualCraned* node) {
+      m_sim_->OnFreeJobs(node, request->task_id_list());
+      return grpc::Status::OK;
+    });
+  }
+
+  grpc::ServerUnaryReactor* TerminateSteps(
+      grpc::CallbackServerContext* context,
+      const crane::grpc::TerminateStepsRequest* request,
+      crane::grpc::TerminateStepsReply* response) override {
+    return Handle_(context, [=, this](VirtualCraned* node) {
+      m_sim_->OnTerminateSteps(node, request->task_id_list(), true);
+      response->set_ok(true);
+      return grpc::Status::OK;
+    });
+  }
+
+  grpc::ServerUnaryReactor* TerminateOrphanedStep(
+      grpc::CallbackServerContext* context,
+      const crane::grpc::TerminateOrphanedStepRequest* request,
+      crane::grpc::TerminateOrphanedStepReply* response) override {
+    return Handle_(context, [=, this](VirtualCraned* node) {
+      m_sim_->OnTerminateSteps(node, request->task_id_list(), false);
+      response->set_ok(true);
+      return grpc::Status::OK;
+    });
+  }
+
+  grpc::ServerUnaryReactor* ChangeJobTimeLimit(
+      grpc::CallbackServerContext* context,
+      const crane::grpc::ChangeJobTimeLimitRequest* request,
+      crane::grpc::ChangeJobTimeLimitReply* response) override {
+    return Handle_(context, [=, this](VirtualCraned* node) {
+      response->set_ok(m_sim_->OnChangeJobTimeLimit(
+          node, request->task_id(), request->time_limit_seconds()));
+      return grpc::Status::OK;
+    });
+  }
+
+ private:
+  grpc::ServerUnaryReactor* Handle_(
+      grpc::CallbackServerContext* context,
+      std::function<grpc::Status(VirtualCraned*)> handle) {
+    VirtualCraned* node =
+        m_sim_->FindByAuthority(context->ExperimentalGetAuthority());
+    if (node == nullptr) {
+      auto* reactor = context->DefaultReactor();
+      reactor->Finish({grpc::StatusCode::NOT_FOUND, "Unknown craned"});
+      return reactor;
+    }
+    return Reply(m_sim_, context, [node, handle = std::move(handle)] {
+      return handle(node);
+    });
+  }
+
+  Simulator* m_sim_;
+};
+
+Simulator::Simulator(
+    SimOptions opts,
+    std::vector<std::pair<CranedId, std::string>> nodes_and_ips,
+    uint32_t thread_num)
+    : m_opts_(std::move(opts)) {
+  m_pool_ = std::make_unique<BS::thread_pool>(
+      thread_num, [] { util::SetCurrentThreadName("SimWorker"); });
+  m_timers_ = std::make_unique<TimerQueue>(m_pool_.get());
+
+  grpc::ChannelArguments channel_args;
+  SetGrpcClientKeepAliveChannelArgs(&channel_args);
+  // Channels with the same arguments share a connection by default, but
+  // ctld should see a connection per craned.
+  channel_args.SetInt(GRPC_ARG_USE_LOCAL_SUBCHANNEL_POOL, 1);
+
+  for (auto& [id, ip] : nodes_and_ips) {
+    auto node = std::make_unique<VirtualCraned>();
+    node->id = std::move(id);
+    node->ip = std::move(ip);
+    node->stub = crane::grpc::CraneCtldForInternal::NewStub(
+        CreateTcpInsecureCustomChannel(m_opts_.ctld_host, m_opts_.ctld_port,
+                                       channel_args));
+    m_ip_node_map_.emplace(node->ip, node.get());
+    m_id_node_map_.emplace(node->id, node.get());
+    m_nodes_.emplace_back(std::move(node));
+  }
+}
+
+bool Simulator::Start() {
+  m_service_ = std::make_unique<SimCranedService>(this);
+
+  grpc::ServerBuilder builder;
+  ServerBuilderSetKeepAliveArgs(&builder);
+  for (const auto& node : m_nodes_)
+    ServerBuilderAddTcpInsecureListeningPort(&builder, node->ip,
+                                             m_opts_.craned_port);
+  builder.RegisterService(m_service_.get());
+
+  m_server_ = builder.BuildAndStart();
+  if (!m_server_) {
+    CRANE_ERROR("Failed to listen on the addresses of the virtual craneds.");
+    return false;
+  }
+
+  // Spread the first handshakes over a ping interval, as real craneds
+  // don't start at the same moment.
+  uint64_t spread_ms = m_opts_.ping_interval_sec * 1000;
+  for (size_t i = 0; i < m_nodes_.size(); i++) {
+    VirtualCraned* node = m_nodes_[i].get();
+    m_timers_->After(
+        std::chrono::milliseconds(spread_ms * i / m_nodes_.size()),
+        [this, node] { RequestConfig_(node); });
+  }
+
+  CRANE_INFO("{} virtual craneds are started.", m_nodes_.size());
+  return true;
+}
+
+void Simulator::Shutdown() {
+  m_server_->Shutdown(std::chrono::system_clock::now() +
+                      std::chrono::seconds(1));
+  m_timers_->Stop();
+  m_pool_->wait();
+}
+
+void Simulator::ReportStats() const {
+  uint64_t ready = 0, running = 0;
+  for (const auto& node : m_nodes_) {
+    absl::MutexLock lock(&node->mtx);
+    if (node->state == VirtualCraned::State::kReady) ready++;
+    running += node->steps.size();
+  }
+
+  fmt::print(
+      "ready {}/{} | running steps {} | started {} ended {} cancelled {} "
+      "exec failures {} | registered {} reconnects {} | injected rpc "
+      "failures {} ctld rpc errors {}\n",
+      ready, m_nodes_.size(), running, m_stats_.steps_started.load(),
+      m_stats_.steps_ended.load(), m_stats_.steps_cancelled.load(),
+      m_stats_.exec_failures.load(), m_stats_.registered.load(),
+      m_stats_.reconnects.load(), m_stats_.injected_rpc_failures.load(),
+      m_stats_.ctld_rpc_errors.load());
+}
+
+VirtualCraned* Simulator::FindByAuthority(grpc::string_ref authority) const {
+  std::string_view host(authority.data(), authority.size());
+  if (host.starts_with('[')) {
+    host = host.substr(1, host.find(']') - 1);
+  } else if (auto colon = host.rfind(':'); colon != std::string_view::npos) {
+    host = host.substr(0, colon);
+  }
+
+  auto it = m_ip_node_map_.find(absl::string_view(host.data(), host.size()));
+  return it == m_ip_node_map_.end() ? nullptr : it->second;
+}
+
+grpc::ClientContext* Simulator::NewContext_(grpc::ClientContext* context,
+                                            int64_t timeout_sec) const {
+  context->set_deadline(std::chrono::system_clock::now() +
+                        std::chrono::seconds(timeout_sec));
+  return context;
+}
+
+void Simulator::RequestConfig_(VirtualCraned* node) {
+  crane::grpc::CranedTriggerReverseConnRequest req;
+  uint64_t epoch;
+  {
+    absl::MutexLock lock(&node->mtx);
+    node->state = VirtualCraned::State::kRequestingConfig;
+    node->token = ToProtoTimestamp(Clock::now());
+    epoch = ++node->epoch;
+
+    req.set_craned_id(node->id);
+    *req.mutable_token() = node->token;
+  }
+
+  // Start over if ctld doesn't finish the handshake in time, like the
+  // register timeout of craned.
+  m_timers_->After(std::chrono::seconds(m_opts_.ctld_timeout_sec),
+                   [this, node, epoch] {
+                     {
+                       absl::MutexLock lock(&node->mtx);
+                       if (node->epoch != epoch ||
+                           node->state == VirtualCraned::State::kReady)
+                         return;
+                     }
+                     m_stats_.reconnects.fetch_add(1);
+                     RequestConfig_(node);
+                   });
+
+  grpc::ClientContext context;
+  google::protobuf::Empty reply;
+  auto status = node->stub->CranedTriggerReverseConn(
+      NewContext_(&context, 1), req, &reply);
+  if (!status.ok()) {
+    m_stats_.ctld_rpc_errors.fetch_add(1);
+    CRANE_TRACE("[{}] CranedTriggerReverseConn failed: {}", node->id,
+                status.error_message());
+  }
+}
+
+void Simulator::OnConfigure(VirtualCraned* node,
+                            const crane::grpc::ConfigureCranedRequest& req) {
+  std::vector<job_id_t> lost_jobs;
+  std::vector<task_id_t> lost_steps;
+  uint64_t epoch;
+  {
+    absl::MutexLock lock(&node->mtx);
+    if (node->state != VirtualCraned::State::kRequestingConfig) return;
+    if (!req.ok() || !req.has_token() || req.token() != node->token) {
+      CRANE_TRACE("[{}] Configure is not accepted.", node->id);
+      return;
+    }
+
+    // Reconcile with the jobs and steps ctld expects on this node.
+    for (const auto& [job_id, job] : req.job_map())
+      if (!node->jobs.contains(job_id)) lost_jobs.emplace_back(job_id);
+    for (const auto& [task_id, task] : req.job_tasks_map())
+      if (!node->steps.contains(task_id)) lost_steps.emplace_back(task_id);
+
+    absl::erase_if(node->jobs, [&](job_id_t job_id) {
+      return !req.job_map().contains(job_id);
+    });
+    absl::erase_if(node->steps, [&](const auto& kv) {
+      return !req.job_tasks_map().contains(kv.first);
+    });
+
+    node->state = VirtualCraned::State::kConfiguring;
+    epoch = node->epoch;
+  }
+
+  m_timers_->After(std::chrono::milliseconds(m_opts_.register_delay_ms),
+                   [this, node, epoch, lost_jobs = std::move(lost_jobs),
+                    lost_steps = std::move(lost_steps)]() mutable {
+                     Register_(node, epoch, std::move(lost_jobs),
+                               std::move(lost_steps));
+                   });
+}
+
+void Simulator::Register_(VirtualCraned* node, uint64_t epoch,
+                          std::vector<job_id_t> lost_jobs,
+                          std::vector<task_id_t> lost_steps) {
+  crane::grpc::CranedRegisterRequest req;
+  {
+    absl::MutexLock lock(&node->mtx);
+    if (node->epoch != epoch) return;
+    req.set_craned_id(node->id);
+    *req.mutable_token() = node->token;
+  }
+
+  auto* meta = req.mutable_remote_meta();
+  meta->set_craned_version(CRANE_VERSION_STRING);
+  meta->set_config_crc(m_opts_.config_crc);
+  meta->mutable_sys_rel_info()->set_name("Linux");
+  meta->mutable_sys_rel_info()->set_release("craned-simulator");
+  meta->mutable_sys_rel_info()->set_version(CRANE_VERSION_STRING);
+  *meta->mutable_craned_start_time() =
+      ToProtoTimestamp(std::chrono::system_clock::now());
+  *meta->mutable_system_boot_time() =
+      ToProtoTimestamp(std::chrono::system_clock::now());
+  meta->mutable_lost_jobs()->Assign(lost_jobs.begin(), lost_jobs.end());
+  meta->mutable_lost_tasks()->Assign(lost_steps.begin(), lost_steps.end());
+
+  grpc::ClientContext context;
+  crane::grpc::CranedRegisterReply reply;
+  auto status =
+      node->stub->CranedRegister(NewContext_(&context, 1), req, &reply);
+  if (!status.ok() || !reply.ok()) {
+    if (!status.ok()) m_stats_.ctld_rpc_errors.fetch_add(1);
+    CRANE_TRACE("[{}] CranedRegister failed.", node->id);
+    m_stats_.reconnects.fetch_add(1);
+    RequestConfig_(node);
+    return;
+  }
+
+  {
+    absl::MutexLock lock(&node->mtx);
+    if (node->epoch != epoch) return;
+    node->state = VirtualCraned::State::kReady;
+    if (!node->changes.empty() && !node->flushing) {
+      node->flushing = true;
+      m_pool_->detach_task([this, node] { FlushChanges_(node); });
+    }
+  }
+  m_stats_.registered.fetch_add(1);
+
+  m_timers_->After(std::chrono::seconds(m_opts_.ping_interval_sec),
+                   [this, node, epoch] { Ping_(node, epoch); });
+}
+
+void Simulator::Ping_(VirtualCraned* node, uint64_t epoch) {
+  {
+    absl::MutexLock lock(&node->mtx);
+    if (node->epoch != epoch) return;
+  }
+
+  // A dropped ping looks like a craned which is alive but late.
+  if (!RandomChance(m_opts_.ping_drop_ratio)) {
+    grpc::ClientContext context;
+    crane::grpc::CranedPingRequest req;
+    crane::grpc::CranedPingReply reply;
+    req.set_craned_id(node->id);
+    auto status = node->stub->CranedPing(
+        NewContext_(&context, kCtldRpcTimeoutSec), req, &reply);
+    if (!status.ok() || !reply.ok()) {
+      if (!status.ok()) m_stats_.ctld_rpc_errors.fetch_add(1);
+      CRANE_TRACE("[{}] CranedPing failed.", node->id);
+      m_stats_.reconnects.fetch_add(1);
+      RequestConfig_(node);
+      return;
+    }
+  }
+
+  m_timers_->After(std::chrono::seconds(m_opts_.ping_interval_sec),
+                   [this, node, epoch] { Ping_(node, epoch); });
+}
+
+void Simulator::OnCreateCgroupForJobs(
+    VirtualCraned* node, const crane::grpc::CreateCgroupForJobsRequest& req) {
+  absl::MutexLock lock(&node->mtx);
+  for (const auto& job : req.job_list()) node->jobs.emplace(job.job_id());
+}
+
+void Simulator::OnExecuteSteps(VirtualCraned* node,
+                               const crane::grpc::ExecuteStepsRequest& req,
+                               std::vector<task_id_t>* failed) {
+  absl::MutexLock lock(&node->mtx);
+  for (const auto& task : req.tasks()) {
+    task_id_t task_id = task.task_id();
+    if (UnitOf(task_id, 1) < m_opts_.exec_fail_ratio) {
+      m_stats_.exec_failures.fetch_add(1);
+      failed->emplace_back(task_id);
+      continue;
+    }
+
+    VirtualCraned::Step step{
+        .start = Clock::now(),
+        .run_ms = m_opts_.min_run_ms +
+                  static_cast<uint64_t>(
+                      UnitOf(task_id, 2) *
+                      static_cast<double>(m_opts_.max_run_ms -
+                                          m_opts_.min_run_ms)),
+        .limit_ms = static_cast<uint64_t>(task.time_limit().seconds()) * 1000,
+    };
+    auto [it, ok] = node->steps.emplace(task_id, step);
+    if (!ok) continue;
+
+    m_stats_.steps_started.fetch_add(1);
+    ScheduleStepEnd_(node, task_id, it->second);
+  }
+}
+
+void Simulator::OnLaunchTree(const crane::grpc::LaunchTreeNode& tree,
+                             crane::grpc::LaunchTreeReply* reply) {
+  auto it = m_id_node_map_.find(tree.craned_id());
+  if (it != m_id_node_map_.end()) {
+    auto* result = reply->add_results();
+    result->set_craned_id(tree.craned_id());
+    if (tree.has_create_cgroup()) {
+      OnCreateCgroupForJobs(it->second, tree.create_cgroup());
+    } else if (tree.has_execute_steps()) {
+      std::vector<task_id_t> failed;
+      OnExecuteSteps(it->second, tree.execute_steps(), &failed);
+      result->mutable_failed_task_id_list()->Assign(failed.begin(),
+                                                    failed.end());
+    }
+  }
+
+  for (const auto& child : tree.children()) OnLaunchTree(child, reply);
+}
+
+void Simulator::OnTerminateSteps(
+    VirtualCraned* node, const google::protobuf::RepeatedField<uint32_t>& ids,
+    bool report) {
+  absl::MutexLock lock(&node->mtx);
+  for (task_id_t task_id : ids) {
+    if (node->steps.erase(task_id) == 0 || !report) continue;
+    m_stats_.steps_cancelled.fetch_add(1);
+    QueueChange_(node, task_id, TaskStatus::Cancelled,
+                 ExitCode::kExitCodeTerminated);
+  }
+}
+
+void Simulator::OnFreeJobs(
+    VirtualCraned* node,
+    const google::protobuf::RepeatedField<uint32_t>& job_ids) {
+  absl::MutexLock lock(&node->mtx);
+  for (job_id_t job_id : job_ids) {
+    node->jobs.erase(job_id);
+    // A job has the step of the same id.
+    node->steps.erase(job_id);
+  }
+}
+
+bool Simulator::OnChangeJobTimeLimit(VirtualCraned* node, task_id_t task_id,
+                                     int64_t limit_sec) {
+  absl::MutexLock lock(&node->mtx);
+  auto it = node->steps.find(task_id);
+  if (it == node->steps.end()) return false;
+
+  it->second.limit_ms = static_cast<uint64_t>(limit_sec) * 1000;
+  it->second.generation++;
+  ScheduleStepEnd_(node, task_id, it->second);
+  return true;
+}
+
+void Simulator::ScheduleStepEnd_(VirtualCraned* node, task_id_t task_id,
+                                 const VirtualCraned::Step& step) {
+  uint64_t end_ms = step.run_ms;
+  if (step.limit_ms != 0) end_ms = std::min(end_ms, step.limit_ms);
+
+  auto delay = std::chrono::duration_cast<std::chrono::milliseconds>(
+      step.start + std::chrono::milliseconds(end_ms) - Clock::now());
+  m_timers_->After(std::max(delay, std::chrono::milliseconds(0)),
+                   [this, node, task_id, gen = step.generation] {
+                     EndStep_(node, task_id, gen);
+                   });
+}
+
+void Simulator::EndStep_(VirtualCraned* node, task_id_t task_id,
+                         uint64_t generation) {
+  absl::MutexLock lock(&node->mtx);
+  auto it = node->steps.find(task_id);
+  if (it == node->steps.end() || it->second.generation != generation) return;
+
+  const VirtualCraned::Step& step = it->second;
+  TaskStatus status = TaskStatus::Completed;
+  uint32_t exit_code = 0;
+  if (step.limit_ms != 0 && step.run_ms > step.limit_ms) {
+    status = TaskStatus::ExceedTimeLimit;
+    exit_code = ExitCode::kExitCodeExceedTimeLimit;
+  } else if (UnitOf(task_id, 3) < m_opts_.step_fail_ratio) {
+    status = TaskStatus::Failed;
+    exit_code = 1;
+  }
+  node->steps.erase(it);
+
+  m_stats_.steps_ended.fetch_add(1);
+  QueueChange_(node, task_id, status, exit_code);
+}
+
+void Simulator::QueueChange_(VirtualCraned* node, task_id_t task_id,
+                             TaskStatus status, uint32_t exit_code) {
+  auto& change = node->changes.emplace_back();
+  change.set_task_id(task_id);
+  change.set_new_status(status);
+  change.set_exit_code(exit_code);
+
+  // Changes are kept until the node is registered again, like craned does.
+  if (node->state == VirtualCraned::State::kReady && !node->flushing) {
+    node->flushing = true;
+    m_pool_->detach_task([this, node] { FlushChanges_(node); });
+  }
+}
+
+void Simulator::FlushChanges_(VirtualCraned* node) {
+  while (true) {
+    crane::grpc::StepStatusChangeBatchRequest req;
+    {
+      absl::MutexLock lock(&node->mtx);
+      if (node->changes.empty() ||
+          node->state != VirtualCraned::State::kReady) {
+        node->flushing = false;
+        return;
+      }
+      req.set_craned_id(node->id);
+      while (!node->changes.empty() &&
+             static_cast<uint32_t>(req.changes_size()) <
+                 kStatusChangeBatchMaxNum) {
+        *req.add_changes() = std::move(node->changes.front());
+        node->changes.pop_front();
+      }
+    }
+
+    grpc::ClientContext context;
+    crane::grpc::StepStatusChangeBatchReply reply;
+    auto status = node->stub->StepStatusChangeBatch(
+        NewContext_(&context, kCtldRpcTimeoutSec), req, &reply);
+    if (status.ok()) continue;
+
+    m_stats_.ctld_rpc_errors.fetch_add(1);
+    CRANE_TRACE("[{}] StepStatusChangeBatch failed: {}", node->id,
+                status.error_message());
+    {
+      absl::MutexLock lock(&node->mtx);
+      auto* changes = req.mutable_changes();
+      for (int i = changes->size() - 1; i >= 0; i--)
+        node->changes.emplace_front(std::move(*changes->Mutable(i)));
+    }
+    m_timers_->After(std::chrono::milliseconds(kStatusChangeRetryMs),
+                     [this, node] { FlushChanges_(node); });
+    return;
+  }
+}
+
+std::atomic_bool g_stopping{false};
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  cxxopts::Options options("craned_simulator",
+                           "Simulate craneds in one process against cranectld");
+
+  // clang-format off
+  options.add_options()
+      ("C,config", "Path to the config file of cranectld",
+       cxxopts::value<std::string>()->default_value(kDefaultConfigPath))
+      ("n,nodes", "Nodes to simulate, all the nodes of the config by default",
+       cxxopts::value<std::string>())
+      ("ctld", "Address of cranectld, ControlMachine by default",
+       cxxopts::value<std::string>())
+      ("print-hosts", "Print /etc/hosts lines which map the nodes to the "
+       "addresses from the given one on, and exit",
+       cxxopts::value<std::string>())
+      ("threads", "Number of threads sending RPCs to ctld",
+       cxxopts::value<uint32_t>()->default_value("64"))
+      ("ping-interval", "Seconds between pings",
+       cxxopts::value<uint32_t>()->default_value(
+           std::to_string(kCranedPingIntervalSec)))
+      ("ctld-timeout", "Seconds before an unfinished handshake starts over",
+       cxxopts::value<uint32_t>()->default_value("30"))
+      ("register-delay-ms", "Delay between Configure and CranedRegister",
+       cxxopts::value<uint32_t>()->default_value("0"))
+      ("rpc-delay-ms", "Delay of the answers to ctld",
+       cxxopts::value<uint32_t>()->default_value("0"))
+      ("rpc-fail-ratio", "Ratio of RPCs from ctld failed with UNAVAILABLE",
+       cxxopts::value<double>()->default_value("0"))
+      ("ping-drop-ratio", "Ratio of pings not sent",
+       cxxopts::value<double>()->default_value("0"))
+      ("min-run-ms", "Minimum run time of a step",
+       cxxopts::value<uint64_t>()->default_value("10000"))
+      ("max-run-ms", "Maximum run time of a step",
+       cxxopts::value<uint64_t>()->default_value("60000"))
+      ("exec-fail-ratio", "Ratio of steps which fail to launch",
+       cxxopts::value<double>()->default_value("0"))
+      ("step-fail-ratio", "Ratio of steps which end as Failed",
+       cxxopts::value<double>()->default_value("0"))
+      ("report-interval", "Seconds between reports of the stats",
+       cxxopts::value<uint32_t>()->default_value("10"))
+      ("log-file", "Log file",
+       cxxopts::value<std::string>()->default_value(
+           "/tmp/craned_simulator.log"))
+      ("l,debug-level", "Log level",
+       cxxopts::value<std::string>()->default_value("info"))
+      ("h,help", "Show help");
+  // clang-format on
+
+  auto parsed = options.parse(argc, argv);
+  if (parsed.count("help")) {
+    fmt::print("{}\n", options.help());
+    return 0;
+  }
+
+  auto log_level = StrToLogLevel(parsed["debug-level"].as<std::string>());
+  if (!log_level.has_value()) {
+    fmt::print(stderr, "Illegal debug level.\n");
+    return 1;
+  }
+  InitLogger(log_level.value(), parsed["log-file"].as<std::string>(), false);
+
+  YAML::Node config;
+  try {
+    config = YAML::LoadFile(parsed["config"].as<std::string>());
+  } catch (const YAML::Exception& e) {
+    fmt::print(stderr, "Failed to read the config: {}\n", e.what());
+    return 1;
+  }
+
+  std::list<std::string> node_ids;
+  if (parsed.count("nodes")) {
+    if (!util::ParseHostList(parsed["nodes"].as<std::string>(), &node_ids)) {
+      fmt::print(stderr, "Invalid node list.\n");
+      return 1;
+    }
+  } else if (config["Nodes"]) {
+    for (const auto& node : config["Nodes"]) {
+      std::list<std::string> names;
+      if (!node["name"] ||
+          !util::ParseHostList(node["name"].Scalar(), &names)) {
+        fmt::print(stderr, "Illegal node name in the config.\n");
+        return 1;
+      }
+      node_ids.splice(node_ids.end(), names);
+    }
+  }
+  if (node_ids.empty()) {
+    fmt::print(stderr, "No node to simulate.\n");
+    return 1;
+  }
+
+  if (parsed.count("print-hosts")) {
+    ipv4_t addr;
+    if (!crane::StrToIpv4(parsed["print-hosts"].as<std::string>(), &addr)) {
+      fmt::print(stderr, "Invalid IPv4 address.\n");
+      return 1;
+    }
+    for (const auto& id : node_ids)
+      fmt::print("{} {}\n", crane::Ipv4ToStr(addr++), id);
+    return 0;
+  }
+
+  crane::InitializeNetworkFunctions();
+
+  std::vector<std::pair<CranedId, std::string>> nodes_and_ips;
+  for (auto& id : node_ids) {
+    ipv4_t ipv4;
+    ipv6_t ipv6;
+    std::string ip;
+    if (crane::ResolveIpv4FromHostname(id, &ipv4))
+      ip = crane::Ipv4ToStr(ipv4);
+    else if (crane::ResolveIpv6FromHostname(id, &ipv6))
+      ip = crane::Ipv6ToStr(ipv6);
+    else {
+      fmt::print(stderr, "Failed to resolve {}. See --print-hosts.\n", id);
+      return 1;
+    }
+    nodes_and_ips.emplace_back(std::move(id), std::move(ip));
+  }
+
+  SimOptions opts{
+      .ctld_port = util::YamlValueOr(config["CraneCtldForInternalListenPort"],
+                                     kCtldForInternalDefaultPort),
+      .craned_port =
+          util::YamlValueOr(config["CranedListenPort"], kCranedDefaultPort),
+      .config_crc = util::CalcConfigCRC32(config),
+      .ping_interval_sec = std::max(parsed["ping-interval"].as<uint32_t>(), 1u),
+      .ctld_timeout_sec = std::max(parsed["ctld-timeout"].as<uint32_t>(), 1u),
+      .register_delay_ms = parsed["register-delay-ms"].as<uint32_t>(),
+      .rpc_delay_ms = parsed["rpc-delay-ms"].as<uint32_t>(),
+      .rpc_fail_ratio = parsed["rpc-fail-ratio"].as<double>(),
+      .ping_drop_ratio = parsed["ping-drop-ratio"].as<double>(),
+      .min_run_ms = parsed["min-run-ms"].as<uint64_t>(),
+      .max_run_ms = parsed["max-run-ms"].as<uint64_t>(),
+      .exec_fail_ratio = parsed["exec-fail-ratio"].as<double>(),
+      .step_fail_ratio = parsed["step-fail-ratio"].as<double>(),
+  };
+  if (parsed.count("ctld"))
+    opts.ctld_host = parsed["ctld"].as<std::string>();
+  else
+    opts.ctld_host = util::YamlValueOr(config["ControlMachine"], "localhost");
+  opts.max_run_ms = std::max(opts.max_run_ms, opts.min_run_ms);
+
+  Simulator sim(std::move(opts), std::move(nodes_and_ips),
+                std::max(parsed["threads"].as<uint32_t>(), 1u));
+  if (!sim.Start()) return 1;
+
+  std::signal(SIGINT, [](int) { g_stopping = true; });
+  std::signal(SIGTERM, [](int) { g_stopping = true; });
+
+  auto report_interval =
+      std::chrono::seconds(parsed["report-interval"].as<uint32_t>());
+  auto next_report = Clock::now() + report_interval;
+  while (!g_stopping) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    if (report_interval.count() != 0 && Clock::now() >= next_report) {
+      sim.ReportStats();
+      next_report += report_interval;
+    }
+  }
+
+  sim.Shutdown();
+  sim.ReportStats();
+  return 0;
+}
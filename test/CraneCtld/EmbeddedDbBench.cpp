@@ -0,0 +1,533 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Offline benchmark of the embedded db.
+//
+// The records are shaped like the ones of EmbeddedDbClient: a serialized
+// TaskToCtld with a batch script of --script-sizes bytes under "<id>T" and a
+// serialized RuntimeAttrOfTask under "<id>S". Each suite runs for every
+// backend and script size.
+//
+// The backend suite drives IEmbeddedDb directly:
+//   insert:  all records, --txn-size tasks per transaction;
+//   update:  --updates random runtime attrs, --txn-size per transaction;
+//   fetch:   --fetches random runtime attrs outside any transaction;
+//   iterate: IterateAllKv over the whole db, as the recovery does;
+//   delete:  all records, --txn-size tasks per transaction.
+//
+// The client suite drives EmbeddedDbClient, so the group commit is included:
+//   append:   AppendTasksToPendingAndAdvanceTaskIds() of --txn-size tasks;
+//   update:   full runtime attrs from --writers threads, one per commit;
+//   delta:    runtime attr deltas from --writers threads, one per commit;
+//   snapshot: RetrieveLastSnapshot() after reopening the client;
+//   purge:    PurgeEndedTasks() of --txn-size tasks.
+//
+// Latencies are per call, that is per transaction, fetch or commit.
+
+#include "CtldPublicDefs.h"
+// Precompiled header comes first!
+
+#include <cxxopts.hpp>
+#include <random>
+
+#include "EmbeddedDbClient.h"
+#include "crane/Logger.h"
+
+namespace {
+
+using namespace Ctld;
+
+using Clock = std::chrono::steady_clock;
+
+std::unique_ptr<IEmbeddedDb> CreateDb(const std::string& backend) {
+#ifdef CRANE_HAVE_UNQLITE
+  if (backend == "Unqlite") return std::make_unique<UnqliteDb>();
+#endif
+#ifdef CRANE_HAVE_BERKELEY_DB
+  if (backend == "BerkeleyDB") return std::make_unique<BerkeleyDb>();
+#endif
+#ifdef CRANE_HAVE_LMDB
+  if (backend == "LMDB") return std::make_unique<LmdbDb>();
+#endif
+  return nullptr;
+}
+
+std::vector<std::string> CompiledBackends() {
+  std::vector<std::string> backends;
+#ifdef CRANE_HAVE_UNQLITE
+  backends.emplace_back("Unqlite");
+#endif
+#ifdef CRANE_HAVE_BERKELEY_DB
+  backends.emplace_back("BerkeleyDB");
+#endif
+#ifdef CRANE_HAVE_LMDB
+  backends.emplace_back("LMDB");
+#endif
+  return backends;
+}
+
+std::string FixedEntry(uint64_t id) { return fmt::format("{}T", id); }
+std::string VariableEntry(uint64_t id) { return fmt::format("{}S", id); }
+
+crane::grpc::TaskToCtld MakeTaskToCtld(uint64_t id, size_t script_size) {
+  crane::grpc::TaskToCtld task;
+  task.mutable_time_limit()->set_seconds(3600);
+  task.set_type(crane::grpc::Batch);
+  task.set_partition_name("CPU");
+  task.set_uid(0);
+  task.set_account("bench");
+  task.set_name(fmt::format("bench_job_{}", id));
+  task.set_cwd("/home/bench");
+  task.set_cmd_line("cbatch job.sh");
+  for (int i = 0; i < 16; i++)
+    task.mutable_env()->emplace(fmt::format("ENV_VAR_{}", i),
+                                "/usr/local/bin:/usr/bin:/bin");
+
+  std::string script = "#!/bin/bash\n";
+  while (script.size() < script_size)
+    script += fmt::format("srun ./step --input data_{}.in\n", script.size());
+  task.mutable_batch_meta()->set_sh_script(std::move(script));
+  task.mutable_batch_meta()->set_output_file_pattern("%j.out");
+
+  return task;
+}
+
+crane::grpc::RuntimeAttrOfTask MakeRuntimeAttr(uint64_t id,
+                                               crane::grpc::TaskStatus status) {
+  crane::grpc::RuntimeAttrOfTask attr;
+  attr.set_task_id(id);
+  attr.set_task_db_id(id);
+  attr.set_username("bench");
+  attr.set_status(status);
+  attr.mutable_submit_time()->set_seconds(1700000000 + id);
+  attr.add_craned_ids(fmt::format("cn{:05}", id % 10000));
+  attr.set_cached_priority(double(id));
+  return attr;
+}
+
+double Percentile(std::vector<double> values, double p) {
+  if (values.empty()) return 0;
+  std::ranges::sort(values);
+  size_t idx = std::min<size_t>(values.size() * p, values.size() - 1);
+  return values[idx];
+}
+
+uint64_t DirSize(const std::filesystem::path& dir) {
+  uint64_t size = 0;
+  std::error_code ec;
+  for (const auto& entry :
+       std::filesystem::recursive_directory_iterator(dir, ec))
+    if (entry.is_regular_file(ec)) size += entry.file_size(ec);
+  return size;
+}
+
+struct WorkloadOptions {
+  uint64_t task_num;
+  uint64_t txn_size;
+  uint64_t update_num;
+  uint64_t fetch_num;
+  uint32_t writer_num;
+  size_t script_size;
+};
+
+struct PhaseResult {
+  std::string name;
+  uint64_t ops;
+  double seconds;
+  std::vector<double> latencies_ms;
+};
+
+struct SuiteResult {
+  std::vector<PhaseResult> phases;
+  uint64_t db_size;  // After all the records are written.
+};
+
+// Times the calls of one phase. ok is false once any call fails.
+class PhaseTimer {
+ public:
+  PhaseTimer(std::string name, uint64_t ops)
+      : m_result_{.name = std::move(name), .ops = ops} {}
+
+  template <typename F>
+  void Call(F&& f) {
+    auto begin = Clock::now();
+    bool call_ok = f();
+    m_result_.latencies_ms.emplace_back(
+        std::chrono::duration<double, std::milli>(Clock::now() - begin)
+            .count());
+    if (!call_ok) ok = false;
+  }
+
+  PhaseResult Finish(Clock::time_point begin) {
+    m_result_.seconds =
+        std::chrono::duration<double>(Clock::now() - begin).count();
+    if (!ok) fmt::print(stderr, "Phase {} failed.\n", m_result_.name);
+    return std::move(m_result_);
+  }
+
+  bool ok{true};
+
+ private:
+  PhaseResult m_result_;
+};
+
+std::optional<SuiteResult> RunBackendSuite(const std::string& backend,
+                                           const WorkloadOptions& opts,
+                                           const std::filesystem::path& dir) {
+  auto db = CreateDb(backend);
+  if (!db || !db->Init((dir / "bench.db").string())) {
+    fmt::print(stderr, "Failed to init backend {}.\n", backend);
+    return std::nullopt;
+  }
+
+  std::mt19937_64 rng(0);
+  std::uniform_int_distribution<uint64_t> random_id(0, opts.task_num - 1);
+
+  // The records are serialized before the timing, as the callers of the
+  // backends do before a transaction.
+  std::vector<std::string> fixed_values(opts.task_num);
+  std::vector<std::string> variable_values(opts.task_num);
+  for (uint64_t i = 0; i < opts.task_num; i++) {
+    fixed_values[i] = MakeTaskToCtld(i, opts.script_size).SerializeAsString();
+    variable_values[i] =
+        MakeRuntimeAttr(i, crane::grpc::Pending).SerializeAsString();
+  }
+  std::string running =
+      MakeRuntimeAttr(0, crane::grpc::Running).SerializeAsString();
+
+  // Calls f(txn_id, i) for [0, n) in transactions of txn_size.
+  auto run_in_txns = [&](PhaseTimer* timer, uint64_t n, auto&& f) {
+    for (uint64_t begin = 0; begin < n && timer->ok; begin += opts.txn_size) {
+      uint64_t end = std::min(n, begin + opts.txn_size);
+      timer->Call([&] {
+        auto txn = db->Begin();
+        if (!txn) return false;
+        for (uint64_t i = begin; i < end; i++)
+          if (!f(txn.value(), i)) return false;
+        return db->Commit(txn.value()).has_value();
+      });
+    }
+  };
+
+  SuiteResult result;
+  auto begin = Clock::now();
+  PhaseTimer insert("insert", opts.task_num * 2);
+  run_in_txns(&insert, opts.task_num, [&](txn_id_t txn, uint64_t i) {
+    const auto& fixed = fixed_values[i];
+    const auto& variable = variable_values[i];
+    return db->Store(txn, FixedEntry(i), fixed.data(), fixed.size()) &&
+           db->Store(txn, VariableEntry(i), variable.data(), variable.size());
+  });
+  result.phases.emplace_back(insert.Finish(begin));
+  result.db_size = DirSize(dir);
+
+  begin = Clock::now();
+  PhaseTimer update("update", opts.update_num);
+  run_in_txns(&update, opts.update_num, [&](txn_id_t txn, uint64_t) {
+    return db
+        ->Store(txn, VariableEntry(random_id(rng)), running.data(),
+                running.size())
+        .has_value();
+  });
+  result.phases.emplace_back(update.Finish(begin));
+
+  begin = Clock::now();
+  PhaseTimer fetch("fetch", opts.fetch_num);
+  std::vector<uint8_t> buf(4096);
+  for (uint64_t i = 0; i < opts.fetch_num && fetch.ok; i++) {
+    fetch.Call([&] {
+      size_t len = buf.size();
+      return db->Fetch(0, VariableEntry(random_id(rng)), buf.data(), &len)
+          .has_value();
+    });
+  }
+  result.phases.emplace_back(fetch.Finish(begin));
+
+  begin = Clock::now();
+  PhaseTimer iterate("iterate", opts.task_num * 2);
+  iterate.Call([&] {
+    uint64_t n = 0;
+    auto res =
+        db->IterateAllKv([&n](std::string&&, std::vector<uint8_t>&&) {
+          n++;
+          return true;
+        });
+    return res.has_value() && n == opts.task_num * 2;
+  });
+  result.phases.emplace_back(iterate.Finish(begin));
+
+  begin = Clock::now();
+  PhaseTimer remove("delete", opts.task_num * 2);
+  run_in_txns(&remove, opts.task_num, [&](txn_id_t txn, uint64_t i) {
+    return db->Delete(txn, VariableEntry(i)) && db->Delete(txn, FixedEntry(i));
+  });
+  result.phases.emplace_back(remove.Finish(begin));
+
+  std::ignore = db->Close();
+  if (!(insert.ok && update.ok && fetch.ok && iterate.ok && remove.ok))
+    return std::nullopt;
+  return result;
+}
+
+std::optional<SuiteResult> RunClientSuite(const std::string& backend,
+                                          const WorkloadOptions& opts,
+                                          const std::filesystem::path& dir) {
+  g_config.CraneEmbeddedDbBackend = backend;
+  std::string db_path = (dir / "embedded.db").string();
+
+  auto client = std::make_unique<EmbeddedDbClient>();
+  if (!client->Init(db_path)) {
+    fmt::print(stderr, "Failed to init the client on {}.\n", backend);
+    return std::nullopt;
+  }
+
+  std::vector<std::unique_ptr<TaskInCtld>> tasks(opts.task_num);
+  for (uint64_t i = 0; i < opts.task_num; i++) {
+    tasks[i] = std::make_unique<TaskInCtld>();
+    tasks[i]->SetFieldsByTaskToCtld(MakeTaskToCtld(i, opts.script_size));
+    tasks[i]->SetStatus(crane::grpc::Pending);
+  }
+
+  SuiteResult result;
+  bool ok = true;
+
+  auto begin = Clock::now();
+  PhaseTimer append("append", opts.task_num);
+  for (uint64_t i = 0; i < opts.task_num && append.ok; i += opts.txn_size) {
+    std::vector<TaskInCtld*> batch;
+    for (uint64_t j = i; j < std::min(opts.task_num, i + opts.txn_size); j++)
+      batch.emplace_back(tasks[j].get());
+    append.Call(
+        [&] { return client->AppendTasksToPendingAndAdvanceTaskIds(batch); });
+  }
+  ok &= append.ok;
+  result.phases.emplace_back(append.Finish(begin));
+  result.db_size = DirSize(dir);
+
+  // Each writer commits on its own and waits, as the RPC threads do, so that
+  // the committer thread groups the concurrent commits.
+  auto run_writers = [&](PhaseTimer* timer, auto&& make_batch) {
+    uint64_t per_writer = opts.update_num / opts.writer_num;
+    std::vector<std::vector<double>> latencies(opts.writer_num);
+    std::atomic<bool> writers_ok{true};
+    std::vector<std::thread> writers;
+    for (uint32_t w = 0; w < opts.writer_num; w++) {
+      writers.emplace_back([&, w] {
+        std::mt19937_64 rng(w);
+        std::uniform_int_distribution<uint64_t> random_idx(0,
+                                                           opts.task_num - 1);
+        for (uint64_t i = 0; i < per_writer; i++) {
+          EmbeddedDbClient::WriteBatch batch;
+          make_batch(&batch, *tasks[random_idx(rng)]);
+
+          auto call_begin = Clock::now();
+          if (!client->CommitAsync(std::move(batch)).get())
+            writers_ok = false;
+          latencies[w].emplace_back(std::chrono::duration<double, std::milli>(
+                                        Clock::now() - call_begin)
+                                        .count());
+        }
+      });
+    }
+    for (auto& writer : writers) writer.join();
+
+    PhaseResult phase = timer->Finish(begin);
+    for (const auto& l : latencies)
+      phase.latencies_ms.insert(phase.latencies_ms.end(), l.begin(), l.end());
+    if (!writers_ok) fmt::print(stderr, "Phase {} failed.\n", phase.name);
+    ok &= writers_ok.load();
+    return phase;
+  };
+
+  begin = Clock::now();
+  PhaseTimer update("update", opts.update_num);
+  result.phases.emplace_back(
+      run_writers(&update, [](EmbeddedDbClient::WriteBatch* batch,
+                              const TaskInCtld& task) {
+        auto attr = task.RuntimeAttr();
+        attr.set_status(crane::grpc::Running);
+        batch->PutRuntimeAttr(task.TaskDbId(), attr);
+      }));
+
+  begin = Clock::now();
+  PhaseTimer delta("delta", opts.update_num);
+  result.phases.emplace_back(run_writers(
+      &delta,
+      [](EmbeddedDbClient::WriteBatch* batch, const TaskInCtld& task) {
+        crane::grpc::RuntimeAttrDeltaOfTask attr_delta;
+        attr_delta.set_status(crane::grpc::Completed);
+        attr_delta.set_exit_code(0);
+        batch->PutRuntimeAttrDelta(task.TaskDbId(), attr_delta);
+      }));
+
+  begin = Clock::now();
+  PhaseTimer snapshot("snapshot", opts.task_num);
+  snapshot.Call([&] {
+    client.reset();
+    client = std::make_unique<EmbeddedDbClient>();
+    if (!client->Init(db_path)) return false;
+
+    EmbeddedDbClient::DbSnapshot db_snapshot;
+    if (!client->RetrieveLastSnapshot(&db_snapshot)) return false;
+    return db_snapshot.pending_queue.size() + db_snapshot.running_queue.size() +
+               db_snapshot.final_queue.size() ==
+           opts.task_num;
+  });
+  ok &= snapshot.ok;
+  result.phases.emplace_back(snapshot.Finish(begin));
+
+  begin = Clock::now();
+  PhaseTimer purge("purge", opts.task_num);
+  for (uint64_t i = 0; i < opts.task_num && purge.ok; i += opts.txn_size) {
+    std::vector<task_db_id_t> db_ids;
+    for (uint64_t j = i; j < std::min(opts.task_num, i + opts.txn_size); j++)
+      db_ids.emplace_back(tasks[j]->TaskDbId());
+    purge.Call([&] { return client->PurgeEndedTasks(db_ids); });
+  }
+  ok &= purge.ok;
+  result.phases.emplace_back(purge.Finish(begin));
+
+  client.reset();
+  if (!ok) return std::nullopt;
+  return result;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  cxxopts::Options options("embedded_db_bench",
+                           "Benchmark the embedded db backends and client");
+
+  // clang-format off
+  options.add_options()
+      ("b,backends", "Comma separated backends, all compiled ones by default",
+       cxxopts::value<std::string>())
+      ("s,suites", "Comma separated suites: backend, client",
+       cxxopts::value<std::string>()->default_value("backend,client"))
+      ("n,tasks", "Number of task records",
+       cxxopts::value<uint64_t>()->default_value("100000"))
+      ("txn-size", "Tasks per transaction, append or purge",
+       cxxopts::value<uint64_t>()->default_value("1000"))
+      ("updates", "Number of runtime attr updates",
+       cxxopts::value<uint64_t>()->default_value("100000"))
+      ("fetches", "Number of random fetches",
+       cxxopts::value<uint64_t>()->default_value("100000"))
+      ("writers", "Concurrent writers of the client suite",
+       cxxopts::value<uint32_t>()->default_value("8"))
+      ("script-sizes", "Comma separated sizes of the batch script in bytes",
+       cxxopts::value<std::string>()->default_value("512,4096,32768"))
+      ("checkpoint-interval", "CraneEmbeddedDbCheckpointInterval in seconds",
+       cxxopts::value<uint64_t>()->default_value("0"))
+      ("d,dir", "Directory of the db files, cleared before each run",
+       cxxopts::value<std::string>()->default_value("/tmp/embedded_db_bench"))
+      ("log-file", "Log file",
+       cxxopts::value<std::string>()->default_value(
+           "/tmp/embedded_db_bench.log"))
+      ("h,help", "Show help");
+  // clang-format on
+
+  auto parsed = options.parse(argc, argv);
+  if (parsed.count("help")) {
+    fmt::print("{}\n", options.help());
+    return 0;
+  }
+
+  InitLogger(spdlog::level::warn, parsed["log-file"].as<std::string>(), false);
+
+  WorkloadOptions opts{
+      .task_num = parsed["tasks"].as<uint64_t>(),
+      .txn_size = parsed["txn-size"].as<uint64_t>(),
+      .update_num = parsed["updates"].as<uint64_t>(),
+      .fetch_num = parsed["fetches"].as<uint64_t>(),
+      .writer_num = parsed["writers"].as<uint32_t>(),
+      .script_size = 0,
+  };
+  if (opts.task_num == 0 || opts.txn_size == 0 || opts.writer_num == 0) {
+    fmt::print(stderr, "Invalid workload.\n");
+    return 1;
+  }
+
+  std::vector<std::string> backends = CompiledBackends();
+  if (parsed.count("backends")) {
+    std::vector<std::string> selected =
+        absl::StrSplit(parsed["backends"].as<std::string>(), ',');
+    backends = std::move(selected);
+  }
+  std::vector<std::string> suites =
+      absl::StrSplit(parsed["suites"].as<std::string>(), ',');
+
+  std::vector<size_t> script_sizes;
+  for (std::string_view size :
+       absl::StrSplit(parsed["script-sizes"].as<std::string>(), ','))
+    script_sizes.emplace_back(std::stoull(std::string(size)));
+
+  g_config.CraneEmbeddedDbCheckpointInterval =
+      parsed["checkpoint-interval"].as<uint64_t>();
+  g_thread_pool = std::make_unique<BS::thread_pool>(
+      std::thread::hardware_concurrency());
+
+  std::filesystem::path dir = parsed["dir"].as<std::string>();
+  fmt::print("tasks: {}, txn size: {}, updates: {}, writers: {}\n",
+             opts.task_num, opts.txn_size, opts.update_num, opts.writer_num);
+  fmt::print("{:<8} {:<11} {:>8} {:<9} {:>12} {:>10} {:>10} {:>10}\n",
+             "suite", "backend", "script", "phase", "ops/s", "p99 (ms)",
+             "time (ms)", "db (MiB)");
+
+  int rc = 0;
+  for (const auto& suite : suites) {
+    for (const auto& backend : backends) {
+      if (!CreateDb(backend)) {
+        fmt::print(stderr, "Backend {} is not compiled.\n", backend);
+        rc = 1;
+        continue;
+      }
+
+      for (size_t script_size : script_sizes) {
+        opts.script_size = script_size;
+        std::filesystem::remove_all(dir);
+        std::filesystem::create_directories(dir);
+
+        std::optional<SuiteResult> result;
+        if (suite == "backend")
+          result = RunBackendSuite(backend, opts, dir);
+        else if (suite == "client")
+          result = RunClientSuite(backend, opts, dir);
+        else
+          fmt::print(stderr, "Unknown suite {}.\n", suite);
+
+        if (!result) {
+          rc = 1;
+          continue;
+        }
+
+        for (const auto& phase : result->phases)
+          fmt::print(
+              "{:<8} {:<11} {:>8} {:<9} {:>12.0f} {:>10.3f} {:>10.1f} "
+              "{:>10.1f}\n",
+              suite, backend, script_size, phase.name,
+              phase.seconds == 0 ? 0 : phase.ops / phase.seconds,
+              Percentile(phase.latencies_ms, 0.99), phase.seconds * 1000,
+              result->db_size / 1024.0 / 1024.0);
+      }
+    }
+  }
+
+  std::filesystem::remove_all(dir);
+  g_thread_pool->wait();
+  return rc;
+}
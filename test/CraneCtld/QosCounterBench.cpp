@@ -0,0 +1,356 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Offline stress benchmark of the QoS counters under concurrent submitters.
+//
+// The accounts form a tree of --depth levels below one root, each account
+// with --fanout children, and the --users users are spread over the leaf
+// accounts. Each of --threads submitters runs --ops submissions of a random
+// user. A submission reserves 1 to 8 cpus and is released once the submitter
+// holds more than --inflight of them, as if the task had ended.
+//
+// Modes:
+//   resolve: look up the handle of (user, account, qos) for each submission,
+//            as for a newly submitted task, then reserve on it;
+//   cached:  reserve on the handles resolved before, as for the recovered or
+//            rescheduled tasks which keep their handles;
+//   shard:   the former per-user map of shard-locked QoS resources, which
+//            only checks the per-user limits, for comparison.
+//
+// Latencies are per reservation. After each run all the counters must be
+// back to zero, otherwise the run is reported as failed.
+
+#include "CtldPublicDefs.h"
+// Precompiled header comes first!
+
+#include <cxxopts.hpp>
+#include <random>
+
+#include "QosCounter.h"
+#include "crane/Logger.h"
+
+namespace {
+
+using namespace Ctld;
+
+using Clock = std::chrono::steady_clock;
+
+constexpr const char* kBenchQos = "normal";
+
+struct BenchUser {
+  std::string name;
+  std::string account;
+  std::vector<std::string> ancestors;
+};
+
+struct WorkloadOptions {
+  uint32_t depth;
+  uint32_t fanout;
+  uint32_t user_num;
+  uint32_t thread_num;
+  uint64_t op_num;
+  uint32_t inflight;
+  QosLimits limits;
+};
+
+struct RunResult {
+  double ops_per_sec{0};
+  double p99_us{0};
+  uint64_t rejected{0};
+  bool ok{true};
+};
+
+double Percentile(std::vector<double> values, double p) {
+  if (values.empty()) return 0;
+  std::ranges::sort(values);
+  size_t idx = std::min<size_t>(values.size() * p, values.size() - 1);
+  return values[idx];
+}
+
+// The leaf accounts are named by their path, e.g. "a.0.2".
+std::vector<BenchUser> MakeUsers(const WorkloadOptions& opts) {
+  std::vector<std::vector<std::string>> levels{{"a"}};
+  for (uint32_t d = 0; d < opts.depth; d++) {
+    std::vector<std::string> next;
+    for (const auto& parent : levels.back())
+      for (uint32_t i = 0; i < opts.fanout; i++)
+        next.emplace_back(fmt::format("{}.{}", parent, i));
+    levels.emplace_back(std::move(next));
+  }
+
+  const auto& leaves = levels.back();
+  std::vector<BenchUser> users;
+  for (uint32_t i = 0; i < opts.user_num; i++) {
+    BenchUser user{.name = fmt::format("user{}", i),
+                   .account = leaves[i % leaves.size()]};
+    std::string_view path = user.account;
+    for (size_t pos = path.rfind('.'); pos != std::string_view::npos;
+         pos = path.rfind('.')) {
+      path = path.substr(0, pos);
+      user.ancestors.emplace_back(path);
+    }
+    users.emplace_back(std::move(user));
+  }
+  return users;
+}
+
+// Drives reserve(user, cpus) and release(user, cpus) from every submitter and
+// collects the latencies of the reservations.
+template <typename Reserve, typename Release>
+RunResult RunSubmitters(const WorkloadOptions& opts, size_t user_num,
+                        Reserve&& reserve, Release&& release) {
+  std::vector<std::vector<double>> latencies(opts.thread_num);
+  std::atomic<uint64_t> rejected{0};
+
+  auto begin = Clock::now();
+  std::vector<std::thread> threads;
+  for (uint32_t t = 0; t < opts.thread_num; t++) {
+    threads.emplace_back([&, t] {
+      std::mt19937_64 rng(t);
+      std::uniform_int_distribution<size_t> user_dist(0, user_num - 1);
+      std::uniform_int_distribution<int> cpu_dist(1, 8);
+      std::deque<std::pair<size_t, double>> held;
+      latencies[t].reserve(opts.op_num);
+
+      for (uint64_t i = 0; i < opts.op_num; i++) {
+        size_t user = user_dist(rng);
+        double cpus = cpu_dist(rng);
+
+        auto start = Clock::now();
+        bool ok = reserve(user, cpus);
+        latencies[t].emplace_back(
+            std::chrono::duration<double, std::micro>(Clock::now() - start)
+                .count());
+
+        if (!ok) {
+          rejected.fetch_add(1, std::memory_order_relaxed);
+          continue;
+        }
+        held.emplace_back(user, cpus);
+        if (held.size() > opts.inflight) {
+          release(held.front().first, held.front().second);
+          held.pop_front();
+        }
+      }
+      for (const auto& [user, cpus] : held) release(user, cpus);
+    });
+  }
+  for (auto& thread : threads) thread.join();
+  double elapsed = std::chrono::duration<double>(Clock::now() - begin).count();
+
+  std::vector<double> all;
+  for (auto& l : latencies) all.insert(all.end(), l.begin(), l.end());
+
+  RunResult result;
+  result.ops_per_sec = double(all.size()) / elapsed;
+  result.p99_us = Percentile(std::move(all), 0.99);
+  result.rejected = rejected.load();
+  return result;
+}
+
+bool CountersAreZero(const std::vector<std::shared_ptr<const QosCounterHandle>>&
+                         handles) {
+  for (const auto& handle : handles) {
+    if (handle->user_counter->job_num.load() != 0 ||
+        handle->user_counter->cpu_count.load() != 0)
+      return false;
+    for (const auto& counter : handle->account_counters)
+      if (counter->job_num.load() != 0 || counter->cpu_count.load() != 0)
+        return false;
+  }
+  return true;
+}
+
+RunResult RunTree(const WorkloadOptions& opts,
+                  const std::vector<BenchUser>& users, bool cached) {
+  QosCounterTree tree;
+  std::vector<std::shared_ptr<const QosCounterHandle>> handles;
+  for (const auto& user : users)
+    handles.emplace_back(
+        tree.Resolve(user.name, user.account, kBenchQos, user.ancestors));
+
+  auto reserve = [&](size_t user, double cpus) {
+    std::shared_ptr<const QosCounterHandle> handle;
+    if (cached)
+      handle = handles[user];
+    else
+      handle = tree.Find(users[user].name, users[user].account, kBenchQos);
+    return QosCounterTree::TryReserve(*handle, opts.limits, cpus) ==
+           CraneErrCode::SUCCESS;
+  };
+  auto release = [&](size_t user, double cpus) {
+    QosCounterTree::Release(*handles[user], cpus);
+  };
+
+  RunResult result = RunSubmitters(opts, users.size(), reserve, release);
+  result.ok = CountersAreZero(handles);
+  return result;
+}
+
+RunResult RunShard(const WorkloadOptions& opts,
+                   const std::vector<BenchUser>& users) {
+  struct Resource {
+    double cpu_count{0};
+    uint32_t job_num{0};
+  };
+  using QosToResourceMap = std::unordered_map<std::string, Resource>;
+  using UserMap = phmap::parallel_flat_hash_map<
+      std::string, QosToResourceMap,
+      phmap::priv::hash_default_hash<std::string>,
+      phmap::priv::hash_default_eq<std::string>,
+      std::allocator<std::pair<const std::string, QosToResourceMap>>, 4,
+      std::shared_mutex>;
+  UserMap user_map;
+
+  auto reserve = [&](size_t user, double cpus) {
+    bool ok = true;
+    user_map.try_emplace_l(
+        users[user].name,
+        [&](std::pair<const std::string, QosToResourceMap>& pair) {
+          auto& val = pair.second[kBenchQos];
+          if (val.cpu_count + cpus > opts.limits.max_cpus_per_user ||
+              val.job_num + 1 > opts.limits.max_jobs_per_user) {
+            ok = false;
+            return;
+          }
+          val.cpu_count += cpus;
+          val.job_num++;
+        },
+        QosToResourceMap{{kBenchQos, Resource{cpus, 1}}});
+    return ok;
+  };
+  auto release = [&](size_t user, double cpus) {
+    user_map.modify_if(
+        users[user].name,
+        [&](std::pair<const std::string, QosToResourceMap>& pair) {
+          auto& val = pair.second[kBenchQos];
+          val.cpu_count -= cpus;
+          val.job_num--;
+        });
+  };
+
+  RunResult result = RunSubmitters(opts, users.size(), reserve, release);
+  user_map.for_each([&](const auto& pair) {
+    for (const auto& [qos, val] : pair.second)
+      if (val.cpu_count != 0 || val.job_num != 0) result.ok = false;
+  });
+  return result;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  cxxopts::Options options("qos_counter_bench",
+                           "Stress the QoS counters with many submitters");
+
+  // clang-format off
+  options.add_options()
+      ("m,modes", "Comma separated modes: resolve, cached, shard",
+       cxxopts::value<std::string>()->default_value("resolve,cached,shard"))
+      ("t,threads", "Comma separated numbers of submitters",
+       cxxopts::value<std::string>()->default_value("1,4,16,64"))
+      ("n,ops", "Submissions per submitter",
+       cxxopts::value<uint64_t>()->default_value("200000"))
+      ("users", "Number of users",
+       cxxopts::value<uint32_t>()->default_value("1000"))
+      ("depth", "Levels of accounts below the root",
+       cxxopts::value<uint32_t>()->default_value("3"))
+      ("fanout", "Children of each account",
+       cxxopts::value<uint32_t>()->default_value("4"))
+      ("inflight", "Reservations held by each submitter",
+       cxxopts::value<uint32_t>()->default_value("64"))
+      ("max-jobs-per-user", "MaxJobsPerUser of the QoS",
+       cxxopts::value<uint32_t>()->default_value("16"))
+      ("max-cpus-per-user", "MaxCpusPerUser of the QoS",
+       cxxopts::value<uint32_t>()->default_value("64"))
+      ("max-cpus-per-account", "MaxCpusPerAccount of the QoS",
+       cxxopts::value<uint32_t>()->default_value("4096"))
+      ("log-file", "Log file",
+       cxxopts::value<std::string>()->default_value(
+           "/tmp/qos_counter_bench.log"))
+      ("h,help", "Show help");
+  // clang-format on
+
+  auto parsed = options.parse(argc, argv);
+  if (parsed.count("help")) {
+    fmt::print("{}\n", options.help());
+    return 0;
+  }
+
+  InitLogger(spdlog::level::warn, parsed["log-file"].as<std::string>(), false);
+
+  WorkloadOptions opts{
+      .depth = parsed["depth"].as<uint32_t>(),
+      .fanout = parsed["fanout"].as<uint32_t>(),
+      .user_num = parsed["users"].as<uint32_t>(),
+      .thread_num = 0,
+      .op_num = parsed["ops"].as<uint64_t>(),
+      .inflight = parsed["inflight"].as<uint32_t>(),
+      .limits =
+          QosLimits{
+              .max_jobs_per_user = parsed["max-jobs-per-user"].as<uint32_t>(),
+              .max_cpus_per_user =
+                  double(parsed["max-cpus-per-user"].as<uint32_t>()),
+              .max_cpus_per_account =
+                  double(parsed["max-cpus-per-account"].as<uint32_t>())},
+  };
+  if (opts.user_num == 0 || opts.fanout == 0 || opts.op_num == 0) {
+    fmt::print(stderr, "Invalid workload.\n");
+    return 1;
+  }
+
+  std::vector<std::string> modes =
+      absl::StrSplit(parsed["modes"].as<std::string>(), ',');
+  std::vector<uint32_t> thread_nums;
+  for (std::string_view num :
+       absl::StrSplit(parsed["threads"].as<std::string>(), ','))
+    thread_nums.emplace_back(std::stoul(std::string(num)));
+
+  std::vector<BenchUser> users = MakeUsers(opts);
+  fmt::print("users: {}, depth: {}, fanout: {}, ops per submitter: {}\n",
+             opts.user_num, opts.depth, opts.fanout, opts.op_num);
+  fmt::print("{:<8} {:>8} {:>12} {:>10} {:>10}\n", "mode", "threads",
+             "ops/s", "p99 (us)", "rejected");
+
+  int rc = 0;
+  for (const auto& mode : modes) {
+    for (uint32_t thread_num : thread_nums) {
+      if (thread_num == 0) continue;
+      opts.thread_num = thread_num;
+
+      RunResult result;
+      if (mode == "resolve")
+        result = RunTree(opts, users, false);
+      else if (mode == "cached")
+        result = RunTree(opts, users, true);
+      else if (mode == "shard")
+        result = RunShard(opts, users);
+      else {
+        fmt::print(stderr, "Unknown mode {}.\n", mode);
+        return 1;
+      }
+
+      fmt::print("{:<8} {:>8} {:>12.0f} {:>10.2f} {:>10}{}\n", mode,
+                 thread_num, result.ops_per_sec, result.p99_us,
+                 result.rejected, result.ok ? "" : " FAILED");
+      if (!result.ok) rc = 1;
+    }
+  }
+
+  return rc;
+}
@@ -0,0 +1,226 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Offline lock benchmark of the running task map of TaskScheduler.
+//
+// A writer applies --changes status changes to a map of --tasks running
+// tasks, as CleanTaskStatusChangeQueueCb_ does for a burst of ended tasks.
+// Each change erases the task and does --work-ns of other work under the
+// lock, which stands for freeing the resources of the task. Meanwhile a
+// selector takes the shared lock of the whole map every --select-interval-us
+// and holds it for --select-us, as node selection does, and a querier looks
+// up single tasks, as the query RPCs do. The waits of the selector and the
+// querier for the lock are reported.
+//
+// Modes:
+//   whole:   the batch is applied under one hold of the lock;
+//   chunked: the lock is released every --chunk changes, which is what
+//            TaskScheduler does with kTaskStatusChangeLockChunkNum;
+//   sharded: the map is split into --shards maps by task id. The writer
+//            holds one shard at a time, the selector locks all the shards
+//            for a consistent view and the querier the shard of its task.
+
+#include <absl/container/flat_hash_map.h>
+#include <absl/synchronization/mutex.h>
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cxxopts.hpp>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Task {
+  uint32_t id;
+  std::array<uint64_t, 16> fields{};
+};
+
+struct Options {
+  uint32_t task_num;
+  uint32_t change_num;
+  uint32_t chunk;
+  uint32_t shard_num;
+  uint32_t work_ns;
+  uint32_t select_us;
+  uint32_t select_interval_us;
+};
+
+// One map and its lock. The whole and chunked modes use a single shard.
+struct Shard {
+  absl::Mutex mtx;
+  absl::flat_hash_map<uint32_t, std::unique_ptr<Task>> tasks;
+};
+
+void SpinFor(std::chrono::nanoseconds duration) {
+  auto end = Clock::now() + duration;
+  while (Clock::now() < end) {
+  }
+}
+
+struct WaitStats {
+  std::vector<int64_t> waits_us;
+
+  void Add(Clock::duration wait) {
+    waits_us.emplace_back(
+        std::chrono::duration_cast<std::chrono::microseconds>(wait).count());
+  }
+
+  std::string Summary() {
+    if (waits_us.empty()) return "none";
+    std::ranges::sort(waits_us);
+    auto at = [this](double q) {
+      return waits_us[static_cast<size_t>(q * (waits_us.size() - 1))];
+    };
+    return fmt::format("n={} p50={}us p99={}us max={}us", waits_us.size(),
+                       at(0.5), at(0.99), waits_us.back());
+  }
+};
+
+void RunMode(const std::string& mode, const Options& opts) {
+  uint32_t shard_num = mode == "sharded" ? opts.shard_num : 1;
+  std::vector<Shard> shards(shard_num);
+  for (uint32_t id = 0; id < opts.task_num; ++id)
+    shards[id % shard_num].tasks.emplace(
+        id, std::make_unique<Task>(Task{.id = id}));
+
+  // The ended tasks, in random order like the status changes of craneds.
+  std::vector<uint32_t> ended(opts.task_num);
+  for (uint32_t id = 0; id < opts.task_num; ++id) ended[id] = id;
+  std::mt19937 rng(1);
+  std::ranges::shuffle(ended, rng);
+  ended.resize(std::min(opts.change_num, opts.task_num));
+
+  std::atomic_bool done{false};
+  WaitStats select_stats;
+  WaitStats query_stats;
+
+  std::thread selector([&] {
+    while (!done.load(std::memory_order_acquire)) {
+      auto begin = Clock::now();
+      for (Shard& shard : shards) shard.mtx.ReaderLock();
+      select_stats.Add(Clock::now() - begin);
+      SpinFor(std::chrono::microseconds(opts.select_us));
+      for (Shard& shard : shards) shard.mtx.ReaderUnlock();
+      std::this_thread::sleep_for(
+          std::chrono::microseconds(opts.select_interval_us));
+    }
+  });
+
+  std::thread querier([&] {
+    std::mt19937 query_rng(2);
+    while (!done.load(std::memory_order_acquire)) {
+      uint32_t id = query_rng() % opts.task_num;
+      Shard& shard = shards[id % shard_num];
+      auto begin = Clock::now();
+      {
+        absl::ReaderMutexLock lock(&shard.mtx);
+        query_stats.Add(Clock::now() - begin);
+        auto it = shard.tasks.find(id);
+        if (it != shard.tasks.end()) SpinFor(std::chrono::nanoseconds(200));
+      }
+      std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+  });
+
+  // Let the readers start.
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+  auto apply = [&](Shard& shard, uint32_t id) {
+    shard.tasks.erase(id);
+    SpinFor(std::chrono::nanoseconds(opts.work_ns));
+  };
+
+  auto write_begin = Clock::now();
+  if (mode == "sharded") {
+    std::vector<std::vector<uint32_t>> shard_ids(shard_num);
+    for (uint32_t id : ended) shard_ids[id % shard_num].emplace_back(id);
+    for (uint32_t i = 0; i < shard_num; ++i) {
+      absl::MutexLock lock(&shards[i].mtx);
+      for (uint32_t id : shard_ids[i]) apply(shards[i], id);
+    }
+  } else {
+    size_t chunk = mode == "chunked" ? opts.chunk : ended.size();
+    for (size_t begin = 0; begin < ended.size(); begin += chunk) {
+      absl::MutexLock lock(&shards[0].mtx);
+      size_t end = std::min(begin + chunk, ended.size());
+      for (size_t i = begin; i < end; ++i) apply(shards[0], ended[i]);
+    }
+  }
+  auto write_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                      Clock::now() - write_begin)
+                      .count();
+
+  // Let the readers see the map after the burst too.
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  done.store(true, std::memory_order_release);
+  selector.join();
+  querier.join();
+
+  fmt::print("{:8} writer {} ms\n", mode, write_ms);
+  fmt::print("{:8} selector wait {}\n", "", select_stats.Summary());
+  fmt::print("{:8} query wait {}\n", "", query_stats.Summary());
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  cxxopts::Options options("running_map_lock_bench",
+                           "Lock waits of the running task map under a burst "
+                           "of status changes");
+  // clang-format off
+  options.add_options()
+      ("tasks", "Running tasks", cxxopts::value<uint32_t>()->default_value("200000"))
+      ("changes", "Status changes in the burst", cxxopts::value<uint32_t>()->default_value("20000"))
+      ("chunk", "Changes per lock hold in the chunked mode", cxxopts::value<uint32_t>()->default_value("1000"))
+      ("shards", "Shards in the sharded mode", cxxopts::value<uint32_t>()->default_value("16"))
+      ("work-ns", "Other work of a change", cxxopts::value<uint32_t>()->default_value("2000"))
+      ("select-us", "Hold time of a node selection", cxxopts::value<uint32_t>()->default_value("2000"))
+      ("select-interval-us", "Pause between node selections", cxxopts::value<uint32_t>()->default_value("1000"))
+      ("mode", "whole, chunked, sharded or all", cxxopts::value<std::string>()->default_value("all"))
+      ("h,help", "Print help");
+  // clang-format on
+
+  auto parsed = options.parse(argc, argv);
+  if (parsed.count("help")) {
+    fmt::print("{}\n", options.help());
+    return 0;
+  }
+
+  Options opts{
+      .task_num = parsed["tasks"].as<uint32_t>(),
+      .change_num = parsed["changes"].as<uint32_t>(),
+      .chunk = std::max(parsed["chunk"].as<uint32_t>(), 1u),
+      .shard_num = std::max(parsed["shards"].as<uint32_t>(), 1u),
+      .work_ns = parsed["work-ns"].as<uint32_t>(),
+      .select_us = parsed["select-us"].as<uint32_t>(),
+      .select_interval_us = parsed["select-interval-us"].as<uint32_t>()};
+
+  std::string mode = parsed["mode"].as<std::string>();
+  for (const char* m : {"whole", "chunked", "sharded"})
+    if (mode == "all" || mode == m) RunMode(m, opts);
+  return 0;
+}
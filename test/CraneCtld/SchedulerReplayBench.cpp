@@ -0,0 +1,430 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Offline benchmark of node selection.
+//
+// A synthetic cluster is built in g_meta_container and a job trace is replayed
+// through the priority sorters and MinLoadFirst, without gRPC, craned or any
+// database. Each scheduling cycle submits the jobs of the cycle, ends the
+// jobs whose run time is over and runs one NodeSelect().
+//
+// Trace file format (one job per line, `#` starts a comment):
+//   submit_cycle,partition,node_num,cpu,mem_mb,gpu,time_limit_sec,run_cycles
+// A trace is generated from --seed if no trace file is given.
+
+#include "CtldPublicDefs.h"
+// Precompiled header comes first!
+
+#include <sys/resource.h>
+
+#include <cxxopts.hpp>
+#include <random>
+
+#include "CranedMetaContainer.h"
+#include "SchedulerStats.h"
+#include "TaskScheduler.h"
+#include "crane/Logger.h"
+
+namespace {
+
+using namespace Ctld;
+
+struct TraceJob {
+  uint64_t submit_cycle;
+  PartitionId partition;
+  uint32_t node_num;
+  double cpu;
+  uint64_t mem_bytes;
+  uint32_t gpu;
+  int64_t time_limit_sec;
+  uint64_t run_cycles;
+};
+
+struct ClusterOptions {
+  uint32_t node_num;
+  uint32_t partition_num;
+  uint32_t cpu_per_node;
+  uint64_t mem_per_node;
+  double gpu_node_ratio;
+  uint32_t gpu_per_node;
+};
+
+constexpr uint64_t kMiB = 1024 * 1024;
+constexpr uint64_t kGiB = 1024 * kMiB;
+
+std::string NodeName(uint32_t i) { return fmt::format("bench{:05}", i); }
+std::string PartitionName(uint32_t i) { return fmt::format("part{}", i); }
+
+void BuildCluster(const ClusterOptions& opts) {
+  std::mt19937_64 rng(0);
+  std::bernoulli_distribution has_gpu(opts.gpu_node_ratio);
+
+  for (uint32_t i = 0; i < opts.node_num; i++) {
+    auto node = std::make_shared<Config::Node>();
+    node->cpu = opts.cpu_per_node;
+    node->memory_bytes = opts.mem_per_node;
+    if (has_gpu(rng)) {
+      auto& slots = node->dedicated_resource["gpu"]["a100"];
+      for (uint32_t j = 0; j < opts.gpu_per_node; j++)
+        slots.emplace(fmt::format("/dev/nvidia{}", j));
+    }
+    g_config.Nodes.emplace(NodeName(i), std::move(node));
+  }
+
+  // Partitions are contiguous slices of the nodes.
+  for (uint32_t p = 0; p < opts.partition_num; p++) {
+    Config::Partition part;
+    uint32_t begin = uint64_t(opts.node_num) * p / opts.partition_num;
+    uint32_t end = uint64_t(opts.node_num) * (p + 1) / opts.partition_num;
+    for (uint32_t i = begin; i < end; i++) part.nodes.emplace(NodeName(i));
+    part.nodelist_str =
+        fmt::format("{}-{}", NodeName(begin), NodeName(end - 1));
+    g_config.Partitions.emplace(PartitionName(p), std::move(part));
+  }
+
+  g_meta_container = std::make_unique<CranedMetaContainer>();
+  g_meta_container->InitFromConfig(g_config);
+  for (uint32_t i = 0; i < opts.node_num; i++)
+    g_meta_container->CranedUp(NodeName(i), crane::grpc::CranedRemoteMeta{});
+}
+
+std::vector<TraceJob> GenerateTrace(const ClusterOptions& opts,
+                                    uint64_t job_num, uint64_t cycle_num,
+                                    uint64_t seed) {
+  std::mt19937_64 rng(seed);
+  std::uniform_int_distribution<uint64_t> submit_cycle(0, cycle_num / 2);
+  std::uniform_int_distribution<uint32_t> partition(0, opts.partition_num - 1);
+  std::discrete_distribution<uint32_t> node_num({0, 80, 10, 0, 6, 0, 0, 0, 4});
+  std::uniform_int_distribution<uint32_t> cpu(1, opts.cpu_per_node / 2);
+  std::uniform_int_distribution<uint64_t> mem_gb(
+      1, std::max<uint64_t>(opts.mem_per_node / kGiB / 4, 1));
+  std::bernoulli_distribution use_gpu(opts.gpu_node_ratio / 2);
+  std::uniform_int_distribution<uint32_t> gpu(1, opts.gpu_per_node);
+  std::uniform_int_distribution<int64_t> time_limit_min(10, 24 * 60);
+  std::uniform_int_distribution<uint64_t> run_cycles(1, cycle_num / 4 + 1);
+
+  std::vector<TraceJob> trace;
+  trace.reserve(job_num);
+  for (uint64_t i = 0; i < job_num; i++) {
+    trace.emplace_back(TraceJob{
+        .submit_cycle = submit_cycle(rng),
+        .partition = PartitionName(partition(rng)),
+        .node_num = node_num(rng),
+        .cpu = double(cpu(rng)),
+        .mem_bytes = mem_gb(rng) * kGiB,
+        .gpu = use_gpu(rng) ? gpu(rng) : 0,
+        .time_limit_sec = time_limit_min(rng) * 60,
+        .run_cycles = run_cycles(rng),
+    });
+  }
+  return trace;
+}
+
+std::optional<std::vector<TraceJob>> LoadTrace(const std::string& path) {
+  std::ifstream file(path);
+  if (!file) {
+    fmt::print(stderr, "Failed to open trace file {}\n", path);
+    return std::nullopt;
+  }
+
+  std::vector<TraceJob> trace;
+  std::string line;
+  for (uint64_t line_no = 1; std::getline(file, line); line_no++) {
+    line = line.substr(0, line.find('#'));
+    absl::StripAsciiWhitespace(&line);
+    if (line.empty()) continue;
+
+    std::vector<std::string> fields = absl::StrSplit(line, ',');
+    if (fields.size() != 8) {
+      fmt::print(stderr, "{}:{}: expected 8 fields but got {}\n", path,
+                 line_no, fields.size());
+      return std::nullopt;
+    }
+
+    try {
+      trace.emplace_back(TraceJob{
+          .submit_cycle = std::stoull(fields[0]),
+          .partition = fields[1],
+          .node_num = uint32_t(std::stoul(fields[2])),
+          .cpu = std::stod(fields[3]),
+          .mem_bytes = std::stoull(fields[4]) * kMiB,
+          .gpu = uint32_t(std::stoul(fields[5])),
+          .time_limit_sec = std::stoll(fields[6]),
+          .run_cycles = std::stoull(fields[7]),
+      });
+    } catch (const std::exception& e) {
+      fmt::print(stderr, "{}:{}: {}\n", path, line_no, e.what());
+      return std::nullopt;
+    }
+
+    if (!g_config.Partitions.contains(trace.back().partition)) {
+      fmt::print(stderr, "{}:{}: unknown partition {}\n", path, line_no,
+                 trace.back().partition);
+      return std::nullopt;
+    }
+  }
+
+  return trace;
+}
+
+std::unique_ptr<TaskInCtld> MakeTask(const TraceJob& job, task_id_t task_id) {
+  auto task = std::make_unique<TaskInCtld>();
+
+  crane::grpc::ResourceView req;
+  req.mutable_allocatable_res()->set_cpu_core_limit(job.cpu);
+  req.mutable_allocatable_res()->set_memory_limit_bytes(job.mem_bytes);
+  req.mutable_allocatable_res()->set_memory_sw_limit_bytes(job.mem_bytes);
+  if (job.gpu > 0)
+    (*req.mutable_device_map()->mutable_name_type_map())["gpu"].set_total(
+        job.gpu);
+
+  task->type = crane::grpc::Batch;
+  task->partition_id = job.partition;
+  task->requested_node_res_view = static_cast<ResourceView>(req);
+  task->time_limit = absl::Seconds(job.time_limit_sec);
+  task->node_num = job.node_num;
+  task->ntasks_per_node = 1;
+  task->cpus_per_task = cpu_t(job.cpu);
+  task->account = fmt::format("account{}", task_id % 16);
+  task->SetTaskId(task_id);
+  task->SetSubmitTime(absl::Now());
+  task->SetStatus(crane::grpc::Pending);
+
+  return task;
+}
+
+uint64_t MaxRssKiB() {
+  struct rusage usage{};
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+double Percentile(std::vector<double> values, double p) {
+  if (values.empty()) return 0;
+  std::ranges::sort(values);
+  size_t idx = std::min<size_t>(values.size() * p, values.size() - 1);
+  return values[idx];
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  cxxopts::Options options("scheduler_replay_bench",
+                           "Replay a job trace through node selection");
+
+  // clang-format off
+  options.add_options()
+      ("n,nodes", "Number of nodes",
+       cxxopts::value<uint32_t>()->default_value("1000"))
+      ("p,partitions", "Number of partitions",
+       cxxopts::value<uint32_t>()->default_value("4"))
+      ("cpu", "CPU cores per node",
+       cxxopts::value<uint32_t>()->default_value("64"))
+      ("mem-gb", "Memory per node in GiB",
+       cxxopts::value<uint64_t>()->default_value("256"))
+      ("gpu-node-ratio", "Ratio of nodes with GPUs",
+       cxxopts::value<double>()->default_value("0.1"))
+      ("gpu", "GPUs per GPU node",
+       cxxopts::value<uint32_t>()->default_value("8"))
+      ("j,jobs", "Number of generated jobs",
+       cxxopts::value<uint64_t>()->default_value("20000"))
+      ("c,cycles", "Maximum number of scheduling cycles",
+       cxxopts::value<uint64_t>()->default_value("200"))
+      ("t,trace", "Trace file to replay instead of a generated one",
+       cxxopts::value<std::string>())
+      ("seed", "Seed of the generated trace",
+       cxxopts::value<uint64_t>()->default_value("1"))
+      ("priority", "Priority sorter: basic or multifactor",
+       cxxopts::value<std::string>()->default_value("multifactor"))
+      ("batch-size", "ScheduledBatchSize",
+       cxxopts::value<uint32_t>()->default_value("100000"))
+      ("parallel", "Enable ParallelNodeSelection")
+      ("budget-ms", "ScheduleCycleBudgetMs, 0 for no budget",
+       cxxopts::value<uint32_t>()->default_value("0"))
+      ("log-file", "Log file",
+       cxxopts::value<std::string>()->default_value(
+           "/tmp/scheduler_replay_bench.log"))
+      ("h,help", "Show help");
+  // clang-format on
+
+  auto parsed = options.parse(argc, argv);
+  if (parsed.count("help")) {
+    fmt::print("{}\n", options.help());
+    return 0;
+  }
+
+  InitLogger(spdlog::level::warn, parsed["log-file"].as<std::string>(), false);
+
+  ClusterOptions cluster{
+      .node_num = parsed["nodes"].as<uint32_t>(),
+      .partition_num = parsed["partitions"].as<uint32_t>(),
+      .cpu_per_node = parsed["cpu"].as<uint32_t>(),
+      .mem_per_node = parsed["mem-gb"].as<uint64_t>() * kGiB,
+      .gpu_node_ratio = parsed["gpu-node-ratio"].as<double>(),
+      .gpu_per_node = parsed["gpu"].as<uint32_t>(),
+  };
+  if (cluster.node_num == 0 || cluster.partition_num == 0 ||
+      cluster.partition_num > cluster.node_num || cluster.cpu_per_node < 2) {
+    fmt::print(stderr, "Invalid cluster size.\n");
+    return 1;
+  }
+  uint64_t cycle_num = parsed["cycles"].as<uint64_t>();
+
+  g_config.ScheduledBatchSize = parsed["batch-size"].as<uint32_t>();
+  g_config.ParallelNodeSelection = parsed.count("parallel") > 0;
+  g_config.ScheduleCycleBudgetMs = parsed["budget-ms"].as<uint32_t>();
+  g_config.PriorityConfig.MaxAge = 7 * 24 * 3600;
+  g_config.PriorityConfig.WeightAge = 1000;
+  g_config.PriorityConfig.WeightFairShare = 1000;
+  g_config.PriorityConfig.WeightJobSize = 1000;
+  g_config.PriorityConfig.WeightPartition = 0;
+  g_config.PriorityConfig.WeightQOS = 0;
+
+  g_thread_pool = std::make_unique<BS::thread_pool>(
+      std::thread::hardware_concurrency());
+  g_scheduler_stats = std::make_unique<SchedulerStats>();
+
+  BuildCluster(cluster);
+
+  std::vector<TraceJob> trace;
+  if (parsed.count("trace")) {
+    auto loaded = LoadTrace(parsed["trace"].as<std::string>());
+    if (!loaded) return 1;
+    trace = std::move(loaded.value());
+  } else {
+    trace = GenerateTrace(cluster, parsed["jobs"].as<uint64_t>(), cycle_num,
+                          parsed["seed"].as<uint64_t>());
+  }
+  std::ranges::stable_sort(trace, {}, &TraceJob::submit_cycle);
+
+  std::unique_ptr<IPrioritySorter> sorter;
+  if (parsed["priority"].as<std::string>() == "basic")
+    sorter = std::make_unique<BasicPriority>();
+  else
+    sorter = std::make_unique<MultiFactorPriority>();
+  MinLoadFirst algo(sorter.get());
+
+  OrderedTaskMap pending_task_map;
+  UnorderedTaskMap running_task_map;
+  std::multimap<uint64_t /*end cycle*/, task_id_t> end_cycle_task_map;
+
+  std::vector<double> cycle_ms;
+  uint64_t started_job_num = 0;
+  uint64_t finished_job_num = 0;
+  double total_select_sec = 0;
+  size_t trace_pos = 0;
+  task_id_t next_task_id = 1;
+
+  auto bench_begin = std::chrono::steady_clock::now();
+  for (uint64_t cycle = 0; cycle < cycle_num; cycle++) {
+    for (; trace_pos < trace.size() && trace[trace_pos].submit_cycle <= cycle;
+         trace_pos++) {
+      auto task = MakeTask(trace[trace_pos], next_task_id++);
+      sorter->OnPendingTaskAdded(*task);
+      pending_task_map.emplace(task->TaskId(), std::move(task));
+    }
+
+    while (!end_cycle_task_map.empty() &&
+           end_cycle_task_map.begin()->first <= cycle) {
+      task_id_t task_id = end_cycle_task_map.begin()->second;
+      end_cycle_task_map.erase(end_cycle_task_map.begin());
+
+      auto it = running_task_map.find(task_id);
+      CranedMetaContainer::HashMap<CranedId, std::vector<task_id_t>>
+          craned_task_ids_map;
+      for (const CranedId& craned_id : it->second->CranedIds())
+        craned_task_ids_map[craned_id].emplace_back(task_id);
+      g_meta_container->FreeResourceFromNodes(craned_task_ids_map);
+      sorter->OnRunningTaskRemoved(task_id);
+      running_task_map.erase(it);
+      finished_job_num++;
+    }
+
+    if (pending_task_map.empty()) {
+      if (trace_pos == trace.size() && running_task_map.empty()) break;
+      continue;
+    }
+
+    std::vector<INodeSelectionAlgo::SelectedTask> selected_tasks;
+    auto begin = std::chrono::steady_clock::now();
+    algo.NodeSelect(running_task_map, pending_task_map, &selected_tasks);
+    auto end = std::chrono::steady_clock::now();
+
+    g_scheduler_stats->Record(SchedulerStats::Phase::NodeSelect, end - begin);
+    cycle_ms.emplace_back(
+        std::chrono::duration<double, std::milli>(end - begin).count());
+    total_select_sec += std::chrono::duration<double>(end - begin).count();
+
+    absl::Time now = absl::Now();
+    for (auto& selected : selected_tasks) {
+      auto node = pending_task_map.extract(selected.task_id);
+      auto& task = node.mapped();
+      sorter->OnPendingTaskRemoved(selected.task_id);
+
+      task->SetStatus(crane::grpc::Running);
+      task->SetStartTime(now);
+      task->SetCranedIds(std::move(selected.craned_ids));
+
+      uint64_t run_cycles =
+          std::max<uint64_t>(trace[selected.task_id - 1].run_cycles, 1);
+      end_cycle_task_map.emplace(cycle + run_cycles, selected.task_id);
+
+      sorter->OnRunningTaskAdded(*task);
+      running_task_map.emplace(selected.task_id, std::move(task));
+    }
+    started_job_num += selected_tasks.size();
+  }
+  auto bench_end = std::chrono::steady_clock::now();
+
+  auto stats = g_scheduler_stats->QuerySchedulerStats();
+  uint64_t sort_us = 0;
+  uint64_t sort_count = 0;
+  for (const auto& latency : stats.phase_latencies()) {
+    if (latency.phase() != SchedulerStats::PhaseName(
+                               SchedulerStats::Phase::PrioritySort))
+      continue;
+    sort_us = latency.sum_us();
+    sort_count = latency.count();
+  }
+
+  fmt::print("nodes: {}, partitions: {}, jobs in trace: {}\n",
+             cluster.node_num, cluster.partition_num, trace.size());
+  fmt::print("cycles: {}, wall time: {:.3f} s\n", cycle_ms.size(),
+             std::chrono::duration<double>(bench_end - bench_begin).count());
+  fmt::print(
+      "node selection: avg {:.3f} ms, p50 {:.3f} ms, p99 {:.3f} ms, "
+      "max {:.3f} ms\n",
+      cycle_ms.empty() ? 0 : total_select_sec * 1000 / cycle_ms.size(),
+      Percentile(cycle_ms, 0.5), Percentile(cycle_ms, 0.99),
+      Percentile(cycle_ms, 1));
+  fmt::print("priority sort: avg {:.3f} ms\n",
+             sort_count == 0 ? 0 : double(sort_us) / 1000 / sort_count);
+  fmt::print("tasks evaluated per cycle: {:.1f}, budget hits: {}\n",
+             cycle_ms.empty()
+                 ? 0
+                 : double(stats.evaluated_task_count()) / cycle_ms.size(),
+             stats.budget_hit_count());
+  fmt::print("jobs started: {}, finished: {}, still pending: {}\n",
+             started_job_num, finished_job_num, pending_task_map.size());
+  fmt::print("jobs started per second of node selection: {:.1f}\n",
+             total_select_sec == 0 ? 0 : started_job_num / total_select_sec);
+  fmt::print("max rss: {:.1f} MiB\n", MaxRssKiB() / 1024.0);
+
+  g_thread_pool->wait();
+  return 0;
+}
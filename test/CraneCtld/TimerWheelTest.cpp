@@ -0,0 +1,108 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <random>
+
+#include "TimerWheel.h"
+
+using Ctld::TimerWheel;
+
+TEST(TimerWheel, ExpireInOrderOfDeadline) {
+  TimerWheel wheel(1000);
+  wheel.Schedule(1, 1003);
+  wheel.Schedule(2, 1000 + 100);
+  wheel.Schedule(3, 1000 + 10000);
+
+  std::vector<task_id_t> expired;
+  wheel.Advance(1002, &expired);
+  EXPECT_TRUE(expired.empty());
+
+  wheel.Advance(1003, &expired);
+  EXPECT_EQ(expired, std::vector<task_id_t>{1});
+
+  expired.clear();
+  wheel.Advance(1099, &expired);
+  EXPECT_TRUE(expired.empty());
+  wheel.Advance(1100, &expired);
+  EXPECT_EQ(expired, std::vector<task_id_t>{2});
+
+  expired.clear();
+  wheel.Advance(11000, &expired);
+  EXPECT_EQ(expired, std::vector<task_id_t>{3});
+  EXPECT_EQ(wheel.Size(), 0);
+}
+
+TEST(TimerWheel, CancelAndReschedule) {
+  TimerWheel wheel(0);
+  wheel.Schedule(1, 10);
+  wheel.Schedule(2, 10);
+  EXPECT_TRUE(wheel.Cancel(1));
+  EXPECT_FALSE(wheel.Cancel(1));
+
+  // A deadline in the past expires at the next tick.
+  wheel.Schedule(2, -5);
+
+  std::vector<task_id_t> expired;
+  wheel.Advance(1, &expired);
+  EXPECT_EQ(expired, std::vector<task_id_t>{2});
+
+  expired.clear();
+  wheel.Advance(100, &expired);
+  EXPECT_TRUE(expired.empty());
+}
+
+TEST(TimerWheel, MatchSortedDeadlines) {
+  std::mt19937_64 rng(42);
+  int64_t now = 1700000000;
+  TimerWheel wheel(now);
+  std::unordered_map<task_id_t, int64_t> deadlines;
+
+  for (int i = 0; i < 200000; i++) {
+    auto id = static_cast<task_id_t>(rng() % 5000);
+    switch (rng() % 4) {
+    case 0: {
+      // Spread the deadlines over all the levels.
+      int64_t span = int64_t{1} << (rng() % 26);
+      int64_t deadline = now + static_cast<int64_t>(rng() % span);
+      wheel.Schedule(id, deadline);
+      deadlines[id] = std::max(deadline, now + 1);
+      break;
+    }
+    case 1:
+      EXPECT_EQ(wheel.Cancel(id), deadlines.erase(id) == 1);
+      break;
+    default: {
+      now += (rng() % 100 == 0) ? rng() % 100000 : rng() % 3;
+      std::vector<task_id_t> expired;
+      wheel.Advance(now, &expired);
+
+      std::vector<task_id_t> expected;
+      for (const auto& [task_id, deadline] : deadlines)
+        if (deadline <= now) expected.emplace_back(task_id);
+      for (task_id_t task_id : expected) deadlines.erase(task_id);
+
+      std::ranges::sort(expired);
+      std::ranges::sort(expected);
+      ASSERT_EQ(expired, expected) << "at " << now;
+    }
+    }
+    ASSERT_EQ(wheel.Size(), deadlines.size());
+  }
+}
@@ -0,0 +1,116 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Offline benchmark of the host list utilities.
+//
+// Expands --hosts with ParseHostList() and HostList::Parse(), compresses the
+// names back with HostNameListToStr() on both the HostList path and the old
+// path, and looks every name up with HostList::Contains(). Each step is run
+// once and checked against the others.
+
+#include <fmt/format.h>
+
+#include <chrono>
+#include <cxxopts.hpp>
+#include <list>
+#include <string>
+
+#include "crane/String.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double SecondsSince(Clock::time_point begin) {
+  return std::chrono::duration<double>(Clock::now() - begin).count();
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  cxxopts::Options options("host_list_bench",
+                           "Measure parsing and compressing host lists");
+
+  // clang-format off
+  options.add_options()
+      ("H,hosts", "Host list to expand and compress",
+       cxxopts::value<std::string>()->default_value(
+           "cn[00001-10000],gpu[001-512]"))
+      ("h,help", "Show help");
+  // clang-format on
+
+  auto parsed = options.parse(argc, argv);
+  if (parsed.count("help")) {
+    fmt::print("{}\n", options.help());
+    return 0;
+  }
+
+  std::string host_list = parsed["hosts"].as<std::string>();
+  bool ok = true;
+  auto check = [&](bool cond, const char* what) {
+    if (!cond) {
+      fmt::print(stderr, "Mismatch: {}\n", what);
+      ok = false;
+    }
+  };
+
+  std::list<std::string> parsed_list;
+  Clock::time_point begin = Clock::now();
+  if (!util::ParseHostList(host_list, &parsed_list)) {
+    fmt::print(stderr, "Invalid host list {}.\n", host_list);
+    return 1;
+  }
+  fmt::print("{:<32} {:>10.6f}s\n", "ParseHostList", SecondsSince(begin));
+
+  util::HostList hosts;
+  begin = Clock::now();
+  check(util::HostList::Parse(host_list, &hosts), "HostList::Parse");
+  fmt::print("{:<32} {:>10.6f}s\n", "HostList::Parse", SecondsSince(begin));
+  check(hosts.Size() == parsed_list.size(), "host number");
+
+  // Takes the old path of HostNameListToStr_() with one name it refuses.
+  std::list<std::string> rewritten_list = parsed_list;
+  rewritten_list.emplace_back("rack1node1");
+  begin = Clock::now();
+  std::string rewritten = util::HostNameListToStr(rewritten_list);
+  fmt::print("{:<32} {:>10.6f}s\n", "HostNameListToStr_",
+             SecondsSince(begin));
+
+  begin = Clock::now();
+  std::string compressed = util::HostNameListToStr(parsed_list);
+  fmt::print("{:<32} {:>10.6f}s\n", "HostNameListToStr",
+             SecondsSince(begin));
+
+  begin = Clock::now();
+  size_t found = 0;
+  hosts.ForEach([&](const std::string& name) {
+    found += hosts.Contains(name) ? 1 : 0;
+  });
+  fmt::print("{:<32} {:>10.6f}s\n", "HostList::ForEach and Contains",
+             SecondsSince(begin));
+
+  check(found == parsed_list.size(), "HostList::Contains");
+  util::HostList reparsed;
+  check(util::HostList::Parse(compressed, &reparsed) &&
+            reparsed.Size() == hosts.Size(),
+        "HostNameListToStr");
+  check(util::HostList::Parse(rewritten, &reparsed) &&
+            reparsed.Size() == hosts.Size() + 1,
+        "HostNameListToStr_");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,288 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Offline latency benchmark of the pam_crane round trips of one ssh login.
+//
+// --logins clients start at the same time, as an MPI launcher fanning out
+// over ssh does, and each asks a stub craned to authorize and migrate its
+// login. The stub takes --handle-us to answer each request, standing in
+// for the cgroup migration.
+//
+// Modes:
+//   grpc: a new channel to the CranedForPam unix socket and one
+//         AuthorizeSshProc call per login, as pam_crane did;
+//   fast: one AuthorizeSshProc over the pam_fast_path socket per login.
+
+#include <absl/strings/str_split.h>
+#include <fmt/format.h>
+#include <grpc++/grpc++.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <cxxopts.hpp>
+#include <latch>
+#include <thread>
+#include <vector>
+
+#include "crane/PamFastPath.h"
+#include "protos/Crane.grpc.pb.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct WorkloadOptions {
+  uint32_t login_num;
+  uint32_t server_threads;
+  std::chrono::microseconds handle_time;
+};
+
+struct RunResult {
+  uint32_t failed{0};
+  double p50_ms{0};
+  double p99_ms{0};
+  double max_ms{0};
+  double wall_ms{0};
+};
+
+void HandleRequest(const WorkloadOptions& opts,
+                   const crane::grpc::AuthorizeSshProcRequest& request,
+                   crane::grpc::AuthorizeSshProcReply* reply) {
+  std::this_thread::sleep_for(opts.handle_time);
+  reply->set_ok(true);
+  reply->set_task_id(request.uid());
+  (*reply->mutable_env_map())["CRANE_JOB_ID"] = "1";
+  (*reply->mutable_env_map())["CRANE_JOB_NODELIST"] = "cn[001-128]";
+}
+
+class StubCranedForPam : public crane::grpc::CranedForPam::Service {
+ public:
+  explicit StubCranedForPam(const WorkloadOptions& opts) : m_opts_(opts) {}
+
+  grpc::Status AuthorizeSshProc(
+      grpc::ServerContext* context,
+      const crane::grpc::AuthorizeSshProcRequest* request,
+      crane::grpc::AuthorizeSshProcReply* response) override {
+    HandleRequest(m_opts_, *request, response);
+    return grpc::Status::OK;
+  }
+
+ private:
+  const WorkloadOptions& m_opts_;
+};
+
+crane::grpc::AuthorizeSshProcRequest NewRequest(uint32_t i) {
+  crane::grpc::AuthorizeSshProcRequest request;
+  request.set_ssh_remote_address("10.0.0.1");
+  request.set_ssh_remote_port(20000 + i);
+  request.set_uid(1000 + i);
+  request.set_pid(static_cast<int32_t>(i));
+  return request;
+}
+
+// Runs login(i) for every login on its own thread at the same time.
+template <typename Login>
+RunResult RunLogins(const WorkloadOptions& opts, Login login) {
+  std::vector<double> latencies(opts.login_num);
+  std::vector<char> oks(opts.login_num);
+  std::latch start(opts.login_num + 1);
+
+  std::vector<std::thread> clients;
+  clients.reserve(opts.login_num);
+  for (uint32_t i = 0; i < opts.login_num; i++) {
+    clients.emplace_back([&, i] {
+      start.arrive_and_wait();
+      auto begin = Clock::now();
+      oks[i] = login(i);
+      latencies[i] = std::chrono::duration<double, std::milli>(Clock::now() -
+                                                               begin)
+                         .count();
+    });
+  }
+
+  auto begin = Clock::now();
+  start.arrive_and_wait();
+  for (auto& client : clients) client.join();
+
+  RunResult result;
+  result.wall_ms =
+      std::chrono::duration<double, std::milli>(Clock::now() - begin).count();
+  result.failed = std::ranges::count(oks, 0);
+  std::ranges::sort(latencies);
+  result.p50_ms = latencies[latencies.size() / 2];
+  result.p99_ms = latencies[latencies.size() * 99 / 100];
+  result.max_ms = latencies.back();
+  return result;
+}
+
+RunResult RunGrpc(const WorkloadOptions& opts, const std::string& sock_path) {
+  StubCranedForPam service(opts);
+  grpc::ServerBuilder builder;
+  builder.AddListeningPort("unix://" + sock_path,
+                           grpc::InsecureServerCredentials());
+  builder.SetSyncServerOption(grpc::ServerBuilder::MAX_POLLERS,
+                              static_cast<int>(opts.server_threads));
+  builder.RegisterService(&service);
+  auto server = builder.BuildAndStart();
+
+  RunResult result = RunLogins(opts, [&](uint32_t i) {
+    auto channel = grpc::CreateChannel("unix://" + sock_path,
+                                       grpc::InsecureChannelCredentials());
+    auto stub = crane::grpc::CranedForPam::NewStub(channel);
+
+    grpc::ClientContext context;
+    context.set_deadline(std::chrono::system_clock::now() +
+                         std::chrono::milliseconds(
+                             crane::pam_fast_path::kTimeoutMs));
+    crane::grpc::AuthorizeSshProcReply reply;
+    return stub->AuthorizeSshProc(&context, NewRequest(i), &reply).ok() &&
+           reply.ok();
+  });
+
+  server->Shutdown();
+  unlink(sock_path.c_str());
+  return result;
+}
+
+RunResult RunFast(const WorkloadOptions& opts, const std::string& sock_path) {
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  std::strncpy(addr.sun_path, sock_path.c_str(), sizeof(addr.sun_path) - 1);
+
+  int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  unlink(sock_path.c_str());
+  if (listen_fd < 0 ||
+      bind(listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) !=
+          0 ||
+      listen(listen_fd, SOMAXCONN) != 0) {
+    fmt::print(stderr, "Failed to listen on {}.\n", sock_path);
+    std::exit(1);
+  }
+
+  // The workers stand in for the thread pool of craned.
+  std::vector<std::thread> workers;
+  for (uint32_t t = 0; t < opts.server_threads; t++) {
+    workers.emplace_back([&] {
+      while (true) {
+        int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+          if (errno == EINTR || errno == ECONNABORTED) continue;
+          break;
+        }
+        crane::grpc::AuthorizeSshProcRequest request;
+        crane::grpc::AuthorizeSshProcReply reply;
+        if (crane::pam_fast_path::ReadMessage(fd, &request)) {
+          HandleRequest(opts, request, &reply);
+          crane::pam_fast_path::WriteMessage(fd, reply);
+        }
+        close(fd);
+      }
+    });
+  }
+
+  RunResult result = RunLogins(opts, [&](uint32_t i) {
+    int fd =
+        crane::pam_fast_path::Connect(sock_path,
+                                      crane::pam_fast_path::kTimeoutMs);
+    if (fd < 0) return false;
+
+    crane::grpc::AuthorizeSshProcReply reply;
+    bool ok = crane::pam_fast_path::WriteMessage(fd, NewRequest(i)) &&
+              crane::pam_fast_path::ReadMessage(fd, &reply) && reply.ok();
+    close(fd);
+    return ok;
+  });
+
+  shutdown(listen_fd, SHUT_RDWR);
+  for (auto& worker : workers) worker.join();
+  close(listen_fd);
+  unlink(sock_path.c_str());
+  return result;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  cxxopts::Options options("pam_fast_path_bench",
+                           "Measure the latency of concurrent ssh logins");
+
+  // clang-format off
+  options.add_options()
+      ("m,modes", "Comma separated modes: grpc, fast",
+       cxxopts::value<std::string>()->default_value("grpc,fast"))
+      ("n,logins", "Concurrent logins",
+       cxxopts::value<uint32_t>()->default_value("1000"))
+      ("server-threads", "Threads of the stub craned",
+       cxxopts::value<uint32_t>()->default_value("16"))
+      ("handle-us", "Microseconds the stub craned takes for a login",
+       cxxopts::value<uint32_t>()->default_value("200"))
+      ("sock-dir", "Directory of the unix sockets",
+       cxxopts::value<std::string>()->default_value("/tmp"))
+      ("h,help", "Show help");
+  // clang-format on
+
+  auto parsed = options.parse(argc, argv);
+  if (parsed.count("help")) {
+    fmt::print("{}\n", options.help());
+    return 0;
+  }
+
+  WorkloadOptions opts{
+      .login_num = parsed["logins"].as<uint32_t>(),
+      .server_threads = parsed["server-threads"].as<uint32_t>(),
+      .handle_time =
+          std::chrono::microseconds(parsed["handle-us"].as<uint32_t>()),
+  };
+  if (opts.login_num == 0 || opts.server_threads == 0) {
+    fmt::print(stderr, "Invalid workload.\n");
+    return 1;
+  }
+
+  std::string sock_path = fmt::format(
+      "{}/pam_fast_path_bench.{}.sock", parsed["sock-dir"].as<std::string>(),
+      getpid());
+
+  fmt::print("logins: {}, server threads: {}, handle: {} us\n",
+             opts.login_num, opts.server_threads, opts.handle_time.count());
+  fmt::print("{:<6} {:>8} {:>10} {:>10} {:>10} {:>10}\n", "mode", "failed",
+             "p50 ms", "p99 ms", "max ms", "wall ms");
+
+  std::vector<std::string> modes =
+      absl::StrSplit(parsed["modes"].as<std::string>(), ',');
+  for (const auto& mode : modes) {
+    RunResult result;
+    if (mode == "grpc")
+      result = RunGrpc(opts, sock_path);
+    else if (mode == "fast")
+      result = RunFast(opts, sock_path);
+    else {
+      fmt::print(stderr, "Unknown mode {}.\n", mode);
+      return 1;
+    }
+
+    fmt::print("{:<6} {:>8} {:>10.2f} {:>10.2f} {:>10.2f} {:>10.1f}\n", mode,
+               result.failed, result.p50_ms, result.p99_ms, result.max_ms,
+               result.wall_ms);
+  }
+
+  return 0;
+}
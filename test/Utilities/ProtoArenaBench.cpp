@@ -0,0 +1,283 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Offline benchmark of building the protobuf messages cranectld sends or
+// serves in bulk, on the heap as before and on a util::ReusableArena.
+//
+// Each operation builds the messages of --tasks tasks once, and the time
+// and the heap allocations per operation are reported. Allocations are
+// counted by replacing the global operator new, which also serves the
+// blocks of the arenas, so the benchmark must stay single-threaded.
+//
+// Cases:
+//   exec-heap:  the ExecuteStepsRequests of a scheduling cycle, grouped by
+//               --craneds craneds, with each TaskToD built by value and the
+//               resources converted through a temporary message;
+//   exec-arena: the same requests built in place on an arena which is
+//               reset and reused by the next cycle, as the launch batch does;
+//   info-heap:  a vector of the TaskInfo of the tasks, as the task query
+//               snapshot was built;
+//   info-arena: the same messages on a new arena sized from the previous
+//               snapshot, as the snapshot is built now.
+
+#include <absl/strings/str_split.h>
+#include <fmt/format.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cxxopts.hpp>
+#include <new>
+#include <unordered_map>
+#include <vector>
+
+#include "crane/ProtoArena.h"
+#include "crane/PublicHeader.h"
+
+namespace {
+
+std::atomic<uint64_t> g_alloc_num{0};
+
+}  // namespace
+
+void* operator new(size_t size) {
+  g_alloc_num.fetch_add(1, std::memory_order_relaxed);
+  if (size == 0) size = 1;
+  if (void* p = std::malloc(size)) return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// What a TaskInCtld holds for the fields below.
+struct TaskSample {
+  crane::grpc::TaskToCtld to_ctld;
+  ResourceInNode res;
+  ResourceView res_view;
+  std::vector<std::string> craned_ids;
+};
+
+TaskSample MakeTaskSample(uint32_t env_num, uint32_t script_bytes) {
+  TaskSample task;
+  task.to_ctld.set_name("bench_job");
+  task.to_ctld.set_cwd("/home/bench/work/dir");
+  task.to_ctld.set_cmd_line("cbatch job.sh");
+  for (uint32_t i = 0; i < env_num; ++i)
+    (*task.to_ctld.mutable_env())[fmt::format("BENCH_ENV_{}", i)] =
+        fmt::format("/opt/bench/value/{}", i);
+  task.to_ctld.mutable_batch_meta()->set_sh_script(
+      std::string(script_bytes, '#'));
+  task.to_ctld.mutable_batch_meta()->set_output_file_pattern("%j.out");
+
+  task.res.allocatable_res.cpu_count = cpu_t{4};
+  task.res.allocatable_res.memory_bytes =
+      task.res.allocatable_res.memory_sw_bytes = uint64_t{8} << 30;
+  task.res.dedicated_res["GPU"]["A100"].emplace("/dev/nvidia0");
+  task.res_view += task.res;
+  task.craned_ids.emplace_back("cn00001");
+  return task;
+}
+
+void FillTaskToD(const TaskSample& task, uint32_t task_id,
+                 crane::grpc::TaskToD* task_to_d) {
+  task_to_d->set_task_id(task_id);
+  task_to_d->set_type(crane::grpc::Batch);
+  task_to_d->set_name(task.to_ctld.name());
+  task_to_d->set_account("bench_account");
+  task_to_d->set_partition("CPU");
+  task_to_d->set_cwd(task.to_ctld.cwd());
+  *task_to_d->mutable_env() = task.to_ctld.env();
+  for (const auto& craned_id : task.craned_ids)
+    task_to_d->add_allocated_nodes(craned_id);
+  task_to_d->mutable_batch_meta()->CopyFrom(task.to_ctld.batch_meta());
+}
+
+void FillTaskInfo(const TaskSample& task, uint32_t task_id, bool in_place,
+                  crane::grpc::TaskInfo* task_info) {
+  task_info->set_task_id(task_id);
+  task_info->set_type(crane::grpc::Batch);
+  task_info->set_name(task.to_ctld.name());
+  task_info->set_account("bench_account");
+  task_info->set_partition("CPU");
+  task_info->set_username("bench");
+  task_info->set_cmd_line(task.to_ctld.cmd_line());
+  task_info->set_cwd(task.to_ctld.cwd());
+  task_info->mutable_execution_node()->Assign(task.craned_ids.begin(),
+                                              task.craned_ids.end());
+  if (in_place) {
+    task.res_view.ToGrpc(task_info->mutable_req_res_view());
+    task.res_view.ToGrpc(task_info->mutable_allocated_res_view());
+  } else {
+    *task_info->mutable_req_res_view() =
+        static_cast<crane::grpc::ResourceView>(task.res_view);
+    *task_info->mutable_allocated_res_view() =
+        static_cast<crane::grpc::ResourceView>(task.res_view);
+  }
+}
+
+struct Result {
+  double us_per_op;
+  double allocs_per_op;
+};
+
+template <typename Op>
+Result Measure(uint64_t op_num, Op op) {
+  uint64_t sink = 0;
+  // Warm up, so that the arenas are sized and lazily created state is not
+  // counted.
+  sink += op();
+
+  uint64_t allocs_before = g_alloc_num.load(std::memory_order_relaxed);
+  auto start = Clock::now();
+  for (uint64_t i = 0; i < op_num; ++i) sink += op();
+  double us = std::chrono::duration<double, std::micro>(Clock::now() - start)
+                  .count();
+  uint64_t allocs = g_alloc_num.load(std::memory_order_relaxed) - allocs_before;
+
+  if (sink == 42) fmt::print("");
+  return {us / op_num, static_cast<double>(allocs) / op_num};
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  cxxopts::Options options("proto_arena_bench",
+                           "Measure time and allocations of building protobuf "
+                           "messages on the heap and on arenas");
+
+  // clang-format off
+  options.add_options()
+      ("c,cases", "Comma separated cases: exec-heap, exec-arena, info-heap, "
+       "info-arena", cxxopts::value<std::string>()->default_value(
+           "exec-heap,exec-arena,info-heap,info-arena"))
+      ("t,tasks", "Tasks per operation",
+       cxxopts::value<uint32_t>()->default_value("2000"))
+      ("C,craneds", "Craneds the tasks of exec cases are spread over",
+       cxxopts::value<uint32_t>()->default_value("200"))
+      ("e,env", "Environment variables per task",
+       cxxopts::value<uint32_t>()->default_value("40"))
+      ("s,script-bytes", "Size of the script of each task",
+       cxxopts::value<uint32_t>()->default_value("2048"))
+      ("n,ops", "Operations per case",
+       cxxopts::value<uint64_t>()->default_value("200"))
+      ("h,help", "Show help");
+  // clang-format on
+
+  auto parsed = options.parse(argc, argv);
+  if (parsed.count("help")) {
+    fmt::print("{}\n", options.help());
+    return 0;
+  }
+
+  uint32_t task_num = parsed["tasks"].as<uint32_t>();
+  uint32_t craned_num = parsed["craneds"].as<uint32_t>();
+  uint64_t op_num = parsed["ops"].as<uint64_t>();
+  if (task_num == 0 || craned_num == 0 || op_num == 0) {
+    fmt::print(stderr, "Invalid workload.\n");
+    return 1;
+  }
+
+  TaskSample task = MakeTaskSample(parsed["env"].as<uint32_t>(),
+                                   parsed["script-bytes"].as<uint32_t>());
+  std::vector<std::string> craned_ids;
+  for (uint32_t i = 0; i < craned_num; ++i)
+    craned_ids.emplace_back(fmt::format("cn{:05}", i));
+
+  fmt::print("tasks: {}, craneds: {}, ops: {}\n", task_num, craned_num,
+             op_num);
+  fmt::print("{:<12} {:>10} {:>12} {:>12}\n", "case", "us/op", "allocs/op",
+             "arena KiB");
+
+  util::ReusableArena launch_arena;
+  size_t snapshot_space = 0;
+
+  std::vector<std::string> cases =
+      absl::StrSplit(parsed["cases"].as<std::string>(), ',');
+  for (const auto& name : cases) {
+    Result result;
+    size_t arena_bytes = 0;
+    if (name == "exec-heap") {
+      result = Measure(op_num, [&] {
+        std::unordered_map<std::string, crane::grpc::ExecuteStepsRequest>
+            requests;
+        for (uint32_t i = 0; i < task_num; ++i) {
+          crane::grpc::TaskToD task_to_d;
+          FillTaskToD(task, i, &task_to_d);
+          *task_to_d.mutable_resources() =
+              static_cast<crane::grpc::ResourceInNode>(task.res);
+          requests[craned_ids[i % craned_num]].mutable_tasks()->Add(
+              std::move(task_to_d));
+        }
+        return static_cast<uint64_t>(requests.size());
+      });
+    } else if (name == "exec-arena") {
+      result = Measure(op_num, [&] {
+        std::unordered_map<std::string, crane::grpc::ExecuteStepsRequest*>
+            requests;
+        for (uint32_t i = 0; i < task_num; ++i) {
+          auto& req = requests[craned_ids[i % craned_num]];
+          if (req == nullptr)
+            req = launch_arena.Create<crane::grpc::ExecuteStepsRequest>();
+          auto* task_to_d = req->add_tasks();
+          FillTaskToD(task, i, task_to_d);
+          task.res.ToGrpc(task_to_d->mutable_resources());
+        }
+        auto size = static_cast<uint64_t>(requests.size());
+        requests.clear();
+        launch_arena.Reset();
+        return size;
+      });
+      arena_bytes = launch_arena.BlockSize();
+    } else if (name == "info-heap") {
+      result = Measure(op_num, [&] {
+        std::vector<crane::grpc::TaskInfo> tasks;
+        tasks.reserve(task_num);
+        for (uint32_t i = 0; i < task_num; ++i)
+          FillTaskInfo(task, i, false, &tasks.emplace_back());
+        return static_cast<uint64_t>(tasks.size());
+      });
+    } else if (name == "info-arena") {
+      result = Measure(op_num, [&] {
+        util::ReusableArena arena(snapshot_space / 4 * 5);
+        std::vector<crane::grpc::TaskInfo*> tasks;
+        tasks.reserve(task_num);
+        for (uint32_t i = 0; i < task_num; ++i) {
+          auto* task_info = arena.Create<crane::grpc::TaskInfo>();
+          FillTaskInfo(task, i, true, task_info);
+          tasks.push_back(task_info);
+        }
+        snapshot_space = arena.SpaceUsed();
+        return static_cast<uint64_t>(tasks.size());
+      });
+      arena_bytes = util::ReusableArena(snapshot_space / 4 * 5).BlockSize();
+    } else {
+      fmt::print(stderr, "Unknown case {}.\n", name);
+      return 1;
+    }
+
+    fmt::print("{:<12} {:>10.1f} {:>12.1f} {:>12}\n", name, result.us_per_op,
+               result.allocs_per_op, arena_bytes >> 10);
+  }
+
+  return 0;
+}
@@ -67,3 +67,59 @@ TEST(String, HostNameListToStr) {
     GTEST_LOG_(INFO) << "Parsing result: " << res;
   }
 }
+
+TEST(String, HostList) {
+  util::HostList hosts;
+  ASSERT_TRUE(util::HostList::Parse("cn[08-10,12],login,gpu1.ib", &hosts));
+  EXPECT_EQ(hosts.Size(), 6U);
+  EXPECT_TRUE(hosts.Contains("cn09"));
+  EXPECT_TRUE(hosts.Contains("cn10"));
+  EXPECT_FALSE(hosts.Contains("cn9"));
+  EXPECT_FALSE(hosts.Contains("cn11"));
+  EXPECT_TRUE(hosts.Contains("login"));
+  EXPECT_EQ(hosts.ToString(), "cn[08-10,12],gpu1.ib,login");
+
+  std::vector<std::string> names;
+  hosts.ForEach([&](const std::string& name) { names.emplace_back(name); });
+  EXPECT_EQ(absl::StrJoin(names, " "), "cn10 cn12 cn08 cn09 gpu1.ib login");
+
+  util::HostList other;
+  ASSERT_TRUE(util::HostList::Parse("cn[9-11],cn[010-011],login", &other));
+
+  util::HostList both = hosts;
+  both.Intersect(other);
+  EXPECT_EQ(both.ToString(), "cn10,login");
+
+  util::HostList either = hosts;
+  either.Union(other);
+  EXPECT_EQ(either.ToString(), "cn[9,08-12,010-011],gpu1.ib,login");
+
+  util::HostList bad;
+  EXPECT_FALSE(util::HostList::Parse("cn[1-a]", &bad));
+  EXPECT_FALSE(util::HostList::Parse("cn[1-2", &bad));
+}
+
+TEST(String, HostListToStringRoundTrip) {
+  for (const char* host_list :
+       {"cn08,cn[009-010]", "cn[8-12]", "cn[08-12]", "cn[008-012,9-11]",
+        "cn[0-9,00-09,000-100]", "cn[098-101],gpu[1-3].ib"}) {
+    util::HostList hosts;
+    ASSERT_TRUE(util::HostList::Parse(host_list, &hosts)) << host_list;
+
+    std::string compressed = hosts.ToString();
+    util::HostList parsed;
+    ASSERT_TRUE(util::HostList::Parse(compressed, &parsed)) << compressed;
+
+    std::vector<std::string> names, parsed_names;
+    hosts.ForEach([&](const std::string& name) { names.emplace_back(name); });
+    parsed.ForEach(
+        [&](const std::string& name) { parsed_names.emplace_back(name); });
+    std::ranges::sort(names);
+    std::ranges::sort(parsed_names);
+    EXPECT_EQ(names, parsed_names) << host_list << " -> " << compressed;
+  }
+
+  util::HostList mixed_width;
+  ASSERT_TRUE(util::HostList::Parse("cn08,cn[009-010]", &mixed_width));
+  EXPECT_EQ(mixed_width.ToString(), "cn[08,009-010]");
+}
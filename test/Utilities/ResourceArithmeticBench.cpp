@@ -0,0 +1,222 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Offline benchmark of the resource arithmetic on the scheduling path.
+//
+// Each case runs --ops times an operation the scheduler does for every
+// task and node it looks at, and reports the time and the heap allocations
+// per operation. Allocations are counted by replacing the global operator
+// new, so the benchmark must stay single-threaded.
+//
+// Cases:
+//   node:     ResourceInNode -= and += of a task on one node;
+//   drain:    the same with an exclusive task taking every slot of the
+//             node, which empties the device maps and fills them again;
+//   view:     ResourceView += and -= of a ResourceInNode;
+//   v2:       ResourceV2 -= and += of a task on --nodes nodes;
+//   feasible: ResourceView::GetFeasibleResourceInNode() on one node;
+//   le:       ResourceView <= ResourceInNode.
+
+#include <absl/strings/str_split.h>
+#include <fmt/format.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cxxopts.hpp>
+#include <new>
+#include <vector>
+
+#include "crane/PublicHeader.h"
+
+namespace {
+
+std::atomic<uint64_t> g_alloc_num{0};
+
+}  // namespace
+
+void* operator new(size_t size) {
+  g_alloc_num.fetch_add(1, std::memory_order_relaxed);
+  if (size == 0) size = 1;
+  if (void* p = std::malloc(size)) return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// A node with --gpus slots of each of two GPU types and 64 cores.
+ResourceInNode MakeNodeTotal(uint32_t gpu_num) {
+  ResourceInNode res;
+  res.allocatable_res.cpu_count = cpu_t{64};
+  res.allocatable_res.memory_bytes = res.allocatable_res.memory_sw_bytes =
+      uint64_t{256} << 30;
+  for (uint32_t i = 0; i < gpu_num; ++i) {
+    res.dedicated_res["GPU"]["A100"].emplace(fmt::format("/dev/nvidia{}", i));
+    res.dedicated_res["GPU"]["H100"].emplace(
+        fmt::format("/dev/nvidia{}", gpu_num + i));
+  }
+  return res;
+}
+
+// A task taking 4 cores and one slot of each GPU type.
+ResourceInNode MakeTaskRes(uint32_t gpu_num) {
+  ResourceInNode res;
+  res.allocatable_res.cpu_count = cpu_t{4};
+  res.allocatable_res.memory_bytes = res.allocatable_res.memory_sw_bytes =
+      uint64_t{8} << 30;
+  res.dedicated_res["GPU"]["A100"].emplace("/dev/nvidia0");
+  res.dedicated_res["GPU"]["H100"].emplace(
+      fmt::format("/dev/nvidia{}", gpu_num));
+  return res;
+}
+
+struct Result {
+  double ns_per_op;
+  double allocs_per_op;
+};
+
+template <typename Op>
+Result Measure(uint64_t op_num, Op op) {
+  uint64_t sink = 0;
+  // Warm up, so that lazily created state is not counted.
+  sink += op();
+
+  uint64_t allocs_before = g_alloc_num.load(std::memory_order_relaxed);
+  auto start = Clock::now();
+  for (uint64_t i = 0; i < op_num; ++i) sink += op();
+  double ns = std::chrono::duration<double, std::nano>(Clock::now() - start)
+                  .count();
+  uint64_t allocs = g_alloc_num.load(std::memory_order_relaxed) - allocs_before;
+
+  if (sink == 42) fmt::print("");
+  return {ns / op_num, static_cast<double>(allocs) / op_num};
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  cxxopts::Options options("resource_arithmetic_bench",
+                           "Measure time and allocations of the resource "
+                           "arithmetic");
+
+  // clang-format off
+  options.add_options()
+      ("c,cases", "Comma separated cases: node, drain, view, v2, feasible, "
+       "le", cxxopts::value<std::string>()->default_value(
+           "node,drain,view,v2,feasible,le"))
+      ("g,gpus", "Slots of each GPU type on a node",
+       cxxopts::value<uint32_t>()->default_value("4"))
+      ("N,nodes", "Nodes of the task in the v2 case",
+       cxxopts::value<uint32_t>()->default_value("16"))
+      ("n,ops", "Operations per case",
+       cxxopts::value<uint64_t>()->default_value("1000000"))
+      ("h,help", "Show help");
+  // clang-format on
+
+  auto parsed = options.parse(argc, argv);
+  if (parsed.count("help")) {
+    fmt::print("{}\n", options.help());
+    return 0;
+  }
+
+  uint32_t gpu_num = parsed["gpus"].as<uint32_t>();
+  uint32_t node_num = parsed["nodes"].as<uint32_t>();
+  uint64_t op_num = parsed["ops"].as<uint64_t>();
+  if (gpu_num == 0 || node_num == 0 || op_num == 0) {
+    fmt::print(stderr, "Invalid workload.\n");
+    return 1;
+  }
+
+  ResourceInNode node_total = MakeNodeTotal(gpu_num);
+  ResourceInNode task_res = MakeTaskRes(gpu_num);
+
+  ResourceView task_view;
+  task_view += task_res;
+
+  ResourceV2 cluster_avail;
+  ResourceV2 task_v2;
+  for (uint32_t i = 0; i < node_num; ++i) {
+    std::string craned_id = fmt::format("cn{:05}", i);
+    cluster_avail.AddResourceInNode(craned_id, node_total);
+    task_v2.AddResourceInNode(craned_id, task_res);
+  }
+
+  fmt::print("gpus per type: {}, nodes: {}, ops: {}\n", gpu_num, node_num,
+             op_num);
+  fmt::print("{:<10} {:>10} {:>12}\n", "case", "ns/op", "allocs/op");
+
+  std::vector<std::string> cases =
+      absl::StrSplit(parsed["cases"].as<std::string>(), ',');
+  for (const auto& name : cases) {
+    Result result;
+    if (name == "node") {
+      ResourceInNode avail = node_total;
+      result = Measure(op_num, [&] {
+        avail -= task_res;
+        avail += task_res;
+        return avail.allocatable_res.memory_bytes;
+      });
+    } else if (name == "drain") {
+      ResourceInNode avail = node_total;
+      result = Measure(op_num, [&] {
+        avail -= node_total;
+        avail += node_total;
+        return avail.allocatable_res.memory_bytes;
+      });
+    } else if (name == "view") {
+      ResourceView view;
+      view += node_total;
+      result = Measure(op_num, [&] {
+        view += task_res;
+        view -= task_res;
+        return view.MemoryBytes();
+      });
+    } else if (name == "v2") {
+      ResourceV2 avail = cluster_avail;
+      result = Measure(op_num, [&] {
+        avail -= task_v2;
+        avail += task_v2;
+        return static_cast<uint64_t>(avail.EachNodeResMap().size());
+      });
+    } else if (name == "feasible") {
+      ResourceInNode feasible;
+      result = Measure(op_num, [&] {
+        feasible.SetToZero();
+        return static_cast<uint64_t>(
+            task_view.GetFeasibleResourceInNode(node_total, &feasible));
+      });
+    } else if (name == "le") {
+      result = Measure(op_num, [&] {
+        return static_cast<uint64_t>(task_view <= node_total);
+      });
+    } else {
+      fmt::print(stderr, "Unknown case {}.\n", name);
+      return 1;
+    }
+
+    fmt::print("{:<10} {:>10.1f} {:>12.2f}\n", name, result.ns_per_op,
+               result.allocs_per_op);
+  }
+
+  return 0;
+}
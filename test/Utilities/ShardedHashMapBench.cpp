@@ -0,0 +1,241 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Offline contention benchmark of the concurrent maps in AtomicHashMap.h.
+//
+// --threads threads run --ops operations each on a map of --keys keys with
+// values the size of a small node record. An operation is a lookup that
+// reads the value, an update of the value in place, or a replacement that
+// erases the key and inserts it again, as a node going down and coming
+// back does. The mix is set by --update-pct and --replace-pct.
+//
+// Modes:
+//   atomic:  util::AtomicHashMap, lookups and updates take the global shared
+//            lock and the value mutex, replacements the global lock;
+//   sharded: util::ShardedHashMap, lookups take the shard shared lock,
+//            updates and replacements the shard lock.
+
+#include <absl/container/flat_hash_map.h>
+#include <absl/strings/numbers.h>
+#include <absl/strings/str_split.h>
+#include <fmt/format.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cxxopts.hpp>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "crane/AtomicHashMap.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Value {
+  std::array<uint64_t, 8> fields{};
+};
+
+struct WorkloadOptions {
+  uint64_t key_num;
+  uint64_t op_num;
+  uint32_t update_pct;
+  uint32_t replace_pct;
+};
+
+enum class Op : uint8_t { kLookup, kUpdate, kReplace };
+
+// Pre-drawn (op, key) pairs, so that the random number generator is not
+// part of the measurement.
+std::vector<std::pair<Op, uint64_t>> MakeOps(const WorkloadOptions& opts,
+                                             uint32_t seed) {
+  std::mt19937_64 rng(seed);
+  std::uniform_int_distribution<uint64_t> key_dist(0, opts.key_num - 1);
+  std::uniform_int_distribution<uint32_t> pct_dist(0, 99);
+  std::vector<std::pair<Op, uint64_t>> ops;
+  ops.reserve(opts.op_num);
+  for (uint64_t i = 0; i < opts.op_num; ++i) {
+    uint32_t pct = pct_dist(rng);
+    Op op = pct < opts.replace_pct                    ? Op::kReplace
+            : pct < opts.replace_pct + opts.update_pct ? Op::kUpdate
+                                                       : Op::kLookup;
+    ops.emplace_back(op, key_dist(rng));
+  }
+  return ops;
+}
+
+// Returns the total operations per second of all threads.
+template <typename RunOp>
+double Run(const WorkloadOptions& opts, uint32_t thread_num, RunOp run_op) {
+  std::vector<std::vector<std::pair<Op, uint64_t>>> ops(thread_num);
+  for (uint32_t i = 0; i < thread_num; ++i) ops[i] = MakeOps(opts, i + 1);
+
+  std::atomic<uint32_t> ready{0};
+  std::atomic<bool> go{false};
+  std::atomic<uint64_t> sink{0};
+  std::vector<std::thread> threads;
+  for (uint32_t i = 0; i < thread_num; ++i) {
+    threads.emplace_back([&, i] {
+      ready.fetch_add(1);
+      while (!go.load(std::memory_order_acquire)) std::this_thread::yield();
+      uint64_t sum = 0;
+      for (auto [op, key] : ops[i]) sum += run_op(op, key);
+      sink.fetch_add(sum, std::memory_order_relaxed);
+    });
+  }
+
+  while (ready.load() != thread_num) std::this_thread::yield();
+  auto start = Clock::now();
+  go.store(true, std::memory_order_release);
+  for (auto& t : threads) t.join();
+  double sec = std::chrono::duration<double>(Clock::now() - start).count();
+
+  return opts.op_num * thread_num / sec;
+}
+
+double RunAtomic(const WorkloadOptions& opts, uint32_t thread_num) {
+  util::AtomicHashMap<absl::flat_hash_map, uint64_t, Value> map;
+  absl::flat_hash_map<uint64_t, Value> init;
+  for (uint64_t k = 0; k < opts.key_num; ++k) init.emplace(k, Value{});
+  map.InitFromMap(std::move(init));
+
+  return Run(opts, thread_num, [&](Op op, uint64_t key) -> uint64_t {
+    switch (op) {
+    case Op::kLookup: {
+      auto value = map.GetValueExclusivePtr(key);
+      return value ? value->fields[key % 8] : 0;
+    }
+    case Op::kUpdate: {
+      auto value = map.GetValueExclusivePtr(key);
+      if (value) ++value->fields[key % 8];
+      return 0;
+    }
+    case Op::kReplace:
+      map.Erase(key);
+      map.Emplace(key, Value{});
+      return 0;
+    }
+    return 0;
+  });
+}
+
+double RunSharded(const WorkloadOptions& opts, uint32_t thread_num) {
+  util::ShardedHashMap<absl::flat_hash_map, uint64_t, Value> map;
+  absl::flat_hash_map<uint64_t, Value> init;
+  for (uint64_t k = 0; k < opts.key_num; ++k) init.emplace(k, Value{});
+  map.InitFromMap(std::move(init));
+
+  return Run(opts, thread_num, [&](Op op, uint64_t key) -> uint64_t {
+    switch (op) {
+    case Op::kLookup: {
+      auto value = map.GetValueConstSharedPtr(key);
+      return value ? value->fields[key % 8] : 0;
+    }
+    case Op::kUpdate: {
+      auto value = map.GetValueExclusivePtr(key);
+      if (value) ++value->fields[key % 8];
+      return 0;
+    }
+    case Op::kReplace:
+      map.Erase(key);
+      map.Emplace(key, Value{});
+      return 0;
+    }
+    return 0;
+  });
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  cxxopts::Options options("sharded_hash_map_bench",
+                           "Measure concurrent map throughput under "
+                           "contention");
+
+  // clang-format off
+  options.add_options()
+      ("m,modes", "Comma separated modes: atomic, sharded",
+       cxxopts::value<std::string>()->default_value("atomic,sharded"))
+      ("t,threads", "Comma separated thread counts",
+       cxxopts::value<std::string>()->default_value("1,2,4,8,16,32,64"))
+      ("k,keys", "Keys in the map",
+       cxxopts::value<uint64_t>()->default_value("10000"))
+      ("n,ops", "Operations per thread",
+       cxxopts::value<uint64_t>()->default_value("1000000"))
+      ("update-pct", "Percentage of updates",
+       cxxopts::value<uint32_t>()->default_value("9"))
+      ("replace-pct", "Percentage of erase and insert pairs",
+       cxxopts::value<uint32_t>()->default_value("1"))
+      ("h,help", "Show help");
+  // clang-format on
+
+  auto parsed = options.parse(argc, argv);
+  if (parsed.count("help")) {
+    fmt::print("{}\n", options.help());
+    return 0;
+  }
+
+  WorkloadOptions opts{
+      .key_num = parsed["keys"].as<uint64_t>(),
+      .op_num = parsed["ops"].as<uint64_t>(),
+      .update_pct = parsed["update-pct"].as<uint32_t>(),
+      .replace_pct = parsed["replace-pct"].as<uint32_t>(),
+  };
+  if (opts.key_num == 0 || opts.op_num == 0 ||
+      opts.update_pct + opts.replace_pct > 100) {
+    fmt::print(stderr, "Invalid workload.\n");
+    return 1;
+  }
+
+  std::vector<uint32_t> thread_nums;
+  for (std::string_view str :
+       absl::StrSplit(parsed["threads"].as<std::string>(), ',')) {
+    uint32_t thread_num = 0;
+    if (!absl::SimpleAtoi(str, &thread_num) || thread_num == 0) {
+      fmt::print(stderr, "Invalid thread count {}.\n", str);
+      return 1;
+    }
+    thread_nums.push_back(thread_num);
+  }
+
+  fmt::print("keys: {}, ops per thread: {}, updates: {}%, replaces: {}%\n",
+             opts.key_num, opts.op_num, opts.update_pct, opts.replace_pct);
+  fmt::print("{:<8} {:>8} {:>14}\n", "mode", "threads", "ops/s");
+
+  std::vector<std::string> modes =
+      absl::StrSplit(parsed["modes"].as<std::string>(), ',');
+  for (const auto& mode : modes) {
+    for (uint32_t thread_num : thread_nums) {
+      double ops_per_sec;
+      if (mode == "atomic")
+        ops_per_sec = RunAtomic(opts, thread_num);
+      else if (mode == "sharded")
+        ops_per_sec = RunSharded(opts, thread_num);
+      else {
+        fmt::print(stderr, "Unknown mode {}.\n", mode);
+        return 1;
+      }
+
+      fmt::print("{:<8} {:>8} {:>14.0f}\n", mode, thread_num, ops_per_sec);
+    }
+  }
+
+  return 0;
+}
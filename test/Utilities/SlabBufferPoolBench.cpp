@@ -0,0 +1,208 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Offline throughput benchmark of the buffers of the X11 forwarding path.
+//
+// A reader thread produces --chunks chunks of random sizes up to --max-len
+// bytes and queues them to a writer thread, which copies each chunk into a
+// reused StreamTaskIORequest and serializes it, as the CforedClient writer
+// does before a stream write. The reader keeps at most --inflight chunks
+// queued.
+//
+// Modes:
+//   heap: every chunk is a new std::unique_ptr<char[]>, as uvw allocates
+//         for each read;
+//   slab: chunks come from a util::SlabBufferPool and are recycled once
+//         serialized.
+
+#include <absl/strings/str_split.h>
+#include <concurrentqueue/concurrentqueue.h>
+#include <fmt/format.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <cxxopts.hpp>
+#include <random>
+#include <thread>
+
+#include "crane/SlabBufferPool.h"
+#include "protos/Crane.pb.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+using crane::grpc::StreamTaskIORequest;
+
+constexpr size_t kMaxChunkLen = 16 * 1024;
+
+using BenchPool = util::SlabBufferPool<kMaxChunkLen, 8>;
+
+struct WorkloadOptions {
+  uint64_t chunk_num;
+  size_t max_len;
+  size_t inflight;
+};
+
+struct RunResult {
+  double mb_per_sec{0};
+  double chunks_per_sec{0};
+  size_t slabs{0};
+};
+
+struct HeapChunk {
+  std::unique_ptr<char[]> data;
+  size_t len;
+};
+
+// Runs the reader on this thread. make_chunk returns a chunk filled with len
+// bytes, read_chunk gives the bytes of a chunk to the writer.
+template <typename Chunk, typename MakeChunk, typename ReadChunk>
+RunResult Run(const WorkloadOptions& opts, MakeChunk make_chunk,
+              ReadChunk read_chunk) {
+  moodycamel::ConcurrentQueue<Chunk> queue;
+  std::atomic<uint64_t> written{0};
+  uint64_t bytes = 0;
+
+  std::thread writer([&] {
+    StreamTaskIORequest request;
+    request.set_type(StreamTaskIORequest::TASK_X11_OUTPUT);
+    std::string wire;
+    Chunk chunk;
+    for (uint64_t i = 0; i < opts.chunk_num;) {
+      if (!queue.try_dequeue(chunk)) continue;
+      auto [data, len] = read_chunk(chunk);
+      request.mutable_payload_task_x11_output_req()->set_msg(data, len);
+      request.SerializeToString(&wire);
+      chunk = Chunk{};
+      written.fetch_add(1, std::memory_order_release);
+      ++i;
+    }
+  });
+
+  std::mt19937_64 rng(42);
+  std::uniform_int_distribution<size_t> len_dist(1, opts.max_len);
+
+  auto start = Clock::now();
+  for (uint64_t i = 0; i < opts.chunk_num; ++i) {
+    while (i - written.load(std::memory_order_acquire) >= opts.inflight)
+      std::this_thread::yield();
+    size_t len = len_dist(rng);
+    bytes += len;
+    queue.enqueue(make_chunk(len));
+  }
+  writer.join();
+  double sec = std::chrono::duration<double>(Clock::now() - start).count();
+
+  return {.mb_per_sec = bytes / sec / 1024 / 1024,
+          .chunks_per_sec = opts.chunk_num / sec};
+}
+
+RunResult RunHeap(const WorkloadOptions& opts) {
+  return Run<HeapChunk>(
+      opts,
+      [](size_t len) {
+        // uvw allocates the size libuv suggests, not the size read.
+        HeapChunk chunk{.data = std::make_unique_for_overwrite<char[]>(
+                            kMaxChunkLen),
+                        .len = len};
+        std::memset(chunk.data.get(), 'x', len);
+        return chunk;
+      },
+      [](const HeapChunk& chunk) {
+        return std::pair<const char*, size_t>(chunk.data.get(), chunk.len);
+      });
+}
+
+RunResult RunSlab(const WorkloadOptions& opts) {
+  BenchPool pool;
+  RunResult result = Run<BenchPool::BufferPtr>(
+      opts,
+      [&](size_t len) {
+        BenchPool::BufferPtr buf = pool.Get();
+        std::memset(buf->data, 'x', len);
+        buf->len = len;
+        return buf;
+      },
+      [](const BenchPool::BufferPtr& buf) {
+        return std::pair<const char*, size_t>(buf->data, buf->len);
+      });
+  result.slabs = pool.SlabNum();
+  return result;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  cxxopts::Options options("slab_buffer_pool_bench",
+                           "Measure the throughput of X11 output buffers");
+
+  // clang-format off
+  options.add_options()
+      ("m,modes", "Comma separated modes: heap, slab",
+       cxxopts::value<std::string>()->default_value("heap,slab"))
+      ("n,chunks", "Chunks to forward",
+       cxxopts::value<uint64_t>()->default_value("1000000"))
+      ("max-len", "Maximum bytes of a chunk",
+       cxxopts::value<size_t>()->default_value("16384"))
+      ("inflight", "Maximum chunks queued to the writer",
+       cxxopts::value<size_t>()->default_value("64"))
+      ("h,help", "Show help");
+  // clang-format on
+
+  auto parsed = options.parse(argc, argv);
+  if (parsed.count("help")) {
+    fmt::print("{}\n", options.help());
+    return 0;
+  }
+
+  WorkloadOptions opts{
+      .chunk_num = parsed["chunks"].as<uint64_t>(),
+      .max_len = parsed["max-len"].as<size_t>(),
+      .inflight = parsed["inflight"].as<size_t>(),
+  };
+  if (opts.chunk_num == 0 || opts.max_len == 0 ||
+      opts.max_len > kMaxChunkLen || opts.inflight == 0) {
+    fmt::print(stderr, "Invalid workload.\n");
+    return 1;
+  }
+
+  fmt::print("chunks: {}, max len: {}, inflight: {}\n", opts.chunk_num,
+             opts.max_len, opts.inflight);
+  fmt::print("{:<6} {:>12} {:>14} {:>8}\n", "mode", "MiB/s", "chunks/s",
+             "slabs");
+
+  std::vector<std::string> modes =
+      absl::StrSplit(parsed["modes"].as<std::string>(), ',');
+  for (const auto& mode : modes) {
+    RunResult result;
+    if (mode == "heap")
+      result = RunHeap(opts);
+    else if (mode == "slab")
+      result = RunSlab(opts);
+    else {
+      fmt::print(stderr, "Unknown mode {}.\n", mode);
+      return 1;
+    }
+
+    fmt::print("{:<6} {:>12.1f} {:>14.0f} {:>8}\n", mode, result.mb_per_sec,
+               result.chunks_per_sec, result.slabs);
+  }
+
+  return 0;
+}
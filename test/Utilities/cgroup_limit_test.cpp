@@ -31,7 +31,7 @@
 #include <vector>
 
 #include "AnonymousPipe.h"
-#include "cgroup.linux.h"
+#include "CgroupManager.h"
 
 // NOTICE: For non-RHEL system, swap account in cgroup is disabled by default.
 //  Turn it on by adding
@@ -118,12 +118,13 @@ TEST(cgroup, cpu_core_limit) {
     t3.join();
 
   } else {
-    using namespace util;
+    using namespace Craned::Common;
     const std::string cg_path{"riley_cgroup"};
 
-    CgroupUtil::Init();
-    auto cg = CgroupUtil::CreateOrOpen(cg_path, ALL_CONTROLLER_FLAG,
-                                       NO_CONTROLLER_FLAG, false);
+    ASSERT_EQ(CgroupManager::Init(spdlog::level::info), CraneErrCode::SUCCESS);
+    auto cg = CgroupManager::CreateOrOpen_(cg_path, ALL_CONTROLLER_FLAG,
+                                           NO_CONTROLLER_FLAG, false);
+    ASSERT_NE(cg, nullptr);
 
     cg->SetCpuCoreLimit(2);
 
@@ -192,10 +193,11 @@ TEST(cgroup, memory_limit) {
 
     const std::string cg_path{"riley_cgroup"};
 
-    using namespace util;
-    CgroupUtil::Init();
-    auto cg = CgroupUtil::CreateOrOpen(cg_path, ALL_CONTROLLER_FLAG,
-                                       NO_CONTROLLER_FLAG, false);
+    using namespace Craned::Common;
+    ASSERT_EQ(CgroupManager::Init(spdlog::level::info), CraneErrCode::SUCCESS);
+    auto cg = CgroupManager::CreateOrOpen_(cg_path, ALL_CONTROLLER_FLAG,
+                                           NO_CONTROLLER_FLAG, false);
+    ASSERT_NE(cg, nullptr);
 
     cg->SetMemoryLimitBytes(10 * MB);
     cg->SetMemorySwLimitBytes(10 * MB);
@@ -215,6 +217,63 @@ TEST(cgroup, memory_limit) {
   }
 }
 
+// Create, limit and destroy job cgroups with each cgroup backend.
+// Needs root and cgroup v2. Run with --gtest_also_run_disabled_tests.
+TEST(cgroup, DISABLED_backend_throughput) {
+  using Craned::Common::AllocatableResourceAllocator;
+  using Craned::Common::CgroupInterface;
+  using Craned::Common::CgroupManager;
+  using Craned::Common::CG_V2_REQUIRED_CONTROLLERS;
+  using Craned::Common::NO_CONTROLLER_FLAG;
+  using Craned::Common::CgConstant::CgroupBackend;
+  using Clock = std::chrono::steady_clock;
+
+  constexpr int kCgroupNum = 500;
+
+  crane::grpc::AllocatableResource res;
+  res.set_cpu_core_limit(2);
+  res.set_memory_limit_bytes(512 * MB);
+  res.set_memory_sw_limit_bytes(512 * MB);
+
+  constexpr std::array<std::pair<CgroupBackend, const char*>, 2> kBackends{
+      {{CgroupBackend::LIBCGROUP, "libcgroup"},
+       {CgroupBackend::CGROUPFS, "cgroupfs"}}};
+
+  for (auto [backend, name] : kBackends) {
+    CgroupManager::SetCgroupBackend(backend);
+    ASSERT_EQ(CgroupManager::Init(spdlog::level::info), CraneErrCode::SUCCESS);
+    ASSERT_EQ(CgroupManager::GetCgroupVersion(),
+              Craned::Common::CgConstant::CgroupVersion::CGROUP_V2);
+
+    std::vector<std::unique_ptr<CgroupInterface>> cgroups;
+    cgroups.reserve(kCgroupNum);
+
+    auto t0 = Clock::now();
+    for (int i = 0; i < kCgroupNum; ++i) {
+      cgroups.emplace_back(CgroupManager::CreateOrOpen_(
+          CgroupManager::CgroupStrByJobId(900000 + i),
+          CG_V2_REQUIRED_CONTROLLERS, NO_CONTROLLER_FLAG, false));
+      ASSERT_NE(cgroups.back(), nullptr);
+    }
+
+    auto t1 = Clock::now();
+    for (auto& cg : cgroups)
+      ASSERT_TRUE(AllocatableResourceAllocator::Allocate(res, cg.get()));
+
+    auto t2 = Clock::now();
+    for (auto& cg : cgroups) cg->Destroy();
+    auto t3 = Clock::now();
+
+    auto per_op_us = [](Clock::duration d) {
+      return std::chrono::duration_cast<std::chrono::microseconds>(d).count() /
+             kCgroupNum;
+    };
+    fmt::print("{}: create {} us, limit {} us, destroy {} us per cgroup\n",
+               name, per_op_us(t1 - t0), per_op_us(t2 - t1),
+               per_op_us(t3 - t2));
+  }
+}
+
 /*
  * read /proc data into the passed struct pstat
  * returns 0 on success, -1 on error
@@ -18,6 +18,11 @@
 
 #include <gtest/gtest.h>
 
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <set>
+
 #include "crane/Network.h"
 #include "crane/PublicHeader.h"
 constexpr std::array slots = {"/dev/nvidia0", "/dev/nvidia1", "/dev/nvidia2",
@@ -171,11 +176,7 @@ TEST(DEDICATED_RES_NODE, minus2) {
 }
 
 TEST(DEDICATED_RES_NODE, req_map) {
-  std::unordered_map<std::string /*name*/,
-                     std::pair<uint64_t /*untyped req count*/,
-                               std::unordered_map<std::string /*type*/,
-                                                  uint64_t /*type total*/>>>
-      req;
+  DeviceMap req;
   req["GPU"] = {1, {{"A100", 1}}};
   DedicatedResourceInNode resourceInNode;
   resourceInNode["GPU"]["A100"].insert(
@@ -184,12 +185,7 @@ TEST(DEDICATED_RES_NODE, req_map) {
 }
 
 TEST(DEDICATED_RES_NODE, req_map2) {
-  using req_t = std::unordered_map<
-      std::string /*name*/,
-      std::pair<
-          uint64_t /*untyped req count*/,
-          std::unordered_map<std::string /*type*/, uint64_t /*type total*/>>>;
-  req_t req;
+  DeviceMap req;
   req["GPU"] = {4, {{"A100", 1}}};
   DedicatedResourceInNode resourceInNode;
   resourceInNode["GPU"]["A100"].insert(
@@ -199,12 +195,7 @@ TEST(DEDICATED_RES_NODE, req_map2) {
 }
 
 TEST(DEDICATED_RES_NODE, req_map3) {
-  using req_t = std::unordered_map<
-      std::string /*name*/,
-      std::pair<
-          uint64_t /*untyped req count*/,
-          std::unordered_map<std::string /*type*/, uint64_t /*type total*/>>>;
-  req_t req;
+  DeviceMap req;
   req["GPU"] = {1, {}};
   DedicatedResourceInNode resourceInNode;
   resourceInNode["GPU"]["A100"].insert({slots[0]});
@@ -212,12 +203,7 @@ TEST(DEDICATED_RES_NODE, req_map3) {
 }
 
 TEST(DEDICATED_RES_NODE, req_map4) {
-  using req_t = std::unordered_map<
-      std::string /*name*/,
-      std::pair<
-          uint64_t /*untyped req count*/,
-          std::unordered_map<std::string /*type*/, uint64_t /*type total*/>>>;
-  req_t req;
+  DeviceMap req;
   req["GPU"] = {4, {{"A100", 1}}};
   DedicatedResourceInNode resourceInNode;
   resourceInNode["GPU"]["B100"].insert(
@@ -236,12 +222,7 @@ TEST(DEDICATED_RES_NODE, req_map5) {
   ASSERT_EQ(4, crane::GetIpAddrVer("10.11.82.1"));
   ASSERT_EQ(4, crane::GetIpAddrVer("127.0.0.1"));
   ASSERT_EQ(-1, crane::GetIpAddrVer("lijunlin"));
-  using req_t = std::unordered_map<
-      std::string /*name*/,
-      std::pair<
-          uint64_t /*untyped req count*/,
-          std::unordered_map<std::string /*type*/, uint64_t /*type total*/>>>;
-  req_t req;
+  DeviceMap req;
   req["GPU"] = {4, {{"A100", 1}}};
   DedicatedResourceInNode resourceInNode;
   resourceInNode["XPU"]["B100"].insert(
@@ -250,3 +231,263 @@ TEST(DEDICATED_RES_NODE, req_map5) {
                req, resourceInNode);
 }
 
+TEST(DEDICATED_RES_NODE, req_map6) {
+  // A zero request of a device the node doesn't have is satisfied.
+  DeviceMap req;
+  req["GPU"] = {0, {}};
+  DedicatedResourceInNode resourceInNode;
+  resourceInNode["XPU"]["B100"].insert({slots[0]});
+  ASSERT_LE(req, resourceInNode);
+}
+
+TEST(DEDICATED_RES_NODE, grpc_round_trip) {
+  DedicatedResourceInNode res;
+  res["GPU"]["A100"].insert({slots[0], slots[1], slots[3]});
+  res["GPU"]["H100"].insert({slots[4]});
+  res["XPU"]["X100"].insert({slots[1], slots[6], slots[5]});
+
+  auto grpc_res = static_cast<crane::grpc::DedicatedResourceInNode>(res);
+  ASSERT_EQ(grpc_res.name_type_map().at("GPU").type_slots_map().at("A100")
+                .slots_size(),
+            3);
+  ASSERT_EQ(DedicatedResourceInNode(grpc_res), res);
+}
+
+namespace {
+
+// Applies the same random operations to a SlotSet and a std::set, which
+// SlotSet replaced, and expects the same results.
+void ExpectSameAsStdSet(const std::vector<std::string>& slot_ids,
+                        size_t round) {
+  std::mt19937 gen(42);
+  std::uniform_int_distribution<size_t> dist(0, slot_ids.size() - 1);
+
+  for (size_t r = 0; r < round; r++) {
+    std::set<SlotId> lhs, rhs;
+    SlotSet dense_lhs, dense_rhs;
+    for (size_t i = 0; i < 6; i++) {
+      const auto& l = slot_ids[dist(gen)];
+      const auto& r = slot_ids[dist(gen)];
+      lhs.insert(l);
+      dense_lhs.insert(l);
+      rhs.insert(r);
+      dense_rhs.insert(r);
+    }
+
+    ASSERT_EQ(dense_lhs.size(), lhs.size());
+    ASSERT_EQ(std::set<SlotId>(dense_lhs.begin(), dense_lhs.end()), lhs);
+    ASSERT_EQ(dense_lhs == dense_rhs, lhs == rhs);
+    ASSERT_EQ(dense_lhs.Includes(dense_rhs), std::ranges::includes(lhs, rhs));
+
+    std::set<SlotId> expected;
+    std::ranges::set_union(lhs, rhs, std::inserter(expected, expected.end()));
+    SlotSet result = dense_lhs;
+    result |= dense_rhs;
+    ASSERT_EQ(std::set<SlotId>(result.begin(), result.end()), expected);
+
+    expected.clear();
+    std::ranges::set_difference(lhs, rhs,
+                                std::inserter(expected, expected.end()));
+    result = dense_lhs;
+    result -= dense_rhs;
+    ASSERT_EQ(std::set<SlotId>(result.begin(), result.end()), expected);
+    ASSERT_EQ(result.empty(), expected.empty());
+
+    expected.clear();
+    std::ranges::set_intersection(lhs, rhs,
+                                  std::inserter(expected, expected.end()));
+    result = dense_lhs;
+    result &= dense_rhs;
+    ASSERT_EQ(std::set<SlotId>(result.begin(), result.end()), expected);
+
+    SlotSet first = dense_lhs.First(2);
+    ASSERT_EQ(first.size(), std::min<size_t>(2, lhs.size()));
+    ASSERT_TRUE(dense_lhs.Includes(first));
+
+    dense_lhs.erase(*lhs.begin());
+    ASSERT_FALSE(dense_lhs.contains(*lhs.begin()));
+    ASSERT_EQ(dense_lhs.size(), lhs.size() - 1);
+  }
+}
+
+}  // namespace
+
+TEST(SLOT_SET, same_as_std_set) {
+  ExpectSameAsStdSet({slots.begin(), slots.end()}, 1000);
+}
+
+TEST(SLOT_SET, same_as_std_set_beyond_inline_word) {
+  std::vector<std::string> slot_ids;
+  for (size_t i = 0; i < 300; i++)
+    slot_ids.emplace_back("/dev/test_slot_set" + std::to_string(i));
+  ExpectSameAsStdSet(slot_ids, 1000);
+}
+
+// Microbenchmark of the slot operations done when a task is allocated and
+// freed. Run with
+// --gtest_also_run_disabled_tests --gtest_filter=SLOT_SET.*
+TEST(SLOT_SET, DISABLED_benchmark_alloc_free) {
+  constexpr size_t kRound = 1000000;
+
+  std::set<SlotId> total(slots.begin(), slots.end());
+  std::set<SlotId> task = {slots[1], slots[5]};
+  SlotSet dense_total(slots.begin(), slots.end());
+  SlotSet dense_task(task.begin(), task.end());
+
+  size_t satisfied = 0;
+  auto begin = std::chrono::steady_clock::now();
+  for (size_t r = 0; r < kRound; r++) {
+    std::set<SlotId> avail;
+    std::ranges::set_difference(total, task,
+                                std::inserter(avail, avail.begin()));
+    satisfied += std::ranges::includes(total, task);
+    avail.insert(task.begin(), task.end());
+    satisfied += avail == total;
+  }
+  auto mid = std::chrono::steady_clock::now();
+  size_t dense_satisfied = 0;
+  for (size_t r = 0; r < kRound; r++) {
+    SlotSet avail = dense_total;
+    avail -= dense_task;
+    dense_satisfied += dense_total.Includes(dense_task);
+    avail |= dense_task;
+    dense_satisfied += avail == dense_total;
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  ASSERT_EQ(satisfied, dense_satisfied);
+
+  auto ns = [](auto d) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+  };
+  std::cout << "std::set<SlotId>: " << ns(mid - begin) / kRound << " ns/op\n"
+            << "SlotSet: " << ns(end - mid) / kRound << " ns/op\n";
+}
+
+namespace {
+
+ResourceInNode MakeResInNode(double cpu, uint64_t mem,
+                             const std::vector<size_t>& a100_slots,
+                             const std::vector<size_t>& h100_slots) {
+  ResourceInNode res;
+  res.allocatable_res.cpu_count = cpu_t{cpu};
+  res.allocatable_res.memory_bytes = mem;
+  res.allocatable_res.memory_sw_bytes = mem;
+  for (size_t i : a100_slots)
+    res.dedicated_res["GPU"]["A100"].insert(slots[i]);
+  for (size_t i : h100_slots)
+    res.dedicated_res["GPU"]["H100"].insert(slots[i]);
+  return res;
+}
+
+}  // namespace
+
+TEST(DENSE_RES_NODE, le_same_as_res_in_node) {
+  ResourceInNode total = MakeResInNode(64, 1024, {0, 1, 2, 3}, {4, 5, 6, 7});
+  ResourceInNodeLayout layout(total);
+  ASSERT_EQ(layout.SlotNum(), 8);
+
+  std::vector<ResourceInNode> cases = {
+      MakeResInNode(1, 1, {}, {}),
+      MakeResInNode(1, 1, {0}, {}),
+      MakeResInNode(1, 1, {0, 2}, {5}),
+      MakeResInNode(32, 512, {1}, {4}),
+      MakeResInNode(64, 1024, {0, 1}, {}),
+      MakeResInNode(65, 1, {}, {}),
+      MakeResInNode(1, 2048, {}, {7}),
+      MakeResInNode(8, 8, {3}, {4, 5, 6}),
+      MakeResInNode(0, 0, {0, 1, 2, 3}, {}),
+      total,
+  };
+
+  for (const auto& lhs : cases) {
+    for (const auto& rhs : cases) {
+      ASSERT_EQ(lhs <= rhs, layout.Encode(lhs) <= layout.Encode(rhs));
+    }
+  }
+}
+
+TEST(DENSE_RES_NODE, unknown_slots) {
+  ResourceInNode total = MakeResInNode(64, 1024, {0, 1}, {});
+  ResourceInNodeLayout layout(total);
+
+  ResourceInNode req = MakeResInNode(1, 1, {}, {4});
+  DenseResourceInNode dense_req = layout.Encode(req);
+  ASSERT_TRUE(dense_req.has_unknown_slots);
+  ASSERT_FALSE(dense_req <= layout.Encode(total));
+}
+
+TEST(DENSE_RES_NODE, arithmetic) {
+  ResourceInNode total = MakeResInNode(64, 1024, {0, 1, 2, 3}, {4, 5, 6, 7});
+  ResourceInNodeLayout layout(total);
+
+  ResourceInNode avail = total;
+  DenseResourceInNode dense_avail = layout.Encode(total);
+
+  ResourceInNode task1 = MakeResInNode(8, 128, {0, 1}, {});
+  ResourceInNode task2 = MakeResInNode(16, 256, {2}, {6});
+
+  avail -= task1;
+  dense_avail -= layout.Encode(task1);
+  ASSERT_EQ(dense_avail, layout.Encode(avail));
+
+  avail -= task2;
+  dense_avail -= layout.Encode(task2);
+  ASSERT_EQ(dense_avail, layout.Encode(avail));
+
+  avail += task1;
+  dense_avail += layout.Encode(task1);
+  ASSERT_EQ(dense_avail, layout.Encode(avail));
+
+  dense_avail.SetToZero();
+  ASSERT_TRUE(dense_avail.IsZero());
+}
+
+// Microbenchmark of the feasibility check. Run with
+// --gtest_also_run_disabled_tests --gtest_filter=DENSE_RES_NODE.*
+TEST(DENSE_RES_NODE, DISABLED_benchmark_le) {
+  constexpr size_t kEntryNum = 1024;
+  constexpr size_t kRound = 1000;
+
+  ResourceInNode total = MakeResInNode(64, 1024, {0, 1, 2, 3}, {4, 5, 6, 7});
+  ResourceInNodeLayout layout(total);
+
+  std::mt19937 gen(42);
+  std::uniform_int_distribution<size_t> dist(0, 3);
+
+  std::vector<ResourceInNode> timeline;
+  std::vector<DenseResourceInNode> dense_timeline;
+  for (size_t i = 0; i < kEntryNum; i++) {
+    std::vector<size_t> a100, h100;
+    for (size_t j = 0; j < 4; j++) {
+      if (dist(gen) != 0) a100.push_back(j);
+      if (dist(gen) != 0) h100.push_back(j + 4);
+    }
+    timeline.emplace_back(
+        MakeResInNode(static_cast<double>(dist(gen) * 16), 1024, a100, h100));
+    dense_timeline.emplace_back(layout.Encode(timeline.back()));
+  }
+
+  ResourceInNode task = MakeResInNode(8, 128, {1}, {5});
+  DenseResourceInNode dense_task = layout.Encode(task);
+
+  size_t satisfied = 0;
+  auto begin = std::chrono::steady_clock::now();
+  for (size_t r = 0; r < kRound; r++)
+    for (const auto& res : timeline) satisfied += task <= res;
+  auto mid = std::chrono::steady_clock::now();
+  size_t dense_satisfied = 0;
+  for (size_t r = 0; r < kRound; r++)
+    for (const auto& res : dense_timeline) dense_satisfied += dense_task <= res;
+  auto end = std::chrono::steady_clock::now();
+
+  ASSERT_EQ(satisfied, dense_satisfied);
+
+  auto ns = [](auto d) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+  };
+  std::cout << "ResourceInNode <=: " << ns(mid - begin) / (kEntryNum * kRound)
+            << " ns/op\n"
+            << "DenseResourceInNode <=: "
+            << ns(end - mid) / (kEntryNum * kRound) << " ns/op\n";
+}
@@ -0,0 +1,154 @@
+/**
+ * Copyright (c) 2024 Peking University and Peking University
+ * Changsha Institute for Computing and Digital Economy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "crane/Metrics.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "crane/Lock.h"
+
+using util::metrics::Histogram;
+using util::metrics::Registry;
+
+TEST(Metrics, CounterFromManyThreads) {
+  Registry registry;
+  auto* counter = registry.GetCounter("test_total", "Test counter.");
+
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 8; ++i)
+    threads.emplace_back([counter] {
+      for (int j = 0; j < 10000; ++j) counter->Inc();
+    });
+  for (auto& t : threads) t.join();
+
+  ASSERT_EQ(counter->Value(), 80000);
+  ASSERT_EQ(registry.GetCounter("test_total", ""), counter);
+}
+
+TEST(Metrics, Serialize) {
+  Registry registry;
+  registry.GetCounter("test_requests_total", "Requests.", {{"code", "OK"}})
+      ->Inc(3);
+  registry.GetGauge("test_depth", "Queue\ndepth.")->Set(-2);
+  auto* histogram =
+      registry.GetHistogram("test_seconds", "Latency.", {}, {0.1, 1});
+  histogram->Observe(0.05);
+  histogram->Observe(0.1);
+  histogram->Observe(5);
+
+  ASSERT_EQ(registry.Serialize(),
+            "# HELP test_depth Queue\\ndepth.\n"
+            "# TYPE test_depth gauge\n"
+            "test_depth -2\n"
+            "# HELP test_requests_total Requests.\n"
+            "# TYPE test_requests_total counter\n"
+            "test_requests_total{code=\"OK\"} 3\n"
+            "# HELP test_seconds Latency.\n"
+            "# TYPE test_seconds histogram\n"
+            "test_seconds_bucket{le=\"0.1\"} 2\n"
+            "test_seconds_bucket{le=\"1\"} 2\n"
+            "test_seconds_bucket{le=\"+Inf\"} 3\n"
+            "test_seconds_sum 5.15\n"
+            "test_seconds_count 3\n");
+}
+
+TEST(Metrics, Callback) {
+  Registry registry;
+  double value = 1.5;
+  auto id = registry.AddGaugeCallback("test_value", "Value.", {{"a", "\"x\""}},
+                                      [&value] { return value; });
+  // The labels are taken by the callback.
+  registry.GetGauge("test_value", "", {{"a", "\"x\""}})->Set(7);
+
+  ASSERT_EQ(registry.Serialize(),
+            "# HELP test_value Value.\n"
+            "# TYPE test_value gauge\n"
+            "test_value{a=\"\\\"x\\\"\"} 1.5\n");
+
+  registry.RemoveCallback(id);
+  ASSERT_EQ(registry.Serialize(), "");
+}
+
+TEST(Metrics, TypeConflict) {
+  Registry registry;
+  registry.GetCounter("test_metric", "Counter.")->Inc();
+  // Still usable, but not exported.
+  registry.GetGauge("test_metric", "Gauge.")->Set(5);
+
+  ASSERT_EQ(registry.Serialize(),
+            "# HELP test_metric Counter.\n"
+            "# TYPE test_metric counter\n"
+            "test_metric 1\n");
+}
+
+TEST(Metrics, LockProfiling) {
+  // Profiling stays enabled for the rest of the process.
+  static Registry registry;
+  static util::ProfiledMutex mtx("test_lock");
+  static util::rw_mutex unnamed_mtx;
+
+  { util::ProfiledMutexLock lock(&mtx); }  // Not profiled yet.
+  util::lock_profiler::Enable(&registry);
+  { util::ProfiledMutexLock lock(&mtx); }
+  { util::ProfiledReaderMutexLock lock(&mtx); }
+  { util::read_lock_guard lock(unnamed_mtx); }
+
+  // Only the named lock, once at each site and mode.
+  std::vector<std::string> count_lines;
+  std::istringstream text(registry.Serialize());
+  for (std::string line; std::getline(text, line);)
+    if (line.find("_seconds_count{") != std::string::npos)
+      count_lines.push_back(line);
+  ASSERT_EQ(count_lines.size(), 4);
+  for (const std::string& line : count_lines) {
+    ASSERT_TRUE(line.starts_with("crane_lock_wait_seconds_count") ||
+                line.starts_with("crane_lock_hold_seconds_count"));
+    ASSERT_NE(line.find("{lock=\"test_lock\",site=\"metrics_test.cpp:"),
+              std::string::npos);
+    ASSERT_TRUE(line.ends_with("mode=\"exclusive\"} 1") ||
+                line.ends_with("mode=\"shared\"} 1"));
+  }
+}
+
+TEST(Metrics, DISABLED_CounterIncBenchmark) {
+  Registry registry;
+  auto* counter = registry.GetCounter("bench_total", "Benchmark.");
+  // Per thread.
+  constexpr uint64_t kIncNum = 10'000'000;
+
+  for (int thread_num : {1, 4, 16}) {
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < thread_num; ++i)
+      threads.emplace_back([counter] {
+        for (uint64_t j = 0; j < kIncNum; ++j) counter->Inc();
+      });
+    for (auto& t : threads) t.join();
+    double ns = std::chrono::duration<double, std::nano>(
+                    std::chrono::steady_clock::now() - start)
+                    .count();
+    GTEST_LOG_(INFO) << thread_num << " threads: " << ns / kIncNum
+                     << " ns per increment";
+  }
+}
@@ -19,6 +19,8 @@
 #include <arpa/inet.h>
 #include <gtest/gtest.h>
 #include <netdb.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "crane/Network.h"
 
@@ -64,3 +66,31 @@ TEST(NetworkFunc, IsAValidIpv4Address) {
   EXPECT_TRUE(IsAValidIpv4Address(ip1));
   EXPECT_FALSE(IsAValidIpv4Address(ip2));
 }
+
+TEST(NetworkFunc, FindTcpSocketByPort) {
+  int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  ASSERT_EQ(bind(listen_fd, (sockaddr*)&addr, sizeof(addr)), 0);
+  ASSERT_EQ(listen(listen_fd, 1), 0);
+  socklen_t len = sizeof(addr);
+  getsockname(listen_fd, (sockaddr*)&addr, &len);
+
+  int client_fd = socket(AF_INET, SOCK_STREAM, 0);
+  ASSERT_EQ(connect(client_fd, (sockaddr*)&addr, sizeof(addr)), 0);
+  sockaddr_in client_addr{};
+  len = sizeof(client_addr);
+  getsockname(client_fd, (sockaddr*)&client_addr, &len);
+
+  struct stat client_stat{};
+  fstat(client_fd, &client_stat);
+
+  crane::TcpSocketInfo info{};
+  ASSERT_TRUE(crane::FindTcpSocketByPort(ntohs(client_addr.sin_port), &info));
+  EXPECT_EQ(info.inode, client_stat.st_ino);
+  EXPECT_EQ(info.uid, getuid());
+
+  close(client_fd);
+  close(listen_fd);
+}